@@ -1,10 +1,28 @@
 #include "devices/block.h"
+#include <debug.h>
+#include <kstat.h>
 #include <list.h>
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 
+/* Number of buckets in a latency histogram.  Bucket B counts
+   requests that took 2**B to 2**(B+1) - 1 ns; the last one also
+   counts longer ones. */
+#define LATENCY_BUCKETS 32
+
+/* Statistics for one direction of transfer. */
+struct block_io_stats
+  {
+    unsigned long long req_cnt;         /* Number of requests. */
+    unsigned long long seq_cnt;         /* Requests that began where
+                                           the previous one ended. */
+    uint32_t latency[LATENCY_BUCKETS];  /* Log2 ns latency histogram. */
+  };
+
 /* A block device. */
 struct block
   {
@@ -16,9 +34,20 @@ struct block
 
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
+    block_sector_t start;               /* Added to each sector number
+                                           passed to the driver. */
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Request statistics, updated with interrupts off. */
+    struct block_io_stats reads;        /* Reads. */
+    struct block_io_stats writes;       /* Writes. */
+    block_sector_t next_sector;         /* End of the last request. */
+    unsigned in_flight;                 /* Requests in progress now. */
+    unsigned max_depth;                 /* Most ever in progress. */
+    unsigned long long depth_sum;       /* Sum of IN_FLIGHT seen by
+                                           each arriving request. */
   };
 
 /* List of all block devices. */
@@ -113,6 +142,51 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Accounts for the start of a request for CNT sectors of BLOCK
+   starting at SECTOR, in the direction whose statistics are IO,
+   and returns the time it started. */
+static uint64_t
+begin_request (struct block *block, struct block_io_stats *io,
+               block_sector_t sector, size_t cnt)
+{
+  enum intr_level old_level = intr_disable ();
+
+  io->req_cnt++;
+  if (sector == block->next_sector)
+    io->seq_cnt++;
+  block->next_sector = sector + cnt;
+  block->depth_sum += block->in_flight;
+  if (++block->in_flight > block->max_depth)
+    block->max_depth = block->in_flight;
+  intr_set_level (old_level);
+
+  return clock_cycles ();
+}
+
+/* Accounts for the end of a request of BLOCK, in the direction
+   whose statistics are IO, that began at time START. */
+static void
+end_request (struct block *block, struct block_io_stats *io, uint64_t start)
+{
+  uint64_t ns = clock_cycles_to_ns (clock_cycles () - start);
+  enum intr_level old_level;
+  int b;
+
+  if (ns >> 32 != 0)
+    b = LATENCY_BUCKETS - 1;
+  else if (ns == 0)
+    b = 0;
+  else
+    b = 31 - __builtin_clz ((uint32_t) ns);
+  if (b >= LATENCY_BUCKETS)
+    b = LATENCY_BUCKETS - 1;
+
+  old_level = intr_disable ();
+  io->latency[b]++;
+  block->in_flight--;
+  intr_set_level (old_level);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +194,13 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
+  uint64_t start;
+
   check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
+  start = begin_request (block, &block->reads, sector, 1);
+  block->ops->read (block->aux, block->start + sector, buffer);
   block->read_cnt++;
+  end_request (block, &block->reads, start);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +211,85 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
+  uint64_t start;
+
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
+  start = begin_request (block, &block->writes, sector, 1);
+  block->ops->write (block->aux, block->start + sector, buffer);
   block->write_cnt++;
+  end_request (block, &block->writes, start);
+}
+
+/* Verifies that the CNT sectors starting at SECTOR are all
+   within BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
+{
+  check_sector (block, sector);
+  if (cnt > block->size - sector)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%zu, "
+           "size=%"PRDSNu")\n", block_name (block), sector, cnt,
+           block->size);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it transfer all of the sectors in
+   as few commands as possible.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+  uint64_t start;
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sectors (block, sector, cnt);
+  start = begin_request (block, &block->reads, sector, cnt);
+  if (block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, block->start + sector, cnt,
+                               buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read (block->aux, block->start + sector + i,
+                        buffer + i * BLOCK_SECTOR_SIZE);
+  block->read_cnt += cnt;
+  end_request (block, &block->reads, start);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+  uint64_t start;
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sectors (block, sector, cnt);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  start = begin_request (block, &block->writes, sector, cnt);
+  if (block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, block->start + sector, cnt,
+                                buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->write (block->aux, block->start + sector + i,
+                         buffer + i * BLOCK_SECTOR_SIZE);
+  block->write_cnt += cnt;
+  end_request (block, &block->writes, start);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,6 +313,26 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Prints the statistics IO, for requests in direction NAME that
+   moved SECTOR_CNT sectors in all. */
+static void
+print_io_stats (const char *name, const struct block_io_stats *io,
+                unsigned long long sector_cnt)
+{
+  int b;
+
+  if (io->req_cnt == 0)
+    return;
+  printf ("  %s: %llu requests, %llu bytes, %llu sequential, %llu random\n",
+          name, io->req_cnt, sector_cnt * BLOCK_SECTOR_SIZE, io->seq_cnt,
+          io->req_cnt - io->seq_cnt);
+  printf ("  %s latency, log2 ns:count:", name);
+  for (b = 0; b < LATENCY_BUCKETS; b++)
+    if (io->latency[b] != 0)
+      printf (" %d:%u", b, (unsigned) io->latency[b]);
+  printf ("\n");
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -171,13 +344,65 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
+          unsigned long long req_cnt = (block->reads.req_cnt
+                                        + block->writes.req_cnt);
+
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          print_io_stats ("read", &block->reads, block->read_cnt);
+          print_io_stats ("write", &block->writes, block->write_cnt);
+          if (req_cnt > 0)
+            printf ("  queue depth: average %llu.%02llu, max %u\n",
+                    block->depth_sum / req_cnt,
+                    block->depth_sum * 100 / req_cnt % 100,
+                    block->max_depth);
         }
     }
 }
 
+/* Copies IO, for SECTOR_CNT sectors, into *K. */
+static void
+copy_io_stats (struct kstat_io *k, const struct block_io_stats *io,
+               unsigned long long sector_cnt)
+{
+  int b;
+
+  k->req_cnt = io->req_cnt;
+  k->seq_cnt = io->seq_cnt;
+  k->sector_cnt = sector_cnt;
+  for (b = 0; b < LATENCY_BUCKETS; b++)
+    k->latency[b] = io->latency[b];
+}
+
+/* Copies the statistics for each block device used for a Pintos
+   role into *K. */
+void
+block_get_kstat (struct kstat *k)
+{
+  enum intr_level old_level;
+  int i;
+
+  ASSERT (BLOCK_ROLE_CNT == KSTAT_BLOCK_CNT);
+  ASSERT (LATENCY_BUCKETS == KSTAT_BUCKETS);
+
+  old_level = intr_disable ();
+  for (i = 0; i < BLOCK_ROLE_CNT; i++)
+    {
+      struct block *block = block_by_role[i];
+      struct kstat_block *kb = &k->block[i];
+
+      if (block == NULL)
+        continue;
+      kb->present = 1;
+      kb->max_depth = block->max_depth;
+      kb->depth_sum = block->depth_sum;
+      copy_io_stats (&kb->reads, &block->reads, block->read_cnt);
+      copy_io_stats (&kb->writes, &block->writes, block->write_cnt);
+    }
+  intr_set_level (old_level);
+}
+
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
@@ -198,8 +423,15 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
+  block->start = 0;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  memset (&block->reads, 0, sizeof block->reads);
+  memset (&block->writes, 0, sizeof block->writes);
+  block->next_sector = 0;
+  block->in_flight = 0;
+  block->max_depth = 0;
+  block->depth_sum = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +443,26 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Registers a new block device with the given NAME, TYPE, and
+   EXTRA_INFO, as block_register(), that consists of the SIZE
+   sectors of PARENT starting at sector START.  The new device
+   uses PARENT's driver directly, with its offset folded into the
+   sector numbers, so that its I/O takes no extra indirection. */
+struct block *
+block_register_slice (const char *name, enum block_type type,
+                      const char *extra_info, struct block *parent,
+                      block_sector_t start, block_sector_t size)
+{
+  struct block *block;
+
+  ASSERT (start <= parent->size && size <= parent->size - start);
+
+  block = block_register (name, type, extra_info, size, parent->ops,
+                          parent->aux);
+  block->start = parent->start + start;
+  return block;
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
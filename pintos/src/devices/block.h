@@ -21,6 +21,7 @@ typedef uint32_t block_sector_t;
 /* Higher-level interface for file systems, etc. */
 
 struct block;
+struct kstat;
 
 /* Type of a block device. */
 enum block_type
@@ -53,22 +54,38 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
 /* Statistics. */
 void block_print_stats (void);
+void block_get_kstat (struct kstat *);
 
 /* Lower-level interface to block device drivers. */
 
+/* The multi-sector operations are optional.  If a driver leaves
+   them null, block_read_multiple() and block_write_multiple()
+   transfer one sector at a time. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+struct block *block_register_slice (const char *name, enum block_type,
+                                    const char *extra_info,
+                                    struct block *parent,
+                                    block_sector_t start,
+                                    block_sector_t size);
 
 #endif /* devices/block.h */
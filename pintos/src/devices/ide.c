@@ -1,14 +1,18 @@
 #include "devices/ide.h"
 #include <ctype.h>
 #include <debug.h>
+#include <list.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +38,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +54,44 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors a single read or write command can transfer. */
+#define MAX_SECTORS_PER_COMMAND 256
+
+/* Bus master IDE registers, relative to a channel's bm_base.
+   See [BMIDE]. */
+#define BM_COMMAND 0            /* Command. */
+#define BM_STATUS 2             /* Status. */
+#define BM_PRDT 4               /* Physical address of PRD table. */
+
+/* Bus master Command Register bits. */
+#define BMC_START 0x01          /* Start transfer. */
+#define BMC_READ 0x08           /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BMS_ERROR 0x02          /* Transfer failed (write 1 to clear). */
+#define BMS_INTR 0x04           /* Disk interrupted (write 1 to clear). */
+#define BMS_KEEP 0x60           /* Drive DMA capable bits, preserved. */
+
+/* A physical region descriptor: one physically contiguous piece
+   of a DMA transfer.  A region may not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes; 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last descriptor. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Descriptors needed for the largest transfer: 128 kB split at
+   up to two 64 kB boundaries.  Aligning the table on its own size
+   keeps it from crossing a 64 kB boundary itself. */
+#define PRD_CNT 4
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +100,11 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt for READ/WRITE
+                                   MULTIPLE, or 0 if not supported. */
+    bool dma;                   /* Does the disk support DMA? */
+    block_sector_t capacity;    /* Size in sectors, once identified. */
+    char info[128];             /* Model and serial number. */
   };
 
 /* An ATA channel (aka controller).
@@ -67,10 +115,20 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
+    struct pcp_lock lock;       /* Protects queue, busy, head. */
+    struct list queue;          /* Pending `struct ide_request's, sorted
+                                   by disk and sector. */
+    bool busy;                  /* Is a thread dispatching transfers? */
+    int head_dev;               /* Device of the last transfer. */
+    block_sector_t head_sector; /* Sector after the last transfer. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    uint8_t intr_status;        /* Status read by the interrupt handler. */
+
+    uint16_t bm_base;           /* Bus master registers, 0 if no DMA. */
+    struct prd prdt[PRD_CNT]    /* PRD table for bus master DMA. */
+      __attribute__ ((aligned (sizeof (struct prd) * PRD_CNT)));
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
@@ -81,28 +139,49 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+static void find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
+static thread_func probe_channel;
 static void identify_ata_device (struct ata_disk *);
+static void register_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, int cnt);
+static bool dma_usable (const struct ata_disk *, const void *buffer);
+static void dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *buffer, bool write);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void input_sectors (struct channel *, void *, size_t cnt);
+static void output_sectors (struct channel *, const void *, size_t cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
+static uint8_t wait_for_interrupt (const struct ata_disk *);
+static bool wait_for_drq (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
-/* Initialize the disk subsystem and detect disks. */
+/* Completed by each probe_channel() thread when it finishes. */
+static struct completion probed;
+
+/* Initialize the disk subsystem and detect disks.  Resetting a
+   channel and waiting for its devices takes long, doubly so for
+   devices that are not there, so each channel is probed by a
+   thread of its own.  The disks are registered afterward, in
+   channel order, so that their order does not depend on which
+   probe finished first. */
 void
 ide_init (void) 
 {
   size_t chan_no;
 
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    channels[chan_no].bm_base = 0;
+  find_bus_master ();
+
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -123,7 +202,11 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
+      pcp_lock_init (&c->lock, PRI_MAX);
+      list_init (&c->queue);
+      c->busy = false;
+      c->head_dev = 0;
+      c->head_sector = 0;
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
  
@@ -136,27 +219,100 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
       intr_register_ext (c->irq, interrupt_handler, c->name);
+    }
+
+  completion_init (&probed);
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
 
-      /* Reset hardware. */
-      reset_channel (c);
+      if (thread_create (c->name, PRI_DEFAULT, probe_channel, c)
+          == TID_ERROR)
+        probe_channel (c);
+    }
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    wait_for_completion (&probed);
 
-      /* Distinguish ATA hard disks from other devices. */
-      if (check_device_type (&c->devices[0]))
-        check_device_type (&c->devices[1]);
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+      int dev_no;
 
-      /* Read hard disk identity information. */
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
-          identify_ata_device (&c->devices[dev_no]);
+          register_ata_device (&c->devices[dev_no]);
     }
 }
+
+/* Resets channel C_ and identifies the disks on it. */
+static void
+probe_channel (void *c_) 
+{
+  struct channel *c = c_;
+  int dev_no;
+
+  /* Reset hardware. */
+  reset_channel (c);
+
+  /* Distinguish ATA hard disks from other devices. */
+  if (check_device_type (&c->devices[0]))
+    check_device_type (&c->devices[1]);
+
+  /* Read hard disk identity information. */
+  for (dev_no = 0; dev_no < 2; dev_no++)
+    if (c->devices[dev_no].is_ata)
+      identify_ata_device (&c->devices[dev_no]);
+
+  complete (&probed);
+}
 
 /* Disk detection and identification. */
 
+/* Looks for a PCI IDE controller that can act as a bus master
+   and, for each legacy channel it drives, records the channel's
+   bus master registers so that transfers can use DMA. */
+static void
+find_bus_master (void)
+{
+  struct pci_device pci;
+  uint32_t prog_if;
+  uint16_t base;
+  size_t chan_no;
+
+  /* Class 1, subclass 1 is an IDE controller.  Bit 7 of its
+     programming interface says whether it can be a bus master. */
+  if (!pci_find_class (0x01, 0x01, 0, &pci))
+    return;
+  prog_if = (pci_read_config (&pci, PCI_REG_CLASS) >> 8) & 0xff;
+  if ((prog_if & 0x80) == 0)
+    return;
+
+  /* BAR 4 holds the I/O base of the bus master registers, 8
+     bytes per channel. */
+  base = pci_read_config (&pci, PCI_REG_BAR0 + 4 * 4) & 0xfffc;
+  if (base == 0)
+    return;
+  pci_enable_bus_master (&pci);
+
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      /* Bits 0 and 2 are set for a channel in native PCI mode,
+         which does not use the legacy ports we drive. */
+      if ((prog_if & (1 << (2 * chan_no))) == 0)
+        {
+          channels[chan_no].bm_base = base + 8 * chan_no;
+          printf ("ide%zu: bus master DMA at port 0x%04"PRIx16"\n",
+                  chan_no, channels[chan_no].bm_base);
+        }
+    }
+}
+
 static char *descramble_ata_string (char *, int size);
 
 /* Resets an ATA channel and waits for any devices present on it
@@ -254,8 +410,8 @@ check_device_type (struct ata_disk *d)
 }
 
 /* Sends an IDENTIFY DEVICE command to disk D and reads the
-   response.  Registers the disk with the block device
-   layer. */
+   response.  Leaves D's is_ata set only if the disk is one to
+   register with register_ata_device(). */
 static void
 identify_ata_device (struct ata_disk *d) 
 {
@@ -263,8 +419,6 @@ identify_ata_device (struct ata_disk *d)
   char id[BLOCK_SECTOR_SIZE];
   block_sector_t capacity;
   char *model, *serial;
-  char extra_info[128];
-  struct block *block;
 
   ASSERT (d->is_ata);
 
@@ -273,20 +427,19 @@ identify_ata_device (struct ata_disk *d)
      into our buffer. */
   select_device_wait (d);
   issue_pio_command (c, CMD_IDENTIFY_DEVICE);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
+  if (!(wait_for_interrupt (d) & STA_DRQ))
     {
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
-  snprintf (extra_info, sizeof extra_info,
+  snprintf (d->info, sizeof d->info,
             "model \"%s\", serial \"%s\"", model, serial);
 
   /* Disable access to IDE disks over 1 GB, which are likely
@@ -303,8 +456,25 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
-  /* Register. */
-  block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
+  /* Word 49, bit 8 says whether the disk supports DMA. */
+  d->dma = (id[49 * 2 + 1] & 0x01) != 0;
+
+  /* Let READ/WRITE MULTIPLE transfer as many sectors per
+     interrupt as the disk allows (word 47, bits 7:0). */
+  if ((id[47 * 2] & 0xff) != 0)
+    set_multiple_mode (d, id[47 * 2] & 0xff);
+
+  d->capacity = capacity;
+}
+
+/* Registers disk D, identified by identify_ata_device(), with the
+   block device layer, along with its partitions. */
+static void
+register_ata_device (struct ata_disk *d) 
+{
+  struct block *block;
+
+  block = block_register (d->name, BLOCK_RAW, d->info, d->capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
@@ -337,23 +507,363 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
+/* Sends SET MULTIPLE MODE to disk D, asking for CNT sectors per
+   interrupt in READ/WRITE MULTIPLE.  If the disk refuses, those
+   commands are not used. */
+static void
+set_multiple_mode (struct ata_disk *d, int cnt)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  d->multiple = wait_for_interrupt (d) & STA_ERR ? 0 : cnt;
+}
+
+/* Returns true if a transfer between disk D and BUFFER can use
+   bus master DMA.  The controller needs BUFFER's physical
+   address, so it must be in kernel memory, and word aligned. */
+static bool
+dma_usable (const struct ata_disk *d, const void *buffer)
+{
+  return (d->dma && d->channel->bm_base != 0
+          && is_kernel_vaddr (buffer) && ((uintptr_t) buffer & 1) == 0);
+}
+
+/* Transfers CNT sectors between disk D, starting at SEC_NO, and
+   BUFFER, using bus master DMA.  WRITE selects the direction.
+   The calling thread sleeps until the disk interrupts on
+   completion; the CPU is free for other threads meanwhile.  D's
+   channel must be busy with this transfer. */
+static void
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  uintptr_t phys = vtop (buffer);
+  size_t size = cnt * BLOCK_SECTOR_SIZE;
+  uint8_t direction = write ? 0 : BMC_READ;
+  uint8_t bm_status;
+  size_t i;
+
+  ASSERT (c->busy);
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_COMMAND);
+
+  /* Describe BUFFER, split at 64 kB boundaries.  Kernel virtual
+     memory maps physical memory linearly, so BUFFER is
+     physically contiguous. */
+  for (i = 0; size > 0; i++)
+    {
+      size_t chunk = 0x10000 - (phys & 0xffff);
+      if (chunk > size)
+        chunk = size;
+
+      ASSERT (i < PRD_CNT);
+      c->prdt[i].addr = phys;
+      c->prdt[i].size = chunk & 0xffff;
+      c->prdt[i].flags = 0;
+      phys += chunk;
+      size -= chunk;
+    }
+  c->prdt[i - 1].flags = PRD_EOT;
+
+  /* Program the bus master, then the disk, then start. */
+  outl (c->bm_base + BM_PRDT, vtop (c->prdt));
+  outb (c->bm_base + BM_COMMAND, direction);
+  bm_status = inb (c->bm_base + BM_STATUS);
+  outb (c->bm_base + BM_STATUS,
+        (bm_status & BMS_KEEP) | BMS_ERROR | BMS_INTR);
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (c->bm_base + BM_COMMAND, direction | BMC_START);
+
+  sema_down (&c->completion_wait);
+
+  /* Stop the bus master and check for errors. */
+  outb (c->bm_base + BM_COMMAND, direction);
+  bm_status = inb (c->bm_base + BM_STATUS);
+  outb (c->bm_base + BM_STATUS,
+        (bm_status & BMS_KEEP) | BMS_ERROR | BMS_INTR);
+  if ((bm_status & BMS_ERROR) || (inb (reg_alt_status (c)) & STA_ERR))
+    PANIC ("%s: DMA %s failed, sector=%"PRDSNu,
+           d->name, write ? "write" : "read", sec_no);
+}
+
+/* Transfers CNT sectors between disk D, starting at SEC_NO, and
+   BUFFER.  WRITE selects the direction.  Each command moves up
+   to MAX_SECTORS_PER_COMMAND sectors, by bus master DMA if
+   possible and otherwise by PIO, using READ/WRITE MULTIPLE to
+   take one interrupt per D->multiple sectors when the disk
+   supports it.  D's channel must be busy with this transfer. */
+static void
+transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+          uint8_t *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  size_t per_intr = d->multiple > 0 ? d->multiple : 1;
+
+  ASSERT (c->busy);
+
+  while (cnt > 0)
+    {
+      size_t cmd_cnt = (cnt < MAX_SECTORS_PER_COMMAND
+                        ? cnt : MAX_SECTORS_PER_COMMAND);
+      size_t left;
+
+      if (dma_usable (d, buffer))
+        dma_transfer (d, sec_no, cmd_cnt, buffer, write);
+      else if (!write)
+        {
+          select_sector (d, sec_no, cmd_cnt);
+          issue_pio_command (c, (cmd_cnt > 1 && d->multiple > 0
+                                 ? CMD_READ_MULTIPLE
+                                 : CMD_READ_SECTOR_RETRY));
+          for (left = cmd_cnt; left > 0; )
+            {
+              size_t block_cnt = left < per_intr ? left : per_intr;
+
+              if ((wait_for_interrupt (d) & (STA_DRQ | STA_ERR)) != STA_DRQ)
+                PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                       d->name, sec_no + (cmd_cnt - left));
+              input_sectors (c, buffer + (cmd_cnt - left) * BLOCK_SECTOR_SIZE,
+                             block_cnt);
+              left -= block_cnt;
+            }
+        }
+      else
+        {
+          select_sector (d, sec_no, cmd_cnt);
+          issue_pio_command (c, (cmd_cnt > 1 && d->multiple > 0
+                                 ? CMD_WRITE_MULTIPLE
+                                 : CMD_WRITE_SECTOR_RETRY));
+          if (!wait_for_drq (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
+          for (left = cmd_cnt; left > 0; )
+            {
+              size_t block_cnt = left < per_intr ? left : per_intr;
+              uint8_t status;
+
+              /* The disk interrupts after each block: to ask for
+                 the next one, or, after the last, to report
+                 completion. */
+              output_sectors (c, buffer + (cmd_cnt - left) * BLOCK_SECTOR_SIZE,
+                              block_cnt);
+              status = wait_for_interrupt (d);
+              left -= block_cnt;
+              if ((status & STA_ERR)
+                  || (left > 0 && !(status & STA_DRQ)))
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, sec_no + (cmd_cnt - left));
+            }
+        }
+
+      buffer += cmd_cnt * BLOCK_SECTOR_SIZE;
+      sec_no += cmd_cnt;
+      cnt -= cmd_cnt;
+    }
+}
+
+/* Request scheduling.
+
+   Each channel keeps its pending transfers in one queue, sorted
+   by disk and then by sector, and runs one transfer at a time.
+   A thread that finds its channel idle becomes the channel's
+   dispatcher: it runs queued transfers in elevator order until
+   its own is done, then hands the job to the owner of the next
+   transfer, who is waiting anyway.
+
+   The elevator is C-LOOK: it takes the first transfer at or past
+   the position where the last one ended, wrapping around to the
+   lowest one at the end of the queue.  A transfer that has waited
+   past its deadline goes first, so that a stream of requests in
+   one area of the disk cannot starve the rest.  Transfers that
+   continue each other both on disk and in memory, in the same
+   direction, are merged into one. */
+
+/* Ticks a read or a write may wait before it is served out of
+   elevator order. */
+#define READ_DEADLINE (TIMER_FREQ / 2)
+#define WRITE_DEADLINE (5 * TIMER_FREQ)
+
+/* A transfer waiting in a channel's queue. */
+struct ide_request
+  {
+    struct list_elem elem;      /* Element in channel's queue. */
+    struct ata_disk *disk;      /* Disk to transfer with. */
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    uint8_t *buffer;            /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                 /* True to write, false to read. */
+    int64_t deadline;           /* Tick at which to stop waiting. */
+    bool done;                  /* Has the transfer finished? */
+    struct semaphore wakeup;    /* Up'd when done or made dispatcher. */
+  };
+
+/* Orders requests by disk, then by sector. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct ide_request *a = list_entry (a_, struct ide_request, elem);
+  const struct ide_request *b = list_entry (b_, struct ide_request, elem);
+
+  if (a->disk->dev_no != b->disk->dev_no)
+    return a->disk->dev_no < b->disk->dev_no;
+  return a->sector < b->sector;
+}
+
+/* Returns the request that channel C should serve next.  C's
+   queue must not be empty and C's lock must be held. */
+static struct ide_request *
+pick_request (struct channel *c)
+{
+  int64_t now = timer_ticks ();
+  struct ide_request *oldest = NULL;
+  struct list_elem *e;
+
+  ASSERT (!list_empty (&c->queue));
+
+  for (e = list_begin (&c->queue); e != list_end (&c->queue);
+       e = list_next (e))
+    {
+      struct ide_request *r = list_entry (e, struct ide_request, elem);
+      if (r->deadline <= now
+          && (oldest == NULL || r->deadline < oldest->deadline))
+        oldest = r;
+    }
+  if (oldest != NULL)
+    return oldest;
+
+  for (e = list_begin (&c->queue); e != list_end (&c->queue);
+       e = list_next (e))
+    {
+      struct ide_request *r = list_entry (e, struct ide_request, elem);
+      if (r->disk->dev_no > c->head_dev
+          || (r->disk->dev_no == c->head_dev && r->sector >= c->head_sector))
+        return r;
+    }
+  return list_entry (list_front (&c->queue), struct ide_request, elem);
+}
+
+/* Runs request R on channel C, merged with the requests after it
+   in the queue that continue it, then marks them all done and
+   wakes their owners.  C's lock must be held; it is released
+   during the transfer itself. */
+static void
+run_request (struct channel *c, struct ide_request *r)
+{
+  struct list batch;
+  struct list_elem *e;
+  size_t cnt = r->cnt;
+
+  for (e = list_next (&r->elem); e != list_end (&c->queue);
+       e = list_next (e))
+    {
+      struct ide_request *next = list_entry (e, struct ide_request, elem);
+      if (next->disk != r->disk || next->write != r->write
+          || next->sector != r->sector + cnt
+          || next->buffer != r->buffer + cnt * BLOCK_SECTOR_SIZE
+          || cnt + next->cnt > MAX_SECTORS_PER_COMMAND)
+        break;
+      cnt += next->cnt;
+    }
+
+  /* Take the batch off the queue before dropping the lock, so that
+     new requests cannot be inserted into the middle of it. */
+  list_init (&batch);
+  list_splice (list_end (&batch), &r->elem, e);
+  c->head_dev = r->disk->dev_no;
+  c->head_sector = r->sector + cnt;
+  pcp_lock_release (&c->lock);
+
+  transfer (r->disk, r->sector, cnt, r->buffer, r->write);
+
+  pcp_lock_acquire (&c->lock);
+  while (!list_empty (&batch))
+    {
+      struct ide_request *done = list_entry (list_pop_front (&batch),
+                                             struct ide_request, elem);
+      done->done = true;
+      sema_up (&done->wakeup);
+    }
+}
+
+/* Queues a transfer of CNT sectors between disk D, starting at
+   SEC_NO, and BUFFER, and returns when it is complete.  WRITE
+   selects the direction. */
+static void
+submit (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+        void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  struct ide_request r;
+
+  r.disk = d;
+  r.sector = sec_no;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.write = write;
+  r.deadline = timer_ticks () + (write ? WRITE_DEADLINE : READ_DEADLINE);
+  r.done = false;
+  sema_init (&r.wakeup, 0);
+
+  pcp_lock_acquire (&c->lock);
+  list_insert_ordered (&c->queue, &r.elem, request_less, NULL);
+  if (c->busy)
+    {
+      /* Wait for the dispatcher to run R or to make us the
+         dispatcher. */
+      pcp_lock_release (&c->lock);
+      sema_down (&r.wakeup);
+      if (r.done)
+        return;
+      pcp_lock_acquire (&c->lock);
+    }
+  else
+    c->busy = true;
+
+  while (!r.done)
+    run_request (c, pick_request (c));
+
+  /* Pass the channel on, or leave it idle. */
+  if (!list_empty (&c->queue))
+    sema_up (&pick_request (c)->wakeup);
+  else
+    c->busy = false;
+  pcp_lock_release (&c->lock);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multiple (void *d, block_sector_t sec_no, size_t cnt, void *buffer)
+{
+  submit (d, sec_no, cnt, buffer, false);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the disk has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d, block_sector_t sec_no, size_t cnt,
+                    const void *buffer)
+{
+  submit (d, sec_no, cnt, (void *) buffer, true);
+}
+
 /* Reads sector SEC_NO from disk D into BUFFER, which must have
    room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read (void *d, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_read_multiple (d, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -362,38 +872,33 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  ide_write_multiple (d, sec_no, 1, buffer);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the count of CNT sectors to the disk's
+   sector selection registers.  (We use LBA mode.)  A count of
+   256 is written as 0. */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_COMMAND);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt & 0xff);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -414,20 +919,21 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, size_t cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Writes CNT sectors from SECTORS to channel C's data register in
+   PIO mode.  SECTORS must contain CNT * BLOCK_SECTOR_SIZE bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, size_t cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
@@ -479,6 +985,50 @@ wait_while_busy (const struct ata_disk *d)
   return false;
 }
 
+/* Sleeps until disk D's channel interrupts, then returns the
+   status the interrupt handler read.  The disk has already
+   cleared BSY when it interrupts, so this normally involves no
+   polling at all; a disk that has not is waited on as by
+   wait_while_busy(). */
+static uint8_t
+wait_for_interrupt (const struct ata_disk *d) 
+{
+  struct channel *c = d->channel;
+
+  sema_down (&c->completion_wait);
+  if (c->intr_status & STA_BSY)
+    {
+      wait_while_busy (d);
+      return inb (reg_alt_status (c));
+    }
+  return c->intr_status;
+}
+
+/* Waits for disk D to ask for the first block of data after a
+   write command and returns true, or returns false on error.
+   ATA disks do not interrupt for the first block, only for later
+   ones, but they raise DRQ within microseconds, so a few reads
+   of the alternate status register almost always see it; a disk
+   that is slower than that is waited on as by wait_while_busy(),
+   which sleeps. */
+static bool
+wait_for_drq (const struct ata_disk *d) 
+{
+  struct channel *c = d->channel;
+  int i;
+
+  timer_nsleep (400);
+  for (i = 0; i < 16; i++) 
+    {
+      uint8_t status = inb (reg_alt_status (c));
+      if (status & STA_ERR)
+        return false;
+      if (!(status & STA_BSY))
+        return (status & STA_DRQ) != 0;
+    }
+  return wait_while_busy (d);
+}
+
 /* Program D's channel so that D is now the selected disk. */
 static void
 select_device (const struct ata_disk *d)
@@ -513,7 +1063,7 @@ interrupt_handler (struct intr_frame *f)
       {
         if (c->expecting_interrupt) 
           {
-            inb (reg_status (c));               /* Acknowledge interrupt. */
+            c->intr_status = inb (reg_status (c)); /* Acknowledge. */
             sema_up (&c->completion_wait);      /* Wake up waiter. */
           }
         else
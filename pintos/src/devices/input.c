@@ -1,16 +1,42 @@
 #include "devices/input.h"
 #include <debug.h>
-#include "devices/intq.h"
 #include "devices/serial.h"
+#include "devices/spsc.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
 
-/* Stores keys from the keyboard and serial port. */
-static struct intq buffer;
+/* Stores keys from the keyboard and serial port.  The keyboard
+   and serial interrupt handlers take turns as the producer, and
+   the thread reading the console is the consumer, so neither side
+   turns interrupts off to use it. */
+#define INPUT_BUFSIZE 64
+static struct spsc_ring buffer;
+static uint8_t buffer_data[INPUT_BUFSIZE];
+
+/* Upped when a key arrives in an empty buffer. */
+static struct semaphore key_sema;
+
+/* Serializes readers, so that the buffer has one consumer. */
+static struct lock reader_lock;
+
+/* Set when the serial driver finds the buffer full, and stops
+   taking bytes from the port until serial_notify(). */
+static volatile bool full_seen;
+
+/* Woken whenever a key arrives. */
+static struct wait_queue pollers;
+
+static spsc_notify_func key_arrived;
 
 /* Initializes the input buffer. */
 void
 input_init (void) 
 {
-  intq_init (&buffer);
+  sema_init (&key_sema, 0);
+  lock_init (&reader_lock);
+  spsc_init (&buffer, buffer_data, 1, sizeof buffer_data,
+             key_arrived, NULL);
+  wait_queue_init (&pollers);
 }
 
 /* Adds a key to the input buffer.
@@ -19,10 +45,10 @@ void
 input_putc (uint8_t key) 
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  ASSERT (!intq_full (&buffer));
 
-  intq_putc (&buffer, key);
-  serial_notify ();
+  if (!spsc_push (&buffer, &key))
+    NOT_REACHED ();
+  wait_queue_wake (&pollers);
 }
 
 /* Retrieves a key from the input buffer.
@@ -30,17 +56,44 @@ input_putc (uint8_t key)
 uint8_t
 input_getc (void) 
 {
-  enum intr_level old_level;
   uint8_t key;
 
-  old_level = intr_disable ();
-  key = intq_getc (&buffer);
-  serial_notify ();
-  intr_set_level (old_level);
-  
+  input_read (&key, 1, true);
   return key;
 }
 
+/* Retrieves up to SIZE keys from the input buffer into KEYS, as
+   many as are there, and returns the number retrieved.  If the
+   buffer is empty and BLOCK is true, first waits for a key to be
+   pressed, so that at least one is returned if SIZE is nonzero. */
+size_t
+input_read (uint8_t *keys, size_t size, bool block) 
+{
+  size_t cnt = 0;
+
+  if (size == 0)
+    return 0;
+
+  lock_acquire (&reader_lock);
+  if (block)
+    while (spsc_empty (&buffer))
+      sema_down (&key_sema);
+  while (cnt < size && spsc_pop (&buffer, keys + cnt))
+    cnt++;
+  lock_release (&reader_lock);
+
+  /* Let the serial port deliver bytes again, now that there is
+     room for them. */
+  if (full_seen)
+    {
+      enum intr_level old_level = intr_disable ();
+      full_seen = false;
+      serial_notify ();
+      intr_set_level (old_level);
+    }
+  return cnt;
+}
+
 /* Returns true if the input buffer is full,
    false otherwise.
    Interrupts must be off. */
@@ -48,5 +101,30 @@ bool
 input_full (void) 
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  return intq_full (&buffer);
+  if (!spsc_full (&buffer))
+    return false;
+  full_seen = true;
+  return true;
+}
+
+/* Returns true if the input buffer is empty, so that
+   input_getc() would wait. */
+bool
+input_empty (void) 
+{
+  return spsc_empty (&buffer);
+}
+
+/* Returns the wait queue that is woken whenever a key arrives. */
+struct wait_queue *
+input_wait_queue (void) 
+{
+  return &pollers;
+}
+
+/* Wakes the thread waiting in input_getc(), if any. */
+static void
+key_arrived (void *aux UNUSED) 
+{
+  sema_up (&key_sema);
 }
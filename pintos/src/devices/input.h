@@ -2,11 +2,17 @@
 #define DEVICES_INPUT_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+struct wait_queue;
+
 void input_init (void);
 void input_putc (uint8_t);
 uint8_t input_getc (void);
+size_t input_read (uint8_t *, size_t, bool block);
 bool input_full (void);
+bool input_empty (void);
+struct wait_queue *input_wait_queue (void);
 
 #endif /* devices/input.h */
@@ -1,17 +1,24 @@
 #include "devices/intq.h"
 #include <debug.h>
+#include <string.h>
 #include "threads/thread.h"
 
-static int next (int pos);
+static size_t next (const struct intq *, size_t pos);
 static void wait (struct intq *q, struct thread **waiter);
 static void signal (struct intq *q, struct thread **waiter);
 
-/* Initializes interrupt queue Q. */
+/* Initializes interrupt queue Q to use the SIZE bytes in BUF.
+   Q holds at most SIZE - 1 bytes at a time. */
 void
-intq_init (struct intq *q) 
+intq_init (struct intq *q, uint8_t *buf, size_t size) 
 {
+  ASSERT (buf != NULL);
+  ASSERT (size >= 2);
+
   lock_init (&q->lock);
   q->not_full = q->not_empty = NULL;
+  q->buf = buf;
+  q->size = size;
   q->head = q->tail = 0;
 }
 
@@ -28,7 +35,7 @@ bool
 intq_full (const struct intq *q) 
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  return next (q->head) == q->tail;
+  return next (q, q->head) == q->tail;
 }
 
 /* Removes a byte from Q and returns it.
@@ -49,7 +56,7 @@ intq_getc (struct intq *q)
     }
   
   byte = q->buf[q->tail];
-  q->tail = next (q->tail);
+  q->tail = next (q, q->tail);
   signal (q, &q->not_full);
   return byte;
 }
@@ -70,15 +77,65 @@ intq_putc (struct intq *q, uint8_t byte)
     }
 
   q->buf[q->head] = byte;
-  q->head = next (q->head);
+  q->head = next (q, q->head);
   signal (q, &q->not_empty);
 }
 
-/* Returns the position after POS within an intq. */
-static int
-next (int pos) 
+/* Removes up to SIZE bytes from Q into BUF, without sleeping,
+   and returns the number removed, which is 0 if Q is empty.
+   Copies each contiguous run of the ring at once. */
+size_t
+intq_get_buf (struct intq *q, uint8_t *buf, size_t size) 
+{
+  size_t cnt = 0;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  while (cnt < size && !intq_empty (q))
+    {
+      size_t run = (q->head >= q->tail ? q->head : q->size) - q->tail;
+      if (run > size - cnt)
+        run = size - cnt;
+      memcpy (buf + cnt, q->buf + q->tail, run);
+      q->tail = (q->tail + run) % q->size;
+      cnt += run;
+    }
+  if (cnt > 0)
+    signal (q, &q->not_full);
+  return cnt;
+}
+
+/* Adds up to SIZE bytes from BUF to the end of Q, without
+   sleeping, and returns the number added, which is 0 if Q is
+   full.  Copies each contiguous run of the ring at once. */
+size_t
+intq_put_buf (struct intq *q, const uint8_t *buf, size_t size) 
+{
+  size_t cnt = 0;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  while (cnt < size && !intq_full (q))
+    {
+      /* One slot stays free to tell a full queue from an empty
+         one. */
+      size_t run = (q->tail > q->head
+                    ? q->tail - 1
+                    : q->size - (q->tail == 0)) - q->head;
+      if (run > size - cnt)
+        run = size - cnt;
+      memcpy (q->buf + q->head, buf + cnt, run);
+      q->head = (q->head + run) % q->size;
+      cnt += run;
+    }
+  if (cnt > 0)
+    signal (q, &q->not_empty);
+  return cnt;
+}
+
+/* Returns the position after POS within Q. */
+static size_t
+next (const struct intq *q, size_t pos) 
 {
-  return (pos + 1) % INTQ_BUFSIZE;
+  return pos + 1 < q->size ? pos + 1 : 0;
 }
 
 /* WAITER must be the address of Q's not_empty or not_full
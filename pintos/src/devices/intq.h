@@ -17,7 +17,9 @@
    protect kernel threads from one another, not from interrupt
    handlers. */
 
-/* Queue buffer size, in bytes. */
+/* Default queue buffer size, in bytes.  Each queue's buffer is
+   supplied to intq_init(), so a queue that sees bursts can have a
+   larger one. */
 #define INTQ_BUFSIZE 64
 
 /* A circular queue of bytes. */
@@ -29,15 +31,18 @@ struct intq
     struct thread *not_empty;   /* Thread waiting for not-empty condition. */
 
     /* Queue. */
-    uint8_t buf[INTQ_BUFSIZE];  /* Buffer. */
-    int head;                   /* New data is written here. */
-    int tail;                   /* Old data is read here. */
+    uint8_t *buf;               /* Buffer. */
+    size_t size;                /* Size of `buf', in bytes. */
+    size_t head;                /* New data is written here. */
+    size_t tail;                /* Old data is read here. */
   };
 
-void intq_init (struct intq *);
+void intq_init (struct intq *, uint8_t *buf, size_t size);
 bool intq_empty (const struct intq *);
 bool intq_full (const struct intq *);
 uint8_t intq_getc (struct intq *);
 void intq_putc (struct intq *, uint8_t);
+size_t intq_get_buf (struct intq *, uint8_t *, size_t);
+size_t intq_put_buf (struct intq *, const uint8_t *, size_t);
 
 #endif /* devices/intq.h */
@@ -0,0 +1,130 @@
+#include "devices/ioapic.h"
+#include <debug.h>
+#include <stddef.h>
+#include "devices/lapic.h"
+
+/* Interface to the I/O APIC, which takes the interrupt lines of
+   the devices and sends each one, as a message over the APIC bus,
+   to the local APIC of a chosen CPU.  The kernel uses it in place
+   of the 8259A PICs once there is more than one CPU, so that a
+   device's interrupts can go to a CPU other than the boot CPU
+   (see intr_set_irq_affinity()).  Only one IOAPIC is used, the
+   first in the MP configuration table, which on a PC has the ISA
+   interrupt lines.  Refer to [82093AA] for details. */
+
+/* Registers, reached by writing the register's index to IOREGSEL
+   and then reading or writing IOWIN, as offsets into the
+   IOAPIC's memory-mapped registers. */
+#define IOREGSEL 0x00           /* Register select. */
+#define IOWIN 0x10              /* Register window. */
+
+/* Register indexes. */
+#define IOAPIC_VER 0x01         /* Version and entry count. */
+#define IOAPIC_REDTBL 0x10      /* Redirection table, 2 per pin. */
+
+/* Redirection table entry bits, low half.  Fixed delivery in
+   physical destination mode is all zeros. */
+#define RED_ACTIVE_LOW 0x2000   /* Polarity: active low. */
+#define RED_LEVEL 0x8000        /* Trigger mode: level. */
+#define RED_MASKED 0x10000      /* Interrupt masked. */
+
+/* Number of ISA IRQ lines. */
+#define IRQ_CNT 16
+
+/* IOAPIC registers, or a null pointer if there is no IOAPIC. */
+static volatile uint32_t *ioapic;
+
+/* Number of input pins. */
+static int pin_cnt;
+
+/* Input pin of each ISA IRQ, and how it signals, as
+   IOAPIC_* flags.  ISA interrupts are edge triggered and active
+   high, and IRQ N is on pin N unless the MP configuration table
+   says otherwise. */
+static struct
+  {
+    int pin;
+    int flags;
+  }
+irqs[IRQ_CNT];
+
+static inline uint32_t
+ioapic_read (unsigned reg)
+{
+  ioapic[IOREGSEL / sizeof *ioapic] = reg;
+  return ioapic[IOWIN / sizeof *ioapic];
+}
+
+static inline void
+ioapic_write (unsigned reg, uint32_t value)
+{
+  ioapic[IOREGSEL / sizeof *ioapic] = reg;
+  ioapic[IOWIN / sizeof *ioapic] = value;
+}
+
+/* Maps the IOAPIC registers, at physical address PADDR, and masks
+   all of its pins. */
+void
+ioapic_init (uintptr_t paddr)
+{
+  int irq, pin;
+
+  ioapic = apic_map (paddr);
+  pin_cnt = ((ioapic_read (IOAPIC_VER) >> 16) & 0xff) + 1;
+  for (pin = 0; pin < pin_cnt; pin++)
+    ioapic_write (IOAPIC_REDTBL + 2 * pin, RED_MASKED);
+  for (irq = 0; irq < IRQ_CNT; irq++)
+    {
+      irqs[irq].pin = irq;
+      irqs[irq].flags = 0;
+    }
+}
+
+/* Returns true if ioapic_init() has found an IOAPIC. */
+bool
+ioapic_present (void)
+{
+  return ioapic != NULL;
+}
+
+/* Records that ISA IRQ arrives on input PIN, signalling as given
+   by FLAGS, a combination of IOAPIC_* flags.  Called only for
+   IRQs that the MP configuration table places differently from
+   the default. */
+void
+ioapic_set_irq_pin (int irq, int pin, int flags)
+{
+  ASSERT (irq >= 0 && irq < IRQ_CNT);
+
+  if (pin < pin_cnt)
+    {
+      irqs[irq].pin = pin;
+      irqs[irq].flags = flags;
+    }
+}
+
+/* Sends IRQ to the CPU whose local APIC ID is APIC_ID, at vector
+   VEC, or masks it if MASKED is true. */
+void
+ioapic_route (int irq, uint8_t vec, unsigned apic_id, bool masked)
+{
+  uint32_t low = vec;
+  int pin;
+
+  ASSERT (ioapic != NULL);
+  ASSERT (irq >= 0 && irq < IRQ_CNT);
+
+  pin = irqs[irq].pin;
+  if (irqs[irq].flags & IOAPIC_LEVEL)
+    low |= RED_LEVEL;
+  if (irqs[irq].flags & IOAPIC_ACTIVE_LOW)
+    low |= RED_ACTIVE_LOW;
+  if (masked)
+    low |= RED_MASKED;
+
+  /* Mask the pin while it changes, so that no interrupt goes out
+     with half of the entry old and half new. */
+  ioapic_write (IOAPIC_REDTBL + 2 * pin, RED_MASKED);
+  ioapic_write (IOAPIC_REDTBL + 2 * pin + 1, apic_id << 24);
+  ioapic_write (IOAPIC_REDTBL + 2 * pin, low);
+}
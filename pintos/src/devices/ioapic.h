@@ -0,0 +1,16 @@
+#ifndef DEVICES_IOAPIC_H
+#define DEVICES_IOAPIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* How an IOAPIC input pin signals, for ioapic_set_irq_pin(). */
+#define IOAPIC_LEVEL 0x1        /* Level triggered, not edge. */
+#define IOAPIC_ACTIVE_LOW 0x2   /* Active low, not high. */
+
+void ioapic_init (uintptr_t paddr);
+bool ioapic_present (void);
+void ioapic_set_irq_pin (int irq, int pin, int flags);
+void ioapic_route (int irq, uint8_t vec, unsigned apic_id, bool masked);
+
+#endif /* devices/ioapic.h */
@@ -1,6 +1,7 @@
 #include "devices/kbd.h"
 #include <ctype.h>
 #include <debug.h>
+#include <kstat.h>
 #include <stdio.h>
 #include <string.h>
 #include "devices/input.h"
@@ -39,6 +40,15 @@ kbd_print_stats (void)
 {
   printf ("Keyboard: %lld keys pressed\n", key_cnt);
 }
+
+/* Copies the keyboard's key count into *K. */
+void
+kbd_get_kstat (struct kstat *k)
+{
+  enum intr_level old_level = intr_disable ();
+  k->keys = key_cnt;
+  intr_set_level (old_level);
+}
 
 /* Maps a set of contiguous scancodes into characters. */
 struct keymap
@@ -0,0 +1,233 @@
+#include "devices/lapic.h"
+#include <debug.h>
+#include <stdint.h>
+#include "devices/timer.h"
+#include "threads/flags.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Interface to the local APIC, the interrupt controller inside
+   each CPU.  Device interrupts arrive from the I/O APIC (see
+   ioapic.c) or, on a machine without one, from the 8259A PICs,
+   which the boot CPU's local APIC passes through on its LINT0
+   pin.  Beyond those, the kernel uses the local APIC for a timer
+   on each of the other CPUs and for interrupts from one CPU to
+   another.  Refer to [IA32-v3a] chapter 8 "Advanced
+   Programmable Interrupt Controller (APIC)" for details. */
+
+/* Local APIC registers, as offsets into its 4 kB of
+   memory-mapped registers. */
+#define LAPIC_ID        0x020   /* Local APIC ID. */
+#define LAPIC_TPR       0x080   /* Task priority. */
+#define LAPIC_EOI       0x0b0   /* End of interrupt. */
+#define LAPIC_SVR       0x0f0   /* Spurious interrupt vector. */
+#define LAPIC_ICR_LO    0x300   /* Interrupt command, low half. */
+#define LAPIC_ICR_HI    0x310   /* Interrupt command, high half. */
+#define LAPIC_LVT_TIMER 0x320   /* Local vector table: timer. */
+#define LAPIC_LVT_LINT0 0x350   /* Local vector table: LINT0 pin. */
+#define LAPIC_LVT_LINT1 0x360   /* Local vector table: LINT1 pin. */
+#define LAPIC_LVT_ERROR 0x370   /* Local vector table: errors. */
+#define LAPIC_TIMER_INIT 0x380  /* Timer initial count. */
+#define LAPIC_TIMER_CUR 0x390   /* Timer current count. */
+#define LAPIC_TIMER_DIV 0x3e0   /* Timer divide configuration. */
+
+/* Register bits. */
+#define SVR_ENABLE      0x100           /* Software enable. */
+#define LVT_MASKED      0x10000         /* Interrupt masked. */
+#define LVT_PERIODIC    0x20000         /* Timer: periodic mode. */
+#define LVT_EXTINT      0x700           /* Deliver as from the 8259A. */
+#define LVT_NMI         0x400           /* Deliver as NMI. */
+#define ICR_INIT        0x500           /* INIT IPI. */
+#define ICR_STARTUP     0x600           /* Start-up IPI. */
+#define ICR_PENDING     0x1000          /* Delivery status: send pending. */
+#define ICR_ASSERT      0x4000          /* Level: assert. */
+#define ICR_LEVEL       0x8000          /* Trigger mode: level. */
+#define TIMER_DIV_16    0x3             /* Timer counts bus clock / 16. */
+
+/* Local APIC registers, mapped at the same virtual address as
+   their physical address, above all of the kernel's mappings of
+   RAM. */
+static volatile uint32_t *lapic;
+
+/* Local APIC timer counts per timer tick, from
+   lapic_calibrate(). */
+static uint32_t counts_per_tick;
+
+static inline uint32_t
+lapic_read (unsigned reg)
+{
+  return lapic[reg / sizeof *lapic];
+}
+
+static inline void
+lapic_write (unsigned reg, uint32_t value)
+{
+  lapic[reg / sizeof *lapic] = value;
+}
+
+/* Returns true if the CPU has a local APIC, as reported by
+   CPUID.  CPUID exists if EFLAGS.ID can be changed.  See
+   [IA32-v2a] "CPUID--CPU Identification". */
+bool
+lapic_present (void)
+{
+  uint32_t flags, toggled, eax, ebx, ecx, edx;
+
+  asm volatile ("pushfl; popl %0" : "=r" (flags));
+  asm volatile ("pushl %1; popfl; pushfl; popl %0"
+                : "=r" (toggled) : "r" (flags ^ FLAG_ID) : "cc");
+  asm volatile ("pushl %0; popfl" : : "r" (flags) : "cc");
+  if (((flags ^ toggled) & FLAG_ID) == 0)
+    return false;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  return (edx & (1 << 9)) != 0;
+}
+
+/* Maps the page of APIC registers at physical address PADDR, a
+   local APIC's or an IOAPIC's, into the kernel's page directory,
+   uncached, at the same virtual address, and returns that
+   address.  Page directories created later inherit the mapping
+   from pagedir_create(), so this must be done before the first
+   user process starts. */
+volatile uint32_t *
+apic_map (uintptr_t paddr)
+{
+  uint32_t *pde = &init_page_dir[pd_no ((void *) paddr)];
+  uint32_t *pt;
+
+  ASSERT (pg_ofs ((void *) paddr) == 0);
+  ASSERT ((void *) paddr >= ptov (init_ram_pages * PGSIZE));
+
+  if (*pde == 0)
+    *pde = pde_create (palloc_get_page (PAL_ASSERT | PAL_ZERO));
+  pt = pde_get_pt (*pde);
+  pt[pt_no ((void *) paddr)] = paddr | PTE_PCD | PTE_PWT | PTE_W | PTE_P;
+  return (volatile uint32_t *) paddr;
+}
+
+/* Maps the local APIC registers, at physical address PADDR. */
+void
+lapic_map (uintptr_t paddr)
+{
+  lapic = apic_map (paddr);
+}
+
+/* Enables the running CPU's local APIC.  On the boot CPU, BSP,
+   the 8259A PICs keep delivering through LINT0 and NMIs through
+   LINT1; on the other CPUs both pins are masked, so that device
+   interrupts all go to the boot CPU. */
+void
+lapic_init (bool bsp)
+{
+  ASSERT (lapic != NULL);
+
+  lapic_write (LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VEC);
+  lapic_write (LAPIC_LVT_TIMER, LVT_MASKED | LAPIC_TIMER_VEC);
+  lapic_write (LAPIC_TIMER_DIV, TIMER_DIV_16);
+  lapic_write (LAPIC_LVT_LINT0, bsp ? LVT_EXTINT : LVT_MASKED);
+  lapic_write (LAPIC_LVT_LINT1, bsp ? LVT_NMI : LVT_MASKED);
+  lapic_write (LAPIC_LVT_ERROR, LVT_MASKED);
+  lapic_write (LAPIC_TPR, 0);
+  lapic_eoi ();
+}
+
+/* Measures how far the local APIC timer counts in one timer
+   tick, for lapic_timer_start().  Every CPU's timer counts the
+   same bus clock, so measuring on the boot CPU is enough.  Must
+   be called with interrupts on, so that the ticks come. */
+void
+lapic_calibrate (void)
+{
+  int64_t start;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    barrier ();
+  lapic_write (LAPIC_TIMER_INIT, UINT32_MAX);
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    barrier ();
+  counts_per_tick = UINT32_MAX - lapic_read (LAPIC_TIMER_CUR);
+  lapic_write (LAPIC_TIMER_INIT, 0);
+}
+
+/* Starts the running CPU's local APIC timer interrupting at
+   LAPIC_TIMER_VEC once per timer tick. */
+void
+lapic_timer_start (void)
+{
+  ASSERT (counts_per_tick != 0);
+
+  lapic_write (LAPIC_LVT_TIMER, LVT_PERIODIC | LAPIC_TIMER_VEC);
+  lapic_write (LAPIC_TIMER_INIT, counts_per_tick);
+}
+
+/* Returns the running CPU's local APIC ID. */
+unsigned
+lapic_id (void)
+{
+  return lapic_read (LAPIC_ID) >> 24;
+}
+
+/* Signals the end of a local APIC interrupt to the running
+   CPU's local APIC. */
+void
+lapic_eoi (void)
+{
+  lapic_write (LAPIC_EOI, 0);
+}
+
+/* Sends the interrupt command LOW to the CPU whose local APIC ID
+   is APIC_ID and waits for the APIC to accept it.  Interrupts are
+   turned off meanwhile, so that no other command is sent from an
+   interrupt handler in the middle of this one. */
+static void
+send_command (unsigned apic_id, uint32_t low)
+{
+  enum intr_level old_level = intr_disable ();
+
+  lapic_write (LAPIC_ICR_HI, apic_id << 24);
+  lapic_write (LAPIC_ICR_LO, low);
+  while (lapic_read (LAPIC_ICR_LO) & ICR_PENDING)
+    asm volatile ("pause");
+  intr_set_level (old_level);
+}
+
+/* Interrupts the CPU whose local APIC ID is APIC_ID at vector
+   VEC. */
+void
+lapic_send_ipi (unsigned apic_id, uint8_t vec)
+{
+  send_command (apic_id, ICR_ASSERT | vec);
+}
+
+/* Starts the CPU whose local APIC ID is APIC_ID running real-mode
+   code at physical address PADDR, which must be page-aligned and
+   below 1 MB, with the INIT, start-up, start-up sequence of
+   [MP] B.4 "Application Processor Startup". */
+void
+lapic_start_ap (unsigned apic_id, uintptr_t paddr)
+{
+  int i;
+
+  ASSERT (pg_ofs ((void *) paddr) == 0 && paddr < 0x100000);
+
+  send_command (apic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+  timer_udelay (200);
+  send_command (apic_id, ICR_INIT | ICR_LEVEL);
+  timer_mdelay (10);
+  for (i = 0; i < 2; i++)
+    {
+      send_command (apic_id, ICR_STARTUP | (paddr >> PGBITS));
+      timer_udelay (200);
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef DEVICES_LAPIC_H
+#define DEVICES_LAPIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Interrupt vectors delivered by the local APIC.  The timer is
+   handled like an external interrupt; the inter-processor
+   interrupts are answered without the kernel lock (see
+   threads/smp.c). */
+#define LAPIC_TIMER_VEC 0xf0    /* Local APIC timer. */
+#define LAPIC_CALL_VEC 0xf1     /* Cross-CPU function call. */
+#define LAPIC_RESCHED_VEC 0xf2  /* Wake an idle CPU to schedule. */
+#define LAPIC_SPURIOUS_VEC 0xff /* Spurious interrupt. */
+
+volatile uint32_t *apic_map (uintptr_t paddr);
+bool lapic_present (void);
+void lapic_map (uintptr_t paddr);
+void lapic_init (bool bsp);
+void lapic_calibrate (void);
+void lapic_timer_start (void);
+unsigned lapic_id (void);
+void lapic_eoi (void);
+void lapic_send_ipi (unsigned apic_id, uint8_t vec);
+void lapic_start_ap (unsigned apic_id, uintptr_t paddr);
+
+#endif /* devices/lapic.h */
@@ -0,0 +1,111 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* This code reads and writes PCI configuration space using
+   configuration mechanism #1, which every PC chipset since the
+   original PCI ones supports.  See [PCI] chapter 3. */
+
+/* I/O ports for configuration mechanism #1. */
+#define PCI_CONFIG_ADDRESS 0xcf8        /* Selects a register. */
+#define PCI_CONFIG_DATA 0xcfc           /* Reads or writes it. */
+
+/* Selects register REG of PCI function D for the next access to
+   PCI_CONFIG_DATA. */
+static void
+select_register (const struct pci_device *d, int reg)
+{
+  ASSERT (d->dev < 32 && d->func < 8);
+  ASSERT (reg >= 0 && reg < 256 && reg % 4 == 0);
+
+  outl (PCI_CONFIG_ADDRESS, (0x80000000u | (d->bus << 16) | (d->dev << 11)
+                             | (d->func << 8) | reg));
+}
+
+/* Returns the 32-bit configuration register REG of D. */
+uint32_t
+pci_read_config (const struct pci_device *d, int reg)
+{
+  select_register (d, reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit configuration register REG of D. */
+void
+pci_write_config (const struct pci_device *d, int reg, uint32_t value)
+{
+  select_register (d, reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Searches all PCI buses for functions whose register REG, masked
+   with MASK, equals VALUE and stores the INDEX'th one found,
+   counting from 0, into *D.  Returns true if successful, false
+   if there are not that many such functions. */
+static bool
+find_function (int reg, uint32_t mask, uint32_t value, int index,
+               struct pci_device *d)
+{
+  int bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          d->bus = bus;
+          d->dev = dev;
+          d->func = func;
+          if ((pci_read_config (d, PCI_REG_ID) & 0xffff) == 0xffff)
+            {
+              /* No such function.  If function 0 is missing, so
+                 is the whole device. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          if ((pci_read_config (d, reg) & mask) == value && index-- == 0)
+            return true;
+
+          /* Only multifunction devices have functions 1...7. */
+          if (func == 0
+              && (pci_read_config (d, PCI_REG_HEADER) & 0x800000) == 0)
+            break;
+        }
+  return false;
+}
+
+/* Searches all PCI buses for functions whose class and subclass
+   are CLASS and SUBCLASS and stores the INDEX'th one found,
+   counting from 0, into *D.  Returns true if successful, false
+   if there are not that many such functions. */
+bool
+pci_find_class (int class, int subclass, int index, struct pci_device *d)
+{
+  return find_function (PCI_REG_CLASS, 0xffff0000,
+                        ((uint32_t) class << 24) | (subclass << 16),
+                        index, d);
+}
+
+/* Searches all PCI buses for functions with the given VENDOR and
+   DEVICE IDs and stores the INDEX'th one found, counting from 0,
+   into *D.  Returns true if successful, false if there are not
+   that many such functions. */
+bool
+pci_find_device (int vendor, int device, int index, struct pci_device *d)
+{
+  return find_function (PCI_REG_ID, 0xffffffff,
+                        ((uint32_t) device << 16) | vendor, index, d);
+}
+
+/* Allows D to master the bus, e.g. for DMA. */
+void
+pci_enable_bus_master (const struct pci_device *d)
+{
+  uint32_t command = pci_read_config (d, PCI_REG_COMMAND);
+
+  /* Only touch the command half: writing 1s to the status half
+     would clear its error bits. */
+  pci_write_config (d, PCI_REG_COMMAND,
+                    (command & 0xffff) | PCI_CMD_IO | PCI_CMD_MASTER);
+}
@@ -0,0 +1,34 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Location of a PCI function in configuration space. */
+struct pci_device
+  {
+    uint8_t bus;                /* Bus number. */
+    uint8_t dev;                /* Device number, 0...31. */
+    uint8_t func;               /* Function number, 0...7. */
+  };
+
+/* Configuration space registers (byte offsets). */
+#define PCI_REG_ID 0x00         /* Vendor ID 15:0, device ID 31:16. */
+#define PCI_REG_COMMAND 0x04    /* Command 15:0, status 31:16. */
+#define PCI_REG_CLASS 0x08      /* Revision, prog IF, subclass, class. */
+#define PCI_REG_HEADER 0x0c     /* Header type in bits 23:16. */
+#define PCI_REG_BAR0 0x10       /* First of six base address registers. */
+#define PCI_REG_IRQ 0x3c        /* Interrupt line in bits 7:0. */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001       /* Respond to I/O space accesses. */
+#define PCI_CMD_MEMORY 0x0002   /* Respond to memory space accesses. */
+#define PCI_CMD_MASTER 0x0004   /* May act as bus master. */
+
+uint32_t pci_read_config (const struct pci_device *, int reg);
+void pci_write_config (const struct pci_device *, int reg, uint32_t value);
+bool pci_find_class (int class, int subclass, int index, struct pci_device *);
+bool pci_find_device (int vendor, int device, int index, struct pci_device *);
+void pci_enable_bus_master (const struct pci_device *);
+
+#endif /* devices/pci.h */
@@ -0,0 +1,130 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device kept in kernel memory, one page per
+   RAMDISK_PAGE_SECTORS sectors.  Its contents start out as zeros
+   and are lost at shutdown, so it suits scratch and swap, or a
+   file system formatted with -f.  It registers as a raw device
+   named "ramdisk", so it plays a role only when named with
+   -filesys, -scratch, or -swap. */
+
+/* Sectors per page. */
+#define RAMDISK_PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+size_t ramdisk_kb;
+
+static uint8_t **pages;                 /* Pages holding the data. */
+static size_t page_cnt;                 /* Number of pages. */
+
+static struct block_operations ramdisk_operations;
+
+/* Allocates the RAM disk, if one was requested, and registers it
+   with the block layer. */
+void
+ramdisk_init (void) 
+{
+  char extra_info[32];
+  size_t i;
+
+  if (ramdisk_kb == 0)
+    return;
+
+  page_cnt = DIV_ROUND_UP (ramdisk_kb * 1024, PGSIZE);
+  pages = malloc (page_cnt * sizeof *pages);
+  if (pages == NULL)
+    PANIC ("ramdisk: out of memory for %zu pages", page_cnt);
+  for (i = 0; i < page_cnt; i++) 
+    {
+      pages[i] = palloc_get_page (PAL_ZERO);
+      if (pages[i] == NULL)
+        PANIC ("ramdisk: out of memory after %zu of %zu pages",
+               i, page_cnt);
+    }
+
+  snprintf (extra_info, sizeof extra_info, "%zu kB in memory",
+            page_cnt * PGSIZE / 1024);
+  block_register ("ramdisk", BLOCK_RAW, extra_info,
+                  page_cnt * RAMDISK_PAGE_SECTORS, &ramdisk_operations,
+                  NULL);
+}
+
+/* Returns the address of SECTOR's data. */
+static uint8_t *
+sector_data (block_sector_t sector) 
+{
+  ASSERT (sector < page_cnt * RAMDISK_PAGE_SECTORS);
+  return (pages[sector / RAMDISK_PAGE_SECTORS]
+          + sector % RAMDISK_PAGE_SECTORS * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads CNT sectors starting at SECTOR into BUFFER, which must
+   have room for CNT * BLOCK_SECTOR_SIZE bytes.  Runs of sectors
+   are copied a page at a time. */
+static void
+ramdisk_read_multiple (void *aux UNUSED, block_sector_t sector, size_t cnt,
+                       void *buffer_) 
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0) 
+    {
+      size_t left = RAMDISK_PAGE_SECTORS - sector % RAMDISK_PAGE_SECTORS;
+      size_t chunk = cnt < left ? cnt : left;
+
+      memcpy (buffer, sector_data (sector), chunk * BLOCK_SECTOR_SIZE);
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+      sector += chunk;
+      cnt -= chunk;
+    }
+}
+
+/* Writes CNT sectors starting at SECTOR from BUFFER, which must
+   contain CNT * BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write_multiple (void *aux UNUSED, block_sector_t sector, size_t cnt,
+                        const void *buffer_) 
+{
+  const uint8_t *buffer = buffer_;
+
+  while (cnt > 0) 
+    {
+      size_t left = RAMDISK_PAGE_SECTORS - sector % RAMDISK_PAGE_SECTORS;
+      size_t chunk = cnt < left ? cnt : left;
+
+      memcpy (sector_data (sector), buffer, chunk * BLOCK_SECTOR_SIZE);
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+      sector += chunk;
+      cnt -= chunk;
+    }
+}
+
+/* Reads sector SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_read (void *aux UNUSED, block_sector_t sector, void *buffer) 
+{
+  memcpy (buffer, sector_data (sector), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes sector SECTOR from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write (void *aux UNUSED, block_sector_t sector, const void *buffer) 
+{
+  memcpy (sector_data (sector), buffer, BLOCK_SECTOR_SIZE);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple
+  };
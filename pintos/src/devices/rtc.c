@@ -1,5 +1,7 @@
 #include "devices/rtc.h"
+#include <debug.h>
 #include <stdio.h>
+#include "threads/interrupt.h"
 #include "threads/io.h"
 
 /* This code is an interface to the MC146818A-compatible real
@@ -28,14 +30,22 @@
 
 /* Register A. */
 #define RTCSA_UIP	0x80	/* Set while time update in progress. */
+#define RTCSA_DV_32K	0x20	/* Divider for the usual 32.768 kHz base. */
+#define RTCSA_RATE	0x0f	/* Periodic rate: 32768 >> (RATE - 1) Hz. */
 
 /* Register B. */
 #define	RTCSB_SET	0x80	/* Disables update to let time be set. */
+#define RTCSB_PIE	0x40	/* Enables the periodic interrupt. */
 #define RTCSB_DM	0x04	/* 0 = BCD time format, 1 = binary format. */
 #define RTCSB_24HR	0x02    /* 0 = 12-hour format, 1 = 24-hour format. */
 
+/* Called from each periodic interrupt, if started. */
+static rtc_periodic_func *periodic_func;
+
 static int bcd_to_bin (uint8_t);
 static uint8_t cmos_read (uint8_t index);
+static void cmos_write (uint8_t index, uint8_t data);
+static intr_handler_func rtc_interrupt;
 
 /* Returns number of seconds since Unix epoch of January 1,
    1970. */
@@ -95,6 +105,43 @@ rtc_get_time (void)
   return time;
 }
 
+/* Starts the RTC's periodic interrupt at HZ interrupts per
+   second, a power of two from 2 to 8192, calling FUNC in
+   interrupt context from each one.  The RTC runs from its own
+   crystal, so it keeps time even if the timer stops. */
+void
+rtc_start_periodic (unsigned hz, rtc_periodic_func *func)
+{
+  enum intr_level old_level;
+  int rate;
+
+  ASSERT (hz >= 2 && hz <= 8192 && (hz & (hz - 1)) == 0);
+  ASSERT (func != NULL);
+  ASSERT (periodic_func == NULL);
+
+  for (rate = 1; 32768u >> (rate - 1) != hz; rate++)
+    continue;
+
+  periodic_func = func;
+  intr_register_ext (0x28, rtc_interrupt, "RTC");
+
+  old_level = intr_disable ();
+  cmos_write (RTC_REG_A, RTCSA_DV_32K | rate);
+  cmos_write (RTC_REG_B, cmos_read (RTC_REG_B) | RTCSB_PIE);
+  cmos_read (RTC_REG_C);
+  intr_set_level (old_level);
+}
+
+/* RTC interrupt handler. */
+static void
+rtc_interrupt (struct intr_frame *args UNUSED)
+{
+  /* Reading register C acknowledges the interrupt.  Until then,
+     the RTC raises no more. */
+  cmos_read (RTC_REG_C);
+  periodic_func ();
+}
+
 /* Returns the integer value of the given BCD byte. */
 static int
 bcd_to_bin (uint8_t x)
@@ -107,6 +154,24 @@ bcd_to_bin (uint8_t x)
 static uint8_t
 cmos_read (uint8_t index)
 {
+  /* The RTC interrupt handler selects register C, so selecting
+     and reading must not be split by an interrupt. */
+  enum intr_level old_level = intr_disable ();
+  uint8_t data;
+
+  outb (CMOS_REG_SET, index);
+  data = inb (CMOS_REG_IO);
+  intr_set_level (old_level);
+  return data;
+}
+
+/* Writes DATA to the CMOS register with the given INDEX. */
+static void
+cmos_write (uint8_t index, uint8_t data)
+{
+  enum intr_level old_level = intr_disable ();
+
   outb (CMOS_REG_SET, index);
-  return inb (CMOS_REG_IO);
+  outb (CMOS_REG_IO, data);
+  intr_set_level (old_level);
 }
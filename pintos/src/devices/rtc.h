@@ -5,4 +5,9 @@ typedef unsigned long time_t;
 
 time_t rtc_get_time (void);
 
+/* Called from the RTC's periodic interrupt. */
+typedef void rtc_periodic_func (void);
+
+void rtc_start_periodic (unsigned hz, rtc_periodic_func *);
+
 #endif
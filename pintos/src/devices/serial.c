@@ -37,6 +37,17 @@
 #define IER_RECV 0x01           /* Interrupt when data received. */
 #define IER_XMIT 0x02           /* Interrupt when transmit finishes. */
 
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable receive and transmit FIFOs. */
+#define FCR_CLEAR 0x06          /* Clear both FIFOs. */
+
+/* Interrupt Identification Register bits. */
+#define IIR_FIFO 0xc0           /* FIFOs enabled (both bits set). */
+
+/* Depth of the 16550A transmit FIFO, which is empty whenever
+   LSR_THRE is set. */
+#define XMIT_FIFO_SIZE 16
+
 /* Line Control Register bits. */
 #define LCR_N81 0x03            /* No parity, 8 data bits, 1 stop bit. */
 #define LCR_DLAB 0x80           /* Divisor Latch Access Bit (DLAB). */
@@ -51,8 +62,17 @@
 /* Transmission mode. */
 static enum { UNINIT, POLL, QUEUE } mode;
 
-/* Data to be transmitted. */
+/* Data to be transmitted.  The queue is large enough to absorb
+   a burst of kernel output, so that writers seldom find it full
+   and fall back to polling with interrupts off. */
+#define TXQ_SIZE 4096
 static struct intq txq;
+static uint8_t txq_data[TXQ_SIZE];
+
+/* Number of bytes the transmitter takes at once when it is
+   empty: XMIT_FIFO_SIZE if the UART has working FIFOs, otherwise
+   1, as on an 8250 or 16450. */
+static size_t xmit_depth = 1;
 
 static void set_serial (int bps);
 static void putc_poll (uint8_t);
@@ -71,7 +91,7 @@ init_poll (void)
   outb (FCR_REG, 0);                    /* Disable FIFO. */
   set_serial (9600);                    /* 9.6 kbps, N-8-1. */
   outb (MCR_REG, MCR_OUT2);             /* Required to enable interrupts. */
-  intq_init (&txq);
+  intq_init (&txq, txq_data, sizeof txq_data);
   mode = POLL;
 } 
 
@@ -90,6 +110,9 @@ serial_init_queue (void)
   intr_register_ext (0x20 + 4, serial_interrupt, "serial");
   mode = QUEUE;
   old_level = intr_disable ();
+  outb (FCR_REG, FCR_ENABLE | FCR_CLEAR);
+  if ((inb (IIR_REG) & IIR_FIFO) == IIR_FIFO)
+    xmit_depth = XMIT_FIFO_SIZE;
   write_ier ();
   intr_set_level (old_level);
 }
@@ -129,6 +152,47 @@ serial_putc (uint8_t byte)
   intr_set_level (old_level);
 }
 
+/* Sends the SIZE bytes in BUF to the serial port.  Like
+   serial_putc(), but queues each run of bytes that fits at once
+   and updates the interrupt enable register only when the queue
+   fills and at the end. */
+void
+serial_putbuf (const uint8_t *buf, size_t size) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (mode != QUEUE)
+    {
+      if (mode == UNINIT)
+        init_poll ();
+      while (size-- > 0)
+        putc_poll (*buf++);
+    }
+  else
+    for (;;)
+      {
+        size_t cnt = intq_put_buf (&txq, buf, size);
+        buf += cnt;
+        size -= cnt;
+        write_ier ();
+        if (size == 0)
+          break;
+
+        /* The queue is full.  As in serial_putc(), poll a byte out
+           if interrupts are off, and otherwise sleep until the
+           interrupt handler makes room. */
+        if (old_level == INTR_OFF)
+          putc_poll (intq_getc (&txq));
+        else
+          {
+            intq_putc (&txq, *buf++);
+            size--;
+          }
+      }
+
+  intr_set_level (old_level);
+}
+
 /* Flushes anything in the serial buffer out the port in polling
    mode. */
 void
@@ -218,10 +282,17 @@ serial_interrupt (struct intr_frame *f UNUSED)
   while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
     input_putc (inb (RBR_REG));
 
-  /* As long as we have a byte to transmit, and the hardware is
-     ready to accept a byte for transmission, transmit a byte. */
-  while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0) 
-    outb (THR_REG, intq_getc (&txq));
+  /* If the hardware is ready to accept bytes for transmission,
+     its transmit FIFO is empty, so fill it from the queue. */
+  if ((inb (LSR_REG) & LSR_THRE) != 0) 
+    {
+      uint8_t buf[XMIT_FIFO_SIZE];
+      size_t cnt = intq_get_buf (&txq, buf, xmit_depth);
+      size_t i;
+
+      for (i = 0; i < cnt; i++)
+        outb (THR_REG, buf[i]);
+    }
 
   /* Update interrupt enable register based on queue status. */
   write_ier ();
@@ -4,8 +4,16 @@
 #include "devices/kbd.h"
 #include "devices/serial.h"
 #include "devices/timer.h"
+#include "devices/watchdog.h"
+#include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/profile.h"
+#include "threads/spinlock.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
 #endif
@@ -13,6 +21,10 @@
 #include "devices/block.h"
 #include "filesys/filesys.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
+#endif
 
 /* Keyboard control register port. */
 #define CONTROL_REG 0x64
@@ -57,6 +69,7 @@ void
 shutdown_reboot (void)
 {
   printf ("Rebooting...\n");
+  console_flush ();
 
     /* See [kbd] for details on how to program the keyboard
      * controller. */
@@ -97,6 +110,7 @@ shutdown_power_off (void)
   print_stats ();
 
   printf ("Powering off...\n");
+  console_flush ();
   serial_flush ();
   outw( 0x604, 0x0 | 0x2000 );
 
@@ -120,7 +134,21 @@ static void
 print_stats (void)
 {
   timer_print_stats ();
+  watchdog_print_stats ();
   thread_print_stats ();
+#ifdef LOCK_STATS
+  lock_print_stats ();
+  spin_print_stats ();
+#endif
+#ifdef INTR_STATS
+  intr_print_stats ();
+#endif
+  profile_print_stats ();
+  trace_dump ();
+#ifdef MALLOC_STATS
+  malloc_print_stats ();
+  palloc_print_stats ();
+#endif
 #ifdef FILESYS
   block_print_stats ();
 #endif
@@ -129,4 +157,8 @@ print_stats (void)
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  frame_print_stats ();
+  swap_print_stats ();
+#endif
 }
@@ -0,0 +1,87 @@
+#include "devices/spsc.h"
+#include <debug.h>
+#include <string.h>
+#include "threads/synch.h"
+
+/* Initializes ring R to hold up to REC_CNT records of REC_SIZE
+   bytes each in BUF, which must have room for them all.  REC_CNT
+   must be a power of 2.  NOTIFY, if nonnull, is called with AUX
+   by the producer whenever it adds a record to an empty ring. */
+void
+spsc_init (struct spsc_ring *r, void *buf, size_t rec_size,
+           size_t rec_cnt, spsc_notify_func *notify, void *aux) 
+{
+  ASSERT (buf != NULL);
+  ASSERT (rec_size > 0);
+  ASSERT (rec_cnt > 0 && (rec_cnt & (rec_cnt - 1)) == 0);
+
+  r->buf = buf;
+  r->rec_size = rec_size;
+  r->rec_cnt = rec_cnt;
+  r->head = r->tail = 0;
+  r->notify = notify;
+  r->aux = aux;
+}
+
+/* Returns true if R holds no records.  Exact only for the
+   consumer: to anyone else, R may fill meanwhile. */
+bool
+spsc_empty (const struct spsc_ring *r) 
+{
+  return r->head == r->tail;
+}
+
+/* Returns true if R has no room for another record.  Exact only
+   for the producer: to anyone else, R may drain meanwhile. */
+bool
+spsc_full (const struct spsc_ring *r) 
+{
+  return r->head - r->tail == r->rec_cnt;
+}
+
+/* Adds a copy of the record at REC to R and returns true, or
+   returns false if R is full.  Only the producer may call this. */
+bool
+spsc_push (struct spsc_ring *r, const void *rec) 
+{
+  size_t head = r->head;
+  size_t tail = r->tail;
+
+  if (head - tail == r->rec_cnt)
+    return false;
+  memcpy (r->buf + (head & (r->rec_cnt - 1)) * r->rec_size, rec,
+          r->rec_size);
+
+  /* Publish the record only once it is written. */
+  barrier ();
+  r->head = head + 1;
+
+  /* The consumer sleeps only after seeing the ring empty, and while
+     it sleeps the ring stays as it saw it, so this push finds the
+     ring empty too and wakes it. */
+  if (head == tail && r->notify != NULL)
+    r->notify (r->aux);
+  return true;
+}
+
+/* Removes the oldest record from R into REC and returns true, or
+   returns false if R is empty.  Only the consumer may call
+   this. */
+bool
+spsc_pop (struct spsc_ring *r, void *rec) 
+{
+  size_t tail = r->tail;
+
+  if (r->head == tail)
+    return false;
+
+  /* Read the record only after seeing that it was published. */
+  barrier ();
+  memcpy (rec, r->buf + (tail & (r->rec_cnt - 1)) * r->rec_size,
+          r->rec_size);
+
+  /* Give back the slot only once the record is read out. */
+  barrier ();
+  r->tail = tail + 1;
+  return true;
+}
@@ -0,0 +1,57 @@
+#ifndef DEVICES_SPSC_H
+#define DEVICES_SPSC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A single-producer, single-consumer ring of fixed-size records,
+   for handing data from an interrupt handler to a kernel thread,
+   or back, without either side turning interrupts off.
+
+   Only the producer advances `head' and only the consumer
+   advances `tail'.  Each side publishes its change with a single
+   aligned store after the records it covers are in place, so the
+   other side never sees a partly written or partly read record.
+   On one CPU the ring needs only compiler barriers, and since x86
+   does not reorder stores with other stores or loads with other
+   loads, it would need no more with several.
+
+   There must be at most one producer and one consumer at any
+   moment.  Several interrupt handlers may take turns as the
+   producer, since external interrupts do not nest.
+
+   The ring does no waiting of its own.  The producer calls the
+   NOTIFY function given to spsc_init() whenever it adds a record
+   to an empty ring, which is the only time a consumer may be
+   waiting.  Typically NOTIFY ups a semaphore on which the
+   consumer sleeps after finding the ring empty, as in:
+
+        while (!spsc_pop (r, &rec))
+          sema_down (&sema);
+
+   The semaphore may then be up more often than there are records,
+   so the consumer must be ready to find the ring empty again. */
+
+/* Called by the producer with the AUX given to spsc_init(). */
+typedef void spsc_notify_func (void *aux);
+
+struct spsc_ring
+  {
+    uint8_t *buf;               /* REC_CNT records of REC_SIZE bytes. */
+    size_t rec_size;            /* Bytes per record. */
+    size_t rec_cnt;             /* Records in BUF, a power of 2. */
+    volatile size_t head;       /* Records ever pushed. */
+    volatile size_t tail;       /* Records ever popped. */
+    spsc_notify_func *notify;   /* Called on push to empty ring. */
+    void *aux;                  /* Passed to NOTIFY. */
+  };
+
+void spsc_init (struct spsc_ring *, void *buf, size_t rec_size,
+                size_t rec_cnt, spsc_notify_func *, void *aux);
+bool spsc_empty (const struct spsc_ring *);
+bool spsc_full (const struct spsc_ring *);
+bool spsc_push (struct spsc_ring *, const void *rec);
+bool spsc_pop (struct spsc_ring *, void *rec);
+
+#endif /* devices/spsc.h */
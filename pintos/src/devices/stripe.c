@@ -0,0 +1,215 @@
+#include "devices/stripe.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* A striped (RAID-0) block device named "md0", made of up to
+   STRIPE_MAX member devices.  Its sectors are dealt out to the
+   members STRIPE_CHUNK at a time, round robin.
+
+   Block device operations are synchronous, so each member has a
+   thread of its own that performs the transfers queued for it.
+   A transfer on md0 queues its pieces on all the members they
+   fall on before sleeping, so members on different IDE channels,
+   or on different virtio disks, work on it at the same time.
+   (The two disks on one IDE channel share its bus, so the IDE
+   driver still runs their transfers one at a time.) */
+
+/* Most member devices. */
+#define STRIPE_MAX 4
+
+/* Sectors per chunk. */
+#define STRIPE_CHUNK 16
+
+/* Most pieces of one transfer outstanding at once. */
+#define STRIPE_BATCH 16
+
+char *stripe_members;
+
+/* A piece of a transfer, queued for one member. */
+struct stripe_io
+  {
+    struct list_elem elem;      /* Element in member's queue. */
+    block_sector_t sector;      /* First sector on the member. */
+    size_t cnt;                 /* Number of sectors. */
+    uint8_t *buffer;            /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                 /* True to write, false to read. */
+    struct semaphore *done;     /* Up'd when the piece is done. */
+  };
+
+/* A member device. */
+struct member
+  {
+    struct block *block;        /* The device. */
+    struct lock lock;           /* Protects QUEUE. */
+    struct list queue;          /* Pieces waiting for the member. */
+    struct semaphore work;      /* Counts pieces in QUEUE. */
+  };
+
+static struct member members[STRIPE_MAX];
+static size_t member_cnt;
+
+static struct block_operations stripe_operations;
+static thread_func member_thread NO_RETURN;
+
+/* Sets up md0 over the devices named in stripe_members, if any,
+   and registers it with the block layer. */
+void
+stripe_init (void) 
+{
+  block_sector_t member_size = 0;
+  char *name, *save_ptr;
+  char extra_info[32];
+  size_t i;
+
+  if (stripe_members == NULL)
+    return;
+
+  for (name = strtok_r (stripe_members, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      struct block *block = block_get_by_name (name);
+      if (block == NULL)
+        PANIC ("stripe: no such block device \"%s\"", name);
+      if (member_cnt >= STRIPE_MAX)
+        PANIC ("stripe: more than %d members", STRIPE_MAX);
+      members[member_cnt++].block = block;
+      if (member_size == 0 || block_size (block) < member_size)
+        member_size = block_size (block);
+    }
+  if (member_cnt == 0)
+    return;
+
+  /* Use the same whole number of chunks from each member. */
+  member_size -= member_size % STRIPE_CHUNK;
+  if (member_size == 0)
+    PANIC ("stripe: members too small");
+
+  for (i = 0; i < member_cnt; i++) 
+    {
+      struct member *m = &members[i];
+      char thread_name[16];
+
+      lock_init (&m->lock);
+      list_init (&m->queue);
+      sema_init (&m->work, 0);
+      snprintf (thread_name, sizeof thread_name, "md0-%s",
+                block_name (m->block));
+      if (thread_create (thread_name, PRI_DEFAULT, member_thread, m)
+          == TID_ERROR)
+        PANIC ("stripe: thread creation failed");
+    }
+
+  snprintf (extra_info, sizeof extra_info, "striped over %zu devices",
+            member_cnt);
+  block_register ("md0", BLOCK_RAW, extra_info, member_size * member_cnt,
+                  &stripe_operations, NULL);
+}
+
+/* Performs the pieces queued for member M_, forever. */
+static void
+member_thread (void *m_) 
+{
+  struct member *m = m_;
+
+  for (;;) 
+    {
+      struct stripe_io *io;
+
+      sema_down (&m->work);
+      lock_acquire (&m->lock);
+      io = list_entry (list_pop_front (&m->queue), struct stripe_io, elem);
+      lock_release (&m->lock);
+
+      if (io->write)
+        block_write_multiple (m->block, io->sector, io->cnt, io->buffer);
+      else
+        block_read_multiple (m->block, io->sector, io->cnt, io->buffer);
+      sema_up (io->done);
+    }
+}
+
+/* Transfers CNT sectors of md0, starting at SECTOR, to or from
+   BUFFER.  WRITE selects the direction.  Queues up to
+   STRIPE_BATCH chunk-sized pieces at a time across the members
+   and waits for all of them before queuing more. */
+static void
+transfer (block_sector_t sector, size_t cnt, uint8_t *buffer, bool write) 
+{
+  struct stripe_io ios[STRIPE_BATCH];
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  while (cnt > 0) 
+    {
+      size_t io_cnt, i;
+
+      for (io_cnt = 0; cnt > 0 && io_cnt < STRIPE_BATCH; io_cnt++) 
+        {
+          block_sector_t chunk = sector / STRIPE_CHUNK;
+          size_t ofs = sector % STRIPE_CHUNK;
+          size_t piece = STRIPE_CHUNK - ofs < cnt ? STRIPE_CHUNK - ofs : cnt;
+          struct member *m = &members[chunk % member_cnt];
+          struct stripe_io *io = &ios[io_cnt];
+
+          io->sector = chunk / member_cnt * STRIPE_CHUNK + ofs;
+          io->cnt = piece;
+          io->buffer = buffer;
+          io->write = write;
+          io->done = &done;
+          lock_acquire (&m->lock);
+          list_push_back (&m->queue, &io->elem);
+          lock_release (&m->lock);
+          sema_up (&m->work);
+
+          sector += piece;
+          buffer += piece * BLOCK_SECTOR_SIZE;
+          cnt -= piece;
+        }
+
+      for (i = 0; i < io_cnt; i++)
+        sema_down (&done);
+    }
+}
+
+/* Reads sector SECTOR into BUFFER. */
+static void
+stripe_read (void *aux UNUSED, block_sector_t sector, void *buffer) 
+{
+  transfer (sector, 1, buffer, false);
+}
+
+/* Writes sector SECTOR from BUFFER. */
+static void
+stripe_write (void *aux UNUSED, block_sector_t sector, const void *buffer) 
+{
+  transfer (sector, 1, (void *) buffer, true);
+}
+
+/* Reads CNT sectors starting at SECTOR into BUFFER. */
+static void
+stripe_read_multiple (void *aux UNUSED, block_sector_t sector, size_t cnt,
+                      void *buffer) 
+{
+  transfer (sector, cnt, buffer, false);
+}
+
+/* Writes CNT sectors starting at SECTOR from BUFFER. */
+static void
+stripe_write_multiple (void *aux UNUSED, block_sector_t sector, size_t cnt,
+                       const void *buffer) 
+{
+  transfer (sector, cnt, (void *) buffer, true);
+}
+
+static struct block_operations stripe_operations =
+  {
+    stripe_read,
+    stripe_write,
+    stripe_read_multiple,
+    stripe_write_multiple
+  };
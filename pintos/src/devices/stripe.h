@@ -0,0 +1,11 @@
+#ifndef DEVICES_STRIPE_H
+#define DEVICES_STRIPE_H
+
+/* Comma-separated names of the block devices to stripe together,
+   or a null pointer for none.  Controlled by kernel command-line
+   option "-stripe=BDEV,BDEV...". */
+extern char *stripe_members;
+
+void stripe_init (void);
+
+#endif /* devices/stripe.h */
@@ -1,54 +1,192 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/fixed-point.h"
+#include "threads/tsc.h"
 
 /* See [8254] for hardware details of the 8254 timer chip. */
 
-#if TIMER_FREQ < 19
-#error 8254 timer requires TIMER_FREQ >= 19
-#endif
-#if TIMER_FREQ > 1000
-#error TIMER_FREQ <= 1000 recommended
-#endif
+/* Number of timer interrupts per second.
+   Controlled by kernel command-line option "-hz=N". */
+unsigned timer_freq = TIMER_FREQ_DEFAULT;
 
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Guards ticks and the time stamp counter calibration below, so
+   that readers need not disable interrupts to get a consistent
+   64-bit value.  Written only with interrupts off. */
+static struct seqcount time_seq;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Busy-wait loops per second to use instead of calibrating, or 0.
+   Controlled by kernel command-line option "-loops=N". */
+unsigned timer_loops_per_sec;
+
+/* Busy-wait loops timed by timer_calibrate()'s fast path. */
+#define CALIBRATE_LOOPS (1u << 14)
+
+/* Time stamp counter rate, and the factor that converts time
+   stamp counter cycles to nanoseconds as a 32.32 fixed-point
+   number.  Initialized by timer_calibrate(). */
+static uint64_t tsc_per_sec;
+static uint64_t ns_per_cycle;
+static uint64_t boot_tsc;
+
+/* PIT cycles per timer tick. */
+#define PIT_CYCLES_PER_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Tickless idle.  While the idle thread runs, the PIT may be
+   switched to one-shot mode, firing after oneshot_ticks timer
+   ticks' worth of PIT cycles; ticks is caught up when the
+   one-shot fires or the idle thread is woken by another
+   interrupt. */
+bool timer_tickless;
+static int64_t oneshot_ticks;   /* Ticks covered by one-shot, or 0. */
+static uint16_t oneshot_count;  /* PIT cycles programmed for one-shot. */
+static uint16_t oneshot_first;  /* PIT cycles to the first tick boundary. */
+
+/* High-resolution timers, in order of expiry.  While one expires
+   before the next tick, the PIT runs in one-shot mode instead of
+   periodic mode: hr_oneshot is set and, once the programmed count
+   runs out, hr_rest PIT cycles remain to the tick boundary.  An
+   interrupt with hr_rest nonzero is not a tick. */
+static struct list hrtimers;
+static bool hr_oneshot;
+static uint16_t hr_rest;
+
+/* Nanoseconds per timer tick. */
+#define NS_PER_TICK (1000000000 / TIMER_FREQ)
+
+/* Work found due by timer_interrupt() for timer_softirq(). */
+static bool second_due;         /* Once-per-second MLFQS update. */
+static bool priority_due;       /* Every-fourth-tick priority update. */
+
 static intr_handler_func timer_interrupt;
+static intr_softirq_func timer_softirq;
 static bool too_many_loops (unsigned loops);
+static void calibrate_loops (void);
+static void advance_ticks (int64_t);
+static int64_t apply_slack (int64_t deadline, int64_t slack);
+static uint64_t wait_for_tick (void);
+static void hrtimer_run (void);
+static void hrtimer_program (void);
+static void hrtimer_interrupt (void);
+static void tick_work (void);
+static void charge_tick (void);
+static bool timer_interrupt_fast (void);
+static hrtimer_func wake_sleeper;
+static void hr_sleep (int64_t ns);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
 
+/* Sets the tick rate to HZ timer interrupts per second.  Must
+   be called before timer_init().  Returns false, leaving the rate
+   alone, if HZ is out of range: the 8254's 16-bit counter cannot
+   divide its input clock down to less than TIMER_FREQ_MIN Hz, and
+   more than TIMER_FREQ_MAX Hz spends too much time in the timer
+   interrupt. */
+bool
+timer_set_freq (unsigned hz)
+{
+  if (hz < TIMER_FREQ_MIN || hz > TIMER_FREQ_MAX)
+    return false;
+  timer_freq = hz;
+  return true;
+}
+
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void)
 {
+  list_init (&hrtimers);
+  seqcount_init (&time_seq);
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+  intr_register_timer_fast (timer_interrupt_fast);
+  intr_register_softirq (SOFTIRQ_TIMER, timer_softirq);
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Calibrates loops_per_tick, used to implement brief delays, and
+   the time stamp counter rate.  This takes one or two ticks: the
+   counter is read at two tick boundaries, and in between a short
+   run of busy-wait loops is timed with it and scaled up to a tick.
+   The slow calibration against the PIT alone serves if the
+   counter is unusable. */
 void
 timer_calibrate (void)
 {
-  unsigned high_bit, test_bit;
+  int64_t start_ticks;
+  uint64_t start_tsc, end_tsc, tick_tsc, loop_tsc;
+  uint64_t per_sec, per_cycle = 0;
+  enum intr_level old_level;
+  int i;
 
   ASSERT (intr_get_level () == INTR_ON);
   printf ("Calibrating timer...  ");
 
+  start_tsc = wait_for_tick ();
+  start_ticks = timer_ticks ();
+
+  /* The shortest of a few runs leaves out interrupts. */
+  loop_tsc = UINT64_MAX;
+  for (i = 0; i < 3; i++)
+    {
+      uint64_t t = rdtsc ();
+      busy_wait (CALIBRATE_LOOPS);
+      t = rdtsc () - t;
+      if (t < loop_tsc)
+        loop_tsc = t;
+    }
+
+  end_tsc = wait_for_tick ();
+  tick_tsc = (end_tsc - start_tsc) / (timer_ticks () - start_ticks);
+  per_sec = tick_tsc * TIMER_FREQ;
+  if (per_sec != 0)
+    per_cycle = ((uint64_t) 1000000000 << 32) / per_sec;
+
+  /* Publish the calibration as a unit, so that clock readers
+     never pair the new boot_tsc with the old conversion factor. */
+  old_level = intr_disable ();
+  seq_write_begin (&time_seq);
+  boot_tsc = end_tsc;
+  tsc_per_sec = per_sec;
+  ns_per_cycle = per_cycle;
+  seq_write_end (&time_seq);
+  intr_set_level (old_level);
+
+  if (timer_loops_per_sec != 0)
+    loops_per_tick = timer_loops_per_sec / TIMER_FREQ;
+  else if (tick_tsc != 0 && loop_tsc != 0
+           && CALIBRATE_LOOPS * tick_tsc / loop_tsc <= UINT_MAX)
+    loops_per_tick = CALIBRATE_LOOPS * tick_tsc / loop_tsc;
+  else
+    calibrate_loops ();
+
+  printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+}
+
+/* Finds loops_per_tick without the time stamp counter, as the
+   largest number of loops that does not span a timer tick.
+   Takes a few dozen ticks. */
+static void
+calibrate_loops (void)
+{
+  unsigned high_bit, test_bit;
+
   /* Approximate loops_per_tick as the largest power-of-two
      still less than one timer tick. */
   loops_per_tick = 1u << 10;
@@ -63,20 +201,157 @@ timer_calibrate (void)
   for (test_bit = high_bit >> 1; test_bit != high_bit >> 10; test_bit >>= 1)
     if (!too_many_loops (high_bit | test_bit))
       loops_per_tick |= test_bit;
+}
 
-  printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+/* Returns the time stamp counter cycles since timer_calibrate(). */
+uint64_t
+clock_cycles (void)
+{
+  uint64_t base;
+  unsigned seq;
+
+  do
+    {
+      seq = seq_read_begin (&time_seq);
+      base = boot_tsc;
+    }
+  while (seq_read_retry (&time_seq, seq));
+  return rdtsc () - base;
 }
 
-/* Returns the number of timer ticks since the OS booted. */
-int64_t
-timer_ticks (void)
+/* Returns the nanoseconds since timer_calibrate(), or 0 before it
+   has run. */
+uint64_t
+clock_ns (void)
+{
+  return clock_cycles_to_ns (clock_cycles ());
+}
+
+/* Converts CYCLES time stamp counter cycles, such as a difference
+   of two clock_cycles() values, to nanoseconds.  Returns 0 before
+   timer_calibrate() has run. */
+uint64_t
+clock_cycles_to_ns (uint64_t cycles)
+{
+  /* CYCLES * ns_per_cycle >> 32, from 32-bit halves so that
+     each product fits in 64 bits. */
+  uint64_t c_hi = cycles >> 32, c_lo = cycles & 0xffffffff;
+  uint64_t n_hi, n_lo, factor;
+  unsigned seq;
+
+  do
+    {
+      seq = seq_read_begin (&time_seq);
+      factor = ns_per_cycle;
+    }
+  while (seq_read_retry (&time_seq, seq));
+  n_hi = factor >> 32;
+  n_lo = factor & 0xffffffff;
+
+  return ((c_hi * n_hi) << 32) + c_hi * n_lo + c_lo * n_hi
+         + ((c_lo * n_lo) >> 32);
+}
+
+/* Returns the time stamp counter rate measured by
+   timer_calibrate(), or 0 before it has run. */
+uint64_t
+clock_cycles_per_sec (void)
+{
+  uint64_t per_sec;
+  unsigned seq;
+
+  do
+    {
+      seq = seq_read_begin (&time_seq);
+      per_sec = tsc_per_sec;
+    }
+  while (seq_read_retry (&time_seq, seq));
+  return per_sec;
+}
+
+/* Initializes high-resolution timer T as not pending. */
+void
+hrtimer_init (struct hrtimer *t)
+{
+  t->pending = false;
+}
+
+/* Starts high-resolution timer T, which must not be pending, to
+   call FUNC (AUX) from the timer interrupt handler NS nanoseconds
+   from now.  May be called from an interrupt handler, but not
+   before timer_calibrate(). */
+void
+hrtimer_start (struct hrtimer *t, int64_t ns, hrtimer_func *func, void *aux)
+{
+  enum intr_level old_level;
+  struct list_elem *e;
+
+  ASSERT (tsc_per_sec != 0);
+  ASSERT (func != NULL);
+
+  old_level = intr_disable ();
+  ASSERT (!t->pending);
+  t->expires = clock_ns () + (ns > 0 ? ns : 0);
+  t->func = func;
+  t->aux = aux;
+  t->pending = true;
+  for (e = list_begin (&hrtimers); e != list_end (&hrtimers);
+       e = list_next (e))
+    if (list_entry (e, struct hrtimer, elem)->expires > t->expires)
+      break;
+  list_insert (e, &t->elem);
+
+  /* The idle thread may have stopped the tick; restart it. */
+  if (oneshot_ticks != 0)
+    timer_idle_exit ();
+  hrtimer_program ();
+  intr_set_level (old_level);
+}
+
+/* Stops high-resolution timer T.  Returns true if it was pending,
+   false if it had already expired or was never started. */
+bool
+hrtimer_cancel (struct hrtimer *t)
 {
   enum intr_level old_level = intr_disable ();
-  int64_t t = ticks;
+  bool pending = t->pending;
+
+  if (pending)
+    {
+      list_remove (&t->elem);
+      t->pending = false;
+    }
   intr_set_level (old_level);
+  return pending;
+}
+
+/* Returns the number of timer ticks since the OS booted.
+   Lockless: retries if a timer interrupt updates the count
+   midway through the read. */
+int64_t
+timer_ticks (void)
+{
+  int64_t t;
+  unsigned seq;
+
+  do
+    {
+      seq = seq_read_begin (&time_seq);
+      t = ticks;
+    }
+  while (seq_read_retry (&time_seq, seq));
   return t;
 }
 
+/* Adds N to the tick count.  Interrupts must be off. */
+static void
+advance_ticks (int64_t n)
+{
+  seq_write_begin (&time_seq);
+  ticks += n;
+  seq_write_end (&time_seq);
+}
+
 /* Returns the number of timer ticks elapsed since THEN, which
    should be a value once returned by timer_ticks(). */
 int64_t
@@ -98,6 +373,45 @@ timer_sleep (int64_t ticks)
   thread_sleep(ticks, start);
 }
 
+/* Sleeps for at least TICKS timer ticks, but allows the wakeup
+   to come up to SLACK ticks late.  The wakeup is moved to the
+   coarsest power-of-2 tick boundary in that window, so that
+   threads with loose deadlines, such as periodic housekeeping
+   threads, tend to wake on the same ticks, and tickless idle
+   sleeps through the ones in between.  Interrupts must be turned
+   on. */
+void
+timer_sleep_slack (int64_t ticks, int64_t slack)
+{
+  int64_t start = timer_ticks ();
+
+  ASSERT (intr_get_level () == INTR_ON);
+  ASSERT (slack >= 0);
+
+  if (ticks <= 0)
+    return;
+  thread_sleep (apply_slack (start + ticks, slack) - start, start);
+}
+
+/* Returns the tick in DEADLINE...DEADLINE + SLACK, inclusive,
+   that is a multiple of the largest power of 2.  Above that
+   power's bit, DEADLINE and DEADLINE + SLACK agree, and clearing
+   the bits below it in DEADLINE + SLACK cannot go below
+   DEADLINE. */
+static int64_t
+apply_slack (int64_t deadline, int64_t slack)
+{
+  int64_t limit = deadline + slack;
+  uint64_t diff = deadline ^ limit;
+  int bit;
+
+  if (slack == 0)
+    return deadline;
+  for (bit = 63; (diff >> bit & 1) == 0; bit--)
+    continue;
+  return limit & ~(((int64_t) 1 << bit) - 1);
+}
+
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
    turned on. */
 void
@@ -161,6 +475,67 @@ timer_ndelay (int64_t ns)
   real_time_delay (ns, 1000 * 1000 * 1000);
 }
 
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU.  In tickless mode, if no thread is due to wake
+   for at least two ticks, replaces the periodic tick by a single
+   interrupt at the earliest wake-up time, keeping the phase of
+   the tick.  The 16-bit PIT counter limits this to a few ticks. */
+void
+timer_idle_enter (void)
+{
+  int64_t limit, wake, n;
+  uint16_t left;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || oneshot_ticks != 0
+      || hr_oneshot || !list_empty (&hrtimers))
+    return;
+
+  /* PIT cycles left until the next periodic tick, then as many
+     whole ticks as fit in the counter. */
+  left = pit_read_counter (0);
+  if (left == 0)
+    return;
+  limit = ticks + 1 + (UINT16_MAX - left) / PIT_CYCLES_PER_TICK;
+
+  /* Do not skip a once-per-second MLFQS update. */
+  if (thread_mlfqs && limit > ROUND_UP (ticks + 1, TIMER_FREQ))
+    limit = ROUND_UP (ticks + 1, TIMER_FREQ);
+
+  wake = thread_next_wake (limit);
+  n = wake - ticks;
+  if (n < 2)
+    return;
+
+  oneshot_ticks = n;
+  oneshot_first = left;
+  oneshot_count = left + (n - 1) * PIT_CYCLES_PER_TICK;
+  pit_configure_oneshot (0, oneshot_count);
+}
+
+/* Called by the idle thread, with interrupts off, after the CPU
+   is woken.  If an interrupt other than the timer's woke it,
+   catches up ticks by the whole ticks elapsed so far and restores
+   the periodic tick.  If the one-shot has already fired, its
+   interrupt is pending and timer_interrupt() does the work. */
+void
+timer_idle_exit (void)
+{
+  uint16_t elapsed;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (oneshot_ticks == 0 || pit_output_high (0))
+    return;
+
+  elapsed = oneshot_count - pit_read_counter (0);
+  if (elapsed >= oneshot_first)
+    advance_ticks (1 + (elapsed - oneshot_first) / PIT_CYCLES_PER_TICK);
+  oneshot_ticks = 0;
+  pit_configure_channel (0, 2, TIMER_FREQ);
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void)
@@ -183,11 +558,72 @@ timer_print_stats (void)
 
    The value of recent cpu can be negative for a thread with a negative nice
    value. Do not clamp negative recent cpu to 0.
+
+   Only the per-tick accounting is done here.  The passes over all
+   threads and the wakeup of sleepers are left to timer_softirq(),
+   which runs as this interrupt returns, before any other thread,
+   but with interrupts on.
+
+   Plain periodic ticks usually do not get here:
+   timer_interrupt_fast() handles them from the timer's own entry
+   stub.
  */
 static void
-timer_interrupt (struct intr_frame *args UNUSED)
+timer_interrupt (struct intr_frame *args)
+{
+  if (hr_oneshot && hr_rest != 0)
+    {
+      /* Between ticks, for a high-resolution timer. */
+      hrtimer_interrupt ();
+      return;
+    }
+
+  if (profile_enabled)
+    profile_sample (args);
+  if (hr_oneshot)
+    {
+      /* The one-shot ended on the tick boundary. */
+      hr_oneshot = false;
+      pit_configure_channel (0, 2, TIMER_FREQ);
+      advance_ticks (1);
+    }
+  else if (oneshot_ticks != 0)
+    {
+      /* One-shot from tickless idle fired: catch up and resume
+         the periodic tick. */
+      advance_ticks (oneshot_ticks);
+      oneshot_ticks = 0;
+      pit_configure_channel (0, 2, TIMER_FREQ);
+    }
+  else
+    advance_ticks (1);
+  tick_work ();
+  hrtimer_run ();
+  hrtimer_program ();
+}
+
+/* Does the accounting for a tick, once TICKS has been advanced,
+   and raises the timer soft interrupt if it has anything to do
+   this tick: an MLFQS update or a sleeper to wake. */
+static void
+tick_work (void)
+{
+  charge_tick ();
+  if(thread_mlfqs)
+  {
+    if(ticks % TIMER_FREQ == 0)
+      second_due = true;
+    if(ticks % 4 == 0)
+      priority_due = true;
+  }
+  if (second_due || priority_due || thread_wake_due (ticks))
+    intr_raise_softirq (SOFTIRQ_TIMER);
+}
+
+/* Charges the running thread for a tick. */
+static void
+charge_tick (void)
 {
-  ticks++;
   thread_tick ();
   if(thread_mlfqs)
   {
@@ -197,40 +633,197 @@ timer_interrupt (struct intr_frame *args UNUSED)
     {
       cur->recent_cpu = FIXED_INT_ADD(cur->recent_cpu, 1);
     }
-    if(ticks % TIMER_FREQ == 0)
+  }
+}
+
+/* Does the accounting for a tick of a CPU other than the boot
+   CPU, from its local APIC timer (see threads/smp.c).  The boot
+   CPU's timer interrupt alone advances TICKS and does the work
+   that is not per CPU, but every running thread is charged, and
+   under the incremental MLFQS has its priority kept current. */
+void
+timer_cpu_tick (void)
+{
+  charge_tick ();
+  if(thread_mlfqs && thread_mlfqs_incremental && ticks % 4 == 0)
+    refresh_thread_advanced_priority(thread_current(), NULL);
+}
+
+/* Handles a plain periodic tick for intr_timer_fast(), which
+   calls it from the timer's entry stub without a full interrupt
+   frame.  Returns false, having done nothing, if the tick needs
+   timer_interrupt(): when the profiler wants the interrupted
+   frame, or a one-shot or high-resolution timer is running. */
+static bool
+timer_interrupt_fast (void)
+{
+  if (profile_enabled || hr_oneshot || oneshot_ticks != 0
+      || !list_empty (&hrtimers))
+    return false;
+  advance_ticks (1);
+  tick_work ();
+  return true;
+}
+
+/* Handles a timer interrupt between ticks: counts out the rest of
+   the tick and runs the high-resolution timers that are due. */
+static void
+hrtimer_interrupt (void)
+{
+  pit_configure_oneshot (0, hr_rest);
+  hr_rest = 0;
+  hrtimer_run ();
+  hrtimer_program ();
+}
+
+/* Runs the high-resolution timers that have expired.  Each may
+   start timers of its own. */
+static void
+hrtimer_run (void)
+{
+  uint64_t now = clock_ns ();
+
+  while (!list_empty (&hrtimers))
     {
+      struct hrtimer *t = list_entry (list_front (&hrtimers),
+                                      struct hrtimer, elem);
+      if (t->expires > now)
+        break;
+      list_pop_front (&hrtimers);
+      t->pending = false;
+      t->func (t->aux);
+    }
+}
+
+/* Makes sure that the PIT interrupts no later than the earliest
+   high-resolution timer's expiry, switching it to one-shot mode
+   if that comes before the next tick.  Interrupts must be off. */
+static void
+hrtimer_program (void)
+{
+  struct hrtimer *t;
+  uint64_t now;
+  uint16_t count, until_tick, target;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* With no timers, or the tickless one-shot running, the next
+     interrupt will do. */
+  if (list_empty (&hrtimers) || oneshot_ticks != 0)
+    return;
+
+  /* PIT cycles until the next interrupt, and until the next
+     tick.  If the one-shot has already run out, its interrupt is
+     pending and will call us again. */
+  if (hr_oneshot)
+    {
+      if (pit_output_high (0))
+        return;
+      count = pit_read_counter (0);
+      until_tick = count + hr_rest;
+    }
+  else
+    count = until_tick = pit_read_counter (0);
+  if (count == 0)
+    return;
+
+  t = list_entry (list_front (&hrtimers), struct hrtimer, elem);
+  now = clock_ns ();
+  if (t->expires <= now)
+    target = 1;
+  else if (t->expires - now >= NS_PER_TICK)
+    return;
+  else
+    {
+      target = (t->expires - now) * PIT_HZ / 1000000000;
+      if (target == 0)
+        target = 1;
+    }
+  if (target >= count)
+    return;
+
+  pit_configure_oneshot (0, target);
+  hr_oneshot = true;
+  hr_rest = until_tick - target;
+}
+
+/* Timer soft interrupt.  Does the MLFQS updates found due by
+   timer_interrupt() and wakes sleeping threads.  Each pass over
+   the threads needs interrupts off, but other interrupts get in
+   between passes. */
+static void
+timer_softirq (void)
+{
+  enum intr_level old_level;
+  bool second, priority;
+
+  old_level = intr_disable ();
+  second = second_due;
+  priority = priority_due;
+  second_due = priority_due = false;
+  intr_set_level (old_level);
+
+  if(thread_mlfqs)
+  {
+    if(second)
+    {
+      old_level = intr_disable ();
       calculate_load_avg();
-      thread_foreach(calculate_thread_recent_cpu, NULL);
+      thread_foreach_runnable(update_thread_recent_cpu, NULL);
+      intr_set_level (old_level);
     }
-    if(ticks % 4 == 0)
+
+    old_level = intr_disable ();
+    if(thread_mlfqs_incremental)
+    {
+      /* only the running thread's recent_cpu changes between the once per
+         second passes, so every other thread's priority is still current */
+      if(second)
+        thread_foreach_runnable(refresh_thread_advanced_priority, NULL);
+      else if(priority)
+        refresh_thread_advanced_priority(thread_current(), NULL);
+    }
+    else if(priority)
     {
-      thread_foreach(calculate_thread_advanced_priority, NULL);
-      /* resort ready_list */
+      thread_foreach_runnable(calculate_thread_advanced_priority, NULL);
+      /* move ready threads to the run queues for their new priorities */
       sort_ready_list();
     }
+    intr_set_level (old_level);
   }
   //check if tail and any elems of equivalent sleep_till needs to be woken up
   //NOTE: disable interrupts when removing from list and unblocking.
   thread_check_wake(timer_ticks());
 }
 
+/* Waits for a timer tick and returns the time stamp counter just
+   after it. */
+static uint64_t
+wait_for_tick (void)
+{
+  int64_t start = timer_ticks ();
+  while (timer_ticks () == start)
+    barrier ();
+  return rdtsc ();
+}
+
 /* Returns true if LOOPS iterations waits for more than one timer
    tick, otherwise false. */
 static bool
 too_many_loops (unsigned loops)
 {
   /* Wait for a timer tick. */
-  int64_t start = ticks;
-  while (ticks == start)
+  int64_t start = timer_ticks ();
+  while (timer_ticks () == start)
     barrier ();
 
   /* Run LOOPS loops. */
-  start = ticks;
+  start = timer_ticks ();
   busy_wait (loops);
 
   /* If the tick count changed, we iterated too long. */
   barrier ();
-  return start != ticks;
+  return start != timer_ticks ();
 }
 
 /* Iterates through a simple loop LOOPS times, for implementing
@@ -247,6 +840,30 @@ busy_wait (int64_t loops)
     barrier ();
 }
 
+/* Wakes thread T, for hr_sleep(). */
+static void
+wake_sleeper (void *t_)
+{
+  struct thread *t = t_;
+
+  thread_unblock (t);
+}
+
+/* Blocks the running thread for NS nanoseconds, on a
+   high-resolution timer. */
+static void
+hr_sleep (int64_t ns)
+{
+  struct hrtimer timer;
+  enum intr_level old_level;
+
+  hrtimer_init (&timer);
+  old_level = intr_disable ();
+  hrtimer_start (&timer, ns, wake_sleeper, thread_current ());
+  thread_block ();
+  intr_set_level (old_level);
+}
+
 /* Sleep for approximately NUM/DENOM seconds. */
 static void
 real_time_sleep (int64_t num, int32_t denom)
@@ -260,7 +877,14 @@ real_time_sleep (int64_t num, int32_t denom)
   int64_t ticks = num * TIMER_FREQ / denom;
 
   ASSERT (intr_get_level () == INTR_ON);
-  if (ticks > 0)
+  if (tsc_per_sec != 0)
+    {
+      /* Block on a high-resolution timer, which neither rounds
+         to ticks nor spins. */
+      ASSERT (1000 * 1000 * 1000 % denom == 0);
+      hr_sleep (num * (1000 * 1000 * 1000 / denom));
+    }
+  else if (ticks > 0)
     {
       /* We're waiting for at least one full timer tick.  Use
          timer_sleep() because it will yield the CPU to other
@@ -1,20 +1,44 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
-/* Number of timer interrupts per second. */
-#define TIMER_FREQ 100
+/* Number of timer interrupts per second.  Set at boot, before
+   timer_init(), by kernel command-line option "-hz=N", which
+   takes a value between TIMER_FREQ_MIN and TIMER_FREQ_MAX. */
+#define TIMER_FREQ timer_freq
+#define TIMER_FREQ_DEFAULT 100
+#define TIMER_FREQ_MIN 19               /* 8254 counter limit. */
+#define TIMER_FREQ_MAX 1000
+extern unsigned timer_freq;
+bool timer_set_freq (unsigned hz);
+
+/* If true, the idle thread stops the periodic tick and programs
+   the timer to fire once at the next sleeping thread's wake-up
+   time.  Controlled by kernel command-line option "-tickless". */
+extern bool timer_tickless;
+
+/* If nonzero, the busy-wait loops per second to assume instead of
+   calibrating them at boot.  Controlled by kernel command-line
+   option "-loops=N", which takes the value printed at boot,
+   without its digit separators. */
+extern unsigned timer_loops_per_sec;
 
 void timer_init (void);
 void timer_calibrate (void);
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+void timer_cpu_tick (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
 
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
+void timer_sleep_slack (int64_t ticks, int64_t slack);
 void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
@@ -24,6 +48,29 @@ void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
+/* High-resolution clock, from the CPU's time stamp counter. */
+uint64_t clock_cycles (void);
+uint64_t clock_ns (void);
+uint64_t clock_cycles_to_ns (uint64_t cycles);
+uint64_t clock_cycles_per_sec (void);
+
+/* High-resolution one-shot timer.  Its function runs in the timer
+   interrupt handler once the timer expires.  The PIT interrupts
+   between ticks as needed, so expiry is not rounded to a tick. */
+typedef void hrtimer_func (void *aux);
+struct hrtimer
+  {
+    struct list_elem elem;      /* Element in the pending list. */
+    uint64_t expires;           /* clock_ns() at which it expires. */
+    hrtimer_func *func;         /* Function to call. */
+    void *aux;                  /* Argument for FUNC. */
+    bool pending;               /* Started and not yet expired? */
+  };
+
+void hrtimer_init (struct hrtimer *);
+void hrtimer_start (struct hrtimer *, int64_t ns, hrtimer_func *, void *aux);
+bool hrtimer_cancel (struct hrtimer *);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
@@ -0,0 +1,217 @@
+#include "devices/tty.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include <tty.h>
+#include "devices/input.h"
+#include "threads/synch.h"
+
+/* Console line discipline, between the input buffer and readers
+   of standard input.
+
+   In raw mode, the default, a read returns the bytes typed so
+   far, waiting only if there are none yet.  In cooked mode the
+   kernel echoes input and edits it a line at a time: backspace or
+   delete erases the last character, Ctrl+U the whole line, and
+   Enter ends it.  A read then returns the completed line, with a
+   new-line at its end, or as much of it as fits, and the next read
+   returns the rest.  Ctrl+D hands over a line without a new-line,
+   or reads as end of file at the start of a line.
+
+   Keys are taken from the input buffer in batches, and never one
+   read call per byte. */
+
+/* Serializes readers and protects all of the below. */
+static struct lock tty_lock;
+
+/* TTY_RAW or TTY_COOKED. */
+static int mode;
+
+/* The line being edited, or once DONE, being read. */
+static uint8_t line[TTY_LINE_MAX];
+static size_t line_len;         /* Bytes in LINE. */
+static size_t line_ofs;         /* Bytes of a done LINE already read. */
+static bool done;               /* LINE complete? */
+
+/* Keys taken from the input buffer but not yet edited, left over
+   from a batch that completed a line. */
+static uint8_t pending[64];
+static size_t pending_ofs, pending_cnt;
+
+/* Echo of edited keys, written out a batch at a time. */
+static char echo_buf[64];
+static size_t echo_len;
+
+static void feed (bool block);
+static bool edit (uint8_t key);
+static void echo (const char *, size_t);
+static void echo_flush (void);
+
+/* Initializes the line discipline, in raw mode. */
+void
+tty_init (void) 
+{
+  lock_init (&tty_lock);
+  mode = TTY_RAW;
+}
+
+/* Switches to NEW_MODE and returns the previous mode, or -1 if
+   NEW_MODE is not valid.  A line being edited when cooked mode ends is
+   handed over as it stands. */
+int
+tty_set_mode (int new_mode) 
+{
+  int old_mode;
+
+  if (new_mode != TTY_RAW && new_mode != TTY_COOKED)
+    return -1;
+
+  lock_acquire (&tty_lock);
+  old_mode = mode;
+  if (mode == TTY_COOKED && new_mode == TTY_RAW && line_len > 0)
+    done = true;
+  mode = new_mode;
+  lock_release (&tty_lock);
+  return old_mode;
+}
+
+/* Reads up to SIZE bytes of console input into BUF and returns
+   the number read, waiting until there is something to return.
+   Returns 0 if SIZE is 0 or, in cooked mode, at end of file. */
+size_t
+tty_read (uint8_t *buf, size_t size) 
+{
+  size_t cnt = 0;
+
+  if (size == 0)
+    return 0;
+
+  lock_acquire (&tty_lock);
+  if (mode == TTY_COOKED)
+    while (!done)
+      feed (true);
+
+  if (done)
+    {
+      /* Finish a completed line first. */
+      cnt = line_len - line_ofs;
+      if (cnt > size)
+        cnt = size;
+      memcpy (buf, line + line_ofs, cnt);
+      line_ofs += cnt;
+      if (line_ofs >= line_len)
+        {
+          line_len = line_ofs = 0;
+          done = false;
+        }
+    }
+  else
+    {
+      /* Raw mode: what is left from cooked mode, then whatever is
+         in the input buffer. */
+      cnt = pending_cnt - pending_ofs;
+      if (cnt > size)
+        cnt = size;
+      memcpy (buf, pending + pending_ofs, cnt);
+      pending_ofs += cnt;
+      if (cnt == 0)
+        cnt = input_read (buf, size, true);
+    }
+  lock_release (&tty_lock);
+  return cnt;
+}
+
+/* Returns true if tty_read() would not wait. */
+bool
+tty_readable (void) 
+{
+  bool readable;
+
+  lock_acquire (&tty_lock);
+  if (mode == TTY_COOKED && !done)
+    feed (false);
+  readable = (done || pending_ofs < pending_cnt
+              || (mode == TTY_RAW && !input_empty ()));
+  lock_release (&tty_lock);
+  return readable;
+}
+
+/* Edits keys into LINE until it is done or, if BLOCK is false, the
+   keys typed so far run out.  If BLOCK is true, waits for keys if
+   there are none.  Echoes the edited keys to the console. */
+static void
+feed (bool block) 
+{
+  ASSERT (lock_held_by_current_thread (&tty_lock));
+
+  if (pending_ofs >= pending_cnt)
+    {
+      pending_ofs = 0;
+      pending_cnt = input_read (pending, sizeof pending, block);
+    }
+  while (!done && pending_ofs < pending_cnt)
+    done = edit (pending[pending_ofs++]);
+  echo_flush ();
+}
+
+/* Applies KEY to LINE and echoes its effect.  Returns true if
+   LINE is now complete. */
+static bool
+edit (uint8_t key) 
+{
+  switch (key) 
+    {
+    case '\r':
+    case '\n':
+      line[line_len++] = '\n';
+      echo ("\n", 1);
+      return true;
+
+    case ('D' - 'A') + 1:       /* Ctrl+D. */
+      return true;
+
+    case '\b':
+    case 0x7f:                  /* Delete. */
+      if (line_len > 0)
+        {
+          line_len--;
+          echo ("\b \b", 3);
+        }
+      return false;
+
+    case ('U' - 'A') + 1:       /* Ctrl+U. */
+      for (; line_len > 0; line_len--)
+        echo ("\b \b", 3);
+      return false;
+
+    default:
+      /* Keep the last byte free for the new-line. */
+      if (line_len < TTY_LINE_MAX - 1)
+        {
+          line[line_len++] = key;
+          echo ((const char *) &key, 1);
+        }
+      return false;
+    }
+}
+
+/* Adds the SIZE bytes in S to the echo buffer. */
+static void
+echo (const char *s, size_t size) 
+{
+  if (echo_len + size > sizeof echo_buf)
+    echo_flush ();
+  memcpy (echo_buf + echo_len, s, size);
+  echo_len += size;
+}
+
+/* Writes the echo buffer to the console and empties it. */
+static void
+echo_flush (void) 
+{
+  if (echo_len > 0)
+    {
+      putbuf (echo_buf, echo_len);
+      echo_len = 0;
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef DEVICES_TTY_H
+#define DEVICES_TTY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+void tty_init (void);
+int tty_set_mode (int mode);
+size_t tty_read (uint8_t *, size_t);
+bool tty_readable (void);
+
+#endif /* devices/tty.h */
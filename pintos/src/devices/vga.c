@@ -14,22 +14,35 @@
 #define COL_CNT 80
 #define ROW_CNT 25
 
+/* Number of rows that fit in the 32 kB of VGA memory at
+   0xb8000. */
+#define BUF_ROWS (0x8000 / (COL_CNT * 2))
+
 /* Current cursor position.  (0,0) is in the upper left corner of
    the display. */
 static size_t cx, cy;
 
+/* Row of the framebuffer shown at the top of the display.  The
+   display scrolls by advancing this row and pointing the CRTC
+   start address at it, over the BUF_ROWS rows of VGA memory;
+   only when the bottom of VGA memory is reached are the visible
+   rows copied back to the top. */
+static size_t top;
+
 /* Attribute value for gray text on a black background. */
 #define GRAY_ON_BLACK 0x07
 
 /* Framebuffer.  See [FREEVGA] under "VGA Text Mode Operation".
-   The character at (x,y) is fb[y][x][0].
-   The attribute at (x,y) is fb[y][x][1]. */
+   The character at (x,y) on the display is fb[top + y][x][0].
+   The attribute at (x,y) on the display is fb[top + y][x][1]. */
 static uint8_t (*fb)[COL_CNT][2];
 
+static void putc_raw (int c, enum intr_level old_level);
 static void clear_row (size_t y);
 static void cls (void);
 static void newline (void);
 static void move_cursor (void);
+static void set_start (void);
 static void find_cursor (size_t *x, size_t *y);
 
 /* Initializes the VGA text display. */
@@ -41,6 +54,8 @@ init (void)
   if (!inited)
     {
       fb = ptov (0xb8000);
+      top = 0;
+      set_start ();
       find_cursor (&cx, &cy);
       inited = true; 
     }
@@ -56,7 +71,36 @@ vga_putc (int c)
   enum intr_level old_level = intr_disable ();
 
   init ();
-  
+  putc_raw (c, old_level);
+
+  /* Update cursor position. */
+  move_cursor ();
+
+  intr_set_level (old_level);
+}
+
+/* Writes the SIZE characters in BUF to the VGA text display,
+   like vga_putc() on each in turn, but disabling interrupts and
+   moving the hardware cursor only once. */
+void
+vga_putbuf (const char *buf, size_t size) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  init ();
+  while (size-- > 0)
+    putc_raw (*buf++, old_level);
+  move_cursor ();
+
+  intr_set_level (old_level);
+}
+
+/* Writes C to the framebuffer for vga_putc() or vga_putbuf(),
+   which run with interrupts off and were called at interrupt
+   level OLD_LEVEL.  Does not move the hardware cursor. */
+static void
+putc_raw (int c, enum intr_level old_level) 
+{
   switch (c) 
     {
     case '\n':
@@ -89,17 +133,12 @@ vga_putc (int c)
       break;
       
     default:
-      fb[cy][cx][0] = c;
-      fb[cy][cx][1] = GRAY_ON_BLACK;
+      fb[top + cy][cx][0] = c;
+      fb[top + cy][cx][1] = GRAY_ON_BLACK;
       if (++cx >= COL_CNT)
         newline ();
       break;
     }
-
-  /* Update cursor position. */
-  move_cursor ();
-
-  intr_set_level (old_level);
 }
 
 /* Clears the screen and moves the cursor to the upper left. */
@@ -108,6 +147,8 @@ cls (void)
 {
   size_t y;
 
+  top = 0;
+  set_start ();
   for (y = 0; y < ROW_CNT; y++)
     clear_row (y);
 
@@ -115,7 +156,7 @@ cls (void)
   move_cursor ();
 }
 
-/* Clears row Y to spaces. */
+/* Clears framebuffer row Y to spaces. */
 static void
 clear_row (size_t y) 
 {
@@ -139,8 +180,15 @@ newline (void)
   if (cy >= ROW_CNT)
     {
       cy = ROW_CNT - 1;
-      memmove (&fb[0], &fb[1], sizeof fb[0] * (ROW_CNT - 1));
-      clear_row (ROW_CNT - 1);
+      if (top + ROW_CNT < BUF_ROWS)
+        top++;
+      else
+        {
+          memmove (&fb[0], &fb[top + 1], sizeof fb[0] * (ROW_CNT - 1));
+          top = 0;
+        }
+      clear_row (top + ROW_CNT - 1);
+      set_start ();
     }
 }
 
@@ -149,11 +197,23 @@ static void
 move_cursor (void) 
 {
   /* See [FREEVGA] under "Manipulating the Text-mode Cursor". */
-  uint16_t cp = cx + COL_CNT * cy;
+  uint16_t cp = cx + COL_CNT * (top + cy);
   outw (0x3d4, 0x0e | (cp & 0xff00));
   outw (0x3d4, 0x0f | (cp << 8));
 }
 
+/* Points the CRTC start address at framebuffer row TOP, so that
+   the display shows rows TOP through TOP + ROW_CNT - 1. */
+static void
+set_start (void) 
+{
+  /* See [FREEVGA] under "CRTC Registers", "Start Address High
+     Register" and "Start Address Low Register". */
+  uint16_t start = COL_CNT * top;
+  outw (0x3d4, 0x0c | (start & 0xff00));
+  outw (0x3d4, 0x0d | (start << 8));
+}
+
 /* Reads the current hardware cursor position into (*X,*Y). */
 static void
 find_cursor (size_t *x, size_t *y) 
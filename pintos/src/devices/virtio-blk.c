@@ -0,0 +1,448 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file drives virtio block devices through the
+   legacy PCI interface of [Virtio] 0.9.5, which every hypervisor
+   that offers virtio-blk still provides.  Each disk has a single
+   virtqueue with room for many requests at once.  Requests are
+   posted without waiting for each other, and the interrupt
+   handler retires every completed request it finds, so one
+   interrupt often completes several of them. */
+
+/* PCI IDs of a legacy or transitional virtio block device. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* Legacy virtio registers, as offsets into I/O BAR 0. */
+#define VIRTIO_FEATURES 0x00    /* Device features (r/o, 32 bits). */
+#define VIRTIO_GUEST_FEATURES 0x04 /* Driver features (32 bits). */
+#define VIRTIO_QUEUE_PFN 0x08   /* Queue page frame number (32 bits). */
+#define VIRTIO_QUEUE_SIZE 0x0c  /* Queue size (r/o, 16 bits). */
+#define VIRTIO_QUEUE_SELECT 0x0e /* Queue select (16 bits). */
+#define VIRTIO_QUEUE_NOTIFY 0x10 /* Queue notify (16 bits). */
+#define VIRTIO_STATUS 0x12      /* Device status (8 bits). */
+#define VIRTIO_ISR 0x13         /* ISR status, cleared by reads (8 bits). */
+#define VIRTIO_BLK_CAPACITY 0x14 /* Capacity in sectors (64 bits). */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* Guest has noticed the device. */
+#define STATUS_DRIVER 0x02      /* Guest knows how to drive it. */
+#define STATUS_DRIVER_OK 0x04   /* Driver is ready. */
+
+/* ISR status bits. */
+#define ISR_QUEUE 0x01          /* A virtqueue has used buffers. */
+
+/* Legacy virtqueues must be aligned to this many bytes. */
+#define VRING_ALIGN PGSIZE
+
+/* A virtqueue descriptor. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address of buffer. */
+    uint32_t len;               /* Length of buffer in bytes. */
+    uint16_t flags;             /* VRING_DESC_F_* flags. */
+    uint16_t next;              /* Next descriptor in chain. */
+  };
+
+#define VRING_DESC_F_NEXT 1     /* Chain continues at NEXT. */
+#define VRING_DESC_F_WRITE 2    /* Device writes the buffer. */
+
+/* The ring of descriptor chains the driver offers the device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the driver puts the next entry. */
+    uint16_t ring[];            /* Heads of descriptor chains. */
+  };
+
+/* An entry in the used ring. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of completed chain. */
+    uint32_t len;               /* Bytes written by the device. */
+  };
+
+/* The ring of chains the device has finished with. */
+struct vring_used
+  {
+    uint16_t flags;             /* VRING_USED_F_* flags. */
+    uint16_t idx;               /* Where the device puts the next entry. */
+    struct vring_used_elem ring[];
+  };
+
+#define VRING_USED_F_NO_NOTIFY 1 /* Device does not need kicks. */
+
+/* Request types. */
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+
+/* The header that starts every request. */
+struct virtio_blk_header
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;            /* First sector. */
+  };
+
+/* Most requests a disk has outstanding at once.  Each uses three
+   descriptors: header, data, and status byte. */
+#define SLOT_MAX 64
+
+/* Most sectors moved by one request.  Longer transfers are split
+   into several requests, all outstanding at once. */
+#define REQUEST_SECTORS 256
+
+/* A thread waiting for its requests to complete. */
+struct waiter
+  {
+    struct semaphore done;      /* Up'd once per completed request. */
+    bool failed;                /* Did any request fail? */
+  };
+
+/* Room for one outstanding request.  Slot I uses descriptors
+   3 * I through 3 * I + 2, chained together for good. */
+struct slot
+  {
+    struct virtio_blk_header header; /* Read by the device. */
+    uint8_t status;             /* Written by the device; 0 is success. */
+    struct waiter *waiter;      /* Owner of the request. */
+  };
+
+/* A virtio block device. */
+struct virtio_disk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* Base of legacy registers. */
+    uint8_t irq;                /* Interrupt vector. */
+    block_sector_t capacity;    /* Capacity in sectors. */
+
+    uint16_t queue_size;        /* Number of descriptors. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    struct vring_used *used;    /* Used ring. */
+    uint16_t last_used;         /* Next used entry to retire. */
+
+    struct slot *slots;         /* Request slots. */
+    size_t slot_cnt;            /* Number of slots. */
+    uint8_t free_slots[SLOT_MAX]; /* Stack of free slot numbers. */
+    size_t free_cnt;            /* Number of free slots. */
+    struct semaphore slot_sema; /* Counts free slots. */
+  };
+
+/* Most virtio block devices used. */
+#define DISK_MAX 4
+static struct virtio_disk disks[DISK_MAX];
+static size_t disk_cnt;
+
+static struct block_operations virtio_blk_operations;
+
+static bool init_disk (struct virtio_disk *, const struct pci_device *);
+static intr_handler_func interrupt_handler;
+
+/* Finds virtio block devices on the PCI bus and registers them. */
+void
+virtio_blk_init (void) 
+{
+  struct pci_device pci;
+  int i;
+
+  for (i = 0; disk_cnt < DISK_MAX
+         && pci_find_device (VIRTIO_VENDOR, VIRTIO_BLK_DEVICE, i, &pci); i++)
+    {
+      struct virtio_disk *d = &disks[disk_cnt];
+      struct block *block;
+      char extra_info[32];
+
+      snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+      if (!init_disk (d, &pci))
+        continue;
+      disk_cnt++;
+
+      snprintf (extra_info, sizeof extra_info, "virtio, %u requests",
+                (unsigned) d->slot_cnt);
+      block = block_register (d->name, BLOCK_RAW, extra_info, d->capacity,
+                              &virtio_blk_operations, d);
+      partition_scan (block);
+    }
+}
+
+/* Returns the number of bytes in a legacy virtqueue with SIZE
+   descriptors, followed by the offset of its used ring in
+   *USED_OFS. */
+static size_t
+vring_bytes (uint16_t size, size_t *used_ofs) 
+{
+  *used_ofs = ROUND_UP (sizeof (struct vring_desc) * size
+                        + sizeof (uint16_t) * (3 + size), VRING_ALIGN);
+  return *used_ofs + ROUND_UP (sizeof (uint16_t) * 3
+                               + sizeof (struct vring_used_elem) * size,
+                               VRING_ALIGN);
+}
+
+/* Resets and sets up disk D, found at PCI function PCI, and
+   starts it.  Returns true if successful, false if the device
+   cannot be used. */
+static bool
+init_disk (struct virtio_disk *d, const struct pci_device *pci) 
+{
+  uint32_t bar = pci_read_config (pci, PCI_REG_BAR0);
+  uint32_t line = pci_read_config (pci, PCI_REG_IRQ) & 0xff;
+  uint64_t capacity;
+  size_t used_ofs, page_cnt, i;
+  uint8_t *ring;
+
+  if (!(bar & 1) || line >= 16)
+    {
+      printf ("%s: no I/O ports or interrupt line, ignoring\n", d->name);
+      return false;
+    }
+  d->io_base = bar & 0xfffc;
+  d->irq = 0x20 + line;
+  pci_enable_bus_master (pci);
+
+  /* Reset, then say hello.  No optional features are needed. */
+  outb (d->io_base + VIRTIO_STATUS, 0);
+  outb (d->io_base + VIRTIO_STATUS, STATUS_ACKNOWLEDGE);
+  outb (d->io_base + VIRTIO_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  outl (d->io_base + VIRTIO_GUEST_FEATURES, 0);
+
+  capacity = (inl (d->io_base + VIRTIO_BLK_CAPACITY)
+              | (uint64_t) inl (d->io_base + VIRTIO_BLK_CAPACITY + 4) << 32);
+  d->capacity = capacity < UINT32_MAX ? capacity : UINT32_MAX;
+
+  /* Set up queue 0, the only one. */
+  outw (d->io_base + VIRTIO_QUEUE_SELECT, 0);
+  d->queue_size = inw (d->io_base + VIRTIO_QUEUE_SIZE);
+  if (d->queue_size < 3)
+    {
+      printf ("%s: queue too small, ignoring\n", d->name);
+      return false;
+    }
+  page_cnt = vring_bytes (d->queue_size, &used_ofs) / PGSIZE;
+  ring = palloc_get_multiple (PAL_ZERO, page_cnt);
+  d->slots = palloc_get_page (PAL_ZERO);
+  if (ring == NULL || d->slots == NULL)
+    PANIC ("%s: out of memory for virtqueue", d->name);
+  d->desc = (struct vring_desc *) ring;
+  d->avail = (struct vring_avail *) (ring + (sizeof (struct vring_desc)
+                                             * d->queue_size));
+  d->used = (struct vring_used *) (ring + used_ofs);
+  d->last_used = 0;
+
+  /* Chain each slot's descriptors once and for all. */
+  d->slot_cnt = d->queue_size / 3;
+  if (d->slot_cnt > SLOT_MAX)
+    d->slot_cnt = SLOT_MAX;
+  if (d->slot_cnt > PGSIZE / sizeof *d->slots)
+    d->slot_cnt = PGSIZE / sizeof *d->slots;
+  for (i = 0; i < d->slot_cnt; i++) 
+    {
+      struct slot *s = &d->slots[i];
+      struct vring_desc *desc = &d->desc[3 * i];
+
+      desc[0].addr = vtop (&s->header);
+      desc[0].len = sizeof s->header;
+      desc[0].flags = VRING_DESC_F_NEXT;
+      desc[0].next = 3 * i + 1;
+      desc[1].flags = VRING_DESC_F_NEXT;
+      desc[1].next = 3 * i + 2;
+      desc[2].addr = vtop (&s->status);
+      desc[2].len = 1;
+      desc[2].flags = VRING_DESC_F_WRITE;
+      d->free_slots[i] = i;
+    }
+  d->free_cnt = d->slot_cnt;
+  sema_init (&d->slot_sema, d->slot_cnt);
+
+  outl (d->io_base + VIRTIO_QUEUE_PFN, vtop (ring) / VRING_ALIGN);
+
+  /* Disks that share an interrupt line share its handler. */
+  for (i = 0; i < disk_cnt; i++)
+    if (disks[i].irq == d->irq)
+      break;
+  if (i == disk_cnt)
+    intr_register_ext (d->irq, interrupt_handler, d->name);
+
+  outb (d->io_base + VIRTIO_STATUS,
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+  return true;
+}
+
+/* Posts a request to transfer CNT sectors between disk D,
+   starting at SECTOR, and BUFFER.  WRITE selects the direction.
+   W is up'd when the request completes.  Returns true if the
+   device must be notified of new requests.  Interrupts must be
+   off. */
+static bool
+post_request (struct virtio_disk *d, block_sector_t sector, size_t cnt,
+              void *buffer, bool write, struct waiter *w) 
+{
+  size_t idx;
+  struct slot *s;
+  struct vring_desc *data;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (d->free_cnt > 0);
+
+  idx = d->free_slots[--d->free_cnt];
+  s = &d->slots[idx];
+  s->header.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  s->header.reserved = 0;
+  s->header.sector = sector;
+  s->status = 0xff;
+  s->waiter = w;
+
+  /* Kernel virtual memory maps physical memory linearly, so BUFFER
+     is physically contiguous. */
+  data = &d->desc[3 * idx + 1];
+  data->addr = vtop (buffer);
+  data->len = cnt * BLOCK_SECTOR_SIZE;
+  data->flags = VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE);
+
+  /* The device may look at the ring entry as soon as the index
+     moves past it. */
+  d->avail->ring[d->avail->idx % d->queue_size] = 3 * idx;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  return !(d->used->flags & VRING_USED_F_NO_NOTIFY);
+}
+
+/* Transfers CNT sectors between disk D, starting at SECTOR, and
+   BUFFER.  WRITE selects the direction.  The transfer is split
+   into requests of up to REQUEST_SECTORS sectors, which are all
+   posted as soon as there are free slots for them; the calling
+   thread then sleeps until every one of them has completed. */
+static void
+transfer (struct virtio_disk *d, block_sector_t sector, size_t cnt,
+          uint8_t *buffer, bool write) 
+{
+  block_sector_t start = sector;
+  struct waiter w;
+  size_t posted = 0;
+  size_t i;
+
+  ASSERT (is_kernel_vaddr (buffer));
+
+  sema_init (&w.done, 0);
+  w.failed = false;
+  while (cnt > 0) 
+    {
+      size_t req_cnt = cnt < REQUEST_SECTORS ? cnt : REQUEST_SECTORS;
+      enum intr_level old_level;
+      bool notify;
+
+      sema_down (&d->slot_sema);
+      old_level = intr_disable ();
+      notify = post_request (d, sector, req_cnt, buffer, write, &w);
+      if (notify)
+        outw (d->io_base + VIRTIO_QUEUE_NOTIFY, 0);
+      intr_set_level (old_level);
+      posted++;
+
+      buffer += req_cnt * BLOCK_SECTOR_SIZE;
+      sector += req_cnt;
+      cnt -= req_cnt;
+    }
+
+  for (i = 0; i < posted; i++)
+    sema_down (&w.done);
+  if (w.failed)
+    PANIC ("%s: %s failed, sector=%"PRDSNu,
+           d->name, write ? "write" : "read", start);
+}
+
+/* Retires every request that disk D has completed. */
+static void
+complete_requests (struct virtio_disk *d) 
+{
+  while (d->last_used != d->used->idx) 
+    {
+      struct vring_used_elem *e;
+      size_t idx;
+      struct slot *s;
+
+      barrier ();
+      e = &d->used->ring[d->last_used % d->queue_size];
+      idx = e->id / 3;
+      ASSERT (idx < d->slot_cnt);
+      s = &d->slots[idx];
+      if (s->status != 0)
+        s->waiter->failed = true;
+      sema_up (&s->waiter->done);
+      d->free_slots[d->free_cnt++] = idx;
+      sema_up (&d->slot_sema);
+      d->last_used++;
+    }
+}
+
+/* Virtio block interrupt handler.  Reading a disk's ISR status
+   acknowledges the interrupt, so every disk on the line is
+   checked. */
+static void
+interrupt_handler (struct intr_frame *f) 
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++) 
+    {
+      struct virtio_disk *d = &disks[i];
+      if (d->irq == f->vec_no && (inb (d->io_base + VIRTIO_ISR) & ISR_QUEUE))
+        complete_requests (d);
+    }
+}
+
+/* Reads sector SECTOR from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+virtio_blk_read (void *d, block_sector_t sector, void *buffer) 
+{
+  transfer (d, sector, 1, buffer, false);
+}
+
+/* Writes sector SECTOR to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+virtio_blk_write (void *d, block_sector_t sector, const void *buffer) 
+{
+  transfer (d, sector, 1, (void *) buffer, true);
+}
+
+/* Reads CNT sectors starting at SECTOR from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes. */
+static void
+virtio_blk_read_multiple (void *d, block_sector_t sector, size_t cnt,
+                          void *buffer) 
+{
+  transfer (d, sector, cnt, buffer, false);
+}
+
+/* Writes CNT sectors starting at SECTOR to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes. */
+static void
+virtio_blk_write_multiple (void *d, block_sector_t sector, size_t cnt,
+                           const void *buffer) 
+{
+  transfer (d, sector, cnt, (void *) buffer, true);
+}
+
+static struct block_operations virtio_blk_operations =
+  {
+    virtio_blk_read,
+    virtio_blk_write,
+    virtio_blk_read_multiple,
+    virtio_blk_write_multiple
+  };
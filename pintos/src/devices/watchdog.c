@@ -0,0 +1,152 @@
+#include "devices/watchdog.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "devices/rtc.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* Stall watchdog.
+
+   The RTC's periodic interrupt is a time source independent of
+   the PIT.  On each one, the watchdog checks that the interrupt
+   itself was not held off, that the timer tick advanced, and that
+   the running thread has not kept a pending preemption waiting,
+   each for no longer than watchdog_ms.  A stall is reported once,
+   when first seen, with a backtrace of the code the interrupt
+   found running.
+
+   The RTC interrupt is maskable, so a span with interrupts off
+   is seen only after it ends, and its backtrace shows where
+   interrupts came back on rather than where they went off. */
+
+unsigned watchdog_ms;
+
+/* RTC interrupts per second, and nanoseconds between them. */
+#define WATCHDOG_HZ 64
+#define WATCHDOG_PERIOD_NS (1000 * 1000 * 1000 / WATCHDOG_HZ)
+
+/* Kinds of stall. */
+enum stall
+  {
+    STALL_INTR,                 /* Interrupts off. */
+    STALL_TICK,                 /* Timer tick not advancing. */
+    STALL_PREEMPT,              /* Preemption pending but disabled. */
+    STALL_CNT
+  };
+
+static const char *stall_names[STALL_CNT] =
+  {
+    "interrupts off",
+    "timer tick stopped",
+    "preemption held off",
+  };
+
+/* Per kind of stall. */
+static unsigned stall_cnt[STALL_CNT];   /* Stalls seen. */
+static uint64_t stall_max_ns[STALL_CNT]; /* Longest, in ns. */
+static bool stall_reported[STALL_CNT];  /* Current stall reported? */
+
+static uint64_t threshold_ns;   /* watchdog_ms in ns. */
+static uint64_t last_ns;        /* Time of the previous check. */
+static int64_t last_ticks;      /* Tick count at the last change. */
+static uint64_t tick_ns;        /* Time of the last tick change. */
+static tid_t held_tid;          /* Thread holding off preemption. */
+static unsigned held_switches;  /* Its context switches then. */
+static uint64_t held_ns;        /* Time it was first seen so. */
+
+static void watchdog_check (void);
+static void stalled (enum stall, uint64_t ns);
+
+/* Starts the watchdog, if the "-watchdog" option asked for it.
+   Must follow timer_calibrate(), since stalls are timed with the
+   time stamp counter. */
+void
+watchdog_init (void)
+{
+  if (watchdog_ms == 0 || clock_cycles_per_sec () == 0)
+    return;
+
+  threshold_ns = (uint64_t) watchdog_ms * 1000 * 1000;
+  last_ns = tick_ns = clock_ns ();
+  last_ticks = timer_ticks ();
+  held_tid = TID_ERROR;
+  rtc_start_periodic (WATCHDOG_HZ, watchdog_check);
+}
+
+/* Checks for stalls.  Called from the RTC interrupt. */
+static void
+watchdog_check (void)
+{
+  struct thread *cur = thread_current ();
+  unsigned switches = cur->voluntary_switches + cur->involuntary_switches;
+  uint64_t now = clock_ns ();
+  int64_t ticks = timer_ticks ();
+
+  /* An RTC interrupt one period late was held off that long. */
+  if (now - last_ns > WATCHDOG_PERIOD_NS + threshold_ns)
+    stalled (STALL_INTR, now - last_ns - WATCHDOG_PERIOD_NS);
+  else
+    stall_reported[STALL_INTR] = false;
+  last_ns = now;
+
+  /* With -tickless, the idle thread stops the tick and catches
+     it up only after this handler returns. */
+  if (ticks != last_ticks || thread_is_idle ())
+    {
+      last_ticks = ticks;
+      tick_ns = now;
+      stall_reported[STALL_TICK] = false;
+    }
+  else if (now - tick_ns > threshold_ns)
+    stalled (STALL_TICK, now - tick_ns);
+
+  /* A thread that disables preemption and runs on while another
+     thread waits to preempt it never switches away. */
+  if (!cur->preempt_pending || cur->preempt_count == 0
+      || cur->tid != held_tid || switches != held_switches)
+    {
+      held_tid = cur->tid;
+      held_switches = switches;
+      held_ns = now;
+      stall_reported[STALL_PREEMPT] = false;
+    }
+  else if (now - held_ns > threshold_ns)
+    stalled (STALL_PREEMPT, now - held_ns);
+}
+
+/* Accounts for a stall of the given TYPE, ongoing or just ended,
+   that has lasted NS nanoseconds so far.  Reports it if it is
+   new. */
+static void
+stalled (enum stall type, uint64_t ns)
+{
+  if (ns > stall_max_ns[type])
+    stall_max_ns[type] = ns;
+  if (stall_reported[type])
+    return;
+  stall_reported[type] = true;
+  stall_cnt[type]++;
+
+  printf ("Watchdog: %s for %"PRIu64" ms in thread %s.\n",
+          stall_names[type], ns / (1000 * 1000), thread_name ());
+  debug_backtrace ();
+}
+
+/* Prints watchdog statistics, if it is running. */
+void
+watchdog_print_stats (void)
+{
+  int i;
+
+  if (threshold_ns == 0)
+    return;
+
+  printf ("Watchdog:");
+  for (i = 0; i < STALL_CNT; i++)
+    printf ("%s %u %s (longest %"PRIu64" ms)", i > 0 ? "," : "",
+            stall_cnt[i], stall_names[i], stall_max_ns[i] / (1000 * 1000));
+  printf ("\n");
+}
@@ -0,0 +1,11 @@
+#ifndef DEVICES_WATCHDOG_H
+#define DEVICES_WATCHDOG_H
+
+/* Stall threshold in milliseconds, or 0 to leave the watchdog
+   off.  Controlled by kernel command-line option "-watchdog=MS". */
+extern unsigned watchdog_ms;
+
+void watchdog_init (void);
+void watchdog_print_stats (void);
+
+#endif /* devices/watchdog.h */
@@ -20,14 +20,7 @@ main (int argc, char *argv[])
           success = false;
           continue;
         }
-      for (;;) 
-        {
-          char buffer[1024];
-          int bytes_read = read (fd, buffer, sizeof buffer);
-          if (bytes_read == 0)
-            break;
-          write (STDOUT_FILENO, buffer, bytes_read);
-        }
+      sendfile (STDOUT_FILENO, fd, -1, filesize (fd));
       close (fd);
     }
   return success ? EXIT_SUCCESS : EXIT_FAILURE;
@@ -38,17 +38,10 @@ main (int argc, char *argv[])
     }
 
   /* Copy data. */
-  for (;;) 
+  if (sendfile (out_fd, in_fd, 0, filesize (in_fd)) != filesize (in_fd))
     {
-      char buffer[1024];
-      int bytes_read = read (in_fd, buffer, sizeof buffer);
-      if (bytes_read == 0)
-        break;
-      if (write (out_fd, buffer, bytes_read) != bytes_read) 
-        {
-          printf ("%s: write failed\n", argv[2]);
-          return EXIT_FAILURE;
-        }
+      printf ("%s: write failed\n", argv[2]);
+      return EXIT_FAILURE;
     }
 
   return EXIT_SUCCESS;
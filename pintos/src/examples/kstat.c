@@ -0,0 +1,93 @@
+/* kstat.c
+
+   Samples the kernel's statistics COUNT times, INTERVAL
+   milliseconds apart, printing what changed in between.  With no
+   arguments, prints one snapshot of the totals since boot. */
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+static bool sample (struct kstat *);
+static void print_delta (const struct kstat *now, const struct kstat *then);
+
+int
+main (int argc, char *argv[])
+{
+  static struct kstat then, now;
+  int interval = 1000;
+  int count = 1;
+  int i;
+
+  if (argc > 3)
+    {
+      printf ("usage: kstat [INTERVAL [COUNT]]\n");
+      return EXIT_FAILURE;
+    }
+  if (argc > 1)
+    {
+      interval = atoi (argv[1]);
+      count = argc > 2 ? atoi (argv[2]) : 10;
+    }
+
+  memset (&then, 0, sizeof then);
+  for (i = 0; i < count; i++)
+    {
+      if (i > 0)
+        poll (NULL, 0, interval);
+      if (!sample (&now))
+        return EXIT_FAILURE;
+      print_delta (&now, &then);
+      then = now;
+    }
+  return EXIT_SUCCESS;
+}
+
+/* Reads a snapshot into *K.  Returns false if it fails or comes
+   from an older kernel, whose snapshot is shorter. */
+static bool
+sample (struct kstat *k)
+{
+  int size = stats (k, sizeof *k);
+
+  if (size < 0)
+    {
+      printf ("kstat: stats failed\n");
+      return false;
+    }
+  if ((unsigned) size < sizeof *k || k->version < KSTAT_VERSION)
+    {
+      printf ("kstat: kernel statistics version %u is too old\n",
+              (unsigned) k->version);
+      return false;
+    }
+  return true;
+}
+
+/* Prints the counters of NOW less those of THEN. */
+static void
+print_delta (const struct kstat *now, const struct kstat *then)
+{
+  long long reads = 0, writes = 0;
+  int i;
+
+  for (i = 0; i < KSTAT_BLOCK_CNT; i++)
+    {
+      reads += now->block[i].reads.sector_cnt - then->block[i].reads.sector_cnt;
+      writes += (now->block[i].writes.sector_cnt
+                 - then->block[i].writes.sector_cnt);
+    }
+
+  printf ("ticks %lld (idle %lld, kernel %lld, user %lld), "
+          "faults %lld, swap %lld out %lld in, sectors %lld read %lld written\n",
+          now->ticks - then->ticks,
+          now->idle_ticks - then->idle_ticks,
+          now->kernel_ticks - then->kernel_ticks,
+          now->user_ticks - then->user_ticks,
+          now->page_faults - then->page_faults,
+          now->swap_outs - then->swap_outs,
+          now->swap_ins - then->swap_ins,
+          reads, writes);
+}
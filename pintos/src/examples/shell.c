@@ -3,12 +3,13 @@
 #include <string.h>
 #include <syscall.h>
 
-static void read_line (char line[], size_t);
-static bool backspace (char **pos, char line[]);
+static bool read_line (char line[], size_t);
 
 int
 main (void)
 {
+  int old_mode = ttymode (TTY_COOKED);
+
   printf ("Shell starting...\n");
   for (;;) 
     {
@@ -16,7 +17,8 @@ main (void)
 
       /* Read command. */
       printf ("--");
-      read_line (command, sizeof command);
+      if (!read_line (command, sizeof command))
+        break;
       
       /* Execute command. */
       if (!strcmp (command, "exit"))
@@ -41,64 +43,45 @@ main (void)
     }
 
   printf ("Shell exiting.");
+  ttymode (old_mode);
   return EXIT_SUCCESS;
 }
 
 /* Reads a line of input from the user into LINE, which has room
-   for SIZE bytes.  Handles backspace and Ctrl+U in the ways
-   expected by Unix users.  On return, LINE will always be
-   null-terminated and will not end in a new-line character. */
-static void
+   for SIZE bytes.  The kernel's cooked mode echoes the line and
+   handles backspace and Ctrl+U in the ways expected by Unix users,
+   and hands it over whole once Enter is pressed.  On return, LINE
+   will always be null-terminated and will not end in a new-line
+   character.  Returns false at end of input. */
+static bool
 read_line (char line[], size_t size) 
 {
-  char *pos = line;
+  size_t len = 0;
+
   for (;;)
     {
-      char c;
-      read (STDIN_FILENO, &c, 1);
+      int n = read (STDIN_FILENO, line + len, size - 1 - len);
 
-      switch (c) 
+      if (n <= 0)
         {
-        case '\r':
-          *pos = '\0';
-          putchar ('\n');
-          return;
-
-        case '\b':
-          backspace (&pos, line);
-          break;
+          line[len] = '\0';
+          return len > 0;
+        }
+      len += n;
+      if (line[len - 1] == '\n')
+        {
+          line[len - 1] = '\0';
+          return true;
+        }
+      if (len == size - 1)
+        {
+          /* Line too long: keep its start and drop the rest. */
+          char c;
 
-        case ('U' - 'A') + 1:       /* Ctrl+U. */
-          while (backspace (&pos, line))
+          line[len] = '\0';
+          while (read (STDIN_FILENO, &c, 1) == 1 && c != '\n')
             continue;
-          break;
-
-        default:
-          /* Add character to line. */
-          if (pos < line + size - 1) 
-            {
-              putchar (c);
-              *pos++ = c;
-            }
-          break;
+          return true;
         }
     }
 }
-
-/* If *POS is past the beginning of LINE, backs up one character
-   position.  Returns true if successful, false if nothing was
-   done. */
-static bool
-backspace (char **pos, char line[]) 
-{
-  if (*pos > line)
-    {
-      /* Back up cursor, overwrite character, back up
-         again. */
-      printf ("\b \b");
-      (*pos)--;
-      return true;
-    }
-  else
-    return false;
-}
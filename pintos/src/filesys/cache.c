@@ -0,0 +1,439 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "filesys/pagecache.h"
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Sector buffer cache.
+
+   All file system metadata I/O, for inodes, index sectors,
+   directories, and the free map, goes through a fixed set of
+   CACHE_SECTORS sector buffers.  File data goes through the page
+   cache instead.  A sector stays cached until the clock algorithm
+   picks its entry for reuse.  Writes only dirty the cached copy;
+   dirty sectors are written back when they are evicted, by the
+   write-behind thread every WRITE_BEHIND_TICKS, and when the cache
+   is flushed at shutdown.
+
+   Writes made within a journal operation are instead logged with
+   journal_log() and leave the cached copy clean, since the journal
+   writes them home itself.  A sector read in from disk therefore
+   takes the journal's copy, if it has one.
+
+   cache_lock protects the mapping from sectors to entries: an
+   entry's `sector' and `valid' members, and the clock hand.  Each
+   entry's own lock protects its data and `dirty' bit and is held
+   across the I/O that fills it, so that threads using different
+   sectors do not wait for each other's disk reads.  A thread never
+   waits for an entry lock while holding cache_lock. */
+
+/* A cached sector. */
+struct cache_entry
+  {
+    struct lock lock;                   /* Protects data and dirty. */
+    block_sector_t sector;              /* Sector held, if valid. */
+    bool valid;                         /* Does this entry hold a sector? */
+    bool dirty;                         /* Modified since read from disk? */
+    bool accessed;                      /* Used since the clock hand
+                                           last passed? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SECTORS];
+static struct lock cache_lock;          /* Protects sector mapping. */
+static size_t clock_hand;               /* Next entry to consider. */
+
+/* Timer ticks between write-behind passes, and how much later
+   than that a pass may start, to share its wakeup with other
+   housekeeping. */
+#define WRITE_BEHIND_TICKS (5 * TIMER_FREQ)
+#define WRITE_BEHIND_SLACK (TIMER_FREQ / 4)
+
+/* Most sectors cache_prefetch() reads, or cache_flush() writes,
+   in one transfer. */
+#define CACHE_RUN (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static thread_func write_behind_daemon NO_RETURN;
+static struct cache_entry *lookup (block_sector_t);
+static struct cache_entry *evict (void);
+static struct cache_entry *cache_get (block_sector_t, bool load);
+static bool holds_dirty (struct cache_entry *, block_sector_t);
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  for (i = 0; i < CACHE_SECTORS; i++)
+    {
+      lock_init (&cache[i].lock);
+      cache[i].valid = false;
+      cache[i].dirty = false;
+      cache[i].accessed = false;
+    }
+  clock_hand = 0;
+
+  thread_create ("write-behind", PRI_DEFAULT, write_behind_daemon, NULL);
+}
+
+/* Write-behind thread.  Periodically writes dirty sectors back to
+   disk, so that a crash loses at most WRITE_BEHIND_TICKS, plus
+   WRITE_BEHIND_SLACK, worth of writes while writers themselves
+   never wait for the disk.  The page cache is written back along
+   with the buffer cache, after its delayed data has been given
+   sectors.  Each pass also checkpoints the journal transaction
+   committed by the last pass, then commits the metadata changes
+   made since, along with the batched free map changes. */
+static void
+write_behind_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep_slack (WRITE_BEHIND_TICKS, WRITE_BEHIND_SLACK);
+      inode_allocate_delayed ();
+      pcache_flush ();
+      journal_checkpoint ();
+      journal_commit ();
+      cache_flush ();
+    }
+}
+
+/* Writes every dirty cached sector back to disk, in increasing
+   order of sector number, with one transfer per run of up to
+   CACHE_RUN consecutive sectors.  On a striped device a run that
+   crosses a chunk boundary goes to several disks at once. */
+void
+cache_flush (void)
+{
+  struct cache_entry *dirty[CACHE_SECTORS];
+  block_sector_t sectors[CACHE_SECTORS];
+  struct cache_entry *run[CACHE_RUN];
+  uint8_t *buffer = palloc_get_page (0);
+  size_t cnt = 0;
+  size_t i, j;
+
+  /* Sort the dirty entries by sector.  Don't wait on the lock of
+     an entry that is clean: a racing writer will be picked up next
+     time. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SECTORS; i++)
+    if (cache[i].valid && cache[i].dirty)
+      {
+        for (j = cnt++; j > 0 && sectors[j - 1] > cache[i].sector; j--)
+          {
+            sectors[j] = sectors[j - 1];
+            dirty[j] = dirty[j - 1];
+          }
+        sectors[j] = cache[i].sector;
+        dirty[j] = &cache[i];
+      }
+  lock_release (&cache_lock);
+
+  i = 0;
+  while (i < cnt)
+    {
+      block_sector_t first = sectors[i];
+      size_t n = 0, k;
+
+      /* Wait only for the first entry of a run, while holding no
+         other entry lock.  Later members are only tried, and the
+         run ends at one that is busy, which then starts the next
+         run. */
+      lock_acquire (&dirty[i]->lock);
+      if (!holds_dirty (dirty[i], first))
+        {
+          lock_release (&dirty[i++]->lock);
+          continue;
+        }
+      run[n++] = dirty[i++];
+      while (buffer != NULL && i < cnt && n < CACHE_RUN
+             && sectors[i] == first + n
+             && lock_try_acquire (&dirty[i]->lock))
+        {
+          if (!holds_dirty (dirty[i], sectors[i]))
+            {
+              lock_release (&dirty[i]->lock);
+              break;
+            }
+          run[n++] = dirty[i++];
+        }
+
+      if (n == 1)
+        block_write (fs_device, first, run[0]->data);
+      else
+        {
+          for (k = 0; k < n; k++)
+            memcpy (buffer + k * BLOCK_SECTOR_SIZE, run[k]->data,
+                    BLOCK_SECTOR_SIZE);
+          block_write_multiple (fs_device, first, n, buffer);
+        }
+      for (k = 0; k < n; k++)
+        {
+          run[k]->dirty = false;
+          lock_release (&run[k]->lock);
+        }
+    }
+  palloc_free_page (buffer);
+}
+
+/* Drops SECTOR from the cache and the journal without writing it
+   back, if it is cached.  Called when SECTOR is freed, so that a
+   stale copy is never written over the sector's next use. */
+void
+cache_discard (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  journal_forget (sector);
+
+  lock_acquire (&cache_lock);
+  e = lookup (sector);
+  lock_release (&cache_lock);
+  if (e == NULL)
+    return;
+
+  /* The entry may have been reused meanwhile.  Taking cache_lock
+     while holding the entry lock is safe, since evict() only tries
+     entry locks. */
+  lock_acquire (&e->lock);
+  if (e->valid && e->sector == sector)
+    {
+      lock_acquire (&cache_lock);
+      e->valid = false;
+      lock_release (&cache_lock);
+      e->dirty = false;
+    }
+  lock_release (&e->lock);
+}
+
+/* Stores into SECTORS up to MAX of the sectors now cached, in
+   increasing order, and returns how many it stored. */
+size_t
+cache_hot_sectors (block_sector_t *sectors, size_t max)
+{
+  size_t cnt = 0;
+  size_t i, j;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SECTORS && cnt < max; i++)
+    if (cache[i].valid)
+      {
+        /* Insertion sort: the cache is small. */
+        for (j = cnt++; j > 0 && sectors[j - 1] > cache[i].sector; j--)
+          sectors[j] = sectors[j - 1];
+        sectors[j] = cache[i].sector;
+      }
+  lock_release (&cache_lock);
+  return cnt;
+}
+
+/* Reads the CNT sectors in SECTORS, which must be in increasing
+   order, into the cache, with one transfer per run of up to
+   CACHE_RUN consecutive sectors not cached yet.  Sectors for
+   which no entry is free are skipped: prefetching is only a
+   hint. */
+void
+cache_prefetch (const block_sector_t *sectors, size_t cnt)
+{
+  struct cache_entry *run[CACHE_RUN];
+  uint8_t *buffer = palloc_get_page (0);
+  size_t i = 0;
+
+  if (buffer == NULL)
+    return;
+  while (i < cnt)
+    {
+      block_sector_t first = sectors[i];
+      size_t n = 0, k;
+
+      /* Claim an entry for each sector of the run.  Their locks
+         stay held until the data arrives, as in cache_get(). */
+      lock_acquire (&cache_lock);
+      while (i < cnt && n < CACHE_RUN && sectors[i] == first + n
+             && lookup (sectors[i]) == NULL
+             && (run[n] = evict ()) != NULL)
+        {
+          run[n]->sector = sectors[i++];
+          run[n]->valid = true;
+          run[n]->accessed = false;
+          n++;
+        }
+      lock_release (&cache_lock);
+      if (n == 0)
+        {
+          i++;
+          continue;
+        }
+
+      block_read_multiple (fs_device, first, n, buffer);
+      for (k = 0; k < n; k++)
+        {
+          if (!journal_read (first + k, run[k]->data))
+            memcpy (run[k]->data, buffer + k * BLOCK_SECTOR_SIZE,
+                    BLOCK_SECTOR_SIZE);
+          lock_release (&run[k]->lock);
+        }
+    }
+  palloc_free_page (buffer);
+}
+
+/* Returns true if E still holds SECTOR and is dirty.  E's lock
+   must be held. */
+static bool
+holds_dirty (struct cache_entry *e, block_sector_t sector)
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+  return e->valid && e->sector == sector && e->dirty;
+}
+
+/* Returns the cache entry whose sector is SECTOR, or a null
+   pointer if SECTOR is not cached.  Must be called with
+   cache_lock held. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SECTORS; i++)
+    if (cache[i].valid && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Chooses an entry to hold a new sector using the clock
+   algorithm, acquires its lock, and writes it back if it is
+   dirty.  Entries whose locks are busy are skipped.  Returns a
+   null pointer if every entry is busy.  Must be called with
+   cache_lock held. */
+static struct cache_entry *
+evict (void)
+{
+  size_t i;
+
+  /* Two sweeps: the first may only clear accessed bits. */
+  for (i = 0; i < 2 * CACHE_SECTORS; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SECTORS;
+
+      if (e->valid && e->accessed)
+        e->accessed = false;
+      else if (lock_try_acquire (&e->lock))
+        {
+          /* Write back under cache_lock, so that nobody can read
+             the old sector from disk before it is up to date. */
+          if (e->valid && e->dirty)
+            block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+          return e;
+        }
+    }
+  return NULL;
+}
+
+/* Returns the cache entry for SECTOR with its lock held, loading
+   the sector from disk first if it is not cached.  If LOAD is
+   false, the caller is about to overwrite the whole sector, so a
+   newly cached sector is not read from disk. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load)
+{
+  struct cache_entry *e;
+
+  for (;;)
+    {
+      lock_acquire (&cache_lock);
+      e = lookup (sector);
+      if (e != NULL)
+        {
+          /* Hit.  Another thread may evict the entry between
+             releasing cache_lock and acquiring its lock, so
+             check again once we hold it. */
+          e->accessed = true;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          if (e->valid && e->sector == sector)
+            return e;
+          lock_release (&e->lock);
+          continue;
+        }
+
+      e = evict ();
+      if (e != NULL)
+        {
+          e->sector = sector;
+          e->valid = true;
+          e->accessed = true;
+          lock_release (&cache_lock);
+          if (load && !journal_read (sector, e->data))
+            block_read (fs_device, sector, e->data);
+          return e;
+        }
+
+      /* Every entry is in use.  Let their users finish. */
+      lock_release (&cache_lock);
+      thread_yield ();
+    }
+}
+
+/* Reads sector SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Writes sector SECTOR from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Reads SIZE bytes starting at byte OFFSET within sector SECTOR
+   into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int size, int offset)
+{
+  struct cache_entry *e;
+
+  ASSERT (offset >= 0 && size >= 0 && offset + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + offset, size);
+  lock_release (&e->lock);
+}
+
+/* Writes SIZE bytes from BUFFER into sector SECTOR, starting at
+   byte OFFSET within the sector. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                int size, int offset)
+{
+  struct cache_entry *e;
+
+  ASSERT (offset >= 0 && size >= 0 && offset + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + offset, buffer, size);
+  if (journal_active ())
+    {
+      journal_log (sector, e->data);
+      e->dirty = false;
+    }
+  else
+    e->dirty = true;
+  lock_release (&e->lock);
+}
@@ -0,0 +1,19 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include "devices/block.h"
+
+/* Number of sectors held in the buffer cache. */
+#define CACHE_SECTORS 64
+
+void cache_init (void);
+void cache_flush (void);
+void cache_read (block_sector_t, void *);
+void cache_write (block_sector_t, const void *);
+void cache_read_at (block_sector_t, void *, int size, int offset);
+void cache_write_at (block_sector_t, const void *, int size, int offset);
+void cache_discard (block_sector_t);
+size_t cache_hot_sectors (block_sector_t *, size_t max);
+void cache_prefetch (const block_sector_t *, size_t cnt);
+
+#endif /* filesys/cache.h */
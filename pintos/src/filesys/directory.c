@@ -1,10 +1,15 @@
 #include "filesys/directory.h"
+#include <dirent.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* A directory. */
 struct dir 
@@ -21,6 +26,228 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* In-memory index of a directory's entries, so that looking up a
+   name or finding a free slot does not scan the directory.
+
+   A directory is opened afresh for every path lookup, so indexes
+   are kept by inode sector rather than in `struct dir', and live
+   as long as the kernel runs.  The first lookup in a directory
+   builds its index from disk; dir_add() and dir_remove() keep it
+   up to date.  If memory runs out, lookups fall back to scanning
+   the directory.
+
+   Since an index always holds every name in its directory, a name
+   missing from it is known not to exist, so failed lookups are as
+   cheap as successful ones without separate negative entries.
+   Taken together, the indexes map (directory sector, name) to an
+   inode sector, which is what a path walk needs at each
+   component.
+
+   Each directory's index also carries the lock that makes adding
+   and removing its entries atomic with respect to each other and
+   to lookups, so that operations in different directories never
+   wait for each other.  If memory runs out while building an
+   index, its lock still serializes the directory while lookups
+   scan it. */
+struct dir_index
+  {
+    struct hash_elem elem;              /* Element in dir_indexes. */
+    block_sector_t sector;              /* Directory's inode sector. */
+    struct lock lock;                   /* Protects the members below and
+                                           serializes changes to the
+                                           directory. */
+    bool built;                         /* Do the members below hold
+                                           the directory's entries? */
+    struct hash names;                  /* `struct dir_name's, by name. */
+    off_t *free_slots;                  /* Offsets of unused entries. */
+    size_t free_cnt;                    /* Number of free_slots in use. */
+    size_t free_cap;                    /* Capacity of free_slots. */
+  };
+
+/* An in-use directory entry in a `struct dir_index'. */
+struct dir_name
+  {
+    struct hash_elem elem;              /* Element in dir_index names. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t inode_sector;        /* Sector number of header. */
+    off_t ofs;                          /* Offset of entry in directory. */
+  };
+
+/* All directory indexes, by sector.  dir_index_lock protects the
+   table; each index's own lock protects the rest. */
+static struct hash dir_indexes;
+static struct lock dir_index_lock;
+
+/* Hash functions for dir_indexes. */
+static unsigned
+dir_index_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct dir_index, elem)->sector);
+}
+
+static bool
+dir_index_less (const struct hash_elem *a, const struct hash_elem *b,
+                void *aux UNUSED)
+{
+  return (hash_entry (a, struct dir_index, elem)->sector
+          < hash_entry (b, struct dir_index, elem)->sector);
+}
+
+/* Hash functions for a dir_index's names. */
+static unsigned
+dir_name_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_string (hash_entry (e, struct dir_name, elem)->name);
+}
+
+static bool
+dir_name_less (const struct hash_elem *a, const struct hash_elem *b,
+               void *aux UNUSED)
+{
+  return strcmp (hash_entry (a, struct dir_name, elem)->name,
+                 hash_entry (b, struct dir_name, elem)->name) < 0;
+}
+
+/* Frees the dir_name that contains E. */
+static void
+dir_name_free (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct dir_name, elem));
+}
+
+/* Records OFS as a free slot in INDEX.  Returns false if out of
+   memory. */
+static bool
+index_add_free (struct dir_index *index, off_t ofs)
+{
+  if (index->free_cnt >= index->free_cap)
+    {
+      size_t new_cap = index->free_cap > 0 ? 2 * index->free_cap : 8;
+      off_t *new_slots = realloc (index->free_slots,
+                                  new_cap * sizeof *new_slots);
+      if (new_slots == NULL)
+        return false;
+      index->free_slots = new_slots;
+      index->free_cap = new_cap;
+    }
+  index->free_slots[index->free_cnt++] = ofs;
+  return true;
+}
+
+/* Adds an entry for E, at offset OFS, to INDEX.  Returns false if
+   out of memory. */
+static bool
+index_add_name (struct dir_index *index, const struct dir_entry *e,
+                off_t ofs)
+{
+  struct dir_name *n = malloc (sizeof *n);
+  if (n == NULL)
+    return false;
+  strlcpy (n->name, e->name, sizeof n->name);
+  n->inode_sector = e->inode_sector;
+  n->ofs = ofs;
+  hash_insert (&index->names, &n->elem);
+  return true;
+}
+
+/* Empties INDEX, so that it will be rebuilt from disk when next
+   used.  INDEX's lock must be held. */
+static void
+index_clear (struct dir_index *index)
+{
+  ASSERT (lock_held_by_current_thread (&index->lock));
+
+  if (index->built)
+    {
+      hash_destroy (&index->names, dir_name_free);
+      free (index->free_slots);
+      index->free_slots = NULL;
+      index->free_cnt = index->free_cap = 0;
+      index->built = false;
+    }
+}
+
+/* Builds INDEX from DIR's entries on disk, leaving it unbuilt if
+   memory is short.  INDEX's lock must be held. */
+static void
+index_build (struct dir_index *index, const struct dir *dir)
+{
+  struct dir_entry e;
+  off_t ofs;
+
+  ASSERT (lock_held_by_current_thread (&index->lock));
+  ASSERT (!index->built);
+
+  if (!hash_init (&index->names, dir_name_hash, dir_name_less, NULL))
+    return;
+  index->built = true;
+  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e)
+    if (!(e.in_use ? index_add_name (index, &e, ofs)
+          : index_add_free (index, ofs)))
+      {
+        index_clear (index);
+        return;
+      }
+}
+
+/* Returns the index for DIR with its lock held, building the
+   index first if necessary.  If memory is short, the index may be
+   unbuilt, or the return value may be a null pointer, in which
+   case DIR is not locked at all. */
+static struct dir_index *
+lock_index (const struct dir *dir)
+{
+  struct dir_index key, *index;
+  struct hash_elem *he;
+
+  key.sector = inode_get_inumber (dir->inode);
+  lock_acquire (&dir_index_lock);
+  he = hash_find (&dir_indexes, &key.elem);
+  if (he != NULL)
+    index = hash_entry (he, struct dir_index, elem);
+  else
+    {
+      index = malloc (sizeof *index);
+      if (index != NULL)
+        {
+          index->sector = key.sector;
+          lock_init (&index->lock);
+          index->built = false;
+          index->free_slots = NULL;
+          index->free_cnt = index->free_cap = 0;
+          hash_insert (&dir_indexes, &index->elem);
+        }
+    }
+  lock_release (&dir_index_lock);
+
+  if (index != NULL)
+    {
+      lock_acquire (&index->lock);
+      if (!index->built)
+        index_build (index, dir);
+    }
+  return index;
+}
+
+/* Releases INDEX, as returned by lock_index(), which may be a null
+   pointer. */
+static void
+unlock_index (struct dir_index *index)
+{
+  if (index != NULL)
+    lock_release (&index->lock);
+}
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  lock_init (&dir_index_lock);
+  if (!hash_init (&dir_indexes, dir_index_hash, dir_index_less, NULL))
+    PANIC ("cannot create directory index table");
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -37,6 +264,7 @@ dir_open (struct inode *inode)
   struct dir *dir = calloc (1, sizeof *dir);
   if (inode != NULL && dir != NULL)
     {
+      inode_set_metadata (inode);
       dir->inode = inode;
       dir->pos = 0;
       return dir;
@@ -65,6 +293,17 @@ dir_reopen (struct dir *dir)
   return dir_open (inode_reopen (dir->inode));
 }
 
+/* Opens and returns a new directory for the same inode as DIR, at
+   the same position.  Returns a null pointer on failure. */
+struct dir *
+dir_dup (struct dir *dir)
+{
+  struct dir *copy = dir_reopen (dir);
+  if (copy != NULL)
+    copy->pos = dir->pos;
+  return copy;
+}
+
 /* Destroys DIR and frees associated resources. */
 void
 dir_close (struct dir *dir) 
@@ -87,9 +326,10 @@ dir_get_inode (struct dir *dir)
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   INDEX must be DIR's index, as returned by lock_index(). */
 static bool
-lookup (const struct dir *dir, const char *name,
+lookup (const struct dir *dir, struct dir_index *index, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
@@ -98,6 +338,31 @@ lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  /* Use the index if there is one. */
+  if (index != NULL && index->built)
+    {
+      struct dir_name key;
+      struct hash_elem *he;
+
+      strlcpy (key.name, name, sizeof key.name);
+      he = (strlen (name) <= NAME_MAX
+            ? hash_find (&index->names, &key.elem) : NULL);
+      if (he == NULL)
+        return false;
+      {
+        struct dir_name *n = hash_entry (he, struct dir_name, elem);
+        if (ep != NULL)
+          {
+            ep->inode_sector = n->inode_sector;
+            strlcpy (ep->name, n->name, sizeof ep->name);
+            ep->in_use = true;
+          }
+        if (ofsp != NULL)
+          *ofsp = n->ofs;
+      }
+      return true;
+    }
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -119,15 +384,20 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  struct dir_index *index;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
+  /* Open the inode before unlocking, so that it cannot be
+     removed and freed in between. */
+  index = lock_index (dir);
+  if (lookup (dir, index, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  unlock_index (index);
 
   return *inode != NULL;
 }
@@ -142,6 +412,7 @@ bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
   struct dir_entry e;
+  struct dir_index *index;
   off_t ofs;
   bool success = false;
 
@@ -152,21 +423,36 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  /* Check that NAME is not in use, holding the directory until
+     the new entry is in, so that two adds of one name cannot both
+     succeed. */
+  index = lock_index (dir);
+  if (lookup (dir, index, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
+  if (index != NULL && index->built)
+    {
+      /* Take a recorded free slot or else append. */
+      ofs = (index->free_cnt > 0
+             ? index->free_slots[--index->free_cnt]
+             : inode_length (dir->inode));
+    }
+  else
+    {
+      /* Set OFS to offset of free slot.
+         If there are no free slots, then it will be set to the
+         current end-of-file.
      
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+         inode_read_at() will only return a short read at end of
+         file.  Otherwise, we'd need to verify that we didn't get a
+         short read due to something intermittent such as low
+         memory. */
+      for (ofs = 0;
+           inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+           ofs += sizeof e) 
+        if (!e.in_use)
+          break;
+    }
 
   /* Write slot. */
   e.in_use = true;
@@ -174,7 +460,14 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
+  /* Record it in the index, or else drop the index rather than let
+     it go stale. */
+  if (index != NULL && index->built
+      && !(success && index_add_name (index, &e, ofs)))
+    index_clear (index);
+
  done:
+  unlock_index (index);
   return success;
 }
 
@@ -185,6 +478,7 @@ bool
 dir_remove (struct dir *dir, const char *name) 
 {
   struct dir_entry e;
+  struct dir_index *index;
   struct inode *inode = NULL;
   bool success = false;
   off_t ofs;
@@ -193,7 +487,8 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  index = lock_index (dir);
+  if (!lookup (dir, index, name, &e, &ofs))
     goto done;
 
   /* Open inode. */
@@ -206,11 +501,26 @@ dir_remove (struct dir *dir, const char *name)
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
 
+  /* Update the index, if there is one. */
+  if (index != NULL && index->built)
+    {
+      struct dir_name key;
+      struct hash_elem *he;
+
+      strlcpy (key.name, name, sizeof key.name);
+      he = hash_delete (&index->names, &key.elem);
+      if (he != NULL)
+        free (hash_entry (he, struct dir_name, elem));
+      if (!index_add_free (index, ofs))
+        index_clear (index);
+    }
+
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  unlock_index (index);
   inode_close (inode);
   return success;
 }
@@ -234,3 +544,43 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
     }
   return false;
 }
+
+/* Reads up to MAX of the next in-use entries in DIR into ENTS and
+   returns the number read, 0 if the directory contains no more
+   entries, or -1 if memory is short.  Unlike dir_readdir(), reads
+   the directory a page of entries at a time, so that listing a
+   large directory takes few inode reads. */
+int
+dir_readdir_batch (struct dir *dir, struct dirent *ents, int max)
+{
+  enum { BATCH = PGSIZE / sizeof (struct dir_entry) };
+  struct dir_entry *batch;
+  int cnt = 0;
+
+  ASSERT (DIRENT_NAME_MAX == NAME_MAX);
+
+  batch = palloc_get_page (0);
+  if (batch == NULL)
+    return -1;
+  while (cnt < max)
+    {
+      off_t bytes = inode_read_at (dir->inode, batch, BATCH * sizeof *batch,
+                                   dir->pos);
+      size_t n = bytes / sizeof *batch;
+      size_t i;
+
+      if (n == 0)
+        break;
+      for (i = 0; i < n && cnt < max; i++)
+        if (batch[i].in_use)
+          {
+            ents[cnt].d_ino = batch[i].inode_sector;
+            strlcpy (ents[cnt].d_name, batch[i].name,
+                     sizeof ents[cnt].d_name);
+            cnt++;
+          }
+      dir->pos += i * sizeof *batch;
+    }
+  palloc_free_page (batch);
+  return cnt;
+}
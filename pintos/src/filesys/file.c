@@ -1,7 +1,12 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <round.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/vaddr.h"
+
+/* Number of pages to read ahead of a sequential reader. */
+#define READ_AHEAD_PAGES 2
 
 /* An open file. */
 struct file 
@@ -9,8 +14,12 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t seq_pos;              /* Where a sequential read would start. */
+    off_t ra_end;               /* End of data already read ahead. */
   };
 
+static off_t read_sequential (struct file *, void *, off_t size, off_t ofs);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +32,8 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->seq_pos = 0;
+      file->ra_end = 0;
       return file;
     }
   else
@@ -68,7 +79,7 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read = read_sequential (file, buffer, size, file->pos);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,15 +92,41 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  return read_sequential (file, buffer, size, file_ofs);
+}
+
+/* Reads SIZE bytes from FILE into BUFFER, starting at offset OFS,
+   and returns the number of bytes read.  If the read picks up
+   where the previous one left off, also starts reading the next
+   READ_AHEAD_PAGES pages into the cache in the background. */
+static off_t
+read_sequential (struct file *file, void *buffer, off_t size, off_t ofs)
+{
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, ofs);
+  off_t end = ofs + bytes_read;
+
+  if (ofs == file->seq_pos && bytes_read > 0)
+    {
+      off_t ra_start = ROUND_UP (end > file->ra_end ? end : file->ra_end,
+                                 PGSIZE);
+      off_t ra_end = ROUND_UP (end, PGSIZE) + READ_AHEAD_PAGES * PGSIZE;
+      if (ra_start < ra_end)
+        {
+          inode_read_ahead (file->inode, ra_end - ra_start, ra_start);
+          file->ra_end = ra_end;
+        }
+    }
+  else
+    file->ra_end = 0;
+  file->seq_pos = end;
+  return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -102,9 +139,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -113,6 +149,40 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Allocates space for the SIZE bytes of FILE starting at FILE_OFS,
+   extending FILE if necessary, without writing it: the space reads
+   as zeros.  Returns true if successful, false if the disk is full
+   or writes to FILE are denied.  The file's current position is
+   unaffected. */
+bool
+file_preallocate (struct file *file, off_t file_ofs, off_t size)
+{
+  return inode_preallocate (file->inode, file_ofs, size);
+}
+
+/* Returns a pointer to FILE's bytes starting at offset FILE_OFS,
+   straight from the page cache, without copying them, and stores
+   into *SIZE how many bytes may be read through it, which is at
+   most the rest of FILE_OFS's page.  Returns a null
+   pointer at end of file, and for a small file whose data is kept
+   in its inode, which must be read with file_read_at() instead.
+   The caller must release the pointer
+   with file_unmap_sector() soon, and must not otherwise access
+   FILE in the meantime.  The file's current position is
+   unaffected. */
+const void *
+file_map_sector (struct file *file, off_t file_ofs, off_t *size)
+{
+  return inode_map (file->inode, file_ofs, size);
+}
+
+/* Releases P, a pointer returned by file_map_sector(). */
+void
+file_unmap_sector (const void *p)
+{
+  inode_unmap (p);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -1,6 +1,7 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stdbool.h>
 #include "filesys/off_t.h"
 
 struct inode;
@@ -16,6 +17,11 @@ off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+bool file_preallocate (struct file *, off_t start, off_t size);
+
+/* Reading without copying. */
+const void *file_map_sector (struct file *, off_t start, off_t *size);
+void file_unmap_sector (const void *);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
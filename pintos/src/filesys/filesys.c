@@ -2,10 +2,14 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/pagecache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
+#include "filesys/hotset.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -21,13 +25,21 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
+  pcache_init ();
   inode_init ();
+  dir_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
+  else
+    journal_recover ();
 
   free_map_open ();
+  journal_init ();
+  if (!format)
+    hotset_start ();
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -35,25 +47,41 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  hotset_save ();
+  inode_allocate_delayed ();
+  journal_shutdown ();
   free_map_close ();
+  pcache_flush ();
+  cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
-   or if internal memory allocation fails. */
+   if internal memory allocation fails,
+   or if INITIAL_SIZE needs too many index sectors to create in
+   one journal transaction. */
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  struct dir *dir;
+  bool success;
+
+  if (!journal_begin (inode_create_sectors (initial_size)
+                      + JOURNAL_DIR_SECTORS))
+    return false;
+
+  /* The new inode goes near the directory that holds it. */
+  dir = dir_open_root ();
+  success = (dir != NULL
+             && free_map_allocate_near (1, ROOT_DIR_SECTOR, &inode_sector)
+             && inode_create (inode_sector, initial_size)
+             && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -76,6 +104,17 @@ filesys_open (const char *name)
   return file_open (inode);
 }
 
+/* Opens the directory named NAME, which so far must be the root
+   directory, named "/" or ".".  Returns the new directory if
+   successful or a null pointer otherwise. */
+struct dir *
+filesys_open_dir (const char *name)
+{
+  if (strcmp (name, "/") && strcmp (name, "."))
+    return NULL;
+  return dir_open_root ();
+}
+
 /* Deletes the file named NAME.
    Returns true if successful, false on failure.
    Fails if no file named NAME exists,
@@ -83,9 +122,14 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  struct dir *dir;
+  bool success;
+
+  journal_begin (JOURNAL_DIR_SECTORS);
+  dir = dir_open_root ();
+  success = dir != NULL && dir_remove (dir, name);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
@@ -96,6 +140,8 @@ do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
+  journal_format ();
+  hotset_format ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
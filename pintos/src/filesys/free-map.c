@@ -1,13 +1,57 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <limits.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/hotset.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Number of free map bits held in one sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * CHAR_BIT)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Sectors of the free map file that differ from the in-memory free
+   map, one bit per sector of the file.  Allocation and release
+   only mark sectors here; free_map_flush() writes them out. */
+static struct bitmap *dirty_map;
+
+/* The disk is divided into allocation groups of GROUP_SECTORS
+   sectors each, in the manner of cylinder groups.  Allocation
+   searches the group holding the caller's hint first, in order to
+   keep a file's data near its inode and an inode near its
+   directory, and moves on to later groups only when that group is
+   full.  One group's bits fill one sector of the free map file. */
+#define GROUP_SECTORS BITS_PER_SECTOR
+
+static size_t group_cnt;             /* Number of allocation groups. */
+static size_t *group_free;           /* Free sectors in each group. */
+static size_t free_cnt;              /* Free sectors in all groups. */
+
+/* Free sectors promised to data whose sectors are chosen later, by
+   free_map_allocate_reserved().  Other allocations leave them
+   alone. */
+static size_t reserved_cnt;
+
+/* Protects free_map, dirty_map, group_free, free_cnt, reserved_cnt,
+   and free_map_file. */
+static struct lock free_map_lock;
+
+static bool allocate (size_t cnt, block_sector_t hint,
+                      block_sector_t *sectorp, bool reserved);
+static void mark_dirty (block_sector_t, size_t cnt);
+static void flush_locked (void);
+static void count_groups (void);
+static void adjust_groups (block_sector_t, size_t cnt, bool allocated);
+static block_sector_t scan_group (size_t group, block_sector_t start,
+                                  size_t cnt);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
@@ -15,26 +59,129 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty_map = bitmap_create (DIV_ROUND_UP (block_size (fs_device),
+                                           BITS_PER_SECTOR));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  group_cnt = DIV_ROUND_UP (block_size (fs_device), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("allocation group creation failed");
+  lock_init (&free_map_lock);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  if (JOURNAL_SECTOR + JOURNAL_SECTOR_CNT <= bitmap_size (free_map))
+    bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTOR_CNT, true);
+  if (HOTSET_SECTOR < bitmap_size (free_map))
+    bitmap_mark (free_map, HOTSET_SECTOR);
+  count_groups ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  The change reaches the free map file
+   at the next free_map_flush(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Like free_map_allocate(), but places the sectors as close after
+   HINT as possible: first in HINT's allocation group at or after
+   HINT, then anywhere in that group, then in the following groups
+   in turn. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t hint,
+                        block_sector_t *sectorp)
+{
+  return allocate (cnt, hint, sectorp, false);
+}
+
+/* Like free_map_allocate_near(), but takes the CNT sectors out of
+   those set aside by free_map_reserve(). */
+bool
+free_map_allocate_reserved (size_t cnt, block_sector_t hint,
+                            block_sector_t *sectorp)
+{
+  return allocate (cnt, hint, sectorp, true);
+}
+
+/* Sets aside CNT free sectors, to be allocated later with
+   free_map_allocate_reserved().  Returns false if fewer than CNT
+   sectors are free and not already set aside. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = free_cnt - reserved_cnt >= cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Returns CNT sectors set aside by free_map_reserve() that will
+   not be allocated after all. */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Allocates CNT sectors near HINT, out of the reserved sectors if
+   RESERVED is true and out of the others otherwise. */
+static bool
+allocate (size_t cnt, block_sector_t hint, block_sector_t *sectorp,
+          bool reserved)
+{
+  block_sector_t sector = BITMAP_ERROR;
+  size_t first, i;
+
+  if (hint >= bitmap_size (free_map))
+    hint = 0;
+  first = hint / GROUP_SECTORS;
+
+  lock_acquire (&free_map_lock);
+  ASSERT (!reserved || reserved_cnt >= cnt);
+  if (!reserved && free_cnt - reserved_cnt < cnt)
+    {
+      lock_release (&free_map_lock);
+      return false;
+    }
+  for (i = 0; i < group_cnt && sector == BITMAP_ERROR; i++)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      size_t group = (first + i) % group_cnt;
+      if (group_free[group] >= cnt
+          || (cnt > GROUP_SECTORS && group_free[group] > 0))
+        {
+          if (i == 0)
+            sector = scan_group (group, hint, cnt);
+          if (sector == BITMAP_ERROR)
+            sector = scan_group (group, group * GROUP_SECTORS, cnt);
+        }
     }
+
+  /* A run may fit only across group boundaries. */
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan (free_map, 0, cnt, false);
+
+  if (sector != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      adjust_groups (sector, cnt, true);
+      mark_dirty (sector, cnt);
+      if (reserved)
+        reserved_cnt -= cnt;
+    }
+  lock_release (&free_map_lock);
+
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
@@ -44,9 +191,132 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  adjust_groups (sector, cnt, false);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Returns true if the CNT sectors starting at SECTOR all exist and
+   are all in use. */
+bool
+free_map_in_use (block_sector_t sector, size_t cnt)
+{
+  bool in_use;
+
+  lock_acquire (&free_map_lock);
+  in_use = (sector + cnt <= bitmap_size (free_map)
+            && bitmap_all (free_map, sector, cnt));
+  lock_release (&free_map_lock);
+  return in_use;
+}
+
+/* Writes the changed parts of the free map to the free map file.
+   Does nothing if the file is not open. */
+void
+free_map_flush (void)
+{
+  lock_acquire (&free_map_lock);
+  flush_locked ();
+  lock_release (&free_map_lock);
+}
+
+/* Records that the free map bits for the CNT sectors starting at
+   SECTOR have changed. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  if (cnt > 0)
+    bitmap_set_multiple (dirty_map, first, last - first + 1, true);
+}
+
+/* Returns the first sector of a run of CNT free sectors that
+   starts in allocation GROUP at or after START, or BITMAP_ERROR if
+   there is none.  free_map_lock must be held. */
+static block_sector_t
+scan_group (size_t group, block_sector_t start, size_t cnt)
+{
+  block_sector_t sector = bitmap_scan (free_map, start, cnt, false);
+  return (sector != BITMAP_ERROR && sector / GROUP_SECTORS == group
+          ? sector : BITMAP_ERROR);
+}
+
+/* Recomputes the free count of every allocation group from the
+   free map. */
+static void
+count_groups (void)
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  size_t group;
+
+  free_cnt = 0;
+  for (group = 0; group < group_cnt; group++)
+    {
+      size_t start = group * GROUP_SECTORS;
+      size_t cnt = (sector_cnt - start < GROUP_SECTORS
+                    ? sector_cnt - start : GROUP_SECTORS);
+      group_free[group] = bitmap_count (free_map, start, cnt, false);
+      free_cnt += group_free[group];
+    }
+}
+
+/* Updates the allocation group free counts for the CNT sectors
+   starting at SECTOR having just been ALLOCATED or released. */
+static void
+adjust_groups (block_sector_t sector, size_t cnt, bool allocated)
+{
+  if (allocated)
+    free_cnt -= cnt;
+  else
+    free_cnt += cnt;
+  while (cnt > 0)
+    {
+      size_t group = sector / GROUP_SECTORS;
+      size_t group_end = (group + 1) * GROUP_SECTORS;
+      size_t n = group_end - sector < cnt ? group_end - sector : cnt;
+
+      if (allocated)
+        group_free[group] -= n;
+      else
+        group_free[group] += n;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Writes each run of dirty free map file sectors with a single
+   write.  Runs that cannot be written stay dirty, to be retried by
+   the next flush.  free_map_lock must be held. */
+static void
+flush_locked (void)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t start = 0;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+  if (free_map_file == NULL)
+    return;
+  while ((start = bitmap_scan (dirty_map, start, 1, true)) != BITMAP_ERROR)
+    {
+      size_t end = bitmap_scan (dirty_map, start, 1, false);
+      size_t first_bit, last_bit;
+
+      if (end == BITMAP_ERROR)
+        end = bitmap_size (dirty_map);
+      first_bit = start * BITS_PER_SECTOR;
+      last_bit = end * BITS_PER_SECTOR < bit_cnt ? end * BITS_PER_SECTOR
+                                                 : bit_cnt;
+      if (bitmap_write_range (free_map, free_map_file,
+                              first_bit, last_bit - first_bit))
+        bitmap_set_multiple (dirty_map, start, end - start, false);
+      start = end;
+    }
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -56,15 +326,21 @@ free_map_open (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_set_metadata (file_get_inode (free_map_file));
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_groups ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  lock_acquire (&free_map_lock);
+  flush_locked ();
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -80,6 +356,8 @@ free_map_create (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_set_metadata (file_get_inode (free_map_file));
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_map, false);
 }
@@ -12,6 +12,13 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (size_t, block_sector_t hint, block_sector_t *);
+bool free_map_allocate_reserved (size_t, block_sector_t hint,
+                                 block_sector_t *);
 void free_map_release (block_sector_t, size_t);
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
+void free_map_flush (void);
+bool free_map_in_use (block_sector_t, size_t);
 
 #endif /* filesys/free-map.h */
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <round.h>
 #include <string.h>
 #include <ustar.h>
 #include "filesys/directory.h"
@@ -11,6 +12,12 @@
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 
+/* Number of pages in the buffer that fsutil_extract() and
+   fsutil_append() use to move file data, and the number of sectors
+   they transfer to or from the scratch device at a time. */
+#define COPY_PAGES 16
+#define COPY_SECTORS (COPY_PAGES * PGSIZE / BLOCK_SECTOR_SIZE)
+
 /* List files in the root directory. */
 void
 fsutil_ls (char **argv UNUSED) 
@@ -79,7 +86,7 @@ fsutil_extract (char **argv UNUSED)
 
   /* Allocate buffers. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
+  data = palloc_get_multiple (0, COPY_PAGES);
   if (header == NULL || data == NULL)
     PANIC ("couldn't allocate buffers");
 
@@ -117,20 +124,23 @@ fsutil_extract (char **argv UNUSED)
 
           printf ("Putting '%s' into the file system...\n", file_name);
 
-          /* Create destination file. */
+          /* Create destination file.  Creating it at its full size
+             preallocates its sectors, as one extent if possible. */
           if (!filesys_create (file_name, size))
             PANIC ("%s: create failed", file_name);
           dst = filesys_open (file_name);
           if (dst == NULL)
             PANIC ("%s: open failed", file_name);
 
-          /* Do copy. */
+          /* Do copy, many sectors per disk command and per write. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
+              int chunk_size = (size > COPY_SECTORS * BLOCK_SECTOR_SIZE
+                                ? COPY_SECTORS * BLOCK_SECTOR_SIZE
                                 : size);
-              block_read (src, sector++, data);
+              size_t sector_cnt = DIV_ROUND_UP (chunk_size, BLOCK_SECTOR_SIZE);
+              block_read_multiple (src, sector, sector_cnt, data);
+              sector += sector_cnt;
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
@@ -151,7 +161,7 @@ fsutil_extract (char **argv UNUSED)
   block_write (src, 0, header);
   block_write (src, 1, header);
 
-  free (data);
+  palloc_free_multiple (data, COPY_PAGES);
   free (header);
 }
 
@@ -169,7 +179,7 @@ fsutil_append (char **argv)
   static block_sector_t sector = 0;
 
   const char *file_name = argv[1];
-  void *buffer;
+  char *buffer;
   struct file *src;
   struct block *dst;
   off_t size;
@@ -177,7 +187,7 @@ fsutil_append (char **argv)
   printf ("Appending '%s' to ustar archive on scratch device...\n", file_name);
 
   /* Allocate buffer. */
-  buffer = malloc (BLOCK_SECTOR_SIZE);
+  buffer = palloc_get_multiple (0, COPY_PAGES);
   if (buffer == NULL)
     PANIC ("couldn't allocate buffer");
 
@@ -197,16 +207,21 @@ fsutil_append (char **argv)
     PANIC ("%s: name too long for ustar format", file_name);
   block_write (dst, sector++, buffer);
 
-  /* Do copy. */
+  /* Do copy, many sectors per read and per disk command. */
   while (size > 0) 
     {
-      int chunk_size = size > BLOCK_SECTOR_SIZE ? BLOCK_SECTOR_SIZE : size;
-      if (sector >= block_size (dst))
+      int chunk_size = (size > COPY_SECTORS * BLOCK_SECTOR_SIZE
+                        ? COPY_SECTORS * BLOCK_SECTOR_SIZE
+                        : size);
+      size_t sector_cnt = DIV_ROUND_UP (chunk_size, BLOCK_SECTOR_SIZE);
+      if (sector_cnt > block_size (dst) - sector)
         PANIC ("%s: out of space on scratch device", file_name);
       if (file_read (src, buffer, chunk_size) != chunk_size)
         PANIC ("%s: read failed with %"PROTd" bytes unread", file_name, size);
-      memset (buffer + chunk_size, 0, BLOCK_SECTOR_SIZE - chunk_size);
-      block_write (dst, sector++, buffer);
+      memset (buffer + chunk_size, 0,
+              sector_cnt * BLOCK_SECTOR_SIZE - chunk_size);
+      block_write_multiple (dst, sector, sector_cnt, buffer);
+      sector += sector_cnt;
       size -= chunk_size;
     }
 
@@ -219,5 +234,5 @@ fsutil_append (char **argv)
 
   /* Finish up. */
   file_close (src);
-  free (buffer);
+  palloc_free_multiple (buffer, COPY_PAGES);
 }
@@ -0,0 +1,117 @@
+#include "filesys/hotset.h"
+#include <debug.h>
+#include <stdint.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/inode.h"
+#include "filesys/pagecache.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* Warm start.
+
+   At shutdown, the sectors in the buffer cache and the file pages
+   in the page cache are recorded in HOTSET_SECTOR.  At the next
+   boot, a background thread reads them back in, the metadata first
+   with one transfer per run of consecutive sectors, then each file
+   page through its inode, while the kernel goes on to run the
+   command line.  After a crash the record may be out of date;
+   that costs only some useless reads, since the sectors read are
+   whatever the disk holds now and file pages are looked up
+   afresh. */
+
+/* Identifies a hot set record. */
+#define HOTSET_MAGIC 0x484f5453
+
+/* On-disk hot set record, at HOTSET_SECTOR.  Must be exactly
+   BLOCK_SECTOR_SIZE bytes long. */
+struct hotset_disk
+  {
+    uint32_t magic;                     /* HOTSET_MAGIC. */
+    uint16_t sector_cnt;                /* Number of cached sectors. */
+    uint16_t page_cnt;                  /* Number of cached pages. */
+    block_sector_t sectors[CACHE_SECTORS]; /* Sectors, increasing. */
+    block_sector_t inumbers[PCACHE_PAGES]; /* Each page's file... */
+    uint16_t pages[PCACHE_PAGES];       /* ...and index within it. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8 - 4 * CACHE_SECTORS
+                   - 6 * PCACHE_PAGES];
+  };
+
+static thread_func warm_start NO_RETURN;
+
+/* Returns true if the file system device has room for the hot set
+   record. */
+static bool
+hotset_fits (void)
+{
+  return HOTSET_SECTOR < block_size (fs_device);
+}
+
+/* Writes an empty hot set to a newly formatted file system. */
+void
+hotset_format (void)
+{
+  static struct hotset_disk h;
+
+  ASSERT (sizeof h == BLOCK_SECTOR_SIZE);
+  if (!hotset_fits ())
+    return;
+  memset (&h, 0, sizeof h);
+  h.magic = HOTSET_MAGIC;
+  block_write (fs_device, HOTSET_SECTOR, &h);
+}
+
+/* Records what the caches hold, for hotset_start() at the next
+   boot.  Called at shutdown. */
+void
+hotset_save (void)
+{
+  static struct hotset_disk h;
+  static size_t pages[PCACHE_PAGES];
+  size_t i;
+
+  if (!hotset_fits ())
+    return;
+  memset (&h, 0, sizeof h);
+  h.magic = HOTSET_MAGIC;
+  h.sector_cnt = cache_hot_sectors (h.sectors, CACHE_SECTORS);
+  h.page_cnt = pcache_hot_pages (h.inumbers, pages, PCACHE_PAGES);
+  for (i = 0; i < h.page_cnt; i++)
+    h.pages[i] = pages[i] <= UINT16_MAX ? pages[i] : 0;
+  block_write (fs_device, HOTSET_SECTOR, &h);
+}
+
+/* Starts reading the hot set recorded at the last shutdown back
+   into the caches in the background.  Call once the file system
+   is ready for use. */
+void
+hotset_start (void)
+{
+  struct hotset_disk *h;
+
+  if (!hotset_fits ())
+    return;
+  h = malloc (sizeof *h);
+  if (h == NULL)
+    return;
+  block_read (fs_device, HOTSET_SECTOR, h);
+  if (h->magic != HOTSET_MAGIC || h->sector_cnt > CACHE_SECTORS
+      || h->page_cnt > PCACHE_PAGES
+      || (h->sector_cnt == 0 && h->page_cnt == 0)
+      || thread_create ("warm-start", PRI_DEFAULT, warm_start, h) == TID_ERROR)
+    free (h);
+}
+
+/* Warm start thread.  Reads in the hot set H, then exits. */
+static void
+warm_start (void *h_)
+{
+  struct hotset_disk *h = h_;
+  size_t i;
+
+  cache_prefetch (h->sectors, h->sector_cnt);
+  for (i = 0; i < h->page_cnt; i++)
+    inode_prefetch (h->inumbers[i], h->pages[i]);
+  free (h);
+  thread_exit ();
+}
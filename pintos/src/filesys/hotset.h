@@ -0,0 +1,15 @@
+#ifndef FILESYS_HOTSET_H
+#define FILESYS_HOTSET_H
+
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+
+/* Sector that records the caches' contents at shutdown, just past
+   the journal. */
+#define HOTSET_SECTOR (JOURNAL_SECTOR + JOURNAL_SECTOR_CNT)
+
+void hotset_format (void);
+void hotset_save (void);
+void hotset_start (void);
+
+#endif /* filesys/hotset.h */
@@ -1,25 +1,84 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
+#include <ohash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "filesys/pagecache.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Shape of the block index.  The first DIRECT_CNT data sectors
+   are listed in the inode itself, the next PTRS_PER_SECTOR in an
+   indirect sector, and the rest in the indirect sectors listed in
+   a doubly indirect sector, for a maximum of a little over 8 MB
+   per file.  A sector number of 0 marks a sector that has not
+   been allocated; sector 0 holds the free map, so no file can
+   use it.  Unallocated data sectors read as zeros.
+
+   A data sector whose number has UNWRITTEN set is allocated but
+   has never been written, as is all space that inode_create() and
+   inode_preallocate() allocate.  It reads as zeros without being
+   read, and is zeroed on disk only when it is first written.
+
+   A file of at most INLINE_MAX bytes may instead keep its data in
+   the inode sector itself, in place of the direct sector list, so
+   that reading it takes one disk read instead of two and it uses
+   no data sector.  Newly created files small enough start out that
+   way.  Inline data is always read and written under the inode's
+   lock, and a write that would not fit moves the data out to a
+   data sector first, for good.  Bytes past the end of inline data
+   are always zero.
+
+   File data is cached by the page cache, metadata (inodes, index
+   sectors, and the data of metadata inodes such as directories) by
+   the buffer cache, which journals it.  No sector is ever in both,
+   so a sector whose use changes must be dropped from the cache
+   that held it before it is freed. */
+#define DIRECT_CNT 123
+#define INLINE_MAX (DIRECT_CNT * sizeof (block_sector_t))
+#define PTRS_PER_SECTOR ((size_t) (BLOCK_SECTOR_SIZE / sizeof (block_sector_t)))
+#define UNWRITTEN 0x80000000u
+
+/* Most sectors allocated as one extent of unwritten space.  Larger
+   requests are split, so that each part fits one journal
+   transaction of PREALLOC_JOURNAL_SECTORS: the inode, its two
+   top-level index sectors, and the indirect sectors the extent
+   spans. */
+#define EXTENT_MAX (8 * PTRS_PER_SECTOR)
+#define PREALLOC_JOURNAL_SECTORS (3 + EXTENT_MAX / PTRS_PER_SECTOR + 1)
+
+/* A sector of zeros. */
+static const char zeros[BLOCK_SECTOR_SIZE];
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    union
+      {
+        block_sector_t direct[DIRECT_CNT]; /* First data sectors. */
+        uint8_t inline_data[INLINE_MAX]; /* Data, if INODE_INLINE. */
+      };
+    block_sector_t indirect;            /* Indirect index sector. */
+    block_sector_t doubly_indirect;     /* Doubly indirect index sector. */
     off_t length;                       /* File size in bytes. */
+    uint32_t flags;                     /* INODE_* flags. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
   };
 
+/* Inode flags. */
+#define INODE_INLINE 0x1                /* Data is in inline_data. */
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -31,37 +90,383 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool metadata;                      /* Data goes through the buffer
+                                           cache and the journal? */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    unsigned version;                   /* Changes after each write. */
+    struct lock lock;                   /* Serializes changes to the
+                                           index; held while the inode
+                                           is read in. */
+    struct rwlock inline_lock;          /* Readers share inline data;
+                                           writers also hold LOCK. */
     struct inode_disk data;             /* Inode content. */
   };
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+/* Allocates a sector as close after HINT as possible, fills it
+   with zeros, and stores its number in *SECTORP.  Returns false if
+   the disk is full.  A data sector, as opposed to an index sector,
+   is zeroed on disk directly, since the page cache will read it
+   from there. */
+static bool
+allocate_zeroed (block_sector_t hint, block_sector_t *sectorp, bool data)
+{
+  if (!free_map_allocate_near (1, hint, sectorp))
+    return false;
+  if (data)
+    block_write (fs_device, *sectorp, zeros);
+  else
+    cache_write (*sectorp, zeros);
+  return true;
+}
+
+/* Returns entry IDX of the index sector INDEX.  If the entry is
+   0 and ALLOCATE is true, allocates a zeroed sector for it first,
+   near INDEX, a data sector if DATA is true.  Returns 0 if the
+   entry is unallocated. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+index_entry (block_sector_t index, size_t idx, bool allocate, bool data)
 {
-  ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  block_sector_t sector;
+
+  cache_read_at (index, &sector, sizeof sector, idx * sizeof sector);
+  if (sector == 0 && allocate && allocate_zeroed (index, &sector, data))
+    cache_write_at (index, &sector, sizeof sector, idx * sizeof sector);
+  return sector;
+}
+
+/* Returns *SLOT, a sector number in an on-disk inode.  If it is 0
+   and ALLOCATE is true, allocates a zeroed sector for it first,
+   near HINT, a data sector if DATA is true.  Returns 0 if the slot
+   is unallocated. */
+static block_sector_t
+inode_entry (block_sector_t *slot, bool allocate, block_sector_t hint,
+             bool data)
+{
+  if (*slot == 0 && allocate)
+    allocate_zeroed (hint, slot, data);
+  return *slot;
+}
+
+/* Returns the sector that holds data sector IDX of the file
+   described by DISK_INODE, or 0 if it has not been allocated.
+   If ALLOCATE is true, first allocates the sector and any index
+   sectors needed to reach it, placing them near HINT, which should
+   be the inode's own sector; then 0 means the disk is full or IDX
+   is beyond the largest possible file. */
+static block_sector_t
+index_to_sector (struct inode_disk *disk_inode, size_t idx, bool allocate,
+                 block_sector_t hint)
+{
+  block_sector_t index;
+
+  if (idx < DIRECT_CNT)
+    return inode_entry (&disk_inode->direct[idx], allocate, hint, true);
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    {
+      index = inode_entry (&disk_inode->indirect, allocate, hint, false);
+      return index != 0 ? index_entry (index, idx, allocate, true) : 0;
+    }
+  idx -= PTRS_PER_SECTOR;
+
+  if (idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      index = inode_entry (&disk_inode->doubly_indirect, allocate, hint,
+                           false);
+      if (index != 0)
+        index = index_entry (index, idx / PTRS_PER_SECTOR, allocate, false);
+      return index != 0 ? index_entry (index, idx % PTRS_PER_SECTOR,
+                                       allocate, true) : 0;
+    }
+  return 0;
+}
+
+/* Makes sure that the index sectors through which DISK_INODE
+   reaches data sector IDX exist, allocating any that are missing
+   near HINT, then, if SECTOR is nonzero, makes SECTOR data sector
+   IDX.  Returns false if the disk is full or IDX is beyond the
+   largest possible file. */
+static bool
+set_index (struct inode_disk *disk_inode, size_t idx, block_sector_t sector,
+           block_sector_t hint)
+{
+  block_sector_t index;
+
+  if (idx < DIRECT_CNT)
+    {
+      if (sector != 0)
+        disk_inode->direct[idx] = sector;
+      return true;
+    }
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    index = inode_entry (&disk_inode->indirect, true, hint, false);
+  else if (idx - PTRS_PER_SECTOR < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      idx -= PTRS_PER_SECTOR;
+      index = inode_entry (&disk_inode->doubly_indirect, true, hint, false);
+      if (index != 0)
+        index = index_entry (index, idx / PTRS_PER_SECTOR, true, false);
+      idx %= PTRS_PER_SECTOR;
+    }
   else
-    return -1;
+    return false;
+
+  if (index != 0 && sector != 0)
+    cache_write_at (index, &sector, sizeof sector, idx * sizeof sector);
+  return index != 0;
+}
+
+/* Like set_index() for INODE, but also writes INODE back if that
+   changes it.  INODE's lock must be held. */
+static bool
+update_index (struct inode *inode, size_t idx, block_sector_t sector)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  block_sector_t indirect = disk_inode->indirect;
+  block_sector_t doubly_indirect = disk_inode->doubly_indirect;
+  bool success = set_index (disk_inode, idx, sector, inode->sector);
+
+  if ((idx < DIRECT_CNT && sector != 0)
+      || disk_inode->indirect != indirect
+      || disk_inode->doubly_indirect != doubly_indirect)
+    cache_write (inode->sector, disk_inode);
+  return success;
+}
+
+/* Allocates unwritten space for each of data sectors START up to
+   END of DISK_INODE, which must span at most EXTENT_MAX sectors,
+   that has none, in as few extents as the free map allows, placing
+   them near HINT.  Returns false if the disk fills up or END is
+   beyond the largest possible file, in which case some of the
+   sectors may have been allocated. */
+static bool
+allocate_unwritten (struct inode_disk *disk_inode, block_sector_t hint,
+                    size_t start, size_t end)
+{
+  size_t idx = start;
+
+  ASSERT (end - start <= EXTENT_MAX);
+
+  while (idx < end)
+    {
+      block_sector_t first;
+      size_t cnt, i;
+
+      if (index_to_sector (disk_inode, idx, false, 0) != 0)
+        {
+          idx++;
+          continue;
+        }
+
+      /* Find the run of sectors without space, and the largest
+         extent that the free map can supply for it. */
+      for (cnt = 1; idx + cnt < end; cnt++)
+        if (index_to_sector (disk_inode, idx + cnt, false, 0) != 0)
+          break;
+      while (!free_map_allocate_near (cnt, hint, &first))
+        if ((cnt /= 2) == 0)
+          return false;
+
+      for (i = 0; i < cnt; i++)
+        if (!set_index (disk_inode, idx + i, (first + i) | UNWRITTEN, hint))
+          {
+            free_map_release (first + i, cnt - i);
+            return false;
+          }
+      idx += cnt;
+      hint = first + cnt;
+    }
+  return true;
+}
+
+/* If data sector IDX of INODE is unwritten, zeros it on disk and
+   marks it written.  Returns the data sector. */
+static block_sector_t
+write_unwritten (struct inode *inode, size_t idx)
+{
+  block_sector_t sector;
+
+  journal_begin (JOURNAL_GROW_SECTORS);
+  lock_acquire (&inode->lock);
+  sector = index_to_sector (&inode->data, idx, false, 0);
+  if (sector & UNWRITTEN)
+    {
+      sector &= ~UNWRITTEN;
+      block_write (fs_device, sector, zeros);
+      update_index (inode, idx, sector);
+    }
+  lock_release (&inode->lock);
+  journal_end ();
+  return sector;
+}
+
+/* Releases SECTOR and, if LEVEL is nonzero, every sector reachable
+   from it as an index sector LEVEL levels above the data.  If
+   METADATA is true, the data sectors are in the buffer cache too. */
+static void
+release_tree (block_sector_t sector, int level, bool metadata)
+{
+  if (sector == 0)
+    return;
+  sector &= ~UNWRITTEN;
+  if (level > 0)
+    {
+      size_t i;
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        release_tree (index_entry (sector, i, false, false), level - 1,
+                      metadata);
+    }
+  if (level > 0 || metadata)
+    cache_discard (sector);
+  free_map_release (sector, 1);
+}
+
+/* Releases all of the data and index sectors of DISK_INODE, whose
+   data is in the buffer cache if METADATA is true. */
+static void
+release_sectors (struct inode_disk *disk_inode, bool metadata)
+{
+  size_t i;
+
+  if (disk_inode->flags & INODE_INLINE)
+    return;
+  for (i = 0; i < DIRECT_CNT; i++)
+    release_tree (disk_inode->direct[i], 0, metadata);
+  release_tree (disk_inode->indirect, 1, metadata);
+  release_tree (disk_inode->doubly_indirect, 2, metadata);
+}
+
+/* Returns the data sector that holds sector IDX of INODE_, or 0
+   if it has not been allocated or is unwritten.  Tells the page
+   cache where to find INODE_'s pages. */
+static block_sector_t
+map_sector (void *inode_, size_t idx)
+{
+  struct inode *inode = inode_;
+  block_sector_t sector = index_to_sector (&inode->data, idx, false, 0);
+  return sector & UNWRITTEN ? 0 : sector;
+}
+
+/* Most sectors allocate_delayed() logs: the inode and the index
+   sectors that point to up to PCACHE_DELAYED_PAGES pages, each of
+   which may span two of them. */
+#define ASSIGN_JOURNAL_SECTORS (1 + 2 * PCACHE_DELAYED_PAGES)
+
+/* State of allocate_delayed() for assign_sector(). */
+struct assign_ctx
+  {
+    struct inode *inode;                /* Inode being given sectors. */
+    block_sector_t next;                /* Next sector of the extent. */
+    size_t left;                        /* Sectors left in the extent. */
+  };
+
+/* Chooses the data sector for delayed sector IDX of the inode in
+   assign_ctx CTX_, taking it from an extent allocated for all LEFT
+   delayed sectors still to go when possible, and records it in the
+   index.  Returns 0 if no reserved sector could be allocated. */
+static block_sector_t
+assign_sector (void *ctx_, size_t idx, size_t left)
+{
+  struct assign_ctx *ctx = ctx_;
+  struct inode *inode = ctx->inode;
+  block_sector_t sector, old;
+
+  if (ctx->left == 0)
+    {
+      /* Continue the file from where its previous sector lies. */
+      block_sector_t hint = idx > 0 ? map_sector (inode, idx - 1) : 0;
+      if (hint == 0)
+        hint = inode->sector;
+
+      if (free_map_allocate_reserved (left, hint, &ctx->next))
+        ctx->left = left;
+      else if (free_map_allocate_reserved (1, hint, &ctx->next))
+        ctx->left = 1;
+      else
+        return 0;
+    }
+  sector = ctx->next++;
+  ctx->left--;
+
+  /* The new sector replaces any unwritten space that was
+     preallocated after the data was written. */
+  old = index_to_sector (&inode->data, idx, false, 0);
+  if (old & UNWRITTEN)
+    free_map_release (old & ~UNWRITTEN, 1);
+
+  /* Cannot fail: write_delayed() allocated the index sectors. */
+  if (!update_index (inode, idx, sector))
+    NOT_REACHED ();
+  return sector;
+}
+
+/* Gives INODE's delayed data in the page cache its sectors, as one
+   extent if possible, and writes it back. */
+static void
+allocate_delayed (struct inode *inode)
+{
+  struct assign_ctx ctx;
+
+  if (!pcache_has_delayed (inode->sector))
+    return;
+
+  ctx.inode = inode;
+  ctx.left = 0;
+  journal_begin (ASSIGN_JOURNAL_SECTORS);
+  lock_acquire (&inode->lock);
+  pcache_assign (inode->sector, assign_sector, &ctx);
+  lock_release (&inode->lock);
+  journal_end ();
+
+  /* pcache_assign() counts the delayed sectors exactly. */
+  ASSERT (ctx.left == 0);
+}
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  open_inodes_lock also
+   protects each inode's open_cnt.  Every open, reopen, and close
+   looks an inode up here, and the table changes far less often,
+   so it is an open-addressing table. */
+static struct ohash open_inodes;
+static struct lock open_inodes_lock;
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const void *e, void *aux UNUSED)
+{
+  return hash_int (((const struct inode *) e)->sector);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns true if inode A has a lower sector number than inode
+   B. */
+static bool
+inode_less (const void *a, const void *b, void *aux UNUSED)
+{
+  return (((const struct inode *) a)->sector
+          < ((const struct inode *) b)->sector);
+}
+
+/* Cache from which in-memory inodes are allocated.  A `struct
+   inode' is a little over a sector, so malloc() would round it
+   up to 1 kB. */
+static struct kmem_cache *inode_cache;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!ohash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("inode_init: cannot create open inode table");
+  lock_init (&open_inodes_lock);
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode), 0, NULL);
+  if (inode_cache == NULL)
+    PANIC ("inode_init: cannot create inode cache");
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -85,71 +490,161 @@ inode_create (block_sector_t sector, off_t length)
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
+      size_t i;
+
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+
+      /* Allocate the initial data up front, so that running out
+         of space is reported here rather than on a later write,
+         but leave it unwritten.  A small enough file needs none. */
+      success = true;
+      if ((size_t) length <= INLINE_MAX)
+        disk_inode->flags = INODE_INLINE;
+      else
+        for (i = 0; i < sectors && success; i += EXTENT_MAX)
+          success = allocate_unwritten (disk_inode, sector, i,
+                                        (sectors - i < EXTENT_MAX
+                                         ? sectors : i + EXTENT_MAX));
+
+      if (success)
+        cache_write (sector, disk_inode);
+      else
+        release_sectors (disk_inode, false);
       free (disk_inode);
     }
   return success;
 }
 
+/* Returns the most sectors inode_create() writes for an inode
+   LENGTH bytes long: the inode and its index sectors. */
+size_t
+inode_create_sectors (off_t length)
+{
+  size_t sectors = bytes_to_sectors (length);
+  size_t cnt = 1;
+
+  if (sectors > DIRECT_CNT)
+    cnt++;
+  if (sectors > DIRECT_CNT + PTRS_PER_SECTOR)
+    cnt += 1 + DIV_ROUND_UP (sectors - DIRECT_CNT - PTRS_PER_SECTOR,
+                             PTRS_PER_SECTOR);
+  return cnt;
+}
+
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  inode = ohash_find (&open_inodes, &key);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+
+      /* Wait for it to be read in. */
+      lock_acquire (&inode->lock);
+      lock_release (&inode->lock);
+      return inode;
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (inode_cache);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The inode is read in holding its own lock rather
+     than the table's, so that opens of other inodes need not wait
+     for the disk; anyone who finds it meanwhile waits for the
+     lock. */
   inode->sector = sector;
+  if (ohash_insert (&open_inodes, inode) != NULL)
+    {
+      kmem_cache_free (inode_cache, inode);
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
+  inode->version = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->metadata = false;
+  lock_init (&inode->lock);
+  rw_init (&inode->inline_lock);
+  lock_acquire (&inode->lock);
+  lock_release (&open_inodes_lock);
+
+  cache_read (inode->sector, &inode->data);
+  lock_release (&inode->lock);
   return inode;
 }
 
+/* Gives the delayed data of every open inode its sectors and
+   writes it back.  Called periodically by the write-behind thread,
+   so that delayed data reaches the disk about as soon as other
+   writes, and at shutdown. */
+void
+inode_allocate_delayed (void)
+{
+  block_sector_t inumber;
+  size_t pos = 0;
+
+  while (pcache_next_delayed (&pos, &inumber))
+    {
+      struct inode key;
+      struct inode *inode;
+
+      /* Hold the inode open meanwhile.  An inode not in the table
+         is being closed, which allocates its delayed data itself. */
+      key.sector = inumber;
+      lock_acquire (&open_inodes_lock);
+      inode = ohash_find (&open_inodes, &key);
+      if (inode != NULL)
+        inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+
+      if (inode != NULL)
+        {
+          allocate_delayed (inode);
+          inode_close (inode);
+        }
+    }
+}
+
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
+/* Marks INODE as holding file system metadata, so that its data
+   goes through the buffer cache and is journaled.  Must be called
+   right after opening INODE, before reading or writing it. */
+void
+inode_set_metadata (struct inode *inode)
+{
+  inode->metadata = true;
+}
+
 /* Returns INODE's inode number. */
 block_sector_t
 inode_get_inumber (const struct inode *inode)
@@ -167,22 +662,42 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* Release resources if this was the last opener.  The last
+     opener first gives delayed data its sectors, while the inode is
+     still in the table, so that nobody can reopen it and read it
+     from disk before it is up to date. */
+  lock_acquire (&open_inodes_lock);
+  while (inode->open_cnt == 1 && !inode->removed
+         && pcache_has_delayed (inode->sector))
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
-        {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
-        }
+      lock_release (&open_inodes_lock);
+      allocate_delayed (inode);
+      lock_acquire (&open_inodes_lock);
+    }
+  if (--inode->open_cnt > 0)
+    {
+      lock_release (&open_inodes_lock);
+      return;
+    }
+
+  /* Remove from inode table and release lock. */
+  ohash_delete (&open_inodes, inode);
+  lock_release (&open_inodes_lock);
 
-      free (inode); 
+  /* Deallocate blocks if removed, dropping them from the caches
+     first so that stale copies are never written over their next
+     use. */
+  if (inode->removed) 
+    {
+      journal_begin (0);
+      pcache_discard (inode->sector);
+      cache_discard (inode->sector);
+      free_map_release (inode->sector, 1);
+      release_sectors (&inode->data, inode->metadata);
+      journal_end ();
     }
+
+  kmem_cache_free (inode_cache, inode); 
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -194,6 +709,123 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode) 
+{
+  return inode->removed;
+}
+
+/* Returns INODE's version, which changes after every write to its
+   data or length, so that a cache of something derived from the
+   data can tell whether it is still current.  The version is kept
+   only while INODE is open. */
+unsigned
+inode_version (const struct inode *inode) 
+{
+  return inode->version;
+}
+
+/* Returns true if INODE's data may be inline.  Only a check under
+   INODE's lock is sure, but once false, it stays false. */
+static inline bool
+may_be_inline (const struct inode *inode)
+{
+  return inode->data.flags & INODE_INLINE;
+}
+
+/* Reads up to SIZE bytes of INODE's inline data starting at
+   OFFSET into BUFFER and returns the number read, or returns -1 if
+   INODE's data is not inline.  Readers of the same inode proceed in
+   parallel. */
+static off_t
+read_inline (struct inode *inode, void *buffer, off_t size, off_t offset)
+{
+  off_t bytes_read = -1;
+
+  rw_read_acquire (&inode->inline_lock);
+  if (inode->data.flags & INODE_INLINE)
+    {
+      off_t left = inode->data.length - offset;
+
+      bytes_read = size < left ? size : left;
+      if (bytes_read < 0)
+        bytes_read = 0;
+      memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+    }
+  rw_read_release (&inode->inline_lock);
+  return bytes_read;
+}
+
+/* Moves INODE's inline data out to a newly allocated data sector
+   and makes INODE use its direct sector list.  Returns false if
+   memory or disk space is short.  INODE's lock must be held. */
+static bool
+move_out (struct inode *inode)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  block_sector_t sector = 0;
+
+  ASSERT (disk_inode->flags & INODE_INLINE);
+
+  if (disk_inode->length > 0)
+    {
+      /* The sector is written directly, like any new data sector,
+         before the inode points to it. */
+      uint8_t *data = calloc (1, BLOCK_SECTOR_SIZE);
+      if (data == NULL)
+        return false;
+      if (!free_map_allocate_near (1, inode->sector, &sector))
+        {
+          free (data);
+          return false;
+        }
+      memcpy (data, disk_inode->inline_data, disk_inode->length);
+      block_write (fs_device, sector, data);
+      free (data);
+    }
+
+  rw_write_acquire (&inode->inline_lock);
+  memset (disk_inode->direct, 0, sizeof disk_inode->direct);
+  disk_inode->direct[0] = sector;
+  disk_inode->flags &= ~INODE_INLINE;
+  rw_write_release (&inode->inline_lock);
+  cache_write (inode->sector, disk_inode);
+  return true;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE's inline data starting
+   at OFFSET and returns SIZE, extending INODE if necessary.  If the
+   data is not inline, returns -1.  If the write does not fit inline,
+   moves the data out and returns -1, or returns 0 if that fails;
+   the caller must write normally after a return of -1. */
+static off_t
+write_inline (struct inode *inode, const void *buffer, off_t size,
+              off_t offset)
+{
+  off_t bytes_written = -1;
+
+  journal_begin (JOURNAL_GROW_SECTORS);
+  lock_acquire (&inode->lock);
+  if (!(inode->data.flags & INODE_INLINE))
+    ;
+  else if ((size_t) offset + size <= INLINE_MAX)
+    {
+      rw_write_acquire (&inode->inline_lock);
+      memcpy (inode->data.inline_data + offset, buffer, size);
+      if (offset + size > inode->data.length)
+        inode->data.length = offset + size;
+      rw_write_release (&inode->inline_lock);
+      cache_write (inode->sector, &inode->data);
+      bytes_written = size;
+    }
+  else if (!move_out (inode))
+    bytes_written = 0;
+  lock_release (&inode->lock);
+  journal_end ();
+  return bytes_written;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -202,109 +834,222 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  int unit = inode->metadata ? BLOCK_SECTOR_SIZE : PGSIZE;
 
-  while (size > 0) 
+  if (may_be_inline (inode))
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      bytes_read = read_inline (inode, buffer, size, offset);
+      if (bytes_read >= 0)
+        return bytes_read;
+      bytes_read = 0;
+    }
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
+  while (size > 0) 
+    {
+      /* Bytes left in inode, bytes left in the page or, for
+         metadata, the sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      int unit_left = unit - offset % unit;
+      int min_left = inode_left < unit_left ? inode_left : unit_left;
 
-      /* Number of bytes to actually copy out of this sector. */
+      /* Number of bytes to actually copy out of this page. */
       int chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
+      if (inode->metadata)
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          block_sector_t sector = map_sector (inode,
+                                              offset / BLOCK_SECTOR_SIZE);
+          if (sector != 0)
+            cache_read_at (sector, buffer + bytes_read, chunk_size,
+                           offset % BLOCK_SECTOR_SIZE);
+          else
+            memset (buffer + bytes_read, 0, chunk_size);
         }
+      else
+        pcache_read (inode->sector, offset, buffer + bytes_read, chunk_size,
+                     map_sector, inode);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
+/* Returns a pointer to the bytes of INODE starting at OFFSET, as
+   held in the page cache, and stores into *SIZE how many bytes
+   may be read through it: up to the end of OFFSET's page or of
+   INODE, whichever comes first.  Returns a null pointer if OFFSET
+   is at or past the end of INODE, or if INODE's data is inline.
+   The bytes stay valid until the pointer is passed to
+   inode_unmap(); see pcache_pin() for the restrictions that apply
+   meanwhile. */
+const void *
+inode_map (struct inode *inode, off_t offset, off_t *size)
+{
+  off_t inode_left = inode_length (inode) - offset;
+  int page_left = PGSIZE - offset % PGSIZE;
+
+  ASSERT (!inode->metadata);
+
+  if (offset < 0 || inode_left <= 0 || may_be_inline (inode))
+    return NULL;
+  *size = inode_left < page_left ? inode_left : page_left;
+  return pcache_pin (inode->sector, offset, map_sector, inode);
+}
+
+/* Releases P, a pointer returned by inode_map(). */
+void
+inode_unmap (const void *p)
+{
+  pcache_unpin (p);
+}
+
+/* Starts reading the SIZE bytes of INODE at OFFSET into the page
+   cache in the background, so that a later inode_read_at() finds
+   them there.  Bytes past the end of INODE are ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t size, off_t offset)
+{
+  off_t end = offset + size;
+
+  if (inode->metadata || may_be_inline (inode))
+    return;
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset -= offset % PGSIZE; offset < end; offset += PGSIZE)
+    pcache_read_ahead (inode->sector, offset, map_sector, inode);
+}
+
+/* Reads page PAGE of the file whose inode is at sector INUMBER
+   into the page cache and waits for it.  Does nothing unless
+   INUMBER is an allocated sector that still holds an inode whose
+   data goes through the page cache, since the caller's list of
+   pages may be out of date. */
+void
+inode_prefetch (block_sector_t inumber, size_t page)
+{
+  struct inode *inode;
+  const void *p;
+  off_t size;
+
+  if (inumber == FREE_MAP_SECTOR || !free_map_in_use (inumber, 1))
+    return;
+  inode = inode_open (inumber);
+  if (inode == NULL)
+    return;
+  if (inode->data.magic == INODE_MAGIC && !inode->metadata && !inode->removed)
+    {
+      p = inode_map (inode, (off_t) page * PGSIZE, &size);
+      if (p != NULL)
+        inode_unmap (p);
+    }
+  inode_close (inode);
+}
+
+/* Writes SIZE bytes from BUFFER into INODE at OFFSET, within a
+   sector that has no data sector yet, leaving the choice of data
+   sector to the page cache, which makes it for all of INODE's
+   delayed data at once.  Allocates the index sectors that will
+   point to it now, so that only the data sector, which the page
+   cache reserves, remains to be allocated later.  Returns false if
+   the sector cannot be delayed; the caller must then allocate it
+   itself. */
+static bool
+write_delayed (struct inode *inode, off_t offset, const void *buffer,
+               int size)
+{
+  bool success;
+
+  journal_begin (JOURNAL_GROW_SECTORS);
+  lock_acquire (&inode->lock);
+  success = update_index (inode, offset / BLOCK_SECTOR_SIZE, 0);
+  lock_release (&inode->lock);
+  journal_end ();
+
+  return success && pcache_write (inode->sector, offset, buffer, size, 0,
+                                  map_sector, inode);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or the file reaches its
+   maximum size.  Writing past end of file extends the inode;
+   any gap before OFFSET reads back as zeros. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
 
+  if (may_be_inline (inode))
+    {
+      bytes_written = write_inline (inode, buffer, size, offset);
+      if (bytes_written >= 0)
+        {
+          inode->version++;
+          return bytes_written;
+        }
+      bytes_written = 0;
+    }
+
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      size_t idx = offset / BLOCK_SECTOR_SIZE;
+      block_sector_t sector_idx = index_to_sector (&inode->data, idx,
+                                                   false, 0);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in sector. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+      int chunk_size = size < sector_left ? size : sector_left;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx == 0 && !inode->metadata
+          && write_delayed (inode, offset, buffer + bytes_written,
+                            chunk_size))
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          /* The data sector is allocated when the data is written
+             back. */
         }
-      else 
+      else
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          if (sector_idx == 0)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
+              /* Allocate the sector, unless another writer beat us
+                 to it, and write out the inode with the index
+                 sectors in the same journal transaction. */
+              journal_begin (JOURNAL_GROW_SECTORS);
+              lock_acquire (&inode->lock);
+              sector_idx = index_to_sector (&inode->data, idx, true,
+                                            inode->sector);
+              cache_write (inode->sector, &inode->data);
+              lock_release (&inode->lock);
+              journal_end ();
+              if (sector_idx == 0)
                 break;
             }
+          if (sector_idx & UNWRITTEN)
+            sector_idx = write_unwritten (inode, idx);
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
+          /* The page cache reads in the rest of the page first if it
+             is not cached. */
+          if (inode->metadata)
+            cache_write_at (sector_idx, buffer + bytes_written, chunk_size,
+                            sector_ofs);
           else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+            pcache_write (inode->sector, offset, buffer + bytes_written,
+                          chunk_size, sector_idx, map_sector, inode);
         }
 
       /* Advance. */
@@ -312,11 +1057,92 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
+  /* Extend the file only after its new data is in place, so that
+     readers never see the new length before the data. */
+  if (offset > inode->data.length)
+    {
+      journal_begin (1);
+      lock_acquire (&inode->lock);
+      if (offset > inode->data.length)
+        {
+          inode->data.length = offset;
+          cache_write (inode->sector, &inode->data);
+        }
+      lock_release (&inode->lock);
+      journal_end ();
+    }
+
+  inode->version++;
   return bytes_written;
 }
 
+/* Allocates unwritten space for the SIZE bytes of INODE starting
+   at OFFSET that have none, in as few contiguous extents as
+   possible, extending INODE to OFFSET + SIZE bytes if it is
+   shorter.  The space reads as zeros.  Returns false if the disk
+   fills up, writes to INODE are denied, or the range is beyond the
+   largest possible file; then part of the space may have been
+   allocated, but INODE's length is unchanged. */
+bool
+inode_preallocate (struct inode *inode, off_t offset, off_t size)
+{
+  size_t start = offset / BLOCK_SECTOR_SIZE;
+  size_t end = bytes_to_sectors (offset + size);
+  bool success = true;
+
+  if (inode->deny_write_cnt || offset < 0 || size < 0
+      || size > INT32_MAX - offset)
+    return false;
+  if (size == 0)
+    return true;
+
+  /* Preallocated space must be listed in the index. */
+  if (may_be_inline (inode))
+    {
+      journal_begin (JOURNAL_GROW_SECTORS);
+      lock_acquire (&inode->lock);
+      if (inode->data.flags & INODE_INLINE)
+        success = move_out (inode);
+      lock_release (&inode->lock);
+      journal_end ();
+      if (!success)
+        return false;
+    }
+
+  /* Delayed data takes space that looks unallocated. */
+  allocate_delayed (inode);
+
+  while (start < end && success)
+    {
+      size_t stop = end - start < EXTENT_MAX ? end : start + EXTENT_MAX;
+
+      journal_begin (PREALLOC_JOURNAL_SECTORS);
+      lock_acquire (&inode->lock);
+      success = allocate_unwritten (&inode->data, inode->sector,
+                                    start, stop);
+      cache_write (inode->sector, &inode->data);
+      lock_release (&inode->lock);
+      journal_end ();
+      start = stop;
+    }
+
+  if (success && offset + size > inode->data.length)
+    {
+      journal_begin (1);
+      lock_acquire (&inode->lock);
+      if (offset + size > inode->data.length)
+        {
+          inode->data.length = offset + size;
+          cache_write (inode->sector, &inode->data);
+        }
+      lock_release (&inode->lock);
+      journal_end ();
+      inode->version++;
+    }
+  return success;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -2,6 +2,7 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
@@ -9,13 +10,23 @@ struct bitmap;
 
 void inode_init (void);
 bool inode_create (block_sector_t, off_t);
+size_t inode_create_sectors (off_t);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
+void inode_set_metadata (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
+void inode_allocate_delayed (void);
 void inode_remove (struct inode *);
+bool inode_is_removed (const struct inode *);
+unsigned inode_version (const struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_read_ahead (struct inode *, off_t size, off_t offset);
+void inode_prefetch (block_sector_t inumber, size_t page);
+const void *inode_map (struct inode *, off_t offset, off_t *size);
+void inode_unmap (const void *);
+bool inode_preallocate (struct inode *, off_t offset, off_t size);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
@@ -0,0 +1,467 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Metadata journal.
+
+   Changes to metadata, that is, to inodes, index sectors,
+   directories, and the free map, are made crash-consistent by
+   writing them ahead to a log in a reserved region of the file
+   system device before any of them reaches its home sector.
+
+   An operation that changes metadata brackets its changes with
+   journal_begin() and journal_end(), which reserves room in the
+   log for the most sectors the operation may change.  While a
+   thread is inside an operation, every buffer cache write copies
+   the changed sector into the running transaction here instead of
+   marking the cached copy dirty, so the buffer cache never writes
+   it home; a later cache miss on the sector reads the journal's
+   copy.  All the operations in progress share one transaction.
+
+   A commit waits for the operations in progress to finish, holding
+   off new ones, then writes the free map's changes into the
+   transaction and writes the whole transaction to the log with one
+   sequential write, followed by the header that makes it count.
+   Commits happen when the flusher asks for one, every few seconds,
+   and when an operation cannot find room in the log, so that many
+   operations share the cost of each.  The committed transaction
+   stays in the log until it is checkpointed, that is, until its
+   sectors are copied home, which the flusher does lazily on its
+   next pass, or the next commit does if the flusher has not.
+   After a crash, journal_recover() copies home the committed
+   transaction that the log holds, if any.
+
+   A sector that is freed is dropped from the journal, so that a
+   stale copy is not later written over its next use.  File data
+   is not journaled. */
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* On-disk journal header, at JOURNAL_SECTOR.  Must be exactly
+   BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    uint32_t magic;                     /* JOURNAL_MAGIC. */
+    uint32_t cnt;                       /* Committed blocks, or 0. */
+    block_sector_t sectors[JOURNAL_BLOCKS]; /* Home of each block. */
+  };
+
+/* Pages holding the running transaction's data. */
+#define RUN_PAGES DIV_ROUND_UP (JOURNAL_BLOCKS * BLOCK_SECTOR_SIZE, PGSIZE)
+
+static bool enabled;                    /* Journaling in effect? */
+static size_t free_map_cnt;             /* Free map file sectors, all of
+                                           which a commit may log. */
+
+/* journal_lock protects everything below.  journal_cond is
+   broadcast whenever any of it changes in a way a waiter may care
+   about. */
+static struct lock journal_lock;
+static struct condition journal_cond;
+
+/* The running transaction. */
+static block_sector_t run_sectors[JOURNAL_BLOCKS]; /* Home sectors. */
+static uint8_t *run_data;               /* Their contents. */
+static size_t run_cnt;                  /* Number of blocks. */
+static size_t reserved;                 /* Blocks reserved by operations
+                                           in progress. */
+static unsigned outstanding;            /* Operations in progress. */
+static unsigned commit_waiters;         /* Threads waiting to commit. */
+static bool committing;                 /* Commit in progress? */
+static bool checkpointing;              /* Checkpoint in progress? */
+
+/* The committed transaction in the log, if LOG_CNT > 0. */
+static block_sector_t log_sectors[JOURNAL_BLOCKS]; /* Home sectors. */
+static bool log_forgotten[JOURNAL_BLOCKS]; /* Freed since the commit? */
+static size_t log_cnt;                  /* Number of blocks. */
+
+static void commit_locked (void);
+static void checkpoint (void);
+static void write_header (size_t cnt, const block_sector_t *);
+static int find_running (block_sector_t);
+
+/* Writes an empty journal to a newly formatted file system. */
+void
+journal_format (void)
+{
+  write_header (0, NULL);
+}
+
+/* Copies the committed transaction in the log, if any, to its home
+   sectors, completing whatever the last run of the kernel
+   committed before it stopped.  Must be called before anything
+   else reads metadata. */
+void
+journal_recover (void)
+{
+  static uint8_t block[BLOCK_SECTOR_SIZE];
+  struct journal_header *h;
+  size_t i;
+
+  h = palloc_get_page (PAL_ASSERT);
+  block_read (fs_device, JOURNAL_SECTOR, h);
+  if (h->magic == JOURNAL_MAGIC && h->cnt > 0 && h->cnt <= JOURNAL_BLOCKS)
+    {
+      printf ("Recovering %u journaled sectors...", (unsigned) h->cnt);
+      for (i = 0; i < h->cnt; i++)
+        {
+          block_read (fs_device, JOURNAL_SECTOR + 1 + i, block);
+          block_write (fs_device, h->sectors[i], block);
+        }
+      write_header (0, NULL);
+      printf ("done.\n");
+    }
+  palloc_free_page (h);
+}
+
+/* Starts journaling, if the file system has a journal: if it was
+   formatted with one and its free map is small enough that a
+   commit can always log all of it.  Call after the free map has
+   been opened. */
+void
+journal_init (void)
+{
+  struct journal_header *h;
+  bool formatted;
+
+  ASSERT (sizeof *h == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&journal_cond);
+
+  h = palloc_get_page (PAL_ASSERT);
+  block_read (fs_device, JOURNAL_SECTOR, h);
+  formatted = (h->magic == JOURNAL_MAGIC
+               && free_map_in_use (JOURNAL_SECTOR, JOURNAL_SECTOR_CNT));
+  palloc_free_page (h);
+
+  free_map_cnt = DIV_ROUND_UP (block_size (fs_device),
+                               BLOCK_SECTOR_SIZE * 8) + 1;
+  if (!formatted)
+    printf ("filesys: no journal, reformat to enable journaling\n");
+  else if (free_map_cnt > JOURNAL_BLOCKS / 2)
+    printf ("filesys: disk too large for journal, journaling disabled\n");
+  else if ((run_data = palloc_get_multiple (0, RUN_PAGES)) == NULL)
+    printf ("filesys: out of memory, journaling disabled\n");
+  else
+    enabled = true;
+}
+
+/* Commits and checkpoints everything and stops journaling, so that
+   the on-disk file system is up to date and later writes go
+   straight home. */
+void
+journal_shutdown (void)
+{
+  if (!enabled)
+    return;
+  journal_commit ();
+  journal_checkpoint ();
+  enabled = false;
+  palloc_free_multiple (run_data, RUN_PAGES);
+}
+
+/* Begins an operation that changes at most SECTOR_CNT metadata
+   sectors, waiting for room in the log if necessary.  Returns
+   false, without beginning anything, if SECTOR_CNT sectors would
+   never fit.  An operation begun inside another is part of it and
+   must fit in its reservation. */
+bool
+journal_begin (size_t sector_cnt)
+{
+  struct thread *t = thread_current ();
+
+  if (!enabled)
+    return true;
+  if (t->journal_depth > 0)
+    {
+      t->journal_depth++;
+      return true;
+    }
+  if (sector_cnt + free_map_cnt > JOURNAL_BLOCKS)
+    return false;
+
+  lock_acquire (&journal_lock);
+  for (;;)
+    {
+      bool fits = (run_cnt + reserved + sector_cnt + free_map_cnt
+                   <= JOURNAL_BLOCKS);
+
+      if (fits && !committing && commit_waiters == 0)
+        break;
+      if (!fits && !committing && !checkpointing && outstanding == 0)
+        commit_locked ();
+      else
+        cond_wait (&journal_cond, &journal_lock);
+    }
+  outstanding++;
+  reserved += sector_cnt;
+  lock_release (&journal_lock);
+
+  t->journal_depth = 1;
+  t->journal_reserved = sector_cnt;
+  return true;
+}
+
+/* Ends an operation begun with journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!enabled)
+    return;
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  outstanding--;
+  reserved -= t->journal_reserved;
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+  t->journal_reserved = 0;
+}
+
+/* Returns true if metadata changes by the current thread must be
+   logged with journal_log(). */
+bool
+journal_active (void)
+{
+  return enabled && thread_current ()->journal_depth > 0;
+}
+
+/* Records DATA as the new contents of SECTOR in the running
+   transaction.  journal_active() must be true. */
+void
+journal_log (block_sector_t sector, const void *data)
+{
+  int i;
+
+  ASSERT (journal_active ());
+
+  lock_acquire (&journal_lock);
+  i = find_running (sector);
+  if (i < 0)
+    {
+      ASSERT (run_cnt < JOURNAL_BLOCKS);
+      i = run_cnt++;
+      run_sectors[i] = sector;
+    }
+  memcpy (run_data + i * BLOCK_SECTOR_SIZE, data, BLOCK_SECTOR_SIZE);
+  lock_release (&journal_lock);
+}
+
+/* If the journal holds a copy of SECTOR newer than its home
+   sector, reads it into DATA and returns true.  Otherwise returns
+   false. */
+bool
+journal_read (block_sector_t sector, void *data)
+{
+  bool found = false;
+  size_t i;
+  int r;
+
+  if (!enabled)
+    return false;
+
+  lock_acquire (&journal_lock);
+  r = find_running (sector);
+  if (r >= 0)
+    {
+      memcpy (data, run_data + r * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+      found = true;
+    }
+  else
+    for (i = 0; i < log_cnt; i++)
+      if (log_sectors[i] == sector && !log_forgotten[i])
+        {
+          block_read (fs_device, JOURNAL_SECTOR + 1 + i, data);
+          found = true;
+          break;
+        }
+  lock_release (&journal_lock);
+  return found;
+}
+
+/* Drops SECTOR, which is being freed, from the journal. */
+void
+journal_forget (block_sector_t sector)
+{
+  size_t i;
+  int r;
+
+  if (!enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  r = find_running (sector);
+  if (r >= 0)
+    {
+      /* Move the last block into its place. */
+      run_cnt--;
+      run_sectors[r] = run_sectors[run_cnt];
+      memcpy (run_data + r * BLOCK_SECTOR_SIZE,
+              run_data + run_cnt * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+    }
+
+  /* The log itself keeps the block, which is harmless: recovery
+     copies it home only if the commit that freed the sector never
+     happened, and that commit must checkpoint this log first. */
+  for (i = 0; i < log_cnt; i++)
+    if (log_sectors[i] == sector)
+      log_forgotten[i] = true;
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction, waiting for the operations in
+   progress to finish and holding off new ones meanwhile. */
+void
+journal_commit (void)
+{
+  if (!enabled)
+    {
+      free_map_flush ();
+      return;
+    }
+
+  lock_acquire (&journal_lock);
+  commit_waiters++;
+  while (committing || checkpointing || outstanding > 0)
+    cond_wait (&journal_cond, &journal_lock);
+  commit_waiters--;
+  commit_locked ();
+  lock_release (&journal_lock);
+}
+
+/* Copies the committed transaction in the log, if any, to its
+   home sectors, without holding off operations. */
+void
+journal_checkpoint (void)
+{
+  if (!enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (committing || checkpointing)
+    cond_wait (&journal_cond, &journal_lock);
+  if (log_cnt > 0)
+    {
+      checkpointing = true;
+      lock_release (&journal_lock);
+      checkpoint ();
+      lock_acquire (&journal_lock);
+      checkpointing = false;
+      cond_broadcast (&journal_cond, &journal_lock);
+    }
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction.  journal_lock must be held, no
+   commit or checkpoint may be in progress, and no operation may be
+   in progress.  Releases journal_lock while it works. */
+static void
+commit_locked (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  ASSERT (!committing && !checkpointing && outstanding == 0);
+
+  committing = true;
+  lock_release (&journal_lock);
+
+  /* The log holds one transaction at a time. */
+  if (log_cnt > 0)
+    checkpoint ();
+
+  /* Log the free map's changes with the operations that made
+     them. */
+  t->journal_depth++;
+  free_map_flush ();
+  t->journal_depth--;
+
+  if (run_cnt > 0)
+    {
+      block_write_multiple (fs_device, JOURNAL_SECTOR + 1, run_cnt, run_data);
+      write_header (run_cnt, run_sectors);
+    }
+
+  lock_acquire (&journal_lock);
+  memcpy (log_sectors, run_sectors, run_cnt * sizeof *run_sectors);
+  memset (log_forgotten, 0, sizeof log_forgotten);
+  log_cnt = run_cnt;
+  run_cnt = 0;
+  committing = false;
+  cond_broadcast (&journal_cond, &journal_lock);
+}
+
+/* Copies each block of the committed transaction home, except for
+   sectors freed since, then empties the log.  The caller must have
+   set `committing' or `checkpointing'. */
+static void
+checkpoint (void)
+{
+  static uint8_t buffer[PGSIZE];
+  enum { BATCH = PGSIZE / BLOCK_SECTOR_SIZE };
+  size_t i, j;
+
+  for (i = 0; i < log_cnt; i += BATCH)
+    {
+      size_t cnt = log_cnt - i < BATCH ? log_cnt - i : BATCH;
+
+      block_read_multiple (fs_device, JOURNAL_SECTOR + 1 + i, cnt, buffer);
+
+      /* Check and write under the lock, so that a sector cannot be
+         freed and reused between the two. */
+      lock_acquire (&journal_lock);
+      for (j = 0; j < cnt; j++)
+        if (!log_forgotten[i + j])
+          block_write (fs_device, log_sectors[i + j],
+                       buffer + j * BLOCK_SECTOR_SIZE);
+      lock_release (&journal_lock);
+    }
+  write_header (0, NULL);
+
+  lock_acquire (&journal_lock);
+  log_cnt = 0;
+  lock_release (&journal_lock);
+}
+
+/* Writes a journal header that commits the CNT blocks in the log,
+   whose home sectors are SECTORS. */
+static void
+write_header (size_t cnt, const block_sector_t *sectors)
+{
+  static struct journal_header h;
+
+  memset (&h, 0, sizeof h);
+  h.magic = JOURNAL_MAGIC;
+  h.cnt = cnt;
+  if (cnt > 0)
+    memcpy (h.sectors, sectors, cnt * sizeof *sectors);
+  block_write (fs_device, JOURNAL_SECTOR, &h);
+}
+
+/* Returns the index of SECTOR in the running transaction, or -1
+   if it is not there.  journal_lock must be held. */
+static int
+find_running (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < run_cnt; i++)
+    if (run_sectors[i] == sector)
+      return i;
+  return -1;
+}
@@ -0,0 +1,38 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Sectors of logged metadata the journal holds, and sectors it
+   occupies on disk, starting at JOURNAL_SECTOR: a header, then
+   the log. */
+#define JOURNAL_BLOCKS 126
+#define JOURNAL_SECTOR_CNT (1 + JOURNAL_BLOCKS)
+
+/* Most sectors one allocation step of a growing inode logs: the
+   inode and two levels of index sectors. */
+#define JOURNAL_GROW_SECTORS 3
+
+/* Most sectors adding or removing a directory entry logs, including
+   growing the directory. */
+#define JOURNAL_DIR_SECTORS 8
+
+void journal_format (void);
+void journal_recover (void);
+void journal_init (void);
+void journal_shutdown (void);
+
+bool journal_begin (size_t sector_cnt);
+void journal_end (void);
+bool journal_active (void);
+
+void journal_log (block_sector_t, const void *);
+bool journal_read (block_sector_t, void *);
+void journal_forget (block_sector_t);
+
+void journal_commit (void);
+void journal_checkpoint (void);
+
+#endif /* filesys/journal.h */
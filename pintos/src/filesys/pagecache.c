@@ -0,0 +1,682 @@
+#include "filesys/pagecache.h"
+#include <debug.h>
+#include <stdint.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Page cache.
+
+   All file data goes through a fixed set of PCACHE_PAGES page
+   buffers, each holding one page of one file, keyed by the file's
+   inode number and the page's index within it.  read(), write(),
+   directory lookups, and demand paging of executables and mapped
+   files all read through it, so one copy of hot file data serves
+   them all.  The sector buffer cache holds only metadata: inodes
+   and index sectors.
+
+   A cached page records the data sector behind each of its
+   sectors, so that it can be written back after its file is
+   closed; a sector of 0 is a hole, which reads as zeros.  Writes
+   mark the sectors they touch dirty, and only dirty sectors are
+   written back, contiguous ones in a single transfer.  Dirty pages
+   are written back when they are evicted, which uses the clock
+   algorithm, and when the cache is flushed: periodically by the
+   buffer cache's write-behind thread, and at shutdown.
+
+   Data written where a file has no sector yet, typically appended
+   data, may be delayed: it takes a sector reserved in the free map
+   but no particular one, and its page stays in the cache, unevicted,
+   until pcache_assign() chooses all of a file's delayed sectors at
+   once, so that they can be allocated as one extent.  At most
+   PCACHE_DELAYED_PAGES pages hold delayed sectors at a time.
+
+   pcache_lock protects the mapping from file pages to entries: an
+   entry's key and `valid' member, and the clock hand.  Each
+   entry's own lock protects the rest of it and is held across the
+   I/O that fills it.  A thread never waits for an entry lock while
+   holding pcache_lock. */
+
+/* A cached file page. */
+struct pcache_entry
+  {
+    struct lock lock;                   /* Protects all but the key. */
+    block_sector_t inumber;             /* Inode, if valid. */
+    size_t page;                        /* Page index within file. */
+    bool valid;                         /* Does this entry hold a page? */
+    bool accessed;                      /* Used since the clock hand
+                                           last passed? */
+    unsigned dirty;                     /* Bit I set if sector I has been
+                                           modified. */
+    unsigned delayed;                   /* Bit I set if sector I is dirty
+                                           but has no data sector yet. */
+    block_sector_t sectors[PCACHE_PAGE_SECTORS]; /* Data sector behind
+                                           each sector, or 0. */
+    uint8_t *data;                      /* Page contents. */
+  };
+
+static struct pcache_entry pcache[PCACHE_PAGES];
+static struct lock pcache_lock;         /* Protects page mapping. */
+static size_t clock_hand;               /* Next entry to consider. */
+static size_t delayed_cnt;              /* Entries with delayed sectors,
+                                           protected by pcache_lock. */
+
+/* Pages waiting to be read ahead, as a circular queue, with the
+   sectors behind each looked up when it was queued.  When the queue
+   is full, further requests are dropped: read-ahead is only a
+   hint.  ra_lock is held while the read-ahead thread claims an
+   entry for a request, so that pcache_discard() either removes a
+   request from the queue or finds its entry in the cache. */
+#define READ_AHEAD_QUEUE 16
+struct ra_request
+  {
+    block_sector_t inumber;
+    size_t page;
+    block_sector_t sectors[PCACHE_PAGE_SECTORS];
+    bool cancelled;                     /* Set by pcache_discard(). */
+  };
+static struct ra_request ra_queue[READ_AHEAD_QUEUE];
+static size_t ra_head, ra_cnt;          /* First request, # of requests. */
+static struct lock ra_lock;             /* Protects the queue. */
+static struct condition ra_nonempty;    /* Signaled on new requests. */
+
+static thread_func read_ahead_daemon NO_RETURN;
+static struct pcache_entry *lookup (block_sector_t inumber, size_t page);
+static struct pcache_entry *evict (void);
+static struct pcache_entry *get_page (block_sector_t inumber, size_t page,
+                                      pcache_map_func *, void *aux);
+static void fill (struct pcache_entry *);
+static void write_back (struct pcache_entry *);
+static void clear_delayed (struct pcache_entry *, unsigned mask);
+static size_t count_bits (unsigned);
+
+/* Initializes the page cache. */
+void
+pcache_init (void)
+{
+  size_t i;
+
+  ASSERT (PCACHE_PAGE_SECTORS * BLOCK_SECTOR_SIZE == PGSIZE);
+
+  lock_init (&pcache_lock);
+  for (i = 0; i < PCACHE_PAGES; i++)
+    {
+      lock_init (&pcache[i].lock);
+      pcache[i].valid = false;
+      pcache[i].accessed = false;
+      pcache[i].dirty = 0;
+      pcache[i].delayed = 0;
+      pcache[i].data = palloc_get_page (PAL_ASSERT);
+    }
+  clock_hand = 0;
+  delayed_cnt = 0;
+
+  lock_init (&ra_lock);
+  cond_init (&ra_nonempty);
+  ra_head = ra_cnt = 0;
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+}
+
+/* Reads SIZE bytes at byte offset OFS of the file with inode
+   number INUMBER into BUFFER.  The bytes must lie within a single
+   page.  If the page is not cached, MAP and AUX give its sectors. */
+void
+pcache_read (block_sector_t inumber, off_t ofs, void *buffer, size_t size,
+             pcache_map_func *map, void *aux)
+{
+  struct pcache_entry *e;
+
+  ASSERT (ofs >= 0 && ofs % PGSIZE + size <= PGSIZE);
+
+  e = get_page (inumber, ofs / PGSIZE, map, aux);
+  memcpy (buffer, e->data + ofs % PGSIZE, size);
+  lock_release (&e->lock);
+}
+
+/* Writes SIZE bytes from BUFFER at byte offset OFS of the file
+   with inode number INUMBER.  The bytes must lie within a single
+   sector, whose data sector is SECTOR.  Otherwise like
+   pcache_read().
+
+   If SECTOR is 0, the data sector is chosen later, by
+   pcache_assign(), unless the sector already has one.  Returns
+   false, without writing anything, if no more delayed sectors may
+   be taken on now or no free sector is left to reserve for it. */
+bool
+pcache_write (block_sector_t inumber, off_t ofs, const void *buffer,
+              size_t size, block_sector_t sector,
+              pcache_map_func *map, void *aux)
+{
+  struct pcache_entry *e;
+  size_t idx = ofs % PGSIZE / BLOCK_SECTOR_SIZE;
+  unsigned bit = 1u << idx;
+
+  ASSERT (ofs >= 0 && ofs % BLOCK_SECTOR_SIZE + size <= BLOCK_SECTOR_SIZE);
+
+  e = get_page (inumber, ofs / PGSIZE, map, aux);
+  if (sector != 0)
+    {
+      /* Another writer may have delayed the sector meanwhile. */
+      if (e->delayed & bit)
+        clear_delayed (e, bit);
+      e->sectors[idx] = sector;
+    }
+  else if (e->sectors[idx] == 0 && !(e->delayed & bit))
+    {
+      bool ok;
+
+      lock_acquire (&pcache_lock);
+      ok = ((e->delayed != 0 || delayed_cnt < PCACHE_DELAYED_PAGES)
+            && free_map_reserve (1));
+      if (ok && e->delayed == 0)
+        delayed_cnt++;
+      lock_release (&pcache_lock);
+      if (!ok)
+        {
+          lock_release (&e->lock);
+          return false;
+        }
+      e->delayed |= bit;
+    }
+  memcpy (e->data + ofs % PGSIZE, buffer, size);
+  e->dirty |= bit;
+  lock_release (&e->lock);
+  return true;
+}
+
+/* Returns true if the file with inode number INUMBER has delayed
+   sectors in the cache. */
+bool
+pcache_has_delayed (block_sector_t inumber)
+{
+  bool found = false;
+  size_t i;
+
+  lock_acquire (&pcache_lock);
+  for (i = 0; i < PCACHE_PAGES && !found; i++)
+    found = (pcache[i].valid && pcache[i].inumber == inumber
+             && pcache[i].delayed != 0);
+  lock_release (&pcache_lock);
+  return found;
+}
+
+/* Iterates over the files with delayed sectors in the cache.
+   *POS must be 0 on the first call.  Stores the inode number of
+   the next file into *INUMBER and returns true, or returns false
+   when there are no more.  A file may be returned more than once. */
+bool
+pcache_next_delayed (size_t *pos, block_sector_t *inumber)
+{
+  bool found = false;
+
+  lock_acquire (&pcache_lock);
+  for (; *pos < PCACHE_PAGES && !found; ++*pos)
+    if (pcache[*pos].valid && pcache[*pos].delayed != 0)
+      {
+        *inumber = pcache[*pos].inumber;
+        found = true;
+      }
+  lock_release (&pcache_lock);
+  return found;
+}
+
+/* Gives data sectors, as chosen by ASSIGN with AUX, to the delayed
+   sectors of the file with inode number INUMBER, in file order, and
+   writes them back.  Callers for a single file must be serialized,
+   and must not hold any entry lock. */
+void
+pcache_assign (block_sector_t inumber, pcache_assign_func *assign,
+               void *aux)
+{
+  struct pcache_entry *entries[PCACHE_PAGES];
+  size_t entry_cnt = 0;
+  size_t left = 0;
+  size_t i, j;
+
+  /* Find the file's pages with delayed sectors, in page order.
+     They cannot be evicted, so they stay put once found. */
+  lock_acquire (&pcache_lock);
+  for (i = 0; i < PCACHE_PAGES; i++)
+    {
+      struct pcache_entry *e = &pcache[i];
+      if (e->valid && e->inumber == inumber && e->delayed != 0)
+        {
+          for (j = entry_cnt++; j > 0 && entries[j - 1]->page > e->page; j--)
+            entries[j] = entries[j - 1];
+          entries[j] = e;
+        }
+    }
+  lock_release (&pcache_lock);
+
+  /* Hold all of them, so that the count passed to ASSIGN is
+     exact.  Nobody else holds more than one entry lock. */
+  for (i = 0; i < entry_cnt; i++)
+    {
+      lock_acquire (&entries[i]->lock);
+      left += count_bits (entries[i]->delayed);
+    }
+
+  for (i = 0; i < entry_cnt; i++)
+    {
+      struct pcache_entry *e = entries[i];
+      unsigned done = 0;
+
+      for (j = 0; j < PCACHE_PAGE_SECTORS && left > 0; j++)
+        if (e->delayed & (1u << j))
+          {
+            block_sector_t sector
+              = assign (aux, e->page * PCACHE_PAGE_SECTORS + j, left);
+            if (sector == 0)
+              {
+                left = 0;
+                break;
+              }
+            e->sectors[j] = sector;
+            done |= 1u << j;
+            left--;
+          }
+
+      /* The sectors are already reserved, so clear_delayed() must
+         not give the reservation back: ASSIGN used it. */
+      e->delayed &= ~done;
+      if (done != 0 && e->delayed == 0)
+        {
+          lock_acquire (&pcache_lock);
+          delayed_cnt--;
+          lock_release (&pcache_lock);
+        }
+
+      /* Write the data before the new sectors can be committed as
+         part of the file. */
+      write_back (e);
+      lock_release (&e->lock);
+    }
+}
+
+/* Returns a pointer to the cached byte at offset OFS of the file
+   with inode number INUMBER, reading in its page first if
+   necessary.  The rest of the page may be read through the
+   pointer, and stays in the cache, unmodified, until the pointer
+   is passed to pcache_unpin().  Hold a pin only briefly: other
+   threads that touch the page wait for it, and the caller must not
+   touch the page itself in any other way while it is pinned. */
+const void *
+pcache_pin (block_sector_t inumber, off_t ofs, pcache_map_func *map,
+            void *aux)
+{
+  ASSERT (ofs >= 0);
+  return get_page (inumber, ofs / PGSIZE, map, aux)->data + ofs % PGSIZE;
+}
+
+/* Releases the pin on the page that P, a pointer returned by
+   pcache_pin(), refers to. */
+void
+pcache_unpin (const void *p)
+{
+  size_t i;
+
+  for (i = 0; i < PCACHE_PAGES; i++)
+    if (pcache[i].data == pg_round_down (p))
+      {
+        ASSERT (lock_held_by_current_thread (&pcache[i].lock));
+        lock_release (&pcache[i].lock);
+        return;
+      }
+  NOT_REACHED ();
+}
+
+/* Asks the read-ahead thread to bring the page containing byte
+   offset OFS of the file with inode number INUMBER into the cache
+   in the background.  Looks up its sectors with MAP and AUX before
+   returning, without waiting for the read. */
+void
+pcache_read_ahead (block_sector_t inumber, off_t ofs, pcache_map_func *map,
+                   void *aux)
+{
+  struct ra_request r;
+  bool cached;
+  size_t i;
+
+  r.inumber = inumber;
+  r.page = ofs / PGSIZE;
+  r.cancelled = false;
+  lock_acquire (&pcache_lock);
+  cached = lookup (r.inumber, r.page) != NULL;
+  lock_release (&pcache_lock);
+  if (cached)
+    return;
+  for (i = 0; i < PCACHE_PAGE_SECTORS; i++)
+    r.sectors[i] = map (aux, r.page * PCACHE_PAGE_SECTORS + i);
+
+  lock_acquire (&ra_lock);
+  if (ra_cnt < READ_AHEAD_QUEUE)
+    {
+      ra_queue[(ra_head + ra_cnt++) % READ_AHEAD_QUEUE] = r;
+      cond_signal (&ra_nonempty, &ra_lock);
+    }
+  lock_release (&ra_lock);
+}
+
+/* Read-ahead thread.  Loads queued pages into the cache, so that
+   a sequential reader finds them there instead of waiting for the
+   disk. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct ra_request r;
+      struct pcache_entry *e = NULL;
+
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_nonempty, &ra_lock);
+      r = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % READ_AHEAD_QUEUE;
+      ra_cnt--;
+
+      /* Claim an entry, unless the page got cached meanwhile.  Its
+         lock stays held until its data arrives. */
+      lock_acquire (&pcache_lock);
+      if (!r.cancelled && lookup (r.inumber, r.page) == NULL
+          && (e = evict ()) != NULL)
+        {
+          e->inumber = r.inumber;
+          e->page = r.page;
+          e->valid = true;
+          e->accessed = true;
+          memcpy (e->sectors, r.sectors, sizeof e->sectors);
+        }
+      lock_release (&pcache_lock);
+      lock_release (&ra_lock);
+
+      if (e != NULL)
+        {
+          fill (e);
+          lock_release (&e->lock);
+        }
+    }
+}
+
+/* Drops every cached page of the file with inode number INUMBER,
+   without writing it back, because the file has been deleted and
+   its sectors are about to be freed. */
+void
+pcache_discard (block_sector_t inumber)
+{
+  size_t i;
+
+  lock_acquire (&ra_lock);
+  for (i = 0; i < ra_cnt; i++)
+    {
+      struct ra_request *r = &ra_queue[(ra_head + i) % READ_AHEAD_QUEUE];
+      if (r->inumber == inumber)
+        r->cancelled = true;
+    }
+  lock_release (&ra_lock);
+
+  for (i = 0; i < PCACHE_PAGES; i++)
+    {
+      struct pcache_entry *e = &pcache[i];
+      bool match;
+
+      lock_acquire (&pcache_lock);
+      match = e->valid && e->inumber == inumber;
+      lock_release (&pcache_lock);
+      if (!match)
+        continue;
+
+      lock_acquire (&e->lock);
+      if (e->valid && e->inumber == inumber && e->delayed != 0)
+        clear_delayed (e, e->delayed);
+      lock_acquire (&pcache_lock);
+      if (e->valid && e->inumber == inumber)
+        {
+          e->valid = false;
+          e->dirty = 0;
+        }
+      lock_release (&pcache_lock);
+      lock_release (&e->lock);
+    }
+}
+
+/* Writes every dirty cached page back to disk. */
+void
+pcache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < PCACHE_PAGES; i++)
+    {
+      struct pcache_entry *e = &pcache[i];
+
+      /* Don't wait on the lock of an entry that is clean.  A
+         racing writer will be picked up next time. */
+      if (!e->dirty)
+        continue;
+
+      lock_acquire (&e->lock);
+      if (e->valid)
+        write_back (e);
+      lock_release (&e->lock);
+    }
+}
+
+/* Stores into INUMBERS and PAGES the keys of up to MAX of the
+   pages now cached, and returns how many it stored. */
+size_t
+pcache_hot_pages (block_sector_t *inumbers, size_t *pages, size_t max)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire (&pcache_lock);
+  for (i = 0; i < PCACHE_PAGES && cnt < max; i++)
+    if (pcache[i].valid)
+      {
+        inumbers[cnt] = pcache[i].inumber;
+        pages[cnt] = pcache[i].page;
+        cnt++;
+      }
+  lock_release (&pcache_lock);
+  return cnt;
+}
+
+/* Returns the entry that holds page PAGE of the file with inode
+   number INUMBER, or a null pointer if it is not cached.  Must be
+   called with pcache_lock held. */
+static struct pcache_entry *
+lookup (block_sector_t inumber, size_t page)
+{
+  size_t i;
+
+  for (i = 0; i < PCACHE_PAGES; i++)
+    if (pcache[i].valid && pcache[i].inumber == inumber
+        && pcache[i].page == page)
+      return &pcache[i];
+  return NULL;
+}
+
+/* Chooses an entry to hold a new page using the clock algorithm,
+   acquires its lock, and writes it back if it is dirty.  Entries
+   whose locks are busy are skipped.  Returns a null pointer if
+   every entry is busy.  Must be called with pcache_lock held. */
+static struct pcache_entry *
+evict (void)
+{
+  size_t i;
+
+  /* Two sweeps: the first may only clear accessed bits. */
+  for (i = 0; i < 2 * PCACHE_PAGES; i++)
+    {
+      struct pcache_entry *e = &pcache[clock_hand];
+      clock_hand = (clock_hand + 1) % PCACHE_PAGES;
+
+      if (e->valid && e->accessed)
+        e->accessed = false;
+      else if (e->delayed == 0 && lock_try_acquire (&e->lock))
+        {
+          /* A writer may have delayed a sector before we got the
+             lock. */
+          if (e->delayed != 0)
+            {
+              lock_release (&e->lock);
+              continue;
+            }
+
+          /* Write back under pcache_lock, so that nobody can read
+             the old page from disk before it is up to date. */
+          if (e->valid)
+            write_back (e);
+          e->dirty = 0;
+          return e;
+        }
+    }
+  return NULL;
+}
+
+/* Returns the entry for page PAGE of the file with inode number
+   INUMBER with its lock held, reading the page in first, from the
+   sectors that MAP and AUX give, if it is not cached. */
+static struct pcache_entry *
+get_page (block_sector_t inumber, size_t page, pcache_map_func *map,
+          void *aux)
+{
+  struct pcache_entry *e;
+  size_t i;
+
+  for (;;)
+    {
+      lock_acquire (&pcache_lock);
+      e = lookup (inumber, page);
+      if (e != NULL)
+        {
+          /* Hit.  Another thread may evict the entry between
+             releasing pcache_lock and acquiring its lock, so check
+             again once we hold it. */
+          e->accessed = true;
+          lock_release (&pcache_lock);
+          lock_acquire (&e->lock);
+          if (e->valid && e->inumber == inumber && e->page == page)
+            return e;
+          lock_release (&e->lock);
+          continue;
+        }
+
+      e = evict ();
+      if (e != NULL)
+        {
+          e->inumber = inumber;
+          e->page = page;
+          e->valid = true;
+          e->accessed = true;
+          lock_release (&pcache_lock);
+          for (i = 0; i < PCACHE_PAGE_SECTORS; i++)
+            e->sectors[i] = map (aux, page * PCACHE_PAGE_SECTORS + i);
+          fill (e);
+          return e;
+        }
+
+      /* Every entry is in use.  Let their users finish. */
+      lock_release (&pcache_lock);
+      thread_yield ();
+    }
+}
+
+/* Returns the number of sectors of E, starting at index I, that
+   are in MASK and lie in consecutive data sectors. */
+static size_t
+run_length (const struct pcache_entry *e, size_t i, unsigned mask)
+{
+  size_t n = 1;
+
+  while (i + n < PCACHE_PAGE_SECTORS && (mask & (1u << (i + n)))
+         && e->sectors[i + n] == e->sectors[i] + n)
+    n++;
+  return n;
+}
+
+/* Reads E's page from its sectors, zeroing the holes, with one
+   multi-sector transfer per run of consecutive sectors.  E's lock
+   must be held. */
+static void
+fill (struct pcache_entry *e)
+{
+  unsigned mask = 0;
+  size_t i, n;
+
+  for (i = 0; i < PCACHE_PAGE_SECTORS; i++)
+    if (e->sectors[i] != 0)
+      mask |= 1u << i;
+
+  for (i = 0; i < PCACHE_PAGE_SECTORS; i += n)
+    {
+      uint8_t *p = e->data + i * BLOCK_SECTOR_SIZE;
+
+      if (mask & (1u << i))
+        {
+          n = run_length (e, i, mask);
+          block_read_multiple (fs_device, e->sectors[i], n, p);
+        }
+      else
+        {
+          n = 1;
+          memset (p, 0, BLOCK_SECTOR_SIZE);
+        }
+    }
+}
+
+/* Writes E's dirty sectors back to disk, with one multi-sector
+   transfer per run of consecutive sectors.  Delayed sectors have
+   nowhere to go yet and stay dirty.  E's lock must be held. */
+static void
+write_back (struct pcache_entry *e)
+{
+  unsigned mask = e->dirty & ~e->delayed;
+  size_t i, n;
+
+  for (i = 0; i < PCACHE_PAGE_SECTORS; i += n)
+    {
+      n = 1;
+      if (mask & (1u << i))
+        {
+          ASSERT (e->sectors[i] != 0);
+          n = run_length (e, i, mask);
+          block_write_multiple (fs_device, e->sectors[i], n,
+                                e->data + i * BLOCK_SECTOR_SIZE);
+        }
+    }
+  e->dirty &= e->delayed;
+}
+
+/* Makes the delayed sectors of E in MASK no longer delayed, giving
+   back their reservations.  E's lock must be held. */
+static void
+clear_delayed (struct pcache_entry *e, unsigned mask)
+{
+  ASSERT ((e->delayed & mask) == mask);
+
+  free_map_unreserve (count_bits (mask));
+  e->delayed &= ~mask;
+  if (e->delayed == 0)
+    {
+      lock_acquire (&pcache_lock);
+      delayed_cnt--;
+      lock_release (&pcache_lock);
+    }
+}
+
+/* Returns the number of 1-bits in X. */
+static size_t
+count_bits (unsigned x)
+{
+  size_t n = 0;
+
+  for (; x != 0; x &= x - 1)
+    n++;
+  return n;
+}
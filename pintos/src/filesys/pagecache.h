@@ -0,0 +1,49 @@
+#ifndef FILESYS_PAGECACHE_H
+#define FILESYS_PAGECACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Number of file pages held in the page cache. */
+#define PCACHE_PAGES 32
+
+/* Sectors per cached page. */
+#define PCACHE_PAGE_SECTORS 8
+
+/* Most pages that may hold data whose sectors have not been chosen
+   yet.  Such pages cannot be evicted. */
+#define PCACHE_DELAYED_PAGES (PCACHE_PAGES / 2)
+
+/* Returns the data sector that holds sector IDX of the file that
+   AUX describes, or 0 if that sector has not been allocated. */
+typedef block_sector_t pcache_map_func (void *aux, size_t idx);
+
+/* Chooses and returns the data sector for sector IDX of the file
+   that AUX describes, which has data in the page cache but no
+   sector yet, or returns 0 to leave it for later.  LEFT is the
+   number of such sectors still to be given one, including IDX,
+   which come in increasing order. */
+typedef block_sector_t pcache_assign_func (void *aux, size_t idx,
+                                           size_t left);
+
+void pcache_init (void);
+void pcache_flush (void);
+void pcache_read (block_sector_t inumber, off_t ofs, void *, size_t size,
+                  pcache_map_func *, void *aux);
+bool pcache_write (block_sector_t inumber, off_t ofs, const void *,
+                   size_t size, block_sector_t sector,
+                   pcache_map_func *, void *aux);
+bool pcache_has_delayed (block_sector_t inumber);
+bool pcache_next_delayed (size_t *pos, block_sector_t *inumber);
+void pcache_assign (block_sector_t inumber, pcache_assign_func *, void *aux);
+const void *pcache_pin (block_sector_t inumber, off_t ofs,
+                        pcache_map_func *, void *aux);
+void pcache_unpin (const void *);
+void pcache_read_ahead (block_sector_t inumber, off_t ofs,
+                        pcache_map_func *, void *aux);
+void pcache_discard (block_sector_t inumber);
+size_t pcache_hot_pages (block_sector_t *inumbers, size_t *pages, size_t max);
+
+#endif /* filesys/pagecache.h */
@@ -0,0 +1,17 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <stdint.h>
+
+/* Longest file name in a directory entry. */
+#define DIRENT_NAME_MAX 14
+
+/* A directory entry, as returned by the readdir_batch() system
+   call. */
+struct dirent
+  {
+    uint32_t d_ino;                     /* Inode number. */
+    char d_name[DIRENT_NAME_MAX + 1];   /* Null-terminated file name. */
+  };
+
+#endif /* lib/dirent.h */
@@ -0,0 +1,37 @@
+#ifndef __LIB_FAULTSTAT_H
+#define __LIB_FAULTSTAT_H
+
+#include <stdint.h>
+
+/* Kinds of page fault, by what it took to service. */
+enum fault_type
+  {
+    FAULT_ZERO,                 /* New all-zero page. */
+    FAULT_FILE,                 /* Page read from a file, or shared
+                                   with a process that had. */
+    FAULT_SWAP,                 /* Page read back from swap. */
+    FAULT_COW,                  /* Write to a copy-on-write page. */
+    FAULT_STACK,                /* New page growing the stack. */
+    FAULT_MINOR,                /* Page already in memory. */
+    FAULT_INVALID,              /* Bad access, not serviced. */
+    FAULT_TYPE_CNT
+  };
+
+/* Number of histogram buckets per type. */
+#define FAULTSTAT_BUCKETS 32
+
+/* Page fault counts and service times, as returned by the
+   faultstat() system call.  count[T] counts the calling process's
+   faults of type T and total[T] those of every process.
+   latency[T][B] counts the faults of type T, in every process,
+   that took from 2**B up to 2**(B + 1) nanoseconds to service.
+   Bucket 0 also counts faults under a nanosecond and the last
+   bucket all longer ones. */
+struct faultstat
+  {
+    uint32_t count[FAULT_TYPE_CNT];
+    uint32_t total[FAULT_TYPE_CNT];
+    uint32_t latency[FAULT_TYPE_CNT][FAULTSTAT_BUCKETS];
+  };
+
+#endif /* lib/faultstat.h */
@@ -0,0 +1,56 @@
+#ifndef __LIB_IORING_H
+#define __LIB_IORING_H
+
+#include <stdint.h>
+
+/* Asynchronous I/O rings, as passed to the io_setup() and
+   io_enter() system calls.
+
+   A process fills in submission queue entries at SQ_TAIL and
+   advances it; io_enter() starts the entries between SQ_HEAD and
+   SQ_TAIL and advances SQ_HEAD past them.  As operations finish,
+   io_enter() stores completion queue entries at CQ_TAIL and
+   advances it; the process consumes them at CQ_HEAD and advances
+   that.  Indexes run freely and are reduced modulo ENTRIES, which
+   must be a power of 2, to index SQES and CQES. */
+
+/* Operations. */
+#define IO_OP_NOP 0             /* Do nothing. */
+#define IO_OP_READ 1            /* Like read(), at OFFSET. */
+#define IO_OP_WRITE 2           /* Like write(), at OFFSET. */
+
+/* A submission queue entry. */
+struct io_sqe
+  {
+    uint32_t opcode;            /* IO_OP_*. */
+    int fd;                     /* File descriptor. */
+    void *buf;                  /* Buffer to read into or write from. */
+    uint32_t len;               /* Bytes to transfer. */
+    uint32_t offset;            /* Offset in file. */
+    uint32_t user_data;         /* Copied to the completion. */
+  };
+
+/* A completion queue entry. */
+struct io_cqe
+  {
+    uint32_t user_data;         /* From the submission. */
+    int32_t res;                /* Bytes transferred, or -1. */
+  };
+
+/* A pair of rings. */
+struct io_ring
+  {
+    uint32_t sq_head;           /* Advanced by the kernel. */
+    uint32_t sq_tail;           /* Advanced by the process. */
+    uint32_t cq_head;           /* Advanced by the process. */
+    uint32_t cq_tail;           /* Advanced by the kernel. */
+    uint32_t entries;           /* Entries in each ring. */
+    struct io_sqe *sqes;        /* Submission ring. */
+    struct io_cqe *cqes;        /* Completion ring. */
+  };
+
+/* Most entries in a ring, and most bytes in one operation. */
+#define IO_RING_MAX 4096
+#define IO_LEN_MAX (64 * 1024)
+
+#endif /* lib/ioring.h */
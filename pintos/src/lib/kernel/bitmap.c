@@ -53,6 +53,14 @@ elem_cnt (size_t bit_cnt)
   return DIV_ROUND_UP (bit_cnt, ELEM_BITS);
 }
 
+/* Returns the index of the lowest set bit in the nonzero
+   element E.  Compiles to a single `bsf' instruction. */
+static inline size_t
+lowest_bit (elem_type e)
+{
+  return __builtin_ctzl (e);
+}
+
 /* Returns the number of bytes required for BIT_CNT bits. */
 static inline size_t
 byte_cnt (size_t bit_cnt)
@@ -246,21 +254,46 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
   return value_cnt;
 }
 
+/* Returns the index of the first bit in B between START and END,
+   exclusive, that is set to VALUE, or END if there is none.
+   Examines a whole element at a time, skipping elements with no
+   bit set to VALUE. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  size_t idx = elem_idx (start);
+  elem_type e;
+
+  if (start >= end)
+    return end;
+
+  /* Ignore the bits below START in the first element. */
+  e = value ? b->bits[idx] : ~b->bits[idx];
+  e &= ~(elem_type) 0 << (start % ELEM_BITS);
+
+  for (;;)
+    {
+      if (e != 0)
+        {
+          size_t bit_idx = idx * ELEM_BITS + lowest_bit (e);
+          return bit_idx < end ? bit_idx : end;
+        }
+      if (++idx * ELEM_BITS >= end)
+        return end;
+      e = value ? b->bits[idx] : ~b->bits[idx];
+    }
+}
+
 /* Returns true if any bits in B between START and START + CNT,
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_bit (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -299,13 +332,24 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      /* Jump to the next bit set to VALUE, then check whether the
+         run starting there is long enough.  If not, the run ends
+         at a bit set to !VALUE, which is where the next search
+         starts. */
+      while ((i = find_bit (b, i, last + 1, value)) <= last)
+        {
+          size_t end = find_bit (b, i, i + cnt, !value);
+          if (end == i + cnt)
+            return i;
+          i = end;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -359,6 +403,28 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B holding the CNT bits starting at START to
+   the same place in FILE that bitmap_write() would put it.  Whole
+   bytes are written, so a few bits to either side may be written
+   as well.  Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t first, last;
+
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (cnt <= b->bit_cnt - start);
+
+  if (cnt == 0)
+    return true;
+  first = start / CHAR_BIT;
+  last = DIV_ROUND_UP (start + cnt, CHAR_BIT);
+  return (file_write_at (file, (const uint8_t *) b->bits + first,
+                         last - first, first)
+          == last - first);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -1,14 +1,23 @@
 #include <console.h>
+#include <kstat.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/serial.h"
 #include "devices/vga.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
-static void vprintf_helper (char, void *);
+static void vprintf_helper (const char *, size_t, void *);
 static void putchar_have_lock (uint8_t c);
+static void putbuf_have_lock (const char *, size_t);
+static void write_devices (const char *, size_t);
+static bool klog_write (const char *, size_t);
+static bool klog_drain_chunk (void);
+static void klog_drain (void);
+static thread_func klog_thread;
 
 /* The console lock.
    Both the vga and serial layers do their own locking, so it's
@@ -59,6 +68,30 @@ static int console_lock_depth;
 /* Number of characters written to console. */
 static int64_t write_cnt;
 
+/* Kernel log.
+
+   When enabled, output is appended to klog_buf instead of being
+   written to the devices, and the low-priority "klog" thread
+   drains it to the vga display and serial port, so that threads
+   that print do not wait for device I/O.  Output that does not fit
+   makes its writer drain the log itself first, to keep the output
+   in order; it is written directly from interrupt context, where
+   that is not possible.  A kernel panic turns the log off and
+   drains it synchronously.
+
+   klog_head and klog_tail count bytes ever written and drained,
+   so klog_head - klog_tail bytes are pending.  They are updated
+   with interrupts off, since interrupt handlers print too.
+   klog_drain_lock serializes the drainers, so that pending output
+   is written in order. */
+bool console_klog;
+#define KLOG_SIZE 8192
+static char klog_buf[KLOG_SIZE];
+static size_t klog_head, klog_tail;
+static bool klog_running;                /* Log in use? */
+static struct semaphore klog_nonempty;   /* Upped when output arrives. */
+static struct lock klog_drain_lock;
+
 /* Enable console locking. */
 void
 console_init (void) 
@@ -67,13 +100,43 @@ console_init (void)
   use_console_lock = true;
 }
 
+/* Starts the kernel log, if "-klog" was given.  Must be called
+   after the thread system has started. */
+void
+console_start_klog (void) 
+{
+  if (!console_klog)
+    return;
+
+  sema_init (&klog_nonempty, 0);
+  lock_init (&klog_drain_lock);
+  if (thread_create ("klog", PRI_MIN, klog_thread, NULL) == TID_ERROR)
+    PANIC ("console_start_klog: cannot create klog thread");
+  klog_running = true;
+}
+
+/* Writes any output pending in the kernel log to the devices. */
+void
+console_flush (void) 
+{
+  if (klog_running && !intr_context ())
+    klog_drain ();
+}
+
 /* Notifies the console that a kernel panic is underway,
    which warns it to avoid trying to take the console lock from
-   now on. */
+   now on.  Output still in the kernel log is written out, and
+   later output goes straight to the devices. */
 void
 console_panic (void) 
 {
   use_console_lock = false;
+  if (klog_running)
+    {
+      klog_running = false;
+      while (klog_drain_chunk ())
+        continue;
+    }
 }
 
 /* Prints console statistics. */
@@ -83,6 +146,15 @@ console_print_stats (void)
   printf ("Console: %lld characters output\n", write_cnt);
 }
 
+/* Copies the console's output count into *K. */
+void
+console_get_kstat (struct kstat *k)
+{
+  enum intr_level old_level = intr_disable ();
+  k->console_chars = write_cnt;
+  intr_set_level (old_level);
+}
+
 /* Acquires the console lock. */
 static void
 acquire_console (void) 
@@ -109,6 +181,22 @@ release_console (void)
     }
 }
 
+/* Holds the console for the current thread until the matching
+   console_release(), so that a series of writes comes out without
+   other threads' output in between.  Calls may nest. */
+void
+console_acquire (void)
+{
+  acquire_console ();
+}
+
+/* Ends a console_acquire(). */
+void
+console_release (void)
+{
+  release_console ();
+}
+
 /* Returns true if the current thread has the console lock,
    false otherwise. */
 static bool
@@ -119,19 +207,44 @@ console_locked_by_current_thread (void)
           || lock_held_by_current_thread (&console_lock));
 }
 
+/* vprintf() formats into a buffer of this many bytes on the
+   stack before it takes the console lock. */
+#define VPRINTF_BUFSIZE 128
+
+/* Formatting state for vprintf(). */
+struct vprintf_state 
+  {
+    char buf[VPRINTF_BUFSIZE];  /* Output not yet written. */
+    size_t len;                 /* Number of bytes in `buf'. */
+    int char_cnt;               /* Total characters formatted. */
+    bool locked;                /* Holding the console? */
+  };
+
 /* The standard vprintf() function,
    which is like printf() but uses a va_list.
-   Writes its output to both vga display and serial port. */
+   Writes its output to both vga display and serial port.
+
+   Output is formatted into a buffer without holding the console
+   lock, so that threads printing at once contend only for the
+   time it takes to write it out.  Output that overflows the
+   buffer is written out under the lock, which is then held until
+   the end, so that it does not mix with other threads'. */
 int
 vprintf (const char *format, va_list args) 
 {
-  int char_cnt = 0;
+  struct vprintf_state s;
 
-  acquire_console ();
-  __vprintf (format, args, vprintf_helper, &char_cnt);
+  s.len = 0;
+  s.char_cnt = 0;
+  s.locked = false;
+  __vprintf_runs (format, args, vprintf_helper, &s);
+
+  if (!s.locked)
+    acquire_console ();
+  putbuf_have_lock (s.buf, s.len);
   release_console ();
 
-  return char_cnt;
+  return s.char_cnt;
 }
 
 /* Writes string S to the console, followed by a new-line
@@ -153,8 +266,7 @@ void
 putbuf (const char *buffer, size_t n) 
 {
   acquire_console ();
-  while (n-- > 0)
-    putchar_have_lock (*buffer++);
+  putbuf_have_lock (buffer, n);
   release_console ();
 }
 
@@ -171,11 +283,28 @@ putchar (int c)
 
 /* Helper function for vprintf(). */
 static void
-vprintf_helper (char c, void *char_cnt_) 
+vprintf_helper (const char *run, size_t n, void *s_) 
 {
-  int *char_cnt = char_cnt_;
-  (*char_cnt)++;
-  putchar_have_lock (c);
+  struct vprintf_state *s = s_;
+
+  s->char_cnt += n;
+  if (n > sizeof s->buf - s->len)
+    {
+      if (!s->locked)
+        {
+          acquire_console ();
+          s->locked = true;
+        }
+      putbuf_have_lock (s->buf, s->len);
+      s->len = 0;
+      if (n > sizeof s->buf)
+        {
+          putbuf_have_lock (run, n);
+          return;
+        }
+    }
+  memcpy (s->buf + s->len, run, n);
+  s->len += n;
 }
 
 /* Writes C to the vga display and serial port.
@@ -183,9 +312,110 @@ vprintf_helper (char c, void *char_cnt_)
    appropriate. */
 static void
 putchar_have_lock (uint8_t c) 
+{
+  char ch = c;
+  putbuf_have_lock (&ch, 1);
+}
+
+/* Writes the N characters in BUFFER to the vga display and
+   serial port, through the kernel log if it is running.  The
+   caller has already acquired the console lock if
+   appropriate. */
+static void
+putbuf_have_lock (const char *buffer, size_t n) 
 {
   ASSERT (console_locked_by_current_thread ());
-  write_cnt++;
-  serial_putc (c);
-  vga_putc (c);
+  if (klog_write (buffer, n))
+    return;
+  if (klog_running && !intr_context ())
+    klog_drain ();
+  write_devices (buffer, n);
+}
+
+/* Writes the N characters in BUFFER to the vga display and
+   serial port, each in one bulk write. */
+static void
+write_devices (const char *buffer, size_t n) 
+{
+  write_cnt += n;
+  serial_putbuf ((const uint8_t *) buffer, n);
+  vga_putbuf (buffer, n);
+}
+
+/* Appends the N characters in BUFFER to the kernel log and
+   returns true, if the log is running and has room for them.
+   Otherwise, returns false. */
+static bool
+klog_write (const char *buffer, size_t n) 
+{
+  enum intr_level old_level;
+  bool success = false;
+
+  if (!klog_running)
+    return false;
+
+  old_level = intr_disable ();
+  if (klog_running && KLOG_SIZE - (klog_head - klog_tail) >= n)
+    {
+      bool was_empty = klog_head == klog_tail;
+      size_t i;
+
+      for (i = 0; i < n; i++)
+        klog_buf[(klog_head + i) % KLOG_SIZE] = buffer[i];
+      klog_head += n;
+      if (was_empty)
+        sema_up (&klog_nonempty);
+      success = true;
+    }
+  intr_set_level (old_level);
+  return success;
+}
+
+/* Removes up to a chunk of output from the kernel log and writes
+   it to the devices.  Returns false if the log was empty. */
+static bool
+klog_drain_chunk (void) 
+{
+  char chunk[128];
+  enum intr_level old_level;
+  size_t n, i;
+
+  old_level = intr_disable ();
+  n = klog_head - klog_tail;
+  if (n > sizeof chunk)
+    n = sizeof chunk;
+  for (i = 0; i < n; i++)
+    chunk[i] = klog_buf[(klog_tail + i) % KLOG_SIZE];
+  klog_tail += n;
+  intr_set_level (old_level);
+
+  if (n > 0)
+    write_devices (chunk, n);
+  return n > 0;
+}
+
+/* Writes all output pending in the kernel log to the devices.
+   Does nothing if called while draining, as by a printf() from
+   within the device drivers. */
+static void
+klog_drain (void) 
+{
+  if (lock_held_by_current_thread (&klog_drain_lock))
+    return;
+  lock_acquire (&klog_drain_lock);
+  while (klog_drain_chunk ())
+    continue;
+  lock_release (&klog_drain_lock);
+}
+
+/* The "klog" thread, which drains the kernel log whenever output
+   arrives. */
+static void
+klog_thread (void *aux UNUSED) 
+{
+  for (;;)
+    {
+      sema_down (&klog_nonempty);
+      klog_drain ();
+    }
 }
@@ -1,8 +1,21 @@
 #ifndef __LIB_KERNEL_CONSOLE_H
 #define __LIB_KERNEL_CONSOLE_H
 
+#include <stdbool.h>
+
+struct kstat;
+
+/* If true, console output goes through the kernel log.
+   Controlled by kernel command-line option "-klog". */
+extern bool console_klog;
+
 void console_init (void);
+void console_start_klog (void);
+void console_flush (void);
 void console_panic (void);
 void console_print_stats (void);
+void console_get_kstat (struct kstat *);
+void console_acquire (void);
+void console_release (void);
 
 #endif /* lib/kernel/console.h */
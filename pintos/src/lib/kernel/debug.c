@@ -9,6 +9,7 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/switch.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
 #include "devices/serial.h"
 #include "devices/shutdown.h"
@@ -36,6 +37,7 @@ debug_panic (const char *file, int line, const char *function,
       va_end (args);
 
       debug_backtrace ();
+      trace_dump ();
     }
   else if (level == 2)
     printf ("Kernel PANIC recursion at %s:%d in %s().\n",
@@ -96,7 +98,8 @@ print_stacktrace(struct thread *t, void *aux UNUSED)
          at the top of their kernel stack page, or the 
          switch_threads_frame's 'eip' member points at switch_entry.
          See also threads.c. */
-      if (t->stack == (uint8_t *)t + PGSIZE || saved_frame->eip == switch_entry)
+      if (t->stack == (uint8_t *)t + THREAD_SIZE
+          || saved_frame->eip == switch_entry)
         {
           printf (" thread was never scheduled.\n");
           return;
@@ -6,6 +6,8 @@
    See hash.h for basic information. */
 
 #include "hash.h"
+#include <stdint.h>
+#include <string.h>
 #include "../debug.h"
 #include "threads/malloc.h"
 
@@ -257,48 +259,97 @@ hash_empty (struct hash *h)
   return h->elem_cnt == 0;
 }
 
-/* Fowler-Noll-Vo hash constants, for 32-bit word sizes. */
-#define FNV_32_PRIME 16777619u
-#define FNV_32_BASIS 2166136261u
+/* MurmurHash3 (x86_32) constants and seed. */
+#define MURMUR_C1 0xcc9e2d51u
+#define MURMUR_C2 0x1b873593u
+#define MURMUR_SEED 0x9747b28cu
+
+/* A 32-bit word that may be unaligned and may alias anything. */
+typedef uint32_t __attribute__ ((may_alias, aligned (1))) hash_word_t;
+
+/* Returns X rotated left by R bits. */
+static inline uint32_t
+rotl32 (uint32_t x, int r) 
+{
+  return (x << r) | (x >> (32 - r));
+}
+
+/* Mixes block K into HASH. */
+static inline uint32_t
+murmur_mix (uint32_t hash, uint32_t k) 
+{
+  k *= MURMUR_C1;
+  k = rotl32 (k, 15);
+  k *= MURMUR_C2;
+  hash ^= k;
+  hash = rotl32 (hash, 13);
+  return hash * 5 + 0xe6546b64;
+}
+
+/* Makes every bit of HASH depend on every other. */
+static inline uint32_t
+murmur_finish (uint32_t hash) 
+{
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6b;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35;
+  hash ^= hash >> 16;
+  return hash;
+}
 
 /* Returns a hash of the SIZE bytes in BUF. */
 unsigned
 hash_bytes (const void *buf_, size_t size)
 {
-  /* Fowler-Noll-Vo 32-bit hash, for bytes. */
+  /* MurmurHash3, four bytes per step.  x86 allows unaligned
+     loads, so BUF need not be aligned. */
   const unsigned char *buf = buf_;
-  unsigned hash;
+  uint32_t hash = MURMUR_SEED;
+  uint32_t tail = 0;
+  size_t len = size;
 
   ASSERT (buf != NULL);
 
-  hash = FNV_32_BASIS;
-  while (size-- > 0)
-    hash = (hash * FNV_32_PRIME) ^ *buf++;
+  for (; size >= 4; size -= 4, buf += 4)
+    hash = murmur_mix (hash, *(const hash_word_t *) buf);
 
-  return hash;
+  switch (size)
+    {
+    case 3:
+      tail ^= buf[2] << 16;
+      /* Fall through. */
+    case 2:
+      tail ^= buf[1] << 8;
+      /* Fall through. */
+    case 1:
+      tail ^= buf[0];
+      tail *= MURMUR_C1;
+      tail = rotl32 (tail, 15);
+      tail *= MURMUR_C2;
+      hash ^= tail;
+    }
+
+  return murmur_finish (hash ^ len);
 } 
 
 /* Returns a hash of string S. */
 unsigned
-hash_string (const char *s_) 
+hash_string (const char *s) 
 {
-  const unsigned char *s = (const unsigned char *) s_;
-  unsigned hash;
-
   ASSERT (s != NULL);
 
-  hash = FNV_32_BASIS;
-  while (*s != '\0')
-    hash = (hash * FNV_32_PRIME) ^ *s++;
-
-  return hash;
+  /* strlen() scans a word at a time, so two passes beat one that
+     stops at every byte to look for the terminator. */
+  return hash_bytes (s, strlen (s));
 }
 
 /* Returns a hash of integer I. */
 unsigned
 hash_int (int i) 
 {
-  return hash_bytes (&i, sizeof i);
+  /* The MurmurHash3 finalizer alone mixes a single word well. */
+  return murmur_finish ((uint32_t) i ^ MURMUR_SEED);
 }
 
 /* Returns the bucket in H that E belongs in. */
@@ -0,0 +1,197 @@
+/* Pairing heap.
+
+   See heap.h for basic information.  The heap is a tree in which
+   every element is no greater than its children, stored as a
+   list of children per element.  Two trees are melded by making
+   the root with the greater value the first child of the other.
+   Removing the root melds its children in pairs from left to
+   right, then melds the results from right to left, which gives
+   the amortized bounds described by Fredman, Sedgewick, Sleator,
+   and Tarjan, "The pairing heap: A new form of self-adjusting
+   heap", Algorithmica 1 (1986). */
+
+#include "heap.h"
+#include "../debug.h"
+
+static struct heap_elem *meld (struct heap *,
+                               struct heap_elem *, struct heap_elem *);
+static struct heap_elem *merge_pairs (struct heap *, struct heap_elem *);
+static void cut (struct heap_elem *);
+
+/* Initializes heap H to be empty, comparing elements using LESS
+   given auxiliary data AUX. */
+void
+heap_init (struct heap *h, heap_less_func *less, void *aux) 
+{
+  ASSERT (h != NULL);
+  ASSERT (less != NULL);
+
+  h->root = NULL;
+  h->size = 0;
+  h->less = less;
+  h->aux = aux;
+}
+
+/* Inserts E into H. */
+void
+heap_insert (struct heap *h, struct heap_elem *e) 
+{
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+
+  e->child = e->next = e->prev = NULL;
+  h->root = meld (h, h->root, e);
+  h->size++;
+}
+
+/* Returns the least element of H, or a null pointer if H is
+   empty. */
+struct heap_elem *
+heap_min (const struct heap *h) 
+{
+  return h->root;
+}
+
+/* Removes the least element of H and returns it.
+   H must not be empty. */
+struct heap_elem *
+heap_pop_min (struct heap *h) 
+{
+  struct heap_elem *min = h->root;
+
+  ASSERT (min != NULL);
+
+  h->root = merge_pairs (h, min->child);
+  h->size--;
+  return min;
+}
+
+/* Removes E, which must be in H, from H. */
+void
+heap_remove (struct heap *h, struct heap_elem *e) 
+{
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+
+  if (e == h->root)
+    heap_pop_min (h);
+  else
+    {
+      cut (e);
+      h->root = meld (h, h->root, merge_pairs (h, e->child));
+      h->size--;
+    }
+}
+
+/* Restores the heap order of H after the value of E, which must
+   be in H, has become less than it was. */
+void
+heap_decrease (struct heap *h, struct heap_elem *e) 
+{
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+
+  if (e != h->root)
+    {
+      cut (e);
+      h->root = meld (h, h->root, e);
+    }
+}
+
+/* Restores the heap order of H after the value of E, which must
+   be in H, has changed in either direction. */
+void
+heap_update (struct heap *h, struct heap_elem *e) 
+{
+  heap_remove (h, e);
+  heap_insert (h, e);
+}
+
+/* Returns the number of elements in H. */
+size_t
+heap_size (const struct heap *h) 
+{
+  return h->size;
+}
+
+/* Returns true if H contains no elements, false otherwise. */
+bool
+heap_empty (const struct heap *h) 
+{
+  return h->size == 0;
+}
+
+/* Melds the trees rooted at A and B, either of which may be
+   null, and returns the root of the result.  A and B must not
+   have siblings or parents. */
+static struct heap_elem *
+meld (struct heap *h, struct heap_elem *a, struct heap_elem *b) 
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (h->less (b, a, h->aux))
+    {
+      struct heap_elem *t = a;
+      a = b;
+      b = t;
+    }
+
+  /* Make B the first child of A. */
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  a->child = b;
+  return a;
+}
+
+/* Melds the list of sibling trees that starts at FIRST, which
+   may be null, into one tree, and returns its root. */
+static struct heap_elem *
+merge_pairs (struct heap *h, struct heap_elem *first) 
+{
+  struct heap_elem *pairs = NULL;
+  struct heap_elem *root = NULL;
+
+  /* Meld pairs from left to right, stacking up the results. */
+  while (first != NULL)
+    {
+      struct heap_elem *a = first;
+      struct heap_elem *b = a->next;
+      struct heap_elem *m;
+
+      first = b != NULL ? b->next : NULL;
+      a->next = a->prev = NULL;
+      if (b != NULL)
+        b->next = b->prev = NULL;
+      m = meld (h, a, b);
+      m->next = pairs;
+      pairs = m;
+    }
+
+  /* Meld the results from right to left. */
+  while (pairs != NULL)
+    {
+      struct heap_elem *next = pairs->next;
+      pairs->next = NULL;
+      root = meld (h, root, pairs);
+      pairs = next;
+    }
+  return root;
+}
+
+/* Detaches E, which must not be a root, and its subtree from its
+   parent and siblings. */
+static void
+cut (struct heap_elem *e) 
+{
+  if (e->prev->child == e)
+    e->prev->child = e->next;
+  else
+    e->prev->next = e->next;
+  if (e->next != NULL)
+    e->next->prev = e->prev;
+  e->next = e->prev = NULL;
+}
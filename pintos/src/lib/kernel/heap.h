@@ -0,0 +1,71 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+/* Pairing heap.
+
+   A priority queue that returns its least element first.
+   Insertion, finding the least element, and decreasing an
+   element's key take O(1) time; removing the least element or
+   any other element takes O(log n) amortized time.  Elements
+   that compare equal come out in no particular order.
+
+   Like the list and hash table implementations, the heap does
+   not allocate memory.  Each structure that can be in a heap
+   embeds a struct heap_elem member, and heap_entry() converts a
+   pointer to that member back into a pointer to the structure.
+   See lib/kernel/list.h for a detailed explanation.
+
+   An element's key may change while it is in a heap, as long as
+   the heap is told right away: heap_decrease() after the element
+   has become less, heap_update() after any other change.  A heap
+   ordered by descending priority, for instance, calls
+   heap_decrease() when a thread receives a priority donation. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct heap_elem 
+  {
+    struct heap_elem *child;    /* First child, or null. */
+    struct heap_elem *next;     /* Next sibling, or null. */
+    struct heap_elem *prev;     /* Previous sibling, or the parent if
+                                   this is the first child. */
+  };
+
+/* Converts pointer to heap element HEAP_ELEM into a pointer to
+   the structure that HEAP_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the heap element. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)           \
+        ((STRUCT *) ((uint8_t *) (HEAP_ELEM)           \
+                     - offsetof (STRUCT, MEMBER)))
+
+/* Compares the value of two heap elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool heap_less_func (const struct heap_elem *a,
+                             const struct heap_elem *b,
+                             void *aux);
+
+/* Pairing heap. */
+struct heap 
+  {
+    struct heap_elem *root;     /* Least element, or null if empty. */
+    size_t size;                /* Number of elements. */
+    heap_less_func *less;       /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void heap_init (struct heap *, heap_less_func *, void *aux);
+void heap_insert (struct heap *, struct heap_elem *);
+struct heap_elem *heap_min (const struct heap *);
+struct heap_elem *heap_pop_min (struct heap *);
+void heap_remove (struct heap *, struct heap_elem *);
+void heap_decrease (struct heap *, struct heap_elem *);
+void heap_update (struct heap *, struct heap_elem *);
+size_t heap_size (const struct heap *);
+bool heap_empty (const struct heap *);
+
+#endif /* lib/kernel/heap.h */
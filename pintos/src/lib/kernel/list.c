@@ -522,3 +522,83 @@ list_min (struct list *list, list_less_func *less, void *aux)
     }
   return min;
 }
+
+/* Initializes counted list CL as an empty list. */
+void
+clist_init (struct clist *cl) 
+{
+  ASSERT (cl != NULL);
+  list_init (&cl->list);
+  cl->size = 0;
+}
+
+/* Inserts ELEM at the beginning of CL. */
+void
+clist_push_front (struct clist *cl, struct list_elem *elem) 
+{
+  list_push_front (&cl->list, elem);
+  cl->size++;
+}
+
+/* Inserts ELEM at the end of CL. */
+void
+clist_push_back (struct clist *cl, struct list_elem *elem) 
+{
+  list_push_back (&cl->list, elem);
+  cl->size++;
+}
+
+/* Inserts ELEM in the proper position in CL, which must be sorted
+   according to LESS given auxiliary data AUX, as
+   list_insert_ordered() does. */
+void
+clist_insert_ordered (struct clist *cl, struct list_elem *elem,
+                      list_less_func *less, void *aux) 
+{
+  list_insert_ordered (&cl->list, elem, less, aux);
+  cl->size++;
+}
+
+/* Removes ELEM, which must be in CL, from CL and returns the
+   element that followed it, as list_remove() does. */
+struct list_elem *
+clist_remove (struct clist *cl, struct list_elem *elem) 
+{
+  ASSERT (cl->size > 0);
+  cl->size--;
+  return list_remove (elem);
+}
+
+/* Removes the front element from CL and returns it.
+   Undefined behavior if CL is empty before removal. */
+struct list_elem *
+clist_pop_front (struct clist *cl) 
+{
+  ASSERT (cl->size > 0);
+  cl->size--;
+  return list_pop_front (&cl->list);
+}
+
+/* Removes the back element from CL and returns it.
+   Undefined behavior if CL is empty before removal. */
+struct list_elem *
+clist_pop_back (struct clist *cl) 
+{
+  ASSERT (cl->size > 0);
+  cl->size--;
+  return list_pop_back (&cl->list);
+}
+
+/* Returns the number of elements in CL in O(1) time. */
+size_t
+clist_size (const struct clist *cl) 
+{
+  return cl->size;
+}
+
+/* Returns true if CL is empty, false otherwise. */
+bool
+clist_empty (const struct clist *cl) 
+{
+  return cl->size == 0;
+}
@@ -178,4 +178,29 @@ void list_unique (struct list *, struct list *duplicates,
 struct list_elem *list_max (struct list *, list_less_func *, void *aux);
 struct list_elem *list_min (struct list *, list_less_func *, void *aux);
 
+/* Counted list.
+
+   A list that also keeps count of its elements, so that
+   clist_size() takes O(1) time instead of list_size()'s O(n), for
+   lists whose size is needed on hot paths.  Elements must be
+   added and removed only with the clist functions, but member
+   `list' may be traversed and inspected with the list functions
+   above. */
+struct clist 
+  {
+    struct list list;           /* Underlying list. */
+    size_t size;                /* Number of elements in `list'. */
+  };
+
+void clist_init (struct clist *);
+void clist_push_front (struct clist *, struct list_elem *);
+void clist_push_back (struct clist *, struct list_elem *);
+void clist_insert_ordered (struct clist *, struct list_elem *,
+                           list_less_func *, void *aux);
+struct list_elem *clist_remove (struct clist *, struct list_elem *);
+struct list_elem *clist_pop_front (struct clist *);
+struct list_elem *clist_pop_back (struct clist *);
+size_t clist_size (const struct clist *);
+bool clist_empty (const struct clist *);
+
 #endif /* lib/kernel/list.h */
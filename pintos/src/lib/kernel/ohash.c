@@ -0,0 +1,356 @@
+/* Open-addressing hash table.
+
+   See ohash.h for basic information.  The Robin Hood technique is
+   from Celis, "Robin Hood Hashing", Ph.D. thesis, University of
+   Waterloo, 1986.  Deletion shifts the elements that follow the
+   deleted one back by a slot, as long as they are not in their
+   home slots, so the table never needs tombstones. */
+
+#include "ohash.h"
+#include <stdint.h>
+#include "../debug.h"
+#include "threads/malloc.h"
+
+/* Size of a cache line, to which slot arrays are aligned. */
+#define CACHE_LINE 64
+
+/* Initial number of slots. */
+#define MIN_SLOTS (2 * OHASH_GROUP_SLOTS)
+
+/* The table grows once more than LOAD_NUM / LOAD_DEN of its slots
+   are in use. */
+#define LOAD_NUM 7
+#define LOAD_DEN 8
+
+static bool table_alloc (struct ohash_table *, size_t slot_cnt);
+static void table_free (struct ohash_table *);
+static size_t table_find (struct ohash *, struct ohash_table *,
+                          unsigned hash, const void *key);
+static void table_insert (struct ohash_table *, unsigned hash, void *);
+static void table_delete (struct ohash_table *, size_t idx);
+static void grow (struct ohash *);
+static void move_some (struct ohash *);
+
+/* Returned by table_find() for an element that is not found. */
+#define NOT_FOUND ((size_t) -1)
+
+/* Initializes hash table H to compute hash values using HASH and
+   compare hash elements using LESS, given auxiliary data AUX.
+   Returns true if successful, false on allocation failure. */
+bool
+ohash_init (struct ohash *h,
+            ohash_hash_func *hash, ohash_less_func *less, void *aux) 
+{
+  ASSERT (h != NULL);
+  ASSERT (hash != NULL && less != NULL);
+
+  h->old.slots = NULL;
+  h->old.block = NULL;
+  h->old.mask = 0;
+  h->old.elem_cnt = 0;
+  h->move_idx = 0;
+  h->hash = hash;
+  h->less = less;
+  h->aux = aux;
+  return table_alloc (&h->cur, MIN_SLOTS);
+}
+
+/* Destroys hash table H.
+
+   If DESTRUCTOR is non-null, then it is called for each element
+   in the hash, given a null auxiliary pointer.  DESTRUCTOR may,
+   if appropriate, deallocate the memory used by the element. */
+void
+ohash_destroy (struct ohash *h, ohash_action_func *destructor) 
+{
+  if (destructor != NULL)
+    ohash_apply (h, destructor, NULL);
+  table_free (&h->cur);
+  table_free (&h->old);
+}
+
+/* Inserts NEW into hash table H and returns a null pointer, if
+   no equal element is already in the table.
+   If an equal element is already in the table, returns it
+   without inserting NEW.
+   If the table is full and cannot grow for lack of memory,
+   returns NEW itself without inserting it. */
+void *
+ohash_insert (struct ohash *h, void *new) 
+{
+  unsigned hash;
+  size_t idx;
+
+  ASSERT (new != NULL);
+
+  hash = h->hash (new, h->aux);
+  idx = table_find (h, &h->cur, hash, new);
+  if (idx != NOT_FOUND)
+    return h->cur.slots[idx].elem;
+  if (h->old.slots != NULL)
+    {
+      idx = table_find (h, &h->old, hash, new);
+      if (idx != NOT_FOUND)
+        return h->old.slots[idx].elem;
+    }
+
+  if (h->old.slots != NULL)
+    move_some (h);
+  else if ((h->cur.elem_cnt + 1) * LOAD_DEN > (h->cur.mask + 1) * LOAD_NUM)
+    grow (h);
+  if (h->cur.elem_cnt == h->cur.mask)
+    return new;
+
+  table_insert (&h->cur, hash, new);
+  return NULL;
+}
+
+/* Finds and returns an element equal to E in hash table H, or a
+   null pointer if no equal element exists in the table. */
+void *
+ohash_find (struct ohash *h, const void *e) 
+{
+  unsigned hash = h->hash (e, h->aux);
+  size_t idx;
+
+  idx = table_find (h, &h->cur, hash, e);
+  if (idx != NOT_FOUND)
+    return h->cur.slots[idx].elem;
+  if (h->old.slots != NULL)
+    {
+      idx = table_find (h, &h->old, hash, e);
+      if (idx != NOT_FOUND)
+        return h->old.slots[idx].elem;
+    }
+  return NULL;
+}
+
+/* Finds, removes, and returns an element equal to E in hash
+   table H.  Returns a null pointer if no equal element existed
+   in the table. */
+void *
+ohash_delete (struct ohash *h, const void *e) 
+{
+  unsigned hash = h->hash (e, h->aux);
+  struct ohash_table *t = &h->cur;
+  size_t idx;
+  void *found;
+
+  idx = table_find (h, t, hash, e);
+  if (idx == NOT_FOUND && h->old.slots != NULL)
+    {
+      t = &h->old;
+      idx = table_find (h, t, hash, e);
+    }
+  if (idx == NOT_FOUND)
+    return NULL;
+
+  found = t->slots[idx].elem;
+  table_delete (t, idx);
+  if (h->old.slots != NULL)
+    move_some (h);
+  return found;
+}
+
+/* Calls ACTION for each element in hash table H in arbitrary
+   order, given auxiliary data AUX.  ACTION must not insert or
+   delete elements. */
+void
+ohash_apply (struct ohash *h, ohash_action_func *action, void *aux) 
+{
+  struct ohash_table *tables[2];
+  int i;
+
+  ASSERT (action != NULL);
+
+  tables[0] = &h->cur;
+  tables[1] = &h->old;
+  for (i = 0; i < 2; i++)
+    if (tables[i]->slots != NULL)
+      {
+        size_t idx;
+        for (idx = 0; idx <= tables[i]->mask; idx++)
+          if (tables[i]->slots[idx].elem != NULL)
+            action (tables[i]->slots[idx].elem, aux);
+      }
+}
+
+/* Returns the number of elements in H. */
+size_t
+ohash_size (struct ohash *h) 
+{
+  return h->cur.elem_cnt + h->old.elem_cnt;
+}
+
+/* Returns true if H contains no elements, false otherwise. */
+bool
+ohash_empty (struct ohash *h) 
+{
+  return ohash_size (h) == 0;
+}
+
+/* Initializes T as an empty table of SLOT_CNT slots, which must
+   be a power of 2.  Returns true if successful, false on
+   allocation failure. */
+static bool
+table_alloc (struct ohash_table *t, size_t slot_cnt) 
+{
+  size_t i;
+
+  t->block = malloc (slot_cnt * sizeof *t->slots + CACHE_LINE - 1);
+  if (t->block == NULL)
+    return false;
+  t->slots = (struct ohash_slot *) (((uintptr_t) t->block + CACHE_LINE - 1)
+                                    & ~(uintptr_t) (CACHE_LINE - 1));
+  for (i = 0; i < slot_cnt; i++)
+    t->slots[i].elem = NULL;
+  t->mask = slot_cnt - 1;
+  t->elem_cnt = 0;
+  return true;
+}
+
+/* Frees T's slots, leaving it with none. */
+static void
+table_free (struct ohash_table *t) 
+{
+  free (t->block);
+  t->slots = t->block = NULL;
+  t->mask = 0;
+  t->elem_cnt = 0;
+}
+
+/* Returns the distance of the element in slot IDX of T from its
+   home slot. */
+static inline size_t
+probe_distance (const struct ohash_table *t, size_t idx) 
+{
+  return (idx - (t->slots[idx].hash & t->mask)) & t->mask;
+}
+
+/* Returns the index of the slot in T that holds an element equal
+   to KEY, whose hash value is HASH, or NOT_FOUND if there is
+   none.  A probe can stop at the first slot whose element is
+   closer to its home than KEY would be, since Robin Hood
+   insertion would have put KEY there. */
+static size_t
+table_find (struct ohash *h, struct ohash_table *t,
+            unsigned hash, const void *key) 
+{
+  size_t idx = hash & t->mask;
+  size_t dist;
+
+  for (dist = 0; ; dist++, idx = (idx + 1) & t->mask)
+    {
+      struct ohash_slot *s = &t->slots[idx];
+
+      if (s->elem == NULL || probe_distance (t, idx) < dist)
+        return NOT_FOUND;
+      if (s->hash == hash
+          && !h->less (key, s->elem, h->aux)
+          && !h->less (s->elem, key, h->aux))
+        return idx;
+    }
+}
+
+/* Inserts E, whose hash value is HASH, into T, which must have a
+   free slot and must not already contain an element equal to
+   E. */
+static void
+table_insert (struct ohash_table *t, unsigned hash, void *e) 
+{
+  size_t idx = hash & t->mask;
+  size_t dist = 0;
+
+  ASSERT (t->elem_cnt <= t->mask);
+
+  for (;;)
+    {
+      struct ohash_slot *s = &t->slots[idx];
+      size_t s_dist;
+
+      if (s->elem == NULL)
+        {
+          s->hash = hash;
+          s->elem = e;
+          t->elem_cnt++;
+          return;
+        }
+
+      /* Take the slot from an element closer to its home, and
+         carry that element on instead. */
+      s_dist = probe_distance (t, idx);
+      if (s_dist < dist)
+        {
+          struct ohash_slot displaced = *s;
+          s->hash = hash;
+          s->elem = e;
+          hash = displaced.hash;
+          e = displaced.elem;
+          dist = s_dist;
+        }
+      idx = (idx + 1) & t->mask;
+      dist++;
+    }
+}
+
+/* Empties slot IDX of T, shifting back the elements after it that
+   are not in their home slots. */
+static void
+table_delete (struct ohash_table *t, size_t idx) 
+{
+  size_t next;
+
+  for (;;)
+    {
+      next = (idx + 1) & t->mask;
+      if (t->slots[next].elem == NULL || probe_distance (t, next) == 0)
+        break;
+      t->slots[idx] = t->slots[next];
+      idx = next;
+    }
+  t->slots[idx].elem = NULL;
+  t->elem_cnt--;
+}
+
+/* Starts moving the elements of H into a table twice the size.
+   Does nothing if memory is not available. */
+static void
+grow (struct ohash *h) 
+{
+  struct ohash_table new;
+
+  ASSERT (h->old.slots == NULL);
+
+  if (!table_alloc (&new, (h->cur.mask + 1) * 2))
+    return;
+  h->old = h->cur;
+  h->cur = new;
+  h->move_idx = 0;
+  move_some (h);
+}
+
+/* Moves the elements in the next group of slots of H's old table
+   into its current table, and frees the old table once it is
+   empty.  The new table is twice the size of the old one, and the
+   old one was at most LOAD_NUM / LOAD_DEN full, so moving a group
+   per insertion finishes well before the new table fills up. */
+static void
+move_some (struct ohash *h) 
+{
+  size_t end = h->move_idx + OHASH_GROUP_SLOTS;
+
+  ASSERT (h->old.slots != NULL);
+
+  /* A deletion shifts the following elements back into the slot
+     being emptied, so stay on each slot until it is empty. */
+  for (; h->move_idx < end && h->move_idx <= h->old.mask; h->move_idx++)
+    while (h->old.slots[h->move_idx].elem != NULL)
+      {
+        struct ohash_slot *s = &h->old.slots[h->move_idx];
+        table_insert (&h->cur, s->hash, s->elem);
+        table_delete (&h->old, h->move_idx);
+      }
+
+  if (h->move_idx > h->old.mask || h->old.elem_cnt == 0)
+    table_free (&h->old);
+}
@@ -0,0 +1,94 @@
+#ifndef __LIB_KERNEL_OHASH_H
+#define __LIB_KERNEL_OHASH_H
+
+/* Open-addressing hash table.
+
+   An alternative to the chained hash table in hash.h for tables
+   that are searched much more often than they change.  Instead
+   of a list per bucket, the table is one array of slots, each of
+   which holds an element's hash value and a pointer to the
+   element.  A lookup probes consecutive slots starting from the
+   one the hash value selects, comparing hash values inline and
+   calling the comparison function only on a match, so it
+   usually touches a single cache line: slots are allocated in
+   cache-line-sized groups of OHASH_GROUP_SLOTS.
+
+   Collisions are resolved by Robin Hood hashing: an element
+   being inserted displaces any element that is closer to its
+   home slot than the inserted one is, which keeps probe
+   sequences short and even at high load.
+
+   The table grows incrementally.  When it fills up, a table
+   twice the size is allocated and elements move into it a group
+   at a time on each later insertion or deletion, so no single
+   operation pays for rehashing the whole table.  Until the move
+   completes, lookups search both tables.
+
+   Elements are not embedded in the table: the table stores
+   pointers to them, which must not be null.  Lookups take a
+   pointer to a key element, as with hash_find(). */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Computes and returns the hash value for element E, given
+   auxiliary data AUX. */
+typedef unsigned ohash_hash_func (const void *e, void *aux);
+
+/* Compares the value of two elements A and B, given auxiliary
+   data AUX.  Returns true if A is less than B, or false if A is
+   greater than or equal to B. */
+typedef bool ohash_less_func (const void *a, const void *b, void *aux);
+
+/* Performs some operation on element E, given auxiliary data
+   AUX. */
+typedef void ohash_action_func (void *e, void *aux);
+
+/* Slots per cache line. */
+#define OHASH_GROUP_SLOTS 8
+
+/* One slot. */
+struct ohash_slot 
+  {
+    unsigned hash;              /* Hash value of `elem'. */
+    void *elem;                 /* Element, or null if empty. */
+  };
+
+/* An array of slots. */
+struct ohash_table 
+  {
+    struct ohash_slot *slots;   /* Slots, or null if none. */
+    void *block;                /* Allocated block containing slots. */
+    size_t mask;                /* Number of slots minus 1. */
+    size_t elem_cnt;            /* Number of elements in table. */
+  };
+
+/* Open-addressing hash table. */
+struct ohash 
+  {
+    struct ohash_table cur;     /* Table that receives insertions. */
+    struct ohash_table old;     /* Table being emptied into `cur'. */
+    size_t move_idx;            /* Next slot of `old' to move. */
+    ohash_hash_func *hash;      /* Hash function. */
+    ohash_less_func *less;      /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `hash' and `less'. */
+  };
+
+/* Basic life cycle. */
+bool ohash_init (struct ohash *, ohash_hash_func *, ohash_less_func *,
+                 void *aux);
+void ohash_destroy (struct ohash *, ohash_action_func *);
+
+/* Search, insertion, deletion. */
+void *ohash_insert (struct ohash *, void *);
+void *ohash_find (struct ohash *, const void *);
+void *ohash_delete (struct ohash *, const void *);
+
+/* Iteration. */
+void ohash_apply (struct ohash *, ohash_action_func *, void *aux);
+
+/* Information. */
+size_t ohash_size (struct ohash *);
+bool ohash_empty (struct ohash *);
+
+#endif /* lib/kernel/ohash.h */
@@ -0,0 +1,465 @@
+/* Red-black tree.
+
+   See rbtree.h for basic information.  The algorithms are those
+   of [CLRS] chapter 13, with null pointers in place of the
+   sentinel leaf: since a null child has no parent pointer,
+   removal tracks the parent of the node being fixed up
+   separately. */
+
+#include "rbtree.h"
+#include "../debug.h"
+
+static void rotate_left (struct rb_tree *, struct rb_elem *);
+static void rotate_right (struct rb_tree *, struct rb_elem *);
+static void transplant (struct rb_tree *, struct rb_elem *old,
+                        struct rb_elem *new);
+static void insert_fixup (struct rb_tree *, struct rb_elem *);
+static void remove_fixup (struct rb_tree *, struct rb_elem *,
+                          struct rb_elem *parent);
+
+/* Returns true if E is a red node, false if it is black or
+   null. */
+static inline bool
+is_red (const struct rb_elem *e) 
+{
+  return e != NULL && e->red;
+}
+
+/* Initializes tree T to be empty, comparing elements using LESS
+   given auxiliary data AUX. */
+void
+rb_init (struct rb_tree *t, rb_less_func *less, void *aux) 
+{
+  ASSERT (t != NULL);
+  ASSERT (less != NULL);
+
+  t->root = t->min = NULL;
+  t->size = 0;
+  t->less = less;
+  t->aux = aux;
+}
+
+/* Inserts E into T, after any elements that it equals. */
+void
+rb_insert (struct rb_tree *t, struct rb_elem *e) 
+{
+  struct rb_elem *parent = NULL;
+  struct rb_elem **link = &t->root;
+  bool leftmost = true;
+
+  ASSERT (t != NULL);
+  ASSERT (e != NULL);
+
+  while (*link != NULL)
+    {
+      parent = *link;
+      if (t->less (e, parent, t->aux))
+        link = &parent->left;
+      else
+        {
+          link = &parent->right;
+          leftmost = false;
+        }
+    }
+
+  e->parent = parent;
+  e->left = e->right = NULL;
+  e->red = true;
+  *link = e;
+  if (leftmost)
+    t->min = e;
+  t->size++;
+
+  insert_fixup (t, e);
+}
+
+/* Inserts E into T if no element equal to it is already in T,
+   and returns a null pointer.  Otherwise, leaves T unchanged and
+   returns the element equal to E. */
+struct rb_elem *
+rb_insert_unique (struct rb_tree *t, struct rb_elem *e) 
+{
+  struct rb_elem *parent = NULL;
+  struct rb_elem **link = &t->root;
+  bool leftmost = true;
+
+  ASSERT (t != NULL);
+  ASSERT (e != NULL);
+
+  while (*link != NULL)
+    {
+      parent = *link;
+      if (t->less (e, parent, t->aux))
+        link = &parent->left;
+      else if (t->less (parent, e, t->aux))
+        {
+          link = &parent->right;
+          leftmost = false;
+        }
+      else
+        return parent;
+    }
+
+  e->parent = parent;
+  e->left = e->right = NULL;
+  e->red = true;
+  *link = e;
+  if (leftmost)
+    t->min = e;
+  t->size++;
+
+  insert_fixup (t, e);
+  return NULL;
+}
+
+/* Removes E, which must be in T, from T. */
+void
+rb_remove (struct rb_tree *t, struct rb_elem *e) 
+{
+  struct rb_elem *x, *x_parent;
+  bool removed_red = e->red;
+
+  ASSERT (t != NULL);
+  ASSERT (e != NULL);
+  ASSERT (t->size > 0);
+
+  if (t->min == e)
+    t->min = rb_next (e);
+
+  if (e->left == NULL)
+    {
+      x = e->right;
+      x_parent = e->parent;
+      transplant (t, e, e->right);
+    }
+  else if (e->right == NULL)
+    {
+      x = e->left;
+      x_parent = e->parent;
+      transplant (t, e, e->left);
+    }
+  else 
+    {
+      /* Replace E by its successor Y, which has no left child. */
+      struct rb_elem *y = e->right;
+      while (y->left != NULL)
+        y = y->left;
+      removed_red = y->red;
+      x = y->right;
+      if (y->parent == e)
+        x_parent = y;
+      else
+        {
+          x_parent = y->parent;
+          transplant (t, y, y->right);
+          y->right = e->right;
+          y->right->parent = y;
+        }
+      transplant (t, e, y);
+      y->left = e->left;
+      y->left->parent = y;
+      y->red = e->red;
+    }
+  t->size--;
+
+  if (!removed_red)
+    remove_fixup (t, x, x_parent);
+}
+
+/* Returns the first element in T equal to E, or a null pointer
+   if there is none. */
+struct rb_elem *
+rb_find (const struct rb_tree *t, const struct rb_elem *e) 
+{
+  struct rb_elem *found = rb_lower_bound (t, e);
+
+  return found != NULL && !t->less (e, found, t->aux) ? found : NULL;
+}
+
+/* Returns the first element in T that is not less than E, or a
+   null pointer if every element is less than E. */
+struct rb_elem *
+rb_lower_bound (const struct rb_tree *t, const struct rb_elem *e) 
+{
+  struct rb_elem *node = t->root;
+  struct rb_elem *bound = NULL;
+
+  while (node != NULL)
+    if (t->less (node, e, t->aux))
+      node = node->right;
+    else
+      {
+        bound = node;
+        node = node->left;
+      }
+  return bound;
+}
+
+/* Returns the first element in T that is greater than E, or a
+   null pointer if no element is greater than E. */
+struct rb_elem *
+rb_upper_bound (const struct rb_tree *t, const struct rb_elem *e) 
+{
+  struct rb_elem *node = t->root;
+  struct rb_elem *bound = NULL;
+
+  while (node != NULL)
+    if (t->less (e, node, t->aux))
+      {
+        bound = node;
+        node = node->left;
+      }
+    else
+      node = node->right;
+  return bound;
+}
+
+/* Returns the least element of T, or a null pointer if T is
+   empty. */
+struct rb_elem *
+rb_min (const struct rb_tree *t) 
+{
+  return t->min;
+}
+
+/* Returns the greatest element of T, the last of any that are
+   equal, or a null pointer if T is empty. */
+struct rb_elem *
+rb_max (const struct rb_tree *t) 
+{
+  struct rb_elem *e = t->root;
+
+  if (e != NULL)
+    while (e->right != NULL)
+      e = e->right;
+  return e;
+}
+
+/* Returns the element that follows E in its tree, or a null
+   pointer if E is the greatest. */
+struct rb_elem *
+rb_next (struct rb_elem *e) 
+{
+  if (e->right != NULL)
+    {
+      e = e->right;
+      while (e->left != NULL)
+        e = e->left;
+      return e;
+    }
+  while (e->parent != NULL && e == e->parent->right)
+    e = e->parent;
+  return e->parent;
+}
+
+/* Returns the element that precedes E in its tree, or a null
+   pointer if E is the least. */
+struct rb_elem *
+rb_prev (struct rb_elem *e) 
+{
+  if (e->left != NULL)
+    {
+      e = e->left;
+      while (e->right != NULL)
+        e = e->right;
+      return e;
+    }
+  while (e->parent != NULL && e == e->parent->left)
+    e = e->parent;
+  return e->parent;
+}
+
+/* Returns the number of elements in T. */
+size_t
+rb_size (const struct rb_tree *t) 
+{
+  return t->size;
+}
+
+/* Returns true if T contains no elements, false otherwise. */
+bool
+rb_empty (const struct rb_tree *t) 
+{
+  return t->size == 0;
+}
+
+/* Makes X's right child take X's place in T, with X as its left
+   child. */
+static void
+rotate_left (struct rb_tree *t, struct rb_elem *x) 
+{
+  struct rb_elem *y = x->right;
+
+  x->right = y->left;
+  if (y->left != NULL)
+    y->left->parent = x;
+  transplant (t, x, y);
+  y->left = x;
+  x->parent = y;
+}
+
+/* Makes X's left child take X's place in T, with X as its right
+   child. */
+static void
+rotate_right (struct rb_tree *t, struct rb_elem *x) 
+{
+  struct rb_elem *y = x->left;
+
+  x->left = y->right;
+  if (y->right != NULL)
+    y->right->parent = x;
+  transplant (t, x, y);
+  y->right = x;
+  x->parent = y;
+}
+
+/* Puts NEW, which may be null, into OLD's place under OLD's
+   parent in T.  OLD's own links are left alone. */
+static void
+transplant (struct rb_tree *t, struct rb_elem *old, struct rb_elem *new) 
+{
+  if (old->parent == NULL)
+    t->root = new;
+  else if (old == old->parent->left)
+    old->parent->left = new;
+  else
+    old->parent->right = new;
+  if (new != NULL)
+    new->parent = old->parent;
+}
+
+/* Restores the red-black properties after red node E has been
+   added to T as a leaf. */
+static void
+insert_fixup (struct rb_tree *t, struct rb_elem *e) 
+{
+  struct rb_elem *p;
+
+  while (is_red (p = e->parent))
+    {
+      struct rb_elem *g = p->parent;
+
+      if (p == g->left)
+        {
+          struct rb_elem *u = g->right;
+          if (is_red (u))
+            {
+              p->red = u->red = false;
+              g->red = true;
+              e = g;
+            }
+          else
+            {
+              if (e == p->right)
+                {
+                  e = p;
+                  rotate_left (t, e);
+                  p = e->parent;
+                }
+              p->red = false;
+              g->red = true;
+              rotate_right (t, g);
+            }
+        }
+      else
+        {
+          struct rb_elem *u = g->left;
+          if (is_red (u))
+            {
+              p->red = u->red = false;
+              g->red = true;
+              e = g;
+            }
+          else
+            {
+              if (e == p->left)
+                {
+                  e = p;
+                  rotate_right (t, e);
+                  p = e->parent;
+                }
+              p->red = false;
+              g->red = true;
+              rotate_left (t, g);
+            }
+        }
+    }
+  t->root->red = false;
+}
+
+/* Restores the red-black properties after a black node has been
+   removed from T.  X, which may be null, took its place, under
+   PARENT. */
+static void
+remove_fixup (struct rb_tree *t, struct rb_elem *x, struct rb_elem *parent) 
+{
+  while (x != t->root && !is_red (x))
+    {
+      if (x == parent->left)
+        {
+          struct rb_elem *w = parent->right;
+          if (is_red (w))
+            {
+              w->red = false;
+              parent->red = true;
+              rotate_left (t, parent);
+              w = parent->right;
+            }
+          if (!is_red (w->left) && !is_red (w->right))
+            {
+              w->red = true;
+              x = parent;
+              parent = x->parent;
+            }
+          else
+            {
+              if (!is_red (w->right))
+                {
+                  w->left->red = false;
+                  w->red = true;
+                  rotate_right (t, w);
+                  w = parent->right;
+                }
+              w->red = parent->red;
+              parent->red = false;
+              w->right->red = false;
+              rotate_left (t, parent);
+              x = t->root;
+            }
+        }
+      else
+        {
+          struct rb_elem *w = parent->left;
+          if (is_red (w))
+            {
+              w->red = false;
+              parent->red = true;
+              rotate_right (t, parent);
+              w = parent->left;
+            }
+          if (!is_red (w->left) && !is_red (w->right))
+            {
+              w->red = true;
+              x = parent;
+              parent = x->parent;
+            }
+          else
+            {
+              if (!is_red (w->left))
+                {
+                  w->right->red = false;
+                  w->red = true;
+                  rotate_left (t, w);
+                  w = parent->left;
+                }
+              w->red = parent->red;
+              parent->red = false;
+              w->left->red = false;
+              rotate_right (t, parent);
+              x = t->root;
+            }
+        }
+    }
+  if (x != NULL)
+    x->red = false;
+}
@@ -0,0 +1,85 @@
+#ifndef __LIB_KSTAT_H
+#define __LIB_KSTAT_H
+
+#include <faultstat.h>
+#include <schedstat.h>
+#include <stdint.h>
+
+/* Version of struct kstat.  Fields are only ever added at the
+   end, with an increment, so a monitor built against an older
+   version reads a prefix that still means the same thing. */
+#define KSTAT_VERSION 1
+
+/* Number of histogram buckets per block device direction. */
+#define KSTAT_BUCKETS 32
+
+/* Block devices reported, one per role: kernel, file system,
+   scratch, and swap. */
+#define KSTAT_BLOCK_CNT 4
+
+/* One direction of transfer on a block device.  latency[B]
+   counts requests that took from 2**B up to 2**(B + 1)
+   nanoseconds. */
+struct kstat_io
+  {
+    uint64_t req_cnt;           /* Requests. */
+    uint64_t seq_cnt;           /* Requests that began where the
+                                   previous one ended. */
+    uint64_t sector_cnt;        /* Sectors transferred. */
+    uint32_t latency[KSTAT_BUCKETS];
+  };
+
+/* A block device in one role. */
+struct kstat_block
+  {
+    uint32_t present;           /* Nonzero if the role is filled. */
+    uint32_t max_depth;         /* Most requests ever in progress. */
+    uint64_t depth_sum;         /* Requests in progress, summed over
+                                   each arriving request. */
+    struct kstat_io reads;
+    struct kstat_io writes;
+  };
+
+/* Snapshot of the kernel's statistics, as returned by the stats()
+   system call.  All counts are since boot.  Counters for parts of
+   the kernel not built in are zero. */
+struct kstat
+  {
+    uint32_t version;           /* KSTAT_VERSION. */
+    uint32_t size;              /* sizeof (struct kstat). */
+
+    /* Time. */
+    int64_t ticks;              /* Timer ticks. */
+    uint64_t uptime_ns;         /* Nanoseconds since calibration. */
+
+    /* Threads. */
+    int64_t idle_ticks;         /* Ticks spent idle. */
+    int64_t kernel_ticks;       /* Ticks in kernel threads. */
+    int64_t user_ticks;         /* Ticks in user programs. */
+
+    /* Console and keyboard. */
+    int64_t console_chars;      /* Characters output. */
+    int64_t keys;               /* Keys pressed. */
+
+    /* Block devices, indexed by role. */
+    struct kstat_block block[KSTAT_BLOCK_CNT];
+
+    /* Page faults.  faults.count[] is the calling process's. */
+    int64_t page_faults;        /* All page faults. */
+    struct faultstat faults;
+
+    /* Virtual memory. */
+    int64_t evictions;          /* Frames evicted... */
+    int64_t reclaims;           /* ...of which by the reclaimer. */
+    int64_t swap_outs;          /* Pages written to swap. */
+    int64_t swap_ins;           /* Pages read back from swap... */
+    int64_t swap_ra_hits;       /* ...of which by read-ahead. */
+    int64_t zswap_stores;       /* Pages compressed into zswap. */
+    int64_t zswap_rejects;      /* Pages that did not compress. */
+    int64_t zswap_loads;        /* Pages decompressed. */
+
+    /* Scheduling latency. */
+    struct schedstat sched;
+  };
+
+#endif /* lib/kstat.h */
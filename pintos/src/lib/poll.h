@@ -0,0 +1,23 @@
+#ifndef __LIB_POLL_H
+#define __LIB_POLL_H
+
+/* A descriptor for poll() to watch, and what it found. */
+struct pollfd
+  {
+    int fd;                     /* Descriptor. */
+    short events;               /* Events to wait for. */
+    short revents;              /* Events that occurred. */
+  };
+
+/* Events.  POLLERR, POLLHUP, and POLLNVAL are reported whether
+   asked for or not. */
+#define POLLIN   0x01           /* Reading will not block. */
+#define POLLOUT  0x04           /* Writing will not block. */
+#define POLLERR  0x08           /* Error; nothing can be written. */
+#define POLLHUP  0x10           /* Other end closed. */
+#define POLLNVAL 0x20           /* Descriptor not open. */
+
+/* Most descriptors in one poll(). */
+#define POLL_MAX 256
+
+#endif /* lib/poll.h */
@@ -0,0 +1,32 @@
+#ifndef __LIB_SCHEDSTAT_H
+#define __LIB_SCHEDSTAT_H
+
+#include <stdint.h>
+
+/* Classes of threads whose scheduling latency is recorded: the
+   three priority bands, below, at, and above PRI_DEFAULT, and
+   deadline threads. */
+enum schedstat_class
+  {
+    SCHEDSTAT_LOW,              /* Priority below PRI_DEFAULT. */
+    SCHEDSTAT_DEFAULT,          /* Priority PRI_DEFAULT. */
+    SCHEDSTAT_HIGH,             /* Priority above PRI_DEFAULT. */
+    SCHEDSTAT_DEADLINE,         /* Deadline threads. */
+    SCHEDSTAT_CLASS_CNT
+  };
+
+/* Number of histogram buckets per class. */
+#define SCHEDSTAT_BUCKETS 32
+
+/* Scheduling latency, the time from a thread being woken to its
+   running, as returned by the schedstat() system call.
+   latency[C][B] counts the wakeups of class C threads that took
+   from 2**B up to 2**(B + 1) nanoseconds.  Bucket 0 also counts
+   wakeups under a nanosecond and the last bucket all longer
+   ones. */
+struct schedstat
+  {
+    uint32_t latency[SCHEDSTAT_CLASS_CNT][SCHEDSTAT_BUCKETS];
+  };
+
+#endif /* lib/schedstat.h */
@@ -0,0 +1,22 @@
+#ifndef __LIB_SPAWN_H
+#define __LIB_SPAWN_H
+
+/* A descriptor for a child started by the spawn() system call to
+   inherit: the child gets its own reference to what the parent's
+   descriptor PARENT_FD refers to, as its descriptor CHILD_FD.
+   Files are reopened at the same position, as for fork().
+   CHILD_FD must be at least 2 and less than SPAWN_CHILD_FD_MAX,
+   and may appear only once. */
+struct spawn_fd
+  {
+    int parent_fd;              /* Descriptor in the parent. */
+    int child_fd;               /* Descriptor in the child. */
+  };
+
+/* Most descriptors one spawn() passes. */
+#define SPAWN_FD_MAX 32
+
+/* Upper bound on child descriptors. */
+#define SPAWN_CHILD_FD_MAX 1024
+
+#endif /* lib/spawn.h */
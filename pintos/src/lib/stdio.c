@@ -13,7 +13,7 @@ struct vsnprintf_aux
     int max_length;     /* Max length of output string. */
   };
 
-static void vsnprintf_helper (char, void *);
+static void vsnprintf_helper (const char *, size_t, void *);
 
 /* Like vprintf(), except that output is stored into BUFFER,
    which must have space for BUF_SIZE characters.  Writes at most
@@ -32,7 +32,7 @@ vsnprintf (char *buffer, size_t buf_size, const char *format, va_list args)
   aux.max_length = buf_size > 0 ? buf_size - 1 : 0;
 
   /* Do most of the work. */
-  __vprintf (format, args, vsnprintf_helper, &aux);
+  __vprintf_runs (format, args, vsnprintf_helper, &aux);
 
   /* Add null terminator. */
   if (buf_size > 0)
@@ -43,12 +43,18 @@ vsnprintf (char *buffer, size_t buf_size, const char *format, va_list args)
 
 /* Helper function for vsnprintf(). */
 static void
-vsnprintf_helper (char ch, void *aux_)
+vsnprintf_helper (const char *run, size_t n, void *aux_)
 {
   struct vsnprintf_aux *aux = aux_;
 
-  if (aux->length++ < aux->max_length)
-    *aux->p++ = ch;
+  if (aux->length < aux->max_length)
+    {
+      size_t room = aux->max_length - aux->length;
+      size_t copy = n < room ? n : room;
+      memcpy (aux->p, run, copy);
+      aux->p += copy;
+    }
+  aux->length += n;
 }
 
 /* Like printf(), except that output is stored into BUFFER,
@@ -140,23 +146,115 @@ static const struct integer_base base_o = {8, "01234567", 0, 3};
 static const struct integer_base base_x = {16, "0123456789abcdef", 'x', 4};
 static const struct integer_base base_X = {16, "0123456789ABCDEF", 'X', 4};
 
+/* The two-digit decimal numbers "00" through "99", so that an
+   integer can be converted two digits per division. */
+static const char digit_pairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+/* Output state for __vprintf_runs().  Characters collect in BUF
+   and go to the sink in runs, so that the sink is not called once
+   per character. */
+struct printf_output
+  {
+    void (*write) (const char *, size_t, void *); /* Sink. */
+    void *aux;                  /* Sink's auxiliary data. */
+    size_t len;                 /* Number of characters in BUF. */
+    char buf[64];               /* Characters not yet written. */
+  };
+
+/* Passes the characters buffered in OUT to its sink. */
+static void
+output_flush (struct printf_output *out) 
+{
+  if (out->len > 0)
+    {
+      out->write (out->buf, out->len, out->aux);
+      out->len = 0;
+    }
+}
+
+/* Appends CH to OUT. */
+static inline void
+output_char (char ch, struct printf_output *out) 
+{
+  if (out->len >= sizeof out->buf)
+    output_flush (out);
+  out->buf[out->len++] = ch;
+}
+
+/* Appends the CNT characters in RUN to OUT.  A long run goes
+   straight to the sink. */
+static void
+output_run (const char *run, size_t cnt, struct printf_output *out) 
+{
+  if (cnt > sizeof out->buf - out->len)
+    {
+      output_flush (out);
+      if (cnt >= sizeof out->buf)
+        {
+          out->write (run, cnt, out->aux);
+          return;
+        }
+    }
+  memcpy (out->buf + out->len, run, cnt);
+  out->len += cnt;
+}
+
 static const char *parse_conversion (const char *format,
                                      struct printf_conversion *,
                                      va_list *);
 static void format_integer (uintmax_t value, bool is_signed, bool negative, 
                             const struct integer_base *,
                             const struct printf_conversion *,
-                            void (*output) (char, void *), void *aux);
-static void output_dup (char ch, size_t cnt,
-                        void (*output) (char, void *), void *aux);
+                            struct printf_output *);
+static void output_dup (char ch, size_t cnt, struct printf_output *);
 static void format_string (const char *string, int length,
                            struct printf_conversion *,
-                           void (*output) (char, void *), void *aux);
+                           struct printf_output *);
 
+/* Sink and auxiliary data for __vprintf(). */
+struct char_sink
+  {
+    void (*output) (char, void *);
+    void *aux;
+  };
+
+/* Passes the CNT characters in RUN one by one to the character
+   sink in SINK_. */
+static void
+write_chars (const char *run, size_t cnt, void *sink_) 
+{
+  struct char_sink *sink = sink_;
+
+  while (cnt-- > 0)
+    sink->output (*run++, sink->aux);
+}
+
+/* Formats FORMAT with ARGS, as vprintf(), calling OUTPUT with AUX
+   for each character. */
 void
 __vprintf (const char *format, va_list args,
            void (*output) (char, void *), void *aux)
 {
+  struct char_sink sink;
+
+  sink.output = output;
+  sink.aux = aux;
+  __vprintf_runs (format, args, write_chars, &sink);
+}
+
+/* Formats FORMAT with ARGS, as vprintf(), calling WRITE with AUX
+   for each run of characters. */
+void
+__vprintf_runs (const char *format, va_list args,
+                void (*write) (const char *, size_t, void *), void *aux)
+{
+  struct printf_output output;
+  struct printf_output *out = &output;
+
+  out->write = write;
+  out->aux = aux;
+  out->len = 0;
   for (; *format != '\0'; format++)
     {
       struct printf_conversion c;
@@ -164,7 +262,10 @@ __vprintf (const char *format, va_list args,
       /* Literally copy non-conversions to output. */
       if (*format != '%') 
         {
-          output (*format, aux);
+          const char *run = format;
+          while (format[1] != '\0' && format[1] != '%')
+            format++;
+          output_run (run, format + 1 - run, out);
           continue;
         }
       format++;
@@ -172,7 +273,7 @@ __vprintf (const char *format, va_list args,
       /* %% => %. */
       if (*format == '%') 
         {
-          output ('%', aux);
+          output_char ('%', out);
           continue;
         }
 
@@ -221,7 +322,7 @@ __vprintf (const char *format, va_list args,
               }
 
             format_integer (value < 0 ? -value : value,
-                            true, value < 0, &base_d, &c, output, aux);
+                            true, value < 0, &base_d, &c, out);
           }
           break;
           
@@ -276,7 +377,7 @@ __vprintf (const char *format, va_list args,
               default: NOT_REACHED ();
               }
 
-            format_integer (value, false, false, b, &c, output, aux);
+            format_integer (value, false, false, b, &c, out);
           }
           break;
 
@@ -284,7 +385,7 @@ __vprintf (const char *format, va_list args,
           {
             /* Treat character as single-character string. */
             char ch = va_arg (args, int);
-            format_string (&ch, 1, &c, output, aux);
+            format_string (&ch, 1, &c, out);
           }
           break;
 
@@ -298,7 +399,7 @@ __vprintf (const char *format, va_list args,
             /* Limit string length according to precision.
                Note: if c.precision == -1 then strnlen() will get
                SIZE_MAX for MAXLEN, which is just what we want. */
-            format_string (s, strnlen (s, c.precision), &c, output, aux);
+            format_string (s, strnlen (s, c.precision), &c, out);
           }
           break;
           
@@ -310,7 +411,7 @@ __vprintf (const char *format, va_list args,
 
             c.flags = POUND;
             format_integer ((uintptr_t) p, false, false,
-                            &base_x, &c, output, aux);
+                            &base_x, &c, out);
           }
           break;
       
@@ -322,14 +423,19 @@ __vprintf (const char *format, va_list args,
         case 'n':
           /* We don't support floating-point arithmetic,
              and %n can be part of a security hole. */
-          __printf ("<<no %%%c in kernel>>", output, aux, *format);
+          output_run ("<<no %", 6, out);
+          output_char (*format, out);
+          output_run (" in kernel>>", 12, out);
           break;
 
         default:
-          __printf ("<<no %%%c conversion>>", output, aux, *format);
+          output_run ("<<no %", 6, out);
+          output_char (*format, out);
+          output_run (" conversion>>", 13, out);
           break;
         }
     }
+  output_flush (out);
 }
 
 /* Parses conversion option characters starting at FORMAT and
@@ -459,20 +565,58 @@ parse_conversion (const char *format, struct printf_conversion *c,
   return format;
 }
 
-/* Performs an integer conversion, writing output to OUTPUT with
-   auxiliary data AUX.  The integer converted has absolute value
-   VALUE.  If IS_SIGNED is true, does a signed conversion with
-   NEGATIVE indicating a negative value; otherwise does an
-   unsigned conversion and ignores NEGATIVE.  The output is done
+/* Writes the decimal digits of V, which are none if V is 0, into
+   the bytes just before END, and returns the first one. */
+static char *
+format_decimal (uint32_t v, char *end) 
+{
+  char *cp = end;
+
+  while (v >= 100)
+    {
+      const char *pair = &digit_pairs[v % 100 * 2];
+      v /= 100;
+      *--cp = pair[1];
+      *--cp = pair[0];
+    }
+  if (v >= 10)
+    {
+      *--cp = digit_pairs[v * 2 + 1];
+      *--cp = digit_pairs[v * 2];
+    }
+  else if (v > 0)
+    *--cp = '0' + v;
+  return cp;
+}
+
+/* Writes the digits of V in base 2**SHIFT, using DIGITS, into the
+   bytes just before END, and returns the first one. */
+static char *
+format_bits (uint32_t v, int shift, const char *digits, char *end) 
+{
+  char *cp = end;
+  unsigned mask = (1u << shift) - 1;
+
+  for (; v > 0; v >>= shift)
+    *--cp = digits[v & mask];
+  return cp;
+}
+
+/* Performs an integer conversion, writing output to OUT.  The
+   integer converted has absolute value VALUE.  If IS_SIGNED is
+   true, does a signed conversion with NEGATIVE indicating a
+   negative value; otherwise does an unsigned conversion and
+   ignores NEGATIVE.  The output is done
    according to the provided base B.  Details of the conversion
    are in C. */
 static void
 format_integer (uintmax_t value, bool is_signed, bool negative, 
                 const struct integer_base *b,
                 const struct printf_conversion *c,
-                void (*output) (char, void *), void *aux)
+                struct printf_output *out)
 {
   char buf[64], *cp;            /* Buffer and current position. */
+  char *end = buf + sizeof buf; /* End of digits. */
   int x;                        /* `x' character to use or 0 if none. */
   int sign;                     /* Sign character or 0 if none. */
   int precision;                /* Rendered precision. */
@@ -498,60 +642,94 @@ format_integer (uintmax_t value, bool is_signed, bool negative,
      nonzero value with the # flag. */
   x = (c->flags & POUND) && value ? b->x : 0;
 
-  /* Accumulate digits into buffer.
-     This algorithm produces digits in reverse order, so later we
-     will output the buffer's content in reverse. */
-  cp = buf;
-  digit_cnt = 0;
-  while (value > 0) 
+  /* Accumulate digits into buffer, from the end backward. */
+  cp = end;
+  if (c->flags & GROUP)
+    {
+      digit_cnt = 0;
+      while (value > 0) 
+        {
+          if (digit_cnt > 0 && digit_cnt % b->group == 0)
+            *--cp = ',';
+          if (value <= UINT32_MAX)
+            {
+              uint32_t v = value;
+              *--cp = b->digits[v % b->base];
+              value = v / b->base;
+            }
+          else 
+            {
+              *--cp = b->digits[value % b->base];
+              value /= b->base;
+            }
+          digit_cnt++;
+        }
+    }
+  else if (b->base == 10)
     {
-      if ((c->flags & GROUP) && digit_cnt > 0 && digit_cnt % b->group == 0)
-        *cp++ = ',';
-      *cp++ = b->digits[value % b->base];
-      value /= b->base;
-      digit_cnt++;
+      /* Peel off nine digits at a time with 64-bit division until
+         the rest fits in 32 bits, then convert 32 bits at a time,
+         which needs no calls to __udivdi3(). */
+      while (value > UINT32_MAX)
+        {
+          char *stop = cp - 9;
+          cp = format_decimal (value % 1000000000, cp);
+          value /= 1000000000;
+          while (cp > stop)
+            *--cp = '0';
+        }
+      cp = format_decimal (value, cp);
+    }
+  else
+    {
+      /* Octal and hexadecimal digits are bit fields. */
+      int shift = __builtin_ctz (b->base);
+      unsigned mask = b->base - 1;
+
+      for (; value > UINT32_MAX; value >>= shift)
+        *--cp = b->digits[value & mask];
+      cp = format_bits (value, shift, b->digits, cp);
     }
 
-  /* Append enough zeros to match precision.
+  /* Prepend enough zeros to match precision.
      If requested precision is 0, then a value of zero is
      rendered as a null string, otherwise as "0".
      If the # flag is used with base 8, the result must always
      begin with a zero. */
   precision = c->precision < 0 ? 1 : c->precision;
-  while (cp - buf < precision && cp < buf + sizeof buf - 1)
-    *cp++ = '0';
-  if ((c->flags & POUND) && b->base == 8 && (cp == buf || cp[-1] != '0'))
-    *cp++ = '0';
+  while (end - cp < precision && cp > buf + 1)
+    *--cp = '0';
+  if ((c->flags & POUND) && b->base == 8 && (cp == end || *cp != '0'))
+    *--cp = '0';
 
   /* Calculate number of pad characters to fill field width. */
-  pad_cnt = c->width - (cp - buf) - (x ? 2 : 0) - (sign != 0);
+  pad_cnt = c->width - (end - cp) - (x ? 2 : 0) - (sign != 0);
   if (pad_cnt < 0)
     pad_cnt = 0;
 
   /* Do output. */
   if ((c->flags & (MINUS | ZERO)) == 0)
-    output_dup (' ', pad_cnt, output, aux);
+    output_dup (' ', pad_cnt, out);
   if (sign)
-    output (sign, aux);
+    output_char (sign, out);
   if (x) 
     {
-      output ('0', aux);
-      output (x, aux); 
+      output_char ('0', out);
+      output_char (x, out); 
     }
   if (c->flags & ZERO)
-    output_dup ('0', pad_cnt, output, aux);
-  while (cp > buf)
-    output (*--cp, aux);
+    output_dup ('0', pad_cnt, out);
+  output_run (cp, end - cp, out);
   if (c->flags & MINUS)
-    output_dup (' ', pad_cnt, output, aux);
+    output_dup (' ', pad_cnt, out);
 }
 
-/* Writes CH to OUTPUT with auxiliary data AUX, CNT times. */
+/* Writes CH to OUT, CNT times. */
 static void
-output_dup (char ch, size_t cnt, void (*output) (char, void *), void *aux) 
+output_dup (char ch, size_t cnt, struct printf_output *out) 
 {
   while (cnt-- > 0)
-    output (ch, aux);
+    output_char (ch, out);
 }
 
 /* Formats the LENGTH characters starting at STRING according to
@@ -560,15 +738,13 @@ output_dup (char ch, size_t cnt, void (*output) (char, void *), void *aux)
 static void
 format_string (const char *string, int length,
                struct printf_conversion *c,
-               void (*output) (char, void *), void *aux) 
+               struct printf_output *out) 
 {
-  int i;
   if (c->width > length && (c->flags & MINUS) == 0)
-    output_dup (' ', c->width - length, output, aux);
-  for (i = 0; i < length; i++)
-    output (string[i], aux);
+    output_dup (' ', c->width - length, out);
+  output_run (string, length, out);
   if (c->width > length && (c->flags & MINUS) != 0)
-    output_dup (' ', c->width - length, output, aux);
+    output_dup (' ', c->width - length, out);
 }
 
 /* Wrapper for __vprintf() that converts varargs into a
@@ -30,6 +30,8 @@ void print_human_readable_size (uint64_t sz);
 /* Internal functions. */
 void __vprintf (const char *format, va_list args,
                 void (*output) (char, void *), void *aux);
+void __vprintf_runs (const char *format, va_list args,
+                     void (*write) (const char *, size_t, void *), void *aux);
 void __printf (const char *format,
                void (*output) (char, void *), void *aux, ...);
 
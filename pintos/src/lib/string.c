@@ -1,19 +1,62 @@
 #include <string.h>
 #include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* string.h routes constant-size calls to its inline versions;
+   these are the out-of-line definitions. */
+#undef memcpy
+#undef memset
+
+/* The search and comparison functions below look at a 32-bit
+   word at a time once their arguments are word aligned.  An
+   aligned word never straddles a page boundary, so reading all of
+   the word that holds a string's null terminator cannot fault
+   even though some of its bytes lie past the end of the string.
+
+   A machine word that may alias any object, for those reads. */
+typedef uint32_t __attribute__ ((may_alias)) word_t;
+
+/* As word_t, but may be unaligned. */
+typedef uint32_t __attribute__ ((may_alias, aligned (1))) uword_t;
+
+/* Returns true if some byte of W is zero.  Subtracting 1 from each
+   byte sets the top bit of any byte that was 0 (or was above
+   0x80, which ~W rules out).  See [Hacker's Delight] 6-1. */
+static inline bool
+has_zero_byte (uint32_t w)
+{
+  return ((w - 0x01010101u) & ~w & 0x80808080u) != 0;
+}
+
+/* Returns true if P is word aligned. */
+static inline bool
+is_word_aligned (const void *p)
+{
+  return ((uintptr_t) p & (sizeof (word_t) - 1)) == 0;
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
-   Returns DST. */
+   Returns DST.  Copies a doubleword at a time with REP MOVSL,
+   then any remaining bytes with REP MOVSB.  See [IA32-v2b]
+   "MOVS/MOVSB/MOVSW/MOVSD--Move Data from String to String" and
+   "REP/REPE/REPZ/REPNE/REPNZ--Repeat String Operation
+   Prefix". */
 void *
 memcpy (void *dst_, const void *src_, size_t size) 
 {
-  unsigned char *dst = dst_;
-  const unsigned char *src = src_;
+  void *dst = dst_;
+  const void *src = src_;
+  size_t words = size / 4;
+  size_t bytes = size % 4;
 
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = *src++;
+  asm volatile ("rep movsl; movl %3, %%ecx; rep movsb"
+                : "+D" (dst), "+S" (src), "+c" (words)
+                : "rm" (bytes)
+                : "memory");
 
   return dst_;
 }
@@ -29,20 +72,27 @@ memmove (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  if (dst < src) 
-    {
-      while (size-- > 0)
-        *dst++ = *src++;
-    }
+  if (dst <= src || dst >= src + size) 
+    memcpy (dst, src, size);
   else 
     {
-      dst += size;
-      src += size;
-      while (size-- > 0)
-        *--dst = *--src;
+      /* Copy backward, with the direction flag set, so that the
+         overlapping tail of SRC is read before it is
+         overwritten.  The trailing bytes go first, then whole
+         doublewords down to DST. */
+      size_t words = size / 4;
+      size_t bytes = size % 4;
+      void *d = dst + size - 1;
+      const void *s = src + size - 1;
+
+      asm volatile ("std; rep movsb; subl $3, %%edi; subl $3, %%esi; "
+                    "movl %3, %%ecx; rep movsl; cld"
+                    : "+D" (d), "+S" (s), "+c" (bytes)
+                    : "rm" (words)
+                    : "memory", "cc");
     }
 
-  return dst;
+  return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -58,6 +108,14 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* Skip equal words.  Both blocks are SIZE bytes long, so x86's
+     unaligned loads are safe here; the byte loop finds the
+     difference within the first unequal word. */
+  for (; size >= sizeof (word_t); a += sizeof (word_t), b += sizeof (word_t),
+         size -= sizeof (word_t))
+    if (*(const uword_t *) a != *(const uword_t *) b)
+      break;
+
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -78,6 +136,23 @@ strcmp (const char *a_, const char *b_)
   ASSERT (a != NULL);
   ASSERT (b != NULL);
 
+  /* If A and B are equally misaligned, compare bytes up to a word
+     boundary, then whole words until they differ or A's holds a
+     null terminator.  Otherwise a word read from the misaligned
+     one could cross into an unmapped page. */
+  if ((((uintptr_t) a ^ (uintptr_t) b) & (sizeof (word_t) - 1)) == 0)
+    {
+      for (; !is_word_aligned (a); a++, b++)
+        if (*a == '\0' || *a != *b)
+          return *a < *b ? -1 : *a > *b;
+      while (*(const word_t *) a == *(const word_t *) b
+             && !has_zero_byte (*(const word_t *) a))
+        {
+          a += sizeof (word_t);
+          b += sizeof (word_t);
+        }
+    }
+
   while (*a != '\0' && *a == *b) 
     {
       a++;
@@ -95,9 +170,20 @@ memchr (const void *block_, int ch_, size_t size)
 {
   const unsigned char *block = block_;
   unsigned char ch = ch_;
+  uint32_t pattern = ch * 0x01010101u;
 
   ASSERT (block != NULL || size == 0);
 
+  for (; size > 0 && !is_word_aligned (block); size--, block++)
+    if (*block == ch)
+      return (void *) block;
+
+  /* A word holds CH if it XOR PATTERN has a zero byte. */
+  for (; size >= sizeof (word_t); size -= sizeof (word_t),
+         block += sizeof (word_t))
+    if (has_zero_byte (*(const word_t *) block ^ pattern))
+      break;
+
   for (; size-- > 0; block++)
     if (*block == ch)
       return (void *) block;
@@ -278,12 +364,16 @@ strtok_r (char *s, const char *delimiters, char **save_ptr)
 void *
 memset (void *dst_, int value, size_t size) 
 {
-  unsigned char *dst = dst_;
+  void *dst = dst_;
+  size_t words = size / 4;
+  size_t bytes = size % 4;
 
   ASSERT (dst != NULL || size == 0);
-  
-  while (size-- > 0)
-    *dst++ = value;
+
+  asm volatile ("rep stosl; movl %3, %%ecx; rep stosb"
+                : "+D" (dst), "+c" (words)
+                : "a" ((unsigned char) value * 0x01010101u), "rm" (bytes)
+                : "memory");
 
   return dst_;
 }
@@ -296,7 +386,12 @@ strlen (const char *string)
 
   ASSERT (string != NULL);
 
-  for (p = string; *p != '\0'; p++)
+  for (p = string; !is_word_aligned (p); p++)
+    if (*p == '\0')
+      return p - string;
+  while (!has_zero_byte (*(const word_t *) p))
+    p += sizeof (word_t);
+  for (; *p != '\0'; p++)
     continue;
   return p - string;
 }
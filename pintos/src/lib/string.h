@@ -25,6 +25,46 @@ size_t strlcat (char *, const char *, size_t);
 char *strtok_r (char *, const char *, char **);
 size_t strnlen (const char *, size_t);
 
+/* Inline versions of memcpy() and memset() for sizes that are
+   known at compile time to be a multiple of 4 and at least
+   MEM_INLINE_MIN, such as BLOCK_SECTOR_SIZE and PGSIZE.  These
+   move a doubleword at a time with no remainder to handle and
+   no call overhead.  Smaller constant sizes are left to the
+   compiler, which expands them as plain moves. */
+#define MEM_INLINE_MIN 64
+
+static inline void *
+memcpy_words (void *dst, const void *src, size_t words) 
+{
+  void *d = dst;
+
+  asm volatile ("rep movsl" : "+D" (d), "+S" (src), "+c" (words)
+                : : "memory");
+  return dst;
+}
+
+static inline void *
+memset_words (void *dst, int value, size_t words) 
+{
+  void *d = dst;
+
+  asm volatile ("rep stosl" : "+D" (d), "+c" (words)
+                : "a" ((unsigned char) value * 0x01010101u) : "memory");
+  return dst;
+}
+
+#define MEM_INLINE_SIZE(SIZE)                                   \
+        (__builtin_constant_p (SIZE)                            \
+         && (SIZE) >= MEM_INLINE_MIN && (SIZE) % 4 == 0)
+#define memcpy(DST, SRC, SIZE)                                  \
+        (MEM_INLINE_SIZE (SIZE)                                 \
+         ? memcpy_words (DST, SRC, (SIZE) / 4)                  \
+         : memcpy (DST, SRC, SIZE))
+#define memset(DST, VALUE, SIZE)                                \
+        (MEM_INLINE_SIZE (SIZE)                                 \
+         ? memset_words (DST, VALUE, (SIZE) / 4)                \
+         : memset (DST, VALUE, SIZE))
+
 /* Try to be helpful. */
 #define strcpy dont_use_strcpy_use_strlcpy
 #define strncpy dont_use_strncpy_use_strlcpy
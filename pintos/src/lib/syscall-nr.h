@@ -28,7 +28,36 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_READV,                  /* Read into several buffers. */
+    SYS_WRITEV,                 /* Write from several buffers. */
+    SYS_SCHEDSTAT,              /* Report scheduling latency. */
+    SYS_FORK,                   /* Duplicate the current process. */
+    SYS_PIPE,                   /* Create a pipe. */
+    SYS_SPLICE,                 /* Move data between a pipe and a file. */
+    SYS_IO_SETUP,               /* Register asynchronous I/O rings. */
+    SYS_IO_ENTER,               /* Submit and complete asynchronous I/O. */
+    SYS_READDIR_BATCH,          /* Reads many directory entries. */
+    SYS_FALLOCATE,              /* Allocates space for a file. */
+    SYS_PREAD,                  /* Reads from a file at an offset. */
+    SYS_PWRITE,                 /* Writes to a file at an offset. */
+    SYS_SPAWN,                  /* Start a process with descriptors. */
+    SYS_PORT_CREATE,            /* Create a message port. */
+    SYS_MSG_SEND,               /* Send a message to a port. */
+    SYS_MSG_RECV,               /* Receive a message from a port. */
+    SYS_FUTEX_WAIT,             /* Wait on a word of memory. */
+    SYS_FUTEX_WAKE,             /* Wake waiters on a word of memory. */
+    SYS_SBRK,                   /* Move the end of the heap. */
+    SYS_POLL,                   /* Wait for descriptors to be ready. */
+    SYS_SHM_CREATE,             /* Create a shared memory segment. */
+    SYS_SHM_ATTACH,             /* Map a shared memory segment. */
+    SYS_SHM_DETACH,             /* Unmap a shared memory segment. */
+    SYS_SENDFILE,               /* Copy from a file to a descriptor. */
+    SYS_FAULTSTAT,              /* Report page fault statistics. */
+    SYS_STATS,                  /* Snapshot kernel statistics. */
+    SYS_TTYMODE                 /* Set the console input mode. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -0,0 +1,38 @@
+#ifndef __LIB_SYSENTER_H
+#define __LIB_SYSENTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Returns true if the CPU supports the SYSENTER and SYSEXIT
+   instructions.  The kernel sets up the fast system call entry,
+   and the user library uses it, exactly when this returns true,
+   so both must make the same test.  CPUID exists if EFLAGS.ID
+   (bit 21) can be changed.  The Pentium Pro reports the feature
+   but lacks it.  See [IA32-v2a] "CPUID--CPU Identification" and
+   [IA32-v2b] "SYSENTER--Fast System Call". */
+static inline bool
+cpu_has_sysenter (void)
+{
+  uint32_t flags, toggled, eax, ebx, ecx, edx;
+  unsigned family, model, stepping;
+
+  asm volatile ("pushfl; popl %0" : "=r" (flags));
+  asm volatile ("pushl %1; popfl; pushfl; popl %0"
+                : "=r" (toggled) : "r" (flags ^ 0x00200000) : "cc");
+  asm volatile ("pushl %0; popfl" : : "r" (flags) : "cc");
+  if (((flags ^ toggled) & 0x00200000) == 0)
+    return false;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  if ((edx & (1 << 11)) == 0)
+    return false;
+  family = (eax >> 8) & 0xf;
+  model = (eax >> 4) & 0xf;
+  stepping = eax & 0xf;
+  return !(family == 6 && model < 3 && stepping < 3);
+}
+
+#endif /* lib/sysenter.h */
@@ -0,0 +1,11 @@
+#ifndef __LIB_TTY_H
+#define __LIB_TTY_H
+
+/* Console input modes, for ttymode(). */
+#define TTY_RAW    0            /* Bytes as typed, no echo. */
+#define TTY_COOKED 1            /* Edited and echoed a line at a time. */
+
+/* Longest line that cooked mode holds, counting its new-line. */
+#define TTY_LINE_MAX 256
+
+#endif /* lib/tty.h */
@@ -0,0 +1,17 @@
+#ifndef __LIB_UIO_H
+#define __LIB_UIO_H
+
+#include <stddef.h>
+
+/* One buffer of a scatter/gather I/O request, as passed to the
+   readv() and writev() system calls. */
+struct iovec
+  {
+    void *iov_base;             /* Start of buffer. */
+    size_t iov_len;             /* Number of bytes in buffer. */
+  };
+
+/* Most buffers in one readv() or writev() request. */
+#define IOV_MAX 512
+
+#endif /* lib/uio.h */
@@ -54,7 +54,7 @@ struct vhprintf_aux
     int handle;         /* Output file handle. */
   };
 
-static void add_char (char, void *);
+static void add_chars (const char *, size_t, void *);
 static void flush (struct vhprintf_aux *);
 
 /* Formats the printf() format specification FORMAT with
@@ -67,21 +67,31 @@ vhprintf (int handle, const char *format, va_list args)
   aux.p = aux.buf;
   aux.char_cnt = 0;
   aux.handle = handle;
-  __vprintf (format, args, add_char, &aux);
+  __vprintf_runs (format, args, add_chars, &aux);
   flush (&aux);
   return aux.char_cnt;
 }
 
-/* Adds C to the buffer in AUX, flushing it if the buffer fills
-   up. */
+/* Adds the N characters in RUN to the buffer in AUX, flushing it
+   as it fills up. */
 static void
-add_char (char c, void *aux_) 
+add_chars (const char *run, size_t n, void *aux_) 
 {
   struct vhprintf_aux *aux = aux_;
-  *aux->p++ = c;
-  if (aux->p >= aux->buf + sizeof aux->buf)
-    flush (aux);
-  aux->char_cnt++;
+
+  aux->char_cnt += n;
+  while (n > 0)
+    {
+      size_t room = aux->buf + sizeof aux->buf - aux->p;
+      size_t chunk = n < room ? n : room;
+
+      memcpy (aux->p, run, chunk);
+      aux->p += chunk;
+      run += chunk;
+      n -= chunk;
+      if (aux->p >= aux->buf + sizeof aux->buf)
+        flush (aux);
+    }
 }
 
 /* Flushes the buffer in AUX. */
@@ -6,5 +6,6 @@ void _start (int argc, char *argv[]);
 void
 _start (int argc, char *argv[]) 
 {
+  select_syscall_entry ();
   exit (main (argc, argv));
 }
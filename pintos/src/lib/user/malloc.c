@@ -0,0 +1,207 @@
+#include <malloc.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+/* A heap allocator for user programs, on top of sbrk().
+
+   Blocks of up to CLASS_MAX bytes, counting an 8-byte header, come
+   in power-of-2 size classes starting at CLASS_MIN.  Each class
+   keeps a list of free blocks, so malloc() and free() of a small
+   block are a few instructions, and refills the list from the heap
+   CHUNK_SIZE bytes at a time.  Freed blocks stay with their class.
+
+   Larger blocks are taken from the heap individually, rounded up
+   to a multiple of BIG_ALIGN, and kept on a single free list when
+   freed, to be reused first fit.
+
+   A process has just one thread, so the class lists need no
+   locking. */
+
+#define CLASS_MIN 16                    /* Smallest block, a power of 2. */
+#define CLASS_MAX 2048                  /* Largest class block. */
+#define CLASS_CNT 8                     /* Classes from 16 to 2048. */
+#define CHUNK_SIZE 4096                 /* Heap taken per refill. */
+#define BIG_ALIGN 16                    /* Big block size granularity. */
+
+/* Header in front of each block. */
+struct header
+  {
+    size_t size;                        /* Block size, header included. */
+    uint32_t pad;                       /* Keeps payloads 8-byte aligned. */
+  };
+
+/* A free block, overlaid on its payload. */
+struct free_block
+  {
+    struct free_block *next;            /* Next free block. */
+  };
+
+static struct free_block *free_lists[CLASS_CNT];
+static struct free_block *big_list;
+
+static void *big_alloc (size_t size);
+static bool refill (int class);
+
+/* Returns the class of a block of SIZE bytes, which must be at
+   most CLASS_MAX. */
+static inline int
+size_class (size_t size)
+{
+  int class = 0;
+  size_t block = CLASS_MIN;
+
+  while (block < size)
+    {
+      block *= 2;
+      class++;
+    }
+  return class;
+}
+
+/* Returns a block of at least SIZE bytes, or a null pointer if SIZE
+   is 0 or the heap cannot grow. */
+void *
+malloc (size_t size)
+{
+  struct free_block *b;
+  struct header *h;
+  int class;
+
+  if (size == 0 || size > SIZE_MAX - sizeof *h - BIG_ALIGN)
+    return NULL;
+  size += sizeof *h;
+  if (size > CLASS_MAX)
+    return big_alloc (size);
+
+  class = size_class (size);
+  if (free_lists[class] == NULL && !refill (class))
+    return NULL;
+  b = free_lists[class];
+  free_lists[class] = b->next;
+  h = (struct header *) b;
+  h->size = (size_t) CLASS_MIN << class;
+  return h + 1;
+}
+
+/* Returns a zeroed block of A times B bytes, or a null pointer if
+   that overflows or the heap cannot grow. */
+void *
+calloc (size_t a, size_t b)
+{
+  void *p;
+
+  if (b != 0 && a > SIZE_MAX / b)
+    return NULL;
+  p = malloc (a * b);
+  if (p != NULL)
+    memset (p, 0, a * b);
+  return p;
+}
+
+/* Resizes block OLD to NEW_SIZE bytes, moving it if necessary, and
+   returns its new location, or a null pointer, leaving OLD alone, if
+   the heap cannot grow.  A null OLD is like malloc(), and a
+   NEW_SIZE of 0 like free(). */
+void *
+realloc (void *old, size_t new_size)
+{
+  struct header *h;
+  void *new;
+
+  if (old == NULL)
+    return malloc (new_size);
+  if (new_size == 0)
+    {
+      free (old);
+      return NULL;
+    }
+
+  h = (struct header *) old - 1;
+  if (new_size <= h->size - sizeof *h)
+    return old;
+  new = malloc (new_size);
+  if (new != NULL)
+    {
+      memcpy (new, old, h->size - sizeof *h);
+      free (old);
+    }
+  return new;
+}
+
+/* Frees block P, which must have come from malloc(), calloc(), or
+   realloc() and not been freed since.  Does nothing if P is
+   null. */
+void
+free (void *p)
+{
+  struct header *h;
+  struct free_block *b;
+
+  if (p == NULL)
+    return;
+  h = (struct header *) p - 1;
+  b = (struct free_block *) h;
+  if (h->size <= CLASS_MAX)
+    {
+      int class = size_class (h->size);
+      b->next = free_lists[class];
+      free_lists[class] = b;
+    }
+  else
+    {
+      /* Keep the size, which big_alloc() looks at, in the header,
+         and the link after it. */
+      ((struct free_block *) (h + 1))->next = big_list;
+      big_list = (struct free_block *) h;
+    }
+}
+
+/* Returns a block of SIZE bytes, header included, for a request
+   too big for the size classes. */
+static void *
+big_alloc (size_t size)
+{
+  struct free_block **bp;
+  struct header *h;
+
+  size = ROUND_UP (size, BIG_ALIGN);
+  for (bp = &big_list; *bp != NULL;
+       bp = &((struct free_block *) ((struct header *) *bp + 1))->next)
+    {
+      h = (struct header *) *bp;
+      if (h->size >= size)
+        {
+          *bp = ((struct free_block *) (h + 1))->next;
+          return h + 1;
+        }
+    }
+
+  h = sbrk (size);
+  if (h == (void *) -1)
+    return NULL;
+  h->size = size;
+  return h + 1;
+}
+
+/* Carves a chunk of new heap into free blocks of CLASS.  Returns
+   false if the heap cannot grow. */
+static bool
+refill (int class)
+{
+  size_t block = (size_t) CLASS_MIN << class;
+  uint8_t *chunk = sbrk (CHUNK_SIZE);
+  size_t ofs;
+
+  if (chunk == (void *) -1)
+    return false;
+  for (ofs = CHUNK_SIZE; ofs >= block; ofs -= block)
+    {
+      struct free_block *b = (struct free_block *) (chunk + ofs - block);
+      b->next = free_lists[class];
+      free_lists[class] = b;
+    }
+  return true;
+}
@@ -1,31 +1,73 @@
 #include <syscall.h>
+#include <sysenter.h>
 #include "../syscall-nr.h"
 
+/* System call entry.
+
+   A system call pushes its arguments and then its number on the
+   stack and calls through syscall_entry, which points to one of
+   the stubs below.  Both pop the return address into %edx and
+   leave the number on top of the stack for the kernel.
+   syscall_int_stub traps with `int $0x30' and jumps back.
+   syscall_sysenter_stub passes the stack pointer in %ecx to
+   SYSENTER, and the kernel's SYSEXIT returns straight to %edx,
+   skipping the interrupt gate and IRET.  Either way %ecx, %edx,
+   and the flags are clobbered, and the return value is in %eax.
+
+   select_syscall_entry() switches to SYSENTER at startup if the
+   CPU supports it, which is exactly when the kernel sets it up. */
+void syscall_int_stub (void);
+void syscall_sysenter_stub (void);
+asm (".globl syscall_int_stub\n"
+     "syscall_int_stub:\n"
+     "\tpopl %edx\n"
+     "\tint $0x30\n"
+     "\tjmp *%edx\n"
+     ".globl syscall_sysenter_stub\n"
+     "syscall_sysenter_stub:\n"
+     "\tpopl %edx\n"
+     "\tmovl %esp, %ecx\n"
+     "\tsysenter\n");
+
+static void (*syscall_entry) (void) = syscall_int_stub;
+
+/* Uses SYSENTER for system calls from now on if the CPU has it.
+   Called by _start() before main(). */
+void
+select_syscall_entry (void)
+{
+  if (cpu_has_sysenter ())
+    syscall_entry = syscall_sysenter_stub;
+}
+
 /* Invokes syscall NUMBER, passing no arguments, and returns the
    return value as an `int'. */
 #define syscall0(NUMBER)                                        \
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
-            ("pushl %[number]; int $0x30; addl $4, %%esp"       \
+            ("pushl %[number]; call *%[entry]; addl $4, %%esp"  \
                : "=a" (retval)                                  \
-               : [number] "i" (NUMBER)                          \
-               : "memory");                                     \
+               : [number] "i" (NUMBER),                         \
+                 [entry] "m" (syscall_entry)                    \
+               : "ecx", "edx", "cc", "memory");                 \
           retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing argument ARG0, and returns the
    return value as an `int'. */
-#define syscall1(NUMBER, ARG0)                                           \
-        ({                                                               \
-          int retval;                                                    \
-          asm volatile                                                   \
-            ("pushl %[arg0]; pushl %[number]; int $0x30; addl $8, %%esp" \
-               : "=a" (retval)                                           \
-               : [number] "i" (NUMBER),                                  \
-                 [arg0] "g" (ARG0)                                       \
-               : "memory");                                              \
-          retval;                                                        \
+#define syscall1(NUMBER, ARG0)                                  \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg0]; pushl %[number]; "                 \
+             "call *%[entry]; addl $8, %%esp"                   \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [entry] "m" (syscall_entry),                   \
+                 [arg0] "g" (ARG0)                              \
+               : "ecx", "edx", "cc", "memory");                 \
+          retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing arguments ARG0 and ARG1, and
@@ -35,12 +77,13 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg1]; pushl %[arg0]; "                   \
-             "pushl %[number]; int $0x30; addl $12, %%esp"      \
+             "pushl %[number]; call *%[entry]; addl $12, %%esp" \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
+                 [entry] "m" (syscall_entry),                   \
                  [arg0] "g" (ARG0),                             \
                  [arg1] "g" (ARG1)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "cc", "memory");                 \
           retval;                                               \
         })
 
@@ -51,13 +94,34 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg2]; pushl %[arg1]; pushl %[arg0]; "    \
-             "pushl %[number]; int $0x30; addl $16, %%esp"      \
+             "pushl %[number]; call *%[entry]; addl $16, %%esp" \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
+                 [entry] "m" (syscall_entry),                   \
                  [arg0] "g" (ARG0),                             \
                  [arg1] "g" (ARG1),                             \
                  [arg2] "g" (ARG2)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "cc", "memory");                 \
+          retval;                                               \
+        })
+
+/* Invokes syscall NUMBER, passing arguments ARG0, ARG1, ARG2, and
+   ARG3, and returns the return value as an `int'. */
+#define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg3]; pushl %[arg2]; pushl %[arg1]; "    \
+             "pushl %[arg0]; pushl %[number]; "                 \
+             "call *%[entry]; addl $20, %%esp"                  \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [entry] "m" (syscall_entry),                   \
+                 [arg0] "g" (ARG0),                             \
+                 [arg1] "g" (ARG1),                             \
+                 [arg2] "g" (ARG2),                             \
+                 [arg3] "g" (ARG3)                              \
+               : "ecx", "edx", "cc", "memory");                 \
           retval;                                               \
         })
 
@@ -182,3 +246,165 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+readv (int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall3 (SYS_READV, fd, iov, iovcnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall3 (SYS_WRITEV, fd, iov, iovcnt);
+}
+
+void
+schedstat (struct schedstat *stat)
+{
+  syscall1 (SYS_SCHEDSTAT, stat);
+}
+
+void
+faultstat (struct faultstat *stat)
+{
+  syscall1 (SYS_FAULTSTAT, stat);
+}
+
+int
+stats (struct kstat *k, unsigned size)
+{
+  return syscall2 (SYS_STATS, k, size);
+}
+
+int
+ttymode (int mode)
+{
+  return syscall1 (SYS_TTYMODE, mode);
+}
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+int
+pipe (int fds[2])
+{
+  return syscall1 (SYS_PIPE, fds);
+}
+
+int
+splice (int fd_in, int fd_out, unsigned size)
+{
+  return syscall3 (SYS_SPLICE, fd_in, fd_out, size);
+}
+
+int
+io_setup (struct io_ring *ring)
+{
+  return syscall1 (SYS_IO_SETUP, ring);
+}
+
+int
+io_enter (unsigned to_submit, unsigned min_complete)
+{
+  return syscall2 (SYS_IO_ENTER, to_submit, min_complete);
+}
+
+int
+readdir_batch (int fd, struct dirent *ents, unsigned size)
+{
+  return syscall3 (SYS_READDIR_BATCH, fd, ents, size);
+}
+
+bool
+fallocate (int fd, unsigned offset, unsigned length)
+{
+  return syscall3 (SYS_FALLOCATE, fd, offset, length);
+}
+
+int
+pread (int fd, void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_PREAD, fd, buffer, size, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_PWRITE, fd, buffer, size, offset);
+}
+
+pid_t
+spawn (const char *cmd_line, const struct spawn_fd *fds, unsigned fd_cnt)
+{
+  return (pid_t) syscall3 (SYS_SPAWN, cmd_line, fds, fd_cnt);
+}
+
+int
+port_create (void)
+{
+  return syscall0 (SYS_PORT_CREATE);
+}
+
+int
+msg_send (int fd, const void *buffer, unsigned size)
+{
+  return syscall3 (SYS_MSG_SEND, fd, buffer, size);
+}
+
+int
+msg_recv (int fd, void *buffer, unsigned size)
+{
+  return syscall3 (SYS_MSG_RECV, fd, buffer, size);
+}
+
+int
+futex_wait (unsigned *addr, unsigned val)
+{
+  return syscall2 (SYS_FUTEX_WAIT, addr, val);
+}
+
+int
+futex_wake (unsigned *addr, int cnt)
+{
+  return syscall2 (SYS_FUTEX_WAKE, addr, cnt);
+}
+
+void *
+sbrk (int increment)
+{
+  return (void *) syscall1 (SYS_SBRK, increment);
+}
+
+int
+poll (struct pollfd *fds, unsigned cnt, int timeout)
+{
+  return syscall3 (SYS_POLL, fds, cnt, timeout);
+}
+
+int
+shm_create (unsigned size)
+{
+  return syscall1 (SYS_SHM_CREATE, size);
+}
+
+bool
+shm_attach (int shmid, void *addr)
+{
+  return syscall2 (SYS_SHM_ATTACH, shmid, addr);
+}
+
+bool
+shm_detach (void *addr)
+{
+  return syscall1 (SYS_SHM_DETACH, addr);
+}
+
+int
+sendfile (int out_fd, int in_fd, int offset, unsigned size)
+{
+  return syscall4 (SYS_SENDFILE, out_fd, in_fd, offset, size);
+}
@@ -3,6 +3,15 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <dirent.h>
+#include <faultstat.h>
+#include <kstat.h>
+#include <ioring.h>
+#include <poll.h>
+#include <schedstat.h>
+#include <spawn.h>
+#include <tty.h>
+#include <uio.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -19,6 +28,9 @@ typedef int mapid_t;
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
 
+/* System call entry, chosen by _start(). */
+void select_syscall_entry (void);
+
 /* Projects 2 and later. */
 void halt (void) NO_RETURN;
 void exit (int status) NO_RETURN;
@@ -45,4 +57,33 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+int readv (int fd, const struct iovec *, int iovcnt);
+int writev (int fd, const struct iovec *, int iovcnt);
+void schedstat (struct schedstat *);
+void faultstat (struct faultstat *);
+int stats (struct kstat *, unsigned size);
+int ttymode (int mode);
+pid_t fork (void);
+int pipe (int fds[2]);
+int splice (int fd_in, int fd_out, unsigned size);
+int io_setup (struct io_ring *);
+int io_enter (unsigned to_submit, unsigned min_complete);
+int readdir_batch (int fd, struct dirent *, unsigned size);
+bool fallocate (int fd, unsigned offset, unsigned length);
+int pread (int fd, void *buffer, unsigned size, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned size, unsigned offset);
+pid_t spawn (const char *cmd_line, const struct spawn_fd *, unsigned fd_cnt);
+int port_create (void);
+int msg_send (int fd, const void *buffer, unsigned size);
+int msg_recv (int fd, void *buffer, unsigned size);
+int futex_wait (unsigned *addr, unsigned val);
+int futex_wake (unsigned *addr, int cnt);
+void *sbrk (int increment);
+int poll (struct pollfd *, unsigned cnt, int timeout);
+int shm_create (unsigned size);
+bool shm_attach (int shmid, void *addr);
+bool shm_detach (void *addr);
+int sendfile (int out_fd, int in_fd, int offset, unsigned size);
+
 #endif /* lib/user/syscall.h */
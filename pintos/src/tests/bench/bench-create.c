@@ -0,0 +1,32 @@
+/* Measures thread_create() and thread_exit(): each new thread
+   has a higher priority than the creator, so it runs and exits
+   before thread_create() returns. */
+
+#include "tests/bench/bench.h"
+#include "tests/threads/tests.h"
+#include "threads/thread.h"
+
+#define THREAD_CNT 2000
+
+static thread_func exit_thread;
+
+void
+test_bench_create (void) 
+{
+  uint64_t start;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  start = rdtsc ();
+  for (i = 0; i < THREAD_CNT; i++)
+    thread_create ("exit", PRI_DEFAULT + 1, exit_thread, NULL);
+  bench_report ("thread_create/thread_exit pairs", THREAD_CNT,
+                rdtsc () - start);
+}
+
+static void
+exit_thread (void *aux UNUSED) 
+{
+}
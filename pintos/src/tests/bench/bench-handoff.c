@@ -0,0 +1,49 @@
+/* Measures a context switch like bench-switch, but with each
+   thread handing the CPU straight to the other through
+   sema_up_handoff().  Each round trip is two switches. */
+
+#include "tests/bench/bench.h"
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define ROUND_TRIPS 10000
+
+static struct semaphore ping, pong;
+static thread_func pong_thread;
+
+void
+test_bench_handoff (void) 
+{
+  uint64_t start;
+  int i;
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  thread_create ("pong", thread_get_priority (), pong_thread, NULL);
+
+  /* One unmeasured round trip lets "pong" get going. */
+  sema_up_handoff (&ping);
+  sema_down (&pong);
+
+  start = rdtsc ();
+  for (i = 0; i < ROUND_TRIPS; i++) 
+    {
+      sema_up_handoff (&ping);
+      sema_down (&pong);
+    }
+  bench_report ("handoff context switches", 2 * ROUND_TRIPS,
+                rdtsc () - start);
+}
+
+static void
+pong_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i <= ROUND_TRIPS; i++) 
+    {
+      sema_down (&ping);
+      sema_up_handoff (&pong);
+    }
+}
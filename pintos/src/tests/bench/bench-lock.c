@@ -0,0 +1,47 @@
+/* Measures a contended lock: several threads of the same
+   priority take turns acquiring one lock, each yielding while it
+   holds the lock so that the others block waiting for it. */
+
+#include "tests/bench/bench.h"
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define THREAD_CNT 4
+#define ITERATIONS 2000
+
+static struct lock lock;
+static struct semaphore done;
+static thread_func locker_thread;
+
+void
+test_bench_lock (void) 
+{
+  uint64_t start;
+  int i;
+
+  lock_init (&lock);
+  sema_init (&done, 0);
+
+  start = rdtsc ();
+  for (i = 0; i < THREAD_CNT; i++)
+    thread_create ("locker", thread_get_priority (), locker_thread, NULL);
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+  bench_report ("contended lock_acquire/lock_release pairs",
+                THREAD_CNT * ITERATIONS, rdtsc () - start);
+}
+
+static void
+locker_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++) 
+    {
+      lock_acquire (&lock);
+      thread_yield ();
+      lock_release (&lock);
+    }
+  sema_up (&done);
+}
@@ -0,0 +1,123 @@
+/* Measures the kernel heap: malloc() and free() for each of
+   malloc's block sizes, random churn of mixed sizes, and
+   multi-page allocations from malloc() and palloc.  Then prints
+   the state the churn left the allocators in. */
+
+#include <random.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "tests/bench/bench.h"
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+#define BLOCK_CNT 256           /* Blocks per size class. */
+#define CHURN_SLOTS 512         /* Live blocks at most during churn. */
+#define CHURN_OPS 20000         /* malloc() or free() calls in churn. */
+#define CHURN_MAX 3000          /* Largest churn request, in bytes. */
+#define BIG_CNT 64              /* Allocations per multi-page size. */
+#define BIG_PAGES_MAX 16        /* Largest multi-page size, in pages. */
+
+static void *blocks[CHURN_SLOTS];
+
+static void
+size_classes (void) 
+{
+  size_t size;
+
+  for (size = 16; size < PGSIZE / 2; size *= 2) 
+    {
+      uint64_t start, malloc_cycles;
+      char what[48];
+      int i;
+
+      start = rdtsc ();
+      for (i = 0; i < BLOCK_CNT; i++)
+        if ((blocks[i] = malloc (size)) == NULL)
+          fail ("malloc (%zu) failed", size);
+      malloc_cycles = rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < BLOCK_CNT; i++)
+        free (blocks[i]);
+
+      snprintf (what, sizeof what, "free (%zu-byte block)", size);
+      bench_report (what, BLOCK_CNT, rdtsc () - start);
+      snprintf (what, sizeof what, "malloc (%zu)", size);
+      bench_report (what, BLOCK_CNT, malloc_cycles);
+    }
+}
+
+static void
+churn (void) 
+{
+  uint64_t start;
+  int i;
+
+  random_init (0);
+  start = rdtsc ();
+  for (i = 0; i < CHURN_OPS; i++) 
+    {
+      void **slot = &blocks[random_ulong () % CHURN_SLOTS];
+
+      if (*slot != NULL) 
+        {
+          free (*slot);
+          *slot = NULL;
+        }
+      else if ((*slot = malloc (random_ulong () % CHURN_MAX + 1)) == NULL)
+        fail ("malloc failed during churn");
+    }
+  bench_report ("mixed-size malloc or free", CHURN_OPS, rdtsc () - start);
+}
+
+static void
+big_blocks (void) 
+{
+  size_t page_cnt;
+
+  for (page_cnt = 1; page_cnt <= BIG_PAGES_MAX; page_cnt *= 2) 
+    {
+      uint64_t start;
+      char what[48];
+      int i;
+
+      start = rdtsc ();
+      for (i = 0; i < BIG_CNT; i++)
+        if ((blocks[i] = palloc_get_multiple (0, page_cnt)) == NULL)
+          fail ("palloc_get_multiple (%zu) failed", page_cnt);
+      for (i = 0; i < BIG_CNT; i++)
+        palloc_free_multiple (blocks[i], page_cnt);
+      snprintf (what, sizeof what, "%zu-page palloc and free", page_cnt);
+      bench_report (what, BIG_CNT, rdtsc () - start);
+
+      start = rdtsc ();
+      for (i = 0; i < BIG_CNT; i++)
+        if ((blocks[i] = malloc (page_cnt * PGSIZE)) == NULL)
+          fail ("malloc (%zu) failed", page_cnt * PGSIZE);
+      for (i = 0; i < BIG_CNT; i++)
+        free (blocks[i]);
+      snprintf (what, sizeof what, "%zu-page malloc and free", page_cnt);
+      bench_report (what, BIG_CNT, rdtsc () - start);
+    }
+}
+
+void
+test_bench_malloc (void) 
+{
+  int i;
+
+  size_classes ();
+  big_blocks ();
+
+  churn ();
+  msg ("Allocator state after churn:");
+  malloc_print_stats ();
+  palloc_print_stats ();
+  for (i = 0; i < CHURN_SLOTS; i++) 
+    {
+      free (blocks[i]);
+      blocks[i] = NULL;
+    }
+}
@@ -0,0 +1,376 @@
+/* Runs a fixed mix of threads for a while under whichever
+   scheduler the kernel was booted with, so that "make
+   sched-compare" can set the priority scheduler, the MLFQS, and
+   the fair-share scheduler side by side.  The mix has four kinds
+   of thread:
+
+   - CPU-bound threads, which only compute.
+
+   - I/O-bound threads, which sleep for a tick with timer_sleep()
+     and compute briefly each time they wake.
+
+   - Lock-heavy threads, which compute briefly while holding one
+     lock that they all share.
+
+   - A donation chain: thread I holds lock I while it acquires
+     lock I - 1, and runs at a priority higher than thread I - 1,
+     so that the priority scheduler donates down the chain.  Each
+     round it sleeps for a tick, so that the chain forms anew.
+
+   The test arguments set the number of threads of each kind and
+   the length of the run, as "cpu=N io=N lock=N chain=N secs=N",
+   each optional.  The report gives:
+
+   - Throughput: operations per second of each kind.
+
+   - Fairness: Jain's index, (sum x)**2 / (n * sum x**2), over the
+     number of ticks each CPU-bound thread ran in, counted as in
+     mlfqs-fair.  It is 1 if they all got the same share and 1/n
+     if one got everything.
+
+   - Wakeup latency: the median, 99th percentile, and worst time
+     from a thread being woken to its running, from the scheduling
+     latency histograms, and the worst lateness, in ticks, of an
+     I/O-bound thread's timer_sleep().
+
+   - Scheduler overhead: the CPU time that went neither to the
+     threads' computation nor to the idle thread, which covers
+     interrupts, context switches, scheduling decisions, and lock
+     and sleep bookkeeping, converted to ticks. */
+
+#include <inttypes.h>
+#include <kstat.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tests/bench/bench.h"
+#include "tests/threads/tests.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Most threads of one kind. */
+#define KIND_MAX 16
+
+/* Upper limit on the length of the donation chain, as in
+   priority-donate-chain. */
+#define CHAIN_MAX 7
+
+#define GAP_CYCLES 1000         /* Shortest gap that is time away. */
+#define SETTLE_TICKS 10         /* Ticks for the threads to start. */
+
+/* Work units per operation of each kind. */
+#define CPU_WORK 1000
+#define IO_WORK 200
+#define LOCK_WORK 50
+#define CHAIN_WORK 200
+
+/* Kinds of thread. */
+enum kind
+  {
+    CPU,
+    IO,
+    LOCK,
+    CHAIN,
+    KIND_CNT
+  };
+
+static const char *kind_names[KIND_CNT] = {"cpu", "io", "lock", "chain"};
+
+/* One thread of the mix. */
+struct worker
+  {
+    enum kind kind;             /* Kind of thread. */
+    int idx;                    /* Index among its kind. */
+    uint64_t ops;               /* Operations completed. */
+    uint64_t busy;              /* Cycles spent computing. */
+    int tick_cnt;               /* Ticks it ran in. */
+    int64_t last_tick;          /* Last tick it ran in. */
+    int64_t late_max;           /* Worst timer_sleep() lateness. */
+  };
+
+static struct worker workers[KIND_CNT][KIND_MAX];
+static int counts[KIND_CNT] = {4, 4, 4, 4};
+static int run_secs = 10;
+
+static int64_t start_tick, end_tick;
+static struct lock shared_lock;
+static struct lock chain_locks[CHAIN_MAX];
+static struct semaphore done;
+
+/* Kernel statistics at the start and end of the run.  Too big for
+   the stack. */
+static struct kstat before, after;
+
+static thread_func worker_thread;
+static void parse_args (void);
+static void report (uint64_t window);
+static void report_latency (void);
+
+void
+test_bench_sched (void)
+{
+  uint64_t tsc_start, tsc_end;
+  int kind, i, total = 0;
+
+  parse_args ();
+  lock_init (&shared_lock);
+  for (i = 0; i < CHAIN_MAX; i++)
+    lock_init (&chain_locks[i]);
+  sema_init (&done, 0);
+
+  msg ("Scheduler: %s.",
+       thread_mlfqs ? "mlfqs" : thread_cfs ? "cfs" : "priority");
+  msg ("Running %d cpu, %d io, %d lock, and %d chain threads "
+       "for %d seconds.",
+       counts[CPU], counts[IO], counts[LOCK], counts[CHAIN], run_secs);
+
+  /* Stay ahead of the workers, to wake up on time. */
+  if (thread_mlfqs)
+    thread_set_nice (NICE_MIN);
+  else
+    {
+      thread_set_priority (PRI_MAX);
+      if (thread_cfs)
+        thread_set_nice (NICE_MIN);
+    }
+
+  start_tick = timer_ticks () + SETTLE_TICKS;
+  end_tick = start_tick + (int64_t) run_secs * TIMER_FREQ;
+  for (kind = 0; kind < KIND_CNT; kind++)
+    for (i = 0; i < counts[kind]; i++)
+      {
+        struct worker *w = &workers[kind][i];
+        int priority = PRI_DEFAULT;
+        char name[16];
+
+        w->kind = kind;
+        w->idx = i;
+        if (kind == CHAIN)
+          priority = PRI_DEFAULT + 1 + i;
+        snprintf (name, sizeof name, "%s %d", kind_names[kind], i);
+        if (thread_create (name, priority, worker_thread, w) == TID_ERROR)
+          fail ("out of memory creating thread %s", name);
+        total++;
+      }
+
+  timer_sleep (start_tick - timer_ticks ());
+  tsc_start = rdtsc ();
+  thread_get_kstat (&before);
+  timer_sleep (end_tick - timer_ticks ());
+  tsc_end = rdtsc ();
+  thread_get_kstat (&after);
+
+  for (i = 0; i < total; i++)
+    sema_down (&done);
+  report (tsc_end - tsc_start);
+}
+
+/* Sets COUNTS and RUN_SECS from the test arguments. */
+static void
+parse_args (void)
+{
+  char args[128];
+  char *token, *save_ptr;
+
+  if (test_args == NULL)
+    return;
+  strlcpy (args, test_args, sizeof args);
+  for (token = strtok_r (args, " ", &save_ptr); token != NULL;
+       token = strtok_r (NULL, " ", &save_ptr))
+    {
+      char *value = strchr (token, '=');
+      int kind;
+
+      if (value == NULL)
+        fail ("bad argument \"%s\"", token);
+      *value++ = '\0';
+      if (!strcmp (token, "secs"))
+        {
+          run_secs = atoi (value);
+          if (run_secs < 1)
+            fail ("secs must be at least 1");
+          continue;
+        }
+      for (kind = 0; kind < KIND_CNT; kind++)
+        if (!strcmp (token, kind_names[kind]))
+          break;
+      if (kind == KIND_CNT)
+        fail ("unknown argument \"%s\"", token);
+      counts[kind] = atoi (value);
+      if (counts[kind] < 0
+          || counts[kind] > (kind == CHAIN ? CHAIN_MAX : KIND_MAX))
+        fail ("%s must be from 0 to %d", token,
+              kind == CHAIN ? CHAIN_MAX : KIND_MAX);
+    }
+}
+
+/* Computes for UNITS work units, adding the cycles spent to W's
+   busy time and counting the ticks W runs in.  A gap between two
+   readings of the time stamp counter longer than GAP_CYCLES is
+   time that W was not running. */
+static void
+work (struct worker *w, int units)
+{
+  uint64_t last = rdtsc ();
+  int i;
+
+  for (i = 0; i < units; i++)
+    {
+      uint64_t now = rdtsc ();
+      int64_t tick = timer_ticks ();
+
+      if (now - last < GAP_CYCLES)
+        w->busy += now - last;
+      if (tick != w->last_tick)
+        {
+          w->tick_cnt++;
+          w->last_tick = tick;
+        }
+      last = now;
+    }
+}
+
+static void
+worker_thread (void *w_)
+{
+  struct worker *w = w_;
+
+  timer_sleep (start_tick - timer_ticks ());
+  while (timer_ticks () < end_tick)
+    {
+      switch (w->kind)
+        {
+        case CPU:
+          work (w, CPU_WORK);
+          break;
+
+        case IO:
+          {
+            int64_t late;
+
+            timer_sleep (1);
+            late = timer_ticks () - thread_current ()->sleep_till;
+            if (late > w->late_max)
+              w->late_max = late;
+            work (w, IO_WORK);
+          }
+          break;
+
+        case LOCK:
+          lock_acquire (&shared_lock);
+          work (w, LOCK_WORK);
+          lock_release (&shared_lock);
+          break;
+
+        case CHAIN:
+          lock_acquire (&chain_locks[w->idx]);
+          if (w->idx > 0)
+            lock_acquire (&chain_locks[w->idx - 1]);
+          work (w, CHAIN_WORK);
+          if (w->idx > 0)
+            lock_release (&chain_locks[w->idx - 1]);
+          lock_release (&chain_locks[w->idx]);
+          timer_sleep (1);
+          break;
+
+        default:
+          NOT_REACHED ();
+        }
+      w->ops++;
+    }
+  sema_up (&done);
+}
+
+/* Reports the results of a run that took WINDOW cycles. */
+static void
+report (uint64_t window)
+{
+  int64_t window_ticks = end_tick - start_tick;
+  int64_t idle_ticks = after.idle_ticks - before.idle_ticks;
+  uint64_t busy = 0, idle, overhead;
+  uint64_t sum = 0, sum_sq = 0;
+  int64_t late_max = 0;
+  int kind, i;
+
+  for (kind = 0; kind < KIND_CNT; kind++)
+    {
+      uint64_t ops = 0;
+
+      if (counts[kind] == 0)
+        continue;
+      for (i = 0; i < counts[kind]; i++)
+        {
+          ops += workers[kind][i].ops;
+          busy += workers[kind][i].busy;
+        }
+      msg ("Throughput: %"PRIu64" %s ops/s.",
+           ops * TIMER_FREQ / window_ticks, kind_names[kind]);
+    }
+
+  for (i = 0; i < counts[CPU]; i++)
+    {
+      uint64_t x = workers[CPU][i].tick_cnt;
+      sum += x;
+      sum_sq += x * x;
+    }
+  if (sum_sq != 0)
+    {
+      uint64_t jain = sum * sum * 1000 / (counts[CPU] * sum_sq);
+      msg ("Fairness: Jain index %"PRIu64".%03"PRIu64" over %d cpu "
+           "threads.", jain / 1000, jain % 1000, counts[CPU]);
+    }
+
+  report_latency ();
+  for (i = 0; i < counts[IO]; i++)
+    if (workers[IO][i].late_max > late_max)
+      late_max = workers[IO][i].late_max;
+  if (counts[IO] > 0)
+    msg ("Latest io wakeup: %"PRId64" ticks late.", late_max);
+
+  /* Idle time is known only to the tick. */
+  idle = window * idle_ticks / window_ticks;
+  overhead = busy + idle < window ? window - busy - idle : 0;
+  msg ("Scheduler overhead: %"PRIu64" of %"PRId64" ticks "
+       "(%"PRIu64".%"PRIu64"%%), %"PRId64" ticks idle.",
+       overhead * window_ticks / window, window_ticks,
+       overhead * 100 / window, overhead * 1000 / window % 10, idle_ticks);
+}
+
+/* Reports the median, 99th percentile, and worst scheduling
+   latency during the run, over all classes of thread.  Each is
+   given as the upper bound of its histogram bucket. */
+static void
+report_latency (void)
+{
+  uint64_t buckets[SCHEDSTAT_BUCKETS];
+  uint64_t cnt = 0, seen = 0;
+  int p50 = -1, p99 = -1, worst = 0;
+  int c, b;
+
+  for (b = 0; b < SCHEDSTAT_BUCKETS; b++)
+    {
+      buckets[b] = 0;
+      for (c = 0; c < SCHEDSTAT_CLASS_CNT; c++)
+        buckets[b] += (after.sched.latency[c][b]
+                       - before.sched.latency[c][b]);
+      cnt += buckets[b];
+      if (buckets[b] != 0)
+        worst = b;
+    }
+  if (cnt == 0)
+    return;
+  for (b = 0; b < SCHEDSTAT_BUCKETS; b++)
+    {
+      seen += buckets[b];
+      if (p50 < 0 && seen * 2 >= cnt)
+        p50 = b;
+      if (p99 < 0 && seen * 100 >= cnt * 99)
+        p99 = b;
+    }
+  msg ("Wakeup latency over %"PRIu64" wakeups: median under %"PRIu64" ns, "
+       "p99 under %"PRIu64" ns, worst under %"PRIu64" ns.", cnt,
+       (uint64_t) 2 << p50, (uint64_t) 2 << p99, (uint64_t) 2 << worst);
+}
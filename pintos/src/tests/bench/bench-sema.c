@@ -0,0 +1,26 @@
+/* Measures an uncontended sema_up() and sema_down() pair, which
+   never blocks or switches threads. */
+
+#include "tests/bench/bench.h"
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+
+#define ROUND_TRIPS 100000
+
+void
+test_bench_sema (void) 
+{
+  struct semaphore sema;
+  uint64_t start;
+  int i;
+
+  sema_init (&sema, 0);
+  start = rdtsc ();
+  for (i = 0; i < ROUND_TRIPS; i++) 
+    {
+      sema_up (&sema);
+      sema_down (&sema);
+    }
+  bench_report ("sema_up/sema_down round trips", ROUND_TRIPS,
+                rdtsc () - start);
+}
@@ -0,0 +1,71 @@
+/* Measures timer_sleep() with many sleepers.  Most of the time
+   they are all asleep, so the time they take is found by
+   subtracting what is left over: a PRI_MIN thread spins reading
+   the time stamp counter, and any gap between two of its reads
+   longer than GAP_CYCLES was spent elsewhere, in the sleepers or
+   in the timer interrupt that wakes them. */
+
+#include <stdbool.h>
+#include "tests/bench/bench.h"
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define SLEEPER_CNT 32
+#define ITERATIONS 50
+#define GAP_CYCLES 1000
+
+static struct semaphore done;
+static volatile bool finished;
+static uint64_t stolen;
+static thread_func sleeper_thread, spinner_thread;
+
+void
+test_bench_sleep (void) 
+{
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&done, 0);
+  finished = false;
+  stolen = 0;
+
+  thread_create ("spinner", PRI_MIN, spinner_thread, NULL);
+  for (i = 0; i < SLEEPER_CNT; i++)
+    thread_create ("sleeper", PRI_DEFAULT, sleeper_thread, NULL);
+  for (i = 0; i < SLEEPER_CNT; i++)
+    sema_down (&done);
+
+  /* Let the spinner see FINISHED and report its total. */
+  finished = true;
+  sema_down (&done);
+  bench_report ("timer_sleep() calls", SLEEPER_CNT * ITERATIONS, stolen);
+}
+
+static void
+sleeper_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++)
+    timer_sleep (1);
+  sema_up (&done);
+}
+
+static void
+spinner_thread (void *aux UNUSED) 
+{
+  uint64_t last = rdtsc ();
+
+  while (!finished) 
+    {
+      uint64_t now = rdtsc ();
+      if (now - last > GAP_CYCLES)
+        stolen += now - last;
+      last = now;
+    }
+  sema_up (&done);
+}
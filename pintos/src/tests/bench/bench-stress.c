@@ -0,0 +1,197 @@
+/* Stresses the run queues and the sleep wheel with thousands of
+   threads at varied priorities, in three phases:
+
+   1. Every thread is asleep.  A PRI_MIN spinner reads the time
+      stamp counter in a loop; while nothing wakes up, each gap
+      between two reads longer than GAP_CYCLES is a timer
+      interrupt, and the gaps add up to the share of the CPU taken
+      by the timer and the scheduler.
+
+   2. The threads wake up over WAKE_SPREAD ticks and compare the
+      tick they run on with the `sleep_till' they asked for.
+
+   3. As many threads are ready to run at once, and the
+      highest-priority thread measures thread_yield() among them.
+
+   These need more memory than the other tests: see Make.tests. */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "tests/bench/bench.h"
+#include "tests/threads/tests.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define GAP_CYCLES 1000         /* Shortest gap charged to others. */
+#define SETTLE_TICKS 50         /* Ticks for the threads to fall asleep. */
+#define QUIET_TICKS 100         /* Ticks measured with no wakeups. */
+#define WAKE_SPREAD 100         /* Ticks over which the threads wake. */
+#define YIELD_CNT 1000          /* thread_yield() calls measured. */
+
+/* Wakeup latency histogram.  Bucket I counts wakeups 2**I - 1
+   to 2**(I+1) - 2 ticks late; the last one also counts anything
+   later. */
+#define LATENCY_BUCKETS 6
+
+static struct semaphore done, spinner_done;
+static volatile bool finished;
+
+/* Phase 1. */
+static int64_t quiet_start, quiet_end;
+static uint64_t quiet_first, quiet_last;
+static uint64_t quiet_cycles, quiet_interrupts, quiet_max;
+
+/* Phase 2. */
+static int64_t wake_base;
+static int latency[LATENCY_BUCKETS];
+static int64_t latency_max;
+
+static thread_func sleeper_thread, spinner_thread, ready_thread;
+static void stress (int thread_cnt);
+
+void
+test_bench_stress_1k (void) 
+{
+  stress (1000);
+}
+
+void
+test_bench_stress_10k (void) 
+{
+  stress (10000);
+}
+
+/* Returns the Ith of a spread of priorities between PRI_MIN and
+   PRI_MAX, exclusive. */
+static int
+varied_priority (int i) 
+{
+  return PRI_MIN + 1 + i % (PRI_MAX - PRI_MIN - 1);
+}
+
+static void
+stress (int thread_cnt) 
+{
+  uint64_t window, start;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Stay ahead of every thread created below. */
+  thread_set_priority (PRI_MAX);
+  sema_init (&done, 0);
+  sema_init (&spinner_done, 0);
+
+  /* Phase 1.  None of the threads runs until we sleep. */
+  msg ("Putting %d threads to sleep.", thread_cnt);
+  thread_create ("spinner", PRI_MIN, spinner_thread, NULL);
+  for (i = 0; i < thread_cnt; i++)
+    if (thread_create ("sleeper", varied_priority (i), sleeper_thread,
+                       (void *) (intptr_t) (i % WAKE_SPREAD)) == TID_ERROR)
+      fail ("out of memory creating thread %d", i);
+  quiet_start = timer_ticks () + SETTLE_TICKS;
+  quiet_end = quiet_start + QUIET_TICKS;
+  wake_base = quiet_end + SETTLE_TICKS;
+  timer_sleep (quiet_end - timer_ticks ());
+  finished = true;
+  sema_down (&spinner_done);
+
+  window = quiet_last - quiet_first;
+  msg ("%"PRIu64" timer interrupts with every thread asleep: "
+       "%"PRIu64" cycles/op, %"PRIu64" at most.",
+       quiet_interrupts,
+       quiet_interrupts != 0 ? quiet_cycles / quiet_interrupts : 0,
+       quiet_max);
+  if (window != 0)
+    msg ("Timer and scheduler took %"PRIu64".%"PRIu64"%% of the CPU.",
+         quiet_cycles * 100 / window, quiet_cycles * 1000 / window % 10);
+
+  /* Phase 2. */
+  for (i = 0; i < thread_cnt; i++)
+    sema_down (&done);
+  for (i = 0; i < LATENCY_BUCKETS; i++) 
+    {
+      int lo = (1 << i) - 1;
+      int hi = (1 << (i + 1)) - 2;
+
+      if (i == LATENCY_BUCKETS - 1)
+        msg ("%d wakeups %d or more ticks late.", latency[i], lo);
+      else if (lo == hi)
+        msg ("%d wakeups %d ticks late.", latency[i], lo);
+      else
+        msg ("%d wakeups %d to %d ticks late.", latency[i], lo, hi);
+    }
+  msg ("Latest wakeup: %"PRId64" ticks late.", latency_max);
+
+  /* Phase 3. */
+  for (i = 0; i < thread_cnt; i++)
+    if (thread_create ("ready", varied_priority (i), ready_thread, NULL)
+        == TID_ERROR)
+      fail ("out of memory creating thread %d", i);
+  start = rdtsc ();
+  for (i = 0; i < YIELD_CNT; i++)
+    thread_yield ();
+  bench_report ("thread_yield() calls with every thread ready",
+                YIELD_CNT, rdtsc () - start);
+
+  /* Let them all run and exit. */
+  thread_set_priority (PRI_MIN);
+  thread_set_priority (PRI_DEFAULT);
+}
+
+static void
+sleeper_thread (void *offset) 
+{
+  enum intr_level old_level;
+  int64_t late;
+  int bucket;
+
+  timer_sleep (wake_base + (intptr_t) offset - timer_ticks ());
+  late = timer_ticks () - thread_current ()->sleep_till;
+
+  for (bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++)
+    if (late < (1 << (bucket + 1)) - 1)
+      break;
+  old_level = intr_disable ();
+  latency[bucket]++;
+  if (late > latency_max)
+    latency_max = late;
+  intr_set_level (old_level);
+  sema_up (&done);
+}
+
+static void
+spinner_thread (void *aux UNUSED) 
+{
+  uint64_t last = rdtsc ();
+
+  while (!finished) 
+    {
+      uint64_t now = rdtsc ();
+      int64_t tick = timer_ticks ();
+
+      if (tick >= quiet_start && tick < quiet_end) 
+        {
+          if (quiet_first == 0)
+            quiet_first = now;
+          else if (now - last > GAP_CYCLES) 
+            {
+              quiet_cycles += now - last;
+              quiet_interrupts++;
+              if (now - last > quiet_max)
+                quiet_max = now - last;
+            }
+          quiet_last = now;
+        }
+      last = now;
+    }
+  sema_up (&spinner_done);
+}
+
+static void
+ready_thread (void *aux UNUSED) 
+{
+}
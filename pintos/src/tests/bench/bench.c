@@ -0,0 +1,14 @@
+#include "tests/bench/bench.h"
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "devices/timer.h"
+
+/* Reports that OPS repetitions of WHAT took CYCLES time stamp
+   counter cycles in all.  "make bench" collects these lines. */
+void
+bench_report (const char *what, unsigned ops, uint64_t cycles) 
+{
+  msg ("%u %s: %"PRIu64" cycles/op, %"PRIu64" ns/op", ops, what,
+       ops != 0 ? cycles / ops : 0,
+       ops != 0 ? clock_cycles_to_ns (cycles) / ops : 0);
+}
@@ -0,0 +1,9 @@
+#ifndef TESTS_BENCH_BENCH_H
+#define TESTS_BENCH_BENCH_H
+
+#include <stdint.h>
+#include "threads/tsc.h"
+
+void bench_report (const char *what, unsigned ops, uint64_t cycles);
+
+#endif /* tests/bench/bench.h */
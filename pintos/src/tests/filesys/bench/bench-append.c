@@ -0,0 +1,31 @@
+/* Appends many small records to a file, the way a log grows. */
+
+#include <syscall.h>
+#include "tests/filesys/bench/fsbench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define RECORD_SIZE 64
+#define RECORD_CNT 4096
+
+void
+test_main (void) 
+{
+  const char *file_name = "log";
+  char record[RECORD_SIZE];
+  uint64_t start;
+  int fd, i;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  start = rdtsc ();
+  for (i = 0; i < RECORD_CNT; i++) 
+    {
+      record[0] = i;
+      if (write (fd, record, RECORD_SIZE) != RECORD_SIZE)
+        fail ("append of record %d failed", i);
+    }
+  close (fd);
+  bench_report ("64-byte appends", RECORD_CNT, rdtsc () - start,
+                RECORD_CNT * RECORD_SIZE);
+}
@@ -0,0 +1,42 @@
+/* Creates many empty files in one directory, opens and closes
+   each of them, and removes them all again.  Every create, open,
+   and remove counts as one op. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/bench/fsbench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 500
+
+void
+test_main (void) 
+{
+  char file_name[16];
+  uint64_t start;
+  int fd, i;
+
+  start = rdtsc ();
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      snprintf (file_name, sizeof file_name, "file%d", i);
+      if (!create (file_name, 0))
+        fail ("create \"%s\" failed", file_name);
+    }
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      snprintf (file_name, sizeof file_name, "file%d", i);
+      if ((fd = open (file_name)) < 2)
+        fail ("open \"%s\" failed", file_name);
+      close (fd);
+    }
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      snprintf (file_name, sizeof file_name, "file%d", i);
+      if (!remove (file_name))
+        fail ("remove \"%s\" failed", file_name);
+    }
+  bench_report ("creates, opens, and removes", 3 * FILE_CNT,
+                rdtsc () - start, 0);
+}
@@ -0,0 +1,34 @@
+/* Reads single sectors of a file, in random order. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/filesys/bench/fsbench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define READ_SIZE 512
+#define READ_CNT 2048
+
+void
+test_main (void) 
+{
+  const char *file_name = "rand";
+  char block[READ_SIZE];
+  uint64_t start;
+  int fd, i;
+
+  fsbench_fill (file_name, FSBENCH_FILE_SIZE);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  start = rdtsc ();
+  for (i = 0; i < READ_CNT; i++) 
+    {
+      size_t ofs = random_ulong () % (FSBENCH_FILE_SIZE / READ_SIZE)
+                   * READ_SIZE;
+      seek (fd, ofs);
+      if (read (fd, block, READ_SIZE) != READ_SIZE)
+        fail ("read %d bytes at offset %zu failed", READ_SIZE, ofs);
+    }
+  close (fd);
+  bench_report ("random 512-byte reads", READ_CNT, rdtsc () - start,
+                READ_CNT * READ_SIZE);
+}
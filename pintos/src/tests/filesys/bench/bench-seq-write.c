@@ -0,0 +1,27 @@
+/* Writes a new file from start to end in FSBENCH_CHUNK pieces. */
+
+#include <syscall.h>
+#include "tests/filesys/bench/fsbench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char chunk[FSBENCH_CHUNK];
+
+void
+test_main (void) 
+{
+  const char *file_name = "seq";
+  uint64_t start;
+  size_t ofs;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  start = rdtsc ();
+  for (ofs = 0; ofs < FSBENCH_FILE_SIZE; ofs += sizeof chunk)
+    if (write (fd, chunk, sizeof chunk) != (int) sizeof chunk)
+      fail ("write %zu bytes at offset %zu failed", sizeof chunk, ofs);
+  close (fd);
+  bench_report ("sequential writes", FSBENCH_FILE_SIZE / sizeof chunk,
+                rdtsc () - start, FSBENCH_FILE_SIZE);
+}
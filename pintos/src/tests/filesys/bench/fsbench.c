@@ -0,0 +1,22 @@
+#include "tests/filesys/bench/fsbench.h"
+#include <syscall.h>
+#include "tests/lib.h"
+
+static char chunk[FSBENCH_CHUNK];
+
+/* Creates FILE_NAME and writes SIZE bytes to it, for benchmarks
+   that need a file to read.  Its sector writes show up in the
+   block device statistics along with those of the benchmark. */
+void
+fsbench_fill (const char *file_name, size_t size) 
+{
+  size_t ofs;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (ofs = 0; ofs < size; ofs += sizeof chunk)
+    if (write (fd, chunk, sizeof chunk) != (int) sizeof chunk)
+      fail ("write %zu bytes at offset %zu failed", sizeof chunk, ofs);
+  close (fd);
+}
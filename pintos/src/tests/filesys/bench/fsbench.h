@@ -0,0 +1,17 @@
+#ifndef TESTS_FILESYS_BENCH_FSBENCH_H
+#define TESTS_FILESYS_BENCH_FSBENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/tsc.h"
+
+/* Size of the file that the sequential and random benchmarks use.
+   The disk must hold it; see FSBENCH_SIZE in Make.tests. */
+#define FSBENCH_FILE_SIZE (2 * 1024 * 1024)
+
+/* Size of each read or write in the sequential benchmarks. */
+#define FSBENCH_CHUNK 4096
+
+void fsbench_fill (const char *file_name, size_t size);
+
+#endif /* tests/filesys/bench/fsbench.h */
@@ -1,4 +1,5 @@
 #include "tests/lib.h"
+#include <inttypes.h>
 #include <random.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -76,6 +77,24 @@ shuffle (void *buf_, size_t cnt, size_t size)
     }
 }
 
+/* Reports that OPS repetitions of WHAT took CYCLES time stamp
+   counter cycles in all and, if BYTES is nonzero, moved BYTES
+   bytes of data.  The "report" scripts of the file system and
+   paging benchmarks match this line against the statistics that
+   the kernel prints when it powers off. */
+void
+bench_report (const char *what, unsigned ops, uint64_t cycles,
+              size_t bytes)
+{
+  if (bytes == 0)
+    msg ("%u ops (%s): %"PRIu64" cycles/op",
+         ops, what, ops != 0 ? cycles / ops : 0);
+  else
+    msg ("%u ops (%s): %"PRIu64" cycles/op, %"PRIu64" kB/Mcycle",
+         ops, what, ops != 0 ? cycles / ops : 0,
+         cycles != 0 ? (uint64_t) bytes * 1000000 / 1024 / cycles : 0);
+}
+
 void
 exec_children (const char *child_name, pid_t pids[], size_t child_cnt) 
 {
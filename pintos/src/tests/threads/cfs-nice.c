@@ -0,0 +1,91 @@
+/* Checks that the fair-share scheduler divides the CPU among
+   CPU-bound threads in proportion to the weights of their nice
+   values.  Three threads, with nice values 0, 0, and 5, spin for
+   10 seconds, counting the ticks they run in as in mlfqs-fair.
+   With weights 1024, 1024, and 335 from cfs_weights[] in
+   threads/thread.c, they should get 43%, 43%, and 14% of the
+   ticks.  Each must land within 5% of the run of its share. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 3
+#define SETTLE_TICKS (1 * TIMER_FREQ)
+#define RUN_TICKS (10 * TIMER_FREQ)
+
+struct thread_info
+  {
+    int nice;
+    int weight;
+    int tick_cnt;
+  };
+
+static thread_func load_thread;
+
+static int64_t start_tick;
+static struct semaphore done;
+
+void
+test_cfs_nice (void)
+{
+  static struct thread_info info[THREAD_CNT] =
+    {
+      {0, 1024, 0},
+      {0, 1024, 0},
+      {5, 335, 0},
+    };
+  int weight_sum = 0;
+  int i;
+
+  ASSERT (thread_cfs);
+
+  /* Stay ahead of the load threads, to wake up on time. */
+  thread_set_nice (NICE_MIN);
+  sema_init (&done, 0);
+  start_tick = timer_ticks () + SETTLE_TICKS;
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "load %d", i);
+      thread_create (name, PRI_DEFAULT, load_thread, &info[i]);
+      weight_sum += info[i].weight;
+    }
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      int expected = RUN_TICKS * info[i].weight / weight_sum;
+      int slack = RUN_TICKS / 20;
+
+      if (info[i].tick_cnt < expected - slack
+          || info[i].tick_cnt > expected + slack)
+        fail ("thread %d with nice %d ran in %d ticks, not %d +/- %d",
+              i, info[i].nice, info[i].tick_cnt, expected, slack);
+      msg ("Thread %d with nice %d got its share.", i, info[i].nice);
+    }
+}
+
+static void
+load_thread (void *ti_)
+{
+  struct thread_info *ti = ti_;
+  int64_t end_tick = start_tick + RUN_TICKS;
+  int64_t last_tick = 0;
+
+  thread_set_nice (ti->nice);
+  timer_sleep (start_tick - timer_ticks ());
+  while (timer_ticks () < end_tick)
+    {
+      int64_t tick = timer_ticks ();
+      if (tick != last_tick)
+        ti->tick_cnt++;
+      last_tick = tick;
+    }
+  sema_up (&done);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(cfs-nice) begin
+(cfs-nice) Thread 0 with nice 0 got its share.
+(cfs-nice) Thread 1 with nice 0 got its share.
+(cfs-nice) Thread 2 with nice 5 got its share.
+(cfs-nice) end
+EOF
+pass;
@@ -0,0 +1,48 @@
+/* Checks that deadline threads run earliest deadline first.
+   Three deadline threads are created in order of decreasing
+   period, then all sleep until the same tick, when each gets a
+   deadline one period later.  They must then run in order of
+   increasing period, whatever the order they were created in. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 3
+
+static thread_func deadline_thread_func;
+
+static int64_t wake_tick;
+static struct semaphore done;
+
+void
+test_deadline_order (void)
+{
+  static const int periods[THREAD_CNT] = {30, 20, 10};
+  int i;
+
+  sema_init (&done, 0);
+  wake_tick = timer_ticks () + 10;
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "period %d", periods[i]);
+      if (thread_create_deadline (name, 2, periods[i], deadline_thread_func,
+                                  NULL) == TID_ERROR)
+        fail ("thread_create_deadline failed for %s", name);
+    }
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+}
+
+static void
+deadline_thread_func (void *aux UNUSED)
+{
+  timer_sleep (wake_tick - timer_ticks ());
+  msg ("Thread %s woke up.", thread_name ());
+  sema_up (&done);
+}
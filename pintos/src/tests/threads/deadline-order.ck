@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(deadline-order) begin
+(deadline-order) Thread period 10 woke up.
+(deadline-order) Thread period 20 woke up.
+(deadline-order) Thread period 30 woke up.
+(deadline-order) end
+EOF
+pass;
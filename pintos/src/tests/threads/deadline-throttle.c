@@ -0,0 +1,71 @@
+/* Checks that a deadline thread that never stops computing is held
+   to its budget: a normal thread running beside one with a budget
+   of 2 ticks in every 10 must still get most of the CPU. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Length of the test, in ticks. */
+#define TEST_TICKS 100
+
+static thread_func spin_thread_func;
+static int run_ticks (void);
+
+static int64_t end_tick;
+static int spin_ticks;
+static struct semaphore done;
+
+void
+test_deadline_throttle (void)
+{
+  tid_t tid;
+  int main_ticks;
+
+  sema_init (&done, 0);
+  end_tick = timer_ticks () + TEST_TICKS;
+  tid = thread_create_deadline ("spinner", 2, 10, spin_thread_func, NULL);
+  if (tid == TID_ERROR)
+    fail ("thread_create_deadline failed");
+  main_ticks = run_ticks ();
+  sema_down (&done);
+
+  if (spin_ticks == 0)
+    fail ("deadline thread never ran");
+  msg ("deadline thread ran");
+  if (main_ticks < TEST_TICKS / 2)
+    fail ("main thread ran in only %d of %d ticks",
+          main_ticks, TEST_TICKS);
+  msg ("main thread ran in at least half of the ticks");
+}
+
+static void
+spin_thread_func (void *aux UNUSED)
+{
+  spin_ticks = run_ticks ();
+  sema_up (&done);
+}
+
+/* Computes until end_tick and returns the number of ticks the
+   running thread ran in. */
+static int
+run_ticks (void)
+{
+  int64_t last_tick = -1;
+  int tick_cnt = 0;
+
+  for (;;)
+    {
+      int64_t tick = timer_ticks ();
+      if (tick >= end_tick)
+        return tick_cnt;
+      if (tick != last_tick)
+        {
+          tick_cnt++;
+          last_tick = tick;
+        }
+    }
+}
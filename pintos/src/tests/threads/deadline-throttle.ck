@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(deadline-throttle) begin
+(deadline-throttle) deadline thread ran
+(deadline-throttle) main thread ran in at least half of the ticks
+(deadline-throttle) end
+EOF
+pass;
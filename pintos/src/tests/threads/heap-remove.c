@@ -0,0 +1,94 @@
+/* Checks that the pairing heap in lib/kernel/heap.c still pops
+   its elements in ascending order after arbitrary elements have
+   been removed with heap_remove() and others have had their keys
+   lowered with heap_decrease().  Removing an element from the
+   middle of the heap relinks its children, so a mistake there
+   shows up as an element lost, popped twice, or out of order. */
+
+#include <heap.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+
+/* Number of elements.  Coprime to STRIDE, so that I * STRIDE %
+   ELEM_CNT visits every key once. */
+#define ELEM_CNT 200
+#define STRIDE 37
+
+struct value
+  {
+    struct heap_elem elem;
+    int key;
+    bool removed;
+  };
+
+static struct value values[ELEM_CNT];
+
+static bool
+value_less (const struct heap_elem *a_, const struct heap_elem *b_,
+            void *aux UNUSED)
+{
+  const struct value *a = heap_entry (a_, struct value, elem);
+  const struct value *b = heap_entry (b_, struct value, elem);
+
+  return a->key < b->key;
+}
+
+void
+test_heap_remove (void)
+{
+  struct heap heap;
+  int i, last, popped;
+
+  heap_init (&heap, value_less, NULL);
+  for (i = 0; i < ELEM_CNT; i++)
+    {
+      values[i].key = i * STRIDE % ELEM_CNT;
+      values[i].removed = false;
+      heap_insert (&heap, &values[i].elem);
+    }
+
+  /* One pop first, so that the heap has been paired into a tree
+     with more than one level before anything is removed. */
+  if (heap_entry (heap_pop_min (&heap), struct value, elem)->key != 0)
+    fail ("first pop did not return key 0");
+  for (i = 0; i < ELEM_CNT; i++)
+    if (values[i].key == 0)
+      values[i].removed = true;
+
+  /* Remove every third element, in insertion order. */
+  for (i = 0; i < ELEM_CNT; i += 3)
+    if (!values[i].removed)
+      {
+        heap_remove (&heap, &values[i].elem);
+        values[i].removed = true;
+      }
+
+  /* Lower the key of every fifth element that is left to below
+     all the others', keeping keys distinct. */
+  for (i = 1; i < ELEM_CNT; i += 5)
+    if (!values[i].removed)
+      {
+        values[i].key -= ELEM_CNT;
+        heap_decrease (&heap, &values[i].elem);
+      }
+  msg ("removed and decreased");
+
+  last = -ELEM_CNT - 1;
+  popped = 0;
+  while (!heap_empty (&heap))
+    {
+      struct value *v = heap_entry (heap_pop_min (&heap), struct value,
+                                    elem);
+      if (v->removed)
+        fail ("popped key %d, which was removed", v->key);
+      if (v->key <= last)
+        fail ("popped key %d after key %d", v->key, last);
+      v->removed = true;
+      last = v->key;
+      popped++;
+    }
+  for (i = 0; i < ELEM_CNT; i++)
+    if (!values[i].removed)
+      fail ("key %d was never popped", values[i].key);
+  msg ("popped %d elements in ascending order", popped);
+}
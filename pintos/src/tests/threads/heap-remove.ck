@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(heap-remove) begin
+(heap-remove) removed and decreased
+(heap-remove) popped 133 elements in ascending order
+(heap-remove) end
+EOF
+pass;
@@ -0,0 +1,109 @@
+/* Checks lookups in the Robin Hood hash table in lib/kernel/ohash.c
+   after deletions.  Deleting an element shifts the elements after
+   it back a slot, so a mistake there leaves an element that
+   ohash_find() can no longer reach, or one that is still found
+   after it was deleted.
+
+   The table is filled while it grows, so that some deletions land
+   in the old table while elements are still moving out of it, and
+   the test is run twice: once with a good hash function, and once
+   with one that sends every key to one of a few home slots, so
+   that probe sequences run long and most elements sit away from
+   their home slots. */
+
+#include <hash.h>
+#include <ohash.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+
+/* Number of elements.  Coprime to STRIDE, so that I * STRIDE %
+   ELEM_CNT visits every key once. */
+#define ELEM_CNT 500
+#define STRIDE 37
+
+/* Home slots used by the poor hash function. */
+#define POOR_HASHES 4
+
+struct value
+  {
+    int key;
+  };
+
+static struct value values[ELEM_CNT];
+
+static void check_deletes (const char *name, ohash_hash_func *);
+
+static unsigned
+good_hash (const void *v_, void *aux UNUSED)
+{
+  const struct value *v = v_;
+
+  return hash_int (v->key);
+}
+
+static unsigned
+poor_hash (const void *v_, void *aux UNUSED)
+{
+  const struct value *v = v_;
+
+  return v->key % POOR_HASHES;
+}
+
+static bool
+value_less (const void *a_, const void *b_, void *aux UNUSED)
+{
+  const struct value *a = a_;
+  const struct value *b = b_;
+
+  return a->key < b->key;
+}
+
+void
+test_ohash_delete (void)
+{
+  check_deletes ("good hash", good_hash);
+  check_deletes ("poor hash", poor_hash);
+}
+
+/* Inserts every key, deleting every other key as soon as the key
+   after it is in, then deletes every third key that is left, and
+   then looks every key up.  Uses HASH as the hash function, and
+   refers to it as NAME. */
+static void
+check_deletes (const char *name, ohash_hash_func *hash)
+{
+  struct ohash h;
+  struct value key;
+  int i;
+
+  if (!ohash_init (&h, hash, value_less, NULL))
+    fail ("%s: ohash_init failed", name);
+  for (i = 0; i < ELEM_CNT; i++)
+    {
+      values[i].key = i * STRIDE % ELEM_CNT;
+      if (ohash_insert (&h, &values[i]) != NULL)
+        fail ("%s: inserting key %d failed", name, values[i].key);
+      if (i % 2 == 1 && ohash_delete (&h, &values[i - 1]) != &values[i - 1])
+        fail ("%s: deleting key %d failed", name, values[i - 1].key);
+    }
+  for (i = 1; i < ELEM_CNT; i += 6)
+    if (ohash_delete (&h, &values[i]) != &values[i])
+      fail ("%s: deleting key %d failed", name, values[i].key);
+
+  for (i = 0; i < ELEM_CNT; i++)
+    {
+      bool deleted = i % 2 == 0 || i % 6 == 1;
+      void *found;
+
+      key.key = values[i].key;
+      found = ohash_find (&h, &key);
+      if (deleted && found != NULL)
+        fail ("%s: found deleted key %d", name, key.key);
+      if (!deleted && found != &values[i])
+        fail ("%s: lost key %d", name, key.key);
+      if (deleted && ohash_delete (&h, &key) != NULL)
+        fail ("%s: deleted key %d twice", name, key.key);
+    }
+  msg ("%s: %zu keys found after deletes", name, ohash_size (&h));
+  ohash_destroy (&h, NULL);
+}
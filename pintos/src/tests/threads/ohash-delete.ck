@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ohash-delete) begin
+(ohash-delete) good hash: 166 keys found after deletes
+(ohash-delete) poor hash: 166 keys found after deletes
+(ohash-delete) end
+EOF
+pass;
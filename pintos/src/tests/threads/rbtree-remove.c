@@ -0,0 +1,130 @@
+/* Checks that the red-black tree in lib/kernel/rbtree.c keeps its
+   elements in order, and stays balanced, after removals.  Inserts
+   keys in a scrambled order, removes every third one, and then
+   checks the red-black invariants, walks the tree both ways, and
+   looks up both the remaining and the removed keys. */
+
+#include <rbtree.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+
+/* Number of elements.  Coprime to STRIDE, so that I * STRIDE %
+   ELEM_CNT visits every key once. */
+#define ELEM_CNT 200
+#define STRIDE 37
+
+struct value
+  {
+    struct rb_elem elem;
+    int key;
+  };
+
+static struct value values[ELEM_CNT];
+
+/* Whether key K is still in the tree. */
+static bool present (int k);
+
+static bool
+value_less (const struct rb_elem *a_, const struct rb_elem *b_,
+            void *aux UNUSED)
+{
+  const struct value *a = rb_entry (a_, struct value, elem);
+  const struct value *b = rb_entry (b_, struct value, elem);
+
+  return a->key < b->key;
+}
+
+static int
+key_of (struct rb_elem *e)
+{
+  return rb_entry (e, struct value, elem)->key;
+}
+
+/* Checks the subtree rooted at E, whose parent must be PARENT,
+   and returns its black height: no red element has a red child,
+   and every path down to a null child passes the same number of
+   black elements. */
+static int
+check_subtree (struct rb_elem *e, struct rb_elem *parent)
+{
+  int left, right;
+
+  if (e == NULL)
+    return 1;
+  if (e->parent != parent)
+    fail ("key %d has the wrong parent", key_of (e));
+  if (e->red && parent != NULL && parent->red)
+    fail ("red key %d has a red parent", key_of (e));
+  left = check_subtree (e->left, e);
+  right = check_subtree (e->right, e);
+  if (left != right)
+    fail ("key %d has black heights %d and %d", key_of (e), left, right);
+  return left + !e->red;
+}
+
+void
+test_rbtree_remove (void)
+{
+  struct rb_tree tree;
+  struct rb_elem *e;
+  struct value key;
+  int i, k, cnt;
+
+  rb_init (&tree, value_less, NULL);
+  for (i = 0; i < ELEM_CNT; i++)
+    {
+      values[i].key = i * STRIDE % ELEM_CNT;
+      rb_insert (&tree, &values[i].elem);
+    }
+  for (i = 0; i < ELEM_CNT; i++)
+    if (!present (values[i].key))
+      rb_remove (&tree, &values[i].elem);
+
+  if (tree.root != NULL && tree.root->red)
+    fail ("root is red");
+  check_subtree (tree.root, NULL);
+  msg ("tree is balanced after removals");
+
+  cnt = 0;
+  k = -1;
+  for (e = rb_min (&tree); e != NULL; e = rb_next (e))
+    {
+      for (k++; !present (k); k++)
+        continue;
+      if (key_of (e) != k)
+        fail ("forward walk found key %d where %d belongs", key_of (e), k);
+      cnt++;
+    }
+  if (cnt != (int) rb_size (&tree))
+    fail ("forward walk found %d of %zu keys", cnt, rb_size (&tree));
+  k = ELEM_CNT;
+  for (e = rb_max (&tree); e != NULL; e = rb_prev (e))
+    {
+      for (k--; !present (k); k--)
+        continue;
+      if (key_of (e) != k)
+        fail ("reverse walk found key %d where %d belongs", key_of (e), k);
+    }
+  msg ("walks found the remaining %d keys in order", cnt);
+
+  for (k = 0; k < ELEM_CNT; k++)
+    {
+      key.key = k;
+      e = rb_find (&tree, &key.elem);
+      if (present (k) ? e == NULL || key_of (e) != k : e != NULL)
+        fail ("rb_find of key %d went wrong", k);
+      e = rb_lower_bound (&tree, &key.elem);
+      if (!present (k) && k + 1 < ELEM_CNT
+          && (e == NULL || key_of (e) != k + 1))
+        fail ("rb_lower_bound of removed key %d did not find %d", k, k + 1);
+    }
+  msg ("lookups agree with removals");
+}
+
+/* Every third key, starting from 0, is removed.  Keys 3N + 1,
+   which follow a removed key, are always present. */
+static bool
+present (int k)
+{
+  return k % 3 != 0;
+}
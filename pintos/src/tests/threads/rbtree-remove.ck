@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rbtree-remove) begin
+(rbtree-remove) tree is balanced after removals
+(rbtree-remove) walks found the remaining 133 keys in order
+(rbtree-remove) lookups agree with removals
+(rbtree-remove) end
+EOF
+pass;
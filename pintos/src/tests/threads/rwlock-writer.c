@@ -0,0 +1,73 @@
+/* Two readers hold a readers-writer lock at the same time.  A
+   higher-priority writer must wait until both have released it,
+   and a reader arriving while the writer waits must wait behind
+   the writer. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+struct rwlock_test
+  {
+    struct rwlock rw;
+    struct semaphore gate;      /* Readers 1 and 2 wait here. */
+  };
+
+static thread_func reader_thread_func;
+static thread_func late_reader_thread_func;
+static thread_func writer_thread_func;
+
+void
+test_rwlock_writer (void)
+{
+  struct rwlock_test test;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rw_init (&test.rw);
+  sema_init (&test.gate, 0);
+  thread_create ("reader 1", PRI_DEFAULT + 1, reader_thread_func, &test);
+  thread_create ("reader 2", PRI_DEFAULT + 1, reader_thread_func, &test);
+  thread_create ("writer", PRI_DEFAULT + 2, writer_thread_func, &test);
+  thread_create ("reader 3", PRI_DEFAULT + 1, late_reader_thread_func, &test);
+  sema_up (&test.gate);
+  sema_up (&test.gate);
+}
+
+static void
+reader_thread_func (void *test_)
+{
+  struct rwlock_test *test = test_;
+
+  rw_read_acquire (&test->rw);
+  msg ("%s acquired", thread_name ());
+  sema_down (&test->gate);
+  msg ("%s releasing", thread_name ());
+  rw_read_release (&test->rw);
+}
+
+static void
+late_reader_thread_func (void *test_)
+{
+  struct rwlock_test *test = test_;
+
+  rw_read_acquire (&test->rw);
+  msg ("%s acquired", thread_name ());
+  rw_read_release (&test->rw);
+}
+
+static void
+writer_thread_func (void *test_)
+{
+  struct rwlock_test *test = test_;
+
+  rw_write_acquire (&test->rw);
+  msg ("writer acquired");
+  rw_write_release (&test->rw);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-writer) begin
+(rwlock-writer) reader 1 acquired
+(rwlock-writer) reader 2 acquired
+(rwlock-writer) reader 1 releasing
+(rwlock-writer) reader 2 releasing
+(rwlock-writer) writer acquired
+(rwlock-writer) reader 3 acquired
+(rwlock-writer) end
+EOF
+pass;
@@ -0,0 +1,126 @@
+/* Runs with more than one CPU.  Four threads, each pinned to one
+   of the CPUs in turn, add to a shared counter under a lock,
+   reading and writing it back in separate steps so that an update
+   lost to another CPU would show in the total.  Then two threads
+   on different CPUs bounce a semaphore back and forth.  A wakeup
+   lost between CPUs hangs the test. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/smp.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define WORKER_CNT 4
+#define ITER_CNT 20000
+#define PING_CNT 1000
+
+struct worker
+  {
+    int cpu;                    /* CPU to run on. */
+    bool moved;                 /* Ran on another CPU after pinning? */
+  };
+
+static struct lock counter_lock;
+static volatile int counter;
+static uint32_t cpus_seen;
+static struct semaphore done;
+static struct semaphore ping, pong;
+
+static thread_func counter_thread, pong_thread;
+static void pin (int cpu);
+
+void
+test_smp_lock (void)
+{
+  struct worker workers[WORKER_CNT];
+  int i;
+
+  if (smp_cpu_cnt < 2)
+    fail ("needs more than one CPU, found %d", smp_cpu_cnt);
+
+  lock_init (&counter_lock);
+  sema_init (&done, 0);
+  for (i = 0; i < WORKER_CNT; i++)
+    {
+      char name[16];
+
+      workers[i].cpu = i % smp_cpu_cnt;
+      workers[i].moved = false;
+      snprintf (name, sizeof name, "counter %d", i);
+      thread_create (name, PRI_DEFAULT, counter_thread, &workers[i]);
+    }
+  for (i = 0; i < WORKER_CNT; i++)
+    sema_down (&done);
+
+  for (i = 0; i < WORKER_CNT; i++)
+    if (workers[i].moved)
+      fail ("counter %d left CPU %d", i, workers[i].cpu);
+  if ((cpus_seen & (cpus_seen - 1)) == 0)
+    fail ("all counter threads ran on one CPU");
+  if (counter != WORKER_CNT * ITER_CNT)
+    fail ("counter is %d, not %d", counter, WORKER_CNT * ITER_CNT);
+  msg ("counter is %d", counter);
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  pin (0);
+  thread_create ("pong", PRI_DEFAULT, pong_thread, NULL);
+  for (i = 0; i < PING_CNT; i++)
+    {
+      sema_up (&ping);
+      sema_down (&pong);
+    }
+  sema_down (&done);
+  msg ("bounced a semaphore %d times between CPUs", PING_CNT);
+}
+
+static void
+counter_thread (void *w_)
+{
+  struct worker *w = w_;
+  int i;
+
+  pin (w->cpu);
+  lock_acquire (&counter_lock);
+  cpus_seen |= 1u << smp_cpu ();
+  lock_release (&counter_lock);
+
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      int value;
+
+      lock_acquire (&counter_lock);
+      value = counter;
+      if (smp_cpu () != w->cpu)
+        w->moved = true;
+      counter = value + 1;
+      lock_release (&counter_lock);
+    }
+  sema_up (&done);
+}
+
+static void
+pong_thread (void *aux UNUSED)
+{
+  int i;
+
+  pin (1);
+  for (i = 0; i < PING_CNT; i++)
+    {
+      sema_down (&ping);
+      sema_up (&pong);
+    }
+  sema_up (&done);
+}
+
+/* Pins the running thread to CPU. */
+static void
+pin (int cpu)
+{
+  if (!thread_set_affinity (thread_tid (), 1u << cpu))
+    fail ("could not pin %s to CPU %d", thread_name (), cpu);
+  if (smp_cpu () != cpu)
+    fail ("%s runs on CPU %d, not %d", thread_name (), smp_cpu (), cpu);
+}
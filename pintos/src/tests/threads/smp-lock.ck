@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(smp-lock) begin
+(smp-lock) counter is 80000
+(smp-lock) bounced a semaphore 1000 times between CPUs
+(smp-lock) end
+EOF
+pass;
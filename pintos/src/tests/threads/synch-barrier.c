@@ -0,0 +1,61 @@
+/* Three threads and the main thread meet at a barrier for two
+   rounds.  In each round, no thread passes the barrier until
+   all four have arrived, and barrier_wait() returns true only
+   in the thread that arrived last. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define THREAD_CNT 3
+#define ROUND_CNT 2
+
+static thread_func barrier_thread_func;
+
+void
+test_synch_barrier (void)
+{
+  struct barrier barrier;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  barrier_init (&barrier, THREAD_CNT + 1);
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "thread %d", i + 1);
+      thread_create (name, PRI_DEFAULT + 1, barrier_thread_func, &barrier);
+    }
+
+  for (i = 1; i <= ROUND_CNT; i++)
+    {
+      msg ("main arrived for round %d", i);
+      if (barrier_wait (&barrier))
+        msg ("main passed round %d last", i);
+      else
+        msg ("main passed round %d", i);
+    }
+}
+
+static void
+barrier_thread_func (void *barrier_)
+{
+  struct barrier *barrier = barrier_;
+  int i;
+
+  for (i = 1; i <= ROUND_CNT; i++)
+    {
+      msg ("%s arrived for round %d", thread_name (), i);
+      if (barrier_wait (barrier))
+        msg ("%s passed round %d last", thread_name (), i);
+      else
+        msg ("%s passed round %d", thread_name (), i);
+    }
+}
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(synch-barrier) begin
+(synch-barrier) thread 1 arrived for round 1
+(synch-barrier) thread 2 arrived for round 1
+(synch-barrier) thread 3 arrived for round 1
+(synch-barrier) main arrived for round 1
+(synch-barrier) thread 1 passed round 1
+(synch-barrier) thread 1 arrived for round 2
+(synch-barrier) thread 2 passed round 1
+(synch-barrier) thread 2 arrived for round 2
+(synch-barrier) thread 3 passed round 1
+(synch-barrier) thread 3 arrived for round 2
+(synch-barrier) main passed round 1 last
+(synch-barrier) main arrived for round 2
+(synch-barrier) thread 1 passed round 2
+(synch-barrier) thread 2 passed round 2
+(synch-barrier) thread 3 passed round 2
+(synch-barrier) main passed round 2 last
+(synch-barrier) end
+EOF
+pass;
@@ -0,0 +1,47 @@
+/* Two threads wait for a completion.  complete() lets only the
+   higher-priority one through, complete_all() the other, and a
+   thread that waits after complete_all() does not block. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func waiter_thread_func;
+
+void
+test_synch_completion (void)
+{
+  struct completion completion;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  completion_init (&completion);
+  thread_create ("waiter 1", PRI_DEFAULT + 1, waiter_thread_func,
+                 &completion);
+  thread_create ("waiter 2", PRI_DEFAULT + 2, waiter_thread_func,
+                 &completion);
+
+  msg ("complete");
+  complete (&completion);
+  msg ("complete_all");
+  complete_all (&completion);
+
+  thread_create ("waiter 3", PRI_DEFAULT + 1, waiter_thread_func,
+                 &completion);
+}
+
+static void
+waiter_thread_func (void *completion_)
+{
+  struct completion *completion = completion_;
+
+  msg ("%s waiting", thread_name ());
+  wait_for_completion (completion);
+  msg ("%s done", thread_name ());
+}
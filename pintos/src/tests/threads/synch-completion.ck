@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(synch-completion) begin
+(synch-completion) waiter 1 waiting
+(synch-completion) waiter 2 waiting
+(synch-completion) complete
+(synch-completion) waiter 2 done
+(synch-completion) complete_all
+(synch-completion) waiter 1 done
+(synch-completion) waiter 3 waiting
+(synch-completion) waiter 3 done
+(synch-completion) end
+EOF
+pass;
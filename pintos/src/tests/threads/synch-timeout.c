@@ -0,0 +1,146 @@
+/* Checks sema_down_timeout() and lock_acquire_timeout(): a wait
+   with nobody to wake it must time out no earlier than asked, and
+   a wait that is satisfied in time must succeed.  Also checks that
+   a timed-out lock wait withdraws its donation along a nested
+   chain: the main thread waits for lock B, held by "medium", which
+   waits for lock A, held by "low", and once the wait times out
+   both must be back to the priority that "medium" alone gives
+   them. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static thread_func up_thread_func;
+static thread_func holder_thread_func;
+static thread_func low_thread_func;
+static thread_func medium_thread_func;
+
+/* State shared with the threads of the nested chain. */
+struct chain
+  {
+    struct lock a, b;           /* Held by "low" and "medium". */
+    struct semaphore go;        /* Tells "low" to release A. */
+    struct semaphore done;      /* Upped by each thread as it ends. */
+    struct thread *low, *medium;
+  };
+
+static void test_nested_timeout (void);
+static void check_priority (struct thread *, int expected);
+
+void
+test_synch_timeout (void)
+{
+  struct semaphore sema;
+  struct lock lock;
+  int64_t start;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&sema, 0);
+  start = timer_ticks ();
+  if (sema_down_timeout (&sema, 10))
+    fail ("sema_down_timeout succeeded on a semaphore nobody upped");
+  if (timer_elapsed (start) < 10)
+    fail ("sema_down_timeout gave up after %lld of 10 ticks",
+          timer_elapsed (start));
+  msg ("sema_down_timeout timed out");
+
+  thread_create ("up", PRI_DEFAULT, up_thread_func, &sema);
+  if (!sema_down_timeout (&sema, 1000))
+    fail ("sema_down_timeout timed out although the semaphore was upped");
+  msg ("sema_down_timeout succeeded");
+
+  lock_init (&lock);
+  thread_create ("holder", PRI_DEFAULT + 1, holder_thread_func, &lock);
+  if (lock_acquire_timeout (&lock, 5))
+    fail ("lock_acquire_timeout acquired a held lock");
+  msg ("lock_acquire_timeout timed out");
+  if (!lock_acquire_timeout (&lock, 1000))
+    fail ("lock_acquire_timeout timed out although the lock was released");
+  msg ("lock_acquire_timeout succeeded");
+  lock_release (&lock);
+
+  test_nested_timeout ();
+}
+
+/* Times out waiting at the head of the nested chain. */
+static void
+test_nested_timeout (void)
+{
+  struct chain chain;
+
+  lock_init (&chain.a);
+  lock_init (&chain.b);
+  sema_init (&chain.go, 0);
+  sema_init (&chain.done, 0);
+  thread_create ("low", PRI_DEFAULT + 1, low_thread_func, &chain);
+  thread_create ("medium", PRI_DEFAULT + 2, medium_thread_func, &chain);
+  thread_set_priority (PRI_DEFAULT + 5);
+  if (lock_acquire_timeout (&chain.b, 5))
+    fail ("lock_acquire_timeout acquired a held lock");
+  check_priority (chain.medium, PRI_DEFAULT + 2);
+  check_priority (chain.low, PRI_DEFAULT + 2);
+  msg ("nested donation withdrawn after timeout");
+
+  sema_up (&chain.go);
+  thread_set_priority (PRI_DEFAULT);
+  sema_down (&chain.done);
+  sema_down (&chain.done);
+}
+
+/* Fails unless T has priority EXPECTED. */
+static void
+check_priority (struct thread *t, int expected)
+{
+  if (t->priority != expected)
+    fail ("%s has priority %d, not %d", t->name, t->priority, expected);
+}
+
+static void
+up_thread_func (void *sema_)
+{
+  struct semaphore *sema = sema_;
+
+  timer_sleep (5);
+  sema_up (sema);
+}
+
+static void
+low_thread_func (void *chain_)
+{
+  struct chain *chain = chain_;
+
+  chain->low = thread_current ();
+  lock_acquire (&chain->a);
+  sema_down (&chain->go);
+  lock_release (&chain->a);
+  sema_up (&chain->done);
+}
+
+static void
+medium_thread_func (void *chain_)
+{
+  struct chain *chain = chain_;
+
+  chain->medium = thread_current ();
+  lock_acquire (&chain->b);
+  lock_acquire (&chain->a);
+  lock_release (&chain->a);
+  lock_release (&chain->b);
+  sema_up (&chain->done);
+}
+
+static void
+holder_thread_func (void *lock_)
+{
+  struct lock *lock = lock_;
+
+  lock_acquire (lock);
+  timer_sleep (20);
+  lock_release (lock);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(synch-timeout) begin
+(synch-timeout) sema_down_timeout timed out
+(synch-timeout) sema_down_timeout succeeded
+(synch-timeout) lock_acquire_timeout timed out
+(synch-timeout) lock_acquire_timeout succeeded
+(synch-timeout) nested donation withdrawn after timeout
+(synch-timeout) end
+EOF
+pass;
@@ -29,6 +29,17 @@ static const struct test tests[] =
     {"priority-preempt", test_priority_preempt},
     {"priority-sema", test_priority_sema},
     {"priority-condvar", test_priority_condvar},
+    {"rwlock-writer", test_rwlock_writer},
+    {"synch-timeout", test_synch_timeout},
+    {"synch-barrier", test_synch_barrier},
+    {"synch-completion", test_synch_completion},
+    {"deadline-throttle", test_deadline_throttle},
+    {"deadline-order", test_deadline_order},
+    {"cfs-nice", test_cfs_nice},
+    {"heap-remove", test_heap_remove},
+    {"rbtree-remove", test_rbtree_remove},
+    {"ohash-delete", test_ohash_delete},
+    {"smp-lock", test_smp_lock},
     {"mlfqs-load-1", test_mlfqs_load_1},
     {"mlfqs-load-60", test_mlfqs_load_60},
     {"mlfqs-load-avg", test_mlfqs_load_avg},
@@ -38,26 +49,45 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"bench-switch", test_bench_switch},
+    {"bench-handoff", test_bench_handoff},
+    {"bench-sema", test_bench_sema},
+    {"bench-lock", test_bench_lock},
+    {"bench-sleep", test_bench_sleep},
+    {"bench-create", test_bench_create},
+    {"bench-malloc", test_bench_malloc},
+    {"bench-stress-1k", test_bench_stress_1k},
+    {"bench-stress-10k", test_bench_stress_10k},
+    {"bench-sched-priority", test_bench_sched},
+    {"bench-sched-mlfqs", test_bench_sched},
+    {"bench-sched-cfs", test_bench_sched},
   };
 
 static const char *test_name;
 
-/* Runs the test named NAME. */
+/* Arguments given after the test's name, or a null pointer. */
+const char *test_args;
+
+/* Runs the test named NAME, which may be followed by a space and
+   arguments for the test, as in "run 'bench-sched-cfs cpu=8'". */
 void
 run_test (const char *name) 
 {
   const struct test *t;
+  const char *space = strchr (name, ' ');
+  size_t len = space != NULL ? (size_t) (space - name) : strlen (name);
 
   for (t = tests; t < tests + sizeof tests / sizeof *tests; t++)
-    if (!strcmp (name, t->name))
+    if (strlen (t->name) == len && !memcmp (name, t->name, len))
       {
-        test_name = name;
+        test_name = t->name;
+        test_args = space != NULL ? space + 1 : NULL;
         msg ("begin");
         t->function ();
         msg ("end");
         return;
       }
-  PANIC ("no test named \"%s\"", name);
+  PANIC ("no test named \"%.*s\"", (int) len, name);
 }
 
 /* Prints FORMAT as if with printf(),
@@ -2,6 +2,7 @@
 #define TESTS_THREADS_TESTS_H
 
 void run_test (const char *);
+extern const char *test_args;
 
 typedef void test_func (void);
 
@@ -23,6 +24,17 @@ extern test_func test_priority_fifo;
 extern test_func test_priority_preempt;
 extern test_func test_priority_sema;
 extern test_func test_priority_condvar;
+extern test_func test_rwlock_writer;
+extern test_func test_synch_timeout;
+extern test_func test_synch_barrier;
+extern test_func test_synch_completion;
+extern test_func test_deadline_throttle;
+extern test_func test_deadline_order;
+extern test_func test_cfs_nice;
+extern test_func test_heap_remove;
+extern test_func test_rbtree_remove;
+extern test_func test_ohash_delete;
+extern test_func test_smp_lock;
 extern test_func test_mlfqs_load_1;
 extern test_func test_mlfqs_load_60;
 extern test_func test_mlfqs_load_avg;
@@ -32,6 +44,16 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_bench_switch;
+extern test_func test_bench_handoff;
+extern test_func test_bench_sema;
+extern test_func test_bench_lock;
+extern test_func test_bench_sleep;
+extern test_func test_bench_create;
+extern test_func test_bench_malloc;
+extern test_func test_bench_stress_1k;
+extern test_func test_bench_stress_10k;
+extern test_func test_bench_sched;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
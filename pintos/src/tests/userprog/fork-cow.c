@@ -0,0 +1,74 @@
+/* Forks, then has the child and the parent each write to pages
+   they share after the fork, and checks that neither sees the
+   other's writes.  Pipes order the two processes: the parent
+   checks only after the child has written, and the child only
+   after the parent has. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+
+/* Pages written by the child, by the parent, and by neither. */
+static char child_page[PAGE_SIZE];
+static char parent_page[PAGE_SIZE];
+static char shared_page[PAGE_SIZE];
+
+/* Returns true if every byte of PAGE is C. */
+static bool
+page_is (const char *page, char c)
+{
+  size_t i;
+
+  for (i = 0; i < PAGE_SIZE; i++)
+    if (page[i] != c)
+      return false;
+  return true;
+}
+
+void
+test_main (void)
+{
+  int to_parent[2], to_child[2];
+  int stack_value = 1;
+  pid_t pid;
+  char c;
+
+  memset (child_page, 'a', PAGE_SIZE);
+  memset (parent_page, 'b', PAGE_SIZE);
+  memset (shared_page, 's', PAGE_SIZE);
+  CHECK (pipe (to_parent) == 0 && pipe (to_child) == 0, "pipe");
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      /* Child.  Write, let the parent check, then wait for the
+         parent's writes and check in turn. */
+      memset (child_page, 'c', PAGE_SIZE);
+      stack_value = 2;
+      write (to_parent[1], "", 1);
+      if (read (to_child[0], &c, 1) != 1)
+        fail ("child: read from pipe failed");
+      if (!page_is (parent_page, 'b'))
+        fail ("child saw the parent's write to its data");
+      if (!page_is (shared_page, 's'))
+        fail ("child's untouched page changed");
+      exit (stack_value == 2 && page_is (child_page, 'c') ? 81 : 1);
+    }
+  if (pid == PID_ERROR)
+    fail ("fork failed");
+
+  memset (parent_page, 'p', PAGE_SIZE);
+  stack_value = 3;
+  write (to_child[1], "", 1);
+  if (read (to_parent[0], &c, 1) != 1)
+    fail ("parent: read from pipe failed");
+  if (!page_is (child_page, 'a') || stack_value != 3)
+    fail ("parent saw the child's writes");
+  msg ("wait(fork()) = %d", wait (pid));
+  if (!page_is (parent_page, 'p') || !page_is (shared_page, 's'))
+    fail ("parent's own pages changed");
+  msg ("neither process saw the other's writes");
+}
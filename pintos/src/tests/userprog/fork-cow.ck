@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-cow) begin
+(fork-cow) pipe
+fork-cow: exit(81)
+(fork-cow) wait(fork()) = 81
+(fork-cow) neither process saw the other's writes
+(fork-cow) end
+fork-cow: exit(0)
+EOF
+pass;
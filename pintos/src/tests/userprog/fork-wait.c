@@ -0,0 +1,20 @@
+/* Waits for a forked child, twice.  The first wait must return
+   the child's exit code, and the second must return -1 at once,
+   as for a child started with exec(). */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  pid_t pid = fork ();
+
+  if (pid == 0)
+    exit (42);
+  if (pid == PID_ERROR)
+    fail ("fork failed");
+  msg ("wait(fork()) = %d", wait (pid));
+  msg ("wait(fork()) = %d", wait (pid));
+}
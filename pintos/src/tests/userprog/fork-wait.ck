@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-wait) begin
+fork-wait: exit(42)
+(fork-wait) wait(fork()) = 42
+(fork-wait) wait(fork()) = -1
+(fork-wait) end
+fork-wait: exit(0)
+EOF
+pass;
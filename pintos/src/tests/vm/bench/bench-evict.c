@@ -0,0 +1,29 @@
+/* Writes two buffers larger than the user pool, a page at a time,
+   so that once the pool is full each page written evicts a dirty
+   one.  The first buffer is incompressible and goes out to the
+   swap device; the second compresses well and stays in the
+   compressed tier. */
+
+#include <stdint.h>
+#include "tests/vm/bench/vmbench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static uint8_t disk_buf[VMBENCH_BUF_SIZE];
+static uint8_t zswap_buf[VMBENCH_BUF_SIZE];
+
+void
+test_main (void) 
+{
+  uint64_t start;
+
+  start = rdtsc ();
+  vmbench_fill (disk_buf, sizeof disk_buf, false);
+  bench_report ("incompressible page writes", VMBENCH_BUF_PAGES,
+                rdtsc () - start, 0);
+
+  start = rdtsc ();
+  vmbench_fill (zswap_buf, sizeof zswap_buf, true);
+  bench_report ("compressible page writes", VMBENCH_BUF_PAGES,
+                rdtsc () - start, 0);
+}
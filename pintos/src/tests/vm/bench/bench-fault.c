@@ -0,0 +1,35 @@
+/* Grows the heap, touches each new page once, and shrinks it
+   again, over and over, so that every touch takes a zero-fill
+   page fault and none has to evict a page. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/vm/bench/vmbench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FAULT_PAGES 64
+#define ROUND_CNT 32
+
+void
+test_main (void) 
+{
+  uint64_t cycles = 0;
+  int round;
+
+  for (round = 0; round < ROUND_CNT; round++)
+    {
+      uint8_t *base = sbrk (FAULT_PAGES * VMBENCH_PAGE);
+      uint64_t start;
+      int i;
+
+      if (base == (uint8_t *) -1)
+        fail ("sbrk failed");
+      start = rdtsc ();
+      for (i = 0; i < FAULT_PAGES; i++)
+        base[i * VMBENCH_PAGE] = i;
+      cycles += rdtsc () - start;
+      sbrk (-FAULT_PAGES * VMBENCH_PAGE);
+    }
+  bench_report ("zero-fill faults", FAULT_PAGES * ROUND_CNT, cycles, 0);
+}
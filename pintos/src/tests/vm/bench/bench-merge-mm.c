@@ -0,0 +1,15 @@
+/* Times page-merge-mm: eight children sort chunks of a 1 MB
+   buffer through mmap, while the parent holds two such buffers. */
+
+#include "tests/vm/bench/vmbench.h"
+#include "tests/vm/parallel-merge.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  uint64_t start = rdtsc ();
+  parallel_merge ("child-qsort-mm", 80);
+  bench_report ("page-merge-mm", 1, rdtsc () - start, 0);
+}
@@ -0,0 +1,16 @@
+/* Times page-merge-stk: eight child-qsort processes sort chunks of
+   a 1 MB buffer on their stacks, while the parent holds two such
+   buffers. */
+
+#include "tests/vm/bench/vmbench.h"
+#include "tests/vm/parallel-merge.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  uint64_t start = rdtsc ();
+  parallel_merge ("child-qsort", 72);
+  bench_report ("child-qsort merge", 1, rdtsc () - start, 0);
+}
@@ -0,0 +1,56 @@
+/* Fills two buffers larger than the user pool, one incompressible
+   and one compressible, then reads a byte from each page of them,
+   so that nearly every read brings a page back in from the swap
+   device or the compressed tier.  Reading the incompressible
+   buffer a second time, in random order, defeats swap read-ahead.
+
+   Each page read in is dirty again once its swap slot is freed,
+   so these times include writing out a victim too. */
+
+#include <random.h>
+#include <stdint.h>
+#include "tests/vm/bench/vmbench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static uint8_t disk_buf[VMBENCH_BUF_SIZE];
+static uint8_t zswap_buf[VMBENCH_BUF_SIZE];
+static uint16_t order[VMBENCH_BUF_PAGES];
+static volatile uint8_t sink;
+
+/* Reads the first byte of each page of BUF in ORDER, and reports
+   the time as WHAT. */
+static void
+read_pages (const char *what, const uint8_t *buf, const uint16_t *order) 
+{
+  uint64_t start = rdtsc ();
+  size_t i;
+
+  for (i = 0; i < VMBENCH_BUF_PAGES; i++)
+    sink = buf[order[i] * VMBENCH_PAGE];
+  bench_report (what, VMBENCH_BUF_PAGES, rdtsc () - start, 0);
+}
+
+void
+test_main (void) 
+{
+  size_t i;
+
+  vmbench_fill (disk_buf, sizeof disk_buf, false);
+  vmbench_fill (zswap_buf, sizeof zswap_buf, true);
+
+  for (i = 0; i < VMBENCH_BUF_PAGES; i++)
+    order[i] = i;
+  read_pages ("sequential swap-ins from disk", disk_buf, order);
+  read_pages ("sequential swap-ins from compressed tier", zswap_buf, order);
+
+  random_init (0);
+  for (i = VMBENCH_BUF_PAGES - 1; i > 0; i--)
+    {
+      size_t j = random_ulong () % (i + 1);
+      uint16_t t = order[i];
+      order[i] = order[j];
+      order[j] = t;
+    }
+  read_pages ("random swap-ins from disk", disk_buf, order);
+}
@@ -0,0 +1,29 @@
+#include "tests/vm/bench/vmbench.h"
+#include <string.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+
+/* Writes SIZE bytes at BUF, a page at a time, with data that the
+   compressed swap tier turns down if COMPRESSIBLE is false and
+   takes if it is true.  Each page differs from the others, so
+   that no two can share a frame. */
+void
+vmbench_fill (uint8_t *buf, size_t size, bool compressible) 
+{
+  static uint8_t page[VMBENCH_PAGE];
+  size_t ofs;
+
+  if (compressible)
+    memset (page, 0x5a, sizeof page);
+  else
+    {
+      struct arc4 arc4;
+      arc4_init (&arc4, "vmbench", 7);
+      arc4_crypt (&arc4, page, sizeof page);
+    }
+  for (ofs = 0; ofs < size; ofs += sizeof page)
+    {
+      *(size_t *) page = ofs;
+      memcpy (buf + ofs, page, sizeof page);
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef TESTS_VM_BENCH_VMBENCH_H
+#define TESTS_VM_BENCH_VMBENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/tsc.h"
+
+/* Size of a page, the unit of every paging benchmark. */
+#define VMBENCH_PAGE 4096
+
+/* Size of the buffers that the eviction and swap-in benchmarks
+   page through.  The user pool must be well under this, and swap
+   well over it; see VMBENCH_UL in Make.tests. */
+#define VMBENCH_BUF_SIZE (2 * 1024 * 1024)
+#define VMBENCH_BUF_PAGES (VMBENCH_BUF_SIZE / VMBENCH_PAGE)
+
+void vmbench_fill (uint8_t *, size_t size, bool compressible);
+
+#endif /* tests/vm/bench/vmbench.h */
@@ -0,0 +1,58 @@
+/* Fills 2 MB of memory, more than fits in the user pool, so that
+   much of it is in swap, and then forks.  The child must see the
+   parent's data, including the pages that were swapped out at
+   the time of the fork, and the parent's data must survive the
+   child overwriting every other page of it.  Overwriting all of
+   it would need 4 MB of private copies, which is all of swap. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+
+static char buf[SIZE];
+
+/* Returns the byte that the parent stores at offset OFS. */
+static char
+pattern (size_t ofs)
+{
+  return ofs / 4096 + ofs % 251;
+}
+
+/* Fails with MESSAGE unless BUF holds the parent's data. */
+static void
+check_pattern (const char *message)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != pattern (i))
+      fail ("%s: byte %zu is %d, not %d", message, i, buf[i], pattern (i));
+}
+
+void
+test_main (void)
+{
+  pid_t pid;
+  size_t i;
+
+  msg ("initialize");
+  for (i = 0; i < SIZE; i++)
+    buf[i] = pattern (i);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      check_pattern ("child");
+      for (i = 0; i < SIZE; i += 2 * 4096)
+        memset (buf + i, 0, 4096);
+      exit (81);
+    }
+  if (pid == PID_ERROR)
+    fail ("fork failed");
+  msg ("wait(fork()) = %d", wait (pid));
+  check_pattern ("parent");
+  msg ("parent's data intact");
+}
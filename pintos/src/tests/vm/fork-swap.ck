@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-swap) begin
+(fork-swap) initialize
+fork-swap: exit(81)
+(fork-swap) wait(fork()) = 81
+(fork-swap) parent's data intact
+(fork-swap) end
+fork-swap: exit(0)
+EOF
+pass;
@@ -31,6 +31,8 @@ Dividing two fixed-point values x and y: ((int64_t) x) * f / y.
 #ifndef THREADS_FIXED_POINT_H
 #define THREADS_FIXED_POINT_H
 
+#include <stdint.h>
+
 #define fp_t int
 #define P 17
 #define Q 14
@@ -48,8 +50,35 @@ Dividing two fixed-point values x and y: ((int64_t) x) * f / y.
 #define FIXED_TO_INT_ROUND_TOWARDS_ZERO(x) (x) / (F)
 #define FIXED_TO_INT_ROUND_TOWARDS_NEAR(x) ((x) >= 0 ? ((x) + (F) / 2) / (F) : ((x) - (F) / 2) / (F))
 #define FIXED_MULTIPLY(x, y) ((int64_t)(x)) * (y) / (F)
-#define FIXED_DIVISION(x, y) ((int64_t)(x)) * (F) / (y)
+#define FIXED_DIVISION(x, y) fixed_divide_64 (((int64_t)(x)) * (F), (y))
 #define FIXED_ADD(x, y) (x) + (y)
 #define FIXED_SUB(x, y) (x) - (y)
 
+/* Constant coefficients of the load average, 59/60 and 1/60. */
+#define FIXED_59_60 (CONVERT_TO_FIXED (59) / 60)
+#define FIXED_1_60 (CONVERT_TO_FIXED (1) / 60)
+
+/* Returns N / D, rounded toward zero like C division, for the
+   fixed-point macros.  A fixed-point quotient fits in 32 bits, so
+   when that is certain a single IDIVL divides the 64-bit N by D,
+   instead of the long software division in __divdi3().  IDIVL
+   faults if the quotient overflows, so other cases still take
+   the 64-bit path.  Dividing by a constant power of 2, as
+   FIXED_INT_DIVIDE and the conversions do, already compiles to
+   shifts. */
+static inline int
+fixed_divide_64 (int64_t n, int d)
+{
+  uint64_t n_mag = n < 0 ? -(uint64_t) n : (uint64_t) n;
+  uint32_t d_mag = d < 0 ? -(uint32_t) d : (uint32_t) d;
+
+  if ((n_mag >> 31) < d_mag)
+    {
+      int q, r;
+      asm ("idivl %3" : "=a" (q), "=d" (r) : "A" (n), "rm" (d));
+      return q;
+    }
+  return n / d;
+}
+
 #endif
@@ -13,18 +13,28 @@
 #include "devices/serial.h"
 #include "devices/shutdown.h"
 #include "devices/timer.h"
+#include "devices/tty.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "devices/watchdog.h"
+#include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
+#include "threads/smp.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/tsc.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
+#include "userprog/futex.h"
 #include "userprog/gdt.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
@@ -34,13 +44,26 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/stripe.h"
+#include "devices/virtio-blk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/shm.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
 
+/* Is CR4.PSE set? */
+bool init_large_pages;
+
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
@@ -57,13 +80,36 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* -bootstat: Print how long each phase of boot took? */
+static bool bootstat;
+
+/* Ends of boot phases, timed with the time stamp counter.  The
+   counter's rate is not known until timer_calibrate(), so they
+   are converted to microseconds only when printed. */
+#define BOOT_PHASE_MAX 16
+struct boot_phase
+  {
+    const char *name;           /* Phase that just ended. */
+    uint64_t tsc;               /* Time stamp counter at its end. */
+  };
+static struct boot_phase boot_phases[BOOT_PHASE_MAX];
+static size_t boot_phase_cnt;
+
 static void bss_init (void);
 static void paging_init (void);
+static bool cpu_has_pse (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
+static void parse_slices (char *value);
+static void parse_idle (char *value);
+#ifndef SCHED_PRIORITY
+static void select_mlfqs (bool incremental);
+#endif
 static void run_actions (char **argv);
 static void usage (void);
+static void boot_phase (const char *name);
+static void print_boot_phases (void);
 
 #ifdef FILESYS
 static void locate_block_devices (void);
@@ -80,6 +126,7 @@ main (void)
 
   /* Clear BSS. */  
   bss_init ();
+  boot_phase ("start");
 
   /* Break command line into arguments and parse options. */
   argv = read_command_line ();
@@ -97,7 +144,14 @@ main (void)
   /* Initialize memory system. */
   palloc_init (user_page_limit);
   malloc_init ();
+  kmem_init ();
   paging_init ();
+#ifdef VM
+  frame_init ();
+  page_init ();
+  shm_init ();
+#endif
+  boot_phase ("memory");
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -110,23 +164,46 @@ main (void)
   timer_init ();
   kbd_init ();
   input_init ();
+  tty_init ();
 #ifdef USERPROG
   exception_init ();
   syscall_init ();
+  process_init ();
+  futex_init ();
 #endif
+  boot_phase ("interrupts");
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
   serial_init_queue ();
+  boot_phase ("threads");
   timer_calibrate ();
+  watchdog_init ();
+  boot_phase ("timer");
+  smp_init ();
+  boot_phase ("smp");
+  wq_init ();
+  console_start_klog ();
 
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  virtio_blk_init ();
+  ramdisk_init ();
+  stripe_init ();
+  boot_phase ("ide");
   locate_block_devices ();
   filesys_init (format_filesys);
+  boot_phase ("filesys");
+#endif
+#ifdef VM
+  swap_init ();
+  frame_start_reclaim ();
+  boot_phase ("swap");
 #endif
 
+  if (bootstat)
+    print_boot_phases ();
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
@@ -137,6 +214,35 @@ main (void)
   thread_exit ();
 }
 
+/* Records that boot phase NAME has just ended. */
+static void
+boot_phase (const char *name)
+{
+  if (boot_phase_cnt < BOOT_PHASE_MAX)
+    {
+      struct boot_phase *p = &boot_phases[boot_phase_cnt++];
+      p->name = name;
+      p->tsc = rdtsc ();
+    }
+}
+
+/* Prints the time each boot phase took, and the time from the
+   end of the first one, when the loader handed over to us.  The
+   loader's own time is not known. */
+static void
+print_boot_phases (void)
+{
+  size_t i;
+
+  for (i = 1; i < boot_phase_cnt; i++)
+    {
+      const struct boot_phase *p = &boot_phases[i];
+      printf ("bootstat: %-10s %8"PRIu64" us, %8"PRIu64" us since start\n",
+              p->name, clock_cycles_to_ns (p->tsc - p[-1].tsc) / 1000,
+              clock_cycles_to_ns (p->tsc - boot_phases[0].tsc) / 1000);
+    }
+}
+
 /* Clear the "BSS", a segment that should be initialized to
    zeros.  It isn't actually stored on disk or zeroed by the
    kernel loader, so we have to zero it ourselves.
@@ -153,13 +259,32 @@ bss_init (void)
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports 4 MB pages, each 4 MB region of RAM that
+   lies wholly within memory and holds no kernel text is mapped
+   by a single page directory entry, which saves a page table and
+   takes one TLB entry instead of 1024.  The kernel text stays
+   mapped with 4 kB pages so that it can be read-only. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  const size_t large_pages = PTSPAN / PGSIZE;
+  /* Guard pages below thread stacks are unmapped one at a time,
+     so they need 4 kB mappings. */
+  bool pse = cpu_has_pse () && !THREAD_STACK_GUARD;
+
+  /* Set CR4.PSE, so that the CPU honors PTE_PS in PDEs. */
+  if (pse)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 | 0x10));
+    }
+  init_large_pages = pse;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -173,6 +298,14 @@ paging_init (void)
 
       if (pd[pde_idx] == 0)
         {
+          if (pse && pte_idx == 0
+              && init_ram_pages - page >= large_pages
+              && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+            {
+              pd[pde_idx] = pde_create_large (vaddr);
+              page += large_pages - 1;
+              continue;
+            }
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
@@ -188,6 +321,27 @@ paging_init (void)
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
 }
 
+/* Returns true if the CPU supports 4 MB pages, as reported by the
+   CPUID instruction.  CPUID exists if EFLAGS.ID can be changed.
+   See [IA32-v2a] "CPUID--CPU Identification". */
+static bool
+cpu_has_pse (void)
+{
+  uint32_t flags, toggled, eax, ebx, ecx, edx;
+
+  asm volatile ("pushfl; popl %0" : "=r" (flags));
+  asm volatile ("pushl %1; popfl; pushfl; popl %0"
+                : "=r" (toggled) : "r" (flags ^ FLAG_ID) : "cc");
+  asm volatile ("pushl %0; popfl" : : "r" (flags) : "cc");
+  if (((flags ^ toggled) & FLAG_ID) == 0)
+    return false;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  return (edx & (1 << 3)) != 0;
+}
+
 /* Breaks the kernel command line into words and returns them as
    an argv-like array. */
 static char **
@@ -247,15 +401,75 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        {
+          if (value == NULL || atoi (value) <= 0)
+            PANIC ("bad -ramdisk argument (use -h for help)");
+          ramdisk_kb = atoi (value);
+        }
+      else if (!strcmp (name, "-stripe"))
+        {
+          if (value == NULL)
+            PANIC ("bad -stripe argument (use -h for help)");
+          stripe_members = value;
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-stack"))
+        {
+          if (value == NULL || atoi (value) <= 0)
+            PANIC ("bad -stack argument (use -h for help)");
+          page_stack_limit = (size_t) atoi (value) * 1024;
+        }
+      else if (!strcmp (name, "-zswap"))
+        {
+          if (value == NULL || atoi (value) < 0)
+            PANIC ("bad -zswap argument (use -h for help)");
+          zswap_pages = atoi (value);
+        }
 #endif
 #endif
+      else if (!strcmp (name, "-bootstat"))
+        bootstat = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-hz"))
+        {
+          if (value == NULL || !timer_set_freq (atoi (value)))
+            PANIC ("bad -hz argument (use -h for help)");
+        }
+      else if (!strcmp (name, "-loops"))
+        timer_loops_per_sec = atoi (value);
+      else if (!strcmp (name, "-watchdog"))
+        watchdog_ms = atoi (value);
+      else if (!strcmp (name, "-klog"))
+        console_klog = true;
+      else if (!strcmp (name, "-profile"))
+        profile_enabled = true;
+      else if (!strcmp (name, "-trace"))
+        trace_enabled = true;
+      else if (!strcmp (name, "-slice"))
+        parse_slices (value);
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
+#ifndef SCHED_PRIORITY
       else if (!strcmp (name, "-mlfqs"))
-        thread_mlfqs = true;
+        select_mlfqs (false);
+      else if (!strcmp (name, "-mlfqs-incremental"))
+        select_mlfqs (true);
+#endif
+      else if (!strcmp (name, "-cfs"))
+        thread_cfs = true;
+      else if (!strcmp (name, "-idle"))
+        parse_idle (value);
+      else if (!strcmp (name, "-smp"))
+        {
+          if (value == NULL || atoi (value) < 1
+              || atoi (value) > THREAD_CPU_CNT)
+            PANIC ("bad -smp argument (use -h for help)");
+          smp_max_cpus = atoi (value);
+        }
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -277,6 +491,70 @@ parse_options (char **argv)
   return argv;
 }
 
+#ifndef SCHED_PRIORITY
+/* Selects the multi-level feedback queue scheduler, recomputing
+   priorities incrementally if INCREMENTAL is true.  A kernel
+   built with -DSCHED_MLFQS always uses it. */
+static void
+select_mlfqs (bool incremental)
+{
+#ifndef SCHED_MLFQS
+  thread_mlfqs = true;
+#endif
+  if (incremental)
+    thread_mlfqs_incremental = true;
+}
+#endif
+
+/* Parses VALUE, the argument to "-slice", which gives either one
+   time slice for all threads or three comma-separated slices for
+   threads below, at, and above the default priority. */
+static void
+parse_slices (char *value)
+{
+  int slices[3];
+  char *token, *save_ptr;
+  int cnt = 0;
+
+  if (value == NULL)
+    PANIC ("-slice requires an argument");
+  for (token = strtok_r (value, ",", &save_ptr); token != NULL;
+       token = strtok_r (NULL, ",", &save_ptr))
+    {
+      if (cnt >= 3 || (slices[cnt] = atoi (token)) <= 0)
+        PANIC ("bad -slice argument (use -h for help)");
+      cnt++;
+    }
+  if (cnt == 1)
+    thread_set_slices (slices[0], slices[0], slices[0]);
+  else if (cnt == 3)
+    thread_set_slices (slices[0], slices[1], slices[2]);
+  else
+    PANIC ("bad -slice argument (use -h for help)");
+}
+
+/* Parses VALUE, the argument to "-idle": "halt" to halt the CPU
+   as soon as it is idle, or "poll", optionally followed by ":US",
+   to poll for US microseconds first. */
+static void
+parse_idle (char *value)
+{
+  char *mode, *us, *save_ptr;
+
+  if (value == NULL)
+    PANIC ("-idle requires an argument");
+  mode = strtok_r (value, ":", &save_ptr);
+  us = strtok_r (NULL, "", &save_ptr);
+  if (mode != NULL && !strcmp (mode, "halt") && us == NULL)
+    thread_idle_poll_us = 0;
+  else if (mode != NULL && !strcmp (mode, "poll") && us == NULL)
+    thread_idle_poll_us = IDLE_POLL_DEFAULT_US;
+  else if (mode != NULL && !strcmp (mode, "poll") && atoi (us) > 0)
+    thread_idle_poll_us = atoi (us);
+  else
+    PANIC ("bad -idle argument (use -h for help)");
+}
+
 /* Runs the task specified in ARGV[1]. */
 static void
 run_task (char **argv)
@@ -373,16 +651,38 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=KB        Add a KB kB RAM disk named `ramdisk'.\n"
+          "  -stripe=BDEV,...   Stripe BDEVs together into a device named `md0'.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -stack=KB          Let user stacks grow to KB kB (default 8192).\n"
+          "  -zswap=PAGES       Keep up to PAGES pages of compressed swap (default 64).\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
+          "  -bootstat          Print how long each phase of boot took.\n"
+          "  -hz=N              Take N timer ticks per second (%d to %d, default %d).\n"
+          "  -tickless          Stop the periodic timer tick while idle.\n"
+          "  -loops=N           Assume N delay loops/s instead of calibrating.\n"
+          "  -watchdog=MS       Report stalls over MS ms, timed by the RTC.\n"
+          "  -klog              Write console output from a background thread.\n"
+          "  -profile           Sample kernel code addresses on each tick.\n"
+          "  -trace             Trace scheduler events; dump at shutdown.\n"
+#ifndef SCHED_PRIORITY
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -mlfqs-incremental Same, recomputing idle priorities once per second.\n"
+#endif
+          "  -cfs               Use fair-share scheduler, weighted by nice.\n"
+          "  -slice=N[,N,N]     Time slice in ticks, for all threads or for\n"
+          "                     threads below, at, and above default priority.\n"
+          "  -idle=poll[:US]    Poll for US microseconds (default %d) before\n"
+          "                     halting the idle CPU.  -idle=halt halts at once.\n"
+          "  -smp=N             Use up to N CPUs (1 to %d, default 1).\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
-          );
+          , TIMER_FREQ_MIN, TIMER_FREQ_MAX, TIMER_FREQ_DEFAULT,
+          IDLE_POLL_DEFAULT_US, THREAD_CPU_CNT);
   shutdown_power_off ();
 }
 
@@ -9,4 +9,8 @@
 /* Page directory with kernel mappings only. */
 extern uint32_t *init_page_dir;
 
+/* Is CR4.PSE set, so that page directory entries may map 4 MB
+   pages? */
+extern bool init_large_pages;
+
 #endif /* threads/init.h */
@@ -6,8 +6,12 @@
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
+#include "threads/smp.h"
 #include "threads/thread.h"
+#include "threads/tsc.h"
 #include "threads/vaddr.h"
+#include "devices/ioapic.h"
+#include "devices/lapic.h"
 #include "devices/timer.h"
 
 /* Programmable Interrupt Controller (PIC) registers.
@@ -18,6 +22,15 @@
 #define PIC1_CTRL	0xa0    /* Slave PIC control register address. */
 #define PIC1_DATA	0xa1    /* Slave PIC data register address. */
 
+/* IRQ lines masked at the PICs, or at the IOAPIC once
+   intr_init_ioapic() has switched to it, bit N for IRQ N. */
+static uint16_t pic_mask;
+
+/* True once external interrupts come through the IOAPIC instead
+   of the PICs, and the CPU each IRQ is sent to then. */
+static bool use_ioapic;
+static int irq_cpus[16];
+
 /* Number of x86 interrupts. */
 #define INTR_CNT 256
 
@@ -33,23 +46,122 @@ static intr_handler_func *intr_handlers[INTR_CNT];
 /* Names for each interrupt, for debugging purposes. */
 static const char *intr_names[INTR_CNT];
 
+/* Local APIC interrupts (see devices/lapic.h).  Those in
+   lapic_vec are handled like external interrupts.  Those in
+   ipi_vec, sent by other CPUs, are answered at once without the
+   kernel lock, which the sender may be holding while it waits for
+   the answer. */
+static bool lapic_vec[INTR_CNT];
+static bool ipi_vec[INTR_CNT];
+
+#ifdef INTR_STATS
+/* Interrupt statistics, kept only with INTR_STATS defined, since
+   they cost a pair of RDTSCs per interrupt and per interrupt-off
+   span.  Times are in CPU cycles.  Handlers of internal
+   interrupts run with interrupts on, so their counts may be
+   slightly off when an interrupt nests in the middle of an
+   update.  With more than one CPU, the interrupts-off span is the
+   last one to begin on any CPU, so spans are only approximate. */
+struct intr_stats
+  {
+    unsigned long long count;   /* Number of interrupts. */
+    uint64_t cycles;            /* Total time in the handler. */
+    uint64_t max_cycles;        /* Longest time in the handler. */
+  };
+static struct intr_stats intr_stats[INTR_CNT];
+
+/* Time spent with interrupts off, by the code address that
+   turned them off.  A span begins when intr_disable() or
+   intr_set_level() turns interrupts off and ends when they are
+   turned back on, possibly in another thread, or when an
+   interrupt returns to code that had them on.  Spans begun by
+   the CPU on interrupt entry are accounted to the interrupt
+   instead.  Sites beyond the table's capacity are not
+   accounted. */
+struct intr_off_site
+  {
+    void *site;                 /* Caller that turned off interrupts. */
+    unsigned long long count;   /* Number of spans. */
+    uint64_t cycles;            /* Total length of spans. */
+    uint64_t max_cycles;        /* Longest span. */
+  };
+#define OFF_SITE_CNT 64         /* Size of off_sites, a power of 2. */
+static struct intr_off_site off_sites[OFF_SITE_CNT];
+static void *off_site;          /* Site of the current span, or null. */
+static uint64_t off_start;      /* Start of the current span. */
+
+static void off_span_begin (void *site);
+static void off_span_end (void);
+#endif /* INTR_STATS */
+
+static enum intr_level disable (void *site);
+
 /* Number of unexpected interrupts for each vector.  An
    unexpected interrupt is one that has no registered handler. */
 static unsigned int unexpected_cnt[INTR_CNT];
 
-/* External interrupts are those generated by devices outside the
+/* Interrupt state of one CPU.
+
+   External interrupts are those generated by devices outside the
    CPU, such as the timer.  External interrupts run with
    interrupts turned off, so they never nest, nor are they ever
    pre-empted.  Handlers for external interrupts also may not
    sleep, although they may invoke intr_yield_on_return() to
    request that a new process be scheduled just before the
    interrupt returns. */
-static bool in_external_intr;   /* Are we processing an external interrupt? */
-static bool yield_on_return;    /* Should we yield on interrupt return? */
+struct intr_cpu
+  {
+    bool in_external_intr;      /* Are we processing an external interrupt? */
+    bool yield_on_return;       /* Should we yield on interrupt return? */
+    bool timer_tail;            /* Tick done, rest left to intr_handler()? */
+    bool in_softirq;            /* Are we running soft interrupts? */
+  };
+static struct intr_cpu intr_cpus[THREAD_CPU_CNT];
+
+/* Returns the running CPU's interrupt state.  Interrupts must be
+   off, or the caller otherwise kept from moving to another
+   CPU. */
+static inline struct intr_cpu *
+this_cpu (void)
+{
+  return &intr_cpus[smp_cpu ()];
+}
+
+/* The timer interrupt, at every tick, has its own entry stub,
+   intr_timer_stub, which saves only the registers C code may
+   clobber and calls intr_timer_fast().  That runs timer_fast,
+   which handles a plain tick, and returns through IRET if nothing
+   more is due.  Otherwise the stub goes on to intr20_stub, and
+   the interrupt takes the usual path through intr_handler().  If
+   timer_fast did the tick, intr_handler() finds timer_tail set
+   and only runs soft interrupts and preempts. */
+static intr_fast_func *timer_fast;
+
+/* Soft interrupts are the deferred halves of external interrupt
+   handlers.  A handler raises one with intr_raise_softirq() to
+   have work done just after the interrupt is acknowledged, with
+   interrupts turned back on, so that other devices' interrupts
+   are not held up behind it.  Soft interrupt handlers count as
+   interrupt context: they may not sleep, but they may call
+   intr_yield_on_return().  External interrupts that arrive while
+   soft interrupts run do not run soft interrupts themselves or
+   yield; they leave that to the interrupt they arrived in. */
+static intr_softirq_func *softirq_handlers[SOFTIRQ_CNT];
+static unsigned softirq_pending; /* Bit N set if soft interrupt N is due. */
+
+/* Number of times run_softirqs() goes back for soft interrupts
+   raised while it ran before leaving them to the next
+   interrupt. */
+#define SOFTIRQ_RESTARTS 4
+
+static void run_softirqs (void);
 
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
+static void pic_unmask (int irq);
 static void pic_end_of_interrupt (int irq);
+static void ioapic_update (int irq);
+static void end_of_interrupt (int vec);
 
 /* Interrupt Descriptor Table helpers. */
 static uint64_t make_intr_gate (void (*) (void), int dpl);
@@ -58,6 +170,7 @@ static inline uint64_t make_idtr_operand (uint16_t limit, void *base);
 
 /* Interrupt handlers. */
 void intr_handler (struct intr_frame *args);
+bool intr_timer_fast (void);
 static void unexpected_interrupt (const struct intr_frame *);
 
 /* Returns the current interrupt status. */
@@ -80,7 +193,9 @@ intr_get_level (void)
 enum intr_level
 intr_set_level (enum intr_level level) 
 {
-  return level == INTR_ON ? intr_enable () : intr_disable ();
+  return (level == INTR_ON
+          ? intr_enable ()
+          : disable (__builtin_return_address (0)));
 }
 
 /* Enables interrupts and returns the previous interrupt status. */
@@ -88,12 +203,18 @@ enum intr_level
 intr_enable (void) 
 {
   enum intr_level old_level = intr_get_level ();
-  ASSERT (!intr_context ());
+  ASSERT (old_level == INTR_ON || !this_cpu ()->in_external_intr);
 
   /* Enable interrupts by setting the interrupt flag.
 
      See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
      Hardware Interrupts". */
+#ifdef INTR_STATS
+  if (old_level == INTR_OFF)
+    off_span_end ();
+#endif
+  if (old_level == INTR_OFF && smp_lock_held ())
+    smp_unlock ();
   asm volatile ("sti");
 
   return old_level;
@@ -102,6 +223,15 @@ intr_enable (void)
 /* Disables interrupts and returns the previous interrupt status. */
 enum intr_level
 intr_disable (void) 
+{
+  return disable (__builtin_return_address (0));
+}
+
+/* Disables interrupts for caller SITE and returns the previous
+   interrupt status.  With more than one CPU, turning interrupts
+   off also takes the kernel lock (see threads/smp.c). */
+static enum intr_level
+disable (void *site UNUSED) 
 {
   enum intr_level old_level = intr_get_level ();
 
@@ -109,7 +239,13 @@ intr_disable (void)
      See [IA32-v2b] "CLI" and [IA32-v3a] 5.8.1 "Masking Maskable
      Hardware Interrupts". */
   asm volatile ("cli" : : : "memory");
+  if (old_level == INTR_ON && smp_active)
+    smp_lock ();
 
+#ifdef INTR_STATS
+  if (old_level == INTR_ON)
+    off_span_begin (site);
+#endif
   return old_level;
 }
 
@@ -157,6 +293,15 @@ intr_init (void)
   intr_names[19] = "#XF SIMD Floating-Point Exception";
 }
 
+/* Loads the IDT that intr_init() built into the running CPU,
+   which smp_init() is starting. */
+void
+intr_init_ap (void)
+{
+  uint64_t idtr_operand = make_idtr_operand (sizeof idt - 1, idt);
+  asm volatile ("lidt %0" : : "m" (idtr_operand));
+}
+
 /* Registers interrupt VEC_NO to invoke HANDLER with descriptor
    privilege level DPL.  Names the interrupt NAME for debugging
    purposes.  The interrupt handler will be invoked with
@@ -183,6 +328,109 @@ intr_register_ext (uint8_t vec_no, intr_handler_func *handler,
 {
   ASSERT (vec_no >= 0x20 && vec_no <= 0x2f);
   register_handler (vec_no, 0, INTR_OFF, handler, name);
+  pic_unmask (vec_no);
+}
+
+/* Sends external interrupts through the IOAPIC, which
+   ioapic_init() has set up, instead of through the PICs, which
+   are masked.  Every IRQ goes to the boot CPU until
+   intr_set_irq_affinity() moves it.  The slave PIC's cascade
+   line, IRQ 2, has no device of its own and is left off the
+   IOAPIC. */
+void
+intr_init_ioapic (void)
+{
+  enum intr_level old_level;
+  int irq;
+
+  ASSERT (ioapic_present ());
+
+  old_level = intr_disable ();
+  outb (PIC0_DATA, 0xff);
+  outb (PIC1_DATA, 0xff);
+  use_ioapic = true;
+  for (irq = 0; irq < 16; irq++)
+    if (irq != 2)
+      ioapic_update (irq);
+  intr_set_level (old_level);
+}
+
+/* Sends external interrupt VEC_NO to CPU, so that its handler
+   runs there.  Returns false, changing nothing, if interrupts do
+   not come through the IOAPIC, CPU is not online, or VEC_NO is
+   the timer's, which stays with the boot CPU: its ticks are the
+   boot CPU's, beside the other CPUs' local APIC timers. */
+bool
+intr_set_irq_affinity (uint8_t vec_no, int cpu)
+{
+  enum intr_level old_level;
+  int irq = vec_no - 0x20;
+
+  if (!use_ioapic || vec_no <= 0x20 || vec_no > 0x2f || irq == 2
+      || cpu < 0 || cpu >= THREAD_CPU_CNT || !cpus[cpu].online)
+    return false;
+
+  old_level = intr_disable ();
+  irq_cpus[irq] = cpu;
+  ioapic_update (irq);
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Returns the CPU that external interrupt VEC_NO is sent to. */
+int
+intr_get_irq_affinity (uint8_t vec_no)
+{
+  ASSERT (vec_no >= 0x20 && vec_no <= 0x2f);
+  return irq_cpus[vec_no - 0x20];
+}
+
+/* Registers local APIC interrupt VEC_NO to invoke HANDLER, which
+   is named NAME for debugging purposes.  The handler runs like
+   an external interrupt's, on whichever CPU the local APIC
+   raising it belongs to. */
+void
+intr_register_lapic (uint8_t vec_no, intr_handler_func *handler,
+                     const char *name)
+{
+  ASSERT (vec_no >= 0xf0 && vec_no < 0xff);
+  register_handler (vec_no, 0, INTR_OFF, handler, name);
+  lapic_vec[vec_no] = true;
+}
+
+/* Registers inter-processor interrupt VEC_NO to invoke HANDLER,
+   which is named NAME for debugging purposes.  The handler runs
+   with interrupts off but without the kernel lock, so it may
+   touch nothing but the running CPU's own state, and not count
+   as interrupt context. */
+void
+intr_register_ipi (uint8_t vec_no, intr_handler_func *handler,
+                   const char *name)
+{
+  ASSERT (vec_no >= 0xf0 && vec_no < 0xff);
+  register_handler (vec_no, 0, INTR_OFF, handler, name);
+  ipi_vec[vec_no] = true;
+}
+
+/* Registers FAST as the fast path of the timer interrupt, whose
+   handler must already be registered.  FAST is called with
+   interrupts off in external interrupt context, like a handler,
+   but without an interrupt frame.  It should do the work of a
+   tick that needs no frame and return true, or return false if
+   the handler should do it instead.
+
+   With INTR_STATS, which accounts every interrupt in
+   intr_handler(), every tick goes through the handler. */
+void
+intr_register_timer_fast (intr_fast_func *fast)
+{
+  ASSERT (intr_handlers[0x20] != NULL);
+  ASSERT (timer_fast == NULL);
+
+  timer_fast = fast;
+#ifndef INTR_STATS
+  idt[0x20] = make_intr_gate (intr_timer_stub, 0);
+#endif
 }
 
 /* Registers internal interrupt VEC_NO to invoke HANDLER, which
@@ -202,16 +450,28 @@ void
 intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
                    intr_handler_func *handler, const char *name)
 {
-  ASSERT (vec_no < 0x20 || vec_no > 0x2f);
+  ASSERT (vec_no < 0x20 || (vec_no > 0x2f && vec_no < 0xf0));
   register_handler (vec_no, dpl, level, handler, name);
 }
 
-/* Returns true during processing of an external interrupt
-   and false at all other times. */
+/* Returns true during processing of an external interrupt or
+   soft interrupt and false at all other times.  Interrupts are
+   held off for the check, so that the caller is not moved to
+   another CPU in the middle of it; this does not take the kernel
+   lock, which only guards state shared between CPUs. */
 bool
 intr_context (void) 
 {
-  return in_external_intr;
+  struct intr_cpu *c;
+  uint32_t flags;
+  bool context;
+
+  asm volatile ("pushfl; popl %0; cli" : "=g" (flags) : : "memory");
+  c = this_cpu ();
+  context = c->in_external_intr || c->in_softirq;
+  if (flags & FLAG_IF)
+    asm volatile ("sti" : : : "memory");
+  return context;
 }
 
 /* During processing of an external interrupt, directs the
@@ -222,7 +482,7 @@ void
 intr_yield_on_return (void) 
 {
   ASSERT (intr_context ());
-  yield_on_return = true;
+  this_cpu ()->yield_on_return = true;
 }
 
 /* 8259A Programmable Interrupt Controller. */
@@ -233,7 +493,11 @@ intr_yield_on_return (void)
    interrupt vectors 0...15.  Those vectors are also used for CPU
    traps and exceptions, so we reprogram the PICs so that
    interrupts 0...15 are delivered to interrupt vectors 32...47
-   (0x20...0x2f) instead. */
+   (0x20...0x2f) instead.
+
+   Only the IRQ lines that a handler has been registered for are
+   unmasked, by intr_register_ext(), so that a device nothing
+   drives cannot interrupt the kernel. */
 static void
 pic_init (void)
 {
@@ -253,9 +517,36 @@ pic_init (void)
   outb (PIC1_DATA, 0x02); /* ICW3: slave ID is 2. */
   outb (PIC1_DATA, 0x01); /* ICW4: 8086 mode, normal EOI, non-buffered. */
 
-  /* Unmask all interrupts. */
-  outb (PIC0_DATA, 0x00);
-  outb (PIC1_DATA, 0x00);
+  /* Leave every IRQ line masked until it has a handler. */
+  pic_mask = 0xffff;
+}
+
+/* Unmasks the IRQ line that delivers interrupt vector IRQ, and
+   the master's cascade line too for a slave IRQ, at the PICs or,
+   once interrupts come through it, at the IOAPIC. */
+static void
+pic_unmask (int irq) 
+{
+  ASSERT (irq >= 0x20 && irq < 0x30);
+
+  pic_mask &= ~(1u << (irq - 0x20));
+  if (use_ioapic)
+    {
+      ioapic_update (irq - 0x20);
+      return;
+    }
+  if (irq >= 0x28)
+    pic_mask &= ~(1u << 2);
+  outb (PIC0_DATA, pic_mask & 0xff);
+  outb (PIC1_DATA, pic_mask >> 8);
+}
+
+/* Programs IRQ's IOAPIC entry from pic_mask and irq_cpus[]. */
+static void
+ioapic_update (int irq)
+{
+  ioapic_route (irq, 0x20 + irq, cpus[irq_cpus[irq]].apic_id,
+                (pic_mask & (1u << irq)) != 0);
 }
 
 /* Sends an end-of-interrupt signal to the PIC for the given IRQ.
@@ -273,6 +564,18 @@ pic_end_of_interrupt (int irq)
   if (irq >= 0x28)
     outb (0xa0, 0x20);
 }
+
+/* Signals the end of external interrupt VEC to the PIC or local
+   APIC that raised it.  An IRQ that came through the IOAPIC is
+   acknowledged at the local APIC that took it. */
+static void
+end_of_interrupt (int vec)
+{
+  if (vec >= 0x20 && vec < 0x30 && !use_ioapic)
+    pic_end_of_interrupt (vec);
+  else
+    lapic_eoi ();
+}
 
 /* Creates an gate that invokes FUNCTION.
 
@@ -344,28 +647,60 @@ make_idtr_operand (uint16_t limit, void *base)
 void
 intr_handler (struct intr_frame *frame) 
 {
+  struct intr_cpu *c;
   bool external;
   intr_handler_func *handler;
+#ifdef INTR_STATS
+  uint64_t start;
+#endif
+
+  /* Inter-processor interrupts are answered without the kernel
+     lock and without counting as interrupt context. */
+  if (ipi_vec[frame->vec_no])
+    {
+      intr_handlers[frame->vec_no] (frame);
+      lapic_eoi ();
+      return;
+    }
+
+  /* An interrupt that came in through an interrupt gate, with
+     interrupts off, takes the kernel lock, unless the code it
+     interrupted held it already. */
+  if (smp_active && intr_get_level () == INTR_OFF && !smp_lock_held ())
+    smp_lock ();
 
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off)
      and they need to be acknowledged on the PIC (see below).
      An external interrupt handler cannot sleep. */
-  external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
+  c = this_cpu ();
+  external = ((frame->vec_no >= 0x20 && frame->vec_no < 0x30)
+              || lapic_vec[frame->vec_no]);
   if (external) 
     {
       ASSERT (intr_get_level () == INTR_OFF);
-      ASSERT (!intr_context ());
+      ASSERT (!c->in_external_intr);
 
-      in_external_intr = true;
-      yield_on_return = false;
+      c->in_external_intr = true;
+      if (!c->in_softirq && !c->timer_tail)
+        c->yield_on_return = false;
     }
 
   /* Invoke the interrupt's handler. */
+#ifdef INTR_STATS
+  start = rdtsc ();
+#endif
   handler = intr_handlers[frame->vec_no];
-  if (handler != NULL)
+  if (c->timer_tail)
+    {
+      /* intr_timer_fast() already did the tick. */
+      ASSERT (frame->vec_no == 0x20);
+      c->timer_tail = false;
+    }
+  else if (handler != NULL)
     handler (frame);
-  else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f)
+  else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f
+           || frame->vec_no == LAPIC_SPURIOUS_VEC)
     {
       /* There is no handler, but this interrupt can trigger
          spuriously due to a hardware fault or hardware race
@@ -373,6 +708,17 @@ intr_handler (struct intr_frame *frame)
     }
   else
     unexpected_interrupt (frame);
+#ifdef INTR_STATS
+  {
+    struct intr_stats *s = &intr_stats[frame->vec_no];
+    uint64_t cycles = rdtsc () - start;
+
+    s->count++;
+    s->cycles += cycles;
+    if (cycles > s->max_cycles)
+      s->max_cycles = cycles;
+  }
+#endif
 
   /* Complete the processing of an external interrupt. */
   if (external) 
@@ -380,12 +726,130 @@ intr_handler (struct intr_frame *frame)
       ASSERT (intr_get_level () == INTR_OFF);
       ASSERT (intr_context ());
 
-      in_external_intr = false;
-      pic_end_of_interrupt (frame->vec_no); 
+      c->in_external_intr = false;
+      end_of_interrupt (frame->vec_no); 
+
+      if (!c->in_softirq)
+        {
+          if (softirq_pending != 0)
+            run_softirqs ();
+
+          /* The thread may resume on another CPU, so C is stale
+             after this. */
+          if (c->yield_on_return) 
+            thread_preempt (); 
+        }
+    }
+
+#ifdef INTR_STATS
+  /* The return will turn interrupts back on. */
+  if (frame->eflags & FLAG_IF)
+    off_span_end ();
+#endif
+
+  /* Leave the kernel lock held exactly if the return leaves
+     interrupts off, whatever the handler did with them. */
+  if (smp_active)
+    {
+      asm volatile ("cli" : : : "memory");
+      if (frame->eflags & FLAG_IF)
+        {
+          if (smp_lock_held ())
+            smp_unlock ();
+        }
+      else if (!smp_lock_held ())
+        smp_lock ();
+    }
+}
+
+/* Fast path of the timer interrupt, called by intr_timer_stub
+   with interrupts off.  Returns true if the interrupt has been
+   handled and acknowledged, false if the stub must go on through
+   intr20_stub to intr_handler(), either to run the timer's
+   handler, if timer_fast declined the tick, or to run soft
+   interrupts and preempt, with timer_tail set.  The timer
+   interrupts only the boot CPU, and with more than one CPU takes
+   the kernel lock, which intr_handler() then finds held. */
+bool
+intr_timer_fast (void)
+{
+  struct intr_cpu *c;
+  bool done;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (smp_active)
+    smp_lock ();
+  c = this_cpu ();
+  ASSERT (!c->in_external_intr);
+
+  c->in_external_intr = true;
+  if (!c->in_softirq)
+    c->yield_on_return = false;
+  done = timer_fast ();
+  c->in_external_intr = false;
+  if (!done)
+    return false;
+  if (!c->in_softirq && (softirq_pending != 0 || c->yield_on_return))
+    {
+      c->timer_tail = true;
+      return false;
+    }
+  end_of_interrupt (0x20);
+  if (smp_active)
+    smp_unlock ();
+  return true;
+}
+
+/* Registers HANDLER to be called for soft interrupt NR. */
+void
+intr_register_softirq (enum softirq nr, intr_softirq_func *handler) 
+{
+  ASSERT (nr < SOFTIRQ_CNT);
+  ASSERT (softirq_handlers[nr] == NULL);
+  softirq_handlers[nr] = handler;
+}
+
+/* Marks soft interrupt NR as due.  It runs as the current
+   external interrupt returns, or on the way out of the next one
+   if there is no current external interrupt. */
+void
+intr_raise_softirq (enum softirq nr) 
+{
+  enum intr_level old_level;
+
+  ASSERT (nr < SOFTIRQ_CNT);
+  ASSERT (softirq_handlers[nr] != NULL);
+
+  old_level = intr_disable ();
+  softirq_pending |= 1u << nr;
+  intr_set_level (old_level);
+}
+
+/* Runs the pending soft interrupts with interrupts on.  Must be
+   called with interrupts off, and returns with them off. */
+static void
+run_softirqs (void) 
+{
+  int restarts;
+
+  ASSERT (intr_get_level () == INTR_OFF);
 
-      if (yield_on_return) 
-        thread_yield (); 
+  this_cpu ()->in_softirq = true;
+  for (restarts = 0; softirq_pending != 0 && restarts < SOFTIRQ_RESTARTS;
+       restarts++)
+    {
+      unsigned pending = softirq_pending;
+      int nr;
+
+      softirq_pending = 0;
+      intr_enable ();
+      for (nr = 0; nr < SOFTIRQ_CNT; nr++)
+        if (pending & (1u << nr))
+          softirq_handlers[nr] ();
+      intr_disable ();
     }
+  this_cpu ()->in_softirq = false;
 }
 
 /* Handles an unexpected interrupt with interrupt frame F.  An
@@ -436,3 +900,69 @@ intr_name (uint8_t vec)
 {
   return intr_names[vec];
 }
+
+#ifdef INTR_STATS
+/* Records that SITE just turned interrupts off. */
+static void
+off_span_begin (void *site) 
+{
+  off_site = site;
+  off_start = rdtsc ();
+}
+
+/* Ends the current interrupts-off span, if any, and charges it to
+   the site that began it.  Interrupts must be off. */
+static void
+off_span_end (void) 
+{
+  uint64_t cycles;
+  size_t i, n;
+
+  if (off_site == NULL)
+    return;
+  cycles = rdtsc () - off_start;
+
+  i = ((uintptr_t) off_site >> 2) & (OFF_SITE_CNT - 1);
+  for (n = 0; n < OFF_SITE_CNT; n++, i = (i + 1) & (OFF_SITE_CNT - 1))
+    {
+      struct intr_off_site *s = &off_sites[i];
+      if (s->site == NULL)
+        s->site = off_site;
+      if (s->site == off_site)
+        {
+          s->count++;
+          s->cycles += cycles;
+          if (cycles > s->max_cycles)
+            s->max_cycles = cycles;
+          break;
+        }
+    }
+  off_site = NULL;
+}
+
+/* Prints per-vector interrupt statistics and the places that
+   kept interrupts off.  Sites are code addresses, which the
+   "backtrace" utility can translate into function names. */
+void
+intr_print_stats (void) 
+{
+  size_t i;
+
+  for (i = 0; i < INTR_CNT; i++)
+    {
+      const struct intr_stats *s = &intr_stats[i];
+      if (s->count > 0)
+        printf ("Interrupt %#04zx (%s): %llu, %"PRIu64" cycles "
+                "(max %"PRIu64")\n", i, intr_names[i], s->count,
+                s->cycles, s->max_cycles);
+    }
+  for (i = 0; i < OFF_SITE_CNT; i++)
+    {
+      const struct intr_off_site *s = &off_sites[i];
+      if (s->site != NULL)
+        printf ("Interrupts off at %p: %llu times, %"PRIu64" cycles "
+                "(max %"PRIu64")\n", s->site, s->count,
+                s->cycles, s->max_cycles);
+    }
+}
+#endif /* INTR_STATS */
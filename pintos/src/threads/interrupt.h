@@ -58,13 +58,37 @@ struct intr_frame
 typedef void intr_handler_func (struct intr_frame *);
 
 void intr_init (void);
+void intr_init_ap (void);
 void intr_register_ext (uint8_t vec, intr_handler_func *, const char *name);
+void intr_register_lapic (uint8_t vec, intr_handler_func *, const char *name);
+void intr_init_ioapic (void);
+bool intr_set_irq_affinity (uint8_t vec, int cpu);
+int intr_get_irq_affinity (uint8_t vec);
+void intr_register_ipi (uint8_t vec, intr_handler_func *, const char *name);
 void intr_register_int (uint8_t vec, int dpl, enum intr_level,
                         intr_handler_func *, const char *name);
 bool intr_context (void);
 void intr_yield_on_return (void);
 
+/* Soft interrupts, in order of precedence. */
+enum softirq
+  {
+    SOFTIRQ_TIMER,              /* Timer tick bookkeeping. */
+    SOFTIRQ_CNT                 /* Number of soft interrupts. */
+  };
+
+typedef void intr_softirq_func (void);
+
+typedef bool intr_fast_func (void);
+void intr_register_timer_fast (intr_fast_func *);
+
+void intr_register_softirq (enum softirq, intr_softirq_func *);
+void intr_raise_softirq (enum softirq);
+
 void intr_dump_frame (const struct intr_frame *);
 const char *intr_name (uint8_t vec);
+#ifdef INTR_STATS
+void intr_print_stats (void);
+#endif
 
 #endif /* threads/interrupt.h */
@@ -16,4 +16,7 @@ extern intr_stub_func *intr_stubs[256];
 /* Interrupt return path. */
 void intr_exit (void);
 
+/* Fast entry point for the timer interrupt. */
+void intr_timer_stub (void);
+
 #endif /* threads/intr-stubs.h */
@@ -4,7 +4,12 @@
 #include <round.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#ifdef MALLOC_STATS
+#include <hash.h>
+#endif
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -32,15 +37,73 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   In front of each descriptor's free list sits a small
+   "magazine" of free blocks that belongs to the CPU rather than
+   to the descriptor.  malloc() and free() use the magazine with
+   interrupts disabled, which is all the synchronization a
+   single CPU needs, and take the descriptor's lock only to
+   refill an empty magazine or drain a full one, moving half a
+   magazine of blocks at a time.  Blocks in a magazine still
+   count as in use by their arenas, so an arena is never freed
+   out from under a magazine. */
+
+/* Maximum number of blocks in a magazine. */
+#define MAG_ROUNDS 16
+
+/* Per-CPU cache of free blocks for one descriptor. */
+struct magazine
+  {
+    size_t cnt;                 /* Number of blocks in ROUNDS. */
+    size_t size;                /* Capacity, at most MAG_ROUNDS. */
+    struct block *rounds[MAG_ROUNDS]; /* Cached free blocks. */
+  };
+
+#ifdef MALLOC_STATS
+/* Allocation counters, kept only with MALLOC_STATS defined.
+   Protected by disabling interrupts. */
+struct alloc_stats
+  {
+    size_t live;                /* Blocks allocated and not freed. */
+    size_t peak;                /* Most blocks ever live at once. */
+    unsigned long long total;   /* Successful allocations. */
+    unsigned long long failures; /* Failed allocations. */
+  };
+
+/* Every SAMPLE_RATE'th allocation is remembered along with the
+   code address that asked for it until it is freed, so that the
+   samples still live at shutdown show roughly where memory is
+   held.  Samples are kept in a table indexed by a hash of the
+   block address; a sample whose slot is taken is dropped. */
+#define SAMPLE_RATE 64
+#define SAMPLE_CNT 1024
+struct alloc_sample
+  {
+    void *block;                /* Sampled block, null if slot free. */
+    void *site;                 /* Caller of malloc() etc. */
+    size_t size;                /* Requested size. */
+  };
+static struct alloc_sample samples[SAMPLE_CNT];
+static unsigned long long alloc_cnt;    /* Allocations counted. */
+static unsigned long long dropped_cnt;  /* Samples dropped. */
+
+/* Number of allocation sites printed by malloc_print_stats(). */
+#define SITES_TOP 20
+#endif
 
 /* Descriptor. */
 struct desc
   {
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
+    size_t arena_cnt;           /* Number of arenas. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+    struct magazine mag;        /* Cached free blocks. */
+#ifdef MALLOC_STATS
+    struct alloc_stats stats;   /* Counters for this block size. */
+#endif
   };
 
 /* Magic number for detecting arena corruption. */
@@ -64,8 +127,18 @@ struct block
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+#ifdef MALLOC_STATS
+static struct alloc_stats big_stats;    /* Counters for big blocks. */
+
+static void count_alloc (size_t size, void *block, void *site);
+static void count_free (void *block);
+static void print_alloc_stats (void);
+#endif
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct block *refill_magazine (struct desc *);
+static void free_blocks (struct desc *, struct block **, size_t);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -79,19 +152,46 @@ malloc_init (void)
       ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
+      d->arena_cnt = 0;
       list_init (&d->free_list);
       lock_init (&d->lock);
+      d->mag.cnt = 0;
+      d->mag.size = (d->blocks_per_arena < MAG_ROUNDS
+                     ? d->blocks_per_arena : MAG_ROUNDS);
     }
 }
 
+static void *get_block (size_t size);
+
+/* Obtains and returns a new block of at least SIZE bytes on
+   behalf of the code at SITE.
+   Returns a null pointer if memory is not available. */
+static inline void *
+allocate (size_t size, void *site UNUSED) 
+{
+  void *p = get_block (size);
+#ifdef MALLOC_STATS
+  count_alloc (size, p, site);
+#endif
+  return p;
+}
+
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+  return allocate (size, __builtin_return_address (0));
+}
+
+/* Does the work of allocate(). */
+static void *
+get_block (size_t size) 
 {
   struct desc *d;
   struct block *b;
   struct arena *a;
+  enum intr_level old_level;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -119,12 +219,36 @@ malloc (size_t size)
       return a + 1;
     }
 
+  /* Take a block from the magazine if it has one. */
+  old_level = intr_disable ();
+  if (d->mag.cnt > 0) 
+    {
+      b = d->mag.rounds[--d->mag.cnt];
+      intr_set_level (old_level);
+      return b;
+    }
+  intr_set_level (old_level);
+
+  return refill_magazine (d);
+}
+
+/* Takes half a magazine of blocks from D's free list, creating a
+   new arena if the list is empty, returns one of them and puts
+   the rest in D's magazine.
+   Returns a null pointer if memory is not available. */
+static struct block *
+refill_magazine (struct desc *d) 
+{
+  struct block *batch[MAG_ROUNDS];
+  size_t batch_cnt, i;
+  enum intr_level old_level;
+
   lock_acquire (&d->lock);
 
   /* If the free list is empty, create a new arena. */
   if (list_empty (&d->free_list))
     {
-      size_t i;
+      struct arena *a;
 
       /* Allocate a page. */
       a = palloc_get_page (0);
@@ -138,6 +262,7 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = d;
       a->free_cnt = d->blocks_per_arena;
+      d->arena_cnt++;
       for (i = 0; i < d->blocks_per_arena; i++) 
         {
           struct block *b = arena_to_block (a, i);
@@ -145,12 +270,28 @@ malloc (size_t size)
         }
     }
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
+  /* Get up to half a magazine of blocks from the free list. */
+  for (batch_cnt = 0; batch_cnt < DIV_ROUND_UP (d->mag.size, 2)
+         && !list_empty (&d->free_list); batch_cnt++) 
+    {
+      struct block *b = list_entry (list_pop_front (&d->free_list),
+                                    struct block, free_elem);
+      block_to_arena (b)->free_cnt--;
+      batch[batch_cnt] = b;
+    }
   lock_release (&d->lock);
-  return b;
+
+  /* Keep the first block for the caller and cache the rest.
+     Another thread may have filled the magazine while we were
+     waiting for the lock, so give back any that don't fit. */
+  old_level = intr_disable ();
+  for (i = 1; i < batch_cnt && d->mag.cnt < d->mag.size; i++)
+    d->mag.rounds[d->mag.cnt++] = batch[i];
+  intr_set_level (old_level);
+  if (i < batch_cnt)
+    free_blocks (d, batch + i, batch_cnt - i);
+
+  return batch[0];
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -167,7 +308,7 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = allocate (size, __builtin_return_address (0));
   if (p != NULL)
     memset (p, 0, size);
 
@@ -185,6 +326,38 @@ block_size (void *block)
   return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
 }
 
+/* Tries to resize OLD_BLOCK to NEW_SIZE bytes without moving
+   it.  A normal block keeps its place if NEW_SIZE still belongs to
+   its descriptor.  A big block gives back the pages it no longer
+   needs or takes the free pages that follow it.  Returns true if
+   successful. */
+static bool
+resize_in_place (void *old_block, size_t new_size) 
+{
+  struct arena *a = block_to_arena (old_block);
+  struct desc *d = a->desc;
+  size_t page_cnt;
+
+  if (d != NULL)
+    return new_size <= d->block_size && (d == descs
+                                         || new_size > d[-1].block_size);
+
+  /* A big block that shrinks into a descriptor's size has to
+     move. */
+  if (new_size <= descs[desc_cnt - 1].block_size)
+    return false;
+
+  page_cnt = DIV_ROUND_UP (new_size + sizeof *a, PGSIZE);
+  if (page_cnt < a->free_cnt)
+    palloc_free_multiple ((uint8_t *) a + page_cnt * PGSIZE,
+                          a->free_cnt - page_cnt);
+  else if (page_cnt > a->free_cnt
+           && !palloc_extend (a, a->free_cnt, page_cnt))
+    return false;
+  a->free_cnt = page_cnt;
+  return true;
+}
+
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
    moving it in the process.
    If successful, returns the new block; on failure, returns a
@@ -199,9 +372,11 @@ realloc (void *old_block, size_t new_size)
       free (old_block);
       return NULL;
     }
+  else if (old_block != NULL && resize_in_place (old_block, new_size))
+    return old_block;
   else 
     {
-      void *new_block = malloc (new_size);
+      void *new_block = allocate (new_size, __builtin_return_address (0));
       if (old_block != NULL && new_block != NULL)
         {
           size_t old_size = block_size (old_block);
@@ -223,36 +398,39 @@ free (void *p)
       struct block *b = p;
       struct arena *a = block_to_arena (b);
       struct desc *d = a->desc;
+
+#ifdef MALLOC_STATS
+      count_free (p);
+#endif
       
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
+          struct block *batch[MAG_ROUNDS + 1];
+          size_t batch_cnt;
+          enum intr_level old_level;
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
 
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+          /* Put the block in the magazine if there's room.
+             Otherwise, drain half of the magazine along with the
+             block back to the free list. */
+          old_level = intr_disable ();
+          if (d->mag.cnt < d->mag.size) 
             {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
+              d->mag.rounds[d->mag.cnt++] = b;
+              intr_set_level (old_level);
+              return;
             }
+          batch[0] = b;
+          for (batch_cnt = 1; batch_cnt <= d->mag.size / 2; batch_cnt++)
+            batch[batch_cnt] = d->mag.rounds[--d->mag.cnt];
+          intr_set_level (old_level);
 
-          lock_release (&d->lock);
+          free_blocks (d, batch, batch_cnt);
         }
       else
         {
@@ -263,6 +441,236 @@ free (void *p)
     }
 }
 
+/* Returns the CNT blocks in BLOCKS to D's free list, freeing any
+   arenas that are left with no blocks in use. */
+static void
+free_blocks (struct desc *d, struct block **blocks, size_t cnt) 
+{
+  size_t i;
+
+  lock_acquire (&d->lock);
+  for (i = 0; i < cnt; i++) 
+    {
+      struct block *b = blocks[i];
+      struct arena *a = block_to_arena (b);
+
+      /* Add block to free list. */
+      list_push_front (&d->free_list, &b->free_elem);
+
+      /* If the arena is now entirely unused, free it. */
+      if (++a->free_cnt >= d->blocks_per_arena) 
+        {
+          size_t j;
+
+          ASSERT (a->free_cnt == d->blocks_per_arena);
+          for (j = 0; j < d->blocks_per_arena; j++) 
+            {
+              struct block *b = arena_to_block (a, j);
+              list_remove (&b->free_elem);
+            }
+          palloc_free_page (a);
+          d->arena_cnt--;
+        }
+    }
+  lock_release (&d->lock);
+}
+
+/* Prints, for each descriptor that has any arenas, how many it
+   has and how many of their blocks are in use, cached in the
+   magazine, and free. */
+void
+malloc_print_stats (void) 
+{
+  struct desc *d;
+
+  for (d = descs; d < descs + desc_cnt; d++) 
+    {
+      size_t arena_cnt, free_cnt, mag_cnt;
+
+      lock_acquire (&d->lock);
+      arena_cnt = d->arena_cnt;
+      free_cnt = list_size (&d->free_list);
+      mag_cnt = d->mag.cnt;
+      lock_release (&d->lock);
+
+      if (arena_cnt != 0)
+        printf ("malloc: %zu-byte blocks: %zu arenas, %zu in use, "
+                "%zu cached, %zu free\n", d->block_size, arena_cnt,
+                arena_cnt * d->blocks_per_arena - free_cnt - mag_cnt,
+                mag_cnt, free_cnt);
+    }
+
+#ifdef MALLOC_STATS
+  print_alloc_stats ();
+#endif
+}
+
+#ifdef MALLOC_STATS
+/* Returns the counters that account for a SIZE-byte request. */
+static struct alloc_stats *
+size_to_stats (size_t size) 
+{
+  struct desc *d;
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->block_size >= size)
+      return &d->stats;
+  return &big_stats;
+}
+
+/* Returns the slot in samples[] for BLOCK. */
+static struct alloc_sample *
+block_to_sample (void *block) 
+{
+  return &samples[hash_int ((uintptr_t) block) % SAMPLE_CNT];
+}
+
+/* Counts a SIZE-byte allocation on behalf of SITE that returned
+   BLOCK, which is null if it failed, and samples it if its turn
+   has come. */
+static void
+count_alloc (size_t size, void *block, void *site) 
+{
+  struct alloc_stats *s;
+  enum intr_level old_level;
+
+  if (size == 0)
+    return;
+
+  s = size_to_stats (size);
+  old_level = intr_disable ();
+  if (block != NULL)
+    {
+      s->total++;
+      if (++s->live > s->peak)
+        s->peak = s->live;
+      if (++alloc_cnt % SAMPLE_RATE == 0) 
+        {
+          struct alloc_sample *sample = block_to_sample (block);
+          if (sample->block == NULL) 
+            {
+              sample->block = block;
+              sample->site = site;
+              sample->size = size;
+            }
+          else
+            dropped_cnt++;
+        }
+    }
+  else
+    s->failures++;
+  intr_set_level (old_level);
+}
+
+/* Counts freeing BLOCK, forgetting its sample if it has one. */
+static void
+count_free (void *block) 
+{
+  struct arena *a = block_to_arena (block);
+  struct alloc_stats *s = a->desc != NULL ? &a->desc->stats : &big_stats;
+  struct alloc_sample *sample = block_to_sample (block);
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  s->live--;
+  if (sample->block == block)
+    sample->block = NULL;
+  intr_set_level (old_level);
+}
+
+/* Live samples taken at one site, for print_alloc_stats(). */
+struct site_total
+  {
+    void *site;                 /* Allocation site. */
+    size_t size;                /* Sum of sampled sizes. */
+    size_t cnt;                 /* Number of samples. */
+  };
+
+/* Orders the sites that A and B point to by address. */
+static int
+compare_sites (const void *a_, const void *b_) 
+{
+  const struct site_total *a = a_;
+  const struct site_total *b = b_;
+  return a->site < b->site ? -1 : a->site > b->site;
+}
+
+/* Orders the sites that A and B point to by size, largest
+   first. */
+static int
+compare_sizes (const void *a_, const void *b_) 
+{
+  const struct site_total *a = a_;
+  const struct site_total *b = b_;
+  return a->size > b->size ? -1 : a->size < b->size;
+}
+
+/* Prints counters S, describing blocks of NAME. */
+static void
+print_counters (const struct alloc_stats *s, const char *name) 
+{
+  if (s->total != 0 || s->failures != 0)
+    printf ("malloc: %s: %zu live, %zu peak, %llu allocated, "
+            "%llu failed\n", name, s->live, s->peak, s->total,
+            s->failures);
+}
+
+/* Prints the allocation counters and the sites that hold the
+   most sampled memory.  Sites are code addresses, which the
+   "backtrace" utility can translate into function names. */
+static void
+print_alloc_stats (void) 
+{
+  static struct site_total sites[SAMPLE_CNT];
+  size_t sample_cnt, site_cnt, i;
+  enum intr_level old_level;
+  struct desc *d;
+  char name[32];
+
+  for (d = descs; d < descs + desc_cnt; d++) 
+    {
+      snprintf (name, sizeof name, "%zu-byte blocks", d->block_size);
+      print_counters (&d->stats, name);
+    }
+  print_counters (&big_stats, "big blocks");
+
+  /* Copy out the live samples. */
+  sample_cnt = 0;
+  old_level = intr_disable ();
+  for (i = 0; i < SAMPLE_CNT; i++)
+    if (samples[i].block != NULL) 
+      {
+        sites[sample_cnt].site = samples[i].site;
+        sites[sample_cnt].size = samples[i].size;
+        sites[sample_cnt].cnt = 1;
+        sample_cnt++;
+      }
+  intr_set_level (old_level);
+  printf ("malloc: sampling 1 in %d allocations: %zu samples live, "
+          "%llu dropped\n", SAMPLE_RATE, sample_cnt, dropped_cnt);
+
+  /* Merge the samples taken at each site. */
+  qsort (sites, sample_cnt, sizeof *sites, compare_sites);
+  site_cnt = 0;
+  for (i = 0; i < sample_cnt; i++)
+    if (site_cnt > 0 && sites[site_cnt - 1].site == sites[i].site) 
+      {
+        sites[site_cnt - 1].size += sites[i].size;
+        sites[site_cnt - 1].cnt++;
+      }
+    else
+      sites[site_cnt++] = sites[i];
+
+  /* Print the sites holding the most, scaled up by the sampling
+     rate. */
+  qsort (sites, site_cnt, sizeof *sites, compare_sizes);
+  for (i = 0; i < site_cnt && i < SITES_TOP; i++)
+    printf ("malloc: %p holds about %zu bytes in %zu blocks\n",
+            sites[i].site, sites[i].size * SAMPLE_RATE,
+            sites[i].cnt * SAMPLE_RATE);
+}
+#endif
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
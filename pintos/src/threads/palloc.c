@@ -2,13 +2,15 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/spinlock.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,25 +25,164 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
 
-/* A memory pool. */
+   The split is only where each pool starts out.  Memory is carved
+   into chunks of LOAN_PAGES pages, and a pool that runs low
+   borrows a wholly free chunk from the other, so long as that
+   leaves the lender a quarter of its pages free.  Whichever pool
+   holds a chunk of the other's hands it back once the chunk is
+   wholly free again and the pool can spare it.  With the "-ul"
+   option the user pool never grows past its limit, though it
+   still lends.
+
+   Within a pool, free pages are managed by a binary buddy
+   allocator.  Free memory is kept as blocks of 2**ORDER pages,
+   each aligned (relative to the arena base) on its own size, on
+   one free list per order.  An allocation of N pages takes the
+   smallest block that fits, splitting larger blocks in half as
+   needed, and gives back the pages beyond N.  Freeing a block
+   merges it with its "buddy", the other half of the block it was
+   split from, for as long as that buddy is free too.  Both take
+   O(log n) time, and coalescing keeps large contiguous runs
+   available as the pool fills and drains.
+
+   Kernel caches that hold on to pages register shrinkers.  When an
+   allocation leaves the kernel pool below its low watermark, or
+   fails outright, the shrinkers are asked to give pages back until
+   the high watermark is free, each in proportion to how much it
+   holds.  (The user pool is kept in check by the frame table's
+   reclaimer instead.) */
+
+/* Number of block orders: blocks of 1 to 2**(ORDER_CNT - 1) pages. */
+#define ORDER_CNT 20
+
+/* Marks a page that does not begin a free block in a pool's
+   order map. */
+#define NOT_FREE 0xff
+
+/* A free buddy block, stored in its own first page. */
+struct free_block
+  {
+    struct list_elem elem;              /* Element in a free list. */
+  };
+
+/* A memory pool.  Both pools index pages from the same arena
+   base, so that chunks can move between them.
+
+   The free lists, maps, and page counts are protected by a
+   spinlock rather than a lock, because pages are freed where
+   sleeping is not allowed, such as when a dying thread's page is
+   released during a context switch, and because the idle thread
+   takes pages to zero, and it must not hold a lock that another
+   thread might donate its priority to.  Buddy operations are
+   short, so interrupts are not off for long. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
-    uint8_t *base;                      /* Base of pool. */
+    struct spinlock lock;               /* Mutual exclusion. */
+    struct bitmap *used_map;            /* Bitmap of pages that are in
+                                           use or not in the pool. */
+    uint8_t *base;                      /* Base of the arena. */
+    size_t page_cnt;                    /* Number of pages in pool. */
+    size_t home_cnt;                    /* Number of pages at boot. */
+    size_t borrowed_cnt;                /* Pages held of the other
+                                           pool's. */
+    struct list free_lists[ORDER_CNT];  /* Free blocks, by order. */
+    uint8_t *order_map;                 /* For each page beginning a free
+                                           block, the block's order;
+                                           otherwise NOT_FREE. */
+
+    /* Pages zeroed ahead of time by the idle thread.  They are
+       marked used in used_map and are handed out to PAL_ZERO
+       requests for single pages.  Protected by disabling
+       interrupts, so that the idle thread never has to wait. */
+    struct list zeroed_pages;           /* Zeroed pages. */
+    size_t zeroed_cnt;                  /* Number of zeroed pages. */
+
+    /* Pages free or pre-zeroed, for palloc_free_cnt().  Protected
+       by disabling interrupts. */
+    size_t free_cnt;
+
+#ifdef MALLOC_STATS
+    /* Allocation counters, kept only with MALLOC_STATS defined.
+       Requests are counted by the order of their page count.
+       Protected by disabling interrupts. */
+    size_t min_free_cnt;                /* Lowest FREE_CNT seen. */
+    unsigned long long requests[ORDER_CNT]; /* Successful requests. */
+    unsigned long long failures[ORDER_CNT]; /* Failed requests. */
+#endif
   };
 
+/* Maximum number of pre-zeroed pages kept in each pool. */
+#define ZEROED_PAGES_MAX 32
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
-static void init_pool (struct pool *, void *base, size_t page_cnt,
-                       const char *name);
+/* Pages lent between the pools at a time: a chunk, aligned on
+   its own size. */
+#define LOAN_ORDER 5
+#define LOAN_PAGES ((size_t) 1 << LOAN_ORDER)
+
+/* A pool borrows below 1/BORROW_LOW_DIV of its pages free, and
+   lends or pays back only with 1/LEND_KEEP_DIV left over. */
+#define BORROW_LOW_DIV 16
+#define LEND_KEEP_DIV 4
+
+/* Page indexes in the arena.  The kernel pool's pages start at
+   index kernel_start, just far enough past the start of the arena
+   to put the user pool's first page at a chunk boundary, and the
+   user pool's pages start at user_start and run to arena_cnt. */
+static size_t kernel_start, user_start, arena_cnt;
+
+/* Pool holding each chunk now: false for the kernel pool, true
+   for the user pool.  Written only with both pool locks held, and
+   only for a chunk with no pages in use. */
+static bool *chunk_owner;
+
+/* May the user pool borrow?  Not if "-ul" capped it. */
+static bool user_may_borrow;
+
+/* Registered shrinkers.  Protected by disabling interrupts. */
+#define SHRINKERS_MAX 8
+struct shrinker
+  {
+    shrink_count_func *count;
+    shrink_scan_func *scan;
+  };
+static struct shrinker shrinkers[SHRINKERS_MAX];
+static size_t shrinker_cnt;
+static bool shrinking;                  /* Shrinkers running? */
+
+/* Kernel pool watermarks, as fractions of the pool. */
+#define SHRINK_LOW_DIV 64
+#define SHRINK_HIGH_DIV 32
+
+static void init_pool (struct pool *, size_t page_idx, size_t page_cnt,
+                       void *map_buf, size_t bm_size, const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static bool borrow (struct pool *);
+static void repay (struct pool *);
+static bool move_chunk (struct pool *from, struct pool *to,
+                        bool foreign_only);
+static size_t find_chunk (struct pool *, bool foreign_only);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void buddy_free_block (struct pool *, size_t page_idx, int order);
+static void buddy_claim (struct pool *, size_t page_idx, size_t page_cnt);
+static void *take_zeroed_page (struct pool *);
+static void adjust_free_cnt (struct pool *, size_t add, size_t sub);
+static size_t shrink (size_t page_cnt);
+static size_t shrink_target (size_t page_cnt);
+static bool refill_zeroed (struct pool *);
+static void print_pool_stats (struct pool *, const char *name);
+#ifdef MALLOC_STATS
+static void count_request (struct pool *, size_t page_cnt, bool success);
+#endif
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
-   pages are put into the user pool. */
+   pages are put into the user pool, and if a limit is given, the
+   user pool never borrows from the kernel pool. */
 void
 palloc_init (size_t user_page_limit)
 {
@@ -49,16 +190,46 @@ palloc_init (size_t user_page_limit)
   uint8_t *free_start = ptov (1024 * 1024);
   uint8_t *free_end = ptov (init_ram_pages * PGSIZE);
   size_t free_pages = (free_end - free_start) / PGSIZE;
-  size_t user_pages = free_pages / 2;
-  size_t kernel_pages;
+  size_t user_pages, kernel_pages, pad;
+  size_t map_cnt, bm_size, map_size, meta_pages, i;
+  uint8_t *meta = free_start;
+
+  /* The pools' used maps and order maps and the chunk owner map
+     go at the start of free memory, sized for the largest arena,
+     with a chunk's worth of padding. */
+  map_cnt = free_pages + LOAN_PAGES;
+  bm_size = bitmap_buf_size (map_cnt);
+  map_size = bm_size + map_cnt;
+  meta_pages = DIV_ROUND_UP (2 * map_size + map_cnt / LOAN_PAGES + 1,
+                             PGSIZE);
+  if (meta_pages >= free_pages)
+    PANIC ("Not enough memory for page allocator maps.");
+  free_pages -= meta_pages;
+
+  /* Give half of memory to kernel, half to user. */
+  user_pages = free_pages / 2;
   if (user_pages > user_page_limit)
     user_pages = user_page_limit;
   kernel_pages = free_pages - user_pages;
+  user_may_borrow = user_page_limit == SIZE_MAX;
 
-  /* Give half of memory to kernel, half to user. */
-  init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
-  init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
-             user_pages, "user pool");
+  /* Index 0 of the arena lies PAD pages before the kernel pool's
+     first page, which are never touched. */
+  pad = (LOAN_PAGES - kernel_pages % LOAN_PAGES) % LOAN_PAGES;
+  kernel_start = pad;
+  user_start = pad + kernel_pages;
+  arena_cnt = user_start + user_pages;
+  kernel_pool.base = user_pool.base
+    = free_start + (meta_pages - pad) * PGSIZE;
+
+  chunk_owner = (bool *) (meta + 2 * map_size);
+  for (i = 0; i * LOAN_PAGES < arena_cnt; i++)
+    chunk_owner[i] = i * LOAN_PAGES >= user_start;
+
+  init_pool (&kernel_pool, kernel_start, kernel_pages, meta, bm_size,
+             "kernel pool");
+  init_pool (&user_pool, user_start, user_pages, meta + map_size, bm_size,
+             "user pool");
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -73,18 +244,81 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
   size_t page_idx;
+  bool borrowed = false, shrunk = false;
+  enum intr_level old_level;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  /* Single zeroed pages come from the pre-zeroed list, if any. */
+  if (page_cnt == 1 && (flags & PAL_ZERO))
+    {
+      pages = take_zeroed_page (pool);
+      if (pages != NULL)
+        {
+          adjust_free_cnt (pool, 0, 1);
+#ifdef MALLOC_STATS
+          count_request (pool, 1, true);
+#endif
+          return pages;
+        }
+    }
+
+ retry:
+  old_level = spin_lock_irqsave (&pool->lock);
+  page_idx = buddy_alloc (pool, page_cnt);
+  if (page_idx == BITMAP_ERROR)
+    {
+      /* Out of free blocks: give the pre-zeroed pages back and
+         try again. */
+      void *page;
+      while ((page = take_zeroed_page (pool)) != NULL)
+        {
+          size_t idx = pg_no (page) - pg_no (pool->base);
+          bitmap_reset (pool->used_map, idx);
+          buddy_free (pool, idx, 1);
+        }
+      page_idx = buddy_alloc (pool, page_cnt);
+    }
+  if (page_idx != BITMAP_ERROR)
+    {
+      ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+      bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+      adjust_free_cnt (pool, 0, page_cnt);
+    }
+  spin_unlock_irqrestore (&pool->lock, old_level);
+
+  /* Borrow from the other pool once per allocation that fails,
+     and whenever the pool runs low.  Failing that, ask the kernel
+     caches for memory the same way. */
+  if (page_idx == BITMAP_ERROR)
+    {
+      if (!borrowed && page_cnt <= LOAN_PAGES && borrow (pool))
+        {
+          borrowed = true;
+          goto retry;
+        }
+      if (pool == &kernel_pool && !shrunk
+          && shrink (shrink_target (page_cnt)) > 0)
+        {
+          shrunk = true;
+          goto retry;
+        }
+    }
+  else if (pool->free_cnt < pool->page_cnt / BORROW_LOW_DIV + 1
+           && borrow (pool))
+    ;
+  else if (pool == &kernel_pool
+           && pool->free_cnt < pool->page_cnt / SHRINK_LOW_DIV + 1)
+    shrink (shrink_target (0));
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
   else
     pages = NULL;
+#ifdef MALLOC_STATS
+  count_request (pool, page_cnt, pages != NULL);
+#endif
 
   if (pages != NULL) 
     {
@@ -100,6 +334,46 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   return pages;
 }
 
+/* Obtains PAGE_CNT contiguous free pages, like
+   palloc_get_multiple(), but with the first at a physical address
+   that is a multiple of ALIGN pages, a power of 2.  Buddy blocks
+   are aligned only relative to the arena base, so an exact
+   allocation is tried first, which is aligned whenever the base
+   happens to be, and failing that enough extra pages are taken to
+   hold an aligned run and the rest given back at once. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt, size_t align)
+{
+  enum palloc_flags raw = flags & ~(PAL_ASSERT | PAL_ZERO);
+  uint8_t *pages, *start;
+  size_t skip;
+
+  ASSERT (align != 0 && (align & (align - 1)) == 0);
+
+  pages = palloc_get_multiple (raw, page_cnt);
+  if (pages != NULL && (vtop (pages) / PGSIZE) % align == 0)
+    start = pages;
+  else
+    {
+      palloc_free_multiple (pages, page_cnt);
+      pages = palloc_get_multiple (raw, page_cnt + align - 1);
+      if (pages == NULL)
+        {
+          if (flags & PAL_ASSERT)
+            PANIC ("palloc_get: out of pages");
+          return NULL;
+        }
+      skip = (align - (vtop (pages) / PGSIZE) % align) % align;
+      start = pages + PGSIZE * skip;
+      palloc_free_multiple (pages, skip);
+      palloc_free_multiple (start + PGSIZE * page_cnt, align - 1 - skip);
+    }
+
+  if (flags & PAL_ZERO)
+    memset (start, 0, PGSIZE * page_cnt);
+  return start;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -119,6 +393,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 {
   struct pool *pool;
   size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -137,8 +412,54 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  old_level = spin_lock_irqsave (&pool->lock);
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  buddy_free (pool, page_idx, page_cnt);
+  adjust_free_cnt (pool, page_cnt, 0);
+  spin_unlock_irqrestore (&pool->lock, old_level);
+
+  if (pool->borrowed_cnt > 0)
+    repay (pool);
+}
+
+/* Tries to grow the PAGE_CNT pages allocated at PAGES to
+   NEW_PAGE_CNT pages without moving them, by taking the pages that
+   follow them.  Returns true if successful, false if any of those
+   pages is in use or lies outside the pool. */
+bool
+palloc_extend (void *pages, size_t page_cnt, size_t new_page_cnt) 
+{
+  struct pool *pool;
+  size_t page_idx, add_cnt;
+  bool success = false;
+  enum intr_level old_level;
+
+  ASSERT (pg_ofs (pages) == 0);
+  ASSERT (new_page_cnt >= page_cnt);
+  if (page_from_pool (&kernel_pool, pages))
+    pool = &kernel_pool;
+  else if (page_from_pool (&user_pool, pages))
+    pool = &user_pool;
+  else
+    NOT_REACHED ();
+
+  page_idx = pg_no (pages) - pg_no (pool->base) + page_cnt;
+  add_cnt = new_page_cnt - page_cnt;
+  if (page_idx + add_cnt > arena_cnt)
+    return false;
+
+  old_level = spin_lock_irqsave (&pool->lock);
+  if (bitmap_none (pool->used_map, page_idx, add_cnt)) 
+    {
+      buddy_claim (pool, page_idx, add_cnt);
+      bitmap_set_multiple (pool->used_map, page_idx, add_cnt, true);
+      adjust_free_cnt (pool, 0, add_cnt);
+      success = true;
+    }
+  spin_unlock_irqrestore (&pool->lock, old_level);
+
+  return success;
 }
 
 /* Frees the page at PAGE. */
@@ -148,35 +469,536 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END,
-   naming it NAME for debugging purposes. */
+/* Returns the number of pages free in the user pool if FLAGS
+   includes PAL_USER, otherwise in the kernel pool.  Cheap enough
+   to call on every allocation, but only a snapshot, since other
+   threads may allocate or free pages at any time. */
+size_t
+palloc_free_cnt (enum palloc_flags flags)
+{
+  return (flags & PAL_USER ? &user_pool : &kernel_pool)->free_cnt;
+}
+
+/* Returns the number of pages in the user pool if FLAGS includes
+   PAL_USER, otherwise in the kernel pool. */
+size_t
+palloc_page_cnt (enum palloc_flags flags)
+{
+  return (flags & PAL_USER ? &user_pool : &kernel_pool)->page_cnt;
+}
+
+/* Returns true if POOL has pages enough free to give up a chunk. */
+static bool
+can_lend (const struct pool *pool)
+{
+  return pool->free_cnt >= LOAN_PAGES + pool->page_cnt / LEND_KEEP_DIV;
+}
+
+/* Tries to borrow a chunk from the pool other than POOL.
+   Returns true if successful. */
+static bool
+borrow (struct pool *pool)
+{
+  struct pool *lender = pool == &kernel_pool ? &user_pool : &kernel_pool;
+
+  if (pool == &user_pool && !user_may_borrow)
+    return false;
+  return can_lend (lender) && move_chunk (lender, pool, false);
+}
+
+/* Gives a wholly free chunk of the other pool's back to it, if
+   POOL holds one and can spare it. */
 static void
-init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
+repay (struct pool *pool)
+{
+  struct pool *home = pool == &kernel_pool ? &user_pool : &kernel_pool;
+
+  if (can_lend (pool))
+    move_chunk (pool, home, true);
+}
+
+/* Moves a wholly free chunk from FROM to TO, preferring one that
+   TO lent to FROM, and taking only such a chunk if FOREIGN_ONLY is
+   true.  Returns false if FROM has none, or can no longer spare
+   it.  The locks of both pools must not be held. */
+static bool
+move_chunk (struct pool *from, struct pool *to, bool foreign_only)
+{
+  struct pool *first = from == &kernel_pool ? from : to;
+  struct pool *second = from == &kernel_pool ? to : from;
+  size_t page_idx = BITMAP_ERROR;
+  enum intr_level old_level;
+
+  /* Always lock the kernel pool first. */
+  old_level = spin_lock_irqsave (&first->lock);
+  spin_lock_irqsave (&second->lock);
+  if (can_lend (from))
+    {
+      page_idx = find_chunk (from, true);
+      if (page_idx == BITMAP_ERROR && !foreign_only)
+        page_idx = find_chunk (from, false);
+    }
+  if (page_idx != BITMAP_ERROR)
+    {
+      if ((page_idx >= user_start) == (to == &user_pool))
+        from->borrowed_cnt -= LOAN_PAGES;
+      else
+        to->borrowed_cnt += LOAN_PAGES;
+
+      buddy_claim (from, page_idx, LOAN_PAGES);
+      bitmap_set_multiple (from->used_map, page_idx, LOAN_PAGES, true);
+      from->page_cnt -= LOAN_PAGES;
+      adjust_free_cnt (from, 0, LOAN_PAGES);
+
+      chunk_owner[page_idx / LOAN_PAGES] = to == &user_pool;
+
+      bitmap_set_multiple (to->used_map, page_idx, LOAN_PAGES, false);
+      buddy_free (to, page_idx, LOAN_PAGES);
+      to->page_cnt += LOAN_PAGES;
+      adjust_free_cnt (to, LOAN_PAGES, 0);
+    }
+  spin_unlock_irqrestore (&second->lock, INTR_OFF);
+  spin_unlock_irqrestore (&first->lock, old_level);
+
+  return page_idx != BITMAP_ERROR;
+}
+
+/* Returns the index of the first page of a chunk in POOL that is
+   wholly free, or BITMAP_ERROR if there is none.  If FOREIGN_ONLY
+   is true, only chunks that began in the other pool qualify.
+   POOL's lock must be held. */
+static size_t
+find_chunk (struct pool *pool, bool foreign_only)
+{
+  int order;
+
+  for (order = LOAN_ORDER; order < ORDER_CNT; order++)
+    {
+      struct list_elem *e;
+
+      for (e = list_begin (&pool->free_lists[order]);
+           e != list_end (&pool->free_lists[order]); e = list_next (e))
+        {
+          size_t page_idx = pg_no (e) - pg_no (pool->base);
+          size_t end_idx = page_idx + ((size_t) 1 << order);
+
+          for (; page_idx < end_idx; page_idx += LOAN_PAGES)
+            if (!foreign_only
+                || (page_idx >= user_start) != (pool == &user_pool))
+              return page_idx;
+        }
+    }
+  return BITMAP_ERROR;
+}
+
+/* Registers a shrinker with count function COUNT and scan
+   function SCAN, to be called when the kernel pool runs low.
+   Returns false if too many shrinkers are registered already. */
+bool
+register_shrinker (shrink_count_func *count, shrink_scan_func *scan)
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  enum intr_level old_level = intr_disable ();
+  bool success = shrinker_cnt < SHRINKERS_MAX;
+
+  if (success)
+    {
+      shrinkers[shrinker_cnt].count = count;
+      shrinkers[shrinker_cnt].scan = scan;
+      shrinker_cnt++;
+    }
+  intr_set_level (old_level);
+  return success;
+}
+
+/* Returns how many pages must be freed to bring the kernel pool up
+   to its high watermark with PAGE_CNT more pages to spare. */
+static size_t
+shrink_target (size_t page_cnt)
+{
+  size_t want = kernel_pool.page_cnt / SHRINK_HIGH_DIV + 1 + page_cnt;
+  size_t free_cnt = kernel_pool.free_cnt;
+
+  return want > free_cnt ? want - free_cnt : 0;
+}
+
+/* Asks the shrinkers to free PAGE_CNT pages in all, dividing the
+   work among them in proportion to what each says it could free.
+   Returns the number of pages freed.  Does nothing if shrinkers
+   are running already, in this thread or another. */
+static size_t
+shrink (size_t page_cnt)
+{
+  size_t counts[SHRINKERS_MAX];
+  size_t cnt, total = 0, freed = 0, i;
+  enum intr_level old_level;
+  bool busy;
+
+  if (page_cnt == 0)
+    return 0;
+  old_level = intr_disable ();
+  busy = shrinking;
+  shrinking = true;
+  cnt = shrinker_cnt;
+  intr_set_level (old_level);
+  if (busy)
+    return 0;
+
+  for (i = 0; i < cnt; i++)
+    {
+      counts[i] = shrinkers[i].count ();
+      total += counts[i];
+    }
+  for (i = 0; i < cnt && total > 0; i++)
+    if (counts[i] > 0)
+      {
+        size_t share = DIV_ROUND_UP (page_cnt * counts[i], total);
+        freed += shrinkers[i].scan (share < counts[i] ? share : counts[i]);
+      }
+
+  old_level = intr_disable ();
+  shrinking = false;
+  intr_set_level (old_level);
+  return freed;
+}
+
+/* Adds ADD to and subtracts SUB from POOL's count of free pages. */
+static void
+adjust_free_cnt (struct pool *pool, size_t add, size_t sub)
+{
+  enum intr_level old_level = intr_disable ();
+  pool->free_cnt = pool->free_cnt + add - sub;
+#ifdef MALLOC_STATS
+  if (pool->free_cnt < pool->min_free_cnt)
+    pool->min_free_cnt = pool->free_cnt;
+#endif
+  intr_set_level (old_level);
+}
+
+#ifdef MALLOC_STATS
+/* Counts a request for PAGE_CNT pages from POOL, which succeeded
+   if SUCCESS is true. */
+static void
+count_request (struct pool *pool, size_t page_cnt, bool success) 
+{
+  enum intr_level old_level;
+  int order;
+
+  for (order = 0; order + 1 < ORDER_CNT
+         && ((size_t) 1 << order) < page_cnt; order++)
+    continue;
+
+  old_level = intr_disable ();
+  if (success)
+    pool->requests[order]++;
+  else
+    pool->failures[order]++;
+  intr_set_level (old_level);
+}
+#endif
+
+/* Prints the occupancy of each pool, the length of each of its
+   free lists, and its external fragmentation. */
+void
+palloc_print_stats (void) 
+{
+  print_pool_stats (&kernel_pool, "kernel pool");
+  print_pool_stats (&user_pool, "user pool");
+}
+
+/* Prints statistics for POOL, calling it NAME.  External
+   fragmentation is the percentage of free pages that lie outside
+   the largest free block, so that a request for more pages than
+   that block has fails even though the pool has enough free. */
+static void
+print_pool_stats (struct pool *pool, const char *name) 
+{
+  size_t free_cnt[ORDER_CNT];
+  size_t used, zeroed, free_pages, largest;
+  enum intr_level old_level;
+  int order;
+
+  old_level = spin_lock_irqsave (&pool->lock);
+  zeroed = pool->zeroed_cnt;
+  free_pages = largest = 0;
+  for (order = 0; order < ORDER_CNT; order++)
+    {
+      free_cnt[order] = list_size (&pool->free_lists[order]);
+      free_pages += free_cnt[order] << order;
+      if (free_cnt[order] != 0)
+        largest = (size_t) 1 << order;
+    }
+  used = pool->page_cnt - zeroed - free_pages;
+  spin_unlock_irqrestore (&pool->lock, old_level);
+
+  printf ("%s: %zu of %zu pages in use, %zu pre-zeroed, %zu free\n",
+          name, used, pool->page_cnt, zeroed, free_pages);
+  printf ("%s: %zu pages borrowed, %zu lent\n", name, pool->borrowed_cnt,
+          pool->home_cnt - (pool->page_cnt - pool->borrowed_cnt));
+  printf ("%s: free blocks:", name);
+  for (order = 0; order < ORDER_CNT; order++)
+    if (free_cnt[order] != 0)
+      printf (" %zu x %zu", free_cnt[order], (size_t) 1 << order);
+  printf ("\n");
+  printf ("%s: largest free block %zu pages, "
+          "external fragmentation %zu%%\n", name, largest,
+          free_pages != 0 ? 100 - largest * 100 / free_pages : 0);
+
+#ifdef MALLOC_STATS
+  printf ("%s: peak %zu pages in use\n",
+          name, pool->page_cnt - pool->min_free_cnt);
+  for (order = 0; order < ORDER_CNT; order++)
+    if (pool->requests[order] != 0 || pool->failures[order] != 0)
+      printf ("%s: requests for up to %zu pages: %llu, %llu failed\n",
+              name, (size_t) 1 << order, pool->requests[order],
+              pool->failures[order]);
+#endif
+}
+
+/* Initializes pool P as holding the PAGE_CNT pages of the arena
+   starting at PAGE_IDX, naming it NAME for debugging purposes.
+   Its used map, of BM_SIZE bytes, and its order map go in
+   MAP_BUF.  P->base must already be set. */
+static void
+init_pool (struct pool *p, size_t page_idx, size_t page_cnt,
+           void *map_buf, size_t bm_size, const char *name)
+{
+  int order;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
-  /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  /* Initialize the pool.  Only its own pages are clear in its
+     used map. */
+  spin_lock_init (&p->lock, name);
+  p->used_map = bitmap_create_in_buf (arena_cnt, map_buf, bm_size);
+  bitmap_set_all (p->used_map, true);
+  bitmap_set_multiple (p->used_map, page_idx, page_cnt, false);
+  p->order_map = (uint8_t *) map_buf + bm_size;
+  memset (p->order_map, NOT_FREE, arena_cnt);
+  p->page_cnt = p->home_cnt = page_cnt;
+  p->borrowed_cnt = 0;
+  for (order = 0; order < ORDER_CNT; order++)
+    list_init (&p->free_lists[order]);
+  list_init (&p->zeroed_pages);
+  p->zeroed_cnt = 0;
+  p->free_cnt = page_cnt;
+#ifdef MALLOC_STATS
+  p->min_free_cnt = page_cnt;
+#endif
+
+  /* All of the pool's pages start out free. */
+  buddy_free (p, page_idx, page_cnt);
+}
+
+/* Returns the address of page PAGE_IDX in POOL. */
+static inline void *
+pool_page (const struct pool *pool, size_t page_idx)
+{
+  return pool->base + PGSIZE * page_idx;
+}
+
+/* Zeroes one free page in each pool that is short of pre-zeroed
+   pages.  Returns true if any page was zeroed, false if every
+   pool's pre-zeroed list is full or the pool is out of free
+   pages.  Called from the idle thread, so it never blocks. */
+bool
+palloc_zero_idle (void)
+{
+  bool kernel = refill_zeroed (&kernel_pool);
+  bool user = refill_zeroed (&user_pool);
+  return kernel || user;
+}
+
+/* Removes and returns a page from POOL's pre-zeroed list, or a
+   null pointer if the list is empty. */
+static void *
+take_zeroed_page (struct pool *pool)
+{
+  struct free_block *b = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (!list_empty (&pool->zeroed_pages))
+    {
+      b = list_entry (list_pop_front (&pool->zeroed_pages),
+                      struct free_block, elem);
+      pool->zeroed_cnt--;
+    }
+  intr_set_level (old_level);
+
+  /* The list element was the only nonzero part of the page. */
+  if (b != NULL)
+    memset (b, 0, sizeof *b);
+  return b;
+}
+
+/* Takes a free page out of POOL, zeroes it, and adds it to POOL's
+   pre-zeroed list.  Returns true if successful, false if the list
+   is full or the pool is out of free pages.  The page is zeroed
+   with interrupts on. */
+static bool
+refill_zeroed (struct pool *pool)
+{
+  struct free_block *b;
+  enum intr_level old_level;
+  size_t page_idx;
+
+  if (pool->zeroed_cnt >= ZEROED_PAGES_MAX)
+    return false;
+  old_level = spin_lock_irqsave (&pool->lock);
+  page_idx = buddy_alloc (pool, 1);
+  if (page_idx != BITMAP_ERROR)
+    bitmap_mark (pool->used_map, page_idx);
+  spin_unlock_irqrestore (&pool->lock, old_level);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  b = pool_page (pool, page_idx);
+  memset (b, 0, PGSIZE);
+
+  old_level = intr_disable ();
+  list_push_back (&pool->zeroed_pages, &b->elem);
+  pool->zeroed_cnt++;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Removes a block of PAGE_CNT pages from POOL's free lists and
+   returns the index of its first page, or BITMAP_ERROR if there
+   is no free run that large. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt)
+{
+  struct free_block *b;
+  size_t page_idx;
+  int order, want;
+
+  /* Smallest order that holds PAGE_CNT pages. */
+  for (want = 0; want < ORDER_CNT && ((size_t) 1 << want) < page_cnt; want++)
+    continue;
+
+  /* Smallest free block of at least that order. */
+  for (order = want; order < ORDER_CNT; order++)
+    if (!list_empty (&pool->free_lists[order]))
+      break;
+  if (order >= ORDER_CNT)
+    return BITMAP_ERROR;
+
+  b = list_entry (list_pop_front (&pool->free_lists[order]),
+                  struct free_block, elem);
+  page_idx = pg_no (b) - pg_no (pool->base);
+  pool->order_map[page_idx] = NOT_FREE;
+
+  /* Split off upper halves until the block is the wanted size. */
+  while (order > want)
+    {
+      order--;
+      buddy_free_block (pool, page_idx + ((size_t) 1 << order), order);
+    }
+
+  /* Give back the pages beyond PAGE_CNT. */
+  buddy_free (pool, page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+
+  return page_idx;
+}
+
+/* Returns the PAGE_CNT pages starting at PAGE_IDX in POOL to the
+   free lists, as the largest aligned blocks that make them up. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  while (page_cnt > 0)
+    {
+      int order = 0;
+
+      /* Largest block aligned at PAGE_IDX that fits in the run. */
+      while (order + 1 < ORDER_CNT
+             && page_idx % ((size_t) 1 << (order + 1)) == 0
+             && ((size_t) 1 << (order + 1)) <= page_cnt)
+        order++;
+
+      buddy_free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX in POOL,
+   merging it with its buddy for as long as the buddy is free. */
+static void
+buddy_free_block (struct pool *pool, size_t page_idx, int order)
+{
+  struct free_block *b;
+
+  for (; order + 1 < ORDER_CNT; order++)
+    {
+      size_t buddy_idx = page_idx ^ ((size_t) 1 << order);
+
+      if (buddy_idx + ((size_t) 1 << order) > arena_cnt
+          || pool->order_map[buddy_idx] != order)
+        break;
+
+      b = pool_page (pool, buddy_idx);
+      list_remove (&b->elem);
+      pool->order_map[buddy_idx] = NOT_FREE;
+      if (buddy_idx < page_idx)
+        page_idx = buddy_idx;
+    }
+
+  b = pool_page (pool, page_idx);
+  list_push_front (&pool->free_lists[order], &b->elem);
+  pool->order_map[page_idx] = order;
+}
+
+/* Removes the PAGE_CNT free pages starting at PAGE_IDX in POOL
+   from the free lists.  Each free block that overlaps the run is
+   taken off its list whole, and its pages outside the run are
+   freed again. */
+static void
+buddy_claim (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t end_idx = page_idx + page_cnt;
+
+  while (page_idx < end_idx)
+    {
+      struct free_block *b;
+      size_t block_idx, block_end;
+      int order;
+
+      /* Find the free block that contains PAGE_IDX. */
+      for (order = 0; order < ORDER_CNT; order++)
+        {
+          block_idx = page_idx & ~(((size_t) 1 << order) - 1);
+          if (pool->order_map[block_idx] == order)
+            break;
+        }
+      ASSERT (order < ORDER_CNT);
+      block_end = block_idx + ((size_t) 1 << order);
+
+      b = pool_page (pool, block_idx);
+      list_remove (&b->elem);
+      pool->order_map[block_idx] = NOT_FREE;
+
+      /* Only the first block can start before the run, and only
+         the last can extend past it. */
+      buddy_free (pool, block_idx, page_idx - block_idx);
+      if (block_end > end_idx)
+        buddy_free (pool, end_idx, block_end - end_idx);
+      page_idx = block_end;
+    }
 }
 
 /* Returns true if PAGE was allocated from POOL,
-   false otherwise. */
+   false otherwise.  The chunk holding an allocated page cannot
+   move, so this needs no lock. */
 static bool
 page_from_pool (const struct pool *pool, void *page) 
 {
   size_t page_no = pg_no (page);
-  size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t start_page = pg_no (pool->base) + kernel_start;
+  size_t end_page = pg_no (pool->base) + arena_cnt;
 
-  return page_no >= start_page && page_no < end_page;
+  if (page_no < start_page || page_no >= end_page)
+    return false;
+  return (chunk_owner[(page_no - pg_no (pool->base)) / LOAN_PAGES]
+          == (pool == &user_pool));
 }
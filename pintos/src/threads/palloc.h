@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -11,10 +12,28 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* Memory-pressure callbacks ("shrinkers") for kernel caches.
+   A count function returns how many kernel pool pages its cache
+   could give back.  A scan function tries to give back up to
+   PAGE_CNT of them, least recently used first, and returns how
+   many it freed.  Either may be called from within any kernel pool
+   allocation, with arbitrary locks held, so they must not block
+   on a lock: they should use lock_try_acquire() and skip whatever
+   is busy. */
+typedef size_t shrink_count_func (void);
+typedef size_t shrink_scan_func (size_t page_cnt);
+
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
+void *palloc_get_aligned (enum palloc_flags, size_t page_cnt, size_t align);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_extend (void *, size_t page_cnt, size_t new_page_cnt);
+bool palloc_zero_idle (void);
+size_t palloc_free_cnt (enum palloc_flags);
+size_t palloc_page_cnt (enum palloc_flags);
+bool register_shrinker (shrink_count_func *, shrink_scan_func *);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
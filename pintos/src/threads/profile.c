@@ -0,0 +1,93 @@
+#include "threads/profile.h"
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "threads/loader.h"
+
+/* A sampling profiler.  The timer interrupt hands each interrupted
+   frame to profile_sample(), which records where the kernel was
+   running in a fixed ring buffer, so sampling never allocates.
+   At shutdown, profile_print_stats() prints the addresses seen
+   most often; the "backtrace" utility translates them into
+   function names and lines.  Ticks that interrupt user code are
+   only counted. */
+
+bool profile_enabled;
+
+/* Ring buffer of sampled kernel EIPs.  When it is full, new
+   samples overwrite the oldest. */
+#define PROFILE_SAMPLES 8192
+static uintptr_t samples[PROFILE_SAMPLES];
+static unsigned long long kernel_samples; /* Kernel samples taken. */
+static unsigned long long user_samples;   /* User samples taken. */
+
+/* Number of distinct addresses printed by profile_print_stats(). */
+#define PROFILE_TOP 20
+
+static int compare_addrs (const void *, const void *);
+
+/* Records a sample of the code interrupted by F.  Called from the
+   timer interrupt handler. */
+void
+profile_sample (const struct intr_frame *f) 
+{
+  if (f->cs != SEL_KCSEG)
+    user_samples++;
+  else
+    samples[kernel_samples++ % PROFILE_SAMPLES] = (uintptr_t) f->eip;
+}
+
+/* Prints a histogram of the most frequently sampled kernel
+   addresses.  Sorts the sample buffer, so it may be called only
+   once, at shutdown. */
+void
+profile_print_stats (void) 
+{
+  size_t cnt, shown;
+
+  if (!profile_enabled)
+    return;
+
+  cnt = kernel_samples < PROFILE_SAMPLES ? kernel_samples : PROFILE_SAMPLES;
+  printf ("Profile: %llu kernel samples, %llu user samples\n",
+          kernel_samples, user_samples);
+  if (cnt < kernel_samples)
+    printf ("Profile: only the last %zu kernel samples kept\n", cnt);
+  qsort (samples, cnt, sizeof *samples, compare_addrs);
+
+  /* Each pass finds the longest remaining run of equal addresses
+     and prints it; samples already printed are zeroed. */
+  for (shown = 0; shown < PROFILE_TOP; shown++)
+    {
+      size_t best = 0, best_len = 0;
+      size_t i, j;
+
+      for (i = 0; i < cnt; i = j)
+        {
+          for (j = i + 1; j < cnt && samples[j] == samples[i]; j++)
+            continue;
+          if (samples[i] != 0 && j - i > best_len)
+            {
+              best = i;
+              best_len = j - i;
+            }
+        }
+      if (best_len == 0)
+        break;
+
+      printf ("  %#010"PRIxPTR" %6zu (%zu%%)\n",
+              samples[best], best_len, best_len * 100 / cnt);
+      for (i = best; i < best + best_len; i++)
+        samples[i] = 0;
+    }
+}
+
+/* Orders the addresses that A and B point to. */
+static int
+compare_addrs (const void *a_, const void *b_) 
+{
+  uintptr_t a = *(const uintptr_t *) a_;
+  uintptr_t b = *(const uintptr_t *) b_;
+  return a < b ? -1 : a > b;
+}
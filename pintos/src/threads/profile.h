@@ -0,0 +1,14 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+#include <stdbool.h>
+#include "threads/interrupt.h"
+
+/* If true, sample the kernel's program counter on every timer
+   tick.  Controlled by kernel command-line option "-profile". */
+extern bool profile_enabled;
+
+void profile_sample (const struct intr_frame *);
+void profile_print_stats (void);
+
+#endif /* threads/profile.h */
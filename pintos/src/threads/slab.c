@@ -0,0 +1,330 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A slab allocator for fixed-size objects.
+
+   Each cache hands out objects of a single size, packed tightly
+   into page-sized "slabs" instead of being rounded up to a power
+   of 2 as malloc() does.  A slab begins with a header that
+   records which of its objects are free, followed by the objects
+   themselves.  The free list is kept in the header, not inside
+   the free objects, so an object keeps the state its constructor
+   gave it while it sits free, and the constructor runs only once
+   per object, when its slab is created.  Callers are therefore
+   expected to free objects in their constructed state.
+
+   A cache keeps its slabs on three lists: partial slabs, which
+   have both free and allocated objects and satisfy allocations
+   first; full slabs; and empty slabs, of which at most
+   EMPTY_SLABS_MAX are retained before pages go back to the page
+   allocator.  Retained empty slabs are also given back, oldest
+   first, when the kernel pool runs low and calls the slab
+   shrinker. */
+
+/* Number of empty slabs a cache retains. */
+#define EMPTY_SLABS_MAX 4
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab0bec
+
+/* Object cache. */
+struct kmem_cache
+  {
+    const char *name;           /* Name, for debugging. */
+    size_t obj_size;            /* Object size, a multiple of ALIGN. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    size_t first_ofs;           /* Offset of first object in a slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or a null pointer. */
+    struct lock lock;           /* Protects everything below. */
+    struct list partial;        /* Slabs with some free objects. */
+    struct list full;           /* Slabs without free objects. */
+    struct list empty;          /* Slabs with only free objects. */
+    size_t empty_cnt;           /* Number of slabs in EMPTY. */
+    struct list_elem elem;      /* Element in all_caches. */
+  };
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of CACHE's lists. */
+    size_t in_use;              /* Number of allocated objects. */
+    int free_head;              /* First free object, or -1. */
+    int16_t next_free[];        /* Free list links, by object index. */
+  };
+
+/* Every cache, for the shrinker. */
+static struct list all_caches;
+static struct lock all_caches_lock;
+
+static shrink_count_func slab_count;
+static shrink_scan_func slab_scan;
+static struct slab *slab_create (struct kmem_cache *);
+static void *slab_object (struct kmem_cache *, struct slab *, size_t idx);
+
+/* Initializes the slab allocator. */
+void
+kmem_init (void)
+{
+  list_init (&all_caches);
+  lock_init (&all_caches_lock);
+  if (!register_shrinker (slab_count, slab_scan))
+    PANIC ("cannot register slab shrinker");
+}
+
+/* Creates and returns a cache of SIZE-byte objects, each aligned
+   on an ALIGN-byte boundary (ALIGN must be a power of 2, or 0 for
+   pointer alignment).  If CTOR is non-null, it is run on each
+   object when the slab holding it is created.  NAME is kept for
+   debugging and must outlive the cache.  Returns a null pointer
+   if memory is not available. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+                   kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+  size_t n;
+
+  ASSERT (name != NULL);
+  ASSERT (size > 0);
+  if (align == 0)
+    align = sizeof (void *);
+  ASSERT ((align & (align - 1)) == 0);
+
+  c = malloc (sizeof *c);
+  if (c == NULL)
+    return NULL;
+
+  c->name = name;
+  c->obj_size = ROUND_UP (size, align);
+  c->ctor = ctor;
+
+  /* Fit as many objects as we can after the header and its
+     free list. */
+  for (n = (PGSIZE - sizeof (struct slab)) / c->obj_size; n > 0; n--)
+    {
+      size_t ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (int16_t),
+                             align);
+      if (ofs + n * c->obj_size <= PGSIZE)
+        {
+          c->first_ofs = ofs;
+          break;
+        }
+    }
+  ASSERT (n > 0 && n <= INT16_MAX);
+  c->objs_per_slab = n;
+
+  lock_init (&c->lock);
+  list_init (&c->partial);
+  list_init (&c->full);
+  list_init (&c->empty);
+  c->empty_cnt = 0;
+
+  lock_acquire (&all_caches_lock);
+  list_push_back (&all_caches, &c->elem);
+  lock_release (&all_caches_lock);
+
+  return c;
+}
+
+/* Destroys cache C, returning its slabs to the page allocator.
+   All of C's objects must have been freed. */
+void
+kmem_cache_destroy (struct kmem_cache *c)
+{
+  if (c == NULL)
+    return;
+
+  ASSERT (list_empty (&c->partial));
+  ASSERT (list_empty (&c->full));
+  lock_acquire (&all_caches_lock);
+  list_remove (&c->elem);
+  lock_release (&all_caches_lock);
+  while (!list_empty (&c->empty))
+    {
+      struct slab *s = list_entry (list_pop_front (&c->empty),
+                                   struct slab, elem);
+      palloc_free_page (s);
+    }
+  free (c);
+}
+
+/* Obtains and returns an object from cache C.  Returns a null
+   pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  ASSERT (c != NULL);
+
+  lock_acquire (&c->lock);
+  if (!list_empty (&c->partial))
+    s = list_entry (list_front (&c->partial), struct slab, elem);
+  else if (!list_empty (&c->empty))
+    {
+      s = list_entry (list_pop_front (&c->empty), struct slab, elem);
+      c->empty_cnt--;
+      list_push_front (&c->partial, &s->elem);
+    }
+  else
+    {
+      s = slab_create (c);
+      if (s == NULL)
+        {
+          lock_release (&c->lock);
+          return NULL;
+        }
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  /* Take the first free object. */
+  ASSERT (s->free_head >= 0);
+  obj = slab_object (c, s, s->free_head);
+  s->free_head = s->next_free[s->free_head];
+  if (++s->in_use == c->objs_per_slab)
+    {
+      list_remove (&s->elem);
+      list_push_back (&c->full, &s->elem);
+    }
+  lock_release (&c->lock);
+
+  return obj;
+}
+
+/* Returns OBJ, previously obtained from cache C, to C.  OBJ
+   should be in the state its constructor leaves it in. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+  size_t idx;
+
+  if (obj == NULL)
+    return;
+
+  s = pg_round_down (obj);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  idx = ((uint8_t *) obj - (uint8_t *) s - c->first_ofs) / c->obj_size;
+  ASSERT (slab_object (c, s, idx) == obj);
+
+  lock_acquire (&c->lock);
+  ASSERT (s->in_use > 0);
+  s->next_free[idx] = s->free_head;
+  s->free_head = idx;
+  if (s->in_use-- == c->objs_per_slab)
+    {
+      /* Full slab becomes partial. */
+      list_remove (&s->elem);
+      list_push_front (&c->partial, &s->elem);
+    }
+  if (s->in_use == 0)
+    {
+      list_remove (&s->elem);
+      if (c->empty_cnt < EMPTY_SLABS_MAX)
+        {
+          list_push_front (&c->empty, &s->elem);
+          c->empty_cnt++;
+        }
+      else
+        {
+          s->magic = 0;
+          palloc_free_page (s);
+        }
+    }
+  lock_release (&c->lock);
+}
+
+/* Shrinker count function: returns the number of empty slabs
+   retained by all caches. */
+static size_t
+slab_count (void)
+{
+  struct list_elem *e;
+  size_t cnt = 0;
+
+  if (!lock_try_acquire (&all_caches_lock))
+    return 0;
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    cnt += list_entry (e, struct kmem_cache, elem)->empty_cnt;
+  lock_release (&all_caches_lock);
+  return cnt;
+}
+
+/* Shrinker scan function: frees up to PAGE_CNT empty slabs,
+   those that emptied longest ago in each cache first, skipping
+   caches that are in use.  Returns the number freed. */
+static size_t
+slab_scan (size_t page_cnt)
+{
+  struct list_elem *e;
+  size_t freed = 0;
+
+  if (!lock_try_acquire (&all_caches_lock))
+    return 0;
+  for (e = list_begin (&all_caches);
+       e != list_end (&all_caches) && freed < page_cnt; e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+
+      if (!lock_try_acquire (&c->lock))
+        continue;
+      while (freed < page_cnt && !list_empty (&c->empty))
+        {
+          struct slab *s = list_entry (list_pop_back (&c->empty),
+                                       struct slab, elem);
+          c->empty_cnt--;
+          s->magic = 0;
+          palloc_free_page (s);
+          freed++;
+        }
+      lock_release (&c->lock);
+    }
+  lock_release (&all_caches_lock);
+  return freed;
+}
+
+/* Obtains a page for a new slab of cache C, links all of its
+   objects into its free list, and runs C's constructor on them.
+   Returns a null pointer if memory is not available. */
+static struct slab *
+slab_create (struct kmem_cache *c)
+{
+  struct slab *s;
+  size_t i;
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->in_use = 0;
+  s->free_head = 0;
+  for (i = 0; i < c->objs_per_slab; i++)
+    {
+      s->next_free[i] = i + 1 < c->objs_per_slab ? (int) i + 1 : -1;
+      if (c->ctor != NULL)
+        c->ctor (slab_object (c, s, i));
+    }
+  return s;
+}
+
+/* Returns the address of object IDX in slab S of cache C. */
+static void *
+slab_object (struct kmem_cache *c, struct slab *s, size_t idx)
+{
+  ASSERT (idx < c->objs_per_slab);
+  return (uint8_t *) s + c->first_ofs + idx * c->obj_size;
+}
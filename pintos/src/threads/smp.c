@@ -0,0 +1,621 @@
+#include "threads/smp.h"
+#include <debug.h>
+#include <packed.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/ioapic.h"
+#include "devices/lapic.h"
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/syscall.h"
+#endif
+
+/* Multiprocessor support.
+
+   smp_init() finds the other CPUs in the MultiProcessor
+   Specification's tables [MP], which the BIOS leaves in low
+   memory, and starts each of them with the local APIC's INIT,
+   start-up sequence at the real-mode code in start.S.  Each CPU
+   then runs an idle thread of its own and schedules threads from
+   a run queue of its own (see thread.c).
+
+   The kernel was written for one CPU, on which turning interrupts
+   off keeps everything else out.  Rather than give each piece of
+   shared data a lock of its own, the CPUs share one kernel lock
+   that goes with turning interrupts off: a CPU holds it exactly
+   while it runs kernel code with interrupts off.  intr_disable()
+   takes it, intr_enable() releases it, and an interrupt taken,
+   which turns interrupts off, takes it on entry, so that every
+   critical section written for one CPU, such as those of the
+   spinlocks and semaphores of synch.c, keeps the other CPUs out
+   as well.  Code that runs with interrupts on, which is most of
+   the kernel and all of user code, runs on all CPUs at once, so
+   shared state that it changes without turning interrupts off is
+   not covered.  That is why struct lock gives up its atomic fast
+   paths once smp_active is set (see synch.c).
+
+   Inter-processor interrupts are the exception.  A CPU that
+   holds the kernel lock may need another to act, for example to
+   flush its TLB, and wait for it, so these interrupts are
+   answered without the lock, and a CPU spinning for the lock
+   answers cross-CPU calls as it spins. */
+
+/* The CPUs, indexed by smp_cpu(). */
+struct cpu cpus[THREAD_CPU_CNT];
+
+int smp_cpu_cnt = 1;
+uint32_t smp_online_mask = 1;
+bool smp_active;
+int smp_max_cpus = 1;
+
+/* The kernel lock: 1 while some CPU holds it, otherwise 0. */
+static volatile uint32_t kernel_lock;
+
+/* Function and argument of the smp_call() in progress, which
+   holds the kernel lock. */
+static smp_call_func *volatile call_func;
+static void *volatile call_aux;
+
+/* Startup code in start.S, with the variables it reads.  The
+   variables lie within the code, and so are filled in in the copy
+   at SMP_AP_START. */
+extern uint8_t ap_start[], ap_start_end[];
+extern uint32_t ap_cr3, ap_cr4, ap_stack;
+
+/* MP floating pointer structure.  See [MP] 4.1 "MP Floating
+   Pointer Structure". */
+struct mp_float
+  {
+    char signature[4];          /* "_MP_". */
+    uint32_t config;            /* Physical address of mp_config. */
+    uint8_t length;             /* Length in 16-byte units: 1. */
+    uint8_t revision;           /* Specification revision. */
+    uint8_t checksum;           /* Sum of all bytes is 0. */
+    uint8_t type;               /* Default configuration, or 0. */
+    uint8_t features[4];        /* Feature bytes. */
+  }
+PACKED;
+
+/* MP configuration table header.  See [MP] 4.2 "MP Configuration
+   Table Header".  Entries follow the header. */
+struct mp_config
+  {
+    char signature[4];          /* "PCMP". */
+    uint16_t length;            /* Base table length, with header. */
+    uint8_t revision;           /* Specification revision. */
+    uint8_t checksum;           /* Sum of base table bytes is 0. */
+    char oem[8];                /* OEM ID. */
+    char product[12];           /* Product ID. */
+    uint32_t oem_table;         /* Physical address of OEM table. */
+    uint16_t oem_length;        /* Size of OEM table. */
+    uint16_t entry_cnt;         /* Number of entries. */
+    uint32_t lapic_addr;        /* Physical address of local APICs. */
+    uint16_t ext_length;        /* Extended table length. */
+    uint8_t ext_checksum;       /* Extended table checksum. */
+    uint8_t reserved;
+  }
+PACKED;
+
+/* MP configuration table processor entry.  See [MP] 4.3.1
+   "Processor Entries".  Entries of the other types are 8 bytes
+   long. */
+#define MP_PROC 0               /* Entry type. */
+#define MP_PROC_ENABLED 0x01    /* CPU is usable. */
+#define MP_PROC_BSP 0x02        /* CPU is the boot CPU. */
+struct mp_proc
+  {
+    uint8_t type;               /* MP_PROC. */
+    uint8_t apic_id;            /* Local APIC ID. */
+    uint8_t apic_version;       /* Local APIC version. */
+    uint8_t flags;              /* MP_PROC_*. */
+    uint32_t signature;         /* CPU stepping, model, family. */
+    uint32_t features;          /* CPUID feature flags. */
+    uint32_t reserved[2];
+  }
+PACKED;
+
+/* MP configuration table bus entry.  See [MP] 4.3.2 "Bus
+   Entries". */
+#define MP_BUS 1                /* Entry type. */
+struct mp_bus
+  {
+    uint8_t type;               /* MP_BUS. */
+    uint8_t id;                 /* Bus ID, used by interrupt entries. */
+    char type_name[6];          /* "ISA   ", "PCI   ", .... */
+  }
+PACKED;
+
+/* MP configuration table I/O APIC entry.  See [MP] 4.3.3 "I/O
+   APIC Entries". */
+#define MP_IOAPIC 2             /* Entry type. */
+#define MP_IOAPIC_ENABLED 0x01  /* I/O APIC is usable. */
+struct mp_ioapic
+  {
+    uint8_t type;               /* MP_IOAPIC. */
+    uint8_t id;                 /* I/O APIC ID. */
+    uint8_t version;            /* I/O APIC version. */
+    uint8_t flags;              /* MP_IOAPIC_*. */
+    uint32_t addr;              /* Physical address of registers. */
+  }
+PACKED;
+
+/* MP configuration table I/O interrupt assignment entry.  See
+   [MP] 4.3.4 "I/O Interrupt Assignment Entries".  Polarity and
+   trigger mode of 0 mean "conforms to the bus": active high and
+   edge triggered for ISA, active low and level triggered for
+   PCI. */
+#define MP_IOINTR 3             /* Entry type. */
+#define MP_INTR_INT 0           /* Interrupt type: vectored. */
+#define MP_POLARITY(FLAGS) ((FLAGS) & 3)
+#define MP_TRIGGER(FLAGS) (((FLAGS) >> 2) & 3)
+struct mp_intr
+  {
+    uint8_t type;               /* MP_IOINTR. */
+    uint8_t int_type;           /* MP_INTR_*. */
+    uint16_t flags;             /* Polarity, trigger mode. */
+    uint8_t src_bus;            /* Bus ID of the source. */
+    uint8_t src_irq;            /* IRQ on that bus. */
+    uint8_t dst_ioapic;         /* I/O APIC ID. */
+    uint8_t dst_intin;          /* I/O APIC input pin. */
+  }
+PACKED;
+
+static struct mp_config *mp_find_config (void);
+static struct mp_float *mp_search (uintptr_t paddr, size_t size);
+static bool mp_checksum (const void *, size_t size);
+static int mp_find_cpus (const struct mp_config *, unsigned ids[], int max);
+static bool mp_find_ioapic (const struct mp_config *);
+static void set_ap_var (uint8_t *code, uint32_t *var, uint32_t value);
+static void run_call (struct cpu *);
+static smp_call_func reload_cr3;
+static intr_handler_func call_interrupt, resched_interrupt;
+static intr_handler_func lapic_timer_interrupt;
+
+/* Starts the CPUs other than the boot CPU, up to smp_max_cpus in
+   all, if the machine has them.  Must be called with interrupts
+   on, after the timer is calibrated and before any user process
+   starts. */
+void
+smp_init (void)
+{
+  unsigned apic_ids[THREAD_CPU_CNT - 1];
+  struct mp_config *mpc;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  uint32_t affinity;
+  uint32_t cr4;
+  uint8_t *code;
+  int apic_cnt, i;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  if (smp_max_cpus <= 1)
+    return;
+  if (!lapic_present ())
+    {
+      printf ("smp: no local APIC, using one CPU.\n");
+      return;
+    }
+  mpc = mp_find_config ();
+  if (mpc == NULL)
+    {
+      printf ("smp: no MP configuration table, using one CPU.\n");
+      return;
+    }
+  apic_cnt = mp_find_cpus (mpc, apic_ids, smp_max_cpus - 1);
+  if (apic_cnt == 0)
+    {
+      printf ("smp: only one CPU.\n");
+      return;
+    }
+
+  /* Set up this CPU's local APIC, and count time on the others
+     with their timers, from which point the boot CPU's timer must
+     tick steadily for them. */
+  intr_register_ipi (LAPIC_CALL_VEC, call_interrupt, "IPI call");
+  intr_register_ipi (LAPIC_RESCHED_VEC, resched_interrupt,
+                     "IPI reschedule");
+  intr_register_lapic (LAPIC_TIMER_VEC, lapic_timer_interrupt,
+                       "LAPIC timer");
+  lapic_map (mpc->lapic_addr);
+  lapic_init (true);
+  cpus[0].apic_id = lapic_id ();
+  lapic_calibrate ();
+  timer_tickless = false;
+
+  /* Take device interrupts through the IOAPIC, if there is one,
+     so that they can be sent to any CPU. */
+  if (mp_find_ioapic (mpc))
+    intr_init_ioapic ();
+  else
+    printf ("smp: no I/O APIC, device interrupts go to CPU 0.\n");
+
+  /* From here on, turning interrupts off takes the kernel lock.
+     This thread stays on this CPU until the others are up. */
+  affinity = cur->affinity;
+  cur->affinity = 1;
+  old_level = intr_disable ();
+  kernel_lock = 1;
+  cpus[0].lock_held = true;
+  smp_active = true;
+  intr_set_level (old_level);
+
+  /* Copy the startup code below 1 MB, and map the low 4 MB where
+     it is, for the instructions just after it turns paging on. */
+  code = ptov (SMP_AP_START);
+  memcpy (code, ap_start, ap_start_end - ap_start);
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  set_ap_var (code, &ap_cr3, vtop (init_page_dir));
+  set_ap_var (code, &ap_cr4, cr4);
+  init_page_dir[0] = init_page_dir[pd_no (ptov (0))];
+  reload_cr3 (NULL);
+
+  for (i = 0; i < apic_cnt; i++)
+    {
+      int id = smp_cpu_cnt;
+      int64_t start;
+
+      cpus[id].id = id;
+      cpus[id].apic_id = apic_ids[i];
+      set_ap_var (code, &ap_stack, (uint32_t) thread_prepare_cpu (id));
+      lapic_start_ap (apic_ids[i], SMP_AP_START);
+
+      start = timer_ticks ();
+      while (!cpus[id].online && timer_elapsed (start) <= TIMER_FREQ / 10)
+        barrier ();
+      if (!cpus[id].online)
+        {
+          printf ("smp: CPU with APIC ID %u did not start.\n", apic_ids[i]);
+          break;
+        }
+    }
+
+  /* Unmap the low 4 MB again, everywhere. */
+  old_level = intr_disable ();
+  init_page_dir[0] = 0;
+  reload_cr3 (NULL);
+  smp_call (smp_online_mask, reload_cr3, NULL);
+  cur->affinity = affinity;
+  intr_set_level (old_level);
+
+  printf ("smp: %d CPUs online.\n", smp_cpu_cnt);
+}
+
+/* Sets VAR, one of the startup code's variables, to VALUE in the
+   copy of the code at CODE. */
+static void
+set_ap_var (uint8_t *code, uint32_t *var, uint32_t value)
+{
+  *(uint32_t *) (code + ((uint8_t *) var - ap_start)) = value;
+}
+
+/* Entry to C code of a CPU that smp_init() started, from start.S,
+   with interrupts off, on the stack of the CPU's idle thread. */
+void
+smp_ap_main (void)
+{
+  int id = smp_cpu ();
+
+  /* Interrupts are off already, so intr_disable() would not take
+     the kernel lock. */
+  smp_lock ();
+
+  intr_init_ap ();
+#ifdef USERPROG
+  gdt_init_ap ();
+  syscall_init_ap ();
+#endif
+  lapic_init (false);
+  lapic_timer_start ();
+
+  smp_online_mask |= 1u << id;
+  smp_cpu_cnt++;
+  cpus[id].online = true;
+
+  thread_start_ap ();
+}
+
+/* Atomically stores NEW in *P and returns the old value.  See
+   [IA32-v2b] "XCHG--Exchange Register/Memory with Register". */
+static inline uint32_t
+atomic_xchg (volatile uint32_t *p, uint32_t new)
+{
+  asm volatile ("xchgl %0, %1" : "+r" (new), "+m" (*p) : : "memory");
+  return new;
+}
+
+/* Takes the kernel lock for the running CPU, which must have
+   interrupts off and not hold it already.  Called by
+   intr_disable() and on interrupt entry.  Answers cross-CPU calls
+   while it waits, because the holder may be waiting for one. */
+void
+smp_lock (void)
+{
+  struct cpu *c = &cpus[smp_cpu ()];
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!c->lock_held);
+
+  while (atomic_xchg (&kernel_lock, 1) != 0)
+    while (kernel_lock != 0)
+      {
+        if (c->call_pending)
+          run_call (c);
+        asm volatile ("pause" : : : "memory");
+      }
+  c->lock_held = true;
+}
+
+/* Releases the kernel lock, which the running CPU holds. */
+void
+smp_unlock (void)
+{
+  struct cpu *c = &cpus[smp_cpu ()];
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (c->lock_held);
+
+  c->lock_held = false;
+  barrier ();
+  kernel_lock = 0;
+}
+
+/* Returns true if the running CPU holds the kernel lock. */
+bool
+smp_lock_held (void)
+{
+  return smp_active && cpus[smp_cpu ()].lock_held;
+}
+
+/* Runs FUNC with AUX on each online CPU in CPU_MASK other than
+   the running CPU, with interrupts off there, and waits for all
+   of them to finish.  FUNC must touch only its own CPU's state,
+   since it runs without the kernel lock, which the caller holds
+   throughout. */
+void
+smp_call (uint32_t cpu_mask, smp_call_func *func, void *aux)
+{
+  enum intr_level old_level;
+  int self, cpu;
+
+  old_level = intr_disable ();
+  self = smp_cpu ();
+  cpu_mask &= smp_online_mask & ~(1u << self);
+  if (cpu_mask != 0)
+    {
+      call_func = func;
+      call_aux = aux;
+      barrier ();
+      for (cpu = 0; cpu < THREAD_CPU_CNT; cpu++)
+        if (cpu_mask & (1u << cpu))
+          {
+            cpus[cpu].call_pending = true;
+            lapic_send_ipi (cpus[cpu].apic_id, LAPIC_CALL_VEC);
+          }
+      for (cpu = 0; cpu < THREAD_CPU_CNT; cpu++)
+        while (cpus[cpu].call_pending)
+          asm volatile ("pause" : : : "memory");
+    }
+  intr_set_level (old_level);
+}
+
+/* Interrupts CPU, if it is idle, to look for a thread to run. */
+void
+smp_send_reschedule (int cpu)
+{
+  ASSERT (cpus[cpu].online);
+  lapic_send_ipi (cpus[cpu].apic_id, LAPIC_RESCHED_VEC);
+}
+
+/* Runs the smp_call() pending on C, the running CPU. */
+static void
+run_call (struct cpu *c)
+{
+  call_func (call_aux);
+  barrier ();
+  c->call_pending = false;
+}
+
+/* Cross-CPU call interrupt.  The call may already have been
+   answered while this CPU spun for the kernel lock. */
+static void
+call_interrupt (struct intr_frame *f UNUSED)
+{
+  struct cpu *c = &cpus[smp_cpu ()];
+
+  if (c->call_pending)
+    run_call (c);
+}
+
+/* Reschedule interrupt.  Nothing to do here: it only wakes the
+   idle thread from `hlt', and the idle thread reschedules. */
+static void
+resched_interrupt (struct intr_frame *f UNUSED)
+{
+}
+
+/* Local APIC timer interrupt, on a CPU other than the boot CPU. */
+static void
+lapic_timer_interrupt (struct intr_frame *f UNUSED)
+{
+  timer_cpu_tick ();
+}
+
+/* Reloads CR3, flushing the running CPU's TLB. */
+static void
+reload_cr3 (void *aux UNUSED)
+{
+  uint32_t cr3;
+
+  asm volatile ("movl %%cr3, %0; movl %0, %%cr3" : "=r" (cr3) : : "memory");
+}
+
+/* Returns the MP configuration table, or a null pointer if there
+   is none.  The floating pointer that locates it is in the first
+   kB of the extended BIOS data area, the last kB of base memory,
+   or the BIOS ROM.  See [MP] 4 "MP Configuration Table". */
+static struct mp_config *
+mp_find_config (void)
+{
+  uintptr_t ebda = *(uint16_t *) ptov (0x40e) << 4;
+  uintptr_t base = *(uint16_t *) ptov (0x413) * 1024;
+  struct mp_float *mpf = NULL;
+  struct mp_config *mpc;
+
+  if (ebda != 0)
+    mpf = mp_search (ebda, 1024);
+  if (mpf == NULL && base >= 1024)
+    mpf = mp_search (base - 1024, 1024);
+  if (mpf == NULL)
+    mpf = mp_search (0xf0000, 0x10000);
+  if (mpf == NULL || mpf->config == 0
+      || mpf->config + sizeof *mpc > init_ram_pages * PGSIZE)
+    return NULL;
+
+  mpc = ptov (mpf->config);
+  if (memcmp (mpc->signature, "PCMP", 4)
+      || mpf->config + mpc->length > init_ram_pages * PGSIZE
+      || !mp_checksum (mpc, mpc->length))
+    return NULL;
+  return mpc;
+}
+
+/* Returns the MP floating pointer structure in the SIZE bytes at
+   physical address PADDR, or a null pointer if there is none. */
+static struct mp_float *
+mp_search (uintptr_t paddr, size_t size)
+{
+  uint8_t *p = ptov (paddr);
+  uint8_t *end = p + size;
+
+  for (; p + sizeof (struct mp_float) <= end; p += 16)
+    if (!memcmp (p, "_MP_", 4) && mp_checksum (p, sizeof (struct mp_float)))
+      return (struct mp_float *) p;
+  return NULL;
+}
+
+/* Returns true if the SIZE bytes at P sum to 0. */
+static bool
+mp_checksum (const void *p_, size_t size)
+{
+  const uint8_t *p = p_;
+  uint8_t sum = 0;
+
+  while (size-- > 0)
+    sum += *p++;
+  return sum == 0;
+}
+
+/* Stores in IDS the local APIC IDs of up to MAX usable CPUs in
+   MPC other than the boot CPU, and returns how many it stored. */
+static int
+mp_find_cpus (const struct mp_config *mpc, unsigned ids[], int max)
+{
+  const uint8_t *p = (const uint8_t *) (mpc + 1);
+  const uint8_t *end = (const uint8_t *) mpc + mpc->length;
+  int cnt = 0;
+  int i;
+
+  for (i = 0; i < mpc->entry_cnt && p < end; i++)
+    if (*p == MP_PROC)
+      {
+        const struct mp_proc *proc = (const struct mp_proc *) p;
+
+        if ((proc->flags & MP_PROC_ENABLED) && !(proc->flags & MP_PROC_BSP)
+            && cnt < max)
+          ids[cnt++] = proc->apic_id;
+        p += sizeof *proc;
+      }
+    else
+      p += 8;
+  return cnt;
+}
+
+/* Sets up the first usable I/O APIC in MPC, with the input pin
+   and signalling of each ISA IRQ as MPC assigns them, and returns
+   true, or returns false if MPC has no usable I/O APIC.  Pins
+   that MPC assigns to a PCI interrupt are taken to carry the ISA
+   IRQ of the same number, as is the case for the pins below 16 on
+   the machines this kernel runs on, emulated or not. */
+static bool
+mp_find_ioapic (const struct mp_config *mpc)
+{
+  const struct mp_ioapic *ioapic = NULL;
+  const uint8_t *end = (const uint8_t *) mpc + mpc->length;
+  uint32_t isa_buses = 0, pci_buses = 0;
+  const uint8_t *p;
+  int i;
+
+  /* Find the buses and the I/O APIC. */
+  p = (const uint8_t *) (mpc + 1);
+  for (i = 0; i < mpc->entry_cnt && p < end; i++)
+    if (*p == MP_PROC)
+      p += sizeof (struct mp_proc);
+    else
+      {
+        if (*p == MP_BUS)
+          {
+            const struct mp_bus *bus = (const struct mp_bus *) p;
+
+            if (bus->id < 32 && !memcmp (bus->type_name, "ISA", 3))
+              isa_buses |= 1u << bus->id;
+            else if (bus->id < 32 && !memcmp (bus->type_name, "PCI", 3))
+              pci_buses |= 1u << bus->id;
+          }
+        else if (*p == MP_IOAPIC && ioapic == NULL)
+          {
+            const struct mp_ioapic *io = (const struct mp_ioapic *) p;
+
+            if (io->flags & MP_IOAPIC_ENABLED)
+              ioapic = io;
+          }
+        p += 8;
+      }
+  if (ioapic == NULL)
+    return false;
+  ioapic_init (ioapic->addr);
+
+  /* Record where each ISA IRQ arrives, and how it signals. */
+  p = (const uint8_t *) (mpc + 1);
+  for (i = 0; i < mpc->entry_cnt && p < end; i++)
+    if (*p == MP_PROC)
+      p += sizeof (struct mp_proc);
+    else
+      {
+        const struct mp_intr *in = (const struct mp_intr *) p;
+
+        if (*p == MP_IOINTR && in->int_type == MP_INTR_INT
+            && in->dst_ioapic == ioapic->id && in->src_bus < 32)
+          {
+            bool pci = (pci_buses & (1u << in->src_bus)) != 0;
+            int irq = -1;
+            int flags;
+
+            if (isa_buses & (1u << in->src_bus))
+              irq = in->src_irq;
+            else if (pci)
+              irq = in->dst_intin;
+
+            if (irq >= 0 && irq < 16)
+              {
+                int polarity = MP_POLARITY (in->flags);
+                int trigger = MP_TRIGGER (in->flags);
+
+                flags = 0;
+                if (polarity == 3 || (polarity == 0 && pci))
+                  flags |= IOAPIC_ACTIVE_LOW;
+                if (trigger == 3 || (trigger == 0 && pci))
+                  flags |= IOAPIC_LEVEL;
+                ioapic_set_irq_pin (irq, in->dst_intin, flags);
+              }
+          }
+        p += 8;
+      }
+  return true;
+}
@@ -0,0 +1,71 @@
+#ifndef THREADS_SMP_H
+#define THREADS_SMP_H
+
+/* Physical address, page-aligned and below 1 MB, to which
+   smp_init() copies the real-mode startup code of the other CPUs
+   (see start.S).  Nothing else uses this page after boot: the
+   loader is at 0x7c00, the initial thread's stack ends below
+   0xf000, and the page allocator's pools start above 1 MB. */
+#define SMP_AP_START 0x1000
+
+#ifndef __ASSEMBLER__
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/thread.h"
+
+/* A CPU. */
+struct cpu
+  {
+    int id;                     /* Index in cpus[], 0 for the boot CPU. */
+    unsigned apic_id;           /* Local APIC ID. */
+    bool lock_held;             /* Holding the kernel lock? */
+    volatile bool call_pending; /* smp_call() waiting on this CPU? */
+    volatile bool online;       /* Started and scheduling threads? */
+  };
+
+extern struct cpu cpus[THREAD_CPU_CNT];
+
+/* Number of CPUs online, and the mask of them, one bit per CPU.
+   Only the boot CPU, CPU 0, until smp_init() starts others. */
+extern int smp_cpu_cnt;
+extern uint32_t smp_online_mask;
+
+/* True once smp_init() has found other CPUs to start, from which
+   point turning interrupts off also takes the kernel lock (see
+   smp.c). */
+extern bool smp_active;
+
+/* Most CPUs to use, including the boot CPU.  Controlled by kernel
+   command-line option "-smp=N". */
+extern int smp_max_cpus;
+
+void smp_init (void);
+void smp_ap_main (void) NO_RETURN;
+
+void smp_lock (void);
+void smp_unlock (void);
+bool smp_lock_held (void);
+
+/* Function run on other CPUs by smp_call(). */
+typedef void smp_call_func (void *aux);
+void smp_call (uint32_t cpu_mask, smp_call_func *, void *aux);
+void smp_send_reschedule (int cpu);
+
+/* Returns the running CPU's index in cpus[].  A thread's `cpu'
+   only changes while it is off the CPU, so this is the running
+   thread's, found from the stack pointer like running_thread():
+   thread_current() insists on a running thread, which the
+   scheduler does not have in the middle of a switch. */
+static inline int
+smp_cpu (void)
+{
+  uintptr_t esp;
+
+  if (!smp_active)
+    return 0;
+  asm ("mov %%esp, %0" : "=g" (esp));
+  return ((struct thread *) (esp & ~(uintptr_t) (THREAD_SIZE - 1)))->cpu;
+}
+#endif /* !__ASSEMBLER__ */
+
+#endif /* threads/smp.h */
@@ -0,0 +1,120 @@
+#include "threads/spinlock.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "threads/thread.h"
+#include "threads/tsc.h"
+#include "threads/vaddr.h"
+
+#ifdef LOCK_STATS
+/* All spinlocks ever acquired, for spin_print_stats(). */
+static struct list all_spinlocks = LIST_INITIALIZER (all_spinlocks);
+#endif
+
+#ifndef NDEBUG
+/* Returns the running thread, like thread_current() but without
+   its checks, since a spinlock may be taken while the running
+   thread is in the middle of changing its status. */
+static struct thread *
+current_thread (void)
+{
+  uint32_t *esp;
+  asm ("mov %%esp, %0" : "=g" (esp));
+  return pg_round_down (esp);
+}
+#endif
+
+/* Initializes LOCK, named NAME, which must outlive it, such as a
+   string literal. */
+void
+spin_lock_init (struct spinlock *lock, const char *name)
+{
+  ASSERT (lock != NULL);
+  ASSERT (name != NULL);
+
+  lock->name = name;
+#ifndef NDEBUG
+  lock->holder = NULL;
+#endif
+#ifdef LOCK_STATS
+  lock->elem.prev = lock->elem.next = NULL;
+  lock->acquisitions = lock->hold_cycles = lock->max_hold_cycles = 0;
+#endif
+}
+
+/* Acquires LOCK, turning interrupts off, and returns the previous
+   interrupt level for spin_unlock_irqrestore().  LOCK must not
+   already be held by the current thread. */
+enum intr_level
+spin_lock_irqsave (struct spinlock *lock UNUSED)
+{
+  enum intr_level old_level = intr_disable ();
+
+  ASSERT (!spin_lock_held (lock));
+#ifndef NDEBUG
+  lock->holder = current_thread ();
+#endif
+#ifdef LOCK_STATS
+  /* A lock is listed for spin_print_stats() when first taken,
+     which also covers static locks. */
+  if (lock->elem.prev == NULL)
+    list_push_back (&all_spinlocks, &lock->elem);
+  lock->acquired_at = rdtsc ();
+#endif
+  return old_level;
+}
+
+/* Releases LOCK, which the current thread must hold, and sets the
+   interrupt level back to OLD_LEVEL. */
+void
+spin_unlock_irqrestore (struct spinlock *lock UNUSED,
+                        enum intr_level old_level)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (spin_lock_held (lock));
+#ifdef LOCK_STATS
+  {
+    uint64_t cycles = rdtsc () - lock->acquired_at;
+    lock->acquisitions++;
+    lock->hold_cycles += cycles;
+    if (cycles > lock->max_hold_cycles)
+      lock->max_hold_cycles = cycles;
+  }
+#endif
+#ifndef NDEBUG
+  lock->holder = NULL;
+#endif
+  intr_set_level (old_level);
+}
+
+/* Returns true if the current thread holds LOCK.  Without
+   debugging, only reports whether interrupts are off, which is
+   the most that can be known. */
+bool
+spin_lock_held (const struct spinlock *lock UNUSED)
+{
+#ifndef NDEBUG
+  return (intr_get_level () == INTR_OFF
+          && lock->holder == current_thread ());
+#else
+  return intr_get_level () == INTR_OFF;
+#endif
+}
+
+#ifdef LOCK_STATS
+/* Prints hold-time statistics for every spinlock. */
+void
+spin_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_spinlocks); e != list_end (&all_spinlocks);
+       e = list_next (e))
+    {
+      struct spinlock *lock = list_entry (e, struct spinlock, elem);
+      printf ("Spinlock %s: %llu acquisitions, %"PRIu64" cycles held "
+              "(max %"PRIu64")\n", lock->name, lock->acquisitions,
+              lock->hold_cycles, lock->max_hold_cycles);
+    }
+}
+#endif /* LOCK_STATS */
@@ -0,0 +1,49 @@
+#ifndef THREADS_SPINLOCK_H
+#define THREADS_SPINLOCK_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
+
+struct thread;
+
+/* A spinlock, for critical sections too short to sleep in.
+   Acquiring one turns interrupts off until it is released, so it
+   may be used in interrupt handlers and by code that an interrupt
+   handler might otherwise run in the middle of.  Code holding a
+   spinlock must not sleep.
+
+   Turning interrupts off is exclusion enough on one CPU, and with
+   more it also takes the kernel lock that every CPU spins on (see
+   threads/smp.c), so there is nothing more to spin on here.
+   Unless NDEBUG is defined, the holder is tracked to catch
+   recursive acquisition and release by a non-holder.  With LOCK_STATS,
+   hold times are accounted and reported by spin_print_stats(). */
+struct spinlock
+  {
+    const char *name;           /* Name, for debugging. */
+#ifndef NDEBUG
+    struct thread *holder;      /* Thread holding lock. */
+#endif
+#ifdef LOCK_STATS
+    struct list_elem elem;      /* Element in list of all spinlocks. */
+    uint64_t acquired_at;       /* Cycle count at acquisition. */
+    unsigned long long acquisitions; /* Number of acquisitions. */
+    uint64_t hold_cycles;       /* Total cycles held. */
+    uint64_t max_hold_cycles;   /* Longest hold. */
+#endif
+  };
+
+/* Initializer for a spinlock named NAME, for static spinlocks. */
+#define SPINLOCK_INITIALIZER(NAME) { .name = (NAME) }
+
+void spin_lock_init (struct spinlock *, const char *name);
+enum intr_level spin_lock_irqsave (struct spinlock *);
+void spin_unlock_irqrestore (struct spinlock *, enum intr_level);
+bool spin_lock_held (const struct spinlock *);
+#ifdef LOCK_STATS
+void spin_print_stats (void);
+#endif
+
+#endif /* threads/spinlock.h */
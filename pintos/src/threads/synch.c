@@ -27,10 +27,52 @@
 */
 
 #include "threads/synch.h"
+#include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/interrupt.h"
+#include "threads/smp.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "devices/timer.h"
+
+/* Maximum number of lock holders that one donation is passed
+   along, bounding the work done by lock_acquire() for deeply
+   nested locks. */
+#define DONATION_DEPTH_MAX 8
+
+/* Values of struct lock's `state'.  A lock is taken by changing
+   its state from LOCK_FREE to LOCK_HELD and released by changing
+   it back, each with a single atomic instruction, as long as no
+   thread waits for it; see lock_cas().  A thread that has to wait
+   sets LOCK_CONTENDED, with interrupts off, which sends the
+   holder's lock_release() down the slow path that wakes a
+   waiter.
+
+   With more than one CPU, the slow paths' plain stores to the
+   state are kept from racing with each other by the kernel lock
+   that comes with turning interrupts off (see threads/smp.c), but
+   not from racing with an atomic instruction on another CPU,
+   which could take or free the lock between a waiter's test and
+   its store and so lose a wakeup.  Then every change of state
+   goes through the slow paths. */
+#define LOCK_FREE 0             /* Not held. */
+#define LOCK_HELD 1             /* Held, with no thread waiting. */
+#define LOCK_CONTENDED 2        /* Held, and threads may be waiting. */
+
+static void donate_priority (struct thread *);
+static void withdraw_donation (struct thread *);
+static bool lock_cas (struct lock *, unsigned old, unsigned new);
+static bool lock_wait (struct lock *, bool timed, int64_t deadline);
+static struct thread *lock_wake (struct lock *);
+static void lock_list (struct lock *);
+static void lock_acquired_slow (struct lock *);
+#ifdef LOCK_STATS
+static struct lock_stats *lock_stats_lookup (const char *name);
+static void lock_stats_acquired (struct lock *, bool contended,
+                                 int64_t start);
+#endif
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -68,14 +110,60 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0)
     {
+      /* waiters is kept in descending priority order, FIFO among equal
+         priorities, so sema_up() finds the thread to wake at its front */
       list_insert_ordered (&sema->waiters, &thread_current()->elem,
-                           priority_semaphore_compare, NULL);
+                           priority_compare, NULL);
       thread_block ();
     }
   sema->value--;
   intr_set_level (old_level);
 }
 
+/* Down or "P" operation on a semaphore, giving up after about
+   TIMEOUT timer ticks.  Returns true if the semaphore was
+   decremented, false if the timeout expired first.  A TIMEOUT of
+   0 or less makes this equivalent to sema_try_down().
+
+   While waiting, the thread is both on SEMA's waiters and in the
+   sleep wheel, so no polling is involved.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+sema_down_timeout (struct semaphore *sema, int64_t timeout)
+{
+  enum intr_level old_level;
+  int64_t deadline;
+  bool success = true;
+
+  ASSERT (sema != NULL);
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  deadline = timer_ticks () + timeout;
+  while (sema->value == 0)
+    {
+      if (timeout <= 0 || timer_ticks () >= deadline)
+        {
+          success = false;
+          break;
+        }
+      list_insert_ordered (&sema->waiters, &thread_current()->elem,
+                           priority_compare, NULL);
+      if (!thread_block_until (deadline))
+        {
+          success = false;
+          break;
+        }
+    }
+  if (success)
+    sema->value--;
+  intr_set_level (old_level);
+
+  return success;
+}
+
 /* Down or "P" operation on a semaphore, but only if the
    semaphore is not already 0.  Returns true if the semaphore is
    decremented, false otherwise.
@@ -117,26 +205,77 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
 
-  while (!list_empty (&sema->waiters))
-  { // unblock all threads waiting for sema_up
-    waiting_thread = list_entry (list_pop_back (&sema->waiters), struct thread, elem);
+  /* since sema->waiters is a list in descending order, the front waiter has
+  the highest priority.  Only it is woken: it will find the incremented value
+  and take it, so waking the others would only make them block again. */
+  if (!list_empty (&sema->waiters))
+  {
+    waiting_thread = list_entry (list_pop_front (&sema->waiters), struct thread, elem);
     thread_unblock(waiting_thread);
   }
 
-  /* since sema->waiters is a list in descending order, waiting thread will
-  have the highest priority of the newly ready threads. preempt if
-  waiting_thread has higher priority than the currently running thread */
+  /* preempt if waiting_thread has higher priority than the currently running
+  thread */
   sema->value++;
   if (waiting_thread != NULL &&
-      waiting_thread->priority > cur->priority &&
-      waiting_thread->status == THREAD_READY)
+      waiting_thread->priority > cur->priority)
   {
-    thread_yield();
+    if (intr_context ())
+      intr_yield_on_return ();
+    else
+      thread_yield();
   }
 
   intr_set_level (old_level);
 }
 
+/* Like sema_up(), but if the thread woken has at least the
+   running thread's priority, switches to it at once with
+   thread_yield_to(), instead of leaving it to the scheduler.
+   Suits a pair of threads that pass control back and forth
+   through semaphores.
+
+   Unlike sema_up(), this function must not be called within an
+   interrupt handler. */
+void
+sema_up_handoff (struct semaphore *sema)
+{
+  enum intr_level old_level;
+  struct thread *waiting_thread = NULL;
+
+  ASSERT (sema != NULL);
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  if (!list_empty (&sema->waiters))
+    {
+      waiting_thread = list_entry (list_pop_front (&sema->waiters),
+                                   struct thread, elem);
+      thread_unblock (waiting_thread);
+    }
+  sema->value++;
+  if (waiting_thread != NULL
+      && waiting_thread->priority >= thread_current ()->priority)
+    thread_yield_to (waiting_thread);
+  intr_set_level (old_level);
+}
+
+/* Moves T, which must be blocked in sema_down() on SEMA, to the
+   position in SEMA's waiters for T's current priority.  Called
+   after T's priority changes, for example by priority donation,
+   so that sema_up() keeps waking the highest-priority waiter.
+   Must be called with interrupts off. */
+void
+sema_reorder_waiter (struct semaphore *sema, struct thread *t)
+{
+  ASSERT (sema != NULL);
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_BLOCKED);
+
+  list_remove (&t->elem);
+  list_insert_ordered (&sema->waiters, &t->elem, priority_compare, NULL);
+}
+
 static void sema_test_helper (void *sema_);
 
 /* Self-test for semaphores that makes control "ping-pong"
@@ -190,18 +329,118 @@ sema_test_helper (void *sema_)
    onerous, it's a good sign that a semaphore should be used,
    instead of a lock. */
 void
-lock_init (struct lock *lock)
+(lock_init) (struct lock *lock)
 {
   ASSERT (lock != NULL);
 
   lock->holder = NULL;
-  sema_init (&lock->semaphore, 1);
+  lock->state = LOCK_FREE;
+  sema_init (&lock->semaphore, 0);
+  lock->lock_list_elem.prev = lock->lock_list_elem.next = NULL;
+#ifdef LOCK_STATS
+  lock->stats = NULL;
+#endif
+}
+
+/* Initializes LOCK like lock_init() and tags it with NAME, a
+   string that must outlive the lock, such as a literal.  With
+   LOCK_STATS defined, contention on all locks sharing NAME is
+   accounted together and reported by lock_print_stats();
+   otherwise NAME is ignored. */
+void
+lock_init_named (struct lock *lock, const char *name)
+{
+  (lock_init) (lock);
+#ifdef LOCK_STATS
+  lock->stats = lock_stats_lookup (name);
+#else
+  (void) name;
+#endif
+}
+
+#ifdef LOCK_STATS
+/* Statistics records, one per lock name.  Records are never
+   freed.  Locks with names beyond the table's capacity are not
+   accounted. */
+#define LOCK_STATS_CNT 64
+static struct lock_stats lock_stats[LOCK_STATS_CNT];
+static size_t lock_stats_used;
+
+/* Returns the statistics record for NAME, creating it if
+   necessary, or a null pointer if the table is full.  Threads on
+   other CPUs may be looking up names too, so the table is
+   protected by turning interrupts off, which also takes the
+   kernel lock. */
+static struct lock_stats *
+lock_stats_lookup (const char *name)
+{
+  enum intr_level old_level;
+  struct lock_stats *s;
+
+  old_level = intr_disable ();
+  for (s = lock_stats; s < lock_stats + lock_stats_used; s++)
+    if (s->name == name || !strcmp (s->name, name))
+      break;
+  if (s == lock_stats + lock_stats_used)
+    {
+      if (lock_stats_used < LOCK_STATS_CNT)
+        {
+          lock_stats_used++;
+          s->name = name;
+        }
+      else
+        s = NULL;
+    }
+  intr_set_level (old_level);
+
+  return s;
+}
+
+/* Records that LOCK was just acquired by the running thread
+   after waiting since tick START. */
+static void
+lock_stats_acquired (struct lock *lock, bool contended, int64_t start)
+{
+  struct lock_stats *s = lock->stats;
+
+  lock->acquired_at = timer_ticks ();
+  if (s != NULL)
+    {
+      int64_t wait = lock->acquired_at - start;
+
+      s->acquisitions++;
+      if (contended)
+        {
+          s->contended++;
+          s->wait_ticks += wait;
+          if (wait > s->max_wait_ticks)
+            s->max_wait_ticks = wait;
+        }
+    }
 }
 
+/* Prints contention statistics for every named lock. */
+void
+lock_print_stats (void)
+{
+  struct lock_stats *s;
+
+  for (s = lock_stats; s < lock_stats + lock_stats_used; s++)
+    printf ("Lock %s: %llu acquisitions, %llu contended, "
+            "%"PRId64" wait ticks (max %"PRId64"), %"PRId64" hold ticks\n",
+            s->name, s->acquisitions, s->contended,
+            s->wait_ticks, s->max_wait_ticks, s->hold_ticks);
+}
+#endif /* LOCK_STATS */
+
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   An uncontended lock is taken with one atomic instruction,
+   without turning interrupts off.  Only a thread that has to
+   wait goes through priority donation.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -214,25 +453,168 @@ lock_acquire (struct lock *lock)
   ASSERT (!lock_held_by_current_thread (lock));
   struct thread * cur;
   enum intr_level old_level;
+  bool waited;
+#ifdef LOCK_STATS
+  bool contended = lock->state != LOCK_FREE;
+  int64_t start = timer_ticks ();
+#else
+  if (!smp_active && lock_cas (lock, LOCK_FREE, LOCK_HELD))
+  {
+    lock->holder = thread_current ();
+    /* a thread that came to wait before we set holder could not
+       donate to us */
+    if (lock->state == LOCK_CONTENDED)
+    {
+      old_level = intr_disable ();
+      lock_acquired_slow (lock);
+      intr_set_level (old_level);
+    }
+    return;
+  }
+#endif
 
   old_level = intr_disable();
   cur = thread_current();
+  waited = lock->state != LOCK_FREE;
 
+  if(waited)
+    TRACE (TRACE_LOCK_WAIT, cur, lock->holder, 0);
   if(lock->holder != NULL && !thread_mlfqs)
   {
     cur->waiting_for_lock = lock;
+    donate_priority(cur);
   }
 
-  sema_down (&lock->semaphore);
+  lock_wait (lock, false, 0);
   lock->holder = thread_current ();
+  if(waited)
+    TRACE (TRACE_LOCK_GOT, cur, NULL, 0);
+#ifdef LOCK_STATS
+  lock_stats_acquired (lock, contended, start);
+#endif
+  if(!thread_mlfqs)
+    cur->waiting_for_lock = NULL;
+  lock_acquired_slow (lock);
+
+  intr_set_level (old_level);
+}
+
+/* Acquires LOCK like lock_acquire(), but gives up after about
+   TIMEOUT timer ticks.  Returns true if LOCK was acquired, false
+   if the timeout expired first.  On timeout, the priority this
+   thread donated is withdrawn from LOCK's holder and from every
+   holder it passed on to down the chain.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+lock_acquire_timeout (struct lock *lock, int64_t timeout)
+{
+  struct thread *cur;
+  enum intr_level old_level;
+  bool success, waited;
+#ifdef LOCK_STATS
+  bool contended = lock->state != LOCK_FREE;
+  int64_t start = timer_ticks ();
+#endif
+
+  ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!lock_held_by_current_thread (lock));
+
+  old_level = intr_disable();
+  cur = thread_current();
+  waited = lock->state != LOCK_FREE;
+
+  if(waited)
+    TRACE (TRACE_LOCK_WAIT, cur, lock->holder, 0);
+  if(lock->holder != NULL && !thread_mlfqs)
+  {
+    cur->waiting_for_lock = lock;
+    donate_priority(cur);
+  }
+
+  success = lock_wait (lock, true, timer_ticks () + timeout);
   if(!thread_mlfqs)
+    cur->waiting_for_lock = NULL;
+  if(success)
+  {
+    lock->holder = cur;
+    if(waited)
+      TRACE (TRACE_LOCK_GOT, cur, NULL, 0);
+#ifdef LOCK_STATS
+    lock_stats_acquired (lock, contended, start);
+#endif
+    lock_acquired_slow (lock);
+  } else if(lock->holder != NULL && !thread_mlfqs)
   {
-    lock->holder->waiting_for_lock = NULL;
-    list_insert_ordered(&lock->holder->locks, &lock->lock_list_elem,
-                        lock_priority_compare, NULL);
+    /* we left the waiters, so the holders down the chain may no longer
+       need our priority */
+    withdraw_donation (lock->holder);
   }
 
   intr_set_level (old_level);
+  return success;
+}
+
+/* Passes T's priority along the chain of lock holders T is
+   waiting for.  Stops as soon as a holder already has at least
+   that priority, since the rest of the chain then cannot change,
+   or after DONATION_DEPTH_MAX holders, or at a holder that does
+   not take donations, the idle thread.  Each raised holder is
+   moved within the run queue or the waiters of the lock it is
+   itself waiting for.  Must be called with interrupts off. */
+static void
+donate_priority (struct thread *t)
+{
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; depth < DONATION_DEPTH_MAX; depth++)
+    {
+      struct lock *lock = t->waiting_for_lock;
+      struct thread *holder;
+
+      if (lock == NULL || lock->holder == NULL)
+        break;
+      holder = lock->holder;
+      if (holder->priority >= t->priority)
+        break;
+      TRACE (TRACE_DONATE, t, holder, t->priority);
+      thread_set_thread_priority (holder, t->priority);
+      if (holder->priority < t->priority)
+        break;
+      t = holder;
+    }
+}
+
+/* Recomputes the priority of HOLDER, after a waiter gave up on a
+   lock that HOLDER holds, and passes the change along the chain of
+   lock holders HOLDER is waiting for, as donate_priority() passes
+   on a donation.  Stops at the first holder whose priority does
+   not change, or after DONATION_DEPTH_MAX holders.  Must be called
+   with interrupts off. */
+static void
+withdraw_donation (struct thread *holder)
+{
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; depth < DONATION_DEPTH_MAX; depth++)
+    {
+      int priority = thread_donated_priority (holder);
+      struct lock *lock;
+
+      if (priority == holder->priority)
+        break;
+      thread_set_thread_priority (holder, priority);
+      lock = holder->waiting_for_lock;
+      if (lock == NULL || lock->holder == NULL)
+        break;
+      holder = lock->holder;
+    }
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -244,14 +626,34 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
-  success = sema_try_down (&lock->semaphore);
+  if (smp_active)
+  {
+    old_level = intr_disable ();
+    success = lock->state == LOCK_FREE;
+    if (success)
+      lock->state = LOCK_HELD;
+  }
+  else
+  {
+    success = lock_cas (lock, LOCK_FREE, LOCK_HELD);
+    old_level = intr_disable ();
+  }
   if (success)
+  {
     lock->holder = thread_current ();
+#ifdef LOCK_STATS
+    lock_stats_acquired (lock, false, 0);
+#endif
+    if (lock->state == LOCK_CONTENDED)
+      lock_acquired_slow (lock);
+  }
+  intr_set_level (old_level);
   return success;
 }
 
@@ -264,21 +666,165 @@ void
 lock_release (struct lock *lock)
 {
   enum intr_level old_level;
+  struct thread *woken;
 
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+#ifndef LOCK_STATS
+  /* with no waiters, nothing was donated through LOCK and there is
+     no one to wake */
+  if (!smp_active)
+  {
+    lock->holder = NULL;
+    if (lock_cas (lock, LOCK_HELD, LOCK_FREE))
+      return;
+  }
+#endif
+
   old_level = intr_disable();
 
+#ifdef LOCK_STATS
+  if (lock->stats != NULL)
+    lock->stats->hold_ticks += timer_ticks () - lock->acquired_at;
+#endif
+  if (lock->lock_list_elem.prev != NULL)
+  {
+    /* remove lock from thread's list of locks */
+    list_remove (&lock->lock_list_elem);
+    lock->lock_list_elem.prev = NULL;
+  }
   lock->holder = NULL;
-  sema_up (&lock->semaphore);
+  lock->state = LOCK_FREE;
+  woken = lock_wake (lock);
 
+  /* drop the donations that came through LOCK, yielding if the thread no
+     longer has the highest priority */
   if(!thread_mlfqs){
-      list_remove(&lock->lock_list_elem); /* remove lock from thread's list of locks */
+      struct thread *cur = thread_current ();
+      thread_set_thread_priority (cur, thread_donated_priority (cur));
   }
+  if (woken != NULL && woken->priority > thread_current ()->priority)
+    thread_yield ();
   intr_set_level(old_level);
 }
 
+/* Sets LOCK's state to NEW if it is OLD, in one atomic
+   instruction, so that no interrupt can come between the test
+   and the update.  Returns true if the state was OLD.  See
+   [IA32-v2a] "CMPXCHG--Compare and Exchange". */
+static bool
+lock_cas (struct lock *lock, unsigned old, unsigned new)
+{
+  unsigned prev;
+
+  asm volatile ("lock cmpxchgl %2, %1"
+                : "=a" (prev), "+m" (lock->state)
+                : "r" (new), "0" (old)
+                : "memory");
+  return prev == old;
+}
+
+/* Waits until LOCK is free, then takes it for the running
+   thread, except for setting its holder.  With TIMED, gives up
+   at tick DEADLINE and returns false.  Returns true if LOCK was
+   taken.  Must be called with interrupts off.
+
+   lock_release() wakes the first waiter but leaves the lock
+   free, so another thread may take it first.  The woken thread
+   then waits again, marking the lock contended, so the waiters
+   left behind are not forgotten.  A thread that gives up waiting
+   likewise leaves the lock marked contended if others still
+   wait. */
+static bool
+lock_wait (struct lock *lock, bool timed, int64_t deadline)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (lock->state != LOCK_FREE)
+    {
+      if (timed && timer_ticks () >= deadline)
+        {
+          if (!list_empty (&lock->semaphore.waiters))
+            {
+              lock->state = LOCK_CONTENDED;
+              lock_list (lock);
+            }
+          return false;
+        }
+      uint64_t start;
+
+      lock->state = LOCK_CONTENDED;
+      lock_list (lock);
+      list_insert_ordered (&lock->semaphore.waiters, &cur->elem,
+                           priority_compare, NULL);
+      start = clock_cycles ();
+      if (timed)
+        thread_block_until (deadline);
+      else
+        thread_block ();
+      cur->lock_wait_cycles += clock_cycles () - start;
+    }
+  lock->state = (list_empty (&lock->semaphore.waiters)
+                 ? LOCK_HELD : LOCK_CONTENDED);
+  return true;
+}
+
+/* Wakes the first of LOCK's waiters, if any, and returns it, or
+   returns a null pointer.  Must be called with interrupts off. */
+static struct thread *
+lock_wake (struct lock *lock)
+{
+  struct thread *t = NULL;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!list_empty (&lock->semaphore.waiters))
+    {
+      t = list_entry (list_pop_front (&lock->semaphore.waiters),
+                      struct thread, elem);
+      thread_unblock (t);
+    }
+  return t;
+}
+
+/* Puts LOCK on its holder's list of held locks, through which
+   thread_donated_priority() finds the priority donated by LOCK's
+   waiters.  A lock does not need to be on the list while no one
+   waits for it, so it is only added once a waiter comes along.
+   Must be called with interrupts off. */
+static void
+lock_list (struct lock *lock)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!thread_mlfqs && lock->holder != NULL
+      && lock->lock_list_elem.prev == NULL)
+    list_push_back (&lock->holder->locks, &lock->lock_list_elem);
+}
+
+/* Finishes taking LOCK for the running thread, which has just
+   become its holder, if threads are waiting for LOCK: lists it
+   and takes on their priority.  Must be called with interrupts
+   off. */
+static void
+lock_acquired_slow (struct lock *lock)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (lock->holder == cur);
+
+  if (thread_mlfqs || lock->state != LOCK_CONTENDED)
+    return;
+  lock_list (lock);
+  /* threads that arrived while the lock was briefly free still donate */
+  if (thread_donated_priority(cur) > cur->priority)
+    thread_set_thread_priority(cur, thread_donated_priority(cur));
+}
+
 /* Returns true if the current thread holds LOCK, false
    otherwise.  (Note that testing whether some other thread holds
    a lock would be racy.) */
@@ -290,15 +836,21 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
+/* One thread waiting on a condition variable, in its waiters. */
 struct semaphore_elem
   {
-    struct list_elem elem;              /* List element. */
-    struct semaphore semaphore;         /* This semaphore. */
-    int highest_priority;               /* the highest priority thread waiting
-                                           for this semaphore*/
+    struct heap_elem elem;              /* Heap element. */
+    struct semaphore semaphore;         /* Upped to wake the waiter. */
+    struct condition *cond;             /* The condition waited on. */
+    struct thread *thread;              /* The waiting thread. */
+    unsigned seq;                       /* Arrival order on the
+                                           condition. */
   };
 
+static heap_less_func waiter_less;
+static void cond_enqueue (struct condition *, struct semaphore_elem *);
+static void cond_wake (struct condition *, struct lock *);
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -307,7 +859,8 @@ cond_init (struct condition *cond)
 {
   ASSERT (cond != NULL);
 
-  list_init (&cond->waiters);
+  heap_init (&cond->waiters, waiter_less, NULL);
+  cond->next_seq = 0;
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -340,40 +893,74 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  sema_init (&waiter.semaphore, 0);
-  waiter.highest_priority = thread_current()->priority; /* current thread is
-                                                           the only waiting
-                                                          thread for semaphore*/
-  //printf("cond_wait: inserting into list\n");
-  list_insert_ordered (&cond->waiters, &waiter.elem, priority_semaphore_compare,
-                       NULL);
-  //printf("cond_wait: releasing lock\n");
+  cond_enqueue (cond, &waiter);
   lock_release (lock);
-  //printf("cond_wait: putting sema down\n");
   sema_down (&waiter.semaphore);
-  //printf("cond_wait: acquiring lock\n");
   lock_acquire (lock);
-  //printf("cond_wait: lock acquired \n");
+}
+
+/* Like cond_wait(), but stops waiting for COND after about
+   TIMEOUT timer ticks.  LOCK is reacquired before returning in
+   either case.  Returns true if COND was signaled, false if the
+   timeout expired first.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+cond_wait_timeout (struct condition *cond, struct lock *lock, int64_t timeout)
+{
+  struct semaphore_elem waiter;
+  bool signaled;
+
+  ASSERT (cond != NULL);
+  ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (lock_held_by_current_thread (lock));
+
+  cond_enqueue (cond, &waiter);
+  lock_release (lock);
+  signaled = sema_down_timeout (&waiter.semaphore, timeout);
+  lock_acquire (lock);
+
+  /* cond_signal() removes a waiter and ups its semaphore while holding LOCK.
+     If that happened after our timeout, the signal is ours; otherwise we are
+     still on COND's waiters and must leave. */
+  if (!signaled)
+    {
+      signaled = sema_try_down (&waiter.semaphore);
+      if (!signaled)
+        {
+          enum intr_level old_level = intr_disable ();
+          heap_remove (&cond->waiters, &waiter.elem);
+          waiter.thread->cond_waiter = NULL;
+          intr_set_level (old_level);
+        }
+    }
+  return signaled;
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
-   LOCK must be held before calling this function.
+   this function signals the one with the highest priority, as
+   it is now rather than when it began to wait, to wake up from
+   its wait.  LOCK must be held before calling this function.
+
+   The signaled thread could not get far anyway, since it must
+   reacquire LOCK, which we hold.  So instead of waking it, it is
+   moved straight onto LOCK's waiters ("wait morphing") and runs
+   only once LOCK is released.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to signal a condition variable within an
    interrupt handler. */
 void
-cond_signal (struct condition *cond, struct lock *lock UNUSED)
+cond_signal (struct condition *cond, struct lock *lock)
 {
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!list_empty (&cond->waiters))
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+  cond_wake (cond, lock);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -385,60 +972,534 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
 void
 cond_broadcast (struct condition *cond, struct lock *lock)
 {
+  enum intr_level old_level;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (lock_held_by_current_thread (lock));
 
-  while (!list_empty (&cond->waiters))
-    cond_signal (cond, lock);
+  /* The waiters move onto LOCK's waiters, as in cond_signal(), so
+     none of them runs until LOCK is released, and then in priority
+     order. */
+  old_level = intr_disable ();
+  while (!heap_empty (&cond->waiters))
+    cond_wake (cond, lock);
+  intr_set_level (old_level);
 }
-/* used in list_insert_ordered() calls implemented in list.c.
-Returns true when the lock containing e_1 has highest_priority > the
-highest_priority of the semaphore containing e_1, thus the list wil be in
-descending order. */
-bool lock_priority_compare(const struct list_elem *e_1, const struct list_elem *e_2,
-                            void *aux)
+
+/* Moves T, which must be waiting on a condition variable, to the
+   position in the condition's waiters for T's current priority.
+   Called after T's priority changes, for example by priority
+   donation, so that cond_signal() keeps waking the
+   highest-priority waiter.  Must be called with interrupts
+   off. */
+void
+cond_reorder_waiter (struct thread *t)
 {
-  ASSERT(e_1 != NULL);
-  ASSERT(e_2 != NULL);
+  struct semaphore_elem *waiter = t->cond_waiter;
 
-  int highest_priority_e1;
-  int highest_priority_e2;
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (waiter != NULL && waiter->thread == t);
 
-  struct lock *l_1 = list_entry(e_1, struct lock, lock_list_elem);
-  struct lock *l_2 = list_entry(e_2, struct lock, lock_list_elem);
+  heap_update (&waiter->cond->waiters, &waiter->elem);
+}
 
-  if(list_empty(&(l_1->semaphore.waiters)))
-  {
-    //printf("lock_priority_compare(): list l1 empty \n");
-    highest_priority_e1 = -1;
-  } else
-  {
-    highest_priority_e1 = list_entry(list_begin(&(l_1->semaphore.waiters)), struct thread, elem)->priority;
-  }
+/* Initializes WAITER for the running thread and adds it to
+   COND's waiters. */
+static void
+cond_enqueue (struct condition *cond, struct semaphore_elem *waiter)
+{
+  enum intr_level old_level;
 
-  if(list_empty(&(l_2->semaphore.waiters)))
-  {
-    //printf("lock_priority_compare(): list l2 empty \n");
-    highest_priority_e2 = -1;
-  } else
-  {
-    highest_priority_e2 = list_entry(list_begin(&(l_2->semaphore.waiters)), struct thread, elem)->priority;
-  }
-  return highest_priority_e1 >= highest_priority_e2;
+  sema_init (&waiter->semaphore, 0);
+  waiter->cond = cond;
+  waiter->thread = thread_current ();
+
+  /* Donations change priorities with interrupts off, not under
+     the condition's lock, so the waiters are kept with
+     interrupts off too. */
+  old_level = intr_disable ();
+  waiter->seq = cond->next_seq++;
+  waiter->thread->cond_waiter = waiter;
+  heap_insert (&cond->waiters, &waiter->elem);
+  intr_set_level (old_level);
+}
+
+/* Removes the highest-priority waiter, if any, from COND and
+   signals it.  A waiter that has already blocked is moved onto the
+   waiters of LOCK, which the running thread holds, as if it had
+   called lock_acquire(): it donates its priority to us and is
+   woken by lock_release().  Its own semaphore is upped without
+   waking it, so that it then leaves cond_wait()'s sema_down() and
+   goes on to take LOCK.  A waiter that has not blocked yet, which
+   happens if it was preempted on its way there, is simply upped. */
+static void
+cond_wake (struct condition *cond, struct lock *lock)
+{
+  struct semaphore_elem *waiter;
+  struct thread *t;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (!heap_empty (&cond->waiters))
+    {
+      waiter = heap_entry (heap_pop_min (&cond->waiters),
+                           struct semaphore_elem, elem);
+      t = waiter->thread;
+      t->cond_waiter = NULL;
+      if (t->status == THREAD_BLOCKED)
+        {
+          ASSERT (waiter->semaphore.value == 0);
+          list_remove (&t->elem);
+          waiter->semaphore.value++;
+          list_insert_ordered (&lock->semaphore.waiters, &t->elem,
+                               priority_compare, NULL);
+          lock->state = LOCK_CONTENDED;
+          lock_list (lock);
+          if (!thread_mlfqs)
+            {
+              t->waiting_for_lock = lock;
+              donate_priority (t);
+            }
+        }
+      else
+        sema_up (&waiter->semaphore);
+    }
+  intr_set_level (old_level);
+}
+
+/* Orders condition waiters by descending live priority, and in
+   order of arrival among equal priorities. */
+static bool
+waiter_less (const struct heap_elem *a_, const struct heap_elem *b_,
+             void *aux UNUSED)
+{
+  const struct semaphore_elem *a
+    = heap_entry (a_, struct semaphore_elem, elem);
+  const struct semaphore_elem *b
+    = heap_entry (b_, struct semaphore_elem, elem);
+
+  if (a->thread->priority != b->thread->priority)
+    return a->thread->priority > b->thread->priority;
+  return (int) (a->seq - b->seq) < 0;
+}
+
+/* Initializes readers-writer lock RW.  Readers share RW with
+   each other but not with a writer.  Writers are preferred: once
+   a writer is waiting, new readers wait behind it, so a steady
+   stream of readers cannot starve writers. */
+void
+rw_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  rw->readers = 0;
+  rw->writer_waiting = false;
+  sema_init (&rw->no_readers, 0);
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   is waiting for it.  Passing through RW's lock makes a waiting
+   reader donate its priority to the writer ahead of it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rw_read_acquire (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rw->lock);
+  old_level = intr_disable ();
+  rw->readers++;
+  intr_set_level (old_level);
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread must hold for reading,
+   letting a waiting writer in if this was the last reader. */
+void
+rw_read_release (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0 && rw->writer_waiting)
+    {
+      rw->writer_waiting = false;
+      sema_up (&rw->no_readers);
+    }
+  intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until no other writer holds
+   it and all current readers have released it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rw_write_acquire (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+
+  /* Holding the lock keeps new readers out while we wait for the
+     current ones. */
+  lock_acquire (&rw->lock);
+  old_level = intr_disable ();
+  while (rw->readers > 0)
+    {
+      rw->writer_waiting = true;
+      sema_down (&rw->no_readers);
+    }
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for writing. */
+void
+rw_write_release (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rw->readers == 0);
+
+  lock_release (&rw->lock);
+}
+
+/* Initializes LOCK as a priority ceiling lock whose holder runs
+   at priority CEILING.  No thread that acquires LOCK may have a
+   higher base priority. */
+void
+pcp_lock_init (struct pcp_lock *lock, int ceiling)
+{
+  ASSERT (lock != NULL);
+  ASSERT (ceiling >= PRI_MIN && ceiling <= PRI_MAX);
+
+  lock->holder = NULL;
+  lock->ceiling = ceiling;
+  lock->saved_ceiling = PRI_MIN;
+  sema_init (&lock->semaphore, 1);
+}
+
+/* Acquires LOCK, sleeping until it becomes available if
+   necessary, and raises the running thread to LOCK's ceiling.
+   The thread is raised before it waits, so that it is not
+   preempted by other users of LOCK between being woken and
+   taking it.  Under the MLFQS, which recomputes every priority,
+   LOCK is a plain mutex.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+pcp_lock_acquire (struct pcp_lock *lock)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  int saved;
+
+  ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (lock->holder != cur);
+  ASSERT (thread_mlfqs || cur->base_priority <= lock->ceiling);
+
+  old_level = intr_disable ();
+  saved = cur->pcp_ceiling;
+  if (!thread_mlfqs && lock->ceiling > saved)
+    {
+      cur->pcp_ceiling = lock->ceiling;
+      if (lock->ceiling > cur->priority)
+        thread_set_thread_priority (cur, lock->ceiling);
+    }
+  sema_down (&lock->semaphore);
+  lock->holder = cur;
+  lock->saved_ceiling = saved;
+  intr_set_level (old_level);
+}
+
+/* Releases LOCK, which must be held by the current thread, and
+   drops the running thread back to the priority it had before.
+   The thread lowers itself before waking a waiter, so that a
+   waiter with a higher base priority runs at once. */
+void
+pcp_lock_release (struct pcp_lock *lock)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (lock != NULL);
+  ASSERT (lock->holder == cur);
+
+  old_level = intr_disable ();
+  lock->holder = NULL;
+  if (!thread_mlfqs)
+    {
+      cur->pcp_ceiling = lock->saved_ceiling;
+      thread_set_thread_priority (cur, thread_donated_priority (cur));
+    }
+  sema_up (&lock->semaphore);
+  intr_set_level (old_level);
+}
+
+/* Returns true if the current thread holds LOCK. */
+bool
+pcp_lock_held_by_current_thread (const struct pcp_lock *lock)
+{
+  ASSERT (lock != NULL);
+
+  return lock->holder == thread_current ();
+}
+
+/* Initializes barrier B for rounds of COUNT threads, which must
+   be at least 1. */
+void
+barrier_init (struct barrier *b, unsigned count)
+{
+  ASSERT (b != NULL);
+  ASSERT (count > 0);
+
+  b->count = count;
+  b->arrived = 0;
+  b->generation = 0;
+  list_init (&b->waiters);
+}
+
+/* Waits until B's count of threads, including the running one,
+   have called barrier_wait(), then returns true in the thread
+   that arrived last and false in all the others.  The barrier
+   can be waited on again at once: a thread that comes back
+   before the others have left waits for the next round, which
+   is told apart by its generation.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+barrier_wait (struct barrier *b)
+{
+  enum intr_level old_level;
+  unsigned generation;
+  bool last = false;
+
+  ASSERT (b != NULL);
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  generation = b->generation;
+  if (++b->arrived == b->count)
+    {
+      b->arrived = 0;
+      b->generation++;
+      last = true;
+      thread_unblock_batch (&b->waiters);
+    }
+  else
+    while (b->generation == generation)
+      {
+        list_push_back (&b->waiters, &thread_current ()->elem);
+        thread_block ();
+      }
+  intr_set_level (old_level);
+
+  return last;
+}
+
+/* Value of struct completion's `done' after complete_all(). */
+#define COMPLETION_ALL UINT_MAX
+
+/* Initializes completion C as not yet completed. */
+void
+completion_init (struct completion *c)
+{
+  ASSERT (c != NULL);
+
+  c->done = 0;
+  list_init (&c->waiters);
+}
+
+/* Signals completion C, letting one wait_for_completion() call
+   through: the highest-priority waiter, if any, or else the next
+   thread to wait.
+
+   This function may be called from an interrupt handler. */
+void
+complete (struct completion *c)
+{
+  enum intr_level old_level;
+  struct thread *t = NULL;
+
+  ASSERT (c != NULL);
+
+  old_level = intr_disable ();
+  if (c->done != COMPLETION_ALL)
+    c->done++;
+  if (!list_empty (&c->waiters))
+    {
+      t = list_entry (list_pop_front (&c->waiters), struct thread, elem);
+      thread_unblock (t);
+    }
+  if (t != NULL && t->priority > thread_current ()->priority)
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
+  intr_set_level (old_level);
+}
+
+/* Signals completion C for good: every thread waiting for C, and
+   every one that waits for it from now on, goes through.
+
+   This function may be called from an interrupt handler. */
+void
+complete_all (struct completion *c)
+{
+  enum intr_level old_level;
+
+  ASSERT (c != NULL);
+
+  old_level = intr_disable ();
+  c->done = COMPLETION_ALL;
+  thread_unblock_batch (&c->waiters);
+  intr_set_level (old_level);
+}
+
+/* Waits for completion C to be signaled, consuming one
+   complete() call, unless complete_all() was called.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+wait_for_completion (struct completion *c)
+{
+  enum intr_level old_level;
+
+  ASSERT (c != NULL);
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  while (c->done == 0)
+    {
+      list_insert_ordered (&c->waiters, &thread_current ()->elem,
+                           priority_compare, NULL);
+      thread_block ();
+    }
+  if (c->done != COMPLETION_ALL)
+    c->done--;
+  intr_set_level (old_level);
+}
+
+/* Initializes wait queue Q as empty. */
+void
+wait_queue_init (struct wait_queue *q)
+{
+  ASSERT (q != NULL);
+
+  list_init (&q->entries);
+}
+
+/* Adds entry E to Q, so that wait_queue_wake() on Q ups SEMA,
+   until wait_queue_remove(). */
+void
+wait_queue_add (struct wait_queue *q, struct wait_entry *e,
+                struct semaphore *sema)
+{
+  enum intr_level old_level;
+
+  ASSERT (q != NULL && e != NULL && sema != NULL);
+
+  e->sema = sema;
+  old_level = intr_disable ();
+  list_push_back (&q->entries, &e->elem);
+  intr_set_level (old_level);
+}
+
+/* Removes entry E from the wait queue that it was added to. */
+void
+wait_queue_remove (struct wait_entry *e)
+{
+  enum intr_level old_level;
+
+  ASSERT (e != NULL);
+
+  old_level = intr_disable ();
+  list_remove (&e->elem);
+  intr_set_level (old_level);
 }
 
-/* used in list_insert_ordered() calls implemented in list.c.
-Returns true when the semaphore containing e_1 has highest_priority > the
-highest_priority of the semaphore containing e_1, thus the list wil be in
-descending order. */
-bool priority_semaphore_compare(const struct list_elem *e_1, const struct list_elem *e_2,
-                                void *aux)
+/* Ups the semaphore of every entry in Q.  Threads woken do not
+   run until the walk over Q is done, since each removes its own
+   entries once it runs.
+
+   This function may be called from an interrupt handler. */
+void
+wait_queue_wake (struct wait_queue *q)
 {
-  ASSERT(e_1 != NULL);
-  ASSERT(e_2 != NULL);
+  enum intr_level old_level;
+  struct list_elem *e;
+  int max_priority = PRI_MIN - 1;
 
-  struct semaphore_elem *s_1 = list_entry(e_1, struct semaphore_elem, elem);
-  struct semaphore_elem *s_2 = list_entry(e_2, struct semaphore_elem, elem);
+  ASSERT (q != NULL);
 
-  return s_1->highest_priority > s_2->highest_priority;
+  old_level = intr_disable ();
+  for (e = list_begin (&q->entries); e != list_end (&q->entries);
+       e = list_next (e))
+    {
+      struct semaphore *sema = list_entry (e, struct wait_entry, elem)->sema;
+
+      sema->value++;
+      if (!list_empty (&sema->waiters))
+        {
+          struct thread *t = list_entry (list_pop_front (&sema->waiters),
+                                         struct thread, elem);
+          thread_unblock (t);
+          if (t->priority > max_priority)
+            max_priority = t->priority;
+        }
+    }
+  if (max_priority > thread_current ()->priority)
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
+  intr_set_level (old_level);
+}
+
+/* Initializes sequence counter S. */
+void
+seqcount_init (struct seqcount *s)
+{
+  ASSERT (s != NULL);
+  s->seq = 0;
+}
+
+/* Begins a write of the data guarded by S.  Interrupts must be off
+   until seq_write_end(), so that no reader can run in the middle
+   of the write and spin on it. */
+void
+seq_write_begin (struct seqcount *s)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT ((s->seq & 1) == 0);
+  s->seq++;
+  barrier ();
+}
+
+/* Ends a write of the data guarded by S. */
+void
+seq_write_end (struct seqcount *s)
+{
+  ASSERT ((s->seq & 1) != 0);
+  barrier ();
+  s->seq++;
 }
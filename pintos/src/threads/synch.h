@@ -1,53 +1,193 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-/* A counting semaphore. */
+struct thread;
+
+/* A counting semaphore.
+
+   WAITERS is one list in descending priority order, not a queue
+   per priority as in the run queue.  Semaphores are embedded in
+   every lock and condition waiter, many of them on 4 kB thread
+   stacks, and a queue per priority would cost each of them 64
+   list heads.  A semaphore seldom has more than a few waiters, so
+   the O(waiters) insertion is short, and sema_up() and
+   thread_donated_priority() still find the highest-priority
+   waiter at the front in O(1). */
 struct semaphore
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct list waiters;        /* Waiting threads, by priority. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
 void sema_down (struct semaphore *);
+bool sema_down_timeout (struct semaphore *, int64_t timeout);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
+void sema_up_handoff (struct semaphore *);
+void sema_reorder_waiter (struct semaphore *, struct thread *);
 void sema_self_test (void);
 
+#ifdef LOCK_STATS
+/* Contention statistics shared by all locks with the same name.
+   Locks come and go (many live on the stack), so statistics are
+   kept per name rather than per lock. */
+struct lock_stats
+  {
+    const char *name;           /* Name given to lock_init_named(). */
+    unsigned long long acquisitions; /* Successful acquisitions. */
+    unsigned long long contended; /* Acquisitions that had to wait. */
+    int64_t wait_ticks;         /* Total ticks spent waiting. */
+    int64_t max_wait_ticks;     /* Longest single wait. */
+    int64_t hold_ticks;         /* Total ticks the lock was held. */
+  };
+#endif
+
 /* Lock. */
 struct lock
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
-    struct semaphore semaphore; /* Binary semaphore controlling access. */
+    unsigned state;             /* LOCK_FREE, LOCK_HELD or
+                                   LOCK_CONTENDED; see synch.c. */
+    struct semaphore semaphore; /* Its waiters are the threads waiting
+                                   for the lock.  Its value is unused. */
     struct list_elem lock_list_elem; /* list elements, used in thread
-                                        locks list */
+                                        locks list, once the lock has
+                                        waiters */
+#ifdef LOCK_STATS
+    struct lock_stats *stats;   /* Statistics, or a null pointer. */
+    int64_t acquired_at;        /* Tick at which holder acquired it. */
+#endif
   };
 
 void lock_init (struct lock *);
+void lock_init_named (struct lock *, const char *name);
 void lock_acquire (struct lock *);
+bool lock_acquire_timeout (struct lock *, int64_t timeout);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
-bool priority_semaphore_compare(const struct list_elem *e_1,
-                                const struct list_elem *e_2,
-                                void *aux);
-bool lock_priority_compare(const struct list_elem *e_1,
-                           const struct list_elem *e_2,
-                           void *aux);                    
+#ifdef LOCK_STATS
+void lock_print_stats (void);
+
+/* With LOCK_STATS, every lock is named after the expression
+   passed to lock_init(), e.g. "&tid_lock". */
+#define lock_init(LOCK) lock_init_named (LOCK, #LOCK)
+#endif
 
 /* Condition variable. */
 struct condition
   {
-    struct list waiters;        /* List of waiting threads. */
+    struct heap waiters;        /* Waiting threads, highest priority
+                                   first. */
+    unsigned next_seq;          /* Arrival number of the next waiter. */
   };
 
 void cond_init (struct condition *);
 void cond_wait (struct condition *, struct lock *);
+bool cond_wait_timeout (struct condition *, struct lock *, int64_t timeout);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
+void cond_reorder_waiter (struct thread *);
+
+/* Readers-writer lock.  Any number of readers, or a single
+   writer, may hold it at once.  A writer holds LOCK for as long as
+   it holds the rwlock, so arriving readers and writers queue on
+   LOCK behind it in priority order and donate their priority to
+   it. */
+struct rwlock
+  {
+    struct lock lock;           /* Held by the writer, if any. */
+    unsigned readers;           /* Number of readers holding the rwlock. */
+    bool writer_waiting;        /* Writer waiting for readers to leave? */
+    struct semaphore no_readers; /* Upped when the last reader leaves. */
+  };
+
+void rw_init (struct rwlock *);
+void rw_read_acquire (struct rwlock *);
+void rw_read_release (struct rwlock *);
+void rw_write_acquire (struct rwlock *);
+void rw_write_release (struct rwlock *);
+
+/* Priority ceiling lock, for a lock whose users are all known and
+   none has a priority above CEILING.  Its holder runs at CEILING
+   from the moment it starts acquiring the lock until it releases
+   it, so within the set of users no one can preempt the holder
+   while it runs, and there is no donation to pass along: taking
+   and releasing it costs the same whether or not anyone waits.
+   Ceiling locks held by one thread must be released in the
+   reverse order of acquisition. */
+struct pcp_lock
+  {
+    struct thread *holder;      /* Thread holding the lock. */
+    int ceiling;                /* Priority of the holder. */
+    int saved_ceiling;          /* Holder's ceiling before acquiring. */
+    struct semaphore semaphore; /* Waiting threads, for a holder that
+                                   sleeps. */
+  };
+
+void pcp_lock_init (struct pcp_lock *, int ceiling);
+void pcp_lock_acquire (struct pcp_lock *);
+void pcp_lock_release (struct pcp_lock *);
+bool pcp_lock_held_by_current_thread (const struct pcp_lock *);
+
+/* Barrier.  Each of COUNT threads that call barrier_wait() waits
+   until all COUNT have arrived, then all go on together.  The
+   barrier is then ready for the next round. */
+struct barrier
+  {
+    unsigned count;             /* Threads per round. */
+    unsigned arrived;           /* Threads arrived in this round. */
+    unsigned generation;        /* Number of rounds completed. */
+    struct list waiters;        /* Threads waiting for this round. */
+  };
+
+void barrier_init (struct barrier *, unsigned count);
+bool barrier_wait (struct barrier *);
+
+/* Completion.  A thread waits in wait_for_completion() for an
+   event that another thread, or an interrupt handler, signals
+   with complete() or, once and for all, complete_all(). */
+struct completion
+  {
+    unsigned done;              /* complete() calls not yet waited
+                                   for, or COMPLETION_ALL. */
+    struct list waiters;        /* List of waiting threads. */
+  };
+
+void completion_init (struct completion *);
+void complete (struct completion *);
+void complete_all (struct completion *);
+void wait_for_completion (struct completion *);
+
+/* Wait queue.  An object whose state threads may want to watch
+   keeps a wait queue and calls wait_queue_wake() whenever its state
+   changes.  A thread watching several objects at once adds an
+   entry to each one's queue, all naming one semaphore, and sleeps
+   on the semaphore, with a timeout if it likes, until one of them
+   changes. */
+struct wait_queue
+  {
+    struct list entries;        /* Entries of watching threads. */
+  };
+
+/* A thread's entry in a wait queue. */
+struct wait_entry
+  {
+    struct list_elem elem;      /* Element in queue's `entries'. */
+    struct semaphore *sema;     /* Upped by wait_queue_wake(). */
+  };
+
+void wait_queue_init (struct wait_queue *);
+void wait_queue_add (struct wait_queue *, struct wait_entry *,
+                     struct semaphore *);
+void wait_queue_remove (struct wait_entry *);
+void wait_queue_wake (struct wait_queue *);
 
 /* Optimization barrier.
 
@@ -56,4 +196,50 @@ void cond_broadcast (struct condition *, struct lock *);
    reference guide for more information.*/
 #define barrier() asm volatile ("" : : : "memory")
 
+/* Sequence counter, guarding data that is written rarely, always
+   with interrupts off, and read often, from anywhere, without
+   turning interrupts off.  A writer makes the count odd while it
+   writes; a reader copies the data out between seq_read_begin()
+   and seq_read_retry() and starts over if the count was odd or
+   changed meanwhile, as when an interrupt handler wrote the data
+   in the middle:
+
+        do
+          {
+            seq = seq_read_begin (&s);
+            copy = data;
+          }
+        while (seq_read_retry (&s, seq));
+
+   Since writers run with interrupts off, a reader never finds the
+   count odd on one CPU, and retries only after being interrupted
+   by a writer. */
+struct seqcount
+  {
+    volatile unsigned seq;      /* Odd while being written. */
+  };
+
+void seqcount_init (struct seqcount *);
+void seq_write_begin (struct seqcount *);
+void seq_write_end (struct seqcount *);
+
+/* Begins a read of the data guarded by S and returns the count to
+   pass to seq_read_retry(). */
+static inline unsigned
+seq_read_begin (const struct seqcount *s)
+{
+  unsigned seq = s->seq;
+  barrier ();
+  return seq;
+}
+
+/* Returns true if the data read since seq_read_begin() returned
+   SEQ may be inconsistent, so the read must be done again. */
+static inline bool
+seq_read_retry (const struct seqcount *s, unsigned seq)
+{
+  barrier ();
+  return (seq & 1) != 0 || s->seq != seq;
+}
+
 #endif /* threads/synch.h */
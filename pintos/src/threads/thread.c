@@ -1,17 +1,25 @@
 #include "threads/thread.h"
+#include <console.h>
 #include <debug.h>
+#include <kstat.h>
 #include <stddef.h>
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
+#include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/smp.h"
+#include "threads/spinlock.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
 #include "threads/fixed-point.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -21,31 +29,162 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Each CPU has a run queue of its own, holding the processes in
+   THREAD_READY state, that is, processes that are ready to run but
+   not actually running, that the CPU will run next.  A CPU takes
+   threads from its own run queue, and only when that is empty
+   looks for one to steal from the busiest other CPU's (see
+   ready_queue_steal()).  Run queues, like everything else the
+   scheduler keeps, are protected by the kernel lock that goes
+   with disabling interrupts (see smp.c). */
+#if PRI_MAX - PRI_MIN + 1 > 64
+#error ready_bitmap requires at most 64 priority levels
+#endif
+struct run_queue
+  {
+    /* One FIFO list per priority.  Bit P of ready_bitmap is set
+       exactly when ready_queues[P] is non-empty, so the
+       highest-priority ready thread is found with a single bit
+       scan. */
+    struct list ready_queues[PRI_MAX - PRI_MIN + 1];
+    uint64_t ready_bitmap;
+    int ready_threads;          /* # of threads in the run queue. */
+
+    /* Deadline threads, those created by thread_create_deadline(),
+       in order of deadline.  The earliest deadline runs before any
+       other thread.  Deadline threads count as priority PRI_MAX for
+       donation and preemption checks, so bit PRI_MAX of
+       ready_bitmap is also set while dl_ready is non-empty. */
+    struct clist dl_ready;
+
+    /* Run queue of the fair-share scheduler, used instead of
+       ready_queues for every thread but deadline threads when
+       thread_cfs is true.  Threads are ordered by vruntime, the
+       ticks they have run, each scaled by NICE_0_WEIGHT over the
+       thread's weight, so the thread that has had the least of its
+       share runs next.  cfs_count[P] is the number of threads in
+       cfs_ready with priority P, which keeps ready_bitmap exact for
+       donation and preemption checks. */
+    struct rb_tree cfs_ready;
+    int cfs_count[PRI_MAX - PRI_MIN + 1];
+
+    /* Monotonic floor of the vruntime of the CPU's ready and
+       running threads.  New threads start at it and waking threads
+       no further than CFS_SLEEP_CREDIT behind it, so a thread
+       cannot bank CPU time by sleeping.  A thread that moves to
+       another CPU keeps its distance from the floor. */
+    int64_t cfs_min_vruntime;
+
+    struct thread *idle_thread; /* The CPU's idle thread. */
+    struct thread *curr;        /* Thread the CPU is running. */
+    unsigned thread_ticks;      /* # of timer ticks since last yield. */
+    bool preempting;            /* In thread_preempt()? */
+    bool kicked;                /* Sent a reschedule interrupt? */
+  };
+static struct run_queue run_queues[THREAD_CPU_CNT];
+
+/* Admission control.  dl_util is the sum of runtime / period over
+   all deadline threads, in units of 1 / DL_UTIL_SCALE; admitting a
+   new deadline thread may not take it over DL_UTIL_MAX, which
+   leaves some time for the rest of the system. */
+#define DL_UTIL_SCALE 1000
+#define DL_UTIL_MAX 950
+static int dl_util;
+
+/* Ready deadline threads that have used up their budget, held out
+   of dl_ready until their deadline refills it.  Linked through
+   `elem', with `parked' set, like the threads of a throttled
+   group. */
+static struct list dl_throttled_threads;
+
+/* Weight of a thread with nice value N is cfs_weights[N -
+   NICE_MIN].  Each step of nice is worth about 10% of the CPU
+   against a thread one step away. */
+#define NICE_0_WEIGHT 1024
+static const int cfs_weights[NICE_MAX - NICE_MIN + 1] =
+  {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */  9548,  7620,  6100,  4904,  3906,
+    /*  -5 */  3121,  2501,  1991,  1586,  1277,
+    /*   0 */  1024,   820,   655,   526,   423,
+    /*   5 */   335,   272,   215,   172,   137,
+    /*  10 */   110,    87,    70,    56,    45,
+    /*  15 */    36,    29,    23,    18,    15,
+    /*  20 */    12,
+  };
+
+/* vruntime a nice-0 thread accrues per tick. */
+#define CFS_TICK 1024
+
+/* A running thread is preempted once it is this far ahead of the
+   ready thread with the least vruntime. */
+#define CFS_WAKEUP_GRAN CFS_TICK
+
+/* How far behind cfs_min_vruntime a waking thread may be placed,
+   which favors interactive threads somewhat. */
+#define CFS_SLEEP_CREDIT (TIME_SLICE * CFS_TICK)
+
+/* Thread groups that have used up their quota, waiting for the
+   end of their period. */
+static struct list throttled_groups;
 
 // List of processes in the THREAD_BLOCKED state
 //static struct list blocked_list;
 
 /* List of all processes.  Processes are added to this list
-   when they are first scheduled and removed when they exit. */
+   when they are first scheduled and removed when they exit.
+
+   The list changes only with interrupts off, but may be walked
+   with interrupts on, inside rcu_read_lock(), in the manner of
+   read-copy update.  A reader cannot be preempted, so no thread can
+   change the list under it, and no reader's section spans a
+   context switch, so each switch is a quiescent state.  A thread
+   that exits leaves the list before switching away for the last
+   time, and its pages are not freed or reused until that switch,
+   when no reader can still be looking at it: its grace period
+   ends there.  With more than one CPU, readers keep interrupts
+   off, and so hold the kernel lock, for the same effect. */
 static struct list all_list;
 
-//lists all processes that are sleeping, order is highest sleep_till at head
-static struct list sleep_list;
-
-//lists all processes that are to be woken up (used only for )
-static struct list awake_list;
-
-/* Idle thread. */
-static struct thread *idle_thread;
+/* List of processes that are not THREAD_BLOCKED, kept only for the
+   multi-level feedback queue scheduler.  Its periodic passes walk
+   this list, so a blocked thread costs nothing until it is woken,
+   when update_thread_recent_cpu() applies the decay it missed. */
+static struct list runnable_list;
+
+/* Hashed timer wheel of sleeping processes.  A process sleeping
+   until tick T is kept in slot T % SLEEP_WHEEL_SIZE, so arming a
+   sleep is O(1) and each tick only examines the processes that
+   hash to that tick's slot.  Processes more than one revolution
+   away stay in their slot until their sleep_till passes. */
+#define SLEEP_WHEEL_SIZE 256            /* Number of slots, a power of 2. */
+static struct list sleep_wheel[SLEEP_WHEEL_SIZE];
+static int64_t sleep_wheel_tick;        /* Last tick whose slot expired. */
+static int sleeping_threads;            /* # of threads in sleep_wheel. */
 
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
-/* Lock used by allocate_tid(). */
-static struct lock tid_lock;
+/* Pages of recently destroyed threads, kept for reuse by
+   thread_create() so that threads that come and go quickly do not
+   go through the page allocator.  init_thread() clears the struct
+   thread itself; the rest of a page is stack and is never read
+   before it is written, so it need not be zeroed. */
+#define THREAD_CACHE_SIZE 8
+static struct thread *thread_cache[THREAD_CACHE_SIZE];
+static size_t thread_cache_cnt;
+static struct spinlock thread_cache_lock
+  = SPINLOCK_INITIALIZER ("thread_cache");
+
+/* Dead threads that the reaper thread has yet to release, because
+   the thread cache is full or they have user process resources
+   still to tear down, neither of which should be done during a
+   context switch.  Linked through `elem'.  Protected by
+   thread_cache_lock, as is reaper_sleeping. */
+static struct list dead_list = LIST_INITIALIZER (dead_list);
+static struct thread *reaper_thread;
+static bool reaper_sleeping;    /* Reaper blocked, waiting for work? */
 
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame
@@ -59,39 +198,123 @@ struct kernel_thread_frame
 static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
+static struct schedstat sched_latency; /* Wakeup-to-run latency. */
 
 /* Scheduling. */
-#define TIME_SLICE 4            /* # of timer ticks to give each thread. */
-static unsigned thread_ticks;   /* # of timer ticks since last yield. */
+#define TIME_SLICE_MS 40        /* Default time slice, in ms. */
+#define TIME_SLICE DIV_ROUND_UP (TIMER_FREQ * TIME_SLICE_MS, 1000)
+                                /* Default # of timer ticks per thread. */
+
+/* Time slice for each priority band, in timer ticks: threads
+   below PRI_DEFAULT, at PRI_DEFAULT, and above it.  Set by
+   thread_set_slices(), from kernel command-line option
+   "-slice", or else TIME_SLICE by thread_init().  A thread's own
+   quantum, from thread_set_quantum(), overrides its band's. */
+enum slice_band { SLICE_LOW, SLICE_DEFAULT, SLICE_HIGH, SLICE_BAND_CNT };
+static unsigned band_slices[SLICE_BAND_CNT];
 static int load_avg;            /* System load average used for mlfqs */
+/* Decay coefficient of recent_cpu, (2*load_avg)/(2*load_avg + 1), which
+   depends only on load_avg, so it is recomputed only when load_avg
+   changes rather than for every thread.  It is 0 while load_avg is 0. */
+static int recent_cpu_coeff;
+
+/* Number of load_avg updates so far, and the recent_cpu decay
+   coefficient of each of the last COEFF_HISTORY of them, indexed
+   by update number modulo COEFF_HISTORY. */
+#define COEFF_HISTORY 64
+static int64_t load_epoch;
+static int coeff_history[COEFF_HISTORY];
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
+#if !defined SCHED_PRIORITY && !defined SCHED_MLFQS
 bool thread_mlfqs;
+#endif
+
+/* If true, recompute MLFQS priorities incrementally.
+   Controlled by kernel command-line option "-o mlfqs-incremental". */
+#ifndef SCHED_PRIORITY
+bool thread_mlfqs_incremental;
+#endif
+
+/* If true, use the fair-share scheduler.
+   Controlled by kernel command-line option "-cfs". */
+bool thread_cfs;
+
+/* Idle polling period, in microseconds.
+   Controlled by kernel command-line option "-idle". */
+unsigned thread_idle_poll_us;
 
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
+static void reaper (void *aux UNUSED);
+static bool idle_poll (void);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
+static struct thread *alloc_thread (void);
+static struct thread *alloc_thread_pages (void);
+static void free_thread (struct thread *);
+static void release_thread (struct thread *);
+static void free_thread_pages (struct thread *);
+#if THREAD_STACK_GUARD
+static void set_guard_page (uint8_t *page, bool guard);
+#endif
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
+static void schedule_to (struct thread *);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static struct run_queue *this_rq (void);
+static bool is_idle (const struct thread *);
+static struct run_queue *select_rq (const struct thread *);
+static bool can_steal (const struct thread *, int cpu);
+static void kick_idle_cpu (struct run_queue *, const struct thread *);
+static void rq_push (struct run_queue *, struct thread *);
+static void ready_queue_push (struct thread *);
+static bool preempts (const struct thread *t, const struct thread *cur);
+static void ready_queue_remove (struct thread *);
+static struct thread *ready_queue_pop (struct run_queue *);
+static struct thread *rq_first_allowed (struct run_queue *, int cpu);
+static struct thread *ready_queue_steal (struct run_queue *);
+static int ready_queue_max_priority (struct run_queue *);
+static void ready_queue_update_bit (struct run_queue *, int priority);
+static void idle_loop (void) NO_RETURN;
+static tid_t create_thread (const char *name, int priority,
+                            int64_t runtime, int64_t period,
+                            thread_func *, void *aux);
+static int dl_utilization (int64_t runtime, int64_t period);
+static void dl_wake (struct thread *);
+static void dl_replenish (struct thread *, int64_t now);
+static void dl_unthrottle (int64_t now);
+static list_less_func deadline_less;
+static unsigned thread_slice (const struct thread *);
+static bool vruntime_less (const struct rb_elem *, const struct rb_elem *,
+                           void *aux);
+static bool cfs_queued (const struct thread *);
+static void cfs_charge (struct thread *);
+static void cfs_update_min (struct run_queue *);
+static void cfs_migrate (struct thread *, struct run_queue *);
 void thread_sleep (int64_t ticks, int64_t start_ticks);
-static bool sleep_less (const struct list_elem *a_, const struct list_elem *b_, void *aux UNUSED);
-static bool priority_less (const struct list_elem *a_, const struct list_elem *b_, void *aux UNUSED);
+static void sleep_wheel_insert (struct thread *);
+static void sleep_wheel_expire (struct list *slot, int64_t ticks,
+                                struct list *woken);
 void thread_check_wake(int64_t ticks);
+static void schedstat_record (struct thread *);
+static thread_action_func print_usage;
+static bool group_throttled (const struct thread *);
+static void group_charge (struct thread_group *, int64_t now);
+static void group_replenish (int64_t now);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
    general and it is possible in this case only because loader.S
    was careful to put the bottom of the stack at a page boundary.
 
-   Also initializes the run queue and the tid lock.
+   Also initializes the run queues and the tid lock.
 
    After calling this function, be sure to initialize the page
    allocator before trying to create any threads with
@@ -102,20 +325,40 @@ void thread_check_wake(int64_t ticks);
 void
 thread_init (void)
 {
+  int i, cpu;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
-  lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (cpu = 0; cpu < THREAD_CPU_CNT; cpu++)
+    {
+      struct run_queue *rq = &run_queues[cpu];
+
+      for (i = 0; i < PRI_MAX - PRI_MIN + 1; i++)
+        list_init (&rq->ready_queues[i]);
+      clist_init (&rq->dl_ready);
+      rb_init (&rq->cfs_ready, vruntime_less, NULL);
+    }
   list_init (&all_list);
+  list_init (&runnable_list);
+  list_init (&throttled_groups);
+  list_init (&dl_throttled_threads);
   //list_init (&blocked_list);
-  list_init (&sleep_list);
-  list_init (&awake_list);
+  for (i = 0; i < SLEEP_WHEEL_SIZE; i++)
+    list_init (&sleep_wheel[i]);
+  sleep_wheel_tick = 0;
+  sleeping_threads = 0;
+  for (i = 0; i < SLICE_BAND_CNT; i++)
+    if (band_slices[i] == 0)
+      band_slices[i] = TIME_SLICE;
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
+  run_queues[0].curr = initial_thread;
+  if (thread_mlfqs)
+    list_push_back (&runnable_list, &initial_thread->runnable_elem);
   /* PINTOS doc:
     At system boot, load_avg is initialized to 0.*/
   load_avg = 0;
@@ -134,8 +377,56 @@ thread_start (void)
   /* Start preemptive thread scheduling. */
   intr_enable ();
 
-  /* Wait for the idle thread to initialize idle_thread. */
+  /* Wait for the idle thread to initialize its run queue's
+     idle_thread. */
   sema_down (&idle_started);
+
+  /* Create the reaper thread. */
+  thread_create ("reaper", PRI_DEFAULT, reaper, NULL);
+}
+
+/* Sets up the idle thread of CPU, which smp_init() is about to
+   start, and returns the top of its stack, on which the CPU
+   enters smp_ap_main() and then thread_start_ap().  The idle
+   thread counts as the CPU's running thread from the start. */
+void *
+thread_prepare_cpu (int cpu)
+{
+  enum intr_level old_level;
+  struct thread *t;
+  char name[16];
+
+  ASSERT (cpu > 0 && cpu < THREAD_CPU_CNT);
+
+  t = alloc_thread ();
+  if (t == NULL)
+    PANIC ("out of memory starting CPU %d", cpu);
+  snprintf (name, sizeof name, "idle %d", cpu);
+  init_thread (t, name, PRI_MIN);
+  t->tid = allocate_tid ();
+  t->cpu = t->rq_cpu = cpu;
+  t->affinity = 1u << cpu;
+  t->status = THREAD_RUNNING;
+
+  old_level = intr_disable ();
+  if (thread_mlfqs)
+    list_push_back (&runnable_list, &t->runnable_elem);
+  run_queues[cpu].idle_thread = t;
+  run_queues[cpu].curr = t;
+  intr_set_level (old_level);
+
+  return (uint8_t *) t + THREAD_SIZE;
+}
+
+/* Runs the idle thread set up by thread_prepare_cpu() on the
+   running CPU, which smp_ap_main() has made ready to schedule
+   threads.  Interrupts and the kernel lock are taken by the
+   caller. */
+void
+thread_start_ap (void)
+{
+  intr_enable ();
+  idle_loop ();
 }
 
 /* Called by the timer interrupt handler at each timer tick.
@@ -144,19 +435,83 @@ void
 thread_tick (void)
 {
   struct thread *t = thread_current ();
+  struct run_queue *rq = this_rq ();
 
   /* Update statistics. */
-  if (t == idle_thread)
+  if (is_idle (t))
     idle_ticks++;
 #ifdef USERPROG
   else if (t->pagedir != NULL)
-    user_ticks++;
+    {
+      user_ticks++;
+      t->user_ticks++;
+    }
 #endif
   else
-    kernel_ticks++;
+    {
+      kernel_ticks++;
+      t->kernel_ticks++;
+    }
+
+  /* Charge a deadline thread for the tick.  As in a hard constant
+     bandwidth server, a thread that uses up its budget before its
+     deadline is throttled until the deadline, when it gets a new
+     deadline and a full budget, so that it cannot take more than
+     its share from other threads, deadline threads or not.  One
+     that has fallen behind its deadline gets a new one at once. */
+  if (!list_empty (&dl_throttled_threads))
+    dl_unthrottle (timer_ticks ());
+  if (t->dl_runtime != 0)
+    {
+      int64_t now = timer_ticks ();
+
+      if (--t->dl_budget <= 0 && t->dl_deadline > now)
+        {
+          t->dl_throttled = true;
+          intr_yield_on_return ();
+        }
+      else if (t->dl_budget <= 0 || t->dl_deadline <= now)
+        dl_replenish (t, now);
+    }
+
+  /* A ready deadline thread preempts any normal thread and any
+     deadline thread with a later deadline. */
+  if (!clist_empty (&rq->dl_ready)
+      && (t->dl_runtime == 0
+          || (list_entry (list_front (&rq->dl_ready.list), struct thread, elem)
+              ->dl_deadline < t->dl_deadline)))
+    intr_yield_on_return ();
+
+  /* Refill throttled groups whose period has ended, then charge
+     the running thread's group, which loses the CPU once it has
+     run for its quota. */
+  if (!list_empty (&throttled_groups) || t->group != NULL)
+    {
+      int64_t now = timer_ticks ();
+
+      group_replenish (now);
+      if (t->group != NULL && !is_idle (t))
+        group_charge (t->group, now);
+    }
+
+  /* Charge a fair-share thread for the tick, and preempt it once
+     another thread is owed the CPU. */
+  if (cfs_queued (t) && !is_idle (t))
+    {
+      cfs_charge (t);
+      if (!rb_empty (&rq->cfs_ready)
+          && t->vruntime - rb_entry (rb_min (&rq->cfs_ready), struct thread,
+                                     rb_elem)->vruntime > CFS_WAKEUP_GRAN)
+        intr_yield_on_return ();
+    }
+
+  /* An idle CPU looks for work to steal from the others once a
+     tick, in case it missed being kicked. */
+  if (is_idle (t) && smp_cpu_cnt > 1)
+    intr_yield_on_return ();
 
   /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  if (++rq->thread_ticks >= thread_slice (t))
     intr_yield_on_return ();
 }
 
@@ -164,8 +519,108 @@ thread_tick (void)
 void
 thread_print_stats (void)
 {
+  static const char *class_names[SCHEDSTAT_CLASS_CNT] =
+    { "low", "default", "high", "deadline" };
+  int c, b;
+
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  for (c = 0; c < SCHEDSTAT_CLASS_CNT; c++)
+    {
+      bool any = false;
+
+      for (b = 0; b < SCHEDSTAT_BUCKETS; b++)
+        if (sched_latency.latency[c][b] != 0)
+          {
+            if (!any)
+              printf ("Wakeup latency, %s, log2 ns:count:", class_names[c]);
+            printf (" %d:%u", b, (unsigned) sched_latency.latency[c][b]);
+            any = true;
+          }
+      if (any)
+        printf ("\n");
+    }
+  thread_print_usage ();
+}
+
+/* Prints the CPU time, context switches, and time blocked on
+   locks of every thread. */
+void
+thread_print_usage (void)
+{
+  /* printf() would block for the console lock or for room in
+     the serial queue, which a reader must not do; holding the
+     lock, with interrupts off, it does neither. */
+  enum intr_level old_level;
+
+  console_acquire ();
+  old_level = intr_disable ();
+  thread_foreach (print_usage, NULL);
+  intr_set_level (old_level);
+  console_release ();
+}
+
+/* Prints the CPU accounting of thread T. */
+static void
+print_usage (struct thread *t, void *aux UNUSED)
+{
+  printf ("Thread %d (%s): %lld user ticks, %lld kernel ticks, "
+          "%u voluntary and %u involuntary switches, "
+          "%llu us waiting for locks\n",
+          t->tid, t->name, t->user_ticks, t->kernel_ticks,
+          t->voluntary_switches, t->involuntary_switches,
+          clock_cycles_to_ns (t->lock_wait_cycles) / 1000);
+}
+
+/* Copies the scheduling latency histograms into *STAT. */
+void
+thread_get_schedstat (struct schedstat *stat)
+{
+  enum intr_level old_level = intr_disable ();
+  *stat = sched_latency;
+  intr_set_level (old_level);
+}
+
+/* Copies the tick counts and scheduling latency histograms into
+   *K. */
+void
+thread_get_kstat (struct kstat *k)
+{
+  enum intr_level old_level = intr_disable ();
+  k->idle_ticks = idle_ticks;
+  k->kernel_ticks = kernel_ticks;
+  k->user_ticks = user_ticks;
+  k->sched = sched_latency;
+  intr_set_level (old_level);
+}
+
+/* Records the latency of running thread T, which was woken at
+   T->wake_cycles, in the histogram for its class. */
+static void
+schedstat_record (struct thread *t)
+{
+  uint64_t ns = clock_cycles_to_ns (clock_cycles () - t->wake_cycles);
+  int c, b;
+
+  if (t->dl_runtime != 0)
+    c = SCHEDSTAT_DEADLINE;
+  else if (t->priority < PRI_DEFAULT)
+    c = SCHEDSTAT_LOW;
+  else if (t->priority == PRI_DEFAULT)
+    c = SCHEDSTAT_DEFAULT;
+  else
+    c = SCHEDSTAT_HIGH;
+
+  if (ns >> 32 != 0)
+    b = SCHEDSTAT_BUCKETS - 1;
+  else if (ns == 0)
+    b = 0;
+  else
+    b = 31 - __builtin_clz ((uint32_t) ns);
+  if (b >= SCHEDSTAT_BUCKETS)
+    b = SCHEDSTAT_BUCKETS - 1;
+  sched_latency.latency[c][b]++;
+  t->wake_cycles = 0;
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -186,6 +641,61 @@ thread_print_stats (void)
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux)
+{
+  return create_thread (name, priority, 0, 0, function, aux);
+}
+
+/* Creates a new kernel thread named NAME in the deadline
+   scheduling class, which executes FUNCTION passing AUX as the
+   argument, and adds it to the ready queue.  The thread is
+   guaranteed RUNTIME timer ticks of CPU time in every PERIOD
+   ticks, ahead of all threads that are not deadline threads and
+   regardless of their priorities and nice values, and is
+   scheduled earliest deadline first among deadline threads.  A
+   thread that runs for RUNTIME ticks in a period is held back
+   until the period ends, so it slows down only itself.
+
+   Returns the new thread's identifier, or TID_ERROR if RUNTIME
+   and PERIOD are not positive with RUNTIME no more than PERIOD,
+   if admitting the thread would commit too much of the CPU to
+   deadline threads, or if creation fails. */
+tid_t
+thread_create_deadline (const char *name, int64_t runtime, int64_t period,
+                        thread_func *function, void *aux)
+{
+  enum intr_level old_level;
+  bool admitted;
+  int util;
+  tid_t tid;
+
+  if (runtime <= 0 || period < runtime)
+    return TID_ERROR;
+  util = dl_utilization (runtime, period);
+
+  old_level = intr_disable ();
+  admitted = dl_util + util <= DL_UTIL_MAX;
+  if (admitted)
+    dl_util += util;
+  intr_set_level (old_level);
+  if (!admitted)
+    return TID_ERROR;
+
+  tid = create_thread (name, PRI_MAX, runtime, period, function, aux);
+  if (tid == TID_ERROR)
+    {
+      old_level = intr_disable ();
+      dl_util -= util;
+      intr_set_level (old_level);
+    }
+  return tid;
+}
+
+/* Creates a thread for thread_create() or, if PERIOD is nonzero,
+   thread_create_deadline(). */
+static tid_t
+create_thread (const char *name, int priority,
+               int64_t runtime, int64_t period,
+               thread_func *function, void *aux)
 {
   struct thread *t;
   struct kernel_thread_frame *kf;
@@ -197,13 +707,18 @@ thread_create (const char *name, int priority,
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = alloc_thread ();
   if (t == NULL)
     return TID_ERROR;
 
   /* Initialize thread. */
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
+  t->dl_runtime = runtime;
+  t->dl_period = period;
+  t->cpu = t->rq_cpu = smp_cpu ();
+  t->vruntime = this_rq ()->cfs_min_vruntime;
+  t->group = thread_current ()->group;
 
   /* Prepare thread for first run by initializing its stack.
      Do this atomically so intermediate values for the 'stack'
@@ -227,10 +742,8 @@ thread_create (const char *name, int priority,
 
   intr_set_level (old_level);
 
-  /* Add to run queue. */
-  thread_unblock (t);
-
-  /* if mlfqs, then calculate advanced thread priority, niceness, recent_cpu */
+  /* if mlfqs, then calculate advanced thread priority, niceness, recent_cpu.
+     T's priority must be final before it is placed in a run queue. */
   if(thread_mlfqs)
   {
      calculate_thread_recent_cpu(t, NULL);
@@ -239,8 +752,12 @@ thread_create (const char *name, int priority,
      calculate_thread_advanced_priority(thread_current(), NULL);
   }
 
+  /* Add to run queue. */
+  thread_unblock (t);
+
   /* check priority of new thread and schedule accordingly */
-  if (t->priority > thread_current()->priority)
+  if (t->priority > thread_current()->priority
+      || (t->dl_runtime != 0 && thread_current()->dl_runtime == 0))
   {
     thread_yield();
   }
@@ -261,6 +778,9 @@ thread_block (void)
   ASSERT (intr_get_level () == INTR_OFF);
 
   thread_current ()->status = THREAD_BLOCKED;
+  if (thread_mlfqs)
+    list_remove (&thread_current ()->runnable_elem);
+  TRACE (TRACE_BLOCK, thread_current (), NULL, 0);
   schedule ();
 }
 
@@ -271,18 +791,90 @@ thread_block (void)
    This function does not preempt the running thread.  This can
    be important: if the caller had disabled interrupts itself,
    it may expect that it can atomically unblock a thread and
-   update other data. */
+   update other data.  Called by an interrupt handler, though,
+   it arranges for the running thread to yield on return from
+   the interrupt if T should preempt it, so that a thread woken
+   by an interrupt does not wait for the end of a time slice. */
 void
 thread_unblock (struct thread *t)
 {
   enum intr_level old_level;
+  struct run_queue *rq;
 
   ASSERT (is_thread (t));
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_insert_ordered (&ready_list, &t->elem, priority_compare, NULL);
+  rq = select_rq (t);
+  cfs_migrate (t, rq);
+  if (t->dl_runtime != 0)
+    dl_wake (t);
+  else if (cfs_queued (t)
+           && t->vruntime < rq->cfs_min_vruntime - CFS_SLEEP_CREDIT)
+    t->vruntime = rq->cfs_min_vruntime - CFS_SLEEP_CREDIT;
+  if (t->timed_wait)
+    {
+      /* Woken before its deadline: disarm the timeout. */
+      list_remove (&t->sleep_elem);
+      sleeping_threads--;
+      t->timed_wait = false;
+    }
+  if (thread_mlfqs)
+    {
+      /* Catch up on the decay skipped while T was blocked; T's
+         priority must be current before it is queued. */
+      update_thread_recent_cpu (t, NULL);
+      calculate_thread_advanced_priority (t, NULL);
+      list_push_back (&runnable_list, &t->runnable_elem);
+    }
+  rq_push (rq, t);
   t->status = THREAD_READY;
+  t->wake_cycles = clock_cycles ();
+  TRACE (TRACE_UNBLOCK, running_thread (), t, t->priority);
+  if (intr_context () && !t->parked && rq == this_rq ()
+      && preempts (t, running_thread ()))
+    intr_yield_on_return ();
+  intr_set_level (old_level);
+}
+
+/* Returns true if ready thread T should run in place of running
+   thread CUR: if T has a higher priority, or if T is a deadline
+   thread and CUR is not one or has a later deadline.  Anything
+   preempts the idle thread. */
+static bool
+preempts (const struct thread *t, const struct thread *cur)
+{
+  if (is_idle (cur))
+    return true;
+  if (t->dl_runtime != 0)
+    return cur->dl_runtime == 0 || t->dl_deadline < cur->dl_deadline;
+  return cur->dl_runtime == 0 && t->priority > cur->priority;
+}
+
+/* Unblocks every thread on LIST, a list of blocked threads linked
+   through their `elem' members, leaving LIST empty.  Unlike
+   thread_unblock(), this also yields at once if any of them has
+   a higher priority than the running thread, once for the whole
+   batch.  In an interrupt handler, thread_unblock() already
+   arranges to yield on return from the interrupt. */
+void
+thread_unblock_batch (struct list *list)
+{
+  enum intr_level old_level;
+  int priority = PRI_MIN - 1;
+
+  old_level = intr_disable ();
+  while (!list_empty (list))
+    {
+      struct thread *t = list_entry (list_pop_front (list),
+                                     struct thread, elem);
+
+      thread_unblock (t);
+      if (t->priority > priority)
+        priority = t->priority;
+    }
+  if (priority > thread_current ()->priority && !intr_context ())
+    thread_yield ();
   intr_set_level (old_level);
 }
 void
@@ -300,9 +892,7 @@ thread_sleep (int64_t ticks, int64_t start_ticks)
 
   prev_intr_level = intr_disable(); //disable interrupts and record previous interrupt status
 
-  //insert current thread into the sleep_list list. use sleep_less to order the list
-  //highest sleep_till value is at the beggining of the list
-  list_insert_ordered(&sleep_list, &current->elem, sleep_less, NULL);
+  sleep_wheel_insert(current);
 
   //block the thread
   thread_block();
@@ -310,56 +900,149 @@ thread_sleep (int64_t ticks, int64_t start_ticks)
   intr_set_level(prev_intr_level);
 }
 
-//function for checking which elem has a lower sleep_till value. True if a is more than b
-//based on value_less()
-//orders highest wait time closest to head
-static bool
-sleep_less (const struct list_elem *a_, const struct list_elem *b_, void *aux UNUSED){
-    const struct thread *a = list_entry (a_, struct thread, elem);
-    const struct thread *b = list_entry (b_, struct thread, elem);
+/* Blocks the current thread, which the caller has just put on a
+   wait list through its `elem', until it is unblocked or until
+   timer tick DEADLINE, whichever comes first.  Returns true if
+   the thread was unblocked, or false if the deadline passed, in
+   which case the thread has been removed from the wait list.
+
+   This function must be called with interrupts turned off. */
+bool
+thread_block_until (int64_t deadline)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (!intr_context ());
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  cur->sleep_till = deadline;
+  cur->timed_wait = true;
+  cur->timed_out = false;
+  sleep_wheel_insert (cur);
+  thread_block ();
 
-    return a->sleep_till > b->sleep_till;//NOTE I switched the inequality
+  return !cur->timed_out;
 }
 
-//orders with highest priority closes to the head
-static bool
-priority_less (const struct list_elem *a_, const struct list_elem *b_, void *aux UNUSED){
-    const struct thread *a = list_entry (a_, struct thread, elem);
-    const struct thread *b = list_entry (b_, struct thread, elem);
+/* Files T in the sleep wheel slot for its sleep_till.  A thread
+   whose wake-up tick has already been expired is filed under the
+   next tick to expire, so it does not wait a full revolution. */
+static void
+sleep_wheel_insert (struct thread *t)
+{
+  int64_t slot = t->sleep_till;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (slot <= sleep_wheel_tick)
+    slot = sleep_wheel_tick + 1;
+  list_push_back (&sleep_wheel[slot & (SLEEP_WHEEL_SIZE - 1)],
+                  &t->sleep_elem);
+  sleeping_threads++;
+}
+
+/* Moves every thread in SLOT whose sleep_till is at or before
+   TICKS to WOKEN, through its `elem', for
+   thread_unblock_batch().  Threads due in a later revolution stay
+   in place.  A thread in a timed wait is taken off its wait list
+   first. */
+static void
+sleep_wheel_expire (struct list *slot, int64_t ticks, struct list *woken)
+{
+  struct list_elem *e = list_begin (slot);
 
-    return a->priority > b->priority;
+  while (e != list_end (slot))
+    {
+      struct thread *t = list_entry (e, struct thread, sleep_elem);
+
+      e = list_next (e);
+      if (t->sleep_till <= ticks)
+        {
+          list_remove (&t->sleep_elem);
+          sleeping_threads--;
+          if (t->timed_wait)
+            {
+              list_remove (&t->elem);
+              t->timed_wait = false;
+              t->timed_out = true;
+            }
+          list_push_back (woken, &t->elem);
+        }
+    }
 }
 
 //function for checking if a thread needs to be woken up, then waking it up if needed
 void
 thread_check_wake(int64_t ticks){
+  enum intr_level prev_intr_level;//save old interrupt level status
+  struct list woken;
+  int64_t tick;
+
+  list_init (&woken);
+  prev_intr_level = intr_disable();//disable interrupts and save old status
+
+  /* expire the slot of every tick since the last call.  If more than a full
+     revolution has passed, each slot only needs to be visited once. */
+  tick = sleep_wheel_tick + 1;
+  if (ticks - sleep_wheel_tick > SLEEP_WHEEL_SIZE)
+    tick = ticks - SLEEP_WHEEL_SIZE + 1;
+  for (; tick <= ticks && sleeping_threads > 0; tick++)
+    sleep_wheel_expire(&sleep_wheel[tick & (SLEEP_WHEEL_SIZE - 1)], ticks,
+                       &woken);
+  if (ticks > sleep_wheel_tick)
+    sleep_wheel_tick = ticks;
+
+  /* wake all the threads due on this tick at once, and preempt at most once
+     for them */
+  thread_unblock_batch(&woken);
 
-  //if sleep list is empty then end check
-  if(list_rbegin(&sleep_list) == list_head(&sleep_list)){
-    return;
-  }
+  //set interrupt level to previous level
+  intr_set_level(prev_intr_level);
+}
 
-  if(list_entry(list_rbegin(&sleep_list), struct thread, elem)->sleep_till <= ticks){
-    enum intr_level prev_intr_level;//save old interrupt level status
+/* Returns true if a sleeping thread may be due to wake at TICKS,
+   so that thread_check_wake() has work to do.  Otherwise the
+   sleep wheel is brought up to TICKS, just as thread_check_wake()
+   would, and false is returned.  Must be called with interrupts
+   off. */
+bool
+thread_wake_due (int64_t ticks)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
 
-    prev_intr_level = intr_disable();//disable interrupts and save old status
+  if (sleeping_threads > 0
+      && (ticks != sleep_wheel_tick + 1
+          || !list_empty (&sleep_wheel[ticks & (SLEEP_WHEEL_SIZE - 1)])))
+    return true;
+  if (ticks > sleep_wheel_tick)
+    sleep_wheel_tick = ticks;
+  return false;
+}
 
-    //unblock threads that no longer need to sleep
-    while(list_entry(list_rbegin(&sleep_list), struct thread, elem)->sleep_till <= ticks && !list_empty(&sleep_list)){
-      struct list_elem *temp_le = list_rbegin(&sleep_list);
-      list_pop_back(&sleep_list);
-      list_insert_ordered(&awake_list, temp_le, priority_less, NULL );
-    }
-    while(!list_empty(&awake_list)){
-      struct thread *temp_thread_elem = list_entry(list_begin(&awake_list), struct thread, elem);
-      list_pop_front(&awake_list);
-      thread_unblock(temp_thread_elem);
-    }
+/* Returns the earliest sleep_till of any sleeping thread, or
+   LIMIT if no thread is due to wake before LIMIT.  Only the
+   slots for ticks up to LIMIT are examined.  Must be called with
+   interrupts off. */
+int64_t
+thread_next_wake (int64_t limit)
+{
+  int64_t tick;
 
-    //set interrupt level to previous level
-    intr_set_level(prev_intr_level);
-  }
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (limit - sleep_wheel_tick > SLEEP_WHEEL_SIZE)
+    limit = sleep_wheel_tick + SLEEP_WHEEL_SIZE;
+  for (tick = sleep_wheel_tick + 1; tick < limit && sleeping_threads > 0;
+       tick++)
+    {
+      struct list *slot = &sleep_wheel[tick & (SLEEP_WHEEL_SIZE - 1)];
+      struct list_elem *e;
 
+      for (e = list_begin (slot); e != list_end (slot); e = list_next (e))
+        if (list_entry (e, struct thread, sleep_elem)->sleep_till <= tick)
+          return tick;
+    }
+  return limit;
 }
 
 /* Returns the name of the running thread. */
@@ -369,6 +1052,7 @@ thread_name (void)
   return thread_current ()->name;
 }
 
+#if !defined NDEBUG && !THREAD_STACK_GUARD
 /* Returns the running thread.
    This is running_thread() plus a couple of sanity checks.
    See the big comment at the top of thread.h for details. */
@@ -388,6 +1072,7 @@ thread_current (void)
 
   return t;
 }
+#endif
 
 /* Returns the running thread's tid. */
 tid_t
@@ -396,6 +1081,13 @@ thread_tid (void)
   return thread_current ()->tid;
 }
 
+/* Returns true if the idle thread is running. */
+bool
+thread_is_idle (void)
+{
+  return is_idle (thread_current ());
+}
+
 /* Deschedules the current thread and destroys it.  Never
    returns to the caller. */
 void
@@ -412,6 +1104,11 @@ thread_exit (void)
      when it calls thread_schedule_tail(). */
   intr_disable ();
   list_remove (&thread_current()->allelem);
+  if (thread_mlfqs)
+    list_remove (&thread_current ()->runnable_elem);
+  if (thread_current ()->dl_runtime != 0)
+    dl_util -= dl_utilization (thread_current ()->dl_runtime,
+                               thread_current ()->dl_period);
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -428,154 +1125,620 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread)
+  if (!is_idle (cur))
   {
-    list_insert_ordered (&ready_list, &cur->elem, priority_compare, NULL);
+    ready_queue_push (cur);
   }
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
 }
 
-/* Invoke function 'func' on all threads, passing along 'aux'.
-   This function must be called with interrupts off. */
+/* Yields the CPU because an interrupt handler asked for it with
+   intr_yield_on_return().  If the running thread has disabled
+   preemption, the yield is left pending instead, for
+   preempt_enable() to carry out. */
 void
-thread_foreach (thread_action_func *func, void *aux)
+thread_preempt (void)
 {
-  struct list_elem *e;
-
-  ASSERT (intr_get_level () == INTR_OFF);
+  struct thread *cur = thread_current ();
 
-  for (e = list_begin (&all_list); e != list_end (&all_list);
-       e = list_next (e))
+  if (cur->preempt_count > 0)
     {
-      struct thread *t = list_entry (e, struct thread, allelem);
-      func (t, aux);
+      cur->preempt_pending = true;
+      return;
     }
+  cur->preempt_pending = false;
+  this_rq ()->preempting = true;
+  thread_yield ();
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Initializes GROUP, a thread group whose members together may
+   run for at most QUOTA timer ticks in every PERIOD ticks, which
+   caps the CPU a class of threads, such as batch jobs, can take
+   from the rest of the system.  Threads join with
+   thread_set_group(), and threads they create start in the same
+   group.  GROUP must outlive its members. */
 void
-thread_set_priority (int new_priority)
+thread_group_init (struct thread_group *group, int64_t quota,
+                   int64_t period)
 {
-  thread_set_thread_priority(thread_current(), new_priority);
+  ASSERT (group != NULL);
+  ASSERT (0 < quota && quota <= period);
+
+  group->quota = quota;
+  group->period = period;
+  group->used = 0;
+  group->period_end = timer_ticks () + period;
+  group->throttled = false;
+  list_init (&group->parked);
 }
 
-/* sets the priority of the given thread */
+/* Moves the running thread into GROUP, or out of any group if
+   GROUP is a null pointer.  If GROUP is throttled, the thread
+   stops running until GROUP's period ends. */
 void
-thread_set_thread_priority (struct thread *thread, int new_priority)
+thread_set_group (struct thread_group *group)
 {
+  struct thread *cur = thread_current ();
   enum intr_level old_level;
-  struct thread *head_of_ready_list;
-  old_level = intr_disable();
 
-  ASSERT(new_priority >= PRI_MIN && new_priority <= PRI_MAX);
-  ASSERT(is_thread(thread));
-
-  thread->priority = new_priority;
-
-  /* if thread is in THREAD_READY, then insert into ready list, else if it is in
-  THREAD_RUNNING, compare threads new priority to largest thread in ready_list
-  and yield if it is smaller. */
-
-  head_of_ready_list = list_entry(list_begin(&ready_list), struct thread, elem);
-
-  if (thread->status == THREAD_READY)
-  {
-    list_remove(&thread->elem);
-    list_insert_ordered(&ready_list, &thread->elem, priority_compare, NULL);
-  } else if (thread->status == THREAD_RUNNING &&
-             thread->priority < head_of_ready_list->priority)
-  {
-    thread_yield();
-  }
+  ASSERT (!intr_context ());
 
-  intr_set_level(old_level);
+  old_level = intr_disable ();
+  cur->group = group;
+  if (group != NULL && group->throttled)
+    thread_yield ();
+  intr_set_level (old_level);
 }
 
-/* Returns the current thread's priority. */
-int
-thread_get_priority (void)
+/* Returns true if T belongs to a thread group that has used up
+   its quota. */
+static bool
+group_throttled (const struct thread *t)
 {
-  return thread_current ()->priority;
+  return t->group != NULL && t->group->throttled;
 }
 
-/* Sets the current thread's nice value to NICE. */
-void
-thread_set_nice (int nice)
+/* Charges GROUP, which the running thread belongs to, for one
+   tick at tick NOW, starting a new period first if the last one
+   has ended, and throttles GROUP once it has used its quota. */
+static void
+group_charge (struct thread_group *group, int64_t now)
 {
-  /* Ensure new nice value is within nice boundary */
-  ASSERT(nice >= NICE_MIN && nice <= NICE_MAX);
-
-  struct thread *cur = thread_current();
-  cur->nice = nice;
+  if (group->throttled)
+    return;
+  if (group->period_end <= now)
+    {
+      group->used = 0;
+      group->period_end = now + group->period;
+    }
+  if (++group->used >= group->quota)
+    {
+      group->throttled = true;
+      list_push_back (&throttled_groups, &group->elem);
+      intr_yield_on_return ();
+    }
+}
 
-  /* "recalculates the thread’s priority based on the new value (see Section
-  B.2 [Calculating Priority], page 89). If the running thread no longer has the
-  highest priority, yields." */
-  calculate_thread_advanced_priority(cur, NULL);
+/* Ends the throttling of every group whose period has ended by
+   tick NOW, giving it a new period and returning its parked
+   threads to the run queue. */
+static void
+group_replenish (int64_t now)
+{
+  struct thread *cur = running_thread ();
+  struct list_elem *e;
 
-  if(cur != idle_thread)
-  {
-    if(cur->status == THREAD_READY)
+  for (e = list_begin (&throttled_groups); e != list_end (&throttled_groups);)
     {
-      enum intr_level old_level;
-      old_level = intr_disable();
-      list_remove(&cur->elem);
-      list_insert_ordered(&ready_list, &cur->elem, priority_compare, NULL);
-      intr_set_level(old_level);
-    } else if (cur->status == THREAD_RUNNING)
-    {
-      if(list_entry(list_begin(&ready_list), struct thread, elem
-                   )->priority > cur->priority)
-      {
-        thread_yield();
-      }
+      struct thread_group *group = list_entry (e, struct thread_group, elem);
+
+      if (group->period_end > now)
+        {
+          e = list_next (e);
+          continue;
+        }
+
+      e = list_remove (e);
+      group->throttled = false;
+      group->used = 0;
+      group->period_end = now + group->period;
+      while (!list_empty (&group->parked))
+        {
+          struct thread *t = list_entry (list_pop_front (&group->parked),
+                                         struct thread, elem);
+
+          t->parked = false;
+          ready_queue_push (t);
+          if (t->rq_cpu == cur->cpu && preempts (t, cur))
+            intr_yield_on_return ();
+        }
     }
-  }
 }
 
-/* PINTOS doc:
-   load_avg = (59/60)*load_avg + (1/60)*ready_threads,
-   where ready threads is the number of threads that are either running or ready
-   to run at time of update (not including the idle thread).
-*/
-void calculate_load_avg()
+/* Returns the thread whose tid is TID, or a null pointer if
+   there is none.  Must be called with interrupts off. */
+static struct thread *
+thread_lookup (tid_t tid)
 {
-  struct thread *cur = thread_current();
-  int ready_threads = list_size(&ready_list);
+  struct list_elem *e;
 
-  /* if current thread is idle thread the ready_threads is the correct count,
-     else ready_threads is off by 1 since the current thread is THREAD_RUNNING
-  */
-  if(cur != idle_thread)
-  {
-    ready_threads = ready_threads + 1;
-  }
+  ASSERT (intr_get_level () == INTR_OFF);
 
-  load_avg = FIXED_ADD(
-    FIXED_MULTIPLY(FIXED_INT_DIVIDE(CONVERT_TO_FIXED(59), 60), load_avg),
-    FIXED_INT_MULTIPLY(FIXED_INT_DIVIDE(CONVERT_TO_FIXED(1), 60), ready_threads)
-  );
+  for (e = list_begin (&all_list); e != list_end (&all_list);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, allelem);
+      if (t->tid == tid)
+        return t;
+    }
+  return NULL;
 }
 
-void calculate_thread_recent_cpu(struct thread *t, void *aux)
+/* Restricts the thread whose tid is TID to the CPUs in MASK, one
+   bit per CPU, with CPU 0 in the least significant bit.  Bits for
+   CPUs that are not online are ignored.  Returns false, changing
+   nothing, if there is no such thread or MASK names none of the
+   online CPUs.
+
+   A ready thread queued on a CPU that MASK excludes moves to one
+   it includes at once.  The running thread, if MASK excludes its
+   CPU, yields to move; a thread running on another CPU moves the
+   next time it is queued. */
+bool
+thread_set_affinity (tid_t tid, uint32_t mask)
+{
+  enum intr_level old_level;
+  struct thread *t;
+
+  mask &= THREAD_CPU_ALL & smp_online_mask;
+  if (mask == 0)
+    return false;
+
+  old_level = intr_disable ();
+  t = thread_lookup (tid);
+  if (t != NULL)
+    {
+      t->affinity = mask;
+      if (t->status == THREAD_READY && !t->parked
+          && !(mask & (1u << t->rq_cpu)))
+        {
+          ready_queue_remove (t);
+          ready_queue_push (t);
+        }
+      else if (t == running_thread () && !(mask & (1u << t->cpu))
+               && !intr_context ())
+        thread_yield ();
+    }
+  intr_set_level (old_level);
+
+  return t != NULL;
+}
+
+/* Returns the CPU affinity mask of the thread whose tid is TID,
+   or 0 if there is no such thread. */
+uint32_t
+thread_get_affinity (tid_t tid)
+{
+  enum intr_level old_level;
+  struct thread *t;
+  uint32_t mask;
+
+  old_level = intr_disable ();
+  t = thread_lookup (tid);
+  mask = t != NULL ? t->affinity : 0;
+  intr_set_level (old_level);
+
+  return mask;
+}
+
+/* Pins the thread whose tid is TID, if PINNED is true, or unpins
+   it.  A pinned thread is never stolen by an idle CPU, so it
+   stays on the CPU it last ran on as long as its affinity allows,
+   even while it waits there behind other threads.  An unpinned
+   thread only prefers that CPU; see select_rq().  Returns false
+   if there is no such thread. */
+bool
+thread_set_pinned (tid_t tid, bool pinned)
+{
+  enum intr_level old_level;
+  struct thread *t;
+
+  old_level = intr_disable ();
+  t = thread_lookup (tid);
+  if (t != NULL)
+    t->pinned = pinned;
+  intr_set_level (old_level);
+
+  return t != NULL;
+}
+
+/* Returns true if the thread whose tid is TID is pinned, false if
+   it is not or there is no such thread. */
+bool
+thread_is_pinned (tid_t tid)
+{
+  enum intr_level old_level;
+  struct thread *t;
+  bool pinned;
+
+  old_level = intr_disable ();
+  t = thread_lookup (tid);
+  pinned = t != NULL && t->pinned;
+  intr_set_level (old_level);
+
+  return pinned;
+}
+
+/* Keeps the running thread from being preempted by another
+   thread until the matching preempt_enable().  Calls nest.
+   Interrupts stay on, and their handlers still run, so this is
+   enough to protect data shared only with other threads on the
+   same CPU, without turning interrupts off.  It does not keep
+   threads on other CPUs out; for that, turn interrupts off, which
+   takes the kernel lock (see smp.c).  The thread must not block
+   or yield before preempt_enable(). */
+void
+preempt_disable (void)
+{
+  thread_current ()->preempt_count++;
+  barrier ();
+}
+
+/* Undoes one preempt_disable().  When preemption becomes enabled
+   again and an interrupt tried to preempt the running thread in
+   the meantime, yields now, unless interrupts are off, in which
+   case the next interrupt return will do so. */
+void
+preempt_enable (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (cur->preempt_count > 0);
+
+  barrier ();
+  if (--cur->preempt_count == 0 && cur->preempt_pending
+      && !intr_context () && intr_get_level () == INTR_ON)
+    {
+      cur->preempt_pending = false;
+      thread_yield ();
+    }
+}
+
+/* Begins an RCU read-side critical section, in which the caller
+   may walk all_list with interrupts on.  Calls nest.  The thread
+   must not block or yield before rcu_read_unlock(): a context
+   switch is a quiescent state, after which the threads that left
+   all_list beforehand may be freed.
+
+   A switch on one CPU is no quiescent state for a reader on
+   another, so with more than one CPU the outermost call turns
+   interrupts off instead, keeping the other CPUs out of the
+   scheduler until rcu_read_unlock(). */
+void
+rcu_read_lock (void)
+{
+  struct thread *cur = thread_current ();
+
+  preempt_disable ();
+  if (cur->rcu_nesting++ == 0 && smp_active)
+    cur->rcu_old_level = intr_disable ();
+}
+
+/* Ends an RCU read-side critical section. */
+void
+rcu_read_unlock (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (cur->rcu_nesting > 0);
+
+  if (--cur->rcu_nesting == 0 && smp_active)
+    intr_set_level (cur->rcu_old_level);
+  preempt_enable ();
+}
+
+/* Yields the CPU directly to T, which must be ready, without
+   looking for the next thread to run, if the scheduler would run
+   T now anyway: T's priority must be at least that of the
+   running thread and of every other ready thread.  T may be
+   picked ahead of other ready threads of its priority.  Deadline
+   and fair-share threads are not handed off to, because they
+   are not chosen by priority.  Otherwise, this only yields the
+   CPU like thread_yield(). */
+void
+thread_yield_to (struct thread *t)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (!intr_context ());
+  ASSERT (is_thread (t));
+
+  old_level = intr_disable ();
+  if (t->status != THREAD_READY || t->dl_runtime != 0 || cfs_queued (t)
+      || t->parked || group_throttled (t) || group_throttled (cur)
+      || cur->dl_runtime != 0 || is_idle (cur)
+      || !(t->affinity & (1u << cur->cpu))
+      || (t->pinned && t->rq_cpu != cur->cpu)
+      || !clist_empty (&this_rq ()->dl_ready)
+      || t->priority < cur->priority
+      || t->priority < ready_queue_max_priority (this_rq ()))
+    {
+      thread_yield ();
+      intr_set_level (old_level);
+      return;
+    }
+
+  ready_queue_remove (t);
+  cfs_migrate (t, this_rq ());
+  ready_queue_push (cur);
+  cur->status = THREAD_READY;
+  schedule_to (t);
+  intr_set_level (old_level);
+}
+
+/* Invoke function 'func' on all threads, passing along 'aux'.
+   The walk is an RCU read-side critical section, so it may be
+   made with interrupts on, and a long one does not hold up the
+   timer; FUNC must not block or yield. */
+void
+thread_foreach (thread_action_func *func, void *aux)
+{
+  struct list_elem *e;
+
+  rcu_read_lock ();
+  for (e = list_begin (&all_list); e != list_end (&all_list);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, allelem);
+      func (t, aux);
+    }
+  rcu_read_unlock ();
+}
+
+/* Invokes FUNC on every thread that is running or ready to run,
+   passing along AUX.  Only valid under the multi-level feedback
+   queue scheduler.  FUNC may move threads between run queues.
+   This function must be called with interrupts off. */
+void
+thread_foreach_runnable (thread_action_func *func, void *aux)
+{
+  struct list_elem *e;
+
+  ASSERT (thread_mlfqs);
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&runnable_list); e != list_end (&runnable_list);
+       e = list_next (e))
+    func (list_entry (e, struct thread, runnable_elem), aux);
+}
+
+/* Sets the current thread's priority to NEW_PRIORITY.  Donations
+   to the current thread still apply: its effective priority does
+   not drop below that of any thread waiting for one of its locks. */
+void
+thread_set_priority (int new_priority)
+{
+  struct thread *cur = thread_current();
+  enum intr_level old_level;
+
+  ASSERT(new_priority >= PRI_MIN && new_priority <= PRI_MAX);
+
+  old_level = intr_disable();
+  cur->base_priority = new_priority;
+  thread_set_thread_priority(cur, thread_donated_priority(cur));
+  intr_set_level(old_level);
+}
+
+/* Returns the effective priority THREAD should have: its base
+   priority, raised to the ceiling of any pcp_lock it holds and to
+   the priority of the highest-priority thread waiting for any
+   lock THREAD holds.  Each lock's waiters are in descending
+   priority order, so this is O(locks held).  Must be called with
+   interrupts off. */
+int
+thread_donated_priority (struct thread *thread)
+{
+  int priority = (thread->base_priority > thread->pcp_ceiling
+                  ? thread->base_priority : thread->pcp_ceiling);
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&thread->locks); e != list_end (&thread->locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, lock_list_elem);
+      struct list *waiters = &lock->semaphore.waiters;
+
+      if (!list_empty (waiters))
+        {
+          int donated = list_entry (list_front (waiters),
+                                    struct thread, elem)->priority;
+          if (donated > priority)
+            priority = donated;
+        }
+    }
+  return priority;
+}
+
+/* sets the effective priority of the given thread, keeping its position in
+   the run queue or in a lock's waiters consistent.  the idle thread is left
+   alone: it is never in the run queue, even when preempted, so moving it
+   there would corrupt it */
+void
+thread_set_thread_priority (struct thread *thread, int new_priority)
+{
+  enum intr_level old_level;
+  old_level = intr_disable();
+
+  ASSERT(new_priority >= PRI_MIN && new_priority <= PRI_MAX);
+  ASSERT(is_thread(thread));
+
+  if (is_idle (thread))
+  {
+    intr_set_level(old_level);
+    return;
+  }
+
+  /* deadline threads stay at PRI_MAX, where dl_ready keeps them */
+  if (thread->dl_runtime != 0)
+    new_priority = PRI_MAX;
+
+  /* if thread is in THREAD_READY, then move it to the run queue for its new
+  priority, else if it is in THREAD_RUNNING, compare threads new priority to
+  the highest ready priority and yield if it is smaller. */
+  if (thread->status == THREAD_READY)
+  {
+    ready_queue_remove(thread);
+    thread->priority = new_priority;
+    rq_push(&run_queues[thread->rq_cpu], thread);
+  } else if (thread->status == THREAD_BLOCKED &&
+             thread->waiting_for_lock != NULL)
+  {
+    /* keep the lock's waiters ordered so its release wakes the right one */
+    thread->priority = new_priority;
+    sema_reorder_waiter(&thread->waiting_for_lock->semaphore, thread);
+  } else
+  {
+    thread->priority = new_priority;
+    /* a thread in cond_wait() stays queued on the condition with its
+    live priority, including the moment before it blocks */
+    if (thread->cond_waiter != NULL)
+      cond_reorder_waiter(thread);
+    if (thread->status == THREAD_RUNNING && thread == running_thread() &&
+        thread->priority < ready_queue_max_priority(this_rq()))
+    {
+      thread_yield();
+    }
+  }
+
+  intr_set_level(old_level);
+}
+
+/* Returns the current thread's priority. */
+int
+thread_get_priority (void)
+{
+  return thread_current ()->priority;
+}
+
+/* Sets the time slices of threads below PRI_DEFAULT, at
+   PRI_DEFAULT, and above PRI_DEFAULT to LOW, DEFAULT, and HIGH
+   timer ticks, respectively.  Each must be positive. */
+void
+thread_set_slices (unsigned low, unsigned def, unsigned high)
+{
+  ASSERT (low > 0 && def > 0 && high > 0);
+
+  band_slices[SLICE_LOW] = low;
+  band_slices[SLICE_DEFAULT] = def;
+  band_slices[SLICE_HIGH] = high;
+}
+
+/* Sets the current thread's time slice to TICKS timer ticks,
+   whatever its priority, or back to that of its priority band if
+   TICKS is 0.  Takes effect from the thread's next slice. */
+void
+thread_set_quantum (unsigned ticks)
+{
+  thread_current ()->quantum = ticks;
+}
+
+/* Returns the current thread's time slice in timer ticks. */
+unsigned
+thread_get_quantum (void)
+{
+  return thread_slice (thread_current ());
+}
+
+/* Returns T's time slice in timer ticks. */
+static unsigned
+thread_slice (const struct thread *t)
+{
+  if (t->quantum != 0)
+    return t->quantum;
+  else if (t->priority < PRI_DEFAULT)
+    return band_slices[SLICE_LOW];
+  else if (t->priority == PRI_DEFAULT)
+    return band_slices[SLICE_DEFAULT];
+  else
+    return band_slices[SLICE_HIGH];
+}
+
+/* Sets the current thread's nice value to NICE. */
+void
+thread_set_nice (int nice)
+{
+  /* Ensure new nice value is within nice boundary */
+  ASSERT(nice >= NICE_MIN && nice <= NICE_MAX);
+
+  struct thread *cur = thread_current();
+  enum intr_level old_level;
+  old_level = intr_disable();
+  cur->nice = nice;
+
+  /* "recalculates the thread’s priority based on the new value (see Section
+  B.2 [Calculating Priority], page 89). If the running thread no longer has the
+  highest priority, yields."  The fair-share scheduler picks up the new
+  weight from the next tick. */
+  if(thread_mlfqs)
+    calculate_thread_advanced_priority(cur, NULL);
+
+  /* the current thread is THREAD_RUNNING, so it is not in a run queue */
+  if(!is_idle(cur) && ready_queue_max_priority(this_rq()) > cur->priority)
+  {
+    thread_yield();
+  }
+  intr_set_level(old_level);
+}
+
+/* PINTOS doc:
+   load_avg = (59/60)*load_avg + (1/60)*ready_threads,
+   where ready threads is the number of threads that are either running or ready
+   to run at time of update (not including the idle thread).
+*/
+void calculate_load_avg()
+{
+  int running_threads = 0;
+  int cpu;
+
+  /* each CPU's ready_threads counts its ready threads, and its running
+     thread adds one more unless it is the idle thread */
+  for(cpu = 0; cpu < THREAD_CPU_CNT; cpu++)
+    if(smp_online_mask & (1u << cpu))
+    {
+      struct run_queue *rq = &run_queues[cpu];
+      running_threads += rq->ready_threads + !is_idle(rq->curr);
+    }
+
+  load_avg = FIXED_ADD(
+    FIXED_MULTIPLY(FIXED_59_60, load_avg),
+    FIXED_INT_MULTIPLY(FIXED_1_60, running_threads)
+  );
+
+  /* PINTOS doc: "We recommend computing the coefficient of recent cpu
+     first, then multiplying." */
+  int load_temp = FIXED_INT_MULTIPLY(load_avg, 2);
+  recent_cpu_coeff = FIXED_DIVISION(load_temp, FIXED_INT_ADD(load_temp, 1));
+  load_epoch++;
+  coeff_history[load_epoch % COEFF_HISTORY] = recent_cpu_coeff;
+}
+
+void calculate_thread_recent_cpu(struct thread *t, void *aux)
 {
   /* Ensure passed thread is indeed a thread */
   ASSERT(is_thread(t));
 
   /* idle thread maintains recent_cpu  */
-  if(t != idle_thread)
+  if(!is_idle(t))
   {
     /* PINTOS doc:
        recent_cpu = (2*load_avg)/(2*load_avg + 1) * recent_cpu + nice
-       You may need to think about the order of calculations in this formula.
-       We recommend computing the coefficient of recent cpu first,
-       then multiplying. */
-       int recent_cpu_coeff;
-       int load_temp;
-       load_temp = FIXED_INT_MULTIPLY(load_avg, 2);
-       recent_cpu_coeff = FIXED_DIVISION(load_temp, FIXED_INT_ADD(load_temp, 1));
+       The coefficient is kept up to date by calculate_load_avg(), so
+       this is a single multiply-add. */
        t->recent_cpu = FIXED_INT_ADD(
          FIXED_MULTIPLY(recent_cpu_coeff, t->recent_cpu),
          t->nice
@@ -583,14 +1746,56 @@ void calculate_thread_recent_cpu(struct thread *t, void *aux)
   }
 }
 
+/* Applies to T's recent_cpu every once per second decay it has not
+   had yet, each with the coefficient of its own second, so a thread
+   that was blocked for a while ends up where the eager per-second
+   pass would have left it.  Coefficients older than COEFF_HISTORY
+   seconds are gone; the oldest one kept stands in for them, which
+   by then only moves recent_cpu towards the same equilibrium. */
+void update_thread_recent_cpu(struct thread *t, void *aux UNUSED)
+{
+  int64_t oldest = load_epoch - COEFF_HISTORY + 1;
+  int64_t missed;
+
+  ASSERT(is_thread(t));
+
+  if(is_idle(t))
+  {
+    t->cpu_epoch = load_epoch;
+    return;
+  }
+
+  /* at most COEFF_HISTORY steps stand in for the forgotten seconds */
+  if(t->cpu_epoch < oldest - 1)
+  {
+    missed = oldest - 1 - t->cpu_epoch;
+    if(missed > COEFF_HISTORY)
+      missed = COEFF_HISTORY;
+    while(missed-- > 0)
+      t->recent_cpu = FIXED_INT_ADD(
+        FIXED_MULTIPLY(coeff_history[oldest % COEFF_HISTORY], t->recent_cpu),
+        t->nice);
+    t->cpu_epoch = oldest - 1;
+  }
+
+  while(t->cpu_epoch < load_epoch)
+  {
+    t->cpu_epoch++;
+    t->recent_cpu = FIXED_INT_ADD(
+      FIXED_MULTIPLY(coeff_history[t->cpu_epoch % COEFF_HISTORY],
+                     t->recent_cpu),
+      t->nice);
+  }
+}
+
 void
 calculate_thread_advanced_priority(struct thread *t, void *aux)
 {
   /* Ensure passed thread is indeed a thread */
   ASSERT(is_thread(t));
 
-  /* idle thread maintains priority PRI_MIN */
-  if(t != idle_thread)
+  /* idle thread maintains priority PRI_MIN, deadline threads PRI_MAX */
+  if(!is_idle(t) && t->dl_runtime == 0)
   {
     /* PINTOS doc:
        priority = PRI_MAX - (recent_cpu / 4) - (nice * 2) */
@@ -607,15 +1812,78 @@ calculate_thread_advanced_priority(struct thread *t, void *aux)
   }
 }
 
+/* Recalculates the advanced priority of T like
+   calculate_thread_advanced_priority(), then keeps T's run queue
+   membership consistent: a ready thread whose priority changed is
+   moved to the queue for its new priority, and a running thread
+   that no longer has the highest priority yields on return from
+   the current interrupt.  Must be called with interrupts off. */
 void
-sort_ready_list()
+refresh_thread_advanced_priority(struct thread *t, void *aux UNUSED)
 {
-  if(!list_empty(&ready_list))
+  int old_priority = t->priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  calculate_thread_advanced_priority(t, NULL);
+  if (t->priority == old_priority)
+    return;
+
+  if (t->status == THREAD_READY)
+  {
+    t->priority = old_priority;
+    ready_queue_remove(t);
+    calculate_thread_advanced_priority(t, NULL);
+    rq_push(&run_queues[t->rq_cpu], t);
+    return;
+  }
+  if (t->cond_waiter != NULL)
+    cond_reorder_waiter(t);
+  if (t->status == THREAD_RUNNING && t == running_thread() && intr_context() &&
+      t->priority < ready_queue_max_priority(this_rq()))
   {
-    list_sort(&ready_list, priority_compare, NULL);
+    intr_yield_on_return();
   }
 }
 
+/* Moves every ready thread to the run queue matching its current
+   priority, after priorities have been recalculated in place.
+   Each queue stays in FIFO order, and each thread on its CPU. */
+void
+sort_ready_list()
+{
+  int cpu;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (cpu = 0; cpu < THREAD_CPU_CNT; cpu++)
+    {
+      struct run_queue *rq = &run_queues[cpu];
+      struct list stale;
+      int pri;
+
+      list_init (&stale);
+      for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+        while (!list_empty (&rq->ready_queues[pri]))
+          list_push_back (&stale, list_pop_front (&rq->ready_queues[pri]));
+      rq->ready_bitmap = 0;
+      rq->ready_threads = 0;
+      if (!clist_empty (&rq->dl_ready))
+        {
+          rq->ready_bitmap |= (uint64_t) 1 << PRI_MAX;
+          rq->ready_threads += clist_size (&rq->dl_ready);
+        }
+      for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+        if (rq->cfs_count[pri] != 0)
+          rq->ready_bitmap |= (uint64_t) 1 << pri;
+      rq->ready_threads += rb_size (&rq->cfs_ready);
+
+      while (!list_empty (&stale))
+        rq_push (rq, list_entry (list_pop_front (&stale),
+                                 struct thread, elem));
+    }
+}
+
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void)
@@ -641,25 +1909,42 @@ thread_get_recent_cpu (void)
 
 /* Idle thread.  Executes when no other thread is ready to run.
 
-   The idle thread is initially put on the ready list by
-   thread_start().  It will be scheduled once initially, at which
-   point it initializes idle_thread, "up"s the semaphore passed
-   to it to enable thread_start() to continue, and immediately
-   blocks.  After that, the idle thread never appears in the
-   ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   The boot CPU's idle thread is initially put on the ready list
+   by thread_start().  It will be scheduled once initially, at
+   which point it initializes its run queue's idle_thread, "up"s
+   the semaphore passed to it to enable thread_start() to
+   continue, and immediately blocks.  After that, the idle thread
+   never appears in the ready list.  It is returned by
+   next_thread_to_run() as a special case when the ready list is
+   empty.  The other CPUs' idle threads are set up by
+   thread_prepare_cpu() instead. */
 static void
 idle (void *idle_started_ UNUSED)
 {
   struct semaphore *idle_started = idle_started_;
-  idle_thread = thread_current ();
+  run_queues[0].idle_thread = thread_current ();
   sema_up (idle_started);
+  idle_loop ();
+}
 
+/* Body of every CPU's idle thread. */
+static void
+idle_loop (void)
+{
   for (;;)
     {
+      /* Use the spare time to zero pages ahead of PAL_ZERO
+         requests, stopping as soon as another thread is ready. */
+      while (this_rq ()->ready_threads == 0 && palloc_zero_idle ())
+        continue;
+
       /* Let someone else run. */
       intr_disable ();
+      timer_idle_exit ();
       thread_block ();
+      timer_idle_enter ();
+      if (idle_poll ())
+        continue;
 
       /* Re-enable interrupts and wait for the next one.
 
@@ -672,11 +1957,73 @@ idle (void *idle_started_ UNUSED)
          time.
 
          See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
-         7.11.1 "HLT Instruction". */
+         7.11.1 "HLT Instruction".
+
+         The kernel lock must not be held while the CPU sleeps.
+         A thread queued for this CPU in the meantime comes with a
+         reschedule interrupt, which `hlt' does not miss. */
+      if (smp_lock_held ())
+        smp_unlock ();
       asm volatile ("sti; hlt" : : : "memory");
     }
 }
 
+/* Reaper thread.  Releases the threads that free_thread() puts on
+   dead_list.  This is not left to the idle thread, which must
+   never block, because tearing down a process and freeing pages
+   takes locks. */
+static void
+reaper (void *aux UNUSED) 
+{
+  reaper_thread = thread_current ();
+
+  for (;;)
+    {
+      enum intr_level old_level = spin_lock_irqsave (&thread_cache_lock);
+      struct thread *t;
+
+      if (list_empty (&dead_list))
+        {
+          /* free_thread() wakes us up directly, since it runs
+             in the middle of a context switch. */
+          reaper_sleeping = true;
+          spin_unlock_irqrestore (&thread_cache_lock, INTR_OFF);
+          thread_block ();
+          intr_set_level (old_level);
+          continue;
+        }
+      t = list_entry (list_pop_front (&dead_list), struct thread, elem);
+      spin_unlock_irqrestore (&thread_cache_lock, old_level);
+
+#ifdef USERPROG
+      process_reap (t);
+#endif
+      release_thread (t);
+    }
+}
+
+/* If idle polling is enabled, spins with interrupts on until a
+   thread becomes ready or thread_idle_poll_us microseconds pass,
+   so that a thread woken soon after the CPU goes idle does not
+   wait for the CPU to come out of `hlt'.  Returns true if a
+   thread is ready.  Interrupts must be off, and are off again on
+   return. */
+static bool
+idle_poll (void)
+{
+  uint64_t until;
+
+  if (thread_idle_poll_us == 0 || clock_cycles_per_sec () == 0)
+    return false;
+
+  until = clock_ns () + thread_idle_poll_us * (uint64_t) 1000;
+  intr_enable ();
+  while (this_rq ()->ready_threads == 0 && clock_ns () < until)
+    asm volatile ("pause" : : : "memory");
+  intr_disable ();
+  return this_rq ()->ready_threads != 0;
+}
+
 /* Function used as the basis for a kernel thread. */
 static void
 kernel_thread (thread_func *function, void *aux)
@@ -695,11 +2042,12 @@ running_thread (void)
   uint32_t *esp;
 
   /* Copy the CPU's stack pointer into `esp', and then round that
-     down to the start of a page.  Because `struct thread' is
-     always at the beginning of a page and the stack pointer is
-     somewhere in the middle, this locates the curent thread. */
+     down to the start of a thread.  Because `struct thread' is
+     always at the beginning of its THREAD_SIZE-aligned block and
+     the stack pointer is somewhere in the middle, this locates the
+     curent thread. */
   asm ("mov %%esp, %0" : "=g" (esp));
-  return pg_round_down (esp);
+  return (struct thread *) ((uintptr_t) esp & ~(uintptr_t) (THREAD_SIZE - 1));
 }
 
 /* Returns true if T appears to point to a valid thread. */
@@ -709,11 +2057,149 @@ is_thread (struct thread *t)
   return t != NULL && t->magic == THREAD_MAGIC;
 }
 
+/* Returns the pages for a new thread, from thread_cache if
+   possible, or a null pointer if no memory is available. */
+static struct thread *
+alloc_thread (void)
+{
+  struct thread *t = NULL;
+  enum intr_level old_level = spin_lock_irqsave (&thread_cache_lock);
+
+  if (thread_cache_cnt > 0)
+    t = thread_cache[--thread_cache_cnt];
+  spin_unlock_irqrestore (&thread_cache_lock, old_level);
+
+  return t != NULL ? t : alloc_thread_pages ();
+}
+
+#if !THREAD_STACK_GUARD
+/* Allocates the page for a new thread. */
+static struct thread *
+alloc_thread_pages (void)
+{
+  return palloc_get_page (0);
+}
+
+/* Frees the page of thread T. */
+static void
+free_thread_pages (struct thread *t)
+{
+  palloc_free_page (t);
+}
+#else
+/* Allocates THREAD_SIZE bytes aligned on THREAD_SIZE for a new
+   thread and unmaps its guard page.  The page allocator aligns
+   its blocks only relative to the start of its pool, so this
+   allocates nearly twice as much and gives back the pages on
+   either side. */
+static struct thread *
+alloc_thread_pages (void)
+{
+  const size_t page_cnt = 2 * THREAD_STACK_PAGES - 1;
+  uint8_t *pages = palloc_get_multiple (0, page_cnt);
+  uint8_t *t;
+
+  if (pages == NULL)
+    return NULL;
+  t = (uint8_t *) ROUND_UP ((uintptr_t) pages, THREAD_SIZE);
+  palloc_free_multiple (pages, (t - pages) / PGSIZE);
+  palloc_free_multiple (t + THREAD_SIZE,
+                        (pages + page_cnt * PGSIZE - (t + THREAD_SIZE))
+                        / PGSIZE);
+
+  set_guard_page (t + PGSIZE, true);
+  return (struct thread *) t;
+}
+
+/* Maps the guard page of thread T again and frees T's pages. */
+static void
+free_thread_pages (struct thread *t)
+{
+  set_guard_page ((uint8_t *) t + PGSIZE, false);
+  palloc_free_multiple (t, THREAD_STACK_PAGES);
+}
+
+/* Marks kernel page PAGE not present, if GUARD is true, or
+   present again otherwise.  The kernel's page tables are shared
+   by every page directory (see pagedir_create()), so this takes
+   effect in every address space.  paging_init() maps all of
+   memory with 4 kB pages in this configuration, so PAGE has a
+   page table entry of its own. */
+static void
+set_guard_page (uint8_t *page, bool guard)
+{
+  uint32_t pde = init_page_dir[pd_no (page)];
+  uint32_t *pte;
+
+  ASSERT ((pde & PTE_P) != 0 && (pde & PTE_PS) == 0);
+
+  pte = pde_get_pt (pde) + pt_no (page);
+  if (guard)
+    {
+      *pte &= ~PTE_P;
+      asm volatile ("invlpg (%0)" : : "r" (page) : "memory");
+    }
+  else
+    *pte |= PTE_P;
+}
+#endif
+
+/* Disposes of dead thread T, called during the context switch
+   away from it.  Keeps T's pages in thread_cache if there is room
+   and T leaves nothing else behind, and otherwise hands T to the
+   reaper thread. */
+static void
+free_thread (struct thread *t)
+{
+  enum intr_level old_level;
+  bool reap;
+
+  /* Catch any use of T after its death. */
+  t->magic = 0;
+  old_level = spin_lock_irqsave (&thread_cache_lock);
+  reap = thread_cache_cnt >= THREAD_CACHE_SIZE;
+#ifdef USERPROG
+  reap = reap || process_needs_reap (t);
+#endif
+  if (reap)
+    {
+      list_push_back (&dead_list, &t->elem);
+      if (reaper_sleeping)
+        {
+          reaper_sleeping = false;
+          thread_unblock (reaper_thread);
+        }
+    }
+  else
+    thread_cache[thread_cache_cnt++] = t;
+  spin_unlock_irqrestore (&thread_cache_lock, old_level);
+}
+
+/* Frees the pages of dead thread T, or keeps them in
+   thread_cache. */
+static void
+release_thread (struct thread *t)
+{
+  enum intr_level old_level;
+
+  old_level = spin_lock_irqsave (&thread_cache_lock);
+  if (thread_cache_cnt < THREAD_CACHE_SIZE)
+    {
+      thread_cache[thread_cache_cnt++] = t;
+      t = NULL;
+    }
+  spin_unlock_irqrestore (&thread_cache_lock, old_level);
+  if (t != NULL)
+    free_thread_pages (t);
+}
+
 /* Does basic initialization of T as a blocked thread named
    NAME. */
 static void
 init_thread (struct thread *t, const char *name, int priority)
 {
+  enum intr_level old_level;
+
   ASSERT (t != NULL);
   ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
   ASSERT (name != NULL);
@@ -721,13 +2207,24 @@ init_thread (struct thread *t, const char *name, int priority)
   memset (t, 0, sizeof *t);
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
-  t->stack = (uint8_t *) t + PGSIZE;
+  t->stack = (uint8_t *) t + THREAD_SIZE;
   t->priority = priority;
+  t->base_priority = priority;
+  t->pcp_ceiling = PRI_MIN;
   t->magic = THREAD_MAGIC;
   t->waiting_for_lock = NULL;
+  t->cond_waiter = NULL;
+  t->affinity = THREAD_CPU_ALL;
   list_init(&t->locks);
+#ifdef USERPROG
+  t->exit_status = -1;
+#endif
+#ifdef VM
+  list_init (&t->mappings);
+  list_init (&t->shm_refs);
+#endif
 
-  if(thread_mlfqs)
+  if(thread_mlfqs || thread_cfs)
   {
     /* PINTOS doc:
     Initially nice = 0 (NICE_DEFAULT). But if thread is a child of another thread then
@@ -747,8 +2244,12 @@ init_thread (struct thread *t, const char *name, int priority)
 
     //calculate_thread_advanced_priority(t, NULL);
   }
+  t->cpu_epoch = load_epoch;
 
+  /* A reader may be walking all_list from an interrupt handler. */
+  old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
+  intr_set_level (old_level);
 }
 
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
@@ -764,23 +2265,457 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
+/* Returns the running CPU's run queue. */
+static struct run_queue *
+this_rq (void)
+{
+  return &run_queues[smp_cpu ()];
+}
+
+/* Returns true if T is the idle thread of its CPU. */
+static bool
+is_idle (const struct thread *t)
+{
+  return t == run_queues[t->cpu].idle_thread;
+}
+
+/* Returns the run queue that ready thread T should join.  That
+   is the queue of the CPU that last ran T, where its cache is
+   warm, if T's affinity allows it.  An unpinned T goes to the
+   running CPU instead if that CPU is busy with a thread of lower
+   priority than T's, so that T does not wait behind it, since
+   only the running CPU can preempt for T at once.  Failing both,
+   T goes to the running CPU or else the first CPU T may run on. */
+static struct run_queue *
+select_rq (const struct thread *t)
+{
+  uint32_t allowed = t->affinity & smp_online_mask;
+  int self = smp_cpu ();
+  int cpu;
+
+  if (allowed & (1u << t->cpu))
+    {
+      struct thread *curr = run_queues[t->cpu].curr;
+
+      if (t->pinned || t->cpu == self || !(allowed & (1u << self))
+          || is_idle (curr) || curr->priority >= t->priority)
+        return &run_queues[t->cpu];
+    }
+  if (allowed & (1u << self))
+    return &run_queues[self];
+  for (cpu = 0; cpu < THREAD_CPU_CNT; cpu++)
+    if (allowed & (1u << cpu))
+      return &run_queues[cpu];
+  return &run_queues[self];
+}
+
+/* Returns true if T, which is ready, may be taken by CPU from the
+   run queue of another CPU. */
+static bool
+can_steal (const struct thread *t, int cpu)
+{
+  return !t->pinned && (t->affinity & (1u << cpu)) != 0;
+}
+
+/* Wakes an idle CPU to run T, just pushed onto RQ: RQ's own CPU
+   if that is another CPU and idle, otherwise, unless T is pinned,
+   any other idle CPU that T may run on, which will steal T.  A
+   kicked CPU is not kicked again until it has rescheduled. */
+static void
+kick_idle_cpu (struct run_queue *rq, const struct thread *t)
+{
+  int self, target = rq - run_queues;
+  int cpu;
+
+  if (smp_cpu_cnt == 1)
+    return;
+  self = smp_cpu ();
+  if (target == self || !is_idle (rq->curr) || rq->kicked)
+    {
+      if (t->pinned)
+        return;
+      target = -1;
+      for (cpu = 0; cpu < THREAD_CPU_CNT; cpu++)
+        if (cpu != self && (smp_online_mask & (1u << cpu))
+            && can_steal (t, cpu)
+            && is_idle (run_queues[cpu].curr) && !run_queues[cpu].kicked)
+          {
+            target = cpu;
+            break;
+          }
+      if (target < 0)
+        return;
+    }
+  run_queues[target].kicked = true;
+  smp_send_reschedule (target);
+}
+
 /* Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
-   empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   return a thread from the running CPU's run queue, unless it is
+   empty, and then one stolen from another CPU's.  (If the running
+   thread can continue running, then it will be in the run
+   queue.)  If there is none to steal, return the CPU's
+   idle_thread.  Threads of groups that were throttled after they
+   were queued are parked on the way. */
 static struct thread *
 next_thread_to_run (void)
 {
-  if (list_empty (&ready_list)){
-    //printf("scheduling idle thread \n");
-    return idle_thread;
-  }
-  else{
-    struct thread *t = list_entry (list_pop_front (&ready_list), struct thread, elem);
-    //printf("scheduling thread: %s \n", t->name);
-    return t;
-  }
+  struct run_queue *rq = this_rq ();
+
+  for (;;)
+    {
+      struct thread *t;
+
+      if (rq->ready_bitmap != 0)
+        t = ready_queue_pop (rq);
+      else
+        {
+          t = ready_queue_steal (rq);
+          if (t == NULL)
+            return rq->idle_thread;
+        }
+
+      if (!group_throttled (t))
+        return t;
+      list_push_back (&t->group->parked, &t->elem);
+      t->parked = true;
+    }
+}
+
+/* Pushes T onto the run queue it should join; see select_rq(). */
+static void
+ready_queue_push (struct thread *t)
+{
+  rq_push (select_rq (t), t);
+}
+
+/* Appends T to the back of RQ's run queue for its priority, or
+   inserts it into dl_ready by deadline if it is a deadline
+   thread, or into cfs_ready by vruntime under the fair-share
+   scheduler, and wakes an idle CPU to run it.  If T's group is
+   throttled, T is parked in the group instead, out of the run
+   queues. */
+static void
+rq_push (struct run_queue *rq, struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+  cfs_migrate (t, rq);
+  if (group_throttled (t))
+    {
+      list_push_back (&t->group->parked, &t->elem);
+      t->parked = true;
+      return;
+    }
+  if (t->dl_throttled)
+    {
+      list_push_back (&dl_throttled_threads, &t->elem);
+      t->parked = true;
+      return;
+    }
+  if (t->dl_runtime != 0)
+    clist_insert_ordered (&rq->dl_ready, &t->elem, deadline_less, NULL);
+  else if (thread_cfs)
+    {
+      rb_insert (&rq->cfs_ready, &t->rb_elem);
+      rq->cfs_count[t->priority]++;
+    }
+  else
+    list_push_back (&rq->ready_queues[t->priority], &t->elem);
+  rq->ready_bitmap |= (uint64_t) 1 << t->priority;
+  rq->ready_threads++;
+  kick_idle_cpu (rq, t);
+}
+
+/* Removes ready thread T from the run queue for its priority.
+   T's priority must not have changed since it was pushed. */
+static void
+ready_queue_remove (struct thread *t)
+{
+  struct run_queue *rq = &run_queues[t->rq_cpu];
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  if (t->parked)
+    {
+      list_remove (&t->elem);
+      t->parked = false;
+      return;
+    }
+  if (cfs_queued (t))
+    {
+      rb_remove (&rq->cfs_ready, &t->rb_elem);
+      rq->cfs_count[t->priority]--;
+    }
+  else if (t->dl_runtime != 0)
+    clist_remove (&rq->dl_ready, &t->elem);
+  else
+    list_remove (&t->elem);
+  ready_queue_update_bit (rq, t->priority);
+  rq->ready_threads--;
+}
+
+/* Removes and returns RQ's deadline thread with the earliest
+   deadline, if any, then the fair-share thread with the least
+   vruntime, and otherwise the thread at the front of the highest
+   priority non-empty run queue.  RQ must not be empty. */
+static struct thread *
+ready_queue_pop (struct run_queue *rq)
+{
+  int pri = ready_queue_max_priority (rq);
+  struct thread *t;
+
+  ASSERT (pri >= PRI_MIN);
+
+  if (!clist_empty (&rq->dl_ready))
+    t = list_entry (clist_pop_front (&rq->dl_ready), struct thread, elem);
+  else if (!rb_empty (&rq->cfs_ready))
+    {
+      t = rb_entry (rb_min (&rq->cfs_ready), struct thread, rb_elem);
+      rb_remove (&rq->cfs_ready, &t->rb_elem);
+      pri = t->priority;
+      rq->cfs_count[pri]--;
+      cfs_update_min (rq);
+    }
+  else
+    t = list_entry (list_pop_front (&rq->ready_queues[pri]),
+                    struct thread, elem);
+  ready_queue_update_bit (rq, pri);
+  rq->ready_threads--;
+  return t;
+}
+
+/* Returns the first thread in RQ, in the order ready_queue_pop()
+   would take them, that CPU may steal, or a null pointer if
+   there is none. */
+static struct thread *
+rq_first_allowed (struct run_queue *rq, int cpu)
+{
+  struct rb_elem *r;
+  struct list_elem *e;
+  int pri;
+
+  for (e = list_begin (&rq->dl_ready.list); e != list_end (&rq->dl_ready.list);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, elem);
+      if (can_steal (t, cpu))
+        return t;
+    }
+  for (r = rb_min (&rq->cfs_ready); r != NULL; r = rb_next (r))
+    {
+      struct thread *t = rb_entry (r, struct thread, rb_elem);
+      if (can_steal (t, cpu))
+        return t;
+    }
+  for (pri = PRI_MAX; pri >= PRI_MIN; pri--)
+    if (rq->ready_bitmap & ((uint64_t) 1 << pri))
+      for (e = list_begin (&rq->ready_queues[pri]);
+           e != list_end (&rq->ready_queues[pri]); e = list_next (e))
+        {
+          struct thread *t = list_entry (e, struct thread, elem);
+          if (can_steal (t, cpu))
+            return t;
+        }
+  return NULL;
+}
+
+/* Takes a ready thread for RQ, which is empty, from the busiest
+   other CPU that has one RQ's CPU may steal, and returns it, or
+   returns a null pointer if no CPU has one.  The thread taken is
+   the one that CPU would have run next. */
+static struct thread *
+ready_queue_steal (struct run_queue *rq)
+{
+  int self = rq - run_queues;
+  struct thread *best = NULL;
+  int best_cnt = 0;
+  int cpu;
+
+  if (smp_cpu_cnt == 1)
+    return NULL;
+  for (cpu = 0; cpu < THREAD_CPU_CNT; cpu++)
+    {
+      struct run_queue *victim = &run_queues[cpu];
+      struct thread *t;
+
+      if (cpu == self || !(smp_online_mask & (1u << cpu))
+          || victim->ready_threads <= best_cnt)
+        continue;
+      t = rq_first_allowed (victim, self);
+      if (t != NULL)
+        {
+          best = t;
+          best_cnt = victim->ready_threads;
+        }
+    }
+  if (best != NULL)
+    {
+      ready_queue_remove (best);
+      cfs_migrate (best, rq);
+    }
+  return best;
+}
+
+/* Clears bit PRIORITY of RQ's ready_bitmap if no thread is left
+   ready at that priority. */
+static void
+ready_queue_update_bit (struct run_queue *rq, int priority)
+{
+  if (list_empty (&rq->ready_queues[priority])
+      && rq->cfs_count[priority] == 0
+      && (priority != PRI_MAX || clist_empty (&rq->dl_ready)))
+    rq->ready_bitmap &= ~((uint64_t) 1 << priority);
+}
+
+/* Returns the share of the CPU taken by a deadline thread with
+   RUNTIME and PERIOD, in units of 1 / DL_UTIL_SCALE, rounded
+   up. */
+static int
+dl_utilization (int64_t runtime, int64_t period)
+{
+  return (runtime * DL_UTIL_SCALE + period - 1) / period;
+}
+
+/* Gives deadline thread T, which is waking up, a new deadline a
+   period away and a full budget, unless its current ones are
+   still usable: the deadline must not have passed, and spending
+   the budget left before it must not exceed the thread's
+   bandwidth of runtime / period.  This is the wakeup rule of a
+   constant bandwidth server.  A thread that blocked while
+   throttled stays throttled until its deadline. */
+static void
+dl_wake (struct thread *t)
+{
+  int64_t now = timer_ticks ();
+
+  if (t->dl_deadline <= now
+      || t->dl_budget * t->dl_period > t->dl_runtime * (t->dl_deadline - now))
+    dl_replenish (t, now);
+}
+
+/* Gives deadline thread T a new deadline a period after tick NOW
+   and a full budget, ending any throttling. */
+static void
+dl_replenish (struct thread *t, int64_t now)
+{
+  t->dl_deadline = now + t->dl_period;
+  t->dl_budget = t->dl_runtime;
+  t->dl_throttled = false;
+}
+
+/* Returns each throttled deadline thread whose deadline has come
+   by tick NOW to the run queue, with a new deadline and budget. */
+static void
+dl_unthrottle (int64_t now)
+{
+  struct thread *cur = running_thread ();
+  struct list_elem *e;
+
+  for (e = list_begin (&dl_throttled_threads);
+       e != list_end (&dl_throttled_threads);)
+    {
+      struct thread *t = list_entry (e, struct thread, elem);
+
+      if (t->dl_deadline > now)
+        {
+          e = list_next (e);
+          continue;
+        }
+
+      e = list_remove (e);
+      t->parked = false;
+      dl_replenish (t, now);
+      ready_queue_push (t);
+      if (t->rq_cpu == cur->cpu && preempts (t, cur))
+        intr_yield_on_return ();
+    }
+}
+
+/* Orders threads A and B by deadline. */
+static bool
+deadline_less (const struct list_elem *a_, const struct list_elem *b_,
+               void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+  return a->dl_deadline < b->dl_deadline;
+}
+
+/* Orders threads A and B by vruntime. */
+static bool
+vruntime_less (const struct rb_elem *a_, const struct rb_elem *b_,
+               void *aux UNUSED)
+{
+  const struct thread *a = rb_entry (a_, struct thread, rb_elem);
+  const struct thread *b = rb_entry (b_, struct thread, rb_elem);
+  return a->vruntime < b->vruntime;
+}
+
+/* Returns true if T is scheduled by the fair-share scheduler,
+   that is, if thread_cfs is true and T is not a deadline
+   thread. */
+static bool
+cfs_queued (const struct thread *t)
+{
+  return thread_cfs && t->dl_runtime == 0;
+}
+
+/* Charges running thread T for one tick, weighted by its nice
+   value. */
+static void
+cfs_charge (struct thread *t)
+{
+  t->vruntime += CFS_TICK * NICE_0_WEIGHT / cfs_weights[t->nice - NICE_MIN];
+  cfs_update_min (this_rq ());
+}
+
+/* Advances RQ's cfs_min_vruntime to the least vruntime of the
+   running thread and RQ's ready fair-share threads, if that is
+   later.  RQ must be the running CPU's. */
+static void
+cfs_update_min (struct run_queue *rq)
+{
+  struct thread *cur = running_thread ();
+  int64_t min = INT64_MAX;
+
+  if (!rb_empty (&rq->cfs_ready))
+    min = rb_entry (rb_min (&rq->cfs_ready), struct thread,
+                    rb_elem)->vruntime;
+  if (cur->status == THREAD_RUNNING && !is_idle (cur)
+      && cfs_queued (cur) && cur->vruntime < min)
+    min = cur->vruntime;
+  if (min != INT64_MAX && min > rq->cfs_min_vruntime)
+    rq->cfs_min_vruntime = min;
+}
+
+/* Moves T, which is in no run queue, to RQ's CPU.  T keeps its
+   distance from its CPU's cfs_min_vruntime, since each CPU's
+   vruntimes advance at their own pace. */
+static void
+cfs_migrate (struct thread *t, struct run_queue *rq)
+{
+  t->vruntime += (rq->cfs_min_vruntime
+                  - run_queues[t->rq_cpu].cfs_min_vruntime);
+  t->rq_cpu = rq - run_queues;
+}
+
+/* Returns the highest priority of any thread ready in RQ, or
+   PRI_MIN - 1 if it is empty. */
+static int
+ready_queue_max_priority (struct run_queue *rq)
+{
+  uint32_t high = rq->ready_bitmap >> 32;
+  uint32_t low = rq->ready_bitmap;
+
+  if (high != 0)
+    return 63 - __builtin_clz (high);
+  else if (low != 0)
+    return 31 - __builtin_clz (low);
+  else
+    return PRI_MIN - 1;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -803,14 +2738,21 @@ void
 thread_schedule_tail (struct thread *prev)
 {
   struct thread *cur = running_thread ();
+  struct run_queue *rq = this_rq ();
 
   ASSERT (intr_get_level () == INTR_OFF);
 
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
+  rq->curr = cur;
+  rq->kicked = false;
 
   /* Start new time slice. */
-  thread_ticks = 0;
+  rq->thread_ticks = 0;
+  rq->preempting = false;
+
+  if (cur->wake_cycles != 0)
+    schedstat_record (cur);
 
 #ifdef USERPROG
   /* Activate the new address space. */
@@ -819,13 +2761,14 @@ thread_schedule_tail (struct thread *prev)
 
   /* If the thread we switched from is dying, destroy its struct
      thread.  This must happen late so that thread_exit() doesn't
-     pull out the rug under itself.  (We don't free
-     initial_thread because its memory was not obtained via
-     palloc().) */
+     pull out the rug under itself, and no earlier than this
+     switch, which ends the grace period of its removal from
+     all_list.  (We don't free initial_thread because its memory
+     was not obtained via palloc().) */
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread)
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      free_thread (prev);
     }
 }
 
@@ -838,30 +2781,48 @@ thread_schedule_tail (struct thread *prev)
    has completed. */
 static void
 schedule (void)
+{
+  schedule_to (next_thread_to_run ());
+}
+
+/* Switches from the running thread to NEXT, which has already
+   been taken off the run queue, or is the running thread itself.
+   The same conditions as for schedule() apply. */
+static void
+schedule_to (struct thread *next)
 {
   struct thread *cur = running_thread ();
-  struct thread *next = next_thread_to_run ();
   struct thread *prev = NULL;
 
   ASSERT (intr_get_level () == INTR_OFF);
   ASSERT (cur->status != THREAD_RUNNING);
+  ASSERT (cur->rcu_nesting == 0);
   ASSERT (is_thread (next));
 
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      if (cur->status == THREAD_READY && this_rq ()->preempting)
+        cur->involuntary_switches++;
+      else
+        cur->voluntary_switches++;
+      TRACE (TRACE_SWITCH, cur, next, next->priority);
+      next->cpu = cur->cpu;
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
-/* Returns a tid to use for a new thread. */
+/* Returns a tid to use for a new thread.  A locked XADD
+   increments the counter and fetches its old value in one
+   instruction, so no lock is needed, even with interrupts on.
+   See [IA32-v2b] "XADD--Exchange and Add". */
 static tid_t
 allocate_tid (void)
 {
   static tid_t next_tid = 1;
-  tid_t tid;
+  tid_t tid = 1;
 
-  lock_acquire (&tid_lock);
-  tid = next_tid++;
-  lock_release (&tid_lock);
+  asm volatile ("lock xaddl %0, %1" : "+r" (tid), "+m" (next_tid));
 
   return tid;
 }
@@ -2,8 +2,14 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <faultstat.h>
 #include <list.h>
+#include <rbtree.h>
+#include <schedstat.h>
 #include <stdint.h>
+#include "threads/vaddr.h"
+
+struct kstat;
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -29,6 +35,21 @@ typedef int tid_t;
 #define NICE_MAX 20                      /* Highest priority. */
 /* Thread Recent CPU */
 #define RECENT_CPU_DEFAULT 0
+/* A group of threads that together may run for at most QUOTA
+   timer ticks in every PERIOD ticks.  A group that has used up its
+   quota is throttled: its members that become ready are held back
+   until the period ends.  See thread_group_init(). */
+struct thread_group
+  {
+    int64_t quota;                      /* Ticks allowed per period. */
+    int64_t period;                     /* Period, in ticks. */
+    int64_t used;                       /* Ticks used this period. */
+    int64_t period_end;                 /* Tick the period ends at. */
+    bool throttled;                     /* Quota used up? */
+    struct list parked;                 /* Ready members held back. */
+    struct list_elem elem;              /* Element in throttled_groups. */
+  };
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -78,71 +99,300 @@ typedef int tid_t;
    an assertion failure in thread_current(), which checks that
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
-   value, triggering the assertion. */
+   value, triggering the assertion.
+
+   Built with -DTHREAD_STACK_PAGES=N, for N a power of 2 from 4
+   to 8, each thread instead gets N pages, aligned on their total
+   size.  The first page holds `struct thread', the second is left
+   unmapped as a guard page, and the rest are the kernel stack:
+
+        N * 4 kB +---------------------------------+
+                 |          kernel stack           |
+                 |                |                |
+                 |                V                |
+                 |                                 |
+            8 kB +---------------------------------+
+                 |     guard page (not present)    |
+            4 kB +---------------------------------+
+                 |          struct thread          |
+            0 kB +---------------------------------+
+
+   A stack overflow then faults as soon as it touches the guard
+   page, instead of corrupting `struct thread', so thread_current()
+   skips its sanity checks.  The fault happens on the overflowing
+   stack itself, so the CPU cannot deliver it and resets; only the
+   initial thread, which runs on the loader's stack, has no guard
+   page. */
 /* The `elem' member has a dual purpose.  It can be an element in
    the run queue (thread.c), or it can be an element in a
    semaphore wait list (synch.c).  It can be used these two ways
    only because they are mutually exclusive: only a thread in the
    ready state is on the run queue, whereas only a thread in the
    blocked state is on a semaphore wait list. */
+#ifndef THREAD_STACK_PAGES
+#define THREAD_STACK_PAGES 1
+#endif
+#if THREAD_STACK_PAGES != 1 && THREAD_STACK_PAGES != 4 \
+    && THREAD_STACK_PAGES != 8
+#error THREAD_STACK_PAGES must be 1, 4, or 8
+#endif
+#define THREAD_SIZE (THREAD_STACK_PAGES * PGSIZE) /* Bytes per thread. */
+#define THREAD_STACK_GUARD (THREAD_STACK_PAGES > 1) /* Guard page? */
+
 struct thread
   {
-    /* Owned by thread.c. */
-    tid_t tid;                          /* Thread identifier. */
+    /* Scheduler-hot fields, touched on every context switch, tick
+       and wakeup.  `struct thread' is page-aligned, so these share
+       the page's first 64-byte cache line. */
     enum thread_status status;          /* Thread state. */
-    char name[16];                      /* Name (for debugging purposes). */
+    int priority;                       /* Effective priority, including
+                                           donations. */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
-    int recent_cpu;                     /* the recent CPU value of the thread stored as fixed-point */
+    struct list_elem elem;              /* List element, shared between
+                                           thread.c and synch.c. */
+    int64_t sleep_till; //sleep thread until ticks happen, wake up (used for timer device)
+    struct list_elem sleep_elem;        /* List element for sleep wheel. */
+    unsigned quantum;                   /* Time slice in ticks, or 0 for
+                                           its priority band's. */
+    tid_t tid;                          /* Thread identifier. */
+    bool timed_wait;                    /* In a wait that can time out? */
+    bool timed_out;                     /* Did the last timed wait expire? */
+    bool preempt_pending;               /* Preempted while preemption was
+                                           disabled? */
+    unsigned preempt_count;             /* Nesting of preempt_disable(). */
+    unsigned rcu_nesting;               /* Nesting of rcu_read_lock(). */
+
+    /* Owned by thread.c. */
+    char name[16];                      /* Name (for debugging purposes). */
     struct list_elem allelem;           /* List element for all threads list. */
+    int base_priority;                  /* Priority set by the thread
+                                           itself, without donations. */
+    int pcp_ceiling;                    /* Highest ceiling of the
+                                           pcp_locks held, or PRI_MIN. */
+    int recent_cpu;                     /* the recent CPU value of the thread stored as fixed-point */
     int nice;
+    int64_t cpu_epoch;                  /* Load average update recent_cpu
+                                           was last decayed for. */
+    struct list_elem runnable_elem;     /* Element in runnable_list. */
 
     /* Shared between thread.c and synch.c. */
-    struct list_elem elem;              /* List element. */
-    struct list locks;
-    struct lock *waiting_for_lock;
+    struct list locks;                  /* Locks held, for donation. */
+    struct lock *waiting_for_lock;      /* Lock being acquired, if any. */
+    struct semaphore_elem *cond_waiter; /* Entry in the waiters of the
+                                           condition waited on, if any. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    int exit_status;                    /* Status to report on exit. */
+    struct hash *children;              /* Records of children, by tid,
+                                           or null if none yet. */
+    struct child *child;                /* Own record, shared with the
+                                           parent, or null. */
+    uint8_t *heap_start;                /* Start of heap, page-aligned,
+                                           just past the executable. */
+    uint8_t *brk;                       /* End of heap. */
+
+    /* Owned by userprog/fd.c. */
+    struct fd_entry *fds;               /* Open descriptors. */
+    struct bitmap *fd_map;              /* Descriptors in use. */
+
+    /* Owned by userprog/ioring.c. */
+    struct io_ctx *io_ctx;              /* Asynchronous I/O, or null. */
+
+    /* Owned by userprog/exception.c. */
+    uint32_t fault_cnt[FAULT_TYPE_CNT]; /* Page faults, by type. */
 #endif
-    int64_t sleep_till; //sleep thread until ticks happen, wake up (used for timer device)
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash *pages;                 /* Supplemental page table. */
+    void *user_esp;                     /* User stack pointer at the last
+                                           entry into the kernel. */
+
+    /* Owned by vm/mmap.c. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Next mapping identifier. */
+
+    /* Owned by vm/shm.c. */
+    struct list shm_refs;               /* Shared memory references. */
+
+    /* Owned by userprog/process.c. */
+    struct file *exec_file;             /* Executable, kept open for
+                                           demand paging. */
+#endif
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of journal operations. */
+    size_t journal_reserved;            /* Log blocks reserved by the
+                                           outermost one. */
+#endif
+
+    /* Deadline scheduling; see thread_create_deadline(). */
+    int64_t dl_runtime;                 /* Budget per period, in ticks,
+                                           or 0 if not a deadline
+                                           thread. */
+    int64_t dl_period;                  /* Period, in ticks. */
+    int64_t dl_deadline;                /* Current absolute deadline. */
+    int64_t dl_budget;                  /* Budget left before it. */
+    bool dl_throttled;                  /* Out of budget until the
+                                           deadline? */
+
+    /* Bandwidth control; see thread_group_init(). */
+    struct thread_group *group;         /* Group charged for the thread's
+                                           ticks, if any. */
+    bool parked;                        /* Ready, but held back in its
+                                           throttled group? */
+
+    /* CPU accounting; see thread_print_usage(). */
+    int64_t user_ticks;                 /* Timer ticks in user mode. */
+    int64_t kernel_ticks;               /* Timer ticks in the kernel. */
+    unsigned voluntary_switches;        /* Switches away by blocking or
+                                           yielding. */
+    unsigned involuntary_switches;      /* Switches away by preemption. */
+    uint64_t lock_wait_cycles;          /* clock_cycles() spent blocked
+                                           acquiring locks. */
+
+    /* Scheduling latency; see thread_get_schedstat(). */
+    uint64_t wake_cycles;               /* clock_cycles() when last woken,
+                                           or 0 if running since. */
+
+    /* CPU affinity; see thread_set_affinity(). */
+    uint32_t affinity;                  /* CPUs the thread may run on,
+                                           one bit per CPU. */
+    bool pinned;                        /* Never stolen by another CPU? */
+    int cpu;                            /* CPU running the thread, or
+                                           that last ran it. */
+    int rq_cpu;                         /* CPU whose run queue holds the
+                                           thread while it is ready. */
+    int rcu_old_level;                  /* Interrupt level before the
+                                           outermost rcu_read_lock(),
+                                           with more than one CPU. */
+
+    /* Fair-share scheduling; see thread_cfs. */
+    int64_t vruntime;                   /* Run time weighted by nice. */
+    struct rb_elem rb_elem;             /* Element in cfs_ready. */
 
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
 
+/* A kernel built with -DSCHED_PRIORITY or -DSCHED_MLFQS (see
+   threads/Make.vars) supports only the priority scheduler or only
+   the multi-level feedback queue scheduler.  thread_mlfqs is then
+   a constant, so the compiler drops the other scheduler's code,
+   such as priority donation under MLFQS, from the hot paths. */
+#if defined SCHED_PRIORITY && defined SCHED_MLFQS
+#error SCHED_PRIORITY and SCHED_MLFQS are mutually exclusive
+#endif
+
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
+#if defined SCHED_PRIORITY
+#define thread_mlfqs false
+#elif defined SCHED_MLFQS
+#define thread_mlfqs true
+#else
 extern bool thread_mlfqs;
+#endif
+
+/* If true, the multi-level feedback queue scheduler recomputes
+   only the running thread's priority every fourth tick and all
+   other threads once per second.  Implies thread_mlfqs.
+   Controlled by kernel command-line option "-o mlfqs-incremental". */
+#ifdef SCHED_PRIORITY
+#define thread_mlfqs_incremental false
+#else
+extern bool thread_mlfqs_incremental;
+#endif
+
+/* If true, use the fair-share scheduler, which runs the ready
+   thread that has had the least CPU time weighted by its nice
+   value.  Controlled by kernel command-line option "-cfs". */
+extern bool thread_cfs;
+
+/* Microseconds the idle thread polls for a ready thread before
+   halting the CPU, or 0 to halt at once (default).  Controlled by
+   kernel command-line option "-idle". */
+#define IDLE_POLL_DEFAULT_US 1000
+extern unsigned thread_idle_poll_us;
 
 void thread_init (void);
 void thread_start (void);
+void *thread_prepare_cpu (int cpu);
+void thread_start_ap (void) NO_RETURN;
 
 void thread_tick (void);
 void thread_print_stats (void);
+void thread_get_kstat (struct kstat *);
+void thread_get_schedstat (struct schedstat *);
+void thread_print_usage (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
+tid_t thread_create_deadline (const char *name, int64_t runtime,
+                              int64_t period, thread_func *, void *);
+
+void thread_group_init (struct thread_group *, int64_t quota,
+                        int64_t period);
+void thread_set_group (struct thread_group *);
 
 void thread_block (void);
+bool thread_block_until (int64_t deadline);
 void thread_unblock (struct thread *);
+void thread_unblock_batch (struct list *);
 
+#if !defined NDEBUG && !THREAD_STACK_GUARD
 struct thread *thread_current (void);
+#else
+/* Returns the running thread.  Without the sanity checks of the
+   out-of-line version this is only the stack pointer rounded down
+   to the start of its thread; see running_thread() in thread.c. */
+static inline struct thread *
+thread_current (void) 
+{
+  uint32_t *esp;
+
+  asm ("mov %%esp, %0" : "=g" (esp));
+  return (struct thread *) ((uintptr_t) esp & ~(uintptr_t) (THREAD_SIZE - 1));
+}
+#endif
 tid_t thread_tid (void);
 const char *thread_name (void);
+bool thread_is_idle (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_preempt (void);
+void thread_yield_to (struct thread *);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
 void thread_foreach (thread_action_func *, void *);
 
+void preempt_disable (void);
+void preempt_enable (void);
+void rcu_read_lock (void);
+void rcu_read_unlock (void);
+
 int thread_get_priority (void);
 void thread_set_priority (int);
+
+void thread_set_slices (unsigned low, unsigned def, unsigned high);
+void thread_set_quantum (unsigned ticks);
+unsigned thread_get_quantum (void);
+
+/* Most CPUs the scheduler runs threads on.  How many it does run
+   on is up to smp_init() (see threads/smp.c). */
+#define THREAD_CPU_CNT 8
+#define THREAD_CPU_ALL ((uint32_t) (((uint64_t) 1 << THREAD_CPU_CNT) - 1))
+bool thread_set_affinity (tid_t, uint32_t mask);
+uint32_t thread_get_affinity (tid_t);
+bool thread_set_pinned (tid_t, bool pinned);
+bool thread_is_pinned (tid_t);
+
 void thread_set_thread_priority (struct thread *thread, int new_priority);
+int thread_donated_priority (struct thread *thread);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
@@ -151,11 +401,16 @@ int thread_get_load_avg (void);
 bool priority_compare(const struct list_elem * e_1, const struct list_elem * e_2,
   void *aux);
 void calculate_thread_advanced_priority(struct thread *t, void* aux);
+void refresh_thread_advanced_priority(struct thread *t, void* aux);
 void calculate_thread_recent_cpu(struct thread *t, void* aux);
+void update_thread_recent_cpu(struct thread *t, void* aux);
+void thread_foreach_runnable (thread_action_func *, void *);
 void calculate_load_avg(void);
 void sort_ready_list(void);
 
 void thread_sleep (int64_t ticks, int64_t start_ticks);
 void thread_check_wake(int64_t ticks);
+bool thread_wake_due (int64_t ticks);
+int64_t thread_next_wake (int64_t limit);
 
 #endif /* threads/thread.h */
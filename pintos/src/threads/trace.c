@@ -0,0 +1,97 @@
+#include "threads/trace.h"
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/spinlock.h"
+#include "threads/thread.h"
+#include "threads/tsc.h"
+
+/* A scheduler event trace.  Events go into a fixed ring buffer,
+   so recording never allocates and never sleeps and may be done
+   from any context.  When the buffer is full, new events
+   overwrite the oldest.  trace_dump() prints the buffer, oldest
+   first, with each event's time in cycles since the first event
+   printed. */
+
+bool trace_enabled;
+
+/* A recorded event. */
+struct trace_entry
+  {
+    uint64_t tsc;               /* Time stamp counter. */
+    enum trace_event event;     /* Event type. */
+    tid_t a, b;                 /* Threads involved, or TID_ERROR. */
+    int value;                  /* Event-specific value. */
+    int reason;                 /* Status A left, for TRACE_SWITCH. */
+  };
+
+#define TRACE_ENTRIES 1024
+static struct trace_entry entries[TRACE_ENTRIES];
+static unsigned long long entry_cnt;  /* Events recorded. */
+static bool dumped;             /* Has trace_dump() run? */
+static struct spinlock trace_lock = SPINLOCK_INITIALIZER ("trace");
+
+/* Records EVENT involving threads A and B, either of which may be
+   null, with VALUE. */
+void
+trace_record (enum trace_event event, const struct thread *a,
+              const struct thread *b, int value)
+{
+  enum intr_level old_level;
+  struct trace_entry *e;
+
+  old_level = spin_lock_irqsave (&trace_lock);
+  e = &entries[entry_cnt++ % TRACE_ENTRIES];
+  e->tsc = rdtsc ();
+  e->event = event;
+  e->a = a != NULL ? a->tid : TID_ERROR;
+  e->b = b != NULL ? b->tid : TID_ERROR;
+  e->value = value;
+  e->reason = a != NULL ? (int) a->status : 0;
+  spin_unlock_irqrestore (&trace_lock, old_level);
+}
+
+/* Prints the recorded events, if tracing is enabled.  Does
+   nothing after the first call, so that a panic during shutdown
+   does not print the trace twice. */
+void
+trace_dump (void)
+{
+  static const char *event_names[] =
+    { "switch", "block", "unblock", "donate", "wait", "acquire" };
+  static const char *status_names[] =
+    { "running", "ready", "blocked", "dying" };
+  unsigned long long first, i;
+
+  if (!trace_enabled || dumped)
+    return;
+  dumped = true;
+
+  first = entry_cnt > TRACE_ENTRIES ? entry_cnt - TRACE_ENTRIES : 0;
+  printf ("Trace: %llu events, last %llu shown\n",
+          entry_cnt, entry_cnt - first);
+  for (i = first; i < entry_cnt; i++)
+    {
+      const struct trace_entry *e = &entries[i % TRACE_ENTRIES];
+      uint64_t t = e->tsc - entries[first % TRACE_ENTRIES].tsc;
+
+      printf ("%14llu %-7s %4d", (unsigned long long) t,
+              event_names[e->event], e->a);
+      switch (e->event)
+        {
+        case TRACE_SWITCH:
+          printf (" (%s) -> %d, priority %d\n",
+                  status_names[e->reason], e->b, e->value);
+          break;
+        case TRACE_UNBLOCK:
+        case TRACE_DONATE:
+          printf (" -> %d, priority %d\n", e->b, e->value);
+          break;
+        case TRACE_LOCK_WAIT:
+          printf (", held by %d\n", e->b);
+          break;
+        default:
+          printf ("\n");
+          break;
+        }
+    }
+}
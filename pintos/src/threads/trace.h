@@ -0,0 +1,34 @@
+#ifndef THREADS_TRACE_H
+#define THREADS_TRACE_H
+
+#include <stdbool.h>
+
+struct thread;
+
+/* Scheduler events. */
+enum trace_event
+  {
+    TRACE_SWITCH,               /* Switch from A to B, B's priority. */
+    TRACE_BLOCK,                /* A blocks. */
+    TRACE_UNBLOCK,              /* A unblocks B, B's priority. */
+    TRACE_DONATE,               /* A donates priority to B. */
+    TRACE_LOCK_WAIT,            /* A waits for a lock held by B. */
+    TRACE_LOCK_GOT              /* A gets a lock it waited for. */
+  };
+
+/* If true, record scheduler events and dump them at shutdown or
+   panic.  Controlled by kernel command-line option "-trace". */
+extern bool trace_enabled;
+
+void trace_record (enum trace_event, const struct thread *a,
+                   const struct thread *b, int value);
+void trace_dump (void);
+
+/* Records an event if tracing is enabled. */
+#define TRACE(EVENT, A, B, VALUE)                       \
+        do {                                            \
+          if (trace_enabled)                            \
+            trace_record (EVENT, A, B, VALUE);          \
+        } while (0)
+
+#endif /* threads/trace.h */
@@ -0,0 +1,156 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* A work queue: a fixed set of kernel threads that run functions
+   handed to them by wq_submit(), so that a subsystem that wants
+   some work done asynchronously need not create a thread for it.
+
+   Each priority has its own queue, and an idle worker always takes
+   the oldest work of the highest priority available.  Workers run
+   pieces of work concurrently, so work must do its own locking,
+   and work that blocks for long ties up a worker. */
+
+/* Number of worker threads. */
+#define WQ_WORKERS 4
+
+/* A piece of submitted work. */
+struct work
+  {
+    struct list_elem queue_elem;   /* Element in queues[]. */
+    struct list_elem pending_elem; /* Element in pending_list. */
+    uint64_t seq;                  /* Submission sequence number. */
+    wq_func *func;                 /* Function to run. */
+    void *aux;                     /* Argument to FUNC. */
+  };
+
+static struct kmem_cache *work_cache;  /* Allocates struct work. */
+
+static struct list queues[WQ_PRI_CNT]; /* Work not yet started. */
+
+/* All work not yet finished, whether queued or running, in order
+   of submission, for wq_flush(). */
+static struct list pending_list;
+static uint64_t next_seq;       /* Sequence number for next work. */
+
+static struct lock wq_lock;        /* Protects all of the above. */
+static struct condition work_queued;   /* Signaled on submission. */
+static struct condition work_finished; /* Broadcast on completion. */
+
+static thread_func worker NO_RETURN;
+
+/* Initializes the work queue and starts its worker threads. */
+void
+wq_init (void)
+{
+  int i;
+
+  work_cache = kmem_cache_create ("work", sizeof (struct work), 0, NULL);
+  if (work_cache == NULL)
+    PANIC ("work queue creation failed");
+  for (i = 0; i < WQ_PRI_CNT; i++)
+    list_init (&queues[i]);
+  list_init (&pending_list);
+  lock_init (&wq_lock);
+  cond_init (&work_queued);
+  cond_init (&work_finished);
+
+  for (i = 0; i < WQ_WORKERS; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "worker %d", i);
+      thread_create (name, PRI_DEFAULT, worker, NULL);
+    }
+}
+
+/* Queues FUNC to be called with AUX on a worker thread at normal
+   priority.  Returns true if successful, false if memory is
+   not available. */
+bool
+wq_submit (wq_func *func, void *aux)
+{
+  return wq_submit_priority (WQ_PRI_NORMAL, func, aux);
+}
+
+/* Queues FUNC to be called with AUX on a worker thread at
+   priority PRI.  Returns true if successful, false if memory is
+   not available.  Must not be called from an interrupt
+   handler. */
+bool
+wq_submit_priority (enum wq_priority pri, wq_func *func, void *aux)
+{
+  struct work *w;
+
+  ASSERT (pri < WQ_PRI_CNT);
+  ASSERT (func != NULL);
+  ASSERT (!intr_context ());
+
+  w = kmem_cache_alloc (work_cache);
+  if (w == NULL)
+    return false;
+  w->func = func;
+  w->aux = aux;
+
+  lock_acquire (&wq_lock);
+  w->seq = next_seq++;
+  list_push_back (&queues[pri], &w->queue_elem);
+  list_push_back (&pending_list, &w->pending_elem);
+  cond_signal (&work_queued, &wq_lock);
+  lock_release (&wq_lock);
+  return true;
+}
+
+/* Waits until all the work submitted before the call has
+   finished.  Work submitted meanwhile is not waited for.  Must
+   not be called from work running on a worker thread. */
+void
+wq_flush (void)
+{
+  uint64_t target;
+
+  lock_acquire (&wq_lock);
+  target = next_seq;
+  while (!list_empty (&pending_list)
+         && list_entry (list_front (&pending_list), struct work,
+                        pending_elem)->seq < target)
+    cond_wait (&work_finished, &wq_lock);
+  lock_release (&wq_lock);
+}
+
+/* Worker thread.  Runs queued work, highest priority first. */
+static void
+worker (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct work *w = NULL;
+      int i;
+
+      lock_acquire (&wq_lock);
+      for (;;)
+        {
+          for (i = 0; i < WQ_PRI_CNT; i++)
+            if (!list_empty (&queues[i]))
+              break;
+          if (i < WQ_PRI_CNT)
+            break;
+          cond_wait (&work_queued, &wq_lock);
+        }
+      w = list_entry (list_pop_front (&queues[i]), struct work, queue_elem);
+      lock_release (&wq_lock);
+
+      w->func (w->aux);
+
+      lock_acquire (&wq_lock);
+      list_remove (&w->pending_elem);
+      cond_broadcast (&work_finished, &wq_lock);
+      lock_release (&wq_lock);
+      kmem_cache_free (work_cache, w);
+    }
+}
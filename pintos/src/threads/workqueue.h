@@ -0,0 +1,25 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <stdbool.h>
+
+/* Work priorities.  Queued work of a higher priority is started
+   before any of a lower priority. */
+enum wq_priority
+  {
+    WQ_PRI_HIGH,                /* Latency-sensitive work. */
+    WQ_PRI_NORMAL,              /* Default. */
+    WQ_PRI_LOW,                 /* Background work. */
+    WQ_PRI_CNT                  /* Number of priorities. */
+  };
+
+/* A function to run on a worker thread, passed the AUX given to
+   wq_submit(). */
+typedef void wq_func (void *aux);
+
+void wq_init (void);
+bool wq_submit (wq_func *, void *aux);
+bool wq_submit_priority (enum wq_priority, wq_func *, void *aux);
+void wq_flush (void);
+
+#endif /* threads/workqueue.h */
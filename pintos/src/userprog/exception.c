@@ -1,15 +1,32 @@
 #include "userprog/exception.h"
+#include <faultstat.h>
 #include <inttypes.h>
+#include <kstat.h>
 #include <stdio.h>
+#include "devices/timer.h"
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+/* Page faults of every process, by type, and their service
+   times.  Updated with interrupts off. */
+static struct faultstat faults;
+
+/* Names of fault types, for exception_print_stats(). */
+static const char *fault_names[FAULT_TYPE_CNT] =
+  {"zero-fill", "file", "swap-in", "copy-on-write", "stack growth",
+   "minor", "invalid"};
+
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+static void fault_record (enum fault_type, uint64_t start);
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -64,7 +81,46 @@ exception_init (void)
 void
 exception_print_stats (void) 
 {
+  int t, b;
+
   printf ("Exception: %lld page faults\n", page_fault_cnt);
+  for (t = 0; t < FAULT_TYPE_CNT; t++)
+    {
+      if (faults.total[t] == 0)
+        continue;
+      printf ("  %s: %u faults, latency log2 ns:count:",
+              fault_names[t], (unsigned) faults.total[t]);
+      for (b = 0; b < FAULTSTAT_BUCKETS; b++)
+        if (faults.latency[t][b] != 0)
+          printf (" %d:%u", b, (unsigned) faults.latency[t][b]);
+      printf ("\n");
+    }
+}
+
+/* Copies the running process's page fault counts, and those of
+   every process along with their service times, into *STAT. */
+void
+exception_get_faultstat (struct faultstat *stat)
+{
+  struct thread *t = thread_current ();
+  enum intr_level old_level = intr_disable ();
+  int i;
+
+  *stat = faults;
+  for (i = 0; i < FAULT_TYPE_CNT; i++)
+    stat->count[i] = t->fault_cnt[i];
+  intr_set_level (old_level);
+}
+
+/* Copies the page fault count and the statistics returned by
+   exception_get_faultstat() into *K. */
+void
+exception_get_kstat (struct kstat *k)
+{
+  enum intr_level old_level = intr_disable ();
+  k->page_faults = page_fault_cnt;
+  intr_set_level (old_level);
+  exception_get_faultstat (&k->faults);
 }
 
 /* Handler for an exception (probably) caused by a user process. */
@@ -126,6 +182,7 @@ page_fault (struct intr_frame *f)
   bool write;        /* True: access was write, false: access was read. */
   bool user;         /* True: access by user, false: access by kernel. */
   void *fault_addr;  /* Fault address. */
+  uint64_t start = clock_cycles ();
 
   /* Obtain faulting address, the virtual address that was
      accessed to cause the fault.  It may point to code or to
@@ -148,9 +205,37 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
+#ifdef VM
+  /* Bring in the page, if it belongs to the process's address
+     space or extends its stack.  The kernel may fault here too,
+     when it touches user memory on the process's behalf.  Writing
+     a page that is present but read-only may be the first write to
+     an all-zero page, which gets its own frame then. */
+  if (user)
+    thread_current ()->user_esp = f->esp;
+  if ((not_present || write) && is_user_vaddr (fault_addr))
+    {
+      enum fault_type type = page_fault_type (fault_addr, write);
+      if (page_in (fault_addr, write))
+        {
+          fault_record (type, start);
+          return;
+        }
+    }
+#endif
+  fault_record (FAULT_INVALID, start);
+
+  /* A kernel access to a bad user address comes from get_user()
+     or put_user() in syscall.c, which leave the address to resume
+     at in %eax.  Resume there, with -1 in %eax to report the
+     failure. */
+  if (!user && is_user_vaddr (fault_addr))
+    {
+      f->eip = (void (*) (void)) f->eax;
+      f->eax = 0xffffffff;
+      return;
+    }
+
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
@@ -159,3 +244,27 @@ page_fault (struct intr_frame *f)
   kill (f);
 }
 
+/* Counts a page fault of TYPE, which began being serviced at
+   START, for the running thread and for all processes. */
+static void
+fault_record (enum fault_type type, uint64_t start)
+{
+  uint64_t ns = clock_cycles_to_ns (clock_cycles () - start);
+  enum intr_level old_level;
+  int b;
+
+  if (ns >> 32 != 0)
+    b = FAULTSTAT_BUCKETS - 1;
+  else if (ns == 0)
+    b = 0;
+  else
+    b = 31 - __builtin_clz ((uint32_t) ns);
+  if (b >= FAULTSTAT_BUCKETS)
+    b = FAULTSTAT_BUCKETS - 1;
+
+  thread_current ()->fault_cnt[type]++;
+  old_level = intr_disable ();
+  faults.total[type]++;
+  faults.latency[type][b]++;
+  intr_set_level (old_level);
+}
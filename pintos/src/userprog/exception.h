@@ -6,7 +6,12 @@
 #define PF_W 0x2    /* 0: read, 1: write. */
 #define PF_U 0x4    /* 0: kernel, 1: user process. */
 
+struct faultstat;
+struct kstat;
+
 void exception_init (void);
 void exception_print_stats (void);
+void exception_get_faultstat (struct faultstat *);
+void exception_get_kstat (struct kstat *);
 
 #endif /* userprog/exception.h */
@@ -0,0 +1,369 @@
+#include "userprog/fd.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "userprog/pipe.h"
+#include "userprog/port.h"
+
+/* File descriptor tables.
+
+   Each process's open files, directories, pipe ends, and ports sit
+   in an array indexed directly by file descriptor, so that the
+   lookup on every I/O system call is a bounds check and a load.
+   A bitmap with one bit per slot records which descriptors are in
+   use, and a new descriptor is the lowest free one.  Descriptors 0
+   and 1 are the console and are never free.
+
+   Both start out null and grow together by doubling when every
+   slot is taken, so a process that never opens a file pays
+   nothing, and one that keeps hundreds open pays for a few
+   reallocations in all.  Only the owning thread touches its
+   table, except that a forking parent's table is read by its child
+   while the parent waits. */
+
+/* Slots in a process's first table. */
+#define FD_INITIAL 16
+
+static bool grow (struct thread *);
+static int add_entry (const struct fd_entry *);
+static struct fd_entry *lookup (int fd);
+static bool copy_entry (const struct fd_entry *, struct fd_entry *);
+static bool is_open (const struct fd_entry *);
+
+/* Adds FILE to the current process's table and returns its new
+   descriptor, the lowest free one.  Returns -1, leaving FILE open,
+   if memory is short. */
+int
+fd_open (struct file *file)
+{
+  struct fd_entry e = {.file = file};
+
+  ASSERT (file != NULL);
+  return add_entry (&e);
+}
+
+/* Adds DIR to the current process's table and returns its new
+   descriptor.  Returns -1, leaving DIR open, if memory is short. */
+int
+fd_open_dir (struct dir *dir)
+{
+  struct fd_entry e = {.dir = dir};
+
+  ASSERT (dir != NULL);
+  return add_entry (&e);
+}
+
+/* Adds P's write end, if WRITE_END is true, or its read end to the
+   current process's table and returns its new descriptor.  Returns
+   -1, leaving the end open, if memory is short. */
+int
+fd_open_pipe (struct pipe *p, bool write_end)
+{
+  struct fd_entry e = {.pipe = p, .write_end = write_end};
+
+  ASSERT (p != NULL);
+  return add_entry (&e);
+}
+
+/* Adds port P to the current process's table and returns its new
+   descriptor.  Returns -1, leaving P open, if memory is short. */
+int
+fd_open_port (struct port *p)
+{
+  struct fd_entry e = {.port = p};
+
+  ASSERT (p != NULL);
+  return add_entry (&e);
+}
+
+/* Returns the file open as descriptor FD in the current process,
+   or a null pointer if FD is not an open file. */
+struct file *
+fd_lookup (int fd)
+{
+  struct fd_entry *e = lookup (fd);
+  return e != NULL ? e->file : NULL;
+}
+
+/* Returns the directory open as descriptor FD in the current
+   process, or a null pointer if FD is not an open directory. */
+struct dir *
+fd_lookup_dir (int fd)
+{
+  struct fd_entry *e = lookup (fd);
+  return e != NULL ? e->dir : NULL;
+}
+
+/* Returns the pipe whose write end, if WRITE_END is true, or read
+   end is open as descriptor FD in the current process, or a null
+   pointer if FD is not that end of a pipe. */
+struct pipe *
+fd_lookup_pipe (int fd, bool write_end)
+{
+  struct fd_entry *e = lookup (fd);
+  return e != NULL && e->write_end == write_end ? e->pipe : NULL;
+}
+
+/* Returns the port open as descriptor FD in the current process,
+   or a null pointer if FD is not an open port. */
+struct port *
+fd_lookup_port (int fd)
+{
+  struct fd_entry *e = lookup (fd);
+  return e != NULL ? e->port : NULL;
+}
+
+/* Closes descriptor FD in the current process and frees it for
+   reuse.  Returns false if FD is not open. */
+bool
+fd_close (int fd)
+{
+  struct thread *t = thread_current ();
+  struct fd_entry *e = lookup (fd);
+
+  if (e == NULL || !is_open (e))
+    return false;
+  fd_close_entry (e);
+  bitmap_reset (t->fd_map, fd);
+  return true;
+}
+
+/* Closes every descriptor the current process has open and frees
+   its table. */
+void
+fd_close_all (void)
+{
+  struct thread *t = thread_current ();
+  size_t fd;
+
+  if (t->fd_map == NULL)
+    return;
+  for (fd = 0; fd < bitmap_size (t->fd_map); fd++)
+    fd_close_entry (&t->fds[fd]);
+  free (t->fds);
+  bitmap_destroy (t->fd_map);
+  t->fds = NULL;
+  t->fd_map = NULL;
+}
+
+/* Gives the current process, a newly forked child, a copy of
+   PARENT's table, which must not change meanwhile.  The child's
+   files are reopened copies at the same positions, so the two
+   processes' reads and seeks do not affect each other, and so are
+   its directories, while its pipe ends are further references to
+   the same pipes.  Returns
+   false if memory is short, leaving whatever was copied for
+   fd_close_all() to free. */
+bool
+fd_copy (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  size_t fd, cnt;
+
+  ASSERT (t->fd_map == NULL);
+  if (parent->fd_map == NULL)
+    return true;
+
+  cnt = bitmap_size (parent->fd_map);
+  t->fds = calloc (cnt, sizeof *t->fds);
+  t->fd_map = bitmap_create (cnt);
+  if (t->fds == NULL || t->fd_map == NULL)
+    {
+      free (t->fds);
+      bitmap_destroy (t->fd_map);
+      t->fds = NULL;
+      t->fd_map = NULL;
+      return false;
+    }
+  bitmap_mark (t->fd_map, STDIN_FILENO);
+  bitmap_mark (t->fd_map, STDOUT_FILENO);
+
+  for (fd = 0; fd < cnt; fd++)
+    {
+      const struct fd_entry *pe = &parent->fds[fd];
+
+      if (!is_open (pe))
+        continue;
+      if (!copy_entry (pe, &t->fds[fd]))
+        return false;
+      bitmap_mark (t->fd_map, fd);
+    }
+  return true;
+}
+
+/* Stores in *COPY a new reference to what descriptor FD in the
+   current process refers to, made the way fd_copy() makes them,
+   for a new process to fd_install().  Returns false if FD is not
+   open or memory is short. */
+bool
+fd_dup (int fd, struct fd_entry *copy)
+{
+  struct fd_entry *e = lookup (fd);
+
+  copy->file = NULL;
+  copy->dir = NULL;
+  copy->pipe = NULL;
+  copy->port = NULL;
+  if (e == NULL || !is_open (e))
+    return false;
+  return copy_entry (e, copy);
+}
+
+/* Installs E, made by fd_dup(), as descriptor FD in the current
+   process.  Returns false if FD is a console descriptor or already
+   open, or if memory is short; then E is still the caller's to
+   close with fd_close_entry(). */
+bool
+fd_install (int fd, const struct fd_entry *e)
+{
+  struct thread *t = thread_current ();
+
+  if (fd == STDIN_FILENO || fd == STDOUT_FILENO || fd < 0)
+    return false;
+  while (t->fd_map == NULL || (size_t) fd >= bitmap_size (t->fd_map))
+    if (!grow (t))
+      return false;
+  if (bitmap_test (t->fd_map, fd))
+    return false;
+  t->fds[fd] = *e;
+  bitmap_mark (t->fd_map, fd);
+  return true;
+}
+
+/* Adds a copy of E to the current process's table and returns its
+   descriptor, or -1 if memory is short. */
+static int
+add_entry (const struct fd_entry *e)
+{
+  struct thread *t = thread_current ();
+  size_t fd;
+
+  fd = t->fd_map != NULL ? bitmap_scan_and_flip (t->fd_map, 0, 1, false)
+                         : BITMAP_ERROR;
+  if (fd == BITMAP_ERROR)
+    {
+      if (!grow (t))
+        return -1;
+      fd = bitmap_scan_and_flip (t->fd_map, 0, 1, false);
+      ASSERT (fd != BITMAP_ERROR);
+    }
+  t->fds[fd] = *e;
+  return fd;
+}
+
+/* Returns the current process's entry for descriptor FD, or a
+   null pointer if FD is out of range. */
+static struct fd_entry *
+lookup (int fd)
+{
+  struct thread *t = thread_current ();
+
+  if (fd < 0 || t->fd_map == NULL || (size_t) fd >= bitmap_size (t->fd_map))
+    return NULL;
+  return &t->fds[fd];
+}
+
+/* Makes TO, which must be clear, a new reference to what FROM
+   refers to.  Returns false if memory is short. */
+static bool
+copy_entry (const struct fd_entry *from, struct fd_entry *to)
+{
+  if (from->file != NULL)
+    {
+      to->file = file_reopen (from->file);
+      if (to->file == NULL)
+        return false;
+      file_seek (to->file, file_tell (from->file));
+    }
+  else if (from->dir != NULL)
+    {
+      to->dir = dir_dup (from->dir);
+      if (to->dir == NULL)
+        return false;
+    }
+  else if (from->pipe != NULL)
+    {
+      pipe_dup (from->pipe, from->write_end);
+      to->pipe = from->pipe;
+      to->write_end = from->write_end;
+    }
+  else if (from->port != NULL)
+    {
+      port_dup (from->port);
+      to->port = from->port;
+    }
+  return true;
+}
+
+/* Returns true if E refers to anything. */
+static bool
+is_open (const struct fd_entry *e)
+{
+  return e->file != NULL || e->dir != NULL || e->pipe != NULL
+         || e->port != NULL;
+}
+
+/* Closes whatever E refers to and clears it. */
+void
+fd_close_entry (struct fd_entry *e)
+{
+  if (e->file != NULL)
+    file_close (e->file);
+  else if (e->dir != NULL)
+    dir_close (e->dir);
+  else if (e->pipe != NULL)
+    pipe_close (e->pipe, e->write_end);
+  else if (e->port != NULL)
+    port_close (e->port);
+  e->file = NULL;
+  e->dir = NULL;
+  e->pipe = NULL;
+  e->port = NULL;
+}
+
+/* Doubles T's table, or creates it with FD_INITIAL slots and the
+   console descriptors reserved.  Returns false if memory is
+   short, leaving the table as it was. */
+static bool
+grow (struct thread *t)
+{
+  size_t old_cnt = t->fd_map != NULL ? bitmap_size (t->fd_map) : 0;
+  size_t new_cnt = old_cnt != 0 ? old_cnt * 2 : FD_INITIAL;
+  struct fd_entry *fds;
+  struct bitmap *map;
+  size_t fd;
+
+  fds = realloc (t->fds, new_cnt * sizeof *fds);
+  if (fds == NULL)
+    return false;
+  t->fds = fds;
+  map = bitmap_create (new_cnt);
+  if (map == NULL)
+    return false;
+
+  for (fd = old_cnt; fd < new_cnt; fd++)
+    {
+      fds[fd].file = NULL;
+      fds[fd].dir = NULL;
+      fds[fd].pipe = NULL;
+      fds[fd].port = NULL;
+    }
+  if (t->fd_map != NULL)
+    {
+      for (fd = 0; fd < old_cnt; fd++)
+        bitmap_set (map, fd, bitmap_test (t->fd_map, fd));
+      bitmap_destroy (t->fd_map);
+    }
+  else
+    {
+      bitmap_mark (map, STDIN_FILENO);
+      bitmap_mark (map, STDOUT_FILENO);
+    }
+  t->fd_map = map;
+  return true;
+}
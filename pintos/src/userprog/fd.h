@@ -0,0 +1,38 @@
+#ifndef USERPROG_FD_H
+#define USERPROG_FD_H
+
+#include <stdbool.h>
+
+struct dir;
+struct file;
+struct pipe;
+struct port;
+struct thread;
+
+/* What a file descriptor refers to: an open file, an open
+   directory, one end of a pipe, or a message port. */
+struct fd_entry
+  {
+    struct file *file;                  /* Open file, or null. */
+    struct dir *dir;                    /* Open directory, or null. */
+    struct pipe *pipe;                  /* Pipe, or null. */
+    bool write_end;                     /* Pipe's write end? */
+    struct port *port;                  /* Message port, or null. */
+  };
+
+int fd_open (struct file *);
+int fd_open_dir (struct dir *);
+int fd_open_pipe (struct pipe *, bool write_end);
+int fd_open_port (struct port *);
+struct file *fd_lookup (int fd);
+struct dir *fd_lookup_dir (int fd);
+struct pipe *fd_lookup_pipe (int fd, bool write_end);
+struct port *fd_lookup_port (int fd);
+bool fd_close (int fd);
+void fd_close_all (void);
+bool fd_copy (struct thread *parent);
+bool fd_dup (int fd, struct fd_entry *);
+bool fd_install (int fd, const struct fd_entry *);
+void fd_close_entry (struct fd_entry *);
+
+#endif /* userprog/fd.h */
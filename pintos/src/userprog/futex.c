@@ -0,0 +1,176 @@
+#include "userprog/futex.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* Futexes.
+
+   A futex is a 32-bit word of user memory that user code can use
+   to build locks that stay in user mode when uncontended: only a
+   thread that must wait enters the kernel, with futex_wait(), and
+   only one that releases a lock with waiters does, with
+   futex_wake().
+
+   Waiters are kept in a fixed hash table of wait queues keyed by
+   the physical address of the word, as the kernel's own mapping of
+   physical memory gives it, so that processes that map the same
+   frame, through shared memory, find each other whatever user
+   address each uses.  While it is looked at, the word's page is
+   locked in memory for writing, so that it has a frame of its own
+   rather than the zero page or a copy-on-write frame.  Frames of
+   shared memory segments are wired, so their addresses stay put
+   while waiters sleep.
+
+   Each bucket's lock serializes checking a word against waking
+   it, so that a waiter that has seen the word unchanged is queued
+   before a waker can look for it. */
+
+#define FUTEX_BUCKETS 64
+
+/* A thread waiting in futex_wait(). */
+struct futex_waiter
+  {
+    struct list_elem elem;              /* Element in bucket's `waiters'. */
+    uint32_t *key;                      /* Kernel address of the word. */
+    struct semaphore woken;             /* Upped by futex_wake(). */
+  };
+
+/* A hash bucket of waiters. */
+struct futex_bucket
+  {
+    struct lock lock;                   /* Protects `waiters'. */
+    struct list waiters;                /* Waiting threads. */
+  };
+
+static struct futex_bucket buckets[FUTEX_BUCKETS];
+
+static uint32_t *lock_word (uint32_t *uaddr);
+static void unlock_word (uint32_t *uaddr);
+static struct futex_bucket *find_bucket (uint32_t *key);
+
+/* Initializes the futex wait queues. */
+void
+futex_init (void)
+{
+  size_t i;
+
+  for (i = 0; i < FUTEX_BUCKETS; i++)
+    {
+      lock_init (&buckets[i].lock);
+      list_init (&buckets[i].waiters);
+    }
+}
+
+/* If the word at user address UADDR holds VAL, waits until another
+   thread calls futex_wake() on the same word and returns 0.
+   Otherwise, returns -1 at once.  Also returns -1 if UADDR is not
+   an aligned, writable word of the current process. */
+int
+futex_wait (uint32_t *uaddr, uint32_t val)
+{
+  struct futex_waiter w;
+  struct futex_bucket *b;
+
+  w.key = lock_word (uaddr);
+  if (w.key == NULL)
+    return -1;
+  b = find_bucket (w.key);
+
+  lock_acquire (&b->lock);
+  if (*w.key != val)
+    {
+      lock_release (&b->lock);
+      unlock_word (uaddr);
+      return -1;
+    }
+  sema_init (&w.woken, 0);
+  list_push_back (&b->waiters, &w.elem);
+  lock_release (&b->lock);
+
+  unlock_word (uaddr);
+  sema_down (&w.woken);
+  return 0;
+}
+
+/* Wakes up to CNT threads waiting on the word at user address
+   UADDR, in the order they started waiting, and returns the number
+   woken, or -1 if UADDR is not an aligned, writable word of the
+   current process. */
+int
+futex_wake (uint32_t *uaddr, int cnt)
+{
+  struct futex_bucket *b;
+  struct list_elem *e, *next;
+  uint32_t *key;
+  int woken = 0;
+
+  key = lock_word (uaddr);
+  if (key == NULL)
+    return -1;
+  b = find_bucket (key);
+
+  lock_acquire (&b->lock);
+  for (e = list_begin (&b->waiters);
+       e != list_end (&b->waiters) && woken < cnt; e = next)
+    {
+      struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+
+      next = list_next (e);
+      if (w->key == key)
+        {
+          list_remove (&w->elem);
+          sema_up (&w->woken);
+          woken++;
+        }
+    }
+  lock_release (&b->lock);
+
+  unlock_word (uaddr);
+  return woken;
+}
+
+/* Locks the page holding the word at user address UADDR in memory
+   for writing and returns the kernel address of the word, or a
+   null pointer if UADDR is not an aligned, writable word. */
+static uint32_t *
+lock_word (uint32_t *uaddr)
+{
+  struct thread *t = thread_current ();
+
+  if ((uintptr_t) uaddr % sizeof *uaddr != 0 || !is_user_vaddr (uaddr))
+    return NULL;
+#ifdef VM
+  if (!page_lock (uaddr, true))
+    return NULL;
+  return pagedir_get_page (t->pagedir, uaddr);
+#else
+  /* Without virtual memory, every page of the process stays where
+     it is, but it may be read-only. */
+  if (!pagedir_is_writable (t->pagedir, uaddr))
+    return NULL;
+  return pagedir_get_page (t->pagedir, uaddr);
+#endif
+}
+
+/* Releases the page that lock_word() locked for UADDR. */
+static void
+unlock_word (uint32_t *uaddr UNUSED)
+{
+#ifdef VM
+  page_unlock (uaddr);
+#endif
+}
+
+/* Returns the bucket for the word at kernel address KEY. */
+static struct futex_bucket *
+find_bucket (uint32_t *key)
+{
+  return &buckets[hash_bytes (&key, sizeof key) % FUTEX_BUCKETS];
+}
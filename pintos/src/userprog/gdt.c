@@ -2,8 +2,14 @@
 #include <debug.h>
 #include "userprog/tss.h"
 #include "threads/palloc.h"
+#include "threads/smp.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
+#if SEL_TSS_CNT != THREAD_CPU_CNT
+#error SEL_TSS_CNT must match THREAD_CPU_CNT
+#endif
+
 /* The Global Descriptor Table (GDT).
 
    The GDT, an x86-specific structure, defines segments that can
@@ -17,7 +23,8 @@
    types of segments are of interest: code, data, and TSS or
    Task-State Segment descriptors.  The former two types are
    exactly what they sound like.  The TSS is used primarily for
-   stack switching on interrupts.
+   stack switching on interrupts, so each CPU has a TSS of its
+   own.
 
    For more information on the GDT as used here, refer to
    [IA32-v3a] 3.2 "Using Segments" through 3.5 "System Descriptor
@@ -29,13 +36,14 @@ static uint64_t make_code_desc (int dpl);
 static uint64_t make_data_desc (int dpl);
 static uint64_t make_tss_desc (void *laddr);
 static uint64_t make_gdtr_operand (uint16_t limit, void *base);
+static void load_gdt (void);
 
 /* Sets up a proper GDT.  The bootstrap loader's GDT didn't
    include user-mode selectors or a TSS, but we need both now. */
 void
 gdt_init (void)
 {
-  uint64_t gdtr_operand;
+  int i;
 
   /* Initialize GDT. */
   gdt[SEL_NULL / sizeof *gdt] = 0;
@@ -43,14 +51,31 @@ gdt_init (void)
   gdt[SEL_KDSEG / sizeof *gdt] = make_data_desc (0);
   gdt[SEL_UCSEG / sizeof *gdt] = make_code_desc (3);
   gdt[SEL_UDSEG / sizeof *gdt] = make_data_desc (3);
-  gdt[SEL_TSS / sizeof *gdt] = make_tss_desc (tss_get ());
+  for (i = 0; i < SEL_TSS_CNT; i++)
+    gdt[SEL_TSS / sizeof *gdt + i] = make_tss_desc (tss_get_cpu (i));
+
+  load_gdt ();
+}
+
+/* Loads the GDT that gdt_init() built, and the running CPU's
+   TSS, into a CPU that smp_init() is starting. */
+void
+gdt_init_ap (void)
+{
+  load_gdt ();
+}
+
+/* Loads GDTR, and TR with the running CPU's TSS.  See [IA32-v3a]
+   2.4.1 "Global Descriptor Table Register (GDTR)", 2.4.4 "Task
+   Register (TR)", and 6.2.4 "Task Register".  */
+static void
+load_gdt (void)
+{
+  uint64_t gdtr_operand;
 
-  /* Load GDTR, TR.  See [IA32-v3a] 2.4.1 "Global Descriptor
-     Table Register (GDTR)", 2.4.4 "Task Register (TR)", and
-     6.2.4 "Task Register".  */
   gdtr_operand = make_gdtr_operand (sizeof gdt - 1, gdt);
   asm volatile ("lgdt %0" : : "m" (gdtr_operand));
-  asm volatile ("ltr %w0" : : "q" (SEL_TSS));
+  asm volatile ("ltr %w0" : : "q" (SEL_TSS + 8 * smp_cpu ()));
 }
 
 /* System segment or code/data segment? */
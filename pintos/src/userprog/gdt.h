@@ -7,9 +7,14 @@
    More selectors are defined by the loader in loader.h. */
 #define SEL_UCSEG       0x1B    /* User code selector. */
 #define SEL_UDSEG       0x23    /* User data selector. */
-#define SEL_TSS         0x28    /* Task-state segment. */
-#define SEL_CNT         6       /* Number of segments. */
+#define SEL_TSS         0x28    /* Task-state segment of CPU 0.
+                                   CPU N's is SEL_TSS + 8 * N. */
+#define SEL_TSS_CNT     8       /* Task-state segments, THREAD_CPU_CNT. */
+#define SEL_CNT         (5 + SEL_TSS_CNT) /* Number of segments. */
 
+#ifndef __ASSEMBLER__
 void gdt_init (void);
+void gdt_init_ap (void);
+#endif
 
 #endif /* userprog/gdt.h */
@@ -0,0 +1,316 @@
+#include "userprog/ioring.h"
+#include <debug.h>
+#include <list.h>
+#include <stdint.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/workqueue.h"
+#include "userprog/fd.h"
+#include "userprog/syscall.h"
+
+/* Asynchronous I/O rings.
+
+   A process registers a pair of rings in its own memory with
+   io_setup(), then queues any number of reads and writes in the
+   submission ring and starts them all with one io_enter().  Each
+   operation runs on the kernel work queue, against its own
+   reopened copy of the file, so the process does not block and
+   needs no thread per operation; the disk driver's request queue
+   orders the transfers that reach the disk.
+
+   Workers cannot reach the process's memory, so an operation
+   moves its data through a kernel buffer: a write's data is
+   copied in when it is submitted, and a read's data is copied out
+   when its completion is posted.  Completions are posted to the
+   completion ring by io_enter(), in the process's own context, so
+   a process collects them by polling the ring after any
+   io_enter() call or by asking io_enter() to wait for some.
+
+   No more operations are accepted than the completion ring has
+   free entries for, so posting never overflows it. */
+
+/* An operation, from submission until its completion is posted. */
+struct io_op
+  {
+    struct list_elem elem;      /* Element in context's `done'. */
+    struct io_ctx *ctx;         /* Owning context. */
+    uint32_t opcode;            /* IO_OP_*. */
+    struct file *file;          /* Own copy of the file, or null. */
+    uint8_t *kbuf;              /* Kernel buffer, or null. */
+    void *ubuf;                 /* User buffer. */
+    size_t len;                 /* Bytes to transfer. */
+    off_t offset;               /* Offset in file. */
+    uint32_t user_data;         /* For the completion. */
+    int res;                    /* Result, once done. */
+  };
+
+/* A process's I/O context. */
+struct io_ctx
+  {
+    struct io_ring *ring;       /* Process's rings. */
+    uint32_t entries;           /* Entries in each ring. */
+    struct io_sqe *sqes;        /* Submission ring, in user memory. */
+    struct io_cqe *cqes;        /* Completion ring, in user memory. */
+    unsigned pending;           /* Operations not yet posted. */
+
+    struct lock lock;           /* Protects the members below. */
+    struct condition finished;  /* Signaled when `done' grows. */
+    struct list done;           /* Finished, not yet posted. */
+    unsigned running;           /* Operations on the work queue. */
+  };
+
+static bool submit (struct io_ctx *, const struct io_sqe *);
+static void finish (struct io_op *);
+static wq_func run_op;
+static bool post (struct io_ctx *, struct io_ring *);
+
+/* Registers RING, in user memory, as the current process's I/O
+   rings.  Returns false if the process already has rings, if
+   RING cannot be read, or if its size is not a power of 2 between
+   1 and IO_RING_MAX. */
+bool
+ioring_setup (struct io_ring *uring)
+{
+  struct thread *t = thread_current ();
+  struct io_ring ring;
+  struct io_ctx *ctx;
+
+  if (t->io_ctx != NULL || !syscall_copy_in (&ring, uring, sizeof ring))
+    return false;
+  if (ring.entries == 0 || ring.entries > IO_RING_MAX
+      || (ring.entries & (ring.entries - 1)) != 0)
+    return false;
+
+  ctx = malloc (sizeof *ctx);
+  if (ctx == NULL)
+    return false;
+  ctx->ring = uring;
+  ctx->entries = ring.entries;
+  ctx->sqes = ring.sqes;
+  ctx->cqes = ring.cqes;
+  ctx->pending = 0;
+  lock_init (&ctx->lock);
+  cond_init (&ctx->finished);
+  list_init (&ctx->done);
+  ctx->running = 0;
+  t->io_ctx = ctx;
+  return true;
+}
+
+/* Posts finished operations to the current process's completion
+   ring, then starts up to TO_SUBMIT operations from its
+   submission ring, then waits until at least MIN_COMPLETE
+   completions are waiting in the completion ring or nothing is in
+   flight.  Returns the number of operations started, or -1 if the
+   process has no rings or they cannot be accessed. */
+int
+ioring_enter (unsigned to_submit, unsigned min_complete)
+{
+  struct io_ctx *ctx = thread_current ()->io_ctx;
+  struct io_ring ring;
+  unsigned submitted = 0;
+
+  if (ctx == NULL || !syscall_copy_in (&ring, ctx->ring, sizeof ring))
+    return -1;
+  if (min_complete > ctx->entries)
+    min_complete = ctx->entries;
+
+  if (!post (ctx, &ring))
+    return -1;
+  while (submitted < to_submit && ring.sq_head != ring.sq_tail
+         && ctx->pending + (ring.cq_tail - ring.cq_head) < ctx->entries)
+    {
+      struct io_sqe sqe;
+
+      if (!syscall_copy_in (&sqe, &ctx->sqes[ring.sq_head
+                                              & (ctx->entries - 1)],
+                            sizeof sqe))
+        return -1;
+      if (!submit (ctx, &sqe))
+        break;
+      ring.sq_head++;
+      submitted++;
+    }
+  if (!syscall_copy_out (&ctx->ring->sq_head, &ring.sq_head,
+                         sizeof ring.sq_head))
+    return -1;
+
+  for (;;)
+    {
+      if (!post (ctx, &ring))
+        return -1;
+      if (ring.cq_tail - ring.cq_head >= min_complete || ctx->pending == 0)
+        break;
+
+      lock_acquire (&ctx->lock);
+      while (list_empty (&ctx->done))
+        cond_wait (&ctx->finished, &ctx->lock);
+      lock_release (&ctx->lock);
+    }
+  return submitted;
+}
+
+/* Waits for the current process's operations in flight, if any,
+   and frees its I/O context.  Completions not yet posted are
+   dropped. */
+void
+ioring_destroy (void)
+{
+  struct thread *t = thread_current ();
+  struct io_ctx *ctx = t->io_ctx;
+
+  if (ctx == NULL)
+    return;
+
+  lock_acquire (&ctx->lock);
+  while (ctx->running > 0)
+    cond_wait (&ctx->finished, &ctx->lock);
+  lock_release (&ctx->lock);
+
+  while (!list_empty (&ctx->done))
+    {
+      struct io_op *op = list_entry (list_pop_front (&ctx->done),
+                                     struct io_op, elem);
+      free (op->kbuf);
+      free (op);
+    }
+  free (ctx);
+  t->io_ctx = NULL;
+}
+
+/* Starts the operation that SQE describes.  An operation that
+   cannot start completes at once with result -1.  Returns false,
+   leaving the entry for the next io_enter(), if memory is too short
+   even to track it. */
+static bool
+submit (struct io_ctx *ctx, const struct io_sqe *sqe)
+{
+  struct io_op *op = malloc (sizeof *op);
+  struct file *file;
+
+  if (op == NULL)
+    return false;
+  ctx->pending++;
+  op->ctx = ctx;
+  op->opcode = sqe->opcode;
+  op->file = NULL;
+  op->kbuf = NULL;
+  op->ubuf = sqe->buf;
+  op->len = sqe->len;
+  op->offset = sqe->offset;
+  op->user_data = sqe->user_data;
+  op->res = -1;
+
+  if (op->opcode == IO_OP_NOP)
+    {
+      op->res = 0;
+      finish (op);
+      return true;
+    }
+  if ((op->opcode != IO_OP_READ && op->opcode != IO_OP_WRITE)
+      || (file = fd_lookup (sqe->fd)) == NULL || op->len > IO_LEN_MAX
+      || (op->kbuf = malloc (op->len > 0 ? op->len : 1)) == NULL
+      || (op->opcode == IO_OP_WRITE
+          && !syscall_copy_in (op->kbuf, op->ubuf, op->len))
+      || (op->file = file_reopen (file)) == NULL)
+    {
+      finish (op);
+      return true;
+    }
+
+  lock_acquire (&ctx->lock);
+  ctx->running++;
+  lock_release (&ctx->lock);
+  if (!wq_submit (run_op, op))
+    {
+      lock_acquire (&ctx->lock);
+      ctx->running--;
+      lock_release (&ctx->lock);
+      file_close (op->file);
+      op->file = NULL;
+      finish (op);
+    }
+  return true;
+}
+
+/* Adds OP, which is done, to its context's finished operations. */
+static void
+finish (struct io_op *op)
+{
+  struct io_ctx *ctx = op->ctx;
+
+  lock_acquire (&ctx->lock);
+  list_push_back (&ctx->done, &op->elem);
+  cond_broadcast (&ctx->finished, &ctx->lock);
+  lock_release (&ctx->lock);
+}
+
+/* Work queue function that carries out the operation OP_. */
+static void
+run_op (void *op_)
+{
+  struct io_op *op = op_;
+  struct io_ctx *ctx = op->ctx;
+
+  if (op->opcode == IO_OP_READ)
+    op->res = file_read_at (op->file, op->kbuf, op->len, op->offset);
+  else
+    op->res = file_write_at (op->file, op->kbuf, op->len, op->offset);
+  file_close (op->file);
+  op->file = NULL;
+
+  lock_acquire (&ctx->lock);
+  ctx->running--;
+  list_push_back (&ctx->done, &op->elem);
+  cond_broadcast (&ctx->finished, &ctx->lock);
+  lock_release (&ctx->lock);
+}
+
+/* Posts as many finished operations as fit to the completion
+   ring, copying read data out to the buffers it was read for, and
+   updates RING, a copy of the process's ring header, and the
+   process's CQ_TAIL to match.  Returns false if the completion
+   ring cannot be written. */
+static bool
+post (struct io_ctx *ctx, struct io_ring *ring)
+{
+  uint32_t cq_tail = ring->cq_tail;
+
+  for (;;)
+    {
+      struct io_op *op;
+      struct io_cqe cqe;
+
+      lock_acquire (&ctx->lock);
+      if (list_empty (&ctx->done) || cq_tail - ring->cq_head >= ctx->entries)
+        {
+          lock_release (&ctx->lock);
+          break;
+        }
+      op = list_entry (list_pop_front (&ctx->done), struct io_op, elem);
+      lock_release (&ctx->lock);
+
+      if (op->opcode == IO_OP_READ && op->res > 0
+          && !syscall_copy_out (op->ubuf, op->kbuf, op->res))
+        op->res = -1;
+      cqe.user_data = op->user_data;
+      cqe.res = op->res;
+      free (op->kbuf);
+      free (op);
+      ctx->pending--;
+      if (!syscall_copy_out (&ctx->cqes[cq_tail & (ctx->entries - 1)],
+                             &cqe, sizeof cqe))
+        return false;
+      cq_tail++;
+    }
+
+  if (cq_tail != ring->cq_tail)
+    {
+      ring->cq_tail = cq_tail;
+      if (!syscall_copy_out (&ctx->ring->cq_tail, &cq_tail, sizeof cq_tail))
+        return false;
+    }
+  return true;
+}
@@ -0,0 +1,11 @@
+#ifndef USERPROG_IORING_H
+#define USERPROG_IORING_H
+
+#include <ioring.h>
+#include <stdbool.h>
+
+bool ioring_setup (struct io_ring *);
+int ioring_enter (unsigned to_submit, unsigned min_complete);
+void ioring_destroy (void);
+
+#endif /* userprog/ioring.h */
@@ -3,11 +3,42 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#include "threads/smp.h"
+#include "threads/thread.h"
+
+/* Page directories and page tables freed by pagedir_destroy(),
+   kept for reuse so that processes that come and go quickly do
+   not go through the page allocator.  pagedir_destroy() clears
+   each entry as it walks the tables, so these pages need no
+   zeroing: a recycled page table is all zeros, and a recycled
+   page directory has an empty user half and the kernel half it
+   was created with, which never changes after boot.  Protected by
+   disabling interrupts. */
+#define PAGE_POOL_SIZE 16
+struct page_pool
+  {
+    void *pages[PAGE_POOL_SIZE];
+    size_t cnt;
+  };
+static struct page_pool pd_pool, pt_pool;
+
+/* Page directory in each CPU's CR3, for shootdown().  A CPU
+   running a kernel thread keeps the last process's page directory
+   (see process_activate()), so this may be a page directory that
+   another CPU is changing or destroying.  Protected by disabling
+   interrupts, which takes the kernel lock. */
+static uint32_t *cpu_pds[THREAD_CPU_CNT];
 
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
+static void flush_local (const struct pagedir_batch *);
+static void shootdown (const struct pagedir_batch *);
+static smp_call_func flush_remote;
+static void *pool_get (struct page_pool *);
+static void pool_put (struct page_pool *, void *);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -16,9 +47,18 @@ static void invalidate_pagedir (uint32_t *);
 uint32_t *
 pagedir_create (void) 
 {
-  uint32_t *pd = palloc_get_page (0);
-  if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+  size_t user_pdes = pd_no (PHYS_BASE);
+  uint32_t *pd = pool_get (&pd_pool);
+
+  if (pd == NULL)
+    {
+      pd = palloc_get_page (0);
+      if (pd == NULL)
+        return NULL;
+      memset (pd, 0, user_pdes * sizeof *pd);
+      memcpy (pd + user_pdes, init_page_dir + user_pdes,
+              PGSIZE - user_pdes * sizeof *pd);
+    }
   return pd;
 }
 
@@ -27,24 +67,140 @@ pagedir_create (void)
 void
 pagedir_destroy (uint32_t *pd) 
 {
+  struct pagedir_batch b;
+  enum intr_level old_level;
   uint32_t *pde;
 
   if (pd == NULL)
     return;
 
   ASSERT (pd != init_page_dir);
+
+  /* Make any other CPU still using PD give it up. */
+  pagedir_batch_init (&b, pd);
+  b.full = true;
+  old_level = intr_disable ();
+  shootdown (&b);
+  intr_set_level (old_level);
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
+    if (*pde & PTE_PS)
+      {
+        palloc_free_multiple (ptov (*pde & PTE_ADDR), HUGE_PAGE_CNT);
+        *pde = 0;
+      }
+    else if (*pde & PTE_P) 
       {
         uint32_t *pt = pde_get_pt (*pde);
         uint32_t *pte;
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-          if (*pte & PTE_P) 
-            palloc_free_page (pte_get_page (*pte));
-        palloc_free_page (pt);
+          if (*pte != 0)
+            {
+              if (*pte & PTE_P) 
+                palloc_free_page (pte_get_page (*pte));
+              *pte = 0;
+            }
+        pool_put (&pt_pool, pt);
+        *pde = 0;
+      }
+  pool_put (&pd_pool, pd);
+}
+
+/* Maps in page directory PD, which must map no user pages, a
+   copy of every user page mapped in SRC, with the same access.
+   The copies come from the user pool.  A huge page is copied to a
+   huge page if the user pool has an aligned run free, and to
+   ordinary pages otherwise.  Returns true if successful,
+   false if memory is short, in which case pagedir_destroy() frees
+   the partial copy.  Used for fork() without virtual memory, where
+   the page directory is all there is to a process's address
+   space. */
+bool
+pagedir_copy (uint32_t *pd, uint32_t *src)
+{
+  uint32_t *pde;
+
+  for (pde = src; pde < src + pd_no (PHYS_BASE); pde++)
+    if (*pde & PTE_PS)
+      {
+        void *upage = (void *) ((pde - src) << PDSHIFT);
+        uint8_t *huge = ptov (*pde & PTE_ADDR);
+        bool writable = (*pde & PTE_W) != 0;
+        void *kpage = palloc_get_aligned (PAL_USER, HUGE_PAGE_CNT,
+                                          HUGE_PAGE_CNT);
+        size_t i;
+
+        if (kpage != NULL)
+          {
+            memcpy (kpage, huge, HUGE_PAGE_CNT * PGSIZE);
+            if (pagedir_set_huge (pd, upage, kpage, writable))
+              continue;
+            palloc_free_multiple (kpage, HUGE_PAGE_CNT);
+            return false;
+          }
+        for (i = 0; i < HUGE_PAGE_CNT; i++)
+          {
+            kpage = palloc_get_page (PAL_USER);
+            if (kpage == NULL)
+              return false;
+            memcpy (kpage, huge + i * PGSIZE, PGSIZE);
+            if (!pagedir_set_page (pd, (uint8_t *) upage + i * PGSIZE,
+                                   kpage, writable))
+              {
+                palloc_free_page (kpage);
+                return false;
+              }
+          }
+      }
+    else if (*pde & PTE_P)
+      {
+        uint32_t *pt = pde_get_pt (*pde);
+        size_t i;
+
+        for (i = 0; i < PGSIZE / sizeof *pt; i++)
+          if (pt[i] & PTE_P)
+            {
+              void *upage = (void *) (((pde - src) << PDSHIFT)
+                                      | (i << PTSHIFT));
+              void *kpage = palloc_get_page (PAL_USER);
+
+              if (kpage == NULL)
+                return false;
+              memcpy (kpage, pte_get_page (pt[i]), PGSIZE);
+              if (!pagedir_set_page (pd, upage, kpage,
+                                     (pt[i] & PTE_W) != 0))
+                {
+                  palloc_free_page (kpage);
+                  return false;
+                }
+            }
       }
-  palloc_free_page (pd);
+  return true;
+}
+
+/* Returns a page from POOL, or a null pointer if it is empty. */
+static void *
+pool_get (struct page_pool *pool)
+{
+  enum intr_level old_level = intr_disable ();
+  void *page = pool->cnt > 0 ? pool->pages[--pool->cnt] : NULL;
+  intr_set_level (old_level);
+  return page;
+}
+
+/* Adds PAGE to POOL, or frees it if POOL is full. */
+static void
+pool_put (struct page_pool *pool, void *page)
+{
+  enum intr_level old_level = intr_disable ();
+  if (pool->cnt < PAGE_POOL_SIZE)
+    {
+      pool->pages[pool->cnt++] = page;
+      page = NULL;
+    }
+  intr_set_level (old_level);
+  if (page != NULL)
+    palloc_free_page (page);
 }
 
 /* Returns the address of the page table entry for virtual
@@ -70,7 +226,9 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
     {
       if (create)
         {
-          pt = palloc_get_page (PAL_ZERO);
+          pt = pool_get (&pt_pool);
+          if (pt == NULL)
+            pt = palloc_get_page (PAL_ZERO);
           if (pt == NULL) 
             return NULL; 
       
@@ -80,6 +238,10 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
         return NULL;
     }
 
+  /* A 4 MB page has no page table entries. */
+  if (*pde & PTE_PS)
+    return NULL;
+
   /* Return the page table entry. */
   pt = pde_get_pt (*pde);
   return &pt[pt_no (vaddr)];
@@ -125,10 +287,14 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
 void *
 pagedir_get_page (uint32_t *pd, const void *uaddr) 
 {
-  uint32_t *pte;
+  uint32_t pde, *pte;
 
   ASSERT (is_user_vaddr (uaddr));
   
+  pde = pd[pd_no (uaddr)];
+  if (pde & PTE_PS)
+    return ((uint8_t *) ptov (pde & PTE_ADDR)
+            + ((uintptr_t) uaddr & (PTSPAN - 1)));
   pte = lookup_page (pd, uaddr, false);
   if (pte != NULL && (*pte & PTE_P) != 0)
     return pte_get_page (*pte) + pg_ofs (uaddr);
@@ -152,10 +318,188 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      pagedir_invalidate (pd, upage, 1);
     }
 }
 
+/* Maps the PAGE_CNT user virtual pages starting at UPAGE in
+   page directory PD to the frames at kernel virtual addresses
+   KPAGES[0] through KPAGES[PAGE_CNT - 1], as pagedir_set_page()
+   would one by one, but looking up each page table only once.
+   Returns true if successful.  Returns false, mapping none of the
+   pages, if any of them is already mapped or a page table cannot
+   be allocated. */
+bool
+pagedir_map_range (uint32_t *pd, void *upage, void *const kpages[],
+                   size_t page_cnt, bool writable)
+{
+  uint8_t *page = upage;
+  uint32_t *pte = NULL;
+  size_t i;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (pd != init_page_dir);
+  ASSERT (page_cnt <= (size_t) ((uint8_t *) PHYS_BASE - page) / PGSIZE);
+
+  for (i = 0; i < page_cnt; i++, page += PGSIZE)
+    {
+      ASSERT (pg_ofs (kpages[i]) == 0);
+      ASSERT (vtop (kpages[i]) >> PTSHIFT < init_ram_pages);
+
+      if (i == 0 || pt_no (page) == 0)
+        pte = lookup_page (pd, page, true);
+      else
+        pte++;
+      if (pte == NULL || (*pte & PTE_P) != 0)
+        {
+          pagedir_unmap_range (pd, upage, i);
+          return false;
+        }
+      *pte = pte_create_user (kpages[i], writable);
+    }
+  return true;
+}
+
+/* Marks the PAGE_CNT user virtual pages starting at UPAGE "not
+   present" in page directory PD, like pagedir_clear_page() for
+   each, but looking up each page table only once and
+   invalidating the TLB once, at the end.  The pages need not be
+   mapped. */
+void
+pagedir_unmap_range (uint32_t *pd, void *upage, size_t page_cnt)
+{
+  uint8_t *page = upage;
+  uint32_t *pte = NULL;
+  bool cleared = false;
+  size_t i;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (page_cnt <= (size_t) ((uint8_t *) PHYS_BASE - page) / PGSIZE);
+
+  for (i = 0; i < page_cnt; i++, page += PGSIZE)
+    {
+      if (i == 0 || pt_no (page) == 0)
+        pte = lookup_page (pd, page, false);
+      else if (pte != NULL)
+        pte++;
+      if (pte != NULL && (*pte & PTE_P) != 0)
+        {
+          *pte &= ~PTE_P;
+          cleared = true;
+        }
+    }
+  if (cleared)
+    pagedir_invalidate (pd, upage, page_cnt);
+}
+
+/* Maps the 4 MB of user virtual memory starting at UPAGE in page
+   directory PD to the HUGE_PAGE_CNT physically contiguous pages
+   starting at kernel virtual address KPAGE, with a single page
+   directory entry, so that the whole range takes one TLB entry.
+   Both addresses must be aligned on 4 MB, and the CPU must
+   support 4 MB pages.  Returns true if successful, false if any
+   page in the range is already mapped.
+
+   Other functions in this file see a huge page only through
+   pagedir_get_page() and pagedir_clear_page(); to change part of
+   one, split it with pagedir_split_huge() first. */
+bool
+pagedir_set_huge (uint32_t *pd, void *upage, void *kpage, bool writable)
+{
+  uint32_t *pde;
+
+  ASSERT (init_large_pages);
+  ASSERT (((uintptr_t) upage & (PTSPAN - 1)) == 0);
+  ASSERT (vtop (kpage) % PTSPAN == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (pd != init_page_dir);
+
+  pde = pd + pd_no (upage);
+  if (*pde & PTE_PS)
+    return false;
+  if (*pde & PTE_P)
+    {
+      /* Give back a page table that maps nothing. */
+      uint32_t *pt = pde_get_pt (*pde);
+      size_t i;
+
+      for (i = 0; i < PGSIZE / sizeof *pt; i++)
+        if (pt[i] != 0)
+          return false;
+      pool_put (&pt_pool, pt);
+    }
+  *pde = pde_create_user_large (kpage, writable);
+  return true;
+}
+
+/* Removes the huge page at UPAGE from page directory PD and
+   returns the kernel virtual address of its pages, which the
+   caller now owns.  Returns a null pointer if UPAGE does not
+   begin a huge page. */
+void *
+pagedir_clear_huge (uint32_t *pd, void *upage)
+{
+  uint32_t *pde;
+  void *kpage;
+
+  ASSERT (is_user_vaddr (upage));
+
+  pde = pd + pd_no (upage);
+  if ((*pde & PTE_PS) == 0 || ((uintptr_t) upage & (PTSPAN - 1)) != 0)
+    return NULL;
+  kpage = ptov (*pde & PTE_ADDR);
+  *pde = 0;
+
+  /* INVLPG of any address in a 4 MB page drops the whole page
+     from the TLB. */
+  pagedir_invalidate (pd, upage, 1);
+  return kpage;
+}
+
+/* If the user virtual address UADDR lies in a huge page in page
+   directory PD, replaces that page's page directory entry by a
+   page table that maps the same pages, with the same access, one
+   by one, so that they can be unmapped or changed individually.
+   Returns true if successful or UADDR is not in a huge page,
+   false if no page table could be allocated. */
+bool
+pagedir_split_huge (uint32_t *pd, void *uaddr)
+{
+  uint32_t *pde, *pt;
+  uint8_t *kpage;
+  bool writable;
+  size_t i;
+
+  ASSERT (is_user_vaddr (uaddr));
+
+  pde = pd + pd_no (uaddr);
+  if ((*pde & PTE_PS) == 0)
+    return true;
+  pt = pool_get (&pt_pool);
+  if (pt == NULL)
+    pt = palloc_get_page (PAL_ZERO);
+  if (pt == NULL)
+    return false;
+
+  kpage = ptov (*pde & PTE_ADDR);
+  writable = (*pde & PTE_W) != 0;
+  for (i = 0; i < HUGE_PAGE_CNT; i++)
+    pt[i] = (pte_create_user (kpage + i * PGSIZE, writable)
+             | (*pde & (PTE_A | PTE_D)));
+  *pde = pde_create (pt);
+  pagedir_invalidate (pd, pg_round_down (uaddr), 1);
+  return true;
+}
+
+/* Returns true if PD maps virtual page VPAGE present and
+   writable. */
+bool
+pagedir_is_writable (uint32_t *pd, const void *vpage) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  return pte != NULL && (*pte & (PTE_P | PTE_W)) == (PTE_P | PTE_W);
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
@@ -180,7 +524,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          pagedir_invalidate (pd, vpage, 1);
         }
     }
 }
@@ -209,7 +553,13 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+
+          /* Only this CPU's TLB is flushed.  A stale entry on
+             another CPU keeps it from setting the accessed bit
+             again, which only makes the page look idle to page
+             replacement until that CPU next flushes. */
+          if (active_pd () == pd)
+            asm volatile ("invlpg (%0)" : : "r" (vpage) : "memory");
         }
     }
 }
@@ -219,6 +569,8 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
 void
 pagedir_activate (uint32_t *pd) 
 {
+  enum intr_level old_level;
+
   if (pd == NULL)
     pd = init_page_dir;
 
@@ -227,7 +579,17 @@ pagedir_activate (uint32_t *pd)
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base
      Address of the Page Directory". */
+  old_level = intr_disable ();
+  cpu_pds[smp_cpu ()] = pd;
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
+  intr_set_level (old_level);
+}
+
+/* Returns true if PD is the page directory in CR3. */
+bool
+pagedir_is_active (uint32_t *pd) 
+{
+  return active_pd () == pd;
 }
 
 /* Returns the currently active page directory. */
@@ -261,3 +623,166 @@ invalidate_pagedir (uint32_t *pd)
       pagedir_activate (pd);
     } 
 }
+
+/* Invalidating more pages than this one by one costs more than
+   flushing the whole TLB and refilling it. */
+#define INVLPG_MAX 32
+
+/* Invalidates the TLB entries for the PAGE_CNT pages starting at
+   the user virtual page that contains UPAGE in PD, after their
+   page table entries have been changed, as a batch of one range;
+   see pagedir_batch_flush(). */
+void
+pagedir_invalidate (uint32_t *pd, const void *upage, size_t page_cnt) 
+{
+  struct pagedir_batch b;
+
+  pagedir_batch_init (&b, pd);
+  pagedir_batch_add (&b, upage, page_cnt);
+  pagedir_batch_flush (&b);
+}
+
+/* Carries out B's invalidations in the running CPU's TLB.
+   Nothing needs to be done unless B's page directory is active.
+   Each page is invalidated with INVLPG, which leaves the rest of
+   the TLB alone, unless B is full, which flushes the whole TLB
+   instead.  See [IA32-v2a] "INVLPG--Invalidate TLB Entry". */
+static void
+flush_local (const struct pagedir_batch *b)
+{
+  size_t i, j;
+
+  if (active_pd () != b->pd)
+    return;
+  if (b->full)
+    {
+      invalidate_pagedir (b->pd);
+      return;
+    }
+  for (i = 0; i < b->range_cnt; i++)
+    for (j = 0; j < b->ranges[i].page_cnt; j++)
+      asm volatile ("invlpg (%0)"
+                    : : "r" (b->ranges[i].start + j * PGSIZE) : "memory");
+}
+
+/* Carries out B's invalidations on the other CPUs that have B's
+   page directory active, with one cross-CPU call for the whole
+   batch, and waits for them.  CPUs without it active are left
+   alone.  Other CPUs load their TLBs from page tables, so a
+   changed entry needs a flush there whether or not the change
+   would have needed one here.  Must be called with interrupts
+   off, so that the running CPU, which the caller flushes itself,
+   does not change. */
+static void
+shootdown (const struct pagedir_batch *b)
+{
+  uint32_t mask = 0;
+  int self, cpu;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (smp_cpu_cnt == 1)
+    return;
+  self = smp_cpu ();
+  for (cpu = 0; cpu < THREAD_CPU_CNT; cpu++)
+    if (cpu != self && cpu_pds[cpu] == b->pd)
+      mask |= 1u << cpu;
+  if (mask != 0)
+    smp_call (mask, flush_remote, (void *) b);
+}
+
+/* Carries out the batch B_ of invalidations, sent by shootdown(),
+   on the running CPU.  A CPU that only borrowed B_'s page
+   directory for a kernel thread gives it up for the kernel's
+   instead, which flushes the TLB: it is not in a position to
+   know when the page directory is freed. */
+static void
+flush_remote (void *b_)
+{
+  const struct pagedir_batch *b = b_;
+
+  if (active_pd () != b->pd)
+    return;
+  if (thread_current ()->pagedir != b->pd)
+    pagedir_activate (NULL);
+  else
+    flush_local (b);
+}
+
+/* Initializes B as an empty batch of invalidations in PD. */
+void
+pagedir_batch_init (struct pagedir_batch *b, uint32_t *pd)
+{
+  b->pd = pd;
+  b->page_cnt = 0;
+  b->range_cnt = 0;
+  b->full = false;
+}
+
+/* Adds to B the PAGE_CNT pages starting at the user virtual page
+   that contains UPAGE.  A range that continues the last one is
+   merged into it.  Once B holds more pages than are worth
+   invalidating one by one, or more ranges than it can track, it
+   just remembers to flush the whole TLB. */
+void
+pagedir_batch_add (struct pagedir_batch *b, const void *upage,
+                   size_t page_cnt)
+{
+  uintptr_t start = (uintptr_t) pg_round_down (upage);
+
+  if (b->full || page_cnt == 0)
+    return;
+  b->page_cnt += page_cnt;
+  if (b->page_cnt > INVLPG_MAX)
+    b->full = true;
+  else if (b->range_cnt > 0
+           && (b->ranges[b->range_cnt - 1].start
+               + b->ranges[b->range_cnt - 1].page_cnt * PGSIZE) == start)
+    b->ranges[b->range_cnt - 1].page_cnt += page_cnt;
+  else if (b->range_cnt < PAGEDIR_BATCH_RANGES)
+    {
+      b->ranges[b->range_cnt].start = start;
+      b->ranges[b->range_cnt].page_cnt = page_cnt;
+      b->range_cnt++;
+    }
+  else
+    b->full = true;
+}
+
+/* Marks user virtual page UPAGE "not present" in B's page
+   directory, like pagedir_clear_page(), but leaves invalidating
+   its TLB entry to pagedir_batch_flush(). */
+void
+pagedir_batch_clear_page (struct pagedir_batch *b, void *upage)
+{
+  uint32_t *pte;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  pte = lookup_page (b->pd, upage, false);
+  if (pte != NULL && (*pte & PTE_P) != 0)
+    {
+      *pte &= ~PTE_P;
+      pagedir_batch_add (b, upage, 1);
+    }
+}
+
+/* Carries out the invalidations collected in B, in the running
+   CPU's TLB and, with one shootdown for the whole batch, in those
+   of the other CPUs that have B's page directory active, and
+   empties B. */
+void
+pagedir_batch_flush (struct pagedir_batch *b)
+{
+  enum intr_level old_level;
+
+  if (b->full || b->range_cnt > 0)
+    {
+      old_level = intr_disable ();
+      shootdown (b);
+      flush_local (b);
+      intr_set_level (old_level);
+    }
+  pagedir_batch_init (b, b->pd);
+}
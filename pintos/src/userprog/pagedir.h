@@ -2,17 +2,61 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/* Pages in a huge page, which a single page directory entry
+   maps. */
+#define HUGE_PAGE_CNT 1024
+
+/* Maximum number of separate page ranges in a pagedir_batch. */
+#define PAGEDIR_BATCH_RANGES 8
+
+/* TLB invalidations in one page directory, collected while its
+   page table entries are changed and carried out together by
+   pagedir_batch_flush(), here and on the other CPUs that have the
+   page directory active, with one cross-CPU call.  Until then the affected pages may still
+   be reachable through stale TLB entries, so the caller must not
+   touch them. */
+struct pagedir_batch
+  {
+    uint32_t *pd;               /* Page directory. */
+    size_t page_cnt;            /* Pages in RANGES. */
+    size_t range_cnt;           /* Ranges in use. */
+    bool full;                  /* Flush the whole TLB instead? */
+    struct
+      {
+        uintptr_t start;        /* First page's address. */
+        size_t page_cnt;        /* Number of pages. */
+      }
+    ranges[PAGEDIR_BATCH_RANGES];
+  };
+
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
+bool pagedir_copy (uint32_t *pd, uint32_t *src);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
+bool pagedir_map_range (uint32_t *pd, void *upage, void *const kpages[],
+                        size_t page_cnt, bool writable);
+void pagedir_unmap_range (uint32_t *pd, void *upage, size_t page_cnt);
+bool pagedir_set_huge (uint32_t *pd, void *upage, void *kpage, bool rw);
+void *pagedir_clear_huge (uint32_t *pd, void *upage);
+bool pagedir_split_huge (uint32_t *pd, void *upage);
+bool pagedir_is_writable (uint32_t *pd, const void *upage);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
 void pagedir_activate (uint32_t *pd);
+bool pagedir_is_active (uint32_t *pd);
+void pagedir_invalidate (uint32_t *pd, const void *upage, size_t page_cnt);
+
+void pagedir_batch_init (struct pagedir_batch *, uint32_t *pd);
+void pagedir_batch_add (struct pagedir_batch *, const void *upage,
+                        size_t page_cnt);
+void pagedir_batch_clear_page (struct pagedir_batch *, void *upage);
+void pagedir_batch_flush (struct pagedir_batch *);
 
 #endif /* userprog/pagedir.h */
@@ -0,0 +1,315 @@
+#include "userprog/pipe.h"
+#include <debug.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Pipes.
+
+   A pipe is a ring buffer of PIPE_BYTES bytes with a read end and
+   a write end, each of which may be open in any number of
+   descriptors.  Readers wait while the pipe is empty and writers
+   while it is full, on condition variables under the pipe's lock.
+   A read returns whatever is available, up to the amount asked
+   for, and 0 once the pipe is empty and no write end is open.  A
+   write does not return until all of its data is in the pipe, or
+   until no read end is left to consume it.
+
+   Every change in what can be done with a pipe wakes its wait
+   queue as well, for poll().
+
+   Data moves between the ring and its source or destination
+   through a copy function, so that pipe_splice_from() and
+   pipe_splice_to() can move file data through the file system's
+   cache directly, without it passing through a user buffer. */
+
+#define PIPE_BYTES (PIPE_PAGES * PGSIZE)
+
+/* A pipe. */
+struct pipe
+  {
+    struct lock lock;                   /* Protects all members. */
+    struct condition not_empty;         /* Signaled when data arrives. */
+    struct condition not_full;          /* Signaled when data leaves. */
+    uint8_t *buffer;                    /* PIPE_BYTES of ring buffer. */
+    size_t head;                        /* Offset of first byte. */
+    size_t used;                        /* Bytes in the buffer. */
+    unsigned readers;                   /* Open read ends. */
+    unsigned writers;                   /* Open write ends. */
+    struct wait_queue pollers;          /* Woken on any change. */
+  };
+
+/* Copies up to SIZE bytes between the ring buffer at RING and the
+   source or destination AUX, and returns the number copied, which
+   is less than SIZE only at end of file or when the disk is full. */
+typedef size_t copy_func (uint8_t *ring, size_t size, void *aux);
+
+static copy_func copy_to_ring, copy_from_ring;
+static copy_func read_file, write_file;
+static int transfer_in (struct pipe *, size_t, copy_func *, void *);
+static int transfer_out (struct pipe *, size_t, copy_func *, void *);
+
+/* Creates a pipe with one read end and one write end open.
+   Returns a null pointer if memory is short. */
+struct pipe *
+pipe_create (void)
+{
+  struct pipe *p = malloc (sizeof *p);
+
+  if (p == NULL)
+    return NULL;
+  p->buffer = palloc_get_multiple (0, PIPE_PAGES);
+  if (p->buffer == NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  lock_init (&p->lock);
+  cond_init (&p->not_empty);
+  cond_init (&p->not_full);
+  wait_queue_init (&p->pollers);
+  p->head = p->used = 0;
+  p->readers = p->writers = 1;
+  return p;
+}
+
+/* Opens another reference to P's write end if WRITE_END is true,
+   otherwise to its read end. */
+void
+pipe_dup (struct pipe *p, bool write_end)
+{
+  lock_acquire (&p->lock);
+  if (write_end)
+    p->writers++;
+  else
+    p->readers++;
+  lock_release (&p->lock);
+}
+
+/* Closes a reference to P's write end if WRITE_END is true,
+   otherwise to its read end, waking threads waiting on the other
+   end, and frees P once both ends are closed. */
+void
+pipe_close (struct pipe *p, bool write_end)
+{
+  bool dead;
+
+  lock_acquire (&p->lock);
+  if (write_end)
+    {
+      ASSERT (p->writers > 0);
+      p->writers--;
+      cond_broadcast (&p->not_empty, &p->lock);
+    }
+  else
+    {
+      ASSERT (p->readers > 0);
+      p->readers--;
+      cond_broadcast (&p->not_full, &p->lock);
+    }
+  wait_queue_wake (&p->pollers);
+  dead = p->readers == 0 && p->writers == 0;
+  lock_release (&p->lock);
+
+  if (dead)
+    {
+      palloc_free_multiple (p->buffer, PIPE_PAGES);
+      free (p);
+    }
+}
+
+/* Reads up to SIZE bytes from P into BUFFER, waiting until at
+   least one byte is available.  Returns the number of bytes
+   read, 0 at end of file. */
+int
+pipe_read (struct pipe *p, void *buffer, size_t size)
+{
+  return transfer_out (p, size, copy_from_ring, &buffer);
+}
+
+/* Writes the SIZE bytes in BUFFER into P, waiting for room as
+   needed.  Returns SIZE, or the number of bytes written before
+   the last read end was closed, or -1 if none were. */
+int
+pipe_write (struct pipe *p, const void *buffer, size_t size)
+{
+  return transfer_in (p, size, copy_to_ring, &buffer);
+}
+
+/* Moves up to SIZE bytes from FILE, starting at its current
+   position, into P, waiting for room as needed.  Returns the
+   number of bytes moved, which is less than SIZE at end of file,
+   or -1 if no read end is open. */
+int
+pipe_splice_from (struct pipe *p, struct file *file, size_t size)
+{
+  return transfer_in (p, size, read_file, file);
+}
+
+/* Moves up to SIZE bytes from P into FILE, at its current
+   position, waiting until at least one byte is available.
+   Returns the number of bytes moved, which is 0 at end of file. */
+int
+pipe_splice_to (struct pipe *p, struct file *file, size_t size)
+{
+  return transfer_out (p, size, write_file, file);
+}
+
+/* Moves SIZE bytes into P with COPY and AUX, a contiguous chunk
+   of the ring at a time.  Returns the number of bytes moved, and
+   -1 if no read end is open before any are. */
+static int
+transfer_in (struct pipe *p, size_t size, copy_func *copy, void *aux)
+{
+  size_t done = 0;
+  bool broken = false;
+
+  lock_acquire (&p->lock);
+  while (done < size)
+    {
+      size_t tail, chunk, cnt;
+
+      while (p->used == PIPE_BYTES && p->readers > 0)
+        cond_wait (&p->not_full, &p->lock);
+      if (p->readers == 0)
+        {
+          broken = true;
+          break;
+        }
+
+      /* Free space runs from the tail to the head, or to the end
+         of the ring if the data does not wrap around. */
+      tail = (p->head + p->used) % PIPE_BYTES;
+      chunk = tail < p->head ? p->head - tail : PIPE_BYTES - tail;
+      if (chunk > size - done)
+        chunk = size - done;
+
+      cnt = copy (p->buffer + tail, chunk, aux);
+      p->used += cnt;
+      done += cnt;
+      if (cnt > 0)
+        {
+          cond_broadcast (&p->not_empty, &p->lock);
+          wait_queue_wake (&p->pollers);
+        }
+      if (cnt < chunk)
+        break;
+    }
+  lock_release (&p->lock);
+  return broken && done == 0 ? -1 : (int) done;
+}
+
+/* Moves up to SIZE bytes out of P with COPY and AUX, waiting
+   until at least one byte is available.  Returns the number of
+   bytes moved, 0 if no write end is open and P is empty. */
+static int
+transfer_out (struct pipe *p, size_t size, copy_func *copy, void *aux)
+{
+  size_t done = 0;
+
+  lock_acquire (&p->lock);
+  while (p->used == 0 && p->writers > 0 && size > 0)
+    cond_wait (&p->not_empty, &p->lock);
+  while (done < size && p->used > 0)
+    {
+      size_t chunk = PIPE_BYTES - p->head, cnt;
+
+      if (chunk > p->used)
+        chunk = p->used;
+      if (chunk > size - done)
+        chunk = size - done;
+
+      cnt = copy (p->buffer + p->head, chunk, aux);
+      p->head = (p->head + cnt) % PIPE_BYTES;
+      p->used -= cnt;
+      done += cnt;
+      if (cnt < chunk)
+        break;
+    }
+  if (done > 0)
+    {
+      cond_broadcast (&p->not_full, &p->lock);
+      wait_queue_wake (&p->pollers);
+    }
+  lock_release (&p->lock);
+  return done;
+}
+
+/* Returns the poll() events that P's write end, if WRITE_END is
+   true, or its read end is ready for: POLLIN if reading will not
+   block, POLLOUT if writing will not, POLLHUP once the other end is
+   closed, and POLLERR for a write end that nobody can read. */
+unsigned
+pipe_events (struct pipe *p, bool write_end)
+{
+  unsigned events = 0;
+
+  lock_acquire (&p->lock);
+  if (write_end)
+    {
+      if (p->readers == 0)
+        events |= POLLOUT | POLLERR | POLLHUP;
+      else if (p->used < PIPE_BYTES)
+        events |= POLLOUT;
+    }
+  else
+    {
+      if (p->used > 0)
+        events |= POLLIN;
+      if (p->writers == 0)
+        events |= POLLIN | POLLHUP;
+    }
+  lock_release (&p->lock);
+  return events;
+}
+
+/* Returns the wait queue that P wakes on any change in its
+   pipe_events(). */
+struct wait_queue *
+pipe_wait_queue (struct pipe *p)
+{
+  return &p->pollers;
+}
+
+/* Copy function that copies into the ring from the buffer that
+   *AUX points to, advancing *AUX. */
+static size_t
+copy_to_ring (uint8_t *ring, size_t size, void *aux)
+{
+  const uint8_t **buffer = aux;
+
+  memcpy (ring, *buffer, size);
+  *buffer += size;
+  return size;
+}
+
+/* Copy function that copies out of the ring into the buffer that
+   *AUX points to, advancing *AUX. */
+static size_t
+copy_from_ring (uint8_t *ring, size_t size, void *aux)
+{
+  uint8_t **buffer = aux;
+
+  memcpy (*buffer, ring, size);
+  *buffer += size;
+  return size;
+}
+
+/* Copy function that reads into the ring from the file AUX. */
+static size_t
+read_file (uint8_t *ring, size_t size, void *aux)
+{
+  return file_read (aux, ring, size);
+}
+
+/* Copy function that writes out of the ring into the file AUX. */
+static size_t
+write_file (uint8_t *ring, size_t size, void *aux)
+{
+  return file_write (aux, ring, size);
+}
@@ -0,0 +1,23 @@
+#ifndef USERPROG_PIPE_H
+#define USERPROG_PIPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct file;
+struct wait_queue;
+
+/* Size of a pipe's ring buffer, in pages. */
+#define PIPE_PAGES 4
+
+struct pipe *pipe_create (void);
+void pipe_dup (struct pipe *, bool write_end);
+void pipe_close (struct pipe *, bool write_end);
+int pipe_read (struct pipe *, void *, size_t);
+int pipe_write (struct pipe *, const void *, size_t);
+int pipe_splice_from (struct pipe *, struct file *, size_t);
+int pipe_splice_to (struct pipe *, struct file *, size_t);
+unsigned pipe_events (struct pipe *, bool write_end);
+struct wait_queue *pipe_wait_queue (struct pipe *);
+
+#endif /* userprog/pipe.h */
@@ -0,0 +1,132 @@
+#include "userprog/poll.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include "devices/input.h"
+#include "devices/tty.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "userprog/fd.h"
+#include "userprog/pipe.h"
+#include "userprog/port.h"
+
+/* Waiting for readiness on many descriptors at once.
+
+   Every object that can block a reader or writer, the console
+   input buffer, pipes, and ports, keeps a wait queue that it wakes
+   whenever what can be done with it changes.  poll_fds() adds an
+   entry naming one semaphore to the queue of each descriptor's
+   object, then checks them all, and sleeps on the semaphore until
+   one of the objects changes or the timeout passes, checking again
+   each time it wakes.  Since the entries go in before the first
+   check, no change after the check can be missed.  Files,
+   directories, and console output never block, so they are always
+   ready. */
+
+static unsigned fd_events (int fd, struct wait_queue **);
+
+/* Waits until at least one of the CNT descriptors in FDS is ready
+   for one of the events it asks for, or until TIMEOUT milliseconds
+   have passed, forever if TIMEOUT is negative.  Sets each one's
+   `revents' and returns the number of descriptors with any, or -1
+   if memory is short. */
+int
+poll_fds (struct pollfd *fds, size_t cnt, int timeout)
+{
+  struct wait_entry *entries = NULL;
+  struct semaphore sema;
+  int64_t deadline = 0;
+  bool timed_out = false;
+  size_t i;
+  int ready;
+
+  if (cnt > 0)
+    {
+      entries = malloc (cnt * sizeof *entries);
+      if (entries == NULL)
+        return -1;
+    }
+  sema_init (&sema, 0);
+  for (i = 0; i < cnt; i++)
+    {
+      struct wait_queue *q;
+
+      fd_events (fds[i].fd, &q);
+      if (q != NULL)
+        wait_queue_add (q, &entries[i], &sema);
+      else
+        entries[i].sema = NULL;
+    }
+  if (timeout > 0)
+    deadline = timer_ticks () + DIV_ROUND_UP ((int64_t) timeout * TIMER_FREQ,
+                                             1000);
+
+  for (;;)
+    {
+      ready = 0;
+      for (i = 0; i < cnt; i++)
+        {
+          unsigned events = fd_events (fds[i].fd, NULL);
+          fds[i].revents = events & (fds[i].events | POLLERR | POLLHUP
+                                     | POLLNVAL);
+          if (fds[i].revents != 0)
+            ready++;
+        }
+      if (ready > 0 || timeout == 0 || timed_out)
+        break;
+
+      if (timeout < 0)
+        sema_down (&sema);
+      else if (!sema_down_timeout (&sema, deadline - timer_ticks ()))
+        timed_out = true;
+    }
+
+  for (i = 0; i < cnt; i++)
+    if (entries[i].sema != NULL)
+      wait_queue_remove (&entries[i]);
+  free (entries);
+  return ready;
+}
+
+/* Returns the poll() events that descriptor FD of the current
+   process is ready for, or POLLNVAL if it is not open.  If Q is
+   nonnull, stores in *Q the wait queue woken when that changes, or
+   a null pointer if it never does. */
+static unsigned
+fd_events (int fd, struct wait_queue **q)
+{
+  struct wait_queue *queue = NULL;
+  struct pipe *pipe;
+  struct port *port;
+  unsigned events;
+
+  if (fd == STDIN_FILENO)
+    {
+      queue = input_wait_queue ();
+      events = tty_readable () ? POLLIN : 0;
+    }
+  else if (fd == STDOUT_FILENO)
+    events = POLLOUT;
+  else if (fd_lookup (fd) != NULL)
+    events = POLLIN | POLLOUT;
+  else if (fd_lookup_dir (fd) != NULL)
+    events = POLLIN;
+  else if ((pipe = fd_lookup_pipe (fd, false)) != NULL
+           || (pipe = fd_lookup_pipe (fd, true)) != NULL)
+    {
+      queue = pipe_wait_queue (pipe);
+      events = pipe_events (pipe, fd_lookup_pipe (fd, true) != NULL);
+    }
+  else if ((port = fd_lookup_port (fd)) != NULL)
+    {
+      queue = port_wait_queue (port);
+      events = port_events (port);
+    }
+  else
+    events = POLLNVAL;
+
+  if (q != NULL)
+    *q = queue;
+  return events;
+}
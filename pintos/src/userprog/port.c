@@ -0,0 +1,408 @@
+#include "userprog/port.h"
+#include <debug.h>
+#include <poll.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#endif
+
+/* Message ports.
+
+   A port is a queue of messages that any process holding a
+   descriptor for it may send to or receive from.  Each message is
+   received whole by one receiver, in the order sent.
+
+   A message smaller than a page is copied into the port's ring
+   buffer and out again.  A larger one travels as pages instead:
+   each whole page of a page-aligned sender's buffer is moved out
+   of the sender's address space, leaving a page of zeros behind,
+   and into the receiver's, if its buffer is page-aligned too,
+   without its bytes being copied.  Pages that cannot be moved,
+   such as the partial page at the end of a message, pages of
+   unaligned buffers, and pages of memory-mapped files, are copied
+   into and out of pages of the kernel's own instead.  Under
+   virtual memory the pages in flight are frames pinned in the
+   frame table, so the number of them a port holds is limited.
+
+   The caller has the user buffer locked in memory throughout, as
+   for any system call, and for writing if MOVABLE is true, which
+   is what allows its pages to be moved. */
+
+#define PORT_MSG_MAX (PORT_MSG_PAGES * PGSIZE) /* Largest message. */
+#define PORT_RING_PAGES 2
+#define PORT_RING_BYTES (PORT_RING_PAGES * PGSIZE)
+#define PORT_QUEUE_LEN 16               /* Most messages queued. */
+#define PORT_PAGES_MAX PORT_MSG_PAGES   /* Most pages queued. */
+
+/* A page of a message in flight. */
+struct msg_page
+  {
+    void *kpage;                        /* Kernel virtual address. */
+#ifdef VM
+    struct frame *frame;                /* Frame, pinned, with no pages. */
+#endif
+  };
+
+/* A queued message. */
+struct message
+  {
+    size_t size;                        /* Size in bytes. */
+    struct msg_page *pages;             /* Pages, or null if the message
+                                           is in the ring buffer. */
+  };
+
+/* A port. */
+struct port
+  {
+    struct lock lock;                   /* Protects all members. */
+    struct condition not_empty;         /* Signaled when a message arrives. */
+    struct condition not_full;          /* Signaled when one leaves. */
+    unsigned ref_cnt;                   /* Open descriptors. */
+    uint8_t *ring;                      /* PORT_RING_BYTES of ring buffer. */
+    size_t ring_head;                   /* Offset of first byte. */
+    size_t ring_used;                   /* Bytes in the ring. */
+    struct message queue[PORT_QUEUE_LEN]; /* Messages, a ring too. */
+    size_t queue_head;                  /* Index of first message. */
+    size_t queue_cnt;                   /* Messages queued. */
+    size_t page_cnt;                    /* Pages in queued messages. */
+    struct wait_queue pollers;          /* Woken on any change. */
+  };
+
+static struct msg_page *make_pages (const uint8_t *, size_t, bool movable);
+static void deliver_pages (struct msg_page *, size_t msg_size,
+                           uint8_t *, size_t, bool movable);
+static void free_pages (struct msg_page *, size_t cnt);
+static bool take_page (uint8_t *upage, struct msg_page *);
+static bool give_page (uint8_t *upage, struct msg_page *);
+static bool alloc_page (struct msg_page *);
+static void free_page (struct msg_page *);
+
+/* Creates a port with one reference.  Returns a null pointer if
+   memory is short. */
+struct port *
+port_create (void)
+{
+  struct port *p = malloc (sizeof *p);
+
+  if (p == NULL)
+    return NULL;
+  p->ring = palloc_get_multiple (0, PORT_RING_PAGES);
+  if (p->ring == NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  lock_init (&p->lock);
+  cond_init (&p->not_empty);
+  cond_init (&p->not_full);
+  wait_queue_init (&p->pollers);
+  p->ref_cnt = 1;
+  p->ring_head = p->ring_used = 0;
+  p->queue_head = p->queue_cnt = 0;
+  p->page_cnt = 0;
+  return p;
+}
+
+/* Opens another reference to P. */
+void
+port_dup (struct port *p)
+{
+  lock_acquire (&p->lock);
+  p->ref_cnt++;
+  lock_release (&p->lock);
+}
+
+/* Closes a reference to P, freeing P and any messages left in it
+   once none is left. */
+void
+port_close (struct port *p)
+{
+  bool dead;
+
+  lock_acquire (&p->lock);
+  ASSERT (p->ref_cnt > 0);
+  dead = --p->ref_cnt == 0;
+  lock_release (&p->lock);
+
+  if (dead)
+    {
+      for (; p->queue_cnt > 0; p->queue_cnt--)
+        {
+          struct message *m = &p->queue[p->queue_head];
+          if (m->pages != NULL)
+            free_pages (m->pages, DIV_ROUND_UP (m->size, PGSIZE));
+          p->queue_head = (p->queue_head + 1) % PORT_QUEUE_LEN;
+        }
+      palloc_free_multiple (p->ring, PORT_RING_PAGES);
+      free (p);
+    }
+}
+
+/* Sends the SIZE bytes in BUFFER to P as one message, waiting for
+   room as needed.  Returns SIZE, or -1 if SIZE exceeds
+   PORT_MSG_MAX or memory is short. */
+int
+port_send (struct port *p, const void *buffer, size_t size, bool movable)
+{
+  struct msg_page *pages = NULL;
+  size_t page_cnt = 0;
+  struct message *m;
+
+  if (size > PORT_MSG_MAX)
+    return -1;
+  if (size >= PGSIZE)
+    {
+      pages = make_pages (buffer, size, movable);
+      if (pages == NULL)
+        return -1;
+      page_cnt = DIV_ROUND_UP (size, PGSIZE);
+    }
+
+  lock_acquire (&p->lock);
+  while (p->queue_cnt == PORT_QUEUE_LEN
+         || (pages == NULL && PORT_RING_BYTES - p->ring_used < size)
+         || p->page_cnt + page_cnt > PORT_PAGES_MAX)
+    cond_wait (&p->not_full, &p->lock);
+
+  m = &p->queue[(p->queue_head + p->queue_cnt++) % PORT_QUEUE_LEN];
+  m->size = size;
+  m->pages = pages;
+  p->page_cnt += page_cnt;
+  if (pages == NULL)
+    {
+      /* Copy into the free space, which may wrap around. */
+      size_t tail = (p->ring_head + p->ring_used) % PORT_RING_BYTES;
+      size_t chunk = size < PORT_RING_BYTES - tail ? size
+                                                   : PORT_RING_BYTES - tail;
+
+      memcpy (p->ring + tail, buffer, chunk);
+      memcpy (p->ring, (const uint8_t *) buffer + chunk, size - chunk);
+      p->ring_used += size;
+    }
+  cond_signal (&p->not_empty, &p->lock);
+  wait_queue_wake (&p->pollers);
+  lock_release (&p->lock);
+  return size;
+}
+
+/* Receives the next message from P into BUFFER, waiting until
+   there is one.  Stores at most SIZE bytes, discarding the rest of
+   a longer message, and returns the number stored. */
+int
+port_recv (struct port *p, void *buffer, size_t size, bool movable)
+{
+  struct message m;
+  size_t n;
+
+  lock_acquire (&p->lock);
+  while (p->queue_cnt == 0)
+    cond_wait (&p->not_empty, &p->lock);
+  m = p->queue[p->queue_head];
+  p->queue_head = (p->queue_head + 1) % PORT_QUEUE_LEN;
+  p->queue_cnt--;
+  n = size < m.size ? size : m.size;
+  if (m.pages == NULL)
+    {
+      size_t chunk = n < PORT_RING_BYTES - p->ring_head
+                     ? n : PORT_RING_BYTES - p->ring_head;
+
+      memcpy (buffer, p->ring + p->ring_head, chunk);
+      memcpy ((uint8_t *) buffer + chunk, p->ring, n - chunk);
+      p->ring_head = (p->ring_head + m.size) % PORT_RING_BYTES;
+      p->ring_used -= m.size;
+    }
+  else
+    p->page_cnt -= DIV_ROUND_UP (m.size, PGSIZE);
+  cond_broadcast (&p->not_full, &p->lock);
+  wait_queue_wake (&p->pollers);
+  lock_release (&p->lock);
+
+  /* The message's pages are ours now. */
+  if (m.pages != NULL)
+    deliver_pages (m.pages, m.size, buffer, size, movable);
+  return n;
+}
+
+/* Returns the poll() events that P is ready for: POLLIN if a
+   message is queued, and POLLOUT if there is room for a message of
+   any size. */
+unsigned
+port_events (struct port *p)
+{
+  unsigned events = 0;
+
+  lock_acquire (&p->lock);
+  if (p->queue_cnt > 0)
+    events |= POLLIN;
+  if (p->queue_cnt < PORT_QUEUE_LEN && p->page_cnt == 0
+      && PORT_RING_BYTES - p->ring_used >= PGSIZE)
+    events |= POLLOUT;
+  lock_release (&p->lock);
+  return events;
+}
+
+/* Returns the wait queue that P wakes on any change in its
+   port_events(). */
+struct wait_queue *
+port_wait_queue (struct port *p)
+{
+  return &p->pollers;
+}
+
+/* Returns the pages of a message holding the SIZE bytes in BUFFER,
+   moving whole pages out of BUFFER if MOVABLE is true and BUFFER is
+   page-aligned and copying the rest, or a null pointer if memory
+   is short. */
+static struct msg_page *
+make_pages (const uint8_t *buffer, size_t size, bool movable)
+{
+  size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+  struct msg_page *pages = malloc (page_cnt * sizeof *pages);
+  size_t i;
+
+  if (pages == NULL)
+    return NULL;
+  movable = movable && pg_ofs (buffer) == 0;
+  for (i = 0; i < page_cnt; i++)
+    {
+      const uint8_t *upage = buffer + i * PGSIZE;
+      size_t chunk = size - i * PGSIZE < PGSIZE ? size - i * PGSIZE : PGSIZE;
+
+      if (movable && chunk == PGSIZE
+          && take_page ((uint8_t *) upage, &pages[i]))
+        continue;
+      if (!alloc_page (&pages[i]))
+        {
+          free_pages (pages, i);
+          return NULL;
+        }
+      memcpy (pages[i].kpage, upage, chunk);
+    }
+  return pages;
+}
+
+/* Delivers a message of MSG_SIZE bytes in PAGES into the SIZE
+   bytes at BUFFER, moving whole pages into BUFFER if MOVABLE is
+   true and BUFFER is page-aligned and copying the rest, and frees
+   the pages that are not moved and PAGES itself. */
+static void
+deliver_pages (struct msg_page *pages, size_t msg_size,
+               uint8_t *buffer, size_t size, bool movable)
+{
+  size_t page_cnt = DIV_ROUND_UP (msg_size, PGSIZE);
+  size_t i;
+
+  movable = movable && pg_ofs (buffer) == 0;
+  for (i = 0; i < page_cnt; i++)
+    {
+      size_t ofs = i * PGSIZE;
+      size_t n = 0;
+
+      if (ofs < size && ofs < msg_size)
+        {
+          n = size - ofs < PGSIZE ? size - ofs : PGSIZE;
+          if (msg_size - ofs < n)
+            n = msg_size - ofs;
+        }
+      if (movable && n == PGSIZE && give_page (buffer + ofs, &pages[i]))
+        continue;
+      memcpy (buffer + ofs, pages[i].kpage, n);
+      free_page (&pages[i]);
+    }
+  free (pages);
+}
+
+/* Frees the first CNT of PAGES, and PAGES itself. */
+static void
+free_pages (struct msg_page *pages, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    free_page (&pages[i]);
+  free (pages);
+}
+
+/* Moves user page UPAGE of the current process, which is locked in
+   memory for writing, into *PG, leaving a page of zeros in its
+   place.  Returns false, with nothing moved, if the page cannot
+   be moved or memory is short. */
+static bool
+take_page (uint8_t *upage, struct msg_page *pg)
+{
+#ifdef VM
+  pg->frame = page_take (upage);
+  if (pg->frame == NULL)
+    return false;
+  pg->kpage = pg->frame->kpage;
+  return true;
+#else
+  uint32_t *pd = thread_current ()->pagedir;
+  void *zeros = palloc_get_page (PAL_USER | PAL_ZERO);
+
+  if (zeros == NULL)
+    return false;
+  pg->kpage = pagedir_get_page (pd, upage);
+  pagedir_clear_page (pd, upage);
+  pagedir_set_page (pd, upage, zeros, true);
+  return true;
+#endif
+}
+
+/* Moves *PG into the current process at user page UPAGE, which is
+   locked in memory for writing, freeing the page it replaces.
+   Returns false, with nothing moved, if UPAGE cannot be
+   replaced. */
+static bool
+give_page (uint8_t *upage, struct msg_page *pg)
+{
+#ifdef VM
+  return page_give (upage, pg->frame);
+#else
+  uint32_t *pd = thread_current ()->pagedir;
+  void *old = pagedir_get_page (pd, upage);
+
+  pagedir_clear_page (pd, upage);
+  pagedir_set_page (pd, upage, pg->kpage, true);
+  palloc_free_page (old);
+  return true;
+#endif
+}
+
+/* Gets a page of the kernel's own for a message into *PG.  Returns
+   false if memory is short. */
+static bool
+alloc_page (struct msg_page *pg)
+{
+#ifdef VM
+  pg->frame = frame_alloc (NULL);
+  if (pg->frame == NULL)
+    return false;
+  pg->kpage = pg->frame->kpage;
+#else
+  pg->kpage = palloc_get_page (PAL_USER);
+  if (pg->kpage == NULL)
+    return false;
+#endif
+  return true;
+}
+
+/* Frees *PG, a page of a message. */
+static void
+free_page (struct msg_page *pg)
+{
+#ifdef VM
+  frame_free (pg->frame);
+#else
+  palloc_free_page (pg->kpage);
+#endif
+}
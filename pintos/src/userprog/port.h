@@ -0,0 +1,20 @@
+#ifndef USERPROG_PORT_H
+#define USERPROG_PORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Largest message, in pages. */
+#define PORT_MSG_PAGES 32
+
+struct wait_queue;
+
+struct port *port_create (void);
+void port_dup (struct port *);
+void port_close (struct port *);
+int port_send (struct port *, const void *, size_t, bool movable);
+int port_recv (struct port *, void *, size_t, bool movable);
+unsigned port_events (struct port *);
+struct wait_queue *port_wait_queue (struct port *);
+
+#endif /* userprog/port.h */
@@ -1,81 +1,550 @@
 #include "userprog/process.h"
 #include <debug.h>
+#include <hash.h>
 #include <inttypes.h>
 #include <round.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "userprog/fd.h"
 #include "userprog/gdt.h"
+#include "userprog/ioring.h"
 #include "userprog/pagedir.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#include "vm/shm.h"
+#endif
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
+static thread_func start_spawn NO_RETURN;
+static bool load_process (char *cmdline, struct intr_frame *);
+static void start_user (struct intr_frame *) NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static int pack_args (char *cmdline, size_t *size);
+static bool push_args (void **esp, const char *args, int argc,
+                       size_t args_size);
+static bool copy_address_space (struct thread *parent);
+
+/* A child process's exit record, shared by the child and its
+   parent, which finds it by tid in its `children' table.  It
+   outlives whichever of the two exits first, so that the child's
+   status survives without the rest of the child, and is freed
+   once both have let go of it. */
+struct child
+  {
+    struct hash_elem elem;              /* Element in parent's table. */
+    tid_t tid;                          /* Child's thread id. */
+    int exit_status;                    /* Child's exit status. */
+    struct semaphore exited;            /* Upped when the child exits. */
+    int ref_cnt;                        /* Holders, 2 while both parent
+                                           and child do.  Protected by
+                                           disabling interrupts. */
+    uint32_t *pagedir;                  /* Exited child's page directory,
+                                           for process_reap(). */
+  };
+
+static struct child *child_create (void);
+static tid_t child_adopt (struct child *, tid_t, bool success);
+static void child_release (struct child *);
+
+/* Passed from process_execute() to the child's start_process(). */
+struct exec_info
+  {
+    char *cmdline;                      /* Command line, in a page. */
+    struct child *child;                /* Child's exit record. */
+    struct semaphore done;              /* Upped once child is loaded. */
+    bool success;                       /* Did the child load? */
+  };
+
+/* Passed from process_fork() to the child's start_fork(). */
+struct fork_info
+  {
+    struct thread *parent;              /* Process forking. */
+    const struct intr_frame *if_;       /* Parent's user registers. */
+    struct child *child;                /* Child's exit record. */
+    struct semaphore done;              /* Upped once child is set up. */
+    bool success;                       /* Did the child set up? */
+  };
+
+/* A descriptor passed to a spawned child. */
+struct spawn_fd_entry
+  {
+    int fd;                             /* Descriptor in the child. */
+    struct fd_entry entry;              /* What it refers to. */
+  };
+
+/* Passed from process_spawn() to the child's start_spawn(), which
+   frees it. */
+struct spawn_info
+  {
+    char *cmdline;                      /* Command line, in a page. */
+    struct child *child;                /* Child's exit record. */
+    size_t fd_cnt;                      /* Number of descriptors. */
+    struct spawn_fd_entry fds[];        /* Descriptors to install. */
+  };
 
 /* Starts a new thread running a user program loaded from
-   FILENAME.  The new thread may be scheduled (and may even exit)
-   before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+   FILENAME and waits for it to load.  Returns the new process's
+   thread id, or TID_ERROR if the thread cannot be created or the
+   program cannot be loaded. */
 tid_t
 process_execute (const char *file_name) 
 {
-  char *fn_copy;
+  char name[sizeof thread_current ()->name];
+  struct exec_info info;
   tid_t tid;
 
   /* Make a copy of FILE_NAME.
      Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
+  info.cmdline = palloc_get_page (0);
+  if (info.cmdline == NULL)
     return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
+  strlcpy (info.cmdline, file_name, PGSIZE);
+  info.child = child_create ();
+  if (info.child == NULL) 
+    {
+      palloc_free_page (info.cmdline);
+      return TID_ERROR;
+    }
+  sema_init (&info.done, 0);
+  info.success = false;
+
+  /* Name the thread after the program, the command's first word. */
+  strlcpy (name, file_name + strspn (file_name, " "), sizeof name);
+  name[strcspn (name, " ")] = '\0';
 
   /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
+  tid = thread_create (name, PRI_DEFAULT, start_process, &info);
   if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
-  return tid;
+    {
+      palloc_free_page (info.cmdline); 
+      free (info.child);
+      return TID_ERROR;
+    }
+  sema_down (&info.done);
+  return child_adopt (info.child, tid, info.success);
+}
+
+/* Starts a new thread running a user program loaded from CMDLINE,
+   a page from palloc_get_page() that this function takes over,
+   with its descriptors FDS[i].child_fd, for i < FD_CNT, referring
+   to what the current process's FDS[i].parent_fd do.  Unlike
+   process_execute(), does not wait for the program to load: the
+   parent makes the child's references to its descriptors itself,
+   so nothing of the parent's is needed afterward, and a program
+   that fails to load exits with status -1 for process_wait() to
+   report.  Returns the new process's thread id, or TID_ERROR if a
+   descriptor is not open or the thread cannot be created. */
+tid_t
+process_spawn (char *cmdline, const struct spawn_fd *fds, size_t fd_cnt)
+{
+  char name[sizeof thread_current ()->name];
+  struct spawn_info *info;
+  struct child *child;
+  size_t i;
+  tid_t tid;
+
+  info = malloc (sizeof *info + fd_cnt * sizeof *info->fds);
+  if (info == NULL)
+    {
+      palloc_free_page (cmdline);
+      return TID_ERROR;
+    }
+  info->cmdline = cmdline;
+  info->child = child = child_create ();
+  info->fd_cnt = 0;
+  if (child == NULL)
+    goto error;
+  for (i = 0; i < fd_cnt; i++)
+    {
+      struct spawn_fd_entry *e = &info->fds[i];
+      e->fd = fds[i].child_fd;
+      if (!fd_dup (fds[i].parent_fd, &e->entry))
+        goto error;
+      info->fd_cnt++;
+    }
+
+  strlcpy (name, cmdline + strspn (cmdline, " "), sizeof name);
+  name[strcspn (name, " ")] = '\0';
+
+  /* INFO belongs to the child once it starts, and may be gone by
+     the time thread_create() returns. */
+  tid = thread_create (name, PRI_DEFAULT, start_spawn, info);
+  if (tid == TID_ERROR)
+    goto error;
+  return child_adopt (child, tid, true);
+
+ error:
+  for (i = 0; i < info->fd_cnt; i++)
+    fd_close_entry (&info->fds[i].entry);
+  free (child);
+  palloc_free_page (cmdline);
+  free (info);
+  return TID_ERROR;
+}
+
+/* A thread function that installs the descriptors passed by
+   process_spawn() and then loads and starts a user process. */
+static void
+start_spawn (void *info_)
+{
+  struct spawn_info *info = info_;
+  struct intr_frame if_;
+  size_t i;
+  bool success = true;
+
+  thread_current ()->child = info->child;
+  for (i = 0; i < info->fd_cnt; i++)
+    {
+      struct spawn_fd_entry *e = &info->fds[i];
+      if (!success || !fd_install (e->fd, &e->entry))
+        {
+          fd_close_entry (&e->entry);
+          success = false;
+        }
+    }
+  success = load_process (info->cmdline, &if_) && success;
+  free (info);
+
+  if (!success)
+    thread_exit ();
+  start_user (&if_);
+}
+
+/* Starts a new process that is a copy of the current one, which
+   entered the kernel with user registers IF_.  The child resumes
+   where the parent does, returning 0 from the system call.  Its
+   address space is a copy of the parent's, with writable pages
+   shared copy-on-write under virtual memory and copied at once
+   otherwise, and it inherits copies of the parent's open file
+   descriptors.  Returns the child's thread id, or TID_ERROR if the
+   child cannot be created. */
+tid_t
+process_fork (const struct intr_frame *if_)
+{
+  struct thread *cur = thread_current ();
+  struct fork_info info;
+  tid_t tid;
+
+  info.parent = cur;
+  info.if_ = if_;
+  info.child = child_create ();
+  if (info.child == NULL)
+    return TID_ERROR;
+  sema_init (&info.done, 0);
+  info.success = false;
+
+  /* Stay blocked until the child has copied our address space, so
+     that it does not change underneath the copy. */
+  tid = thread_create (cur->name, PRI_DEFAULT, start_fork, &info);
+  if (tid == TID_ERROR)
+    {
+      free (info.child);
+      return TID_ERROR;
+    }
+  sema_down (&info.done);
+  return child_adopt (info.child, tid, info.success);
+}
+
+/* A thread function that copies the parent process's address
+   space and resumes it as the child, for process_fork(). */
+static void
+start_fork (void *info_)
+{
+  struct fork_info *info = info_;
+  struct intr_frame if_ = *info->if_;
+  bool success;
+
+  thread_current ()->child = info->child;
+  success = (copy_address_space (info->parent)
+             && fd_copy (info->parent));
+  info->success = success;
+  sema_up (&info->done);
+  if (!success)
+    thread_exit ();
+
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Gives the current thread a copy of PARENT's address space.
+   Returns false if memory is short, leaving whatever was copied
+   for process_exit() to free. */
+static bool
+copy_address_space (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+
+  t->heap_start = parent->heap_start;
+  t->brk = parent->brk;
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL)
+    return false;
+  process_activate ();
+#ifdef VM
+  if (!page_table_init ())
+    return false;
+  t->exec_file = file_reopen (parent->exec_file);
+  if (t->exec_file == NULL)
+    return false;
+  file_deny_write (t->exec_file);
+  return page_table_copy (parent);
+#else
+  return pagedir_copy (t->pagedir, parent->pagedir);
+#endif
 }
 
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *file_name_)
+start_process (void *info_)
 {
-  char *file_name = file_name_;
+  struct exec_info *info = info_;
   struct intr_frame if_;
   bool success;
 
-  /* Initialize interrupt frame and load executable. */
-  memset (&if_, 0, sizeof if_);
-  if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
-  if_.cs = SEL_UCSEG;
-  if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp);
+  thread_current ()->child = info->child;
+  success = load_process (info->cmdline, &if_);
+
+  /* Tell the parent how it went.  INFO is gone once it wakes. */
+  info->success = success;
+  sema_up (&info->done);
 
   /* If load failed, quit. */
-  palloc_free_page (file_name);
   if (!success) 
     thread_exit ();
+  start_user (&if_);
+}
 
-  /* Start the user process by simulating a return from an
-     interrupt, implemented by intr_exit (in
-     threads/intr-stubs.S).  Because intr_exit takes all of its
-     arguments on the stack in the form of a `struct intr_frame',
-     we just point the stack pointer (%esp) to our stack frame
-     and jump to it. */
-  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+/* Loads the executable that CMDLINE, a page from palloc_get_page(),
+   names into the current thread and passes it its arguments,
+   initializing *IF_ to start it, and frees CMDLINE.  Returns true
+   if successful. */
+static bool
+load_process (char *cmdline, struct intr_frame *if_) 
+{
+  size_t args_size;
+  int argc;
+  bool success;
+
+  /* Split the command line into words.  The first one names the
+     executable. */
+  argc = pack_args (cmdline, &args_size);
+
+  /* Initialize interrupt frame, load executable, and pass it its
+     arguments. */
+  memset (if_, 0, sizeof *if_);
+  if_->gs = if_->fs = if_->es = if_->ds = if_->ss = SEL_UDSEG;
+  if_->cs = SEL_UCSEG;
+  if_->eflags = FLAG_IF | FLAG_MBS;
+  success = (load (cmdline, &if_->eip, &if_->esp)
+             && push_args (&if_->esp, cmdline, argc, args_size));
+  palloc_free_page (cmdline);
+  return success;
+}
+
+/* Starts the user process that IF_ describes by simulating a
+   return from an interrupt, implemented by intr_exit (in
+   threads/intr-stubs.S).  Because intr_exit takes all of its
+   arguments on the stack in the form of a `struct intr_frame', we
+   just point the stack pointer (%esp) to the frame and jump to
+   it. */
+static void
+start_user (struct intr_frame *if_) 
+{
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (if_) : "memory");
   NOT_REACHED ();
 }
 
+/* Packs the words of CMDLINE, which are separated by spaces, in
+   place into consecutive null-terminated strings with nothing
+   between them, so that they can be copied to the user stack in
+   one piece.  Stores the number of bytes they take, including the
+   null terminators, in *SIZE, and returns the number of words. */
+static int
+pack_args (char *cmdline, size_t *size)
+{
+  const char *src = cmdline;
+  char *dst = cmdline;
+  int argc = 0;
+
+  for (;;)
+    {
+      while (*src == ' ')
+        src++;
+      if (*src == '\0')
+        break;
+
+      /* Copy the word, then step past the separator before
+         terminating the copy, which may overwrite it. */
+      while (*src != ' ' && *src != '\0')
+        *dst++ = *src++;
+      if (*src != '\0')
+        src++;
+      *dst++ = '\0';
+      argc++;
+    }
+  if (argc == 0)
+    *cmdline = '\0';
+
+  *size = dst - cmdline;
+  return argc;
+}
+
+/* Lays out the initial stack frame of a user program at the top
+   of the stack page that ends at *ESP: the ARGC packed argument
+   strings in ARGS, ARGS_SIZE bytes in all, then the
+   null-terminated, word-aligned argv[] array, argv, argc, and a
+   null return address.  The strings go in with one copy and the
+   rest is written in place.  Updates *ESP to point to the return
+   address.  Returns false if the frame does not fit in the page. */
+static bool
+push_args (void **esp, const char *args, int argc, size_t args_size)
+{
+  uint8_t *top = *esp;
+  char *strings;
+  char **argv;
+  uint32_t *frame;
+  const char *s;
+  int i;
+
+  ASSERT (pg_ofs (top) == 0);
+  if (ROUND_UP (args_size, sizeof *argv) + (argc + 1) * sizeof *argv
+      + 3 * sizeof *frame > PGSIZE)
+    return false;
+  strings = (char *) top - args_size;
+  argv = (char **) ROUND_DOWN ((uintptr_t) strings, sizeof *argv) - (argc + 1);
+  frame = (uint32_t *) argv - 3;
+
+#ifdef VM
+  /* Keep the page in memory while we write it. */
+  if (!page_lock (top - 1, true))
+    return false;
+#endif
+  memcpy (strings, args, args_size);
+  for (i = 0, s = strings; i < argc; i++, s += strlen (s) + 1)
+    argv[i] = (char *) s;
+  argv[argc] = NULL;
+  frame[0] = 0;                         /* Return address. */
+  frame[1] = argc;
+  frame[2] = (uint32_t) argv;
+#ifdef VM
+  page_unlock (top - 1);
+#endif
+
+  *esp = frame;
+  return true;
+}
+
+/* Returns a hash value for child record E. */
+static unsigned
+child_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct child, elem)->tid);
+}
+
+/* Returns true if child record A has a lower tid than B. */
+static bool
+child_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct child, elem)->tid
+          < hash_entry (b, struct child, elem)->tid);
+}
+
+/* Returns a new exit record for a child about to be created, or a
+   null pointer if memory is short. */
+static struct child *
+child_create (void) 
+{
+  struct child *c = malloc (sizeof *c);
+  if (c != NULL)
+    {
+      c->tid = TID_ERROR;
+      c->exit_status = -1;
+      sema_init (&c->exited, 0);
+      c->ref_cnt = 2;
+      c->pagedir = NULL;
+    }
+  return c;
+}
+
+/* Enters exit record C, for the child with thread id TID, in the
+   current thread's table of children, if the child started up
+   successfully as SUCCESS says, and returns TID.  If it did not,
+   or memory is short, lets go of C instead; a failed child
+   returns TID_ERROR. */
+static tid_t
+child_adopt (struct child *c, tid_t tid, bool success) 
+{
+  struct thread *cur = thread_current ();
+
+  if (!success)
+    {
+      child_release (c);
+      return TID_ERROR;
+    }
+
+  if (cur->children == NULL)
+    {
+      cur->children = malloc (sizeof *cur->children);
+      if (cur->children != NULL
+          && !hash_init (cur->children, child_hash, child_less, NULL))
+        {
+          free (cur->children);
+          cur->children = NULL;
+        }
+    }
+
+  /* Without a table, the child runs but cannot be waited for. */
+  c->tid = tid;
+  if (cur->children == NULL)
+    child_release (c);
+  else
+    hash_insert (cur->children, &c->elem);
+  return tid;
+}
+
+/* Lets go of exit record C, freeing it if nobody else holds it. */
+static void
+child_release (struct child *c) 
+{
+  enum intr_level old_level;
+  int ref_cnt;
+
+  old_level = intr_disable ();
+  ref_cnt = --c->ref_cnt;
+  intr_set_level (old_level);
+  if (ref_cnt == 0)
+    free (c);
+}
+
+/* Lets go of the child record that E is embedded in, for
+   hash_destroy(). */
+static void
+child_destroy (struct hash_elem *e, void *aux UNUSED) 
+{
+  child_release (hash_entry (e, struct child, elem));
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -83,23 +552,59 @@ start_process (void *file_name_)
    been successfully called for the given TID, returns -1
    immediately, without waiting.
 
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   The child's record is found by hashing its tid, and is dropped
+   once waited for. */
 int
-process_wait (tid_t child_tid UNUSED) 
+process_wait (tid_t child_tid) 
 {
-  return -1;
+  struct thread *cur = thread_current ();
+  struct child key, *c;
+  struct hash_elem *e;
+  int status;
+
+  if (cur->children == NULL)
+    return -1;
+  key.tid = child_tid;
+  e = hash_delete (cur->children, &key.elem);
+  if (e == NULL)
+    return -1;
+
+  c = hash_entry (e, struct child, elem);
+  sema_down (&c->exited);
+  status = c->exit_status;
+  child_release (c);
+  return status;
 }
 
-/* Free the current process's resources. */
+/* Free the current process's resources.  Its page directory, and
+   with it the memory of a process without VM, is left for
+   process_reap() to free after the process's thread is gone, off
+   the path of its exit and the context switch. */
 void
 process_exit (void)
 {
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
-  /* Destroy the current process's page directory and switch back
-     to the kernel-only page directory. */
+  /* Only user processes have a page directory. */
+  if (cur->pagedir != NULL)
+    printf ("%s: exit(%d)\n", cur->name, cur->exit_status);
+
+  ioring_destroy ();
+  fd_close_all ();
+
+#ifdef VM
+  /* Free the pages before the page directory that maps them, and
+     only then the executable that backs them. */
+  mmap_unmap_all ();
+  shm_detach_all ();
+  page_table_destroy ();
+  file_close (cur->exec_file);
+  cur->exec_file = NULL;
+#endif
+
+  /* Switch back to the kernel-only page directory and leave the
+     current process's page directory to be destroyed. */
   pd = cur->pagedir;
   if (pd != NULL) 
     {
@@ -107,12 +612,56 @@ process_exit (void)
          cur->pagedir to NULL before switching page directories,
          so that a timer interrupt can't switch back to the
          process page directory.  We must activate the base page
-         directory before destroying the process's page
-         directory, or our active page directory will be one
-         that's been freed (and cleared). */
+         directory before the process's page directory is
+         destroyed, or our active page directory, which kernel
+         threads borrow, will be one that's been freed (and
+         cleared). */
       cur->pagedir = NULL;
       pagedir_activate (NULL);
-      pagedir_destroy (pd);
+      if (cur->child != NULL)
+        cur->child->pagedir = pd;
+      else
+        pagedir_destroy (pd);
+    }
+
+  /* Let go of our children's records; those still running keep
+     theirs until they exit. */
+  if (cur->children != NULL)
+    {
+      hash_destroy (cur->children, child_destroy);
+      free (cur->children);
+      cur->children = NULL;
+    }
+
+  /* The reaper reports our exit status to our parent. */
+  if (cur->child != NULL)
+    cur->child->exit_status = cur->exit_status;
+}
+
+/* Returns true if dead thread T has resources left for
+   process_reap() to free.  Called during a context switch. */
+bool
+process_needs_reap (const struct thread *t) 
+{
+  return t->child != NULL;
+}
+
+/* Frees what exited thread T's process left behind, once T has
+   switched away for the last time, and then reports T's exit to
+   its parent, so that a parent that waits for T finds its memory
+   free. */
+void
+process_reap (struct thread *t) 
+{
+  struct child *c = t->child;
+
+  if (c != NULL)
+    {
+      pagedir_destroy (c->pagedir);
+      c->pagedir = NULL;
+      sema_up (&c->exited);
+      child_release (c);
+      t->child = NULL;
     }
 }
 
@@ -124,8 +673,17 @@ process_activate (void)
 {
   struct thread *t = thread_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+  /* Activate thread's page tables.  A kernel thread has no user
+     address space of its own, so it runs on whichever page
+     directory is already active: all of them map the kernel the
+     same way.  Switching between a process and kernel threads thus
+     reloads CR3, flushing the TLB, only when a different process
+     runs next.  A borrowed page directory is never freed from
+     under a kernel thread, because process_exit() activates the
+     base page directory before destroying its own, and
+     pagedir_destroy() makes the other CPUs give it up. */
+  if (t->pagedir != NULL && !pagedir_is_active (t->pagedir))
+    pagedir_activate (t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -196,11 +754,57 @@ struct Elf32_Phdr
 #define PF_R 4          /* Readable. */
 
 static bool setup_stack (void **esp);
+static struct Elf32_Phdr *read_headers (struct file *,
+                                        struct Elf32_Ehdr *);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
                           bool writable);
 
+/* A loadable segment, laid out the way load_segment() wants it. */
+struct segment
+  {
+    uint32_t file_page;         /* Page-aligned offset in the file. */
+    uint32_t mem_page;          /* Page-aligned user address. */
+    uint32_t read_bytes;        /* Bytes to read from the file. */
+    uint32_t zero_bytes;        /* Bytes to zero after them. */
+    bool writable;              /* Writable by the process? */
+  };
+
+/* An executable's entry point and segments, parsed and validated. */
+struct exec_image
+  {
+    void (*entry) (void);       /* Entry point. */
+    size_t seg_cnt;             /* Number of segments. */
+    struct segment *segs;       /* Segments, allocated with malloc(). */
+  };
+
+/* Cache of recently loaded executables, so that running the same
+   program again skips parsing and validating its headers and the
+   reads they take.  Each entry holds its inode open and is valid
+   only as long as inode_version() reports the version it was
+   parsed at.  The least recently used entry is replaced. */
+#define EXEC_CACHE_CNT 8
+struct exec_cache_entry
+  {
+    struct inode *inode;        /* Executable, or null if unused. */
+    unsigned version;           /* INODE's version when parsed. */
+    unsigned long long last_use; /* exec_cache_clock at last use. */
+    struct exec_image image;    /* Parsed executable. */
+  };
+static struct exec_cache_entry exec_cache[EXEC_CACHE_CNT];
+static unsigned long long exec_cache_clock;
+static struct lock exec_cache_lock;
+
+static bool get_image (struct file *, struct exec_image *);
+
+/* Initializes the executable cache. */
+void
+process_init (void) 
+{
+  lock_init (&exec_cache_lock);
+}
+
 /* Loads an ELF executable from FILE_NAME into the current thread.
    Stores the executable's entry point into *EIP
    and its initial stack pointer into *ESP.
@@ -209,17 +813,22 @@ bool
 load (const char *file_name, void (**eip) (void), void **esp) 
 {
   struct thread *t = thread_current ();
-  struct Elf32_Ehdr ehdr;
+  struct exec_image image;
   struct file *file = NULL;
-  off_t file_ofs;
   bool success = false;
-  int i;
+  size_t i;
+
+  image.segs = NULL;
 
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
     goto done;
   process_activate ();
+#ifdef VM
+  if (!page_table_init ())
+    goto done;
+#endif
 
   /* Open executable file. */
   file = filesys_open (file_name);
@@ -228,34 +837,142 @@ load (const char *file_name, void (**eip) (void), void **esp)
       printf ("load: %s: open failed\n", file_name);
       goto done; 
     }
+#ifdef VM
+  /* Pages are read from FILE as they are touched, so keep it open
+     and unchanged until the process exits. */
+  t->exec_file = file;
+  file_deny_write (file);
+#endif
 
-  /* Read and verify executable header. */
-  if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
-      || memcmp (ehdr.e_ident, "\177ELF\1\1\1", 7)
-      || ehdr.e_type != 2
-      || ehdr.e_machine != 3
-      || ehdr.e_version != 1
-      || ehdr.e_phentsize != sizeof (struct Elf32_Phdr)
-      || ehdr.e_phnum > 1024) 
+  /* Find the executable's segments. */
+  if (!get_image (file, &image)) 
     {
       printf ("load: %s: error loading executable\n", file_name);
       goto done; 
     }
 
-  /* Read program headers. */
-  file_ofs = ehdr.e_phoff;
-  for (i = 0; i < ehdr.e_phnum; i++) 
+  /* Load segments.  The heap starts just past the last one. */
+  t->heap_start = NULL;
+  for (i = 0; i < image.seg_cnt; i++) 
     {
-      struct Elf32_Phdr phdr;
+      const struct segment *seg = &image.segs[i];
+      uint8_t *end = ((uint8_t *) seg->mem_page + seg->read_bytes
+                      + seg->zero_bytes);
 
-      if (file_ofs < 0 || file_ofs > file_length (file))
+      if (!load_segment (file, seg->file_page, (void *) seg->mem_page,
+                         seg->read_bytes, seg->zero_bytes, seg->writable))
         goto done;
-      file_seek (file, file_ofs);
+      if (end > t->heap_start)
+        t->heap_start = end;
+    }
+  t->brk = t->heap_start;
 
-      if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-        goto done;
-      file_ofs += sizeof phdr;
-      switch (phdr.p_type) 
+  /* Set up stack. */
+  if (!setup_stack (esp))
+    goto done;
+
+  /* Start address. */
+  *eip = image.entry;
+
+  success = true;
+
+ done:
+  /* We arrive here whether the load is successful or not. */
+  free (image.segs);
+#ifndef VM
+  file_close (file);
+#endif
+  return success;
+}
+
+/* load() helpers. */
+
+#ifndef VM
+static bool install_page (void *upage, void *kpage, bool writable);
+#endif
+
+/* Number of bytes at the start of an executable that
+   read_headers() reads first, enough for the executable header
+   and a typical program header table. */
+#define HEADER_BYTES 512
+
+/* Reads and verifies the executable header of FILE into *EHDR and
+   returns its program header table in a block allocated with
+   malloc(), which the caller must free.  Both usually come from a
+   single read of the first HEADER_BYTES bytes; a table that lies
+   beyond them takes one more read.  Returns a null pointer if
+   FILE is not a valid executable or memory is short. */
+static struct Elf32_Phdr *
+read_headers (struct file *file, struct Elf32_Ehdr *ehdr)
+{
+  uint8_t *buf;
+  size_t table_size;
+  off_t buf_size;
+
+  buf = malloc (HEADER_BYTES);
+  if (buf == NULL)
+    return NULL;
+  buf_size = file_read_at (file, buf, HEADER_BYTES, 0);
+  if (buf_size < (off_t) sizeof *ehdr)
+    goto error;
+  memcpy (ehdr, buf, sizeof *ehdr);
+  if (memcmp (ehdr->e_ident, "\177ELF\1\1\1", 7)
+      || ehdr->e_type != 2
+      || ehdr->e_machine != 3
+      || ehdr->e_version != 1
+      || ehdr->e_phentsize != sizeof (struct Elf32_Phdr)
+      || ehdr->e_phnum > 1024
+      || ehdr->e_phoff > (Elf32_Off) file_length (file)) 
+    goto error;
+
+  table_size = ehdr->e_phnum * sizeof (struct Elf32_Phdr);
+  if (ehdr->e_phoff + table_size <= (size_t) buf_size)
+    {
+      /* The table came in with the header. */
+      memmove (buf, buf + ehdr->e_phoff, table_size);
+      return (struct Elf32_Phdr *) buf;
+    }
+
+  free (buf);
+  buf = malloc (table_size);
+  if (buf == NULL
+      || file_read_at (file, buf, table_size, ehdr->e_phoff)
+         != (off_t) table_size)
+    goto error;
+  return (struct Elf32_Phdr *) buf;
+
+ error:
+  free (buf);
+  return NULL;
+}
+
+/* Parses and validates executable FILE into *IMAGE.  Returns
+   true if successful, false if FILE is not a valid executable or
+   memory is short. */
+static bool
+parse_image (struct file *file, struct exec_image *image)
+{
+  struct Elf32_Ehdr ehdr;
+  struct Elf32_Phdr *phdrs;
+  bool success = false;
+  int i;
+
+  phdrs = read_headers (file, &ehdr);
+  if (phdrs == NULL)
+    return false;
+  image->entry = (void (*) (void)) ehdr.e_entry;
+  image->seg_cnt = 0;
+  image->segs = malloc (ehdr.e_phnum * sizeof *image->segs);
+  if (image->segs == NULL && ehdr.e_phnum > 0)
+    goto done;
+
+  for (i = 0; i < ehdr.e_phnum; i++) 
+    {
+      const struct Elf32_Phdr *phdr = &phdrs[i];
+      struct segment *seg;
+      uint32_t page_offset;
+
+      switch (phdr->p_type) 
         {
         case PT_NULL:
         case PT_NOTE:
@@ -269,56 +986,125 @@ load (const char *file_name, void (**eip) (void), void **esp)
         case PT_SHLIB:
           goto done;
         case PT_LOAD:
-          if (validate_segment (&phdr, file)) 
+          if (!validate_segment (phdr, file)) 
+            goto done;
+          seg = &image->segs[image->seg_cnt++];
+          seg->writable = (phdr->p_flags & PF_W) != 0;
+          seg->file_page = phdr->p_offset & ~PGMASK;
+          seg->mem_page = phdr->p_vaddr & ~PGMASK;
+          page_offset = phdr->p_vaddr & PGMASK;
+          if (phdr->p_filesz > 0)
             {
-              bool writable = (phdr.p_flags & PF_W) != 0;
-              uint32_t file_page = phdr.p_offset & ~PGMASK;
-              uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
-              uint32_t page_offset = phdr.p_vaddr & PGMASK;
-              uint32_t read_bytes, zero_bytes;
-              if (phdr.p_filesz > 0)
-                {
-                  /* Normal segment.
-                     Read initial part from disk and zero the rest. */
-                  read_bytes = page_offset + phdr.p_filesz;
-                  zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-                                - read_bytes);
-                }
-              else 
-                {
-                  /* Entirely zero.
-                     Don't read anything from disk. */
-                  read_bytes = 0;
-                  zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
-                }
-              if (!load_segment (file, file_page, (void *) mem_page,
-                                 read_bytes, zero_bytes, writable))
-                goto done;
+              /* Normal segment.
+                 Read initial part from disk and zero the rest. */
+              seg->read_bytes = page_offset + phdr->p_filesz;
+              seg->zero_bytes = (ROUND_UP (page_offset + phdr->p_memsz,
+                                           PGSIZE)
+                                 - seg->read_bytes);
+            }
+          else 
+            {
+              /* Entirely zero.
+                 Don't read anything from disk. */
+              seg->read_bytes = 0;
+              seg->zero_bytes = ROUND_UP (page_offset + phdr->p_memsz,
+                                          PGSIZE);
             }
-          else
-            goto done;
           break;
         }
     }
-
-  /* Set up stack. */
-  if (!setup_stack (esp))
-    goto done;
-
-  /* Start address. */
-  *eip = (void (*) (void)) ehdr.e_entry;
-
   success = true;
 
  done:
-  /* We arrive here whether the load is successful or not. */
-  file_close (file);
+  free (phdrs);
+  if (!success)
+    free (image->segs);
   return success;
 }
-
-/* load() helpers. */
 
-static bool install_page (void *upage, void *kpage, bool writable);
+/* Returns a copy of *IMAGE in *COPY, with its own segment array.
+   Returns false if memory is short. */
+static bool
+copy_image (const struct exec_image *image, struct exec_image *copy) 
+{
+  size_t size = image->seg_cnt * sizeof *image->segs;
+
+  *copy = *image;
+  copy->segs = malloc (size);
+  if (copy->segs == NULL && size > 0)
+    return false;
+  memcpy (copy->segs, image->segs, size);
+  return true;
+}
+
+/* Fills *IMAGE with the parsed segments of executable FILE, from
+   the executable cache if possible, and caches them if not.  The
+   caller must free IMAGE->segs.  Returns true if successful, false
+   if FILE is not a valid executable or memory is short. */
+static bool
+get_image (struct file *file, struct exec_image *image)
+{
+  struct inode *inode = file_get_inode (file);
+  unsigned version = inode_version (inode);
+  struct exec_cache_entry *e, *victim = NULL;
+  struct inode *old_inode = NULL;
+  struct exec_image old_image;
+  bool found = false;
+
+  /* Look for INODE at its current version, dropping entries for
+     files that have since been deleted. */
+  lock_acquire (&exec_cache_lock);
+  for (e = exec_cache; e < exec_cache + EXEC_CACHE_CNT; e++) 
+    if (e->inode == inode && e->version == version)
+      {
+        e->last_use = ++exec_cache_clock;
+        found = copy_image (&e->image, image);
+        break;
+      }
+  lock_release (&exec_cache_lock);
+  if (found)
+    return true;
+
+  /* Parse it the slow way, reading the version before the headers
+     so that a write racing with us leaves a stale entry that
+     never matches. */
+  if (!parse_image (file, image))
+    return false;
+
+  /* Replace an unused entry, one for an old version of INODE or
+     for a deleted file, or else the least recently used. */
+  lock_acquire (&exec_cache_lock);
+  for (e = exec_cache; e < exec_cache + EXEC_CACHE_CNT; e++) 
+    if (e->inode == NULL || e->inode == inode
+        || inode_is_removed (e->inode))
+      {
+        victim = e;
+        break;
+      }
+    else if (victim == NULL || e->last_use < victim->last_use)
+      victim = e;
+  old_inode = victim->inode;
+  old_image = victim->image;
+  if (copy_image (image, &victim->image)) 
+    {
+      victim->inode = inode_reopen (inode);
+      victim->version = version;
+      victim->last_use = ++exec_cache_clock;
+    }
+  else 
+    {
+      victim->inode = NULL;
+      victim->image.segs = NULL;
+    }
+  lock_release (&exec_cache_lock);
+
+  if (old_inode != NULL) 
+    {
+      free (old_image.segs);
+      inode_close (old_inode);
+    }
+  return true;
+}
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -365,6 +1151,9 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
   return true;
 }
 
+/* Pages mapped per pagedir_map_range() call by load_segment(). */
+#define MAP_BATCH 64
+
 /* Loads a segment starting at offset OFS in FILE at address
    UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
    memory are initialized, as follows:
@@ -377,6 +1166,13 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory, the pages are only recorded in the
+   supplemental page table, and each is read in by the page fault
+   handler when first touched.  Otherwise, the segment is read
+   with a single file_read_at() into physically contiguous pages
+   if the user pool has a long enough run free, and a page at a
+   time if not.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -387,6 +1183,58 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  while (read_bytes > 0 || zero_bytes > 0) 
+    {
+      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+      size_t page_zero_bytes = PGSIZE - page_read_bytes;
+
+      if (page_add_file (upage, file, ofs, page_read_bytes,
+                         writable) == NULL)
+        return false;
+
+      /* Advance. */
+      read_bytes -= page_read_bytes;
+      zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
+      upage += PGSIZE;
+    }
+  return true;
+#else
+  size_t page_cnt = (read_bytes + zero_bytes) / PGSIZE;
+  uint8_t *kpages = palloc_get_multiple (PAL_USER, page_cnt);
+  if (kpages != NULL) 
+    {
+      size_t i;
+
+      if (file_read_at (file, kpages, read_bytes, ofs) != (off_t) read_bytes)
+        {
+          palloc_free_multiple (kpages, page_cnt);
+          return false;
+        }
+      memset (kpages + read_bytes, 0, zero_bytes);
+
+      /* Map the pages a batch at a time.  Pages already mapped are
+         freed along with the page directory if a later batch
+         fails. */
+      for (i = 0; i < page_cnt; i += MAP_BATCH)
+        {
+          void *batch[MAP_BATCH];
+          size_t cnt = page_cnt - i < MAP_BATCH ? page_cnt - i : MAP_BATCH;
+          size_t j;
+
+          for (j = 0; j < cnt; j++)
+            batch[j] = kpages + (i + j) * PGSIZE;
+          if (!pagedir_map_range (thread_current ()->pagedir,
+                                  upage + i * PGSIZE, batch, cnt, writable))
+            {
+              palloc_free_multiple (kpages + i * PGSIZE, page_cnt - i);
+              return false;
+            }
+        }
+      return true;
+    }
+
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -422,6 +1270,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -429,6 +1278,14 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp) 
 {
+#ifdef VM
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+
+  if (page_add (upage, true) == NULL || !page_in (upage, true))
+    return false;
+  *esp = PHYS_BASE;
+  return true;
+#else
   uint8_t *kpage;
   bool success = false;
 
@@ -442,8 +1299,10 @@ setup_stack (void **esp)
         palloc_free_page (kpage);
     }
   return success;
+#endif
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -463,3 +1322,185 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
+
+/* Heap. */
+
+/* Lowest address of the stack region, which the heap must stay
+   below. */
+#ifdef VM
+#define STACK_BOTTOM ((uint8_t *) PHYS_BASE - page_stack_limit)
+#else
+#define STACK_BOTTOM ((uint8_t *) PHYS_BASE - PGSIZE)
+#endif
+
+static bool add_heap_pages (uint8_t *start, uint8_t *end);
+static void remove_heap_pages (uint8_t *start, uint8_t *end);
+static bool add_heap_page (uint8_t *upage);
+#ifndef VM
+static void remove_heap_page (uint8_t *upage);
+static bool add_heap_huge (uint8_t *upage);
+#endif
+
+/* Moves the end of the current process's heap by INCREMENT bytes
+   and returns its old end.  Pages the heap grows into read as
+   zeros; under virtual memory they are brought in only when first
+   touched.  Returns (void *) -1, with the heap as it was, if the
+   heap would shrink below its start or run into the stack or
+   other pages in use, or if memory is short. */
+void *
+process_sbrk (intptr_t increment)
+{
+  struct thread *t = thread_current ();
+  uint8_t *old_brk = t->brk;
+  uint8_t *old_end = pg_round_up (old_brk);
+  uint8_t *new_brk, *new_end;
+
+  if (t->heap_start == NULL)
+    return (void *) -1;
+  if (increment < 0)
+    {
+      if ((uintptr_t) 0 - (uintptr_t) increment
+          > (uintptr_t) (old_brk - t->heap_start))
+        return (void *) -1;
+    }
+  else if (old_brk > STACK_BOTTOM
+           || (uintptr_t) increment > (uintptr_t) (STACK_BOTTOM - old_brk))
+    return (void *) -1;
+  new_brk = old_brk + increment;
+  new_end = pg_round_up (new_brk);
+
+  if (new_end > old_end && !add_heap_pages (old_end, new_end))
+    return (void *) -1;
+  if (new_end < old_end)
+    {
+#ifndef VM
+      /* A huge page that the new end falls inside must be broken
+         up so that its upper part can go. */
+      if (!pagedir_split_huge (t->pagedir, new_end))
+        return (void *) -1;
+#endif
+      remove_heap_pages (new_end, old_end);
+    }
+
+  t->brk = new_brk;
+  return old_brk;
+}
+
+/* Adds all-zero pages to the heap from START up to END.  Without
+   virtual memory, each aligned 4 MB span that the range covers
+   gets a single huge page when the CPU and the user pool allow,
+   which saves a page table and most of the TLB misses on a large
+   heap.  Returns false, having added nothing, if any page is in
+   use or memory is short. */
+static bool
+add_heap_pages (uint8_t *start, uint8_t *end)
+{
+  uint8_t *upage = start;
+
+  while (upage < end)
+    {
+#ifndef VM
+      if ((uintptr_t) upage % PTSPAN == 0
+          && (size_t) (end - upage) >= PTSPAN
+          && add_heap_huge (upage))
+        {
+          upage += PTSPAN;
+          continue;
+        }
+#endif
+      if (!add_heap_page (upage))
+        {
+          remove_heap_pages (start, upage);
+          return false;
+        }
+      upage += PGSIZE;
+    }
+  return true;
+}
+
+/* Removes the heap pages from START up to END.  Without virtual
+   memory, no huge page may extend past either bound. */
+static void
+remove_heap_pages (uint8_t *start, uint8_t *end)
+{
+#ifdef VM
+  page_remove_range (start, (end - start) / PGSIZE);
+#else
+  uint8_t *upage = start;
+
+  while (upage < end)
+    {
+      void *kpage = pagedir_clear_huge (thread_current ()->pagedir, upage);
+
+      if (kpage != NULL)
+        {
+          palloc_free_multiple (kpage, HUGE_PAGE_CNT);
+          upage += PTSPAN;
+          continue;
+        }
+      remove_heap_page (upage);
+      upage += PGSIZE;
+    }
+#endif
+}
+
+#ifndef VM
+/* Adds an all-zero huge page to the heap at UPAGE, which must be
+   aligned on 4 MB.  Returns false if the CPU lacks 4 MB pages, no
+   aligned run of user pages is free, or part of the span is in
+   use. */
+static bool
+add_heap_huge (uint8_t *upage)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  void *kpage;
+
+  if (!init_large_pages)
+    return false;
+  kpage = palloc_get_aligned (PAL_USER | PAL_ZERO, HUGE_PAGE_CNT,
+                              HUGE_PAGE_CNT);
+  if (kpage == NULL)
+    return false;
+  if (!pagedir_set_huge (pd, upage, kpage, true))
+    {
+      palloc_free_multiple (kpage, HUGE_PAGE_CNT);
+      return false;
+    }
+  return true;
+}
+#endif
+
+/* Adds an all-zero page to the heap at UPAGE.  Returns false if
+   UPAGE is in use or memory is short. */
+static bool
+add_heap_page (uint8_t *upage)
+{
+#ifdef VM
+  return page_add (upage, true) != NULL;
+#else
+  uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+
+  if (kpage == NULL)
+    return false;
+  if (!install_page (upage, kpage, true))
+    {
+      palloc_free_page (kpage);
+      return false;
+    }
+  return true;
+#endif
+}
+
+#ifndef VM
+/* Removes the heap page at UPAGE. */
+static void
+remove_heap_page (uint8_t *upage)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  void *kpage = pagedir_get_page (pd, upage);
+
+  pagedir_clear_page (pd, upage);
+  palloc_free_page (kpage);
+}
+#endif
@@ -1,11 +1,22 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include "threads/thread.h"
 
+struct intr_frame;
+struct spawn_fd;
+
+void process_init (void);
 tid_t process_execute (const char *file_name);
+tid_t process_fork (const struct intr_frame *);
+tid_t process_spawn (char *cmdline, const struct spawn_fd *, size_t fd_cnt);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
+bool process_needs_reap (const struct thread *);
+void process_reap (struct thread *);
+void *process_sbrk (intptr_t increment);
 
 #endif /* userprog/process.h */
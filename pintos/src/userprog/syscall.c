@@ -1,20 +1,1298 @@
 #include "userprog/syscall.h"
+#include <console.h>
+#include <dirent.h>
+#include <faultstat.h>
+#include <kstat.h>
+#include <limits.h>
+#include <spawn.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include <sysenter.h>
+#include <uio.h>
+#include "devices/block.h"
+#include "devices/kbd.h"
+#include "devices/shutdown.h"
+#include "devices/timer.h"
+#include "devices/tty.h"
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "filesys/filesys.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/exception.h"
+#include "userprog/fd.h"
+#include "userprog/futex.h"
+#include "userprog/gdt.h"
+#include "userprog/ioring.h"
+#include "userprog/pipe.h"
+#include "userprog/poll.h"
+#include "userprog/port.h"
+#include "userprog/process.h"
+#include "userprog/tss.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/mmap.h"
+#include "vm/page.h"
+#include "vm/shm.h"
+#include "vm/swap.h"
+#endif
 
-static void syscall_handler (struct intr_frame *);
+/* A system call implementation.  Every implementation takes three
+   argument words, whether or not it uses them, and returns the
+   value to put in the caller's %eax.  The few system calls that
+   need a fourth argument word use syscall4_func instead. */
+typedef uint32_t syscall_func (uint32_t, uint32_t, uint32_t);
+typedef uint32_t syscall4_func (uint32_t, uint32_t, uint32_t, uint32_t);
 
+/* A system call table entry. */
+struct syscall
+  {
+    size_t arg_cnt;             /* Number of argument words. */
+    syscall_func *func;         /* Implementation, or null if... */
+    syscall4_func *func4;       /* ...ARG_CNT is 4 and this is it. */
+  };
+
+static syscall_func sys_halt, sys_exit, sys_exec, sys_wait;
+static syscall_func sys_create, sys_remove, sys_open, sys_filesize;
+static syscall_func sys_read, sys_write, sys_seek, sys_tell, sys_close;
+#ifdef VM
+static syscall_func sys_mmap, sys_munmap;
+static syscall_func sys_shm_create, sys_shm_attach, sys_shm_detach;
+#endif
+static syscall_func sys_readdir, sys_isdir, sys_inumber;
+static syscall_func sys_readv, sys_writev, sys_schedstat, sys_faultstat;
+static syscall_func sys_stats, sys_ttymode;
+static syscall_func sys_fork;
+static syscall_func sys_pipe, sys_splice, sys_io_setup, sys_io_enter;
+static syscall_func sys_readdir_batch, sys_fallocate, sys_spawn;
+static syscall_func sys_port_create, sys_msg_send, sys_msg_recv;
+static syscall_func sys_futex_wait, sys_futex_wake, sys_sbrk, sys_poll;
+static syscall4_func sys_pread, sys_pwrite, sys_sendfile;
+
+/* System calls, indexed by number.  Missing entries are system
+   calls that are not implemented. */
+static const struct syscall syscall_table[] =
+  {
+    [SYS_HALT] = {0, sys_halt},
+    [SYS_EXIT] = {1, sys_exit},
+    [SYS_EXEC] = {1, sys_exec},
+    [SYS_WAIT] = {1, sys_wait},
+    [SYS_CREATE] = {2, sys_create},
+    [SYS_REMOVE] = {1, sys_remove},
+    [SYS_OPEN] = {1, sys_open},
+    [SYS_FILESIZE] = {1, sys_filesize},
+    [SYS_READ] = {3, sys_read},
+    [SYS_WRITE] = {3, sys_write},
+    [SYS_SEEK] = {2, sys_seek},
+    [SYS_TELL] = {1, sys_tell},
+    [SYS_CLOSE] = {1, sys_close},
+#ifdef VM
+    [SYS_MMAP] = {2, sys_mmap},
+    [SYS_MUNMAP] = {1, sys_munmap},
+#endif
+    [SYS_READDIR] = {2, sys_readdir},
+    [SYS_ISDIR] = {1, sys_isdir},
+    [SYS_INUMBER] = {1, sys_inumber},
+    [SYS_READV] = {3, sys_readv},
+    [SYS_WRITEV] = {3, sys_writev},
+    [SYS_SCHEDSTAT] = {1, sys_schedstat},
+    [SYS_FAULTSTAT] = {1, sys_faultstat},
+    [SYS_STATS] = {2, sys_stats},
+    [SYS_TTYMODE] = {1, sys_ttymode},
+    [SYS_FORK] = {0, sys_fork},
+    [SYS_PIPE] = {1, sys_pipe},
+    [SYS_SPLICE] = {3, sys_splice},
+    [SYS_IO_SETUP] = {1, sys_io_setup},
+    [SYS_IO_ENTER] = {2, sys_io_enter},
+    [SYS_READDIR_BATCH] = {3, sys_readdir_batch},
+    [SYS_FALLOCATE] = {3, sys_fallocate},
+    [SYS_PREAD] = {4, NULL, sys_pread},
+    [SYS_PWRITE] = {4, NULL, sys_pwrite},
+    [SYS_SENDFILE] = {4, NULL, sys_sendfile},
+    [SYS_SPAWN] = {3, sys_spawn},
+    [SYS_PORT_CREATE] = {0, sys_port_create},
+    [SYS_MSG_SEND] = {3, sys_msg_send},
+    [SYS_MSG_RECV] = {3, sys_msg_recv},
+    [SYS_FUTEX_WAIT] = {2, sys_futex_wait},
+    [SYS_FUTEX_WAKE] = {2, sys_futex_wake},
+    [SYS_SBRK] = {1, sys_sbrk},
+    [SYS_POLL] = {3, sys_poll},
+#ifdef VM
+    [SYS_SHM_CREATE] = {1, sys_shm_create},
+    [SYS_SHM_ATTACH] = {2, sys_shm_attach},
+    [SYS_SHM_DETACH] = {1, sys_shm_detach},
+#endif
+  };
+
+#define SYSCALL_CNT (sizeof syscall_table / sizeof *syscall_table)
+
+/* Model-specific registers that configure SYSENTER.  See
+   [IA32-v3a] 5.8.7 "Performing Fast Calls to System Procedures
+   with the SYSENTER and SYSEXIT Instructions". */
+#define MSR_SYSENTER_CS 0x174   /* Kernel code selector. */
+#define MSR_SYSENTER_ESP 0x175  /* Initial kernel stack pointer. */
+#define MSR_SYSENTER_EIP 0x176  /* Entry point. */
+
+/* Fast system call entry point, in sysenter.S. */
+void sysenter_entry (void);
+
+static void kill_process (void) NO_RETURN;
+static uint32_t get_arg (const uint32_t *);
+static char *copy_in_string (const char *);
+static bool try_lock_buffer (const void *, size_t, bool write);
+static void lock_buffer (const void *, size_t, bool write);
+static void unlock_buffer (const void *, size_t);
+static struct iovec *copy_in_iovec (const struct iovec *, int iovcnt);
+
+/* Writes VALUE to model-specific register MSR.  See [IA32-v2b]
+   "WRMSR--Write to Model Specific Register". */
+static inline void
+wrmsr (uint32_t msr, uint32_t value)
+{
+  asm volatile ("wrmsr" : : "c" (msr), "a" (value), "d" (0));
+}
+
+/* Registers the system call handlers: the `int $0x30' gate and,
+   if the CPU has it, SYSENTER, which the user library then uses
+   instead.  SYSENTER loads the kernel stack pointer from a fixed
+   MSR, so we point it at the TSS's esp0, which tss_update() keeps
+   at the running thread's kernel stack, and sysenter_entry loads
+   the stack from there.  SYSEXIT's user code and data selectors
+   follow from the kernel code selector at fixed offsets, which
+   the GDT's layout matches. */
 void
-syscall_init (void) 
+syscall_init (void)
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
+  syscall_init_ap ();
+}
+
+/* Points the running CPU's SYSENTER MSRs at sysenter_entry and
+   its own TSS's esp0.  Called by syscall_init() on the boot CPU
+   and by smp_ap_main() on each of the others. */
+void
+syscall_init_ap (void)
+{
+  if (cpu_has_sysenter ())
+    {
+      ASSERT (SEL_UCSEG == (SEL_KCSEG + 16) + 3);
+      ASSERT (SEL_UDSEG == (SEL_KCSEG + 24) + 3);
+      wrmsr (MSR_SYSENTER_CS, SEL_KCSEG);
+      wrmsr (MSR_SYSENTER_ESP, (uint32_t) tss_esp0 ());
+      wrmsr (MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
+    }
+}
+
+/* Dispatches the system call whose number and arguments are on
+   the user stack.  Called through intr_handler() for `int $0x30'
+   and directly by sysenter_entry. */
+void
+syscall_handler (struct intr_frame *f)
+{
+  const uint32_t *esp = f->esp;
+  uint32_t args[4];
+  const struct syscall *sc;
+  unsigned number;
+  size_t i;
+
+#ifdef VM
+  thread_current ()->user_esp = f->esp;
+#endif
+  number = get_arg (esp);
+  if (number >= SYSCALL_CNT || (syscall_table[number].func == NULL
+                                 && syscall_table[number].func4 == NULL))
+    kill_process ();
+  sc = &syscall_table[number];
+
+  for (i = 0; i < sc->arg_cnt; i++)
+    args[i] = get_arg (esp + 1 + i);
+  if (sc->func4 != NULL)
+    f->eax = sc->func4 (args[0], args[1], args[2], args[3]);
+  else
+    f->eax = sc->func (args[0], args[1], args[2]);
 }
 
+/* User memory access.
+
+   Rather than checking every user pointer against the page table
+   before using it, the kernel simply dereferences it with
+   get_user() or put_user().  A bad pointer makes the access page
+   fault, and page_fault() resumes execution after the access with
+   -1 in %eax, which these functions report as failure.  Larger
+   buffers are checked once per page by lock_buffer() and then
+   accessed directly. */
+
+/* Reads a byte at user virtual address UADDR, which must be below
+   PHYS_BASE.  Returns the byte value if successful, -1 if a
+   segfault occurred. */
+static inline int
+get_user (const uint8_t *uaddr)
+{
+  int result;
+  asm ("movl $1f, %0; movzbl %1, %0; 1:"
+       : "=&a" (result) : "m" (*uaddr));
+  return result;
+}
+
+/* Writes BYTE to user address UDST, which must be below
+   PHYS_BASE.  Returns true if successful, false if a segfault
+   occurred. */
+static inline bool
+put_user (uint8_t *udst, uint8_t byte)
+{
+  int error_code;
+  asm ("movl $1f, %0; movb %b2, %1; 1:"
+       : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+  return error_code != -1;
+}
+
+/* Reads the 32-bit word at user address UADDR, which must be
+   below PHYS_BASE, into *VALUE.  Returns true if successful,
+   false if a segfault occurred. */
+static inline bool
+get_user_word (const uint32_t *uaddr, uint32_t *value)
+{
+  int error_code;
+  asm ("movl $1f, %0; movl %2, %1; 1:"
+       : "=&a" (error_code), "=&r" (*value) : "m" (*uaddr));
+  return error_code != -1;
+}
+
+/* Terminates the current process with exit status -1, for passing
+   a bad pointer or making a nonexistent system call. */
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+kill_process (void)
+{
+  thread_current ()->exit_status = -1;
+  thread_exit ();
+}
+
+/* Returns the argument word at user address UADDR, killing the
+   process if it cannot be read. */
+static uint32_t
+get_arg (const uint32_t *uaddr)
+{
+  uint32_t value;
+
+  if ((uintptr_t) uaddr > (uintptr_t) PHYS_BASE - sizeof *uaddr
+      || !get_user_word (uaddr, &value))
+    kill_process ();
+  return value;
+}
+
+/* Copies the null-terminated string at user address US into a new
+   page and returns it.  The caller must free the page with
+   palloc_free_page().  Kills the process if US is a bad pointer
+   or the string does not fit in a page. */
+static char *
+copy_in_string (const char *us)
+{
+  char *ks = palloc_get_page (0);
+  size_t length;
+
+  if (ks == NULL)
+    kill_process ();
+  for (length = 0; length < PGSIZE; length++)
+    {
+      int c;
+
+      if (!is_user_vaddr (us + length)
+          || (c = get_user ((const uint8_t *) us + length)) == -1)
+        {
+          palloc_free_page (ks);
+          kill_process ();
+        }
+      ks[length] = c;
+      if (c == '\0')
+        return ks;
+    }
+  palloc_free_page (ks);
+  kill_process ();
+}
+
+/* Makes sure that the kernel can access the SIZE bytes at user
+   address UBUF directly, for writing if WRITE is true.  Each page
+   is checked once.  With virtual memory, the pages are also
+   brought in and locked in memory, so that the access cannot
+   fault; the caller must release them with unlock_buffer().
+   Returns false, with nothing locked, if the buffer is bad. */
+static bool
+try_lock_buffer (const void *ubuf, size_t size, bool write)
+{
+  const uint8_t *start = ubuf;
+  const uint8_t *page;
+
+  if (size == 0)
+    return true;
+  if ((uintptr_t) start >= (uintptr_t) PHYS_BASE
+      || (uintptr_t) PHYS_BASE - (uintptr_t) start < size)
+    return false;
+
+  for (page = pg_round_down (start); page < start + size; page += PGSIZE)
+    {
+#ifdef VM
+      if (!page_lock (page, write))
+        {
+          if (page > start)
+            unlock_buffer (start, page - start);
+          return false;
+        }
+#else
+      const uint8_t *p = page > start ? page : start;
+      int c = get_user (p);
+      if (c == -1 || (write && !put_user ((uint8_t *) p, c)))
+        return false;
+#endif
+    }
+  return true;
+}
+
+/* Like try_lock_buffer(), but kills the process if the buffer is
+   bad. */
+static void
+lock_buffer (const void *ubuf, size_t size, bool write)
+{
+  if (!try_lock_buffer (ubuf, size, write))
+    kill_process ();
+}
+
+/* Releases the SIZE bytes at UBUF locked by lock_buffer(). */
+static void
+unlock_buffer (const void *ubuf UNUSED, size_t size UNUSED)
+{
+#ifdef VM
+  const uint8_t *start = ubuf;
+  const uint8_t *page;
+
+  if (size == 0)
+    return;
+  for (page = pg_round_down (start); page < start + size; page += PGSIZE)
+    page_unlock (page);
+#endif
+}
+
+/* Copies SIZE bytes from user address USRC to DST.  Returns false
+   if USRC is a bad pointer. */
+bool
+syscall_copy_in (void *dst, const void *usrc, size_t size)
+{
+  if (!try_lock_buffer (usrc, size, false))
+    return false;
+  memcpy (dst, usrc, size);
+  unlock_buffer (usrc, size);
+  return true;
+}
+
+/* Copies SIZE bytes from SRC to user address UDST.  Returns false
+   if UDST is a bad pointer. */
+bool
+syscall_copy_out (void *udst, const void *src, size_t size)
+{
+  if (!try_lock_buffer (udst, size, true))
+    return false;
+  memcpy (udst, src, size);
+  unlock_buffer (udst, size);
+  return true;
+}
+
+/* Copies the IOVCNT buffer descriptors at user address UIOV into
+   a new page and returns it.  The caller must free the page with
+   palloc_free_page().  Returns a null pointer if IOVCNT is out of
+   range or the buffers total more than INT_MAX bytes, and kills
+   the process if UIOV is a bad pointer. */
+static struct iovec *
+copy_in_iovec (const struct iovec *uiov, int iovcnt)
+{
+  struct iovec *iov;
+  size_t total = 0;
+  int i;
+
+  if (iovcnt <= 0 || iovcnt > IOV_MAX)
+    return NULL;
+  lock_buffer (uiov, iovcnt * sizeof *uiov, false);
+  iov = palloc_get_page (0);
+  if (iov != NULL)
+    memcpy (iov, uiov, iovcnt * sizeof *uiov);
+  unlock_buffer (uiov, iovcnt * sizeof *uiov);
+  if (iov == NULL)
+    return NULL;
+
+  for (i = 0; i < iovcnt; i++)
+    {
+      if (iov[i].iov_len > INT_MAX - total)
+        {
+          palloc_free_page (iov);
+          return NULL;
+        }
+      total += iov[i].iov_len;
+    }
+  return iov;
+}
+
+/* Halt system call. */
+static uint32_t
+sys_halt (uint32_t a0 UNUSED, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  shutdown_power_off ();
+}
+
+/* Exit system call. */
+static uint32_t
+sys_exit (uint32_t status, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
 {
-  printf ("system call!\n");
+  thread_current ()->exit_status = (int) status;
   thread_exit ();
 }
+
+/* Exec system call. */
+static uint32_t
+sys_exec (uint32_t ucmd_line, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  char *cmd_line = copy_in_string ((const char *) ucmd_line);
+  tid_t tid = process_execute (cmd_line);
+
+  palloc_free_page (cmd_line);
+  return tid;
+}
+
+/* Wait system call. */
+static uint32_t
+sys_wait (uint32_t child, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  return process_wait ((tid_t) child);
+}
+
+/* Create system call. */
+static uint32_t
+sys_create (uint32_t ufile, uint32_t initial_size, uint32_t a2 UNUSED)
+{
+  char *file = copy_in_string ((const char *) ufile);
+  bool success = filesys_create (file, initial_size);
+
+  palloc_free_page (file);
+  return success;
+}
+
+/* Remove system call. */
+static uint32_t
+sys_remove (uint32_t ufile, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  char *file = copy_in_string ((const char *) ufile);
+  bool success = filesys_remove (file);
+
+  palloc_free_page (file);
+  return success;
+}
+
+/* Open system call.  Opens a file or a directory. */
+static uint32_t
+sys_open (uint32_t ufile, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  char *name = copy_in_string ((const char *) ufile);
+  struct file *file = filesys_open (name);
+  struct dir *dir = file == NULL ? filesys_open_dir (name) : NULL;
+  int fd = -1;
+
+  palloc_free_page (name);
+  if (file != NULL)
+    {
+      fd = fd_open (file);
+      if (fd < 0)
+        file_close (file);
+    }
+  else if (dir != NULL)
+    {
+      fd = fd_open_dir (dir);
+      if (fd < 0)
+        dir_close (dir);
+    }
+  return fd;
+}
+
+/* Filesize system call. */
+static uint32_t
+sys_filesize (uint32_t fd, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  struct file *file = fd_lookup (fd);
+
+  return file != NULL ? file_length (file) : -1;
+}
+
+/* Returns true if FD is the console, a file, or a pipe's read
+   end. */
+static bool
+is_readable (int fd)
+{
+  return (fd == STDIN_FILENO || fd_lookup (fd) != NULL
+          || fd_lookup_pipe (fd, false) != NULL);
+}
+
+/* Returns true if FD is the console, a file, or a pipe's write
+   end. */
+static bool
+is_writable (int fd)
+{
+  return (fd == STDOUT_FILENO || fd_lookup (fd) != NULL
+          || fd_lookup_pipe (fd, true) != NULL);
+}
+
+/* Reads SIZE bytes from descriptor FD into the user buffer BUFFER
+   and returns the number read, or -1 if FD is not readable.  A
+   pipe returns whatever it has, up to SIZE bytes, once it has
+   anything, and so does the console, a line at a time in cooked
+   mode.  Kills the process if BUFFER is bad; if CLEANUP is
+   nonnull, calls it with AUX first. */
+static int
+read_fd (int fd, uint8_t *buffer, size_t size,
+         void (*cleanup) (void *), void *aux)
+{
+  struct file *file = NULL;
+  struct pipe *pipe = NULL;
+  int result;
+
+  if (!is_readable (fd))
+    return -1;
+  if (fd != STDIN_FILENO)
+    {
+      file = fd_lookup (fd);
+      pipe = fd_lookup_pipe (fd, false);
+    }
+  if (!try_lock_buffer (buffer, size, true))
+    {
+      if (cleanup != NULL)
+        cleanup (aux);
+      kill_process ();
+    }
+  if (file != NULL)
+    result = file_read (file, buffer, size);
+  else if (pipe != NULL)
+    result = pipe_read (pipe, buffer, size);
+  else
+    result = tty_read (buffer, size);
+  unlock_buffer (buffer, size);
+  return result;
+}
+
+/* Writes SIZE bytes from the user buffer BUFFER to descriptor FD
+   and returns the number written, or -1 if FD is not writable or
+   is a pipe that nobody can read.  Kills the process if BUFFER is
+   bad; if CLEANUP is nonnull, calls it with AUX first. */
+static int
+write_fd (int fd, const char *buffer, size_t size,
+          void (*cleanup) (void *), void *aux)
+{
+  struct file *file = NULL;
+  struct pipe *pipe = NULL;
+  int result;
+
+  if (!is_writable (fd))
+    return -1;
+  if (fd != STDOUT_FILENO)
+    {
+      file = fd_lookup (fd);
+      pipe = fd_lookup_pipe (fd, true);
+    }
+  if (!try_lock_buffer (buffer, size, false))
+    {
+      if (cleanup != NULL)
+        cleanup (aux);
+      kill_process ();
+    }
+  if (file != NULL)
+    result = file_write (file, buffer, size);
+  else if (pipe != NULL)
+    result = pipe_write (pipe, buffer, size);
+  else
+    {
+      putbuf (buffer, size);
+      result = size;
+    }
+  unlock_buffer (buffer, size);
+  return result;
+}
+
+/* Read system call. */
+static uint32_t
+sys_read (uint32_t fd, uint32_t ubuffer, uint32_t size)
+{
+  return read_fd (fd, (uint8_t *) ubuffer, size, NULL, NULL);
+}
+
+/* Write system call. */
+static uint32_t
+sys_write (uint32_t fd, uint32_t ubuffer, uint32_t size)
+{
+  return write_fd (fd, (const char *) ubuffer, size, NULL, NULL);
+}
+
+/* Pread system call.  Reads from file FD at OFFSET without using
+   or changing its position, so that threads sharing a descriptor
+   may read it in parallel.  Fails on pipes and the console. */
+static uint32_t
+sys_pread (uint32_t fd, uint32_t ubuffer, uint32_t size, uint32_t offset)
+{
+  struct file *file = fd_lookup (fd);
+  uint8_t *buffer = (uint8_t *) ubuffer;
+  int result;
+
+  if (file == NULL || offset > INT_MAX || size > INT_MAX)
+    return -1;
+  lock_buffer (buffer, size, true);
+  result = file_read_at (file, buffer, size, offset);
+  unlock_buffer (buffer, size);
+  return result;
+}
+
+/* Pwrite system call.  Writes to file FD at OFFSET without using
+   or changing its position.  Fails on pipes and the console. */
+static uint32_t
+sys_pwrite (uint32_t fd, uint32_t ubuffer, uint32_t size, uint32_t offset)
+{
+  struct file *file = fd_lookup (fd);
+  const uint8_t *buffer = (const uint8_t *) ubuffer;
+  int result;
+
+  if (file == NULL || offset > INT_MAX || size > INT_MAX)
+    return -1;
+  lock_buffer (buffer, size, false);
+  result = file_write_at (file, buffer, size, offset);
+  unlock_buffer (buffer, size);
+  return result;
+}
+
+/* Seek system call. */
+static uint32_t
+sys_seek (uint32_t fd, uint32_t position, uint32_t a2 UNUSED)
+{
+  struct file *file = fd_lookup (fd);
+
+  if (file != NULL)
+    file_seek (file, position);
+  return 0;
+}
+
+/* Tell system call. */
+static uint32_t
+sys_tell (uint32_t fd, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  struct file *file = fd_lookup (fd);
+
+  return file != NULL ? file_tell (file) : -1;
+}
+
+/* Close system call. */
+static uint32_t
+sys_close (uint32_t fd, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  fd_close (fd);
+  return 0;
+}
+
+/* Cleanup function for the vectored system calls: frees the
+   iovec page AUX before the process dies. */
+static void
+free_iovec (void *aux)
+{
+  palloc_free_page (aux);
+}
+
+/* Readv system call.  Fills each buffer in turn, like a series of
+   reads, in a single trap, stopping early at end of file. */
+static uint32_t
+sys_readv (uint32_t fd, uint32_t uiov, uint32_t iovcnt)
+{
+  struct iovec *iov;
+  int total = 0;
+  int i;
+
+  if (!is_readable (fd))
+    return -1;
+  iov = copy_in_iovec ((const struct iovec *) uiov, iovcnt);
+  if (iov == NULL)
+    return -1;
+
+  for (i = 0; i < (int) iovcnt; i++)
+    {
+      int cnt = read_fd (fd, iov[i].iov_base, iov[i].iov_len,
+                         free_iovec, iov);
+      total += cnt;
+      if ((size_t) cnt < iov[i].iov_len)
+        break;
+    }
+  palloc_free_page (iov);
+  return total;
+}
+
+/* Cleanup function for writev() to the console: lets go of the
+   console and frees the iovec page AUX before the process dies. */
+static void
+release_console (void *aux)
+{
+  console_release ();
+  free_iovec (aux);
+}
+
+/* Writev system call.  Writes each buffer in turn, in a single
+   trap, stopping early if the disk fills or a pipe breaks.
+   Console output holds the console throughout, so the buffers
+   come out together. */
+static uint32_t
+sys_writev (uint32_t fd, uint32_t uiov, uint32_t iovcnt)
+{
+  struct iovec *iov;
+  int total = 0;
+  int i;
+
+  if (!is_writable (fd))
+    return -1;
+  iov = copy_in_iovec ((const struct iovec *) uiov, iovcnt);
+  if (iov == NULL)
+    return -1;
+
+  /* Buffers are locked one at a time, since several may share a
+     page. */
+  if (fd == STDOUT_FILENO)
+    console_acquire ();
+  for (i = 0; i < (int) iovcnt; i++)
+    {
+      int cnt = write_fd (fd, iov[i].iov_base, iov[i].iov_len,
+                          fd == STDOUT_FILENO ? release_console : free_iovec,
+                          iov);
+      if (cnt < 0)
+        {
+          /* Broken pipe. */
+          if (total == 0)
+            total = -1;
+          break;
+        }
+      total += cnt;
+      if ((size_t) cnt < iov[i].iov_len)
+        break;
+    }
+  if (fd == STDOUT_FILENO)
+    console_release ();
+  palloc_free_page (iov);
+  return total;
+}
+
+/* Schedstat system call.  Copies the scheduling latency
+   histograms into the caller's struct schedstat. */
+static uint32_t
+sys_schedstat (uint32_t ustat, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  struct schedstat *stat = (struct schedstat *) ustat;
+
+  lock_buffer (stat, sizeof *stat, true);
+  thread_get_schedstat (stat);
+  unlock_buffer (stat, sizeof *stat);
+  return 0;
+}
+
+/* Faultstat system call.  Copies the page fault counts and
+   service time histograms into the caller's struct faultstat. */
+static uint32_t
+sys_faultstat (uint32_t ustat, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  struct faultstat *stat = (struct faultstat *) ustat;
+
+  lock_buffer (stat, sizeof *stat, true);
+  exception_get_faultstat (stat);
+  unlock_buffer (stat, sizeof *stat);
+  return 0;
+}
+
+/* Stats system call.  Copies the first SIZE bytes of a snapshot
+   of the kernel's statistics, a struct kstat, to UBUF, and
+   returns the size of the whole snapshot, so that callers can
+   tell a newer kernel's longer one from their own.  Returns -1 if
+   memory is short. */
+static uint32_t
+sys_stats (uint32_t ubuf, uint32_t size, uint32_t a2 UNUSED)
+{
+  struct kstat *k = calloc (1, sizeof *k);
+
+  if (k == NULL)
+    return -1;
+  k->version = KSTAT_VERSION;
+  k->size = sizeof *k;
+  k->ticks = timer_ticks ();
+  k->uptime_ns = clock_ns ();
+  thread_get_kstat (k);
+  console_get_kstat (k);
+  kbd_get_kstat (k);
+  block_get_kstat (k);
+  exception_get_kstat (k);
+#ifdef VM
+  frame_get_kstat (k);
+  swap_get_kstat (k);
+#endif
+
+  if (size > sizeof *k)
+    size = sizeof *k;
+  if (!syscall_copy_out ((void *) ubuf, k, size))
+    {
+      free (k);
+      kill_process ();
+    }
+  free (k);
+  return sizeof (struct kstat);
+}
+
+/* Ttymode system call.  Switches console input to MODE, TTY_RAW
+   or TTY_COOKED, and returns the previous mode, or -1 if MODE is
+   not valid. */
+static uint32_t
+sys_ttymode (uint32_t mode, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  return tty_set_mode (mode);
+}
+
+/* Fork system call.  The user registers that the child resumes
+   with are in the interrupt frame that the system call trap pushed
+   at the very top of the calling thread's kernel stack, where the
+   TSS points on entry from user mode. */
+static uint32_t
+sys_fork (uint32_t a0 UNUSED, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  struct intr_frame *if_
+    = (struct intr_frame *) ((uint8_t *) thread_current () + THREAD_SIZE) - 1;
+
+  return process_fork (if_);
+}
+
+/* Spawn system call.  Starts CMD_LINE as a child process with the
+   FD_CNT descriptors in UFDS, without waiting for it to load.
+   Returns -1 if the descriptors are invalid. */
+static uint32_t
+sys_spawn (uint32_t ucmd_line, uint32_t ufds, uint32_t fd_cnt)
+{
+  struct spawn_fd fds[SPAWN_FD_MAX];
+  char *cmd_line;
+  size_t i, j;
+
+  if (fd_cnt > SPAWN_FD_MAX)
+    return -1;
+  lock_buffer ((const void *) ufds, fd_cnt * sizeof *fds, false);
+  memcpy (fds, (const void *) ufds, fd_cnt * sizeof *fds);
+  unlock_buffer ((const void *) ufds, fd_cnt * sizeof *fds);
+  for (i = 0; i < fd_cnt; i++)
+    {
+      if (fds[i].child_fd < 2 || fds[i].child_fd >= SPAWN_CHILD_FD_MAX)
+        return -1;
+      for (j = 0; j < i; j++)
+        if (fds[j].child_fd == fds[i].child_fd)
+          return -1;
+    }
+
+  cmd_line = copy_in_string ((const char *) ucmd_line);
+  return process_spawn (cmd_line, fds, fd_cnt);
+}
+
+/* Port_create system call.  Returns a descriptor for a new
+   message port, or -1 if memory is short. */
+static uint32_t
+sys_port_create (uint32_t a0 UNUSED, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  struct port *p = port_create ();
+  int fd;
+
+  if (p == NULL)
+    return -1;
+  fd = fd_open_port (p);
+  if (fd < 0)
+    port_close (p);
+  return fd;
+}
+
+/* Msg_send system call.  Sends SIZE bytes from UBUFFER to port FD
+   as one message.  Whole pages of a page-aligned, writable buffer
+   are moved rather than copied, and read as zeros afterward. */
+static uint32_t
+sys_msg_send (uint32_t fd, uint32_t ubuffer, uint32_t size)
+{
+  struct port *p = fd_lookup_port (fd);
+  const uint8_t *buffer = (const uint8_t *) ubuffer;
+  bool movable;
+  int result;
+
+  if (p == NULL || size > PORT_MSG_PAGES * PGSIZE)
+    return -1;
+  movable = size >= PGSIZE && try_lock_buffer (buffer, size, true);
+  if (!movable)
+    lock_buffer (buffer, size, false);
+  result = port_send (p, buffer, size, movable);
+  unlock_buffer (buffer, size);
+  return result;
+}
+
+/* Msg_recv system call.  Receives the next message on port FD
+   into the SIZE bytes at UBUFFER, truncating it if it is longer,
+   and returns the number of bytes stored. */
+static uint32_t
+sys_msg_recv (uint32_t fd, uint32_t ubuffer, uint32_t size)
+{
+  struct port *p = fd_lookup_port (fd);
+  uint8_t *buffer = (uint8_t *) ubuffer;
+  int result;
+
+  if (p == NULL)
+    return -1;
+  if (size > PORT_MSG_PAGES * PGSIZE)
+    size = PORT_MSG_PAGES * PGSIZE;
+  lock_buffer (buffer, size, true);
+  result = port_recv (p, buffer, size, true);
+  unlock_buffer (buffer, size);
+  return result;
+}
+
+/* Futex_wait system call. */
+static uint32_t
+sys_futex_wait (uint32_t uaddr, uint32_t val, uint32_t a2 UNUSED)
+{
+  return futex_wait ((uint32_t *) uaddr, val);
+}
+
+/* Futex_wake system call. */
+static uint32_t
+sys_futex_wake (uint32_t uaddr, uint32_t cnt, uint32_t a2 UNUSED)
+{
+  return futex_wake ((uint32_t *) uaddr, cnt);
+}
+
+/* Sbrk system call.  Moves the end of the heap by INCREMENT bytes
+   and returns its old end, or -1 on failure. */
+static uint32_t
+sys_sbrk (uint32_t increment, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  return (uint32_t) process_sbrk ((intptr_t) increment);
+}
+
+/* Poll system call.  Waits for one of the CNT descriptors in UFDS
+   to become ready, for at most TIMEOUT milliseconds if it is not
+   negative.  The descriptors are copied in and out, so that the
+   caller's array need not stay locked in memory while it waits. */
+static uint32_t
+sys_poll (uint32_t ufds, uint32_t cnt, uint32_t timeout)
+{
+  struct pollfd *ufd = (struct pollfd *) ufds;
+  struct pollfd *fds;
+  size_t size;
+  int ready;
+
+  if (cnt > POLL_MAX)
+    return -1;
+  size = cnt * sizeof *fds;
+  fds = malloc (size);
+  if (fds == NULL && size > 0)
+    return -1;
+  if (!try_lock_buffer (ufd, size, false))
+    {
+      free (fds);
+      kill_process ();
+    }
+  memcpy (fds, ufd, size);
+  unlock_buffer (ufd, size);
+
+  ready = poll_fds (fds, cnt, (int) timeout);
+
+  if (!try_lock_buffer (ufd, size, true))
+    {
+      free (fds);
+      kill_process ();
+    }
+  memcpy (ufd, fds, size);
+  unlock_buffer (ufd, size);
+  free (fds);
+  return ready;
+}
+
+/* Readdir system call. */
+static uint32_t
+sys_readdir (uint32_t fd, uint32_t uname, uint32_t a2 UNUSED)
+{
+  struct dir *dir = fd_lookup_dir (fd);
+  char name[NAME_MAX + 1];
+
+  if (dir == NULL || !dir_readdir (dir, name))
+    return false;
+  lock_buffer ((char *) uname, sizeof name, true);
+  memcpy ((char *) uname, name, sizeof name);
+  unlock_buffer ((char *) uname, sizeof name);
+  return true;
+}
+
+/* Isdir system call. */
+static uint32_t
+sys_isdir (uint32_t fd, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  return fd_lookup_dir (fd) != NULL;
+}
+
+/* Inumber system call. */
+static uint32_t
+sys_inumber (uint32_t fd, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  struct file *file = fd_lookup (fd);
+  struct dir *dir = fd_lookup_dir (fd);
+
+  if (file != NULL)
+    return inode_get_inumber (file_get_inode (file));
+  if (dir != NULL)
+    return inode_get_inumber (dir_get_inode (dir));
+  return -1;
+}
+
+/* Readdir_batch system call.  Fills the caller's buffer with as
+   many whole struct dirents as fit and returns how many, 0 at end
+   of directory. */
+static uint32_t
+sys_readdir_batch (uint32_t fd, uint32_t ubuf, uint32_t size)
+{
+  struct dirent *ents = (struct dirent *) ubuf;
+  struct dir *dir = fd_lookup_dir (fd);
+  size_t max = size / sizeof *ents;
+  int cnt;
+
+  if (dir == NULL)
+    return -1;
+  if (max > INT_MAX)
+    max = INT_MAX;
+  lock_buffer (ents, max * sizeof *ents, true);
+  cnt = dir_readdir_batch (dir, ents, max);
+  unlock_buffer (ents, max * sizeof *ents);
+  return cnt;
+}
+
+/* Fallocate system call.  Allocates LENGTH bytes of unwritten
+   space in file FD starting at OFFSET, extending the file if
+   necessary. */
+static uint32_t
+sys_fallocate (uint32_t fd, uint32_t offset, uint32_t length)
+{
+  struct file *file = fd_lookup (fd);
+
+  return (file != NULL && offset <= INT_MAX && length <= INT_MAX - offset
+          && file_preallocate (file, offset, length));
+}
+
+/* Pipe system call.  Stores the new pipe's read and write
+   descriptors into the caller's FDS[0] and FDS[1]. */
+static uint32_t
+sys_pipe (uint32_t ufds, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  int *fds = (int *) ufds;
+  struct pipe *p;
+  int rfd, wfd;
+
+  lock_buffer (fds, 2 * sizeof *fds, true);
+  p = pipe_create ();
+  if (p == NULL)
+    goto error;
+  rfd = fd_open_pipe (p, false);
+  if (rfd < 0)
+    {
+      pipe_close (p, false);
+      pipe_close (p, true);
+      goto error;
+    }
+  wfd = fd_open_pipe (p, true);
+  if (wfd < 0)
+    {
+      fd_close (rfd);
+      pipe_close (p, true);
+      goto error;
+    }
+  fds[0] = rfd;
+  fds[1] = wfd;
+  unlock_buffer (fds, 2 * sizeof *fds);
+  return 0;
+
+ error:
+  unlock_buffer (fds, 2 * sizeof *fds);
+  return -1;
+}
+
+/* Splice system call.  Moves up to SIZE bytes from a pipe's read
+   end to a file, or from a file to a pipe's write end, through the
+   kernel's buffers only. */
+static uint32_t
+sys_splice (uint32_t fd_in, uint32_t fd_out, uint32_t size)
+{
+  struct pipe *p;
+  struct file *file;
+
+  if (size > INT_MAX)
+    size = INT_MAX;
+  if ((p = fd_lookup_pipe (fd_in, false)) != NULL
+      && (file = fd_lookup (fd_out)) != NULL)
+    return pipe_splice_to (p, file, size);
+  if ((file = fd_lookup (fd_in)) != NULL
+      && (p = fd_lookup_pipe (fd_out, true)) != NULL)
+    return pipe_splice_from (p, file, size);
+  return -1;
+}
+
+/* Writes SIZE bytes from kernel buffer DATA to file OUT, or to the
+   console if OUT is null, and returns the number written. */
+static off_t
+send_chunk (struct file *out, const void *data, off_t size)
+{
+  if (out != NULL)
+    return file_write (out, data, size);
+  putbuf (data, size);
+  return size;
+}
+
+/* Copies up to SIZE bytes of file IN, starting at OFFSET, to file
+   OUT, or to the console if OUT is null, and returns the number
+   copied.  The bytes go straight from the page cache, except for
+   inline data and for a copy within one file, whose pages must
+   not stay pinned while they are written; those go through a
+   kernel bounce page. */
+static off_t
+send_file (struct file *in, off_t offset, off_t size, struct file *out)
+{
+  bool same = out != NULL && file_get_inode (out) == file_get_inode (in);
+  uint8_t *bounce = NULL;
+  off_t done = 0;
+
+  while (done < size)
+    {
+      const void *data = NULL;
+      off_t chunk, written;
+
+      if (!same)
+        data = file_map_sector (in, offset + done, &chunk);
+      if (data != NULL)
+        {
+          if (chunk > size - done)
+            chunk = size - done;
+          written = send_chunk (out, data, chunk);
+          file_unmap_sector (data);
+        }
+      else
+        {
+          if (bounce == NULL)
+            bounce = palloc_get_page (0);
+          if (bounce == NULL)
+            break;
+          chunk = file_read_at (in, bounce, size - done < PGSIZE
+                                            ? size - done : PGSIZE,
+                                offset + done);
+          if (chunk <= 0)
+            break;
+          written = send_chunk (out, bounce, chunk);
+        }
+      done += written;
+      if (written < chunk)
+        break;
+    }
+  palloc_free_page (bounce);
+  return done;
+}
+
+/* Sendfile system call.  Copies up to SIZE bytes of file IN_FD to
+   OUT_FD, which may be the console, a pipe's write end or another
+   file, without passing them through user memory.  Reads at
+   OFFSET without using or changing IN_FD's position, or, if
+   OFFSET is -1, at IN_FD's position and advances it.  Returns the
+   number of bytes copied, or -1 if a descriptor is unsuitable or
+   the pipe is broken. */
+static uint32_t
+sys_sendfile (uint32_t out_fd, uint32_t in_fd, uint32_t offset,
+              uint32_t size)
+{
+  struct file *in = fd_lookup (in_fd);
+  struct file *out = NULL;
+  struct pipe *p = NULL;
+  bool use_pos = (int32_t) offset == -1;
+  off_t pos;
+  int result;
+
+  if (in == NULL || (!use_pos && offset > INT_MAX))
+    return -1;
+  if (out_fd != STDOUT_FILENO
+      && (out = fd_lookup (out_fd)) == NULL
+      && (p = fd_lookup_pipe (out_fd, true)) == NULL)
+    return -1;
+  if (size > INT_MAX)
+    size = INT_MAX;
+
+  pos = file_tell (in);
+  if (p != NULL)
+    {
+      /* The pipe fills from IN's position, which is put back if
+         the caller gave an offset. */
+      file_seek (in, use_pos ? pos : (off_t) offset);
+      result = pipe_splice_from (p, in, size);
+      if (!use_pos)
+        file_seek (in, pos);
+      return result;
+    }
+
+  if (out_fd == STDOUT_FILENO)
+    console_acquire ();
+  result = send_file (in, use_pos ? pos : (off_t) offset, size, out);
+  if (out_fd == STDOUT_FILENO)
+    console_release ();
+  if (use_pos)
+    file_seek (in, pos + result);
+  return result;
+}
+
+/* Io_setup system call. */
+static uint32_t
+sys_io_setup (uint32_t uring, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  return ioring_setup ((struct io_ring *) uring) ? 0 : -1;
+}
+
+/* Io_enter system call. */
+static uint32_t
+sys_io_enter (uint32_t to_submit, uint32_t min_complete, uint32_t a2 UNUSED)
+{
+  return ioring_enter (to_submit, min_complete);
+}
+
+#ifdef VM
+/* Mmap system call. */
+static uint32_t
+sys_mmap (uint32_t fd, uint32_t addr, uint32_t a2 UNUSED)
+{
+  return mmap_map (fd_lookup (fd), (void *) addr);
+}
+
+/* Munmap system call. */
+static uint32_t
+sys_munmap (uint32_t mapid, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  mmap_unmap (mapid);
+  return 0;
+}
+
+/* Shm_create system call. */
+static uint32_t
+sys_shm_create (uint32_t size, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  return shm_create (size);
+}
+
+/* Shm_attach system call. */
+static uint32_t
+sys_shm_attach (uint32_t shmid, uint32_t addr, uint32_t a2 UNUSED)
+{
+  return shm_attach (shmid, (void *) addr);
+}
+
+/* Shm_detach system call. */
+static uint32_t
+sys_shm_detach (uint32_t addr, uint32_t a1 UNUSED, uint32_t a2 UNUSED)
+{
+  return shm_detach ((void *) addr);
+}
+#endif
@@ -1,6 +1,15 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
+struct intr_frame;
+
 void syscall_init (void);
+void syscall_init_ap (void);
+void syscall_handler (struct intr_frame *);
+bool syscall_copy_in (void *, const void *usrc, size_t);
+bool syscall_copy_out (void *udst, const void *, size_t);
 
 #endif /* userprog/syscall.h */
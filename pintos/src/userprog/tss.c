@@ -4,6 +4,7 @@
 #include "userprog/gdt.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
+#include "threads/smp.h"
 #include "threads/vaddr.h"
 
 /* The Task-State Segment (TSS).
@@ -72,35 +73,59 @@ struct tss
     uint16_t trace, bitmap;
   };
 
-/* Kernel TSS. */
+/* Kernel TSSes, one per CPU, since each CPU's TSS points to the
+   stack of the thread that CPU runs.  All of them fit in one
+   page. */
 static struct tss *tss;
 
-/* Initializes the kernel TSS. */
+/* Initializes the kernel TSSes. */
 void
 tss_init (void) 
 {
+  int i;
+
   /* Our TSS is never used in a call gate or task gate, so only a
      few fields of it are ever referenced, and those are the only
      ones we initialize. */
+  ASSERT (THREAD_CPU_CNT * sizeof *tss <= PGSIZE);
   tss = palloc_get_page (PAL_ASSERT | PAL_ZERO);
-  tss->ss0 = SEL_KDSEG;
-  tss->bitmap = 0xdfff;
+  for (i = 0; i < THREAD_CPU_CNT; i++)
+    {
+      tss[i].ss0 = SEL_KDSEG;
+      tss[i].bitmap = 0xdfff;
+    }
   tss_update ();
 }
 
-/* Returns the kernel TSS. */
+/* Returns the kernel TSS of CPU. */
 struct tss *
-tss_get (void) 
+tss_get_cpu (int cpu) 
 {
   ASSERT (tss != NULL);
-  return tss;
+  ASSERT (cpu >= 0 && cpu < THREAD_CPU_CNT);
+  return &tss[cpu];
 }
 
-/* Sets the ring 0 stack pointer in the TSS to point to the end
-   of the thread stack. */
+/* Returns the running CPU's kernel TSS. */
+struct tss *
+tss_get (void) 
+{
+  return tss_get_cpu (smp_cpu ());
+}
+
+/* Returns the address of the ring 0 stack pointer in the running
+   CPU's TSS, which always points to the end of the stack of the
+   thread that CPU runs. */
+void **
+tss_esp0 (void)
+{
+  return &tss_get ()->esp0;
+}
+
+/* Sets the ring 0 stack pointer in the running CPU's TSS to point
+   to the end of the thread stack. */
 void
 tss_update (void) 
 {
-  ASSERT (tss != NULL);
-  tss->esp0 = (uint8_t *) thread_current () + PGSIZE;
+  tss_get ()->esp0 = (uint8_t *) thread_current () + THREAD_SIZE;
 }
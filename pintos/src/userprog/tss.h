@@ -6,6 +6,8 @@
 struct tss;
 void tss_init (void);
 struct tss *tss_get (void);
+struct tss *tss_get_cpu (int cpu);
 void tss_update (void);
+void **tss_esp0 (void);
 
 #endif /* userprog/tss.h */
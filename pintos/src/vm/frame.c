@@ -0,0 +1,543 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <kstat.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+
+/* Frame table.
+
+   Every user pool page that holds user pages has a `struct
+   frame' on frame_list.  When the user pool runs dry, a victim is
+   chosen with the clock (second chance) algorithm: the hand
+   sweeps the list, clearing the accessed bits of each recently
+   used frame and evicting the first frame found not accessed
+   since the hand last passed it.
+
+   Frames holding read-only file pages are also entered in
+   shared_frames, keyed by file, offset, and length, so that a
+   process faulting in the same page of the same executable maps
+   the existing frame instead of reading its own copy.  A process
+   created by fork() shares each writable page that is in memory
+   with its parent in the same way, copy-on-write, until one of
+   them writes it and frame_copy() gives it a frame of its own.
+
+   frame_lock protects the list, the hand, shared_frames, and each
+   frame's `pinned' and `pages' members.  A frame is pinned while
+   its page is being read in or written out, so that the hand skips
+   it.  The evictor also needs the lock of every page in the
+   victim, but only ever tries for them, since the thread evicting
+   may hold the lock of the page it is bringing in.
+
+   So that a page fault rarely has to evict a page itself, a
+   reclaimer thread at the lowest priority evicts ahead of demand:
+   frame_alloc() wakes it when the user pool falls below
+   reclaim_low free pages, and it runs the clock, writing out
+   dirty victims and freeing their frames, until reclaim_high
+   pages are free. */
+static struct clist frame_list;
+static struct list_elem *hand;          /* Next frame to consider. */
+static struct hash shared_frames;
+static struct lock frame_lock;
+
+static struct frame *get_frame (void);
+static struct frame *evict (void);
+static struct list_elem *advance (struct list_elem *);
+static bool lock_pages (struct frame *);
+static void unlock_pages (struct frame *, struct list_elem *stop);
+static bool pages_accessed (struct frame *);
+static void unshare (struct frame *);
+static hash_hash_func share_hash;
+static thread_func reclaim_thread NO_RETURN;
+static void wake_reclaimer (void);
+
+/* Reclaimer watermarks, as fractions of the user pool. */
+#define RECLAIM_LOW_DIV 32
+#define RECLAIM_HIGH_DIV 16
+static size_t reclaim_low, reclaim_high;
+static struct semaphore reclaim_sema;   /* Upped to wake reclaimer. */
+static bool reclaim_awake;              /* Reclaimer running? */
+static long long evict_cnt;             /* Frames evicted, in all. */
+static long long reclaim_cnt;           /* ...of which by reclaimer,
+                                           which alone updates it. */
+static hash_less_func share_less;
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  clist_init (&frame_list);
+  lock_init (&frame_lock);
+  if (!hash_init (&shared_frames, share_hash, share_less, NULL))
+    PANIC ("cannot create shared frame table");
+  hand = list_end (&frame_list.list);
+}
+
+/* Starts the reclaimer thread.  Must be called once swap is set
+   up, since reclaiming writes pages out. */
+void
+frame_start_reclaim (void)
+{
+  size_t pages = palloc_page_cnt (PAL_USER);
+
+  reclaim_low = pages / RECLAIM_LOW_DIV + 1;
+  reclaim_high = pages / RECLAIM_HIGH_DIV + 2;
+  sema_init (&reclaim_sema, 0);
+  reclaim_awake = true;
+  thread_create ("reclaim", PRI_MIN, reclaim_thread, NULL);
+}
+
+/* Returns a frame for page P, evicting another page if the user
+   pool is exhausted, or a null pointer if no page can be evicted.
+   The frame is returned pinned; the caller unpins it with
+   frame_unpin() once P's contents are in place.  If P is null, the
+   frame is mapped by no page, and stays pinned until it is given
+   to one with frame_add() or freed. */
+struct frame *
+frame_alloc (struct page *p)
+{
+  struct frame *f = get_frame ();
+
+  if (f != NULL && p != NULL)
+    list_push_back (&f->pages, &p->frame_elem);
+  if (palloc_free_cnt (PAL_USER) < reclaim_low)
+    wake_reclaimer ();
+  return f;
+}
+
+/* Returns a new frame, pinned and mapped by no page, evicting
+   another page if the user pool is exhausted, or a null pointer if
+   no page can be evicted.  Pinning keeps the evictor away, so the
+   caller may add pages to it without frame_lock. */
+static struct frame *
+get_frame (void)
+{
+  void *kpage = palloc_get_page (PAL_USER);
+  struct frame *f;
+
+  if (kpage == NULL)
+    return evict ();
+
+  f = malloc (sizeof *f);
+  if (f == NULL)
+    {
+      palloc_free_page (kpage);
+      return NULL;
+    }
+  f->kpage = kpage;
+  list_init (&f->pages);
+  f->pinned = true;
+  f->wired = false;
+  f->shared = false;
+
+  lock_acquire (&frame_lock);
+  clist_push_back (&frame_list, &f->elem);
+  lock_release (&frame_lock);
+  return f;
+}
+
+/* Returns a new zeroed frame for a shared memory segment, mapped
+   by no page, or a null pointer if no page can be evicted.  The
+   frame stays pinned, and is not freed when the last page mapping
+   it is released; the segment frees it with frame_free(). */
+struct frame *
+frame_alloc_wired (void)
+{
+  struct frame *f = get_frame ();
+
+  if (f != NULL)
+    {
+      memset (f->kpage, 0, PGSIZE);
+      f->wired = true;
+    }
+  if (palloc_free_cnt (PAL_USER) < reclaim_low)
+    wake_reclaimer ();
+  return f;
+}
+
+/* Adds page P, of a process being forked, to the pages mapping F,
+   so that P shares F copy-on-write with the parent's page. */
+void
+frame_add (struct frame *f, struct page *p)
+{
+  lock_acquire (&frame_lock);
+  list_push_back (&f->pages, &p->frame_elem);
+  lock_release (&frame_lock);
+}
+
+/* Removes page P, which the caller has unmapped and which must be
+   the only page mapping F, from F, and pins F, so that F can be
+   handed to another page with frame_add() and frame_unpin(). */
+void
+frame_detach (struct frame *f, struct page *p)
+{
+  lock_acquire (&frame_lock);
+  ASSERT (!f->pinned && !f->wired && !f->shared);
+  list_remove (&p->frame_elem);
+  ASSERT (list_empty (&f->pages));
+  f->pinned = true;
+  lock_release (&frame_lock);
+}
+
+/* Returns true if P is the only page mapping F. */
+bool
+frame_is_private (struct frame *f, struct page *p)
+{
+  bool private;
+
+  lock_acquire (&frame_lock);
+  private = (list_begin (&f->pages) == &p->frame_elem
+             && list_next (&p->frame_elem) == list_end (&f->pages));
+  lock_release (&frame_lock);
+  return private;
+}
+
+/* Gives page P, which maps F along with other pages, a copy of F
+   of its own.  The caller must have unmapped P.  Returns the new
+   frame, pinned, or a null pointer if memory is short, in which
+   case P still maps F.  Since P's lock is held, F cannot be
+   evicted meanwhile. */
+struct frame *
+frame_copy (struct frame *f, struct page *p)
+{
+  struct frame *copy = get_frame ();
+  bool unused;
+
+  if (copy == NULL)
+    return NULL;
+  memcpy (copy->kpage, f->kpage, PGSIZE);
+
+  lock_acquire (&frame_lock);
+  list_remove (&p->frame_elem);
+  unused = list_empty (&f->pages);
+  lock_release (&frame_lock);
+  list_push_back (&copy->pages, &p->frame_elem);
+
+  /* The other pages may have gone away while we copied. */
+  if (unused)
+    frame_free (f);
+  return copy;
+}
+
+/* Looks for a frame that already holds the contents of P, which
+   must be a read-only page of a file.  If there is one, adds P to
+   the pages mapping it and returns it; otherwise returns a null
+   pointer. */
+struct frame *
+frame_share (struct page *p)
+{
+  struct frame key, *f = NULL;
+  struct hash_elem *e;
+
+  ASSERT (!p->writable && p->file != NULL);
+
+  key.inode = file_get_inode (p->file);
+  key.ofs = p->file_ofs;
+  key.read_bytes = p->read_bytes;
+
+  lock_acquire (&frame_lock);
+  e = hash_find (&shared_frames, &key.share_elem);
+  if (e != NULL)
+    {
+      f = hash_entry (e, struct frame, share_elem);
+      list_push_back (&f->pages, &p->frame_elem);
+    }
+  lock_release (&frame_lock);
+  return f;
+}
+
+/* Makes F, which has just been filled with a read-only page of a
+   file, available to frame_share().  If another process published
+   the same page first, F stays private. */
+void
+frame_publish (struct frame *f)
+{
+  struct page *p = list_entry (list_front (&f->pages), struct page,
+                               frame_elem);
+
+  ASSERT (f->pinned && !f->shared);
+  ASSERT (!p->writable && p->file != NULL);
+
+  f->inode = file_get_inode (p->file);
+  f->ofs = p->file_ofs;
+  f->read_bytes = p->read_bytes;
+
+  lock_acquire (&frame_lock);
+  f->shared = hash_insert (&shared_frames, &f->share_elem) == NULL;
+  lock_release (&frame_lock);
+}
+
+/* Makes F eligible for eviction again. */
+void
+frame_unpin (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  ASSERT (f->pinned);
+  f->pinned = false;
+  lock_release (&frame_lock);
+}
+
+/* Removes page P, which the caller has unmapped, from the pages
+   mapping F.  Frees F once no page maps it, unless it is wired. */
+void
+frame_release (struct frame *f, struct page *p)
+{
+  bool unused;
+
+  lock_acquire (&frame_lock);
+  list_remove (&p->frame_elem);
+  unused = list_empty (&f->pages) && !f->wired;
+  lock_release (&frame_lock);
+
+  if (unused)
+    frame_free (f);
+}
+
+/* Removes F from the frame table and returns its memory to the
+   user pool.  The caller must have unmapped it everywhere. */
+void
+frame_free (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  clist_remove (&frame_list, &f->elem);
+  unshare (f);
+  lock_release (&frame_lock);
+
+  palloc_free_page (f->kpage);
+  free (f);
+}
+
+/* Wakes the reclaimer if it is asleep. */
+static void
+wake_reclaimer (void)
+{
+  enum intr_level old_level = intr_disable ();
+  if (!reclaim_awake)
+    {
+      reclaim_awake = true;
+      sema_up (&reclaim_sema);
+    }
+  intr_set_level (old_level);
+}
+
+/* Reclaimer thread.  Frees frames until at least reclaim_high
+   user pages are free, or nothing more can be evicted, then sleeps
+   until wake_reclaimer(). */
+static void
+reclaim_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      enum intr_level old_level;
+
+      while (palloc_free_cnt (PAL_USER) < reclaim_high)
+        {
+          struct frame *f = evict ();
+          if (f == NULL)
+            break;
+          frame_free (f);
+          reclaim_cnt++;
+        }
+
+      /* A wakeup between here and sema_down() leaves the
+         semaphore up, so it is not lost. */
+      old_level = intr_disable ();
+      reclaim_awake = false;
+      intr_set_level (old_level);
+      sema_down (&reclaim_sema);
+    }
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frame: %lld evictions, %lld by reclaimer\n",
+          evict_cnt, reclaim_cnt);
+}
+
+/* Copies the eviction counts into *K. */
+void
+frame_get_kstat (struct kstat *k)
+{
+  enum intr_level old_level = intr_disable ();
+  k->evictions = evict_cnt;
+  k->reclaims = reclaim_cnt;
+  intr_set_level (old_level);
+}
+
+/* Returns the list element after E, wrapping around at the end of
+   frame_list.  frame_lock must be held. */
+static struct list_elem *
+advance (struct list_elem *e)
+{
+  e = list_next (e);
+  return e != list_end (&frame_list.list) ? e : list_begin (&frame_list.list);
+}
+
+/* Chooses a victim frame with the clock algorithm, writes its
+   pages out, and returns the frame, pinned and with no pages.
+   Returns a null pointer if no page can be evicted, because every
+   frame is pinned or swap is full.  frame_lock must not be held. */
+static struct frame *
+evict (void)
+{
+  size_t tries;
+
+  lock_acquire (&frame_lock);
+  if (clist_empty (&frame_list))
+    {
+      lock_release (&frame_lock);
+      return NULL;
+    }
+  if (hand == list_end (&frame_list.list))
+    hand = list_begin (&frame_list.list);
+
+  /* Two full sweeps are enough to clear every accessed bit and
+     then find an unaccessed frame, if there is one to be had. */
+  for (tries = 2 * clist_size (&frame_list); tries > 0; tries--)
+    {
+      struct frame *f = list_entry (hand, struct frame, elem);
+      struct list_elem *e, *next;
+      bool success = true;
+
+      hand = advance (hand);
+      if (f->pinned || !lock_pages (f))
+        continue;
+      if (pages_accessed (f))
+        {
+          unlock_pages (f, list_end (&f->pages));
+          continue;
+        }
+
+      /* Write the pages out with frame_lock released, so that
+         other threads may use the frame table meanwhile.  Each
+         page written out leaves F at once.  If swap fills up
+         partway through a frame shared copy-on-write, the pages
+         not yet written out keep mapping F. */
+      f->pinned = true;
+      unshare (f);
+      lock_release (&frame_lock);
+      for (e = list_begin (&f->pages); e != list_end (&f->pages);
+           e = next)
+        {
+          struct page *p = list_entry (e, struct page, frame_elem);
+
+          next = list_next (e);
+          if (!page_out (p))
+            {
+              success = false;
+              break;
+            }
+          list_remove (e);
+          lock_release (&p->lock);
+        }
+      unlock_pages (f, list_end (&f->pages));
+      lock_acquire (&frame_lock);
+      if (success)
+        {
+          evict_cnt++;
+          lock_release (&frame_lock);
+          return f;
+        }
+      f->pinned = false;
+    }
+  lock_release (&frame_lock);
+  return NULL;
+}
+
+/* Tries to acquire the lock of every page mapping F.  Returns true
+   if successful; otherwise, acquires none of them.  frame_lock
+   must be held. */
+static bool
+lock_pages (struct frame *f)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    if (!lock_try_acquire (&list_entry (e, struct page, frame_elem)->lock))
+      {
+        unlock_pages (f, e);
+        return false;
+      }
+  return true;
+}
+
+/* Releases the locks of the pages mapping F, up to but not
+   including STOP. */
+static void
+unlock_pages (struct frame *f, struct list_elem *stop)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&f->pages); e != stop; e = list_next (e))
+    lock_release (&list_entry (e, struct page, frame_elem)->lock);
+}
+
+/* Returns true if any page mapping F has been accessed since the
+   last call, clearing all of their accessed bits. */
+static bool
+pages_accessed (struct frame *f)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+      if (pagedir_is_accessed (p->pagedir, p->addr))
+        {
+          accessed = true;
+          pagedir_set_accessed (p->pagedir, p->addr, false);
+        }
+    }
+  return accessed;
+}
+
+/* Removes F from shared_frames, if it is there, so that no more
+   processes start sharing it.  frame_lock must be held. */
+static void
+unshare (struct frame *f)
+{
+  if (f->shared)
+    {
+      hash_delete (&shared_frames, &f->share_elem);
+      f->shared = false;
+    }
+}
+
+/* Returns a hash value for the shared frame that contains E. */
+static unsigned
+share_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, share_elem);
+  return hash_bytes (&f->inode, sizeof f->inode) ^ hash_int (f->ofs);
+}
+
+/* Returns true if the shared frame containing A sorts before the
+   one containing B. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, share_elem);
+  const struct frame *b = hash_entry (b_, struct frame, share_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  return a->read_bytes < b->read_bytes;
+}
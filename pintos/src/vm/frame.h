@@ -0,0 +1,57 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct page;
+struct kstat;
+
+/* A physical frame from the user pool, holding one user page.
+
+   A frame holding a read-only page of a file may be shared: every
+   process that maps the same bytes of the same file maps this one
+   frame, and `pages' lists a `struct page' for each of them.  So
+   may a frame holding a writable page of a process that has
+   forked, shared copy-on-write between parent and child.
+   So may a frame of a shared memory segment, wired in memory for
+   every process attached to the segment.  Otherwise `pages' holds
+   exactly one page. */
+struct frame
+  {
+    struct list_elem elem;              /* Element in frame list. */
+    void *kpage;                        /* Kernel virtual address. */
+    struct list pages;                  /* Pages mapping this frame. */
+    bool pinned;                        /* Exempt from eviction? */
+    bool wired;                         /* Held by a shared memory
+                                           segment, pinned for good and
+                                           kept when no page maps it? */
+
+    /* For a frame in the shared frame table. */
+    struct hash_elem share_elem;        /* Element in shared_frames. */
+    bool shared;                        /* In shared_frames? */
+    struct inode *inode;                /* File the page came from. */
+    off_t ofs;                          /* Offset in file. */
+    size_t read_bytes;                  /* Bytes from file; rest zero. */
+  };
+
+void frame_init (void);
+void frame_start_reclaim (void);
+struct frame *frame_alloc (struct page *);
+struct frame *frame_alloc_wired (void);
+struct frame *frame_share (struct page *);
+void frame_add (struct frame *, struct page *);
+void frame_detach (struct frame *, struct page *);
+bool frame_is_private (struct frame *, struct page *);
+struct frame *frame_copy (struct frame *, struct page *);
+void frame_publish (struct frame *);
+void frame_unpin (struct frame *);
+void frame_release (struct frame *, struct page *);
+void frame_free (struct frame *);
+void frame_print_stats (void);
+void frame_get_kstat (struct kstat *);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,139 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* Memory-mapped files.
+
+   A mapping makes the pages of a file appear at consecutive user
+   addresses.  Nothing is read when the mapping is made: each page
+   is recorded in the supplemental page table as a write-back page
+   of the file, and comes in on its first access like any other
+   page.  Modified pages go back to the file, not to swap, when
+   they are evicted and when the mapping is removed. */
+
+/* One memory-mapped file. */
+struct mapping
+  {
+    struct list_elem elem;              /* Element in thread's `mappings'. */
+    int mapid;                          /* Mapping identifier. */
+    struct file *file;                  /* Mapping's own open file. */
+    uint8_t *addr;                      /* First user page. */
+    size_t page_cnt;                    /* Number of pages. */
+  };
+
+static struct mapping *find_mapping (int mapid);
+static void unmap (struct mapping *);
+
+/* Maps FILE into the current process's address space starting at
+   user page ADDR.  The mapping uses its own reopened copy of FILE,
+   so closing FILE does not affect it.  Returns a mapping
+   identifier, or MAP_FAILED if ADDR is not page-aligned, is null,
+   or would overlap pages already in use, if FILE is empty, or if
+   memory is short. */
+int
+mmap_map (struct file *file, void *addr)
+{
+  struct thread *t = thread_current ();
+  struct mapping *m;
+  off_t length;
+  size_t page_cnt, i;
+
+  if (addr == NULL || pg_ofs (addr) != 0 || !is_user_vaddr (addr)
+      || file == NULL)
+    return MAP_FAILED;
+  length = file_length (file);
+  if (length == 0)
+    return MAP_FAILED;
+  page_cnt = DIV_ROUND_UP (length, PGSIZE);
+
+  /* The whole range must be unused user memory. */
+  if ((uintptr_t) PHYS_BASE - (uintptr_t) addr < (uintptr_t) length)
+    return MAP_FAILED;
+  for (i = 0; i < page_cnt; i++)
+    if (page_lookup ((uint8_t *) addr + i * PGSIZE) != NULL)
+      return MAP_FAILED;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return MAP_FAILED;
+  m->file = file_reopen (file);
+  if (m->file == NULL)
+    {
+      free (m);
+      return MAP_FAILED;
+    }
+  m->mapid = t->next_mapid++;
+  m->addr = addr;
+  m->page_cnt = 0;
+  list_push_back (&t->mappings, &m->elem);
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      off_t ofs = i * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+      if (page_add_mmap (m->addr + ofs, m->file, ofs, read_bytes) == NULL)
+        {
+          unmap (m);
+          return MAP_FAILED;
+        }
+      m->page_cnt++;
+    }
+  return m->mapid;
+}
+
+/* Removes mapping MAPID of the current process, writing its
+   modified pages back to the file.  Does nothing if there is no
+   such mapping. */
+void
+mmap_unmap (int mapid)
+{
+  struct mapping *m = find_mapping (mapid);
+  if (m != NULL)
+    unmap (m);
+}
+
+/* Removes all of the current process's mappings.  Must be called
+   before its supplemental page table is destroyed. */
+void
+mmap_unmap_all (void)
+{
+  struct thread *t = thread_current ();
+
+  while (!list_empty (&t->mappings))
+    unmap (list_entry (list_front (&t->mappings), struct mapping, elem));
+}
+
+/* Returns the current process's mapping with the given MAPID, or
+   a null pointer if there is none. */
+static struct mapping *
+find_mapping (int mapid)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&t->mappings); e != list_end (&t->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->mapid == mapid)
+        return m;
+    }
+  return NULL;
+}
+
+/* Removes M's pages, writing back those that were modified, and
+   frees M. */
+static void
+unmap (struct mapping *m)
+{
+  page_remove_range (m->addr, m->page_cnt);
+  list_remove (&m->elem);
+  file_close (m->file);
+  free (m);
+}
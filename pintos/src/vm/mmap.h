@@ -0,0 +1,13 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+struct file;
+
+/* Returned by mmap_map() on failure. */
+#define MAP_FAILED (-1)
+
+int mmap_map (struct file *, void *addr);
+void mmap_unmap (int mapid);
+void mmap_unmap_all (void);
+
+#endif /* vm/mmap.h */
@@ -0,0 +1,705 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Supplemental page table.
+
+   Each process has a hash table of `struct page', keyed by user
+   virtual page address, describing every page of its address
+   space.  Pages start out not present: the page directory maps
+   nothing, and the first access faults into page_in(), which
+   allocates a frame, fills it from swap, from the page's file, or
+   with zeros, and maps it.  When frames run short, the frame
+   table calls page_out() to push a page back out: to swap if it
+   has been modified, otherwise nowhere, since it can be read again
+   from where it first came from.  Pages of memory-mapped files
+   are written back to their file instead of to swap.
+
+   Read-only pages of files are shared between processes through
+   the frame table's shared frames, so that every process running
+   the same executable maps one copy of its code.  All-zero pages,
+   such as BSS and untouched stack, are mapped read-only to a single
+   zero page until they are first written, when they get a frame
+   of their own.  A forked process starts out sharing the frames of
+   its parent's writable pages, mapped read-only in both, and the
+   first write to such a page copies it.  Pages of shared memory
+   segments map the segment's wired frames from the start and
+   never leave them.
+
+   Only the owning process adds or removes pages, so the table
+   itself needs no lock.  Each page's lock serializes bringing it
+   in against the frame table writing it out. */
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destroy;
+static bool load (struct page *, bool write);
+static bool copy_on_write (struct page *);
+static bool copy_page (struct page *, struct thread *parent);
+static void write_back (struct page *);
+static bool is_movable (const struct page *);
+static void clear_mapping (struct page *, struct pagedir_batch *);
+
+/* Page of zeros, mapped read-only by every all-zero page that has
+   been read but not yet written. */
+static void *zero_page;
+
+/* Largest size of a user stack, in bytes. */
+size_t page_stack_limit = PAGE_STACK_DEFAULT;
+
+/* The stack grows on access to an address at most this far below
+   the stack pointer, which covers PUSHA, the deepest x86 push: it
+   stores 32 bytes below %esp before moving it. */
+#define STACK_SLOP 32
+
+static struct page *lookup_or_grow (const void *addr);
+static bool grows_stack (const void *addr);
+
+/* Allocates the shared zero page. */
+void
+page_init (void)
+{
+  zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+}
+
+/* Creates the current process's supplemental page table.
+   Returns false if memory is short. */
+bool
+page_table_init (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->pages == NULL);
+  t->pages = malloc (sizeof *t->pages);
+  if (t->pages == NULL)
+    return false;
+  if (!hash_init (t->pages, page_hash, page_less, NULL))
+    {
+      free (t->pages);
+      t->pages = NULL;
+      return false;
+    }
+  return true;
+}
+
+/* Destroys the current process's supplemental page table, if it
+   has one, unmapping and freeing every page in it.  Must be called
+   before the process's page directory is destroyed. */
+void
+page_table_destroy (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->pages != NULL)
+    {
+      hash_destroy (t->pages, page_destroy);
+      free (t->pages);
+      t->pages = NULL;
+    }
+}
+
+/* Fills the current process's supplemental page table, which
+   must be empty, with a copy of PARENT's, for fork().  Pages of
+   the parent's executable become pages of the current process's
+   own executable, which must already be open.  Memory-mapped files
+   are not inherited.  PARENT must be blocked, waiting for the copy
+   to finish.  Returns false if memory is short, leaving a partial
+   copy for process_exit() to free. */
+bool
+page_table_copy (struct thread *parent)
+{
+  struct hash_iterator i;
+
+  hash_first (&i, parent->pages);
+  while (hash_next (&i))
+    if (!copy_page (hash_entry (hash_cur (&i), struct page, hash_elem),
+                    parent))
+      return false;
+  return true;
+}
+
+/* Adds to the current process's address space a copy of PP, a
+   page of PARENT.  A writable page that is in memory, or in swap
+   and so brought into memory, is shared with PARENT copy-on-write.
+   Any other page starts out not present, so it will be read again
+   from the executable, mapped to the zero page, or shared through
+   the frame table, just as in PARENT.  Returns false if memory is
+   short. */
+static bool
+copy_page (struct page *pp, struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  struct file *file = pp->file;
+  struct page *p;
+  bool success = true;
+
+  if (pp->write_back || pp->shm)
+    return true;
+  if (file != NULL && file == parent->exec_file)
+    file = cur->exec_file;
+  p = page_add_file (pp->addr, file, pp->file_ofs, pp->read_bytes,
+                     pp->writable);
+  if (p == NULL)
+    return false;
+  if (!pp->writable)
+    return true;
+
+  lock_acquire (&pp->lock);
+  if (pp->swap_slot != SWAP_ERROR && !load (pp, false))
+    success = false;
+  else if (pp->frame != NULL)
+    {
+      void *kpage = pp->frame->kpage;
+
+      /* Only the parent's page directory knows if the page was
+         modified; either way, both copies now differ from the
+         file if it was. */
+      if (pagedir_is_dirty (pp->pagedir, pp->addr))
+        pp->dirty = true;
+      p->dirty = pp->dirty;
+      if (pagedir_set_page (p->pagedir, p->addr, kpage, false))
+        {
+          frame_add (pp->frame, p);
+          p->frame = pp->frame;
+          p->cow = pp->cow = true;
+          pagedir_clear_page (pp->pagedir, pp->addr);
+          pagedir_set_page (pp->pagedir, pp->addr, kpage, false);
+        }
+      else
+        success = false;
+    }
+  lock_release (&pp->lock);
+  return success;
+}
+
+/* Adds to the current process's address space an all-zero page
+   at ADDR, which is writable if WRITABLE is true.  The page is not
+   brought into memory until it is accessed.  Returns the new
+   page, or a null pointer if ADDR is already in use or memory is
+   short. */
+struct page *
+page_add (void *addr, bool writable)
+{
+  return page_add_file (addr, NULL, 0, 0, writable);
+}
+
+/* Adds to the current process's address space a page at ADDR
+   whose first READ_BYTES bytes come from FILE at offset OFS and
+   whose remainder is zeroed.  FILE must stay open as long as the
+   page exists.  Otherwise like page_add(). */
+struct page *
+page_add_file (void *addr, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  struct page *p;
+
+  ASSERT (pg_ofs (addr) == 0);
+  ASSERT (is_user_vaddr (addr));
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->addr = addr;
+  p->pagedir = thread_current ()->pagedir;
+  p->writable = writable;
+  lock_init (&p->lock);
+  p->frame = NULL;
+  p->dirty = false;
+  p->write_back = false;
+  p->swap_slot = SWAP_ERROR;
+  p->zero_mapped = false;
+  p->cow = false;
+  p->shm = false;
+  p->file = read_bytes > 0 ? file : NULL;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  if (hash_insert (thread_current ()->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Adds to the current process's address space a writable page at
+   ADDR that maps READ_BYTES bytes of FILE starting at OFS, followed
+   by zeros.  Modifications to those bytes are written back to FILE
+   when the page is evicted or removed.  Otherwise like
+   page_add_file(). */
+struct page *
+page_add_mmap (void *addr, struct file *file, off_t ofs, size_t read_bytes)
+{
+  struct page *p = page_add_file (addr, file, ofs, read_bytes, true);
+  if (p != NULL)
+    p->write_back = true;
+  return p;
+}
+
+/* Adds to the current process's address space a writable page at
+   ADDR that maps F, a wired frame of a shared memory segment, and
+   maps it at once.  Otherwise like page_add(). */
+struct page *
+page_add_frame (void *addr, struct frame *f)
+{
+  struct page *p = page_add (addr, true);
+
+  if (p == NULL)
+    return NULL;
+  if (!pagedir_set_page (p->pagedir, addr, f->kpage, true))
+    {
+      hash_delete (thread_current ()->pages, &p->hash_elem);
+      free (p);
+      return NULL;
+    }
+  frame_add (f, p);
+  p->frame = f;
+  p->shm = true;
+  return p;
+}
+
+/* Removes the page at ADDR from the current process's address
+   space, writing it back first if it is a modified page of a
+   memory-mapped file.  Does nothing if there is no such page. */
+void
+page_remove (void *addr)
+{
+  struct page *p = page_lookup (addr);
+
+  if (p != NULL)
+    {
+      hash_delete (thread_current ()->pages, &p->hash_elem);
+      page_destroy (&p->hash_elem, NULL);
+    }
+}
+
+/* Removes the PAGE_CNT pages starting at ADDR from the current
+   process's address space, as page_remove() would one by one, but
+   invalidating their TLB entries together at the end. */
+void
+page_remove_range (void *addr, size_t page_cnt)
+{
+  struct thread *t = thread_current ();
+  struct pagedir_batch b;
+  size_t i;
+
+  pagedir_batch_init (&b, t->pagedir);
+  for (i = 0; i < page_cnt; i++)
+    {
+      struct page *p = page_lookup ((uint8_t *) addr + i * PGSIZE);
+
+      if (p != NULL)
+        {
+          hash_delete (t->pages, &p->hash_elem);
+          page_destroy (&p->hash_elem, &b);
+        }
+    }
+  pagedir_batch_flush (&b);
+}
+
+/* Returns the current process's page that contains ADDR, or a
+   null pointer if there is none. */
+struct page *
+page_lookup (const void *addr)
+{
+  struct page key;
+  struct hash_elem *e;
+
+  if (!is_user_vaddr (addr) || thread_current ()->pages == NULL)
+    return NULL;
+  key.addr = pg_round_down (addr);
+  e = hash_find (thread_current ()->pages, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Returns the current process's page that contains ADDR, as
+   page_lookup() does, except that an address in the stack region,
+   no more than STACK_SLOP bytes below the user stack pointer,
+   grows the stack with a new all-zero page.  The stack region is
+   the page_stack_limit bytes below PHYS_BASE. */
+static struct page *
+lookup_or_grow (const void *addr)
+{
+  struct page *p = page_lookup (addr);
+
+  if (p == NULL && grows_stack (addr))
+    p = page_add (pg_round_down (addr), true);
+  return p;
+}
+
+/* Returns true if ADDR, which is in no page, is in the stack
+   region and close enough to the user stack pointer to grow the
+   stack. */
+static bool
+grows_stack (const void *addr)
+{
+  const uint8_t *esp = thread_current ()->user_esp;
+
+  return (is_user_vaddr (addr)
+          && (uintptr_t) PHYS_BASE - (uintptr_t) addr <= page_stack_limit
+          && (const uint8_t *) addr + STACK_SLOP >= esp);
+}
+
+/* Returns the kind of fault that page_in (FAULT_ADDR, WRITE)
+   is about to service, for the page fault statistics.  Looks at
+   the page without its lock, so another thread bringing it in or
+   evicting it meanwhile may make the answer stale. */
+enum fault_type
+page_fault_type (const void *fault_addr, bool write)
+{
+  struct page *p = page_lookup (fault_addr);
+
+  if (p == NULL)
+    return grows_stack (fault_addr) ? FAULT_STACK : FAULT_INVALID;
+  if (write && !p->writable)
+    return FAULT_INVALID;
+  if (p->frame != NULL)
+    return write && p->cow ? FAULT_COW : FAULT_MINOR;
+  if (p->swap_slot != SWAP_ERROR)
+    return FAULT_SWAP;
+  if (p->file != NULL)
+    return FAULT_FILE;
+  return FAULT_ZERO;
+}
+
+/* Brings the page containing FAULT_ADDR into memory and maps it
+   in the current process's page directory, for writing if WRITE
+   is true, growing the stack if FAULT_ADDR is just beyond it.
+   Returns true if successful, false if FAULT_ADDR is not part of
+   the process's address space, if WRITE is true and the page is
+   read-only, or if memory is short. */
+bool
+page_in (void *fault_addr, bool write)
+{
+  struct page *p = lookup_or_grow (fault_addr);
+  bool success;
+
+  if (p == NULL || (write && !p->writable))
+    return false;
+  lock_acquire (&p->lock);
+  success = load (p, write);
+  lock_release (&p->lock);
+  return success;
+}
+
+/* Brings the page containing ADDR into memory, if necessary, and
+   keeps it there until page_unlock(), so that the kernel can
+   access it directly without faulting.  Grows the stack like
+   page_in().  Returns false, leaving nothing locked, if ADDR is
+   not part of the process's address space, if WRITE is true and
+   the page is read-only, or if memory is short. */
+bool
+page_lock (const void *addr, bool write)
+{
+  struct page *p = lookup_or_grow (addr);
+
+  if (p == NULL || (write && !p->writable))
+    return false;
+  lock_acquire (&p->lock);
+  if (!load (p, write))
+    {
+      lock_release (&p->lock);
+      return false;
+    }
+  return true;
+}
+
+/* Releases the page containing ADDR, which page_lock() locked. */
+void
+page_unlock (const void *addr)
+{
+  struct page *p = page_lookup (addr);
+
+  ASSERT (p != NULL);
+  lock_release (&p->lock);
+}
+
+/* Brings P into memory and maps it, if it is not there already,
+   for writing if WRITE is true.  Returns true if successful, false
+   if memory is short.  P's lock must be held. */
+static bool
+load (struct page *p, bool write)
+{
+  struct frame *f;
+  uint8_t *kpage;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  if (p->frame != NULL)
+    return !write || !p->cow || copy_on_write (p);
+
+  /* Map an all-zero page that is only read to the zero page, and
+     give it a frame of its own when it is first written. */
+  if (p->zero_mapped)
+    {
+      if (!write)
+        return true;
+      pagedir_clear_page (p->pagedir, p->addr);
+      p->zero_mapped = false;
+    }
+  else if (!write && p->file == NULL && p->swap_slot == SWAP_ERROR
+           && !p->write_back)
+    {
+      if (!pagedir_set_page (p->pagedir, p->addr, zero_page, false))
+        return false;
+      p->zero_mapped = true;
+      return true;
+    }
+
+  /* Map another process's copy of a read-only file page, if
+     there is one. */
+  if (!p->writable && p->file != NULL)
+    {
+      f = frame_share (p);
+      if (f != NULL)
+        {
+          if (!pagedir_set_page (p->pagedir, p->addr, f->kpage, false))
+            {
+              frame_release (f, p);
+              return false;
+            }
+          p->frame = f;
+          return true;
+        }
+    }
+
+  f = frame_alloc (p);
+  if (f == NULL)
+    return false;
+  kpage = f->kpage;
+
+  if (p->swap_slot != SWAP_ERROR)
+    {
+      swap_in (p->swap_slot, kpage);
+      p->swap_slot = SWAP_ERROR;
+    }
+  else
+    {
+      if (p->file != NULL
+          && file_read_at (p->file, kpage, p->read_bytes, p->file_ofs)
+             != (off_t) p->read_bytes)
+        {
+          frame_free (f);
+          return false;
+        }
+      memset (kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+    }
+
+  if (!pagedir_set_page (p->pagedir, p->addr, kpage, p->writable))
+    {
+      frame_free (f);
+      return false;
+    }
+  p->frame = f;
+  if (!p->writable && p->file != NULL)
+    frame_publish (f);
+  frame_unpin (f);
+  return true;
+}
+
+/* Makes P, which is in memory but mapped read-only because it
+   may share its frame copy-on-write, writable, copying the frame
+   first unless P is the last page left sharing it.  Returns true
+   if successful, false if memory is short.  P's lock must be
+   held. */
+static bool
+copy_on_write (struct page *p)
+{
+  struct frame *f = p->frame;
+
+  if (pagedir_is_dirty (p->pagedir, p->addr))
+    p->dirty = true;
+  pagedir_clear_page (p->pagedir, p->addr);
+  if (!frame_is_private (f, p))
+    {
+      struct frame *copy = frame_copy (f, p);
+      if (copy == NULL)
+        {
+          pagedir_set_page (p->pagedir, p->addr, f->kpage, false);
+          return false;
+        }
+      frame_unpin (copy);
+      f = p->frame = copy;
+    }
+  p->cow = false;
+  return pagedir_set_page (p->pagedir, p->addr, f->kpage, true);
+}
+
+/* Evicts P, which must be in memory, from its frame, writing it to
+   its file or to swap if it has been modified.  Returns true if
+   successful, false if P must be written to swap but swap is full,
+   in which case P stays where it was.  Called by the frame table
+   with P's lock held and P's frame pinned. */
+bool
+page_out (struct page *p)
+{
+  struct frame *f = p->frame;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (f != NULL);
+
+  /* Unmap first, so that the process cannot dirty the page after
+     we look at the dirty bit. */
+  pagedir_clear_page (p->pagedir, p->addr);
+  if (p->write_back)
+    {
+      /* Once written back, the file holds the current contents. */
+      write_back (p);
+      p->frame = NULL;
+      return true;
+    }
+  if (pagedir_is_dirty (p->pagedir, p->addr))
+    p->dirty = true;
+
+  if (p->dirty)
+    {
+      size_t slot = swap_out (f->kpage);
+      if (slot == SWAP_ERROR)
+        {
+          pagedir_set_page (p->pagedir, p->addr, f->kpage,
+                            p->writable && !p->cow);
+          return false;
+        }
+      p->swap_slot = slot;
+    }
+  p->frame = NULL;
+  p->cow = false;
+  return true;
+}
+
+/* Returns true if P, which page_lock() has locked for writing,
+   holds an ordinary private frame that can move to another page. */
+static bool
+is_movable (const struct page *p)
+{
+  return p->frame != NULL && !p->cow && !p->shm && !p->write_back;
+}
+
+/* Takes the frame of the page at ADDR, which page_lock() has
+   locked for writing, out of the current process, leaving the page
+   all zeros.  Returns the frame, pinned and mapped by no page, or a
+   null pointer if the page is shared memory or a page of a
+   memory-mapped file, whose frame cannot move. */
+struct frame *
+page_take (void *addr)
+{
+  struct page *p = page_lookup (addr);
+  struct frame *f;
+
+  ASSERT (p != NULL && lock_held_by_current_thread (&p->lock));
+  if (!is_movable (p))
+    return NULL;
+
+  f = p->frame;
+  pagedir_clear_page (p->pagedir, p->addr);
+  frame_detach (f, p);
+  p->frame = NULL;
+  p->dirty = false;
+  p->file = NULL;
+  p->read_bytes = 0;
+  return f;
+}
+
+/* Replaces the contents of the page at ADDR, which page_lock() has
+   locked for writing, by frame F, from page_take() or a frame
+   allocated for no page, and unpins F.  Returns false, leaving the
+   page as it was, if the page is shared memory or a page of a
+   memory-mapped file. */
+bool
+page_give (void *addr, struct frame *f)
+{
+  struct page *p = page_lookup (addr);
+
+  ASSERT (p != NULL && lock_held_by_current_thread (&p->lock));
+  if (!is_movable (p))
+    return false;
+
+  pagedir_clear_page (p->pagedir, p->addr);
+  frame_release (p->frame, p);
+  frame_add (f, p);
+  p->frame = f;
+  p->dirty = true;
+  p->file = NULL;
+  p->read_bytes = 0;
+
+  /* The page was mapped a moment ago, so its page table exists and
+     this cannot fail. */
+  pagedir_set_page (p->pagedir, p->addr, f->kpage, true);
+  frame_unpin (f);
+  return true;
+}
+
+/* Writes P, a page of a memory-mapped file that is in memory but
+   no longer mapped, back to its file if it was modified. */
+static void
+write_back (struct page *p)
+{
+  if (pagedir_is_dirty (p->pagedir, p->addr))
+    file_write_at (p->file, p->frame->kpage, p->read_bytes, p->file_ofs);
+}
+
+/* Returns a hash value for the page that contains E. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_bytes (&p->addr, sizeof p->addr);
+}
+
+/* Returns true if the page containing A precedes the one
+   containing B. */
+static bool
+page_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED)
+{
+  return (hash_entry (a, struct page, hash_elem)->addr
+          < hash_entry (b, struct page, hash_elem)->addr);
+}
+
+/* Unmaps and frees the page that contains E, and its frame or
+   swap slot.  If AUX is not null, it is a pagedir_batch for P's
+   page directory, to which the page's TLB invalidation is added. */
+static void
+page_destroy (struct hash_elem *e, void *aux)
+{
+  struct page *p = hash_entry (e, struct page, hash_elem);
+  struct pagedir_batch *b = aux;
+
+  /* Wait out any eviction in progress. */
+  lock_acquire (&p->lock);
+  if (p->frame != NULL)
+    {
+      clear_mapping (p, b);
+      if (p->write_back)
+        write_back (p);
+      frame_release (p->frame, p);
+    }
+  else if (p->zero_mapped)
+    clear_mapping (p, b);
+  else if (p->swap_slot != SWAP_ERROR)
+    swap_free (p->swap_slot);
+  lock_release (&p->lock);
+  free (p);
+}
+
+/* Unmaps P, invalidating its TLB entry now if B is null or as
+   part of B otherwise. */
+static void
+clear_mapping (struct page *p, struct pagedir_batch *b)
+{
+  if (b == NULL)
+    pagedir_clear_page (p->pagedir, p->addr);
+  else
+    {
+      ASSERT (b->pd == p->pagedir);
+      pagedir_batch_clear_page (b, p->addr);
+    }
+}
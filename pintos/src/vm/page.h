@@ -0,0 +1,78 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <faultstat.h>
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct frame;
+struct thread;
+
+/* A page of a process's virtual address space, as recorded in the
+   process's supplemental page table.  The page directory says
+   which pages are in memory right now; this says what every page
+   should contain, so that a page fault can bring it in. */
+struct page
+  {
+    struct hash_elem hash_elem;         /* Element in thread's `pages'. */
+    void *addr;                         /* User virtual address. */
+    uint32_t *pagedir;                  /* Page directory that maps it. */
+    bool writable;                      /* May the process write it? */
+
+    /* Held while the page is brought in, written out, or freed. */
+    struct lock lock;
+    struct frame *frame;                /* Frame holding the page, or
+                                           null if not in memory. */
+    struct list_elem frame_elem;        /* Element in frame's `pages'. */
+    bool dirty;                         /* Modified since loaded? */
+    bool write_back;                    /* Write changes to FILE, not
+                                           to swap? */
+    size_t swap_slot;                   /* Swap slot holding the page,
+                                           or SWAP_ERROR. */
+    bool zero_mapped;                   /* Mapped read-only to the shared
+                                           zero page? */
+    bool cow;                           /* Mapped read-only because FRAME
+                                           may be shared copy-on-write? */
+    bool shm;                           /* Maps a shared memory segment's
+                                           wired FRAME? */
+
+    /* Initial contents: READ_BYTES bytes from FILE at FILE_OFS,
+       then zeros.  FILE is null for an all-zero page. */
+    struct file *file;
+    off_t file_ofs;
+    size_t read_bytes;
+  };
+
+/* Largest size of a user stack, in bytes.  Controlled by kernel
+   command-line option "-stack=KB". */
+#define PAGE_STACK_DEFAULT (8 * 1024 * 1024)
+extern size_t page_stack_limit;
+
+void page_init (void);
+bool page_table_init (void);
+void page_table_destroy (void);
+bool page_table_copy (struct thread *parent);
+
+struct page *page_add (void *addr, bool writable);
+struct page *page_add_file (void *addr, struct file *, off_t ofs,
+                            size_t read_bytes, bool writable);
+struct page *page_add_mmap (void *addr, struct file *, off_t ofs,
+                            size_t read_bytes);
+struct page *page_add_frame (void *addr, struct frame *);
+struct page *page_lookup (const void *addr);
+void page_remove (void *addr);
+void page_remove_range (void *addr, size_t page_cnt);
+bool page_in (void *fault_addr, bool write);
+enum fault_type page_fault_type (const void *fault_addr, bool write);
+bool page_lock (const void *addr, bool write);
+void page_unlock (const void *addr);
+bool page_out (struct page *);
+struct frame *page_take (void *addr);
+bool page_give (void *addr, struct frame *);
+
+#endif /* vm/page.h */
@@ -0,0 +1,288 @@
+#include "vm/shm.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+
+/* Shared memory segments.
+
+   A segment is a run of frames that any number of processes can
+   map into their address spaces at once, so that what one writes
+   the others see without a copy.  Its frames are wired in the
+   frame table: they are never evicted, since each process that
+   maps a frame has a page of its own for it and the pages would
+   otherwise be written out separately, and they are not freed
+   when the last page mapping them goes away.  Instead, a segment
+   counts its references, one for each attachment and one that the
+   creating process holds until it exits, and frees its frames
+   when the last one goes.  Wired frames are limited to a share of
+   the user pool so that eviction always has something to work
+   with.
+
+   shm_lock protects `segments', each segment's reference count,
+   and wired_cnt. */
+
+/* A shared memory segment. */
+struct shm_segment
+  {
+    struct list_elem elem;              /* Element in `segments'. */
+    int id;                             /* Segment identifier. */
+    int ref_cnt;                        /* References held. */
+    size_t page_cnt;                    /* Number of frames. */
+    struct frame *frames[];             /* Frames, in order. */
+  };
+
+/* A reference that a process holds to a segment. */
+struct shm_ref
+  {
+    struct list_elem elem;              /* Element in thread's `shm_refs'. */
+    struct shm_segment *seg;            /* Segment referred to. */
+    uint8_t *addr;                      /* First user page it is attached
+                                           at, or null for the creator's
+                                           reference. */
+  };
+
+static struct list segments;
+static struct lock shm_lock;
+static int next_id;
+
+/* Frames wired by segments, and the most there may be. */
+static size_t wired_cnt, wired_max;
+#define WIRED_MAX_DIV 2
+
+static struct shm_segment *find_segment (int shmid);
+static bool add_ref (struct shm_segment *, void *addr);
+static void release (struct shm_segment *);
+static void free_segment (struct shm_segment *);
+
+/* Initializes shared memory segments. */
+void
+shm_init (void)
+{
+  list_init (&segments);
+  lock_init (&shm_lock);
+  wired_max = palloc_page_cnt (PAL_USER) / WIRED_MAX_DIV;
+}
+
+/* Creates a zeroed shared memory segment of at least SIZE bytes
+   and returns its identifier, or -1 if SIZE is 0 or too big or if
+   memory is short.  The segment lasts at least as long as the
+   current process does, and after that as long as any process is
+   attached to it. */
+int
+shm_create (size_t size)
+{
+  size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+  struct shm_segment *seg;
+  bool reserved;
+
+  lock_acquire (&shm_lock);
+  reserved = page_cnt > 0 && page_cnt <= wired_max - wired_cnt;
+  if (reserved)
+    wired_cnt += page_cnt;
+  lock_release (&shm_lock);
+  if (!reserved)
+    return -1;
+
+  seg = malloc (sizeof *seg + page_cnt * sizeof *seg->frames);
+  if (seg == NULL)
+    goto error;
+  seg->ref_cnt = 0;
+  for (seg->page_cnt = 0; seg->page_cnt < page_cnt; seg->page_cnt++)
+    {
+      struct frame *f = frame_alloc_wired ();
+      if (f == NULL)
+        goto error;
+      seg->frames[seg->page_cnt] = f;
+    }
+  if (!add_ref (seg, NULL))
+    goto error;
+
+  lock_acquire (&shm_lock);
+  seg->id = next_id++;
+  list_push_back (&segments, &seg->elem);
+  lock_release (&shm_lock);
+  return seg->id;
+
+ error:
+  lock_acquire (&shm_lock);
+  wired_cnt -= page_cnt;
+  lock_release (&shm_lock);
+  if (seg != NULL)
+    free_segment (seg);
+  return -1;
+}
+
+/* Maps shared memory segment SHMID into the current process's
+   address space starting at user page ADDR.  Returns false if
+   there is no such segment, if ADDR is not page-aligned, is null,
+   or would overlap pages already in use, or if memory is short. */
+bool
+shm_attach (int shmid, void *addr)
+{
+  struct shm_segment *seg;
+  size_t i;
+
+  if (addr == NULL || pg_ofs (addr) != 0 || !is_user_vaddr (addr))
+    return false;
+
+  /* Take a reference, so that the segment cannot go away while we
+     map it. */
+  lock_acquire (&shm_lock);
+  seg = find_segment (shmid);
+  if (seg != NULL)
+    seg->ref_cnt++;
+  lock_release (&shm_lock);
+  if (seg == NULL)
+    return false;
+
+  /* The whole range must be unused user memory. */
+  if (((uintptr_t) PHYS_BASE - (uintptr_t) addr) / PGSIZE < seg->page_cnt)
+    goto error;
+  for (i = 0; i < seg->page_cnt; i++)
+    if (page_lookup ((uint8_t *) addr + i * PGSIZE) != NULL)
+      goto error;
+
+  for (i = 0; i < seg->page_cnt; i++)
+    if (page_add_frame ((uint8_t *) addr + i * PGSIZE, seg->frames[i])
+        == NULL)
+      {
+        page_remove_range (addr, i);
+        goto error;
+      }
+
+  /* add_ref() takes a reference of its own. */
+  if (add_ref (seg, addr))
+    {
+      release (seg);
+      return true;
+    }
+  page_remove_range (addr, seg->page_cnt);
+
+ error:
+  release (seg);
+  return false;
+}
+
+/* Unmaps the shared memory segment that the current process
+   attached at ADDR.  Returns false if it attached none there. */
+bool
+shm_detach (void *addr)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  if (addr == NULL)
+    return false;
+  for (e = list_begin (&t->shm_refs); e != list_end (&t->shm_refs);
+       e = list_next (e))
+    {
+      struct shm_ref *r = list_entry (e, struct shm_ref, elem);
+      if (r->addr == addr)
+        {
+          page_remove_range (r->addr, r->seg->page_cnt);
+          list_remove (&r->elem);
+          release (r->seg);
+          free (r);
+          return true;
+        }
+    }
+  return false;
+}
+
+/* Detaches all of the current process's segments and drops its
+   references to those it created.  Must be called before its
+   supplemental page table is destroyed. */
+void
+shm_detach_all (void)
+{
+  struct thread *t = thread_current ();
+
+  while (!list_empty (&t->shm_refs))
+    {
+      struct shm_ref *r = list_entry (list_front (&t->shm_refs),
+                                      struct shm_ref, elem);
+      if (r->addr != NULL)
+        shm_detach (r->addr);
+      else
+        {
+          list_remove (&r->elem);
+          release (r->seg);
+          free (r);
+        }
+    }
+}
+
+/* Returns the segment with the given SHMID, or a null pointer if
+   there is none.  shm_lock must be held. */
+static struct shm_segment *
+find_segment (int shmid)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&segments); e != list_end (&segments);
+       e = list_next (e))
+    {
+      struct shm_segment *seg = list_entry (e, struct shm_segment, elem);
+      if (seg->id == shmid)
+        return seg;
+    }
+  return NULL;
+}
+
+/* Records a new reference from the current process to SEG,
+   attached at ADDR, or the creator's if ADDR is null.  Returns
+   false if memory is short. */
+static bool
+add_ref (struct shm_segment *seg, void *addr)
+{
+  struct shm_ref *r = malloc (sizeof *r);
+
+  if (r == NULL)
+    return false;
+  r->seg = seg;
+  r->addr = addr;
+  lock_acquire (&shm_lock);
+  seg->ref_cnt++;
+  lock_release (&shm_lock);
+  list_push_back (&thread_current ()->shm_refs, &r->elem);
+  return true;
+}
+
+/* Drops a reference to SEG, freeing it if it was the last. */
+static void
+release (struct shm_segment *seg)
+{
+  bool unused;
+
+  lock_acquire (&shm_lock);
+  ASSERT (seg->ref_cnt > 0);
+  unused = --seg->ref_cnt == 0;
+  if (unused)
+    {
+      list_remove (&seg->elem);
+      wired_cnt -= seg->page_cnt;
+    }
+  lock_release (&shm_lock);
+
+  if (unused)
+    free_segment (seg);
+}
+
+/* Frees SEG and its frames, which no page may map. */
+static void
+free_segment (struct shm_segment *seg)
+{
+  size_t i;
+
+  for (i = 0; i < seg->page_cnt; i++)
+    frame_free (seg->frames[i]);
+  free (seg);
+}
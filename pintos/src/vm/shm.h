@@ -0,0 +1,13 @@
+#ifndef VM_SHM_H
+#define VM_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+void shm_init (void);
+int shm_create (size_t size);
+bool shm_attach (int shmid, void *addr);
+bool shm_detach (void *addr);
+void shm_detach_all (void);
+
+#endif /* vm/shm.h */
@@ -0,0 +1,235 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <kstat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/zswap.h"
+
+/* Swap area.
+
+   The swap device is divided into slots of one page each.  A
+   bitmap records which slots are in use.  Each page goes out and
+   comes back with a single multi-sector transfer.
+
+   Slots are handed out in clusters: swap_out() takes a run of
+   SWAP_CLUSTER free slots and fills it in order, so that pages
+   evicted together, which tend to be faulted back in together,
+   lie in consecutive sectors.  swap_in() takes advantage of that
+   by reading up to READ_AHEAD in-use slots at once, starting with
+   the one wanted, and keeping the others in a read-ahead buffer to
+   satisfy the next swap-ins without touching the device.
+
+   Pages are first offered to the compressed tier in memory, and
+   go to the device only if it turns them down.  Slot numbers past
+   the device's slots name compressed pages. */
+
+/* Sectors per swap slot. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Slots allocated together. */
+#define SWAP_CLUSTER 16
+
+/* Most slots read by one swap-in. */
+#define READ_AHEAD 4
+
+static struct block *swap_device;       /* Swap device, or null. */
+static struct bitmap *swap_slots;       /* Used slots. */
+static struct lock swap_lock;           /* Protects swap_slots and
+                                           the current cluster. */
+static size_t disk_slots;               /* Slots on the device. */
+static size_t cluster_next;             /* Next slot of the cluster. */
+static size_t cluster_end;              /* End of the cluster. */
+static long long out_cnt;               /* Pages written, under
+                                           swap_lock. */
+
+/* Read-ahead buffer, holding the contents of READ_AHEAD slots
+   starting at ra_first.  Bit I of ra_valid is set if slot
+   ra_first + I is in the buffer and not yet read out or freed.
+   ra_lock protects all of them and is held across the read that
+   fills them, so that freeing or rewriting a slot invalidates it
+   only after any read of it in progress. */
+static uint8_t *ra_buf;
+static size_t ra_first;
+static unsigned ra_valid;
+static struct lock ra_lock;
+static long long in_cnt;                /* Pages read in, and... */
+static long long ra_hit_cnt;            /* ...of those, found in
+                                           ra_buf; under ra_lock. */
+
+static size_t alloc_slot (void);
+static void ra_invalidate (size_t slot);
+
+/* Returns true if SLOT holds a compressed page. */
+static inline bool
+is_compressed (size_t slot)
+{
+  return slot >= disk_slots;
+}
+
+/* Sets up the swap area on the swap block device and the
+   compressed tier.  Without a device, swap_out() fails once the
+   compressed tier is full. */
+void
+swap_init (void)
+{
+  lock_init (&swap_lock);
+  lock_init (&ra_lock);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    {
+      printf ("swap: no swap device, compressed swap only\n");
+      swap_slots = bitmap_create (0);
+    }
+  else
+    {
+      swap_slots = bitmap_create (block_size (swap_device) / PAGE_SECTORS);
+      ra_buf = palloc_get_multiple (PAL_ASSERT, READ_AHEAD);
+    }
+  if (swap_slots == NULL)
+    PANIC ("swap bitmap creation failed");
+  disk_slots = bitmap_size (swap_slots);
+  zswap_init ();
+}
+
+/* Writes the page at KPAGE to a free swap slot and returns the
+   slot, or SWAP_ERROR if swap is full. */
+size_t
+swap_out (const void *kpage)
+{
+  size_t slot = zswap_store (kpage);
+
+  if (slot != ZSWAP_ERROR)
+    return disk_slots + slot;
+
+  lock_acquire (&swap_lock);
+  slot = alloc_slot ();
+  if (slot != BITMAP_ERROR)
+    out_cnt++;
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return SWAP_ERROR;
+
+  block_write_multiple (swap_device, slot * PAGE_SECTORS, PAGE_SECTORS,
+                        kpage);
+
+  /* A read-ahead may have picked up the slot before it was
+     written. */
+  ra_invalidate (slot);
+  return slot;
+}
+
+/* Reads the page in SLOT into KPAGE and frees SLOT. */
+void
+swap_in (size_t slot, void *kpage)
+{
+  if (is_compressed (slot))
+    {
+      zswap_load (slot - disk_slots, kpage);
+      return;
+    }
+
+  lock_acquire (&ra_lock);
+  if (slot < ra_first || slot >= ra_first + READ_AHEAD
+      || (ra_valid & (1u << (slot - ra_first))) == 0)
+    {
+      size_t cnt = 1;
+
+      /* Read ahead through the slots after SLOT that are in use. */
+      lock_acquire (&swap_lock);
+      while (cnt < READ_AHEAD && slot + cnt < disk_slots
+             && bitmap_test (swap_slots, slot + cnt))
+        cnt++;
+      lock_release (&swap_lock);
+
+      block_read_multiple (swap_device, slot * PAGE_SECTORS,
+                           cnt * PAGE_SECTORS, ra_buf);
+      ra_first = slot;
+      ra_valid = (1u << cnt) - 1;
+    }
+  else
+    ra_hit_cnt++;
+  in_cnt++;
+  memcpy (kpage, ra_buf + (slot - ra_first) * PGSIZE, PGSIZE);
+  lock_release (&ra_lock);
+
+  swap_free (slot);
+}
+
+/* Frees SLOT without reading it. */
+void
+swap_free (size_t slot)
+{
+  if (is_compressed (slot))
+    {
+      zswap_free (slot - disk_slots);
+      return;
+    }
+
+  ra_invalidate (slot);
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (swap_slots, slot));
+  bitmap_reset (swap_slots, slot);
+  lock_release (&swap_lock);
+}
+
+/* Prints swap statistics for the device and the compressed
+   tier. */
+void
+swap_print_stats (void)
+{
+  printf ("Swap: %lld pages out, %lld pages in, %lld from read-ahead\n",
+          out_cnt, in_cnt, ra_hit_cnt);
+  zswap_print_stats ();
+}
+
+/* Copies the swap and zswap counts into *K. */
+void
+swap_get_kstat (struct kstat *k)
+{
+  enum intr_level old_level = intr_disable ();
+  k->swap_outs = out_cnt;
+  k->swap_ins = in_cnt;
+  k->swap_ra_hits = ra_hit_cnt;
+  intr_set_level (old_level);
+  zswap_get_kstat (k);
+}
+
+/* Marks a free device slot used and returns it, or BITMAP_ERROR
+   if there is none.  Continues the current cluster if it has a
+   slot left, and otherwise starts a new one at the first run of
+   SWAP_CLUSTER free slots, settling for any free slot once swap is
+   too fragmented for that.  swap_lock must be held. */
+static size_t
+alloc_slot (void)
+{
+  size_t slot;
+
+  if (cluster_next >= cluster_end || bitmap_test (swap_slots, cluster_next))
+    {
+      slot = bitmap_scan (swap_slots, 0, SWAP_CLUSTER, false);
+      if (slot == BITMAP_ERROR)
+        return bitmap_scan_and_flip (swap_slots, 0, 1, false);
+      cluster_next = slot;
+      cluster_end = slot + SWAP_CLUSTER;
+    }
+  slot = cluster_next++;
+  bitmap_mark (swap_slots, slot);
+  return slot;
+}
+
+/* Drops SLOT from the read-ahead buffer, if it is there. */
+static void
+ra_invalidate (size_t slot)
+{
+  lock_acquire (&ra_lock);
+  if (slot >= ra_first && slot < ra_first + READ_AHEAD)
+    ra_valid &= ~(1u << (slot - ra_first));
+  lock_release (&ra_lock);
+}
@@ -0,0 +1,19 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct kstat;
+
+/* Returned by swap_out() when there is no free swap slot. */
+#define SWAP_ERROR ((size_t) -1)
+
+void swap_init (void);
+size_t swap_out (const void *kpage);
+void swap_in (size_t slot, void *kpage);
+void swap_free (size_t slot);
+void swap_print_stats (void);
+void swap_get_kstat (struct kstat *);
+
+#endif /* vm/swap.h */
@@ -0,0 +1,344 @@
+#include "vm/zswap.h"
+#include <debug.h>
+#include <kstat.h>
+#include <list.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Compressed swap tier.
+
+   Before a page goes out to the swap device, it is compressed into
+   memory here, which costs far less than a page-sized disk write.
+   Only when this tier is full, or the page does not compress to
+   half its size, does it go to disk.
+
+   Compressed pages are packed into slabs: kernel pages each
+   divided into equal objects of one size class.  A compressed page
+   takes an object of the smallest class that holds it.  Each class
+   keeps a list of its slabs that have a free object; a slab whose
+   last object is freed goes back to the page allocator.  A handle
+   names an object by slab index and object index.
+
+   The compressor is a byte-oriented LZ77 variant tuned for speed:
+   a single hash probe per position, no lazy matching.  Its output
+   is a sequence of tokens.  A token byte below 0x80 is followed by
+   that many plus one literal bytes.  A token byte 0x80 | N is
+   followed by a 16-bit little-endian distance D, and copies N + 3
+   bytes starting D bytes back in the output, which may overlap the
+   bytes being copied, so that a run of zeros compresses to a few
+   bytes per 130. */
+
+/* Size classes, in bytes.  The largest is half a page, since a
+   page that compresses no smaller would save nothing worth the
+   trouble. */
+static const uint16_t class_size[] =
+  {128, 256, 384, 512, 680, 816, 1024, 1360, 2048};
+#define CLASS_CNT (sizeof class_size / sizeof *class_size)
+#define ZSWAP_MAX_LEN 2048
+
+/* Most objects in one slab, those of the smallest class. */
+#define SLAB_OBJS 32
+
+/* A slab. */
+struct slab
+  {
+    uint8_t *page;              /* Kernel page, or null if unused. */
+    struct list_elem elem;      /* Element in partial[CLASS]. */
+    size_t class;               /* Index into class_size[]. */
+    uint32_t used;              /* Bitmap of objects in use. */
+    uint16_t len[SLAB_OBJS];    /* Compressed length of each object. */
+  };
+
+size_t zswap_pages = ZSWAP_PAGES_DEFAULT;
+
+static struct slab *slabs;              /* zswap_pages slabs. */
+static struct list partial[CLASS_CNT];  /* Slabs with a free object. */
+static struct lock zswap_lock;          /* Protects everything here. */
+static long long store_cnt;             /* Pages stored. */
+static long long reject_cnt;            /* Pages turned down. */
+static long long load_cnt;              /* Pages loaded. */
+
+/* Compressor scratch space, protected by zswap_lock. */
+#define LZ_HASH_BITS 10
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+static uint8_t lz_out[ZSWAP_MAX_LEN];
+
+static size_t lz_compress (const uint8_t *, uint8_t *, size_t max);
+static void lz_decompress (const uint8_t *, size_t len, uint8_t *);
+static struct slab *get_slab (size_t class);
+static uint32_t full_mask (size_t class);
+static void free_object (size_t handle);
+
+/* Sets up the compressed tier. */
+void
+zswap_init (void)
+{
+  size_t i;
+
+  lock_init (&zswap_lock);
+  for (i = 0; i < CLASS_CNT; i++)
+    list_init (&partial[i]);
+  if (zswap_pages > 0)
+    {
+      slabs = calloc (zswap_pages, sizeof *slabs);
+      if (slabs == NULL)
+        PANIC ("cannot allocate compressed swap slabs");
+    }
+}
+
+/* Returns the number of distinct handles, all of which are less
+   than this. */
+size_t
+zswap_handle_cnt (void)
+{
+  return zswap_pages * SLAB_OBJS;
+}
+
+/* Compresses the page at KPAGE into the tier and returns its
+   handle, or ZSWAP_ERROR if it does not compress well enough or
+   the tier is full. */
+size_t
+zswap_store (const void *kpage)
+{
+  struct slab *s;
+  size_t len, class, obj, handle = ZSWAP_ERROR;
+
+  if (zswap_pages == 0)
+    return ZSWAP_ERROR;
+
+  lock_acquire (&zswap_lock);
+  len = lz_compress (kpage, lz_out, ZSWAP_MAX_LEN);
+  if (len > 0)
+    {
+      for (class = 0; class_size[class] < len; class++)
+        continue;
+      s = get_slab (class);
+      if (s != NULL)
+        {
+          for (obj = 0; s->used & (1u << obj); obj++)
+            continue;
+          s->used |= 1u << obj;
+          s->len[obj] = len;
+          memcpy (s->page + obj * class_size[class], lz_out, len);
+          if (s->used == full_mask (class))
+            list_remove (&s->elem);
+          handle = (s - slabs) * SLAB_OBJS + obj;
+        }
+    }
+  if (handle != ZSWAP_ERROR)
+    store_cnt++;
+  else
+    reject_cnt++;
+  lock_release (&zswap_lock);
+  return handle;
+}
+
+/* Decompresses the page with HANDLE into KPAGE and frees HANDLE. */
+void
+zswap_load (size_t handle, void *kpage)
+{
+  struct slab *s = &slabs[handle / SLAB_OBJS];
+  size_t obj = handle % SLAB_OBJS;
+
+  lock_acquire (&zswap_lock);
+  lz_decompress (s->page + obj * class_size[s->class], s->len[obj], kpage);
+  free_object (handle);
+  load_cnt++;
+  lock_release (&zswap_lock);
+}
+
+/* Frees HANDLE without decompressing it. */
+void
+zswap_free (size_t handle)
+{
+  lock_acquire (&zswap_lock);
+  free_object (handle);
+  lock_release (&zswap_lock);
+}
+
+/* Prints compressed tier statistics. */
+void
+zswap_print_stats (void)
+{
+  printf ("Zswap: %lld pages stored, %lld rejected, %lld loaded\n",
+          store_cnt, reject_cnt, load_cnt);
+}
+
+/* Copies the zswap counts into *K. */
+void
+zswap_get_kstat (struct kstat *k)
+{
+  enum intr_level old_level = intr_disable ();
+  k->zswap_stores = store_cnt;
+  k->zswap_rejects = reject_cnt;
+  k->zswap_loads = load_cnt;
+  intr_set_level (old_level);
+}
+
+/* Returns a slab of CLASS with a free object, taking a new page
+   for it if necessary, or a null pointer if the tier is full or
+   memory is short.  zswap_lock must be held. */
+static struct slab *
+get_slab (size_t class)
+{
+  size_t i;
+
+  if (!list_empty (&partial[class]))
+    return list_entry (list_front (&partial[class]), struct slab, elem);
+
+  for (i = 0; i < zswap_pages; i++)
+    if (slabs[i].page == NULL)
+      {
+        struct slab *s = &slabs[i];
+
+        s->page = palloc_get_page (0);
+        if (s->page == NULL)
+          return NULL;
+        s->class = class;
+        s->used = 0;
+        list_push_front (&partial[class], &s->elem);
+        return s;
+      }
+  return NULL;
+}
+
+/* Returns the value of a slab's `used' bitmap when all of its
+   objects of CLASS are in use. */
+static uint32_t
+full_mask (size_t class)
+{
+  size_t objs = PGSIZE / class_size[class];
+  return objs < 32 ? (1u << objs) - 1 : UINT32_MAX;
+}
+
+/* Frees the object with HANDLE, and its slab if that leaves it
+   empty.  zswap_lock must be held. */
+static void
+free_object (size_t handle)
+{
+  struct slab *s = &slabs[handle / SLAB_OBJS];
+  uint32_t bit = 1u << handle % SLAB_OBJS;
+
+  ASSERT (handle < zswap_handle_cnt ());
+  ASSERT (s->page != NULL && (s->used & bit) != 0);
+
+  if (s->used == full_mask (s->class))
+    list_push_front (&partial[s->class], &s->elem);
+  s->used &= ~bit;
+  if (s->used == 0)
+    {
+      list_remove (&s->elem);
+      palloc_free_page (s->page);
+      s->page = NULL;
+    }
+}
+
+/* Hashes the 3 bytes at P. */
+static inline unsigned
+lz_hash (const uint8_t *p)
+{
+  uint32_t x = p[0] | (p[1] << 8) | (p[2] << 16);
+  return (x * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Appends the CNT literal bytes at LIT to the MAX-byte buffer DST,
+   which already holds *OUT bytes.  Returns false if they do not
+   fit. */
+static bool
+lz_literals (const uint8_t *lit, size_t cnt, uint8_t *dst, size_t *out,
+             size_t max)
+{
+  while (cnt > 0)
+    {
+      size_t n = cnt < 128 ? cnt : 128;
+
+      if (*out + 1 + n > max)
+        return false;
+      dst[(*out)++] = n - 1;
+      memcpy (dst + *out, lit, n);
+      *out += n;
+      lit += n;
+      cnt -= n;
+    }
+  return true;
+}
+
+/* Compresses the page at SRC into DST, which has room for MAX
+   bytes.  Returns the compressed length, or 0 if it exceeds MAX.
+   Uses lz_table, so zswap_lock must be held. */
+static size_t
+lz_compress (const uint8_t *src, uint8_t *dst, size_t max)
+{
+  size_t in = 0, lit = 0, out = 0;
+
+  memset (lz_table, 0, sizeof lz_table);
+  while (in + 3 <= PGSIZE)
+    {
+      unsigned h = lz_hash (src + in);
+      size_t cand = lz_table[h];
+
+      lz_table[h] = in;
+      if (cand < in && !memcmp (src + cand, src + in, 3))
+        {
+          size_t len = 3, dist = in - cand;
+
+          while (in + len < PGSIZE && len < 127 + 3
+                 && src[cand + len] == src[in + len])
+            len++;
+          if (!lz_literals (src + lit, in - lit, dst, &out, max)
+              || out + 3 > max)
+            return 0;
+          dst[out++] = 0x80 | (len - 3);
+          dst[out++] = dist & 0xff;
+          dst[out++] = dist >> 8;
+          in += len;
+          lit = in;
+        }
+      else
+        in++;
+    }
+  if (!lz_literals (src + lit, PGSIZE - lit, dst, &out, max))
+    return 0;
+  return out;
+}
+
+/* Decompresses the LEN bytes at SRC, which lz_compress() produced,
+   into the page at DST. */
+static void
+lz_decompress (const uint8_t *src, size_t len, uint8_t *dst)
+{
+  const uint8_t *end = src + len;
+  size_t out = 0;
+
+  while (src < end)
+    {
+      size_t token = *src++;
+
+      if (token & 0x80)
+        {
+          size_t n = (token & 0x7f) + 3;
+          size_t dist = src[0] | (src[1] << 8);
+
+          src += 2;
+          ASSERT (dist > 0 && dist <= out && out + n <= PGSIZE);
+          for (; n > 0; n--, out++)
+            dst[out] = dst[out - dist];
+        }
+      else
+        {
+          size_t n = token + 1;
+
+          ASSERT (out + n <= PGSIZE);
+          memcpy (dst + out, src, n);
+          src += n;
+          out += n;
+        }
+    }
+  ASSERT (out == PGSIZE);
+}
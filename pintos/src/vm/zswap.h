@@ -0,0 +1,26 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct kstat;
+
+/* Returned by zswap_store() when a page cannot be stored. */
+#define ZSWAP_ERROR ((size_t) -1)
+
+/* Most kernel pages to spend on compressed pages.  Controlled by
+   kernel command-line option "-zswap=PAGES"; 0 disables the
+   compressed tier. */
+#define ZSWAP_PAGES_DEFAULT 64
+extern size_t zswap_pages;
+
+void zswap_init (void);
+size_t zswap_handle_cnt (void);
+size_t zswap_store (const void *kpage);
+void zswap_load (size_t handle, void *kpage);
+void zswap_free (size_t handle);
+void zswap_print_stats (void);
+void zswap_get_kstat (struct kstat *);
+
+#endif /* vm/zswap.h */